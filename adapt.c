@@ -0,0 +1,101 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+
+#include "adapt.h"
+#include "admission.h"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double clamp(const AdaptLimit *a, double limit) {
+    if (limit < a->o.min_limit) {
+        return a->o.min_limit;
+    }
+    return limit > a->o.max_limit ? a->o.max_limit : limit;
+}
+
+int init_AdaptLimit(AdaptLimit *a, const AdaptOptions *o, int start) {
+    memset(a, 0, sizeof(*a));
+    if (o != NULL) {
+        a->o = *o;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    a->cpus = cpus > 0 ? cpus : 1;
+    if (a->o.min_limit <= 0) {
+        a->o.min_limit = 1;
+    }
+    if (a->o.max_limit <= 0) {
+        a->o.max_limit = 8 * a->cpus;
+    }
+    if (a->o.max_limit < a->o.min_limit) {
+        a->o.max_limit = a->o.min_limit;
+    }
+    if (a->o.window_ms <= 0) {
+        a->o.window_ms = ADAPT_WINDOW_MS;
+    }
+    if (a->o.mem_pressure == 0) {
+        a->o.mem_pressure = ADAPT_MEM_PRESSURE;
+    }
+    if (a->o.runq_per_cpu == 0) {
+        a->o.runq_per_cpu = ADAPT_RUNQ_PER_CPU;
+    }
+    a->mem_fd = a->o.mem_pressure > 0 ? open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC) : -1;
+    a->limit = clamp(a, start > 0 ? start : a->cpus);
+    a->window_start_ns = now_ns();
+    return 0;
+}
+
+void close_AdaptLimit(AdaptLimit *a) {
+    if (a->mem_fd >= 0) {
+        close(a->mem_fd);
+        a->mem_fd = -1;
+    }
+}
+
+static bool overloaded(const AdaptLimit *a) {
+    long runnable;
+
+    if (a->mem_fd >= 0 && read_pressure(a->mem_fd) > a->o.mem_pressure) {
+        return true;
+    }
+    // /proc/loadavg counts the runnable tasks of the whole host, us included
+    return a->o.runq_per_cpu > 0 && read_tasks(&runnable, NULL) == 0 &&
+        runnable - 1 > a->o.runq_per_cpu * a->cpus;
+}
+
+int complete_AdaptLimit(AdaptLimit *a, bool queued) {
+    uint64_t now = now_ns(), elapsed = now - a->window_start_ns;
+
+    a->completions++;
+    a->saturated |= queued;
+    if (elapsed < a->o.window_ms * 1000000ull || a->completions < ADAPT_MIN_SAMPLES) {
+        return (int)a->limit;
+    }
+    double tput = a->completions * 1e9 / elapsed;
+    AdaptAction act = ADAPT_HOLD;
+    if (overloaded(a)) {
+        act = ADAPT_BACK_OFF;
+        a->limit = clamp(a, a->limit * 2 / 3);
+        a->n_back_offs++;
+    } else if (a->last == ADAPT_GROW && tput < a->prev_tput * 0.95) {
+        act = ADAPT_UNDO; // past the knee: the extra slot only added contention
+        a->limit = clamp(a, a->limit - 1);
+    } else if (a->saturated && a->last != ADAPT_UNDO) {
+        act = ADAPT_GROW;
+        a->limit = clamp(a, a->limit + 1);
+    }
+    a->last = act;
+    a->prev_tput = tput;
+    a->completions = 0;
+    a->saturated = false;
+    a->window_start_ns = now;
+    a->n_windows++;
+    return (int)a->limit;
+}
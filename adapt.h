@@ -0,0 +1,55 @@
+#ifndef ADAPT_H
+#define ADAPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ADAPT_WINDOW_MS 250     // default sampling window
+#define ADAPT_MIN_SAMPLES 4     // completions a window needs before it counts
+#define ADAPT_MEM_PRESSURE 10.0 // default memory "some avg10" (%) to back off at
+#define ADAPT_RUNQ_PER_CPU 2.0  // default runnable tasks per CPU to back off at
+
+// 0 picks the default; negative thresholds are ignored
+typedef struct {
+    int min_limit;          // floor, 0 for 1
+    int max_limit;          // ceiling, 0 for 8 per CPU
+    int window_ms;
+    double mem_pressure;
+    double runq_per_cpu;
+} AdaptOptions;
+
+typedef enum {
+    ADAPT_HOLD = 0,
+    ADAPT_GROW,             // the last window added a slot
+    ADAPT_UNDO,             // the last growth cost throughput and was taken back
+    ADAPT_BACK_OFF          // memory pressure or a long run queue cut the limit
+} AdaptAction;
+
+// in-flight limit found at runtime, AIMD steered by a throughput gradient:
+// each window that kept every slot busy adds a slot while completions/s
+// keep up, takes it back once they drop after growing, and cuts the limit
+// by a third under memory pressure or a run queue over runq_per_cpu
+typedef struct {
+    AdaptOptions o;
+    int cpus;
+    int mem_fd;             // /proc/pressure/memory, -1 without PSI
+    double limit;
+    uint64_t window_start_ns;
+    size_t completions;     // in this window
+    bool saturated;         // this window, a completion found jobs queued
+    double prev_tput;       // completions/s of the last window
+    AdaptAction last;
+    // counters
+    size_t n_windows;
+    size_t n_back_offs;
+} AdaptLimit;
+
+// o may be NULL; start is the first limit
+int init_AdaptLimit(AdaptLimit *a, const AdaptOptions *o, int start);
+void close_AdaptLimit(AdaptLimit *a);
+// count a completion; queued: jobs were waiting for a slot. Returns the
+// limit to use from now on
+int complete_AdaptLimit(AdaptLimit *a, bool queued);
+
+#endif // ADAPT_H
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "admission.h"
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000};
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+static ssize_t read_at0(int fd, char *buf, size_t len) {
+    ssize_t n = pread(fd, buf, len - 1, 0);
+    if (n < 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+double read_pressure(int fd) {
+    char buf[256];
+    double avg10 = 0;
+
+    if (read_at0(fd, buf, sizeof(buf)) < 0 || sscanf(buf, "some avg10=%lf", &avg10) != 1) {
+        return 0;
+    }
+    return avg10;
+}
+
+// "0.10 0.20 0.30 2/345 6789": runnable/total
+int read_tasks(long *runnable, long *total) {
+    char buf[128];
+    long r = 0, t = 0;
+    int fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC), rc = 0;
+
+    if (fd < 0) {
+        return 1;
+    }
+    if (read_at0(fd, buf, sizeof(buf)) < 0 || sscanf(buf, "%*f %*f %*f %ld/%ld", &r, &t) != 2) {
+        rc = 1;
+    }
+    close(fd);
+    if (runnable != NULL) {
+        *runnable = r;
+    }
+    if (total != NULL) {
+        *total = t;
+    }
+    return rc;
+}
+
+// the tighter of RLIMIT_NPROC and the kernel's threads-max
+static long task_limit(void) {
+    struct rlimit rl;
+    char buf[32];
+    long limit = 0;
+    int fd = open("/proc/sys/kernel/threads-max", O_RDONLY | O_CLOEXEC);
+
+    if (fd >= 0) {
+        if (read_at0(fd, buf, sizeof(buf)) > 0) {
+            limit = strtol(buf, NULL, 10);
+        }
+        close(fd);
+    }
+    if (getrlimit(RLIMIT_NPROC, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY &&
+            (limit == 0 || (long)rl.rlim_cur < limit)) {
+        limit = rl.rlim_cur;
+    }
+    return limit;
+}
+
+int init_Admission(Admission *a, const AdmitOptions *o) {
+    memset(a, 0, sizeof(*a));
+    if (o != NULL) {
+        a->o = *o;
+    }
+    if (a->o.poll_ms <= 0) {
+        a->o.poll_ms = ADMIT_POLL_MS;
+    }
+    if (a->o.backoff_ms <= 0) {
+        a->o.backoff_ms = ADMIT_BACKOFF_MS;
+    }
+    a->cpu_fd = a->mem_fd = -1;
+    if (a->o.cpu_pressure > 0) {
+        a->cpu_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+    }
+    if (a->o.mem_pressure > 0) {
+        a->mem_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    }
+    if (a->o.nproc_pct > 0) {
+        a->nproc_limit = task_limit();
+    }
+    pthread_mutex_init(&a->lock, NULL);
+    return 0;
+}
+
+void close_Admission(Admission *a) {
+    if (a->cpu_fd >= 0) {
+        close(a->cpu_fd);
+    }
+    if (a->mem_fd >= 0) {
+        close(a->mem_fd);
+    }
+    a->cpu_fd = a->mem_fd = -1;
+    pthread_mutex_destroy(&a->lock);
+}
+
+static bool overloaded(Admission *a) {
+    if (a->cpu_fd >= 0 && read_pressure(a->cpu_fd) > a->o.cpu_pressure) {
+        return true;
+    }
+    if (a->mem_fd >= 0 && read_pressure(a->mem_fd) > a->o.mem_pressure) {
+        return true;
+    }
+    long tasks;
+    if (a->nproc_limit > 0 && read_tasks(NULL, &tasks) == 0 && tasks * 100 > a->nproc_limit * a->o.nproc_pct) {
+        return true;
+    }
+    return false;
+}
+
+int poll_Admission(Admission *a, int *wait_ms) {
+    int rc = 0;
+
+    pthread_mutex_lock(&a->lock);
+    uint64_t now = now_ns();
+    if (a->sampled_ns == 0 || now - a->sampled_ns >= ADMIT_SAMPLE_MS * 1000000ull) {
+        a->sampled_ns = now;
+        if (!overloaded(a)) {
+            a->over_since_ns = 0;
+        } else if (a->over_since_ns == 0) {
+            a->over_since_ns = now;
+        }
+    }
+    if (a->over_since_ns != 0) {
+        if (a->o.max_delay_ms > 0 && now - a->over_since_ns >= a->o.max_delay_ms * 1000000ull) {
+            a->n_shed++;
+            rc = EBUSY;
+        } else {
+            a->n_held++;
+            *wait_ms = a->o.poll_ms;
+            rc = EAGAIN;
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+    return rc;
+}
+
+int backoff_Admission(Admission *a, int attempt) {
+    static __thread unsigned seed;
+
+    if (attempt >= a->o.eagain_retries) {
+        return -1;
+    }
+    if (seed == 0) {
+        seed = (unsigned)now_ns() ^ (unsigned)gettid();
+    }
+    long d = a->o.backoff_ms;
+    for (int i = 0; i < attempt && d < ADMIT_BACKOFF_MAX_MS; i++) {
+        d *= 2;
+    }
+    if (d > ADMIT_BACKOFF_MAX_MS) {
+        d = ADMIT_BACKOFF_MAX_MS;
+    }
+    // somewhere in the upper half, so retries of one storm spread out
+    d = d / 2 + rand_r(&seed) % (d / 2 + 1);
+    __atomic_add_fetch(&a->n_retried, 1, __ATOMIC_RELAXED);
+    return (int)d;
+}
+
+int spawn_Admission(Admission *a, SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]) {
+    int rc, wait_ms, d;
+
+    for (int attempt = 0;; attempt++) {
+        while (a != NULL && (rc = poll_Admission(a, &wait_ms)) == EAGAIN) {
+            sleep_ms(wait_ms);
+        }
+        if (a != NULL && rc != 0) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_ADMISSION, -1, rc, 0, args[0]);
+        }
+        rc = st != NULL ? spawn_SpawnTemplate(st, ci, args, env) : subprocess(ci, args, env);
+        if (a == NULL || !retryable_spawn(ci, rc) || (d = backoff_Admission(a, attempt)) < 0) {
+            return rc;
+        }
+        sleep_ms(d);
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "subprocess.h"
+
+#define ADMIT_SAMPLE_MS 100     // the load is read at most this often
+#define ADMIT_POLL_MS 50        // default recheck interval while held back
+#define ADMIT_BACKOFF_MS 10     // default first EAGAIN retry delay
+#define ADMIT_BACKOFF_MAX_MS 2000
+
+// thresholds are off at 0
+typedef struct {
+    double cpu_pressure;    // hold spawns while /proc/pressure/cpu "some avg10" is above this (%)
+    double mem_pressure;    // same for /proc/pressure/memory
+    int nproc_pct;          // hold spawns while tasks exceed this % of RLIMIT_NPROC (or threads-max)
+    int poll_ms;            // recheck interval while held back, 0 for ADMIT_POLL_MS
+    int max_delay_ms;       // shed (EBUSY) once the load stayed over this long, 0 to wait it out
+    int eagain_retries;     // retry spawns that failed with EAGAIN this many times
+    int backoff_ms;         // first retry delay, doubled per retry and jittered, 0 for ADMIT_BACKOFF_MS
+} AdmitOptions;
+
+// admission control for spawn storms: pressure stall information and the
+// task count against its limit are sampled (cached for ADMIT_SAMPLE_MS),
+// spawns wait while one is over its threshold and are shed once that lasted
+// max_delay_ms. The task count is /proc/loadavg's, every task of the host:
+// an upper bound on the ones RLIMIT_NPROC counts. Thread-safe
+typedef struct {
+    AdmitOptions o;
+    int cpu_fd;             // -1 without PSI
+    int mem_fd;
+    long nproc_limit;       // 0 without a limit
+    pthread_mutex_t lock;
+    uint64_t sampled_ns;
+    uint64_t over_since_ns; // 0 while under every threshold
+    // counters
+    size_t n_held;          // polls answered with a delay
+    size_t n_shed;
+    size_t n_retried;       // EAGAIN spawns retried
+} Admission;
+
+// "some avg10" (%) of an open /proc/pressure file, 0 if unreadable
+double read_pressure(int fd);
+// runnable and total tasks of the host from /proc/loadavg; either may be NULL
+int read_tasks(long *runnable, long *total);
+
+// o NULL or thresholds whose source is missing (no PSI) are off
+int init_Admission(Admission *a, const AdmitOptions *o);
+void close_Admission(Admission *a);
+// 0 to spawn now, EAGAIN to ask again in *wait_ms, EBUSY to shed the spawn
+int poll_Admission(Admission *a, int *wait_ms);
+// jittered delay before retry attempt (from 0) of a spawn, -1 once out of retries
+int backoff_Admission(Admission *a, int attempt);
+// whether subprocess() failing with rc on ci is worth a retry
+static inline bool retryable_spawn(const ProcInfo *ci, int rc) {
+    return rc == EAGAIN && ci->err.stage == SPAWN_STAGE_EXEC;
+}
+// blocking: wait for admission, spawn with st (NULL for subprocess()) and
+// retry EAGAIN; a shed spawn fails with EBUSY at SPAWN_STAGE_ADMISSION.
+// a NULL spawns right away
+int spawn_Admission(Admission *a, SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]);
+
+#endif // ADMISSION_H
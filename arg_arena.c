@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "arg_arena.h"
+#include "subprocess.h"
+
+#define ARG_ARENA_MIN 4096
+
+static ArgChunk *new_chunk(size_t cap) {
+    ArgChunk *c = malloc(sizeof(ArgChunk) + cap);
+    if (c != NULL) {
+        c->next = NULL;
+        c->cap = cap;
+        c->used = 0;
+    }
+    return c;
+}
+
+// size bytes aligned to align from the current block, chaining a new one if needed
+static void *alloc(ArgArena *a, size_t size, size_t align) {
+    ArgChunk *c = a->cur;
+    size_t off = (c->used + align - 1) & ~(align - 1);
+
+    if (off + size > c->cap) {
+        // a later vector must not move earlier ones: chain, never realloc
+        size_t cap = c->cap * 2 > size + align ? c->cap * 2 : size + align;
+        ArgChunk *n = new_chunk(cap);
+        if (n == NULL) {
+            return NULL;
+        }
+        c->next = n;
+        a->cur = c = n;
+        off = 0;
+    }
+    a->used += off - c->used + size;
+    c->used = off + size;
+    return c->data + off;
+}
+
+static int add_pending(ArgArena *a, char *s) {
+    if (a->n_pending == a->cap_pending) {
+        size_t cap = a->cap_pending ? a->cap_pending * 2 : 16;
+        char **p = realloc(a->pending, cap * sizeof(char *));
+        if (p == NULL) {
+            return 1;
+        }
+        a->pending = p;
+        a->cap_pending = cap;
+    }
+    a->pending[a->n_pending++] = s;
+    return 0;
+}
+
+int init_ArgArena(ArgArena *a, size_t hint) {
+    memset(a, 0, sizeof(*a));
+    a->head = a->cur = new_chunk(hint > ARG_ARENA_MIN ? hint : ARG_ARENA_MIN);
+    if (a->head == NULL) {
+        showError(false, "Failed to allocate argument arena!");
+        return 1;
+    }
+    return 0;
+}
+
+void free_ArgArena(ArgArena *a) {
+    for (ArgChunk *c = a->head, *next; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(a->pending);
+    memset(a, 0, sizeof(*a));
+}
+
+void reset_ArgArena(ArgArena *a) {
+    if (a->head->next != NULL) {
+        // spilled last round: one block that holds it all next time
+        ArgChunk *big = new_chunk(a->used + a->used / 2);
+        if (big != NULL) {
+            for (ArgChunk *c = a->head, *next; c != NULL; c = next) {
+                next = c->next;
+                free(c);
+            }
+            a->head = big;
+        }
+    }
+    a->head->used = 0;
+    a->cur = a->head;
+    a->n_pending = 0;
+    a->used = 0;
+}
+
+int push_ArgArena(ArgArena *a, const char *s) {
+    size_t len = strlen(s) + 1;
+    char *dst = alloc(a, len, 1);
+
+    if (dst == NULL || add_pending(a, dst)) {
+        return 1;
+    }
+    memcpy(dst, s, len);
+    return 0;
+}
+
+int pushf_ArgArena(ArgArena *a, const char *fmt, ...) {
+    ArgChunk *c = a->cur;
+    size_t room = c->cap - c->used;
+    va_list args;
+
+    // format straight into the free tail, copy only if it didn't fit
+    va_start(args, fmt);
+    int len = vsnprintf(c->data + c->used, room, fmt, args);
+    va_end(args);
+    if (len < 0) {
+        return 1;
+    }
+    if ((size_t)len < room) {
+        return add_pending(a, alloc(a, len + 1, 1));
+    }
+    char *dst = alloc(a, len + 1, 1);
+    if (dst == NULL || add_pending(a, dst)) {
+        return 1;
+    }
+    va_start(args, fmt);
+    vsnprintf(dst, len + 1, fmt, args);
+    va_end(args);
+    return 0;
+}
+
+int push_all_ArgArena(ArgArena *a, char* const vec[]) {
+    for (size_t i = 0; vec != NULL && vec[i] != NULL; i++) {
+        if (push_ArgArena(a, vec[i])) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+char **finish_ArgArena(ArgArena *a) {
+    char **vec = alloc(a, (a->n_pending + 1) * sizeof(char *), _Alignof(char *));
+
+    if (vec == NULL) {
+        a->n_pending = 0;
+        return NULL;
+    }
+    memcpy(vec, a->pending, a->n_pending * sizeof(char *));
+    vec[a->n_pending] = NULL;
+    a->n_pending = 0;
+    return vec;
+}
@@ -0,0 +1,41 @@
+#ifndef ARG_ARENA_H
+#define ARG_ARENA_H
+
+#include <stddef.h>
+
+// one block of arena memory; blocks never move once handed out
+typedef struct ArgChunk {
+    struct ArgChunk *next;
+    size_t cap;
+    size_t used;
+    char data[];
+} ArgChunk;
+
+// builds argv/envp vectors for subprocess(): strings and the NULL-terminated
+// pointer array are carved out of one block, so a vector costs no mallocs
+// once the arena is warm. A reset is O(1); when the last round spilled into
+// extra blocks, the reset folds them into one block big enough for all of it
+typedef struct {
+    ArgChunk *head;         // first block, kept across resets
+    ArgChunk *cur;          // block being filled
+    char **pending;         // strings of the vector being built
+    size_t n_pending;
+    size_t cap_pending;
+    size_t used;            // bytes handed out since the last reset
+} ArgArena;
+
+// hint: bytes to reserve up front, 0 for a small default
+int init_ArgArena(ArgArena *a, size_t hint);
+void free_ArgArena(ArgArena *a);
+// drop every vector built so far; their pointers become invalid
+void reset_ArgArena(ArgArena *a);
+// append a string (or a printf-formatted one) to the vector being built
+int push_ArgArena(ArgArena *a, const char *s);
+int pushf_ArgArena(ArgArena *a, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// append every string of a NULL-terminated vector, e.g. environ
+int push_all_ArgArena(ArgArena *a, char* const vec[]);
+// close the vector being built and return it NULL-terminated, NULL on ENOMEM
+// the vector stays valid until the next reset, later vectors don't move it
+char **finish_ArgArena(ArgArena *a);
+
+#endif // ARG_ARENA_H
@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "path_cache.h"
+
+#define BATCH_MAX_THREADS 64
+
+typedef struct {
+    ProcInfo *cis;
+    char ***argvs;
+    char **env;
+    int *results;
+    Admission *admission;
+    size_t lo;
+    size_t hi;
+    size_t failed;
+} BatchRange;
+
+static bool same_path(const char *a, const char *b) {
+    return a == b || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static bool same_shape(const ProcInfo *a, const ProcInfo *b) {
+    return a->stdin_type == b->stdin_type && a->stdout_type == b->stdout_type &&
+        a->stderr_type == b->stderr_type && a->close_fds == b->close_fds &&
+        same_path(a->f_stdin, b->f_stdin) && same_path(a->f_stdout, b->f_stdout) &&
+        same_path(a->f_stderr, b->f_stderr) && a->path_append == b->path_append;
+}
+
+static void *spawn_range(void *arg) {
+    BatchRange *r = arg;
+    SpawnTemplate st;
+    const ProcInfo *shape = NULL;
+    const char *name = NULL;
+    char exe[PATH_MAX];
+    bool have_exe = false;
+
+    for (size_t i = r->lo; i < r->hi; i++) {
+        ProcInfo *ci = &r->cis[i];
+        char **args = r->argvs[i];
+        if (shape == NULL || !same_shape(shape, ci)) {
+            if (shape != NULL) {
+                close_SpawnTemplate(&st);
+            }
+            shape = NULL;
+            if (init_SpawnTemplate(&st, ci)) {
+                r->results[i] = 1;
+                r->failed++;
+                continue;
+            }
+            shape = ci;
+            name = NULL; // the template lost its exe
+        }
+        if (name == NULL || strcmp(name, args[0]) != 0) {
+            name = args[0];
+            have_exe = resolve_path(name, exe, sizeof(exe));
+        }
+        st.exe = have_exe ? exe : NULL;
+        r->results[i] = spawn_Admission(r->admission, &st, ci, args, r->env);
+        if (r->results[i] != 0) {
+            r->failed++;
+        }
+    }
+    if (shape != NULL) {
+        close_SpawnTemplate(&st);
+    }
+    return NULL;
+}
+
+size_t subprocess_batch(ProcInfo *cis, char** argvs[], size_t n, char* env[],
+        int *results, int n_threads) {
+    return subprocess_batch_admitted(cis, argvs, n, env, results, n_threads, NULL);
+}
+
+size_t subprocess_batch_admitted(ProcInfo *cis, char** argvs[], size_t n, char* env[],
+        int *results, int n_threads, Admission *a) {
+    BatchRange ranges[BATCH_MAX_THREADS];
+    pthread_t threads[BATCH_MAX_THREADS];
+    size_t failed = 0;
+
+    if (n_threads < 1) {
+        n_threads = 1;
+    }
+    if (n_threads > BATCH_MAX_THREADS) {
+        n_threads = BATCH_MAX_THREADS;
+    }
+    if ((size_t)n_threads > n) {
+        n_threads = n ? n : 1;
+    }
+    for (int t = 0; t < n_threads; t++) {
+        ranges[t] = (BatchRange){.cis = cis, .argvs = argvs, .env = env, .results = results,
+            .admission = a, .lo = n * t / n_threads, .hi = n * (t + 1) / n_threads};
+    }
+    // the calling thread takes the first range itself
+    int started = 1;
+    for (int t = 1; t < n_threads; t++, started++) {
+        if (pthread_create(&threads[t], NULL, spawn_range, &ranges[t])) {
+            break;
+        }
+    }
+    for (int t = started; t < n_threads; t++) { // couldn't get a thread: do it here
+        spawn_range(&ranges[t]);
+    }
+    spawn_range(&ranges[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    for (int t = 0; t < n_threads; t++) {
+        failed += ranges[t].failed;
+    }
+    return failed;
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+#include "subprocess.h"
+#include "admission.h"
+
+// spawn n jobs in one call: cis[i] runs argvs[i], results[i] receives the
+// per-job subprocess() rc. Jobs sharing a stream shape reuse one SpawnTemplate
+// and jobs sharing argv[0] one PATH lookup. With n_threads > 1 the jobs are
+// split into contiguous ranges spawned in parallel.
+// returns the number of jobs that failed to spawn
+size_t subprocess_batch(ProcInfo *cis, char** argvs[], size_t n, char* env[],
+    int *results, int n_threads);
+// the same, every spawn first admitted by a (see spawn_Admission()); shed
+// jobs get EBUSY in results
+size_t subprocess_batch_admitted(ProcInfo *cis, char** argvs[], size_t n, char* env[],
+    int *results, int n_threads, Admission *a);
+
+#endif // BATCH_H
@@ -0,0 +1,209 @@
+// capture-path benchmark: wall time and parent CPU time of draining a
+// child's stdout in different ways, across output and pipe sizes, as CSV
+//
+// usage: capture_bench [bytes ...]   (default 1M 100M 1G; k/M/G suffixes)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "subprocess.h"
+#include "capture.h"
+#include "uring.h"
+
+#define BIG_READ (64 * 1024)
+#define MEMFD_MAX (1ULL << 30)  // memfd output lives in RAM, skip beyond this
+#define RING_LIMIT (1 << 20)    // run_and_capture() keeps the last 1 MB
+
+extern char **environ;
+
+typedef struct {
+    double wall_ms;
+    double cpu_ms;  // the parent's own CPU, the child's is not counted
+    size_t bytes;
+} Sample;
+
+static inline double now_ms(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// a child writing exactly bytes to stdout
+static int spawn_writer(ProcInfo *ci, size_t bytes, ProcComType out, int pipe_size) {
+    static char count[32];
+    static char *args[] = {"head", "-c", count, "/dev/zero", NULL};
+
+    snprintf(count, sizeof(count), "%zu", bytes);
+    *ci = (ProcInfo){.p_stdin=-1, .p_stdout=-1, .p_stderr=-1};
+    ci->stdout_type = out;
+    ci->sz_stdout = pipe_size;
+    return subprocess(ci, args, environ);
+}
+
+static size_t read_loop(int fd, size_t bufsz) {
+    char *buf = malloc(bufsz);
+    size_t total = 0;
+    ssize_t n;
+    while ((n = read(fd, buf, bufsz)) > 0 || (n < 0 && errno == EINTR)) {
+        total += n > 0 ? n : 0;
+    }
+    free(buf);
+    return total;
+}
+
+// main()'s loop
+static size_t drain_read128(ProcInfo *ci) {
+    return read_loop(ci->p_stdout, 128);
+}
+
+static size_t drain_read64k(ProcInfo *ci) {
+    return read_loop(ci->p_stdout, BIG_READ);
+}
+
+static size_t drain_splice(ProcInfo *ci) {
+    int out = open("/tmp", O_TMPFILE | O_RDWR, 0600);
+    size_t total = 0;
+    ssize_t n;
+    if (out < 0) {
+        return 0;
+    }
+    while ((n = splice(ci->p_stdout, NULL, out, NULL, 1 << 20, SPLICE_F_MOVE)) > 0 ||
+           (n < 0 && errno == EINTR)) {
+        total += n > 0 ? n : 0;
+    }
+    close(out);
+    return total;
+}
+
+static size_t drain_uring(ProcInfo *ci) {
+    Uring r;
+    char *buf = malloc(BIG_READ);
+    size_t total = 0;
+    if (init_Uring(&r, 8)) {
+        free(buf);
+        return 0;
+    }
+    for (;;) {
+        struct io_uring_sqe *sqe = get_sqe_Uring(&r);
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = ci->p_stdout;
+        sqe->addr = (unsigned long)buf;
+        sqe->len = BIG_READ;
+        sqe->off = -1; // current position: pipes have none
+        if (submit_Uring(&r, 1, -1) < 0) {
+            break;
+        }
+        struct io_uring_cqe *cqe = peek_Uring(&r);
+        int res = cqe ? cqe->res : -EIO;
+        seen_Uring(&r);
+        if (res == -EINTR || res == -EAGAIN) {
+            continue;
+        }
+        if (res <= 0) {
+            break;
+        }
+        total += res;
+    }
+    close_Uring(&r);
+    free(buf);
+    return total;
+}
+
+typedef struct {
+    const char *name;
+    ProcComType out;
+    size_t (*drain)(ProcInfo *ci); // NULL: the variant has its own run
+    bool sized;                    // honors the pipe size
+} Variant;
+
+static Variant variants[] = {
+    {"read128", PROC_COM_PIPE, drain_read128, true},
+    {"read64k", PROC_COM_PIPE, drain_read64k, true},
+    {"splice", PROC_COM_PIPE, drain_splice, true},
+    {"uring", PROC_COM_PIPE, drain_uring, true},
+    {"capture", PROC_COM_CAPTURE, NULL, true},
+    {"memfd", PROC_COM_MEMFD, NULL, false},
+};
+
+// output is only touched as far as the variant must to have it available
+static int run_variant(const Variant *v, size_t bytes, int pipe_size, Sample *s) {
+    ProcInfo ci;
+    double w0 = now_ms(CLOCK_MONOTONIC), c0 = now_ms(CLOCK_PROCESS_CPUTIME_ID);
+    int rc = 0;
+
+    s->bytes = 0;
+    if (v->out == PROC_COM_CAPTURE) {
+        static char count[32];
+        char *args[] = {"head", "-c", count, "/dev/zero", NULL};
+        CaptureResult res = {.out.limit = RING_LIMIT};
+        snprintf(count, sizeof(count), "%zu", bytes);
+        ci = (ProcInfo){.p_stdin=-1, .p_stdout=-1, .p_stderr=-1};
+        ci.stdout_type = PROC_COM_CAPTURE;
+        ci.sz_stdout = pipe_size;
+        rc = run_and_capture(&ci, args, environ, &res);
+        s->bytes = res.out.total;
+        free_CaptureResult(&res);
+        close_ProcInfo(&ci);
+    } else if (spawn_writer(&ci, bytes, v->out, pipe_size)) {
+        return 1;
+    } else if (v->out == PROC_COM_MEMFD) {
+        size_t len;
+        waitpid(ci.pid, NULL, 0);
+        const char *data = map_memfd(ci.p_stdout, &len);
+        s->bytes = len;
+        unmap_memfd(data, len);
+        close_ProcInfo(&ci);
+    } else {
+        s->bytes = v->drain(&ci);
+        waitpid(ci.pid, NULL, 0);
+        close_ProcInfo(&ci);
+    }
+    s->wall_ms = now_ms(CLOCK_MONOTONIC) - w0;
+    s->cpu_ms = now_ms(CLOCK_PROCESS_CPUTIME_ID) - c0;
+    return rc != 0 || s->bytes != bytes;
+}
+
+static size_t parse_size(const char *s) {
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'G': case 'g': n <<= 10; // fallthrough
+    case 'M': case 'm': n <<= 10; // fallthrough
+    case 'K': case 'k': n <<= 10;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    size_t default_sizes[] = {1 << 20, 100 << 20, 1 << 30};
+    int pipe_sizes[] = {0, 256 << 10, 1 << 20};
+    int n_sizes = argc > 1 ? argc - 1 : 3;
+
+    printf("variant,bytes,pipe_size,wall_ms,parent_cpu_ms,mb_per_s,ok\n");
+    for (int b = 0; b < n_sizes; b++) {
+        size_t bytes = argc > 1 ? parse_size(argv[b + 1]) : default_sizes[b];
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            if (variants[v].out == PROC_COM_MEMFD && bytes > MEMFD_MAX) {
+                continue;
+            }
+            for (size_t p = 0; p < sizeof(pipe_sizes) / sizeof(pipe_sizes[0]); p++) {
+                if (!variants[v].sized && p > 0) {
+                    break;
+                }
+                Sample s;
+                int fail = run_variant(&variants[v], bytes, pipe_sizes[p], &s);
+                printf("%s,%zu,%d,%.2f,%.2f,%.1f,%d\n", variants[v].name, bytes,
+                    variants[v].sized ? pipe_sizes[p] : 0, s.wall_ms, s.cpu_ms,
+                    s.wall_ms > 0 ? s.bytes / (s.wall_ms * 1e3) : 0.0, !fail);
+                fflush(stdout);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,232 @@
+// event-loop scaling benchmark: N concurrent children each write small
+// timestamped records at a fixed rate; for each backend it measures the
+// dispatch latency (record written to callback run) and the parent's CPU
+// time per event, as CSV
+//
+// usage: event_bench [rate_hz] [records] [children ...]
+//        (default 100 Hz, 20 records each, 10 100 1000 children)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+
+#define MAX_SAMPLES (4 << 20)   // latencies kept for the percentiles
+
+extern char **environ;
+
+typedef struct {
+    size_t n_events;    // callbacks (or poll hits) that read
+    size_t n_records;
+    size_t n_open;      // children whose stdout is still open
+    uint64_t *lat_ns;
+    size_t n_lat;
+} Stats;
+
+static inline uint64_t now_ns(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// child side: wait for the start gate (EOF on stdin), then write one
+// 8-byte CLOCK_MONOTONIC stamp every 1/rate s, starting at a random phase
+static int child_main(int rate, int records) {
+    char c;
+    uint64_t period = 1000000000ULL / (rate > 0 ? rate : 1);
+    while (read(STDIN_FILENO, &c, 1) > 0 || errno == EINTR);
+    srandom(getpid());
+    uint64_t next = now_ns(CLOCK_MONOTONIC) + random() % period;
+    for (int i = 0; i < records; i++) {
+        struct timespec ts = {next / 1000000000ULL, next % 1000000000ULL};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+        uint64_t stamp = now_ns(CLOCK_MONOTONIC);
+        if (write(STDOUT_FILENO, &stamp, sizeof(stamp)) != sizeof(stamp)) {
+            return 1;
+        }
+        next += period;
+    }
+    return 0;
+}
+
+// read what fd has and account its records; false once it hit EOF
+static bool drain(int fd, Stats *s) {
+    uint64_t buf[512];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) {
+        return true;
+    }
+    if (n <= 0) {
+        return false;
+    }
+    uint64_t t = now_ns(CLOCK_MONOTONIC);
+    s->n_events++;
+    // records are 8 bytes and far below PIPE_BUF, so reads never split one
+    for (size_t i = 0; i < (size_t)n / sizeof(uint64_t); i++, s->n_records++) {
+        if (s->n_lat < MAX_SAMPLES) {
+            s->lat_ns[s->n_lat++] = t - buf[i];
+        }
+    }
+    return true;
+}
+
+static void on_ready(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Stats *s = data;
+    if (!drain(fd, s)) {
+        del_EventLoop(loop, fd);
+        close(fd);
+        s->n_open--;
+    }
+}
+
+#define BACKEND_POLL -1    // plain poll(2), outside EventLoop
+
+static const struct {
+    const char *name;
+    int backend;
+} backends[] = {
+    {"poll", BACKEND_POLL}, {"epoll", EVLOOP_EPOLL}, {"io_uring", EVLOOP_IO_URING},
+};
+
+static void run_poll(int *fds, size_t n, Stats *s) {
+    struct pollfd *pfd = malloc(n * sizeof(*pfd));
+    size_t live = n;
+    for (size_t i = 0; i < n; i++) {
+        pfd[i] = (struct pollfd){.fd = fds[i], .events = POLLIN};
+    }
+    while (live > 0) {
+        int ready = poll(pfd, live, -1);
+        for (size_t i = 0; i < live && ready > 0; i++) {
+            if (pfd[i].revents == 0) {
+                continue;
+            }
+            ready--;
+            if (!drain(pfd[i].fd, s)) {
+                close(pfd[i].fd);
+                s->n_open--;
+                pfd[i--] = pfd[--live]; // the moved-in entry is checked next
+            }
+        }
+    }
+    free(pfd);
+}
+
+static void run_loop(int backend, int *fds, size_t n, Stats *s) {
+    EventLoop loop;
+    if (init_EventLoop(&loop, backend)) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (add_EventLoop(&loop, fds[i], POLLIN, on_ready, s)) {
+            close(fds[i]);
+            s->n_open--;
+        }
+    }
+    while (s->n_open > 0 && run_EventLoop(&loop, -1) >= 0);
+    close_EventLoop(&loop);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_case(const char *self, int bi, size_t n, int rate, int records, Stats *s) {
+    char rate_s[16], records_s[16];
+    char *args[] = {(char *)self, "--child", rate_s, records_s, NULL};
+    int gate[2];
+    pid_t *pids = malloc(n * sizeof(pid_t));
+    int *fds = malloc(n * sizeof(int));
+    size_t spawned = 0;
+
+    snprintf(rate_s, sizeof(rate_s), "%d", rate);
+    snprintf(records_s, sizeof(records_s), "%d", records);
+    if (pipe2(gate, O_CLOEXEC)) {
+        return;
+    }
+    for (; spawned < n; spawned++) {
+        ProcInfo ci = {.p_stdin=-1, .p_stdout=-1, .p_stderr=-1};
+        ci.stdin_type = PROC_COM_FD;
+        ci.p_stdin = gate[0];
+        ci.stdout_type = PROC_COM_PIPE;
+        ci.close_fds = true;
+        if (subprocess(&ci, args, environ)) {
+            break;
+        }
+        if (ci.pidfd >= 0) { // children are reaped with waitpid(): save the fd
+            close(ci.pidfd);
+        }
+        pids[spawned] = ci.pid;
+        fds[spawned] = ci.p_stdout;
+    }
+    close(gate[0]);
+    s->n_open = spawned;
+    uint64_t w0 = now_ns(CLOCK_MONOTONIC), c0 = now_ns(CLOCK_PROCESS_CPUTIME_ID);
+    close(gate[1]); // every child starts writing now
+    if (backends[bi].backend == BACKEND_POLL) {
+        run_poll(fds, spawned, s);
+    } else {
+        run_loop(backends[bi].backend, fds, spawned, s);
+    }
+    uint64_t cpu = now_ns(CLOCK_PROCESS_CPUTIME_ID) - c0, wall = now_ns(CLOCK_MONOTONIC) - w0;
+    for (size_t i = 0; i < spawned; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+    qsort(s->lat_ns, s->n_lat, sizeof(uint64_t), cmp_u64);
+    printf("%s,%zu,%d,%zu,%zu,%.1f,%.2f,%.1f,%.1f,%.1f,%zu\n", backends[bi].name, n, rate,
+        s->n_records, s->n_events, wall / 1e6,
+        s->n_events ? cpu / 1e3 / s->n_events : 0.0,
+        s->n_lat ? s->lat_ns[s->n_lat / 2] / 1e3 : 0.0,
+        s->n_lat ? s->lat_ns[(size_t)(s->n_lat * 0.99)] / 1e3 : 0.0,
+        s->n_lat ? s->lat_ns[s->n_lat - 1] / 1e3 : 0.0,
+        n - spawned);
+    fflush(stdout);
+    free(pids);
+    free(fds);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 4 && strcmp(argv[1], "--child") == 0) {
+        return child_main(atoi(argv[2]), atoi(argv[3]));
+    }
+    int rate = argc > 1 ? atoi(argv[1]) : 100;
+    int records = argc > 2 ? atoi(argv[2]) : 20;
+    size_t default_n[] = {10, 100, 1000};
+    int n_cases = argc > 3 ? argc - 3 : 3;
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0) {
+        fprintf(stderr, "cannot find own executable: %s\n", strerror(errno));
+        return 1;
+    }
+    self[len] = '\0';
+    // one pipe per child, plus room for the spawn's transient fds
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    Stats s = {.lat_ns = malloc(MAX_SAMPLES * sizeof(uint64_t))};
+    printf("backend,children,rate_hz,records,events,wall_ms,parent_cpu_us_per_event,"
+        "p50_us,p99_us,max_us,spawn_fails\n");
+    for (int c = 0; c < n_cases; c++) {
+        size_t n = argc > 3 ? strtoull(argv[c + 3], NULL, 10) : default_n[c];
+        for (size_t b = 0; b < sizeof(backends) / sizeof(backends[0]); b++) {
+            s = (Stats){.lat_ns = s.lat_ns};
+            run_case(self, b, n, rate, records, &s);
+        }
+    }
+    free(s.lat_ns);
+    return 0;
+}
@@ -0,0 +1,361 @@
+// workload replay benchmark: plays a trace from start_workload_recording()
+// back open-loop, each child at its recorded offset, through different
+// spawn backends and event loops. Stub children stand in for the real
+// commands: each writes its recorded stdout/stderr byte counts to the same
+// kind of stream and then idles out the rest of its recorded runtime. CSV
+// of spawn latency, how late children started and how long they took
+//
+// usage: replay_bench [trace] [speed]
+//        (no trace: record a synthetic one first; speed 2 plays twice as fast)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "capture.h"
+#include "spawn_server.h"
+#include "workload.h"
+
+#define MAX_LIVE 512            // children at once; later ones wait (and count as late)
+#define SYNTH_CHILDREN 400
+#define STUB_CHUNK (64 * 1024)
+
+extern char **environ;
+
+typedef struct {
+    const char *name;
+    SpawnBackend backend;
+    bool server;
+    EvLoopBackend loop;
+} Setting;
+
+static const Setting settings[] = {
+    {"posix_spawn+epoll", SPAWN_BACKEND_POSIX_SPAWN, false, EVLOOP_EPOLL},
+    {"vfork+epoll", SPAWN_BACKEND_VFORK, false, EVLOOP_EPOLL},
+    {"server+epoll", SPAWN_BACKEND_AUTO, true, EVLOOP_EPOLL},
+    {"posix_spawn+io_uring", SPAWN_BACKEND_POSIX_SPAWN, false, EVLOOP_IO_URING},
+};
+
+typedef struct {
+    ProcInfo ci;
+    const WorkloadRecord *rec;
+    uint64_t due_ns;            // when the trace says it starts
+    int open;                   // pipes not at EOF yet, plus one until it exited
+    uint64_t bytes;
+} Replayed;
+
+typedef struct {
+    uint64_t *spawn_ns;         // by record
+    uint64_t *lag_ns;           // spawned this late
+    uint64_t *done_ns;          // due until reaped
+    size_t n_done;
+    size_t n_fails;
+    size_t n_live;
+    uint64_t bytes;
+} Stats;
+
+static char self[PATH_MAX];
+static char out_path[PATH_MAX];
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void write_zeros(int fd, uint64_t n) {
+    static char buf[STUB_CHUNK];
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n < sizeof(buf) ? n : sizeof(buf));
+        if (w <= 0) {
+            return;
+        }
+        n -= w;
+    }
+}
+
+// child side: the recorded output, then idle until the recorded runtime is up
+static int stub_main(uint64_t out, uint64_t err, uint64_t runtime_us) {
+    uint64_t t0 = now_ns();
+    write_zeros(STDOUT_FILENO, out);
+    write_zeros(STDERR_FILENO, err);
+    uint64_t spent = (now_ns() - t0) / 1000;
+    if (spent < runtime_us) {
+        usleep(runtime_us - spent);
+    }
+    return 0;
+}
+
+static void stub_args(char **args, char bufs[3][24], uint64_t out, uint64_t err, uint64_t runtime_us) {
+    snprintf(bufs[0], 24, "%llu", (unsigned long long)out);
+    snprintf(bufs[1], 24, "%llu", (unsigned long long)err);
+    snprintf(bufs[2], 24, "%llu", (unsigned long long)runtime_us);
+    args[0] = self;
+    args[1] = "--stub";
+    args[2] = bufs[0];
+    args[3] = bufs[1];
+    args[4] = bufs[2];
+    args[5] = NULL;
+}
+
+// the recorded kind of an output stream, as far as a stub can have it
+static ProcComType replay_type(ProcComType t, bool is_stderr) {
+    switch (t) {
+    case PROC_COM_PIPE:
+    case PROC_COM_CAPTURE:
+    case PROC_COM_DUPLEX:
+    case PROC_COM_SOCKET:
+        return PROC_COM_PIPE;
+    case PROC_COM_PATH:
+    case PROC_COM_MEMFD:
+        return t;
+    case PROC_COM_STDOUT:
+        return is_stderr ? PROC_COM_STDOUT : PROC_COM_NONE;
+    default: // inherited or passed fds: nothing the bench should see
+        return PROC_COM_NONE;
+    }
+}
+
+// a synthetic trace: mostly small captured outputs, some files, a few big
+// outputs, arriving every ~2 ms, recorded through the library itself
+static int record_synthetic(const char *path) {
+    char *args[6], bufs[3][24];
+
+    if (start_workload_recording(path)) {
+        return 1;
+    }
+    srandom(1);
+    for (int i = 0; i < SYNTH_CHILDREN; i++) {
+        int kind = random() % 10;
+        uint64_t out = kind < 7 ? random() % 4096 : kind < 9 ? 64 * 1024 : 1 << 20;
+        uint64_t runtime_us = 200 + random() % 3000;
+        ProcInfo ci = {.p_stdin = -1, .p_stdout = -1, .p_stderr = -1};
+        ci.stdout_type = kind == 7 ? PROC_COM_PATH : PROC_COM_CAPTURE;
+        ci.f_stdout = out_path;
+        ci.stderr_type = kind == 8 ? PROC_COM_CAPTURE : PROC_COM_NONE;
+        stub_args(args, bufs, out, kind == 8 ? 512 : 0, runtime_us);
+        if (ci.stdout_type == PROC_COM_CAPTURE) {
+            CaptureResult res = {0};
+            run_and_capture(&ci, args, environ, &res);
+            free_CaptureResult(&res);
+        } else if (subprocess(&ci, args, environ) == 0) {
+            reap_ProcInfo(&ci, NULL, 0);
+            close_ProcInfo(&ci);
+        }
+        usleep(random() % 4000);
+    }
+    stop_workload_recording();
+    return 0;
+}
+
+static void finish(Replayed *r, Stats *s) {
+    if (r->ci.pidfd < 0) { // nothing told the loop it exited
+        reap_ProcInfo(&r->ci, NULL, 0);
+    }
+    s->done_ns[s->n_done++] = now_ns() - r->due_ns;
+    s->bytes += r->bytes;
+    s->n_live--;
+    close_ProcInfo(&r->ci);
+    free(r);
+}
+
+static void on_event(EventLoop *loop, int fd, unsigned revents, void *data) {
+    static char buf[STUB_CHUNK];
+    Replayed *r = data;
+
+    if (fd == r->ci.pidfd) {
+        del_EventLoop(loop, fd);
+        reap_ProcInfo(&r->ci, NULL, 0);
+        r->open--;
+    } else {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n > 0) {
+            r->bytes += n;
+            return;
+        }
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            return;
+        }
+        del_EventLoop(loop, fd);
+        r->open--;
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int cmp_start(const void *a, const void *b) {
+    const WorkloadRecord *x = a, *y = b;
+    return x->start_ns < y->start_ns ? -1 : x->start_ns > y->start_ns;
+}
+
+static double pct_us(uint64_t *v, size_t n, double q) {
+    return n ? v[(size_t)(q * (n - 1))] / 1e3 : 0.0;
+}
+
+static void run_setting(const Setting *set, const WorkloadRecord *recs, size_t n, double speed, Stats *s) {
+    EventLoop loop;
+    Replayed **live = calloc(MAX_LIVE, sizeof(Replayed *));
+    size_t next = 0, n_spawned = 0;
+
+    set_spawn_backend(set->backend);
+    if ((set->server && start_SpawnServer()) || init_EventLoop(&loop, set->loop)) {
+        printf("%s,unavailable\n", set->name);
+        free(live);
+        return;
+    }
+    uint64_t t0 = now_ns();
+    while (next < n || s->n_live > 0) {
+        uint64_t now = now_ns() - t0;
+        for (; next < n && s->n_live < MAX_LIVE && (uint64_t)(recs[next].start_ns / speed) <= now; next++) {
+            const WorkloadRecord *rec = &recs[next];
+            char *args[6], bufs[3][24];
+            Replayed *r = calloc(1, sizeof(Replayed));
+            r->rec = rec;
+            r->due_ns = t0 + (uint64_t)(rec->start_ns / speed);
+            r->ci = (ProcInfo){.p_stdin = -1, .p_stdout = -1, .p_stderr = -1};
+            r->ci.stdin_type = PROC_COM_NONE;
+            r->ci.stdout_type = replay_type(rec->types[STDOUT_FILENO], false);
+            r->ci.stderr_type = replay_type(rec->types[STDERR_FILENO], true);
+            r->ci.f_stdout = r->ci.f_stderr = out_path;
+            r->ci.close_fds = true;
+            stub_args(args, bufs, rec->out_bytes[0], rec->out_bytes[1], rec->runtime_ns / speed / 1000);
+            uint64_t a = now_ns();
+            int rc = subprocess(&r->ci, args, environ);
+            uint64_t b = now_ns();
+            if (rc != 0 || watch_ProcInfo(&loop, &r->ci, on_event, r)) {
+                if (rc == 0) {
+                    kill(r->ci.pid, SIGKILL);
+                    reap_ProcInfo(&r->ci, NULL, 0);
+                }
+                close_ProcInfo(&r->ci);
+                free(r);
+                s->n_fails++;
+                continue;
+            }
+            s->spawn_ns[n_spawned] = b - a;
+            s->lag_ns[n_spawned++] = a > r->due_ns ? a - r->due_ns : 0;
+            r->open = (r->ci.pidfd >= 0) + (r->ci.stdout_type == PROC_COM_PIPE) + (r->ci.stderr_type == PROC_COM_PIPE);
+            for (int i = 0; i < MAX_LIVE; i++) {
+                if (live[i] == NULL) {
+                    live[i] = r;
+                    break;
+                }
+            }
+            s->n_live++;
+        }
+        int timeout = -1;
+        if (next < n && s->n_live < MAX_LIVE) {
+            uint64_t due = recs[next].start_ns / speed, at = now_ns() - t0;
+            timeout = due > at ? (int)((due - at + 999999) / 1000000) : 0;
+        }
+        run_EventLoop(&loop, timeout);
+        for (int i = 0; i < MAX_LIVE; i++) {
+            if (live[i] != NULL && live[i]->open == 0) {
+                finish(live[i], s);
+                live[i] = NULL;
+            }
+        }
+    }
+    uint64_t wall = now_ns() - t0;
+    close_EventLoop(&loop);
+    if (set->server) {
+        stop_SpawnServer();
+    }
+    set_spawn_backend(SPAWN_BACKEND_AUTO);
+    qsort(s->spawn_ns, n_spawned, sizeof(uint64_t), cmp_u64);
+    qsort(s->lag_ns, n_spawned, sizeof(uint64_t), cmp_u64);
+    qsort(s->done_ns, s->n_done, sizeof(uint64_t), cmp_u64);
+    printf("%s,%zu,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%llu,%zu\n", set->name, n_spawned, wall / 1e6,
+        pct_us(s->spawn_ns, n_spawned, 0.5), pct_us(s->spawn_ns, n_spawned, 0.99),
+        pct_us(s->lag_ns, n_spawned, 0.5), pct_us(s->lag_ns, n_spawned, 0.99),
+        pct_us(s->done_ns, s->n_done, 0.5), pct_us(s->done_ns, s->n_done, 0.99),
+        (unsigned long long)s->bytes, s->n_fails);
+    fflush(stdout);
+    free(live);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 5 && strcmp(argv[1], "--stub") == 0) {
+        return stub_main(strtoull(argv[2], NULL, 10), strtoull(argv[3], NULL, 10), strtoull(argv[4], NULL, 10));
+    }
+    double speed = argc > 2 ? atof(argv[2]) : 1.0;
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (len < 0 || speed <= 0) {
+        fprintf(stderr, "cannot find own executable: %s\n", strerror(errno));
+        return 1;
+    }
+    self[len] = '\0';
+    const char *tmp = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    snprintf(out_path, sizeof(out_path), "%s/replay_bench.%d.out", tmp, (int)getpid());
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    char synth[PATH_MAX];
+    const char *path = argc > 1 ? argv[1] : synth;
+    if (argc <= 1) {
+        snprintf(synth, sizeof(synth), "%s/replay_bench.%d.trace", tmp, (int)getpid());
+        if (record_synthetic(synth)) {
+            return 1;
+        }
+    }
+    WorkloadTrace t;
+    WorkloadRecord *recs = NULL;
+    size_t n = 0, cap = 0;
+    int rc;
+    if (open_WorkloadTrace(&t, path)) {
+        return 1;
+    }
+    while (true) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            recs = realloc(recs, cap * sizeof(WorkloadRecord));
+        }
+        if ((rc = next_WorkloadTrace(&t, &recs[n])) <= 0) {
+            break;
+        }
+        n++;
+    }
+    close_WorkloadTrace(&t);
+    if (rc < 0) {
+        fprintf(stderr, "%s is cut short after %zu records, replaying those\n", path, n);
+    }
+    if (argc <= 1) {
+        unlink(synth);
+    }
+    qsort(recs, n, sizeof(WorkloadRecord), cmp_start);
+
+    Stats s = {
+        .spawn_ns = malloc((n + 1) * sizeof(uint64_t)),
+        .lag_ns = malloc((n + 1) * sizeof(uint64_t)),
+        .done_ns = malloc((n + 1) * sizeof(uint64_t)),
+    };
+    printf("setting,children,wall_ms,spawn_p50_us,spawn_p99_us,late_p50_us,late_p99_us,"
+        "done_p50_us,done_p99_us,bytes_read,fails\n");
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        s = (Stats){.spawn_ns = s.spawn_ns, .lag_ns = s.lag_ns, .done_ns = s.done_ns};
+        run_setting(&settings[i], recs, n, speed, &s);
+    }
+    unlink(out_path);
+    free(s.spawn_ns);
+    free(s.lag_ns);
+    free(s.done_ns);
+    free(recs);
+    return 0;
+}
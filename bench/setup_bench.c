@@ -0,0 +1,177 @@
+// subprocess() setup-overhead benchmark: the parent-side cost of each
+// spawn phase for every stdin/stdout/stderr ProcComType combination, for
+// subprocess() and for a prebuilt SpawnTemplate, as CSV. Phases come from
+// the trace.h probes, built in-process with -DSUBPROCESS_TRACE_HOOK:
+//
+//   setup  spawn__start..spawn__actions   stream plan, pipes, file actions, attributes
+//   spawn  spawn__actions..spawn__exec    posix_spawn, which includes the child's exec
+//   post   spawn__exec..spawn__done       cgroup, scheduling, pidfd, fd bookkeeping
+//   close  close_ProcInfo()
+//
+// usage: setup_bench [iterations]   (default 100, /bin/true as the child)
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "subprocess.h"
+
+extern char **environ;
+
+static char *child_args[] = {"/bin/true", NULL};
+
+typedef enum { PROBE_START, PROBE_ACTIONS, PROBE_EXEC, PROBE_DONE, N_PROBES } Probe;
+
+static const char *probe_names[N_PROBES] = {
+    [PROBE_START] = "spawn__start", [PROBE_ACTIONS] = "spawn__actions",
+    [PROBE_EXEC] = "spawn__exec", [PROBE_DONE] = "spawn__done",
+};
+
+static uint64_t stamps[N_PROBES];
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void subprocess_trace_hook(const char *probe) {
+    uint64_t t = now_ns();
+    for (int i = 0; i < N_PROBES; i++) {
+        if (strcmp(probe, probe_names[i]) == 0) {
+            stamps[i] = t;
+            return;
+        }
+    }
+}
+
+typedef enum { PHASE_SETUP, PHASE_SPAWN, PHASE_POST, PHASE_CLOSE, N_PHASES } Phase;
+
+static const struct {
+    ProcComType type;
+    const char *name;
+} in_types[] = {
+    {PROC_COM_INHERIT, "inherit"}, {PROC_COM_NONE, "none"}, {PROC_COM_PIPE, "pipe"},
+    {PROC_COM_FD, "fd"}, {PROC_COM_PATH, "path"},
+}, out_types[] = {
+    {PROC_COM_INHERIT, "inherit"}, {PROC_COM_NONE, "none"}, {PROC_COM_PIPE, "pipe"},
+    {PROC_COM_FD, "fd"}, {PROC_COM_PATH, "path"}, {PROC_COM_MEMFD, "memfd"},
+}, err_types[] = {
+    {PROC_COM_INHERIT, "inherit"}, {PROC_COM_NONE, "none"}, {PROC_COM_PIPE, "pipe"},
+    {PROC_COM_FD, "fd"}, {PROC_COM_PATH, "path"}, {PROC_COM_STDOUT, "stdout"},
+};
+
+#define N_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+static int null_fd;
+
+static ProcInfo shape(ProcComType in, ProcComType out, ProcComType err) {
+    ProcInfo ci = {.p_stdin=-1, .p_stdout=-1, .p_stderr=-1};
+    ci.stdin_type = in;
+    ci.stdout_type = out;
+    ci.stderr_type = err;
+    ci.f_stdin = ci.f_stdout = ci.f_stderr = "/dev/null";
+    if (in == PROC_COM_FD) {
+        ci.p_stdin = null_fd;
+    }
+    if (out == PROC_COM_FD) {
+        ci.p_stdout = null_fd;
+    }
+    if (err == PROC_COM_FD) {
+        ci.p_stderr = null_fd;
+    }
+    return ci;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static inline uint64_t span(Probe from, Probe to) {
+    return stamps[from] && stamps[to] >= stamps[from] ? stamps[to] - stamps[from] : 0;
+}
+
+// one row: p50 of each phase over iterations spawns
+static void run_combo(bool templated, int ii, int oi, int ei, int iterations, uint64_t *lat[N_PHASES]) {
+    ProcInfo base = shape(in_types[ii].type, out_types[oi].type, err_types[ei].type);
+    SpawnTemplate st;
+    int ok = 0;
+
+    if (templated && init_SpawnTemplate(&st, &base)) {
+        return;
+    }
+    for (int i = 0; i < iterations; i++) {
+        ProcInfo ci = base;
+        memset(stamps, 0, sizeof(stamps));
+        int rc = templated ? spawn_SpawnTemplate(&st, &ci, child_args, environ)
+            : subprocess(&ci, child_args, environ);
+        if (rc != 0) {
+            continue;
+        }
+        // borrowed fds must survive close_ProcInfo()
+        if (in_types[ii].type == PROC_COM_FD) {
+            ci.p_stdin = -1;
+        }
+        if (out_types[oi].type == PROC_COM_FD) {
+            ci.p_stdout = -1;
+        }
+        if (err_types[ei].type == PROC_COM_FD) {
+            ci.p_stderr = -1;
+        }
+        pid_t pid = ci.pid;
+        uint64_t t0 = now_ns();
+        close_ProcInfo(&ci);
+        lat[PHASE_CLOSE][ok] = now_ns() - t0;
+        lat[PHASE_SETUP][ok] = span(PROBE_START, PROBE_ACTIONS);
+        lat[PHASE_SPAWN][ok] = span(PROBE_ACTIONS, PROBE_EXEC);
+        lat[PHASE_POST][ok] = span(PROBE_EXEC, PROBE_DONE);
+        waitpid(pid, NULL, 0);
+        ok++;
+    }
+    if (templated) {
+        close_SpawnTemplate(&st);
+    }
+    printf("%s,%s,%s,%s,%d", templated ? "template" : "subprocess",
+        in_types[ii].name, out_types[oi].name, err_types[ei].name, ok);
+    uint64_t overhead = 0;
+    for (int p = 0; p < N_PHASES; p++) {
+        qsort(lat[p], ok, sizeof(uint64_t), cmp_u64);
+        uint64_t p50 = ok ? lat[p][ok / 2] : 0;
+        overhead += p != PHASE_SPAWN ? p50 : 0;
+        printf(",%.2f", p50 / 1e3);
+    }
+    printf(",%.2f,%d\n", overhead / 1e3, iterations - ok);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100;
+    uint64_t *lat[N_PHASES];
+
+    if (iterations < 1 || (null_fd = open("/dev/null", O_RDWR | O_CLOEXEC)) < 0) {
+        return 1;
+    }
+    for (int p = 0; p < N_PHASES; p++) {
+        lat[p] = malloc(iterations * sizeof(uint64_t));
+    }
+    printf("path,stdin,stdout,stderr,spawns,setup_us,spawn_us,post_us,close_us,overhead_us,fails\n");
+    for (int t = 0; t < 2; t++) {
+        for (size_t ii = 0; ii < N_OF(in_types); ii++) {
+            for (size_t oi = 0; oi < N_OF(out_types); oi++) {
+                for (size_t ei = 0; ei < N_OF(err_types); ei++) {
+                    run_combo(t == 1, ii, oi, ei, iterations, lat);
+                }
+            }
+        }
+    }
+    fflush(stdout);
+    for (int p = 0; p < N_PHASES; p++) {
+        free(lat[p]);
+    }
+    return 0;
+}
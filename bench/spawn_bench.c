@@ -0,0 +1,163 @@
+// spawn-rate benchmark: spawns/second and p50/p99 spawn latency for
+// subprocess() and raw process-creation primitives across parent RSS sizes
+//
+// usage: spawn_bench [iterations] [rss_mb ...]
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <spawn.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+
+#include "subprocess.h"
+#include "child.h"
+
+extern char **environ;
+
+static char *child_path = "/bin/true";
+static char *child_args[] = {"true", NULL};
+
+static inline double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// each variant returns the child pid (or -1); the caller reaps it
+static pid_t spawn_subprocess(void) {
+    ProcInfo ci = {.p_stdin=-1, .p_stdout=-1, .p_stderr=-1};
+    if (subprocess(&ci, child_args, environ)) {
+        return -1;
+    }
+    pid_t pid = ci.pid;
+    close_ProcInfo(&ci);
+    return pid;
+}
+
+static pid_t spawn_usevfork(void) {
+    posix_spawnattr_t attr;
+    pid_t pid;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_USEVFORK);
+    int rc = posix_spawn(&pid, child_path, NULL, &attr, child_args, environ);
+    posix_spawnattr_destroy(&attr);
+    return rc ? -1 : pid;
+}
+
+static pid_t spawn_vfork(void) {
+    pid_t pid = vfork();
+    if (pid == 0) {
+        execve(child_path, child_args, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t spawn_fork(void) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execve(child_path, child_args, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+#if defined(__x86_64__) && defined(SYS_clone3)
+#define CLONE3_STACK (64 * 1024)
+
+static int clone3_child(void *arg) {
+    (void)arg;
+    execve(child_path, child_args, environ);
+    _exit(127);
+}
+
+static pid_t spawn_clone3(void) {
+    static char *stack;
+    if (stack == NULL && (stack = aligned_alloc(16, CLONE3_STACK)) == NULL) {
+        return -1;
+    }
+    struct clone_args ca = {
+        .flags = CLONE_VM | CLONE_VFORK,
+        .exit_signal = SIGCHLD,
+        .stack = (unsigned long)stack,
+        .stack_size = CLONE3_STACK,
+    };
+    return clone3_run(&ca, clone3_child, NULL);
+}
+#endif
+
+typedef struct {
+    const char *name;
+    pid_t (*spawn)(void);
+} Variant;
+
+static Variant variants[] = {
+    {"subprocess", spawn_subprocess},
+    {"usevfork", spawn_usevfork},
+    {"vfork", spawn_vfork},
+    {"fork", spawn_fork},
+#if defined(__x86_64__) && defined(SYS_clone3)
+    {"clone3", spawn_clone3},
+#endif
+};
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_variant(const Variant *v, int iterations, size_t rss_mb) {
+    double *lat = malloc(iterations * sizeof(double));
+    int ok = 0;
+    double start = now_us();
+
+    for (int i = 0; i < iterations; i++) {
+        double t0 = now_us();
+        pid_t pid = v->spawn();
+        lat[ok] = now_us() - t0;
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+            ok++;
+        }
+    }
+    double elapsed = now_us() - start;
+    qsort(lat, ok, sizeof(double), cmp_double);
+    printf("%-10s %8zu %10.1f %10.1f %10.1f %6d\n", v->name, rss_mb,
+        ok ? ok / (elapsed / 1e6) : 0.0,
+        ok ? lat[ok / 2] : 0.0,
+        ok ? lat[(int)(ok * 0.99)] : 0.0,
+        iterations - ok);
+    free(lat);
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    size_t default_rss[] = {10, 100, 1000};
+    int n_rss = argc > 2 ? argc - 2 : 3;
+
+    printf("%-10s %8s %10s %10s %10s %6s\n", "variant", "rss_mb", "spawns/s", "p50_us", "p99_us", "fails");
+    for (int r = 0; r < n_rss; r++) {
+        size_t rss_mb = argc > 2 ? strtoull(argv[r + 2], NULL, 10) : default_rss[r];
+        size_t sz = rss_mb << 20;
+        // touch every page so the parent really carries that much mapped memory
+        char *ballast = mmap(NULL, sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (ballast == MAP_FAILED) {
+            fprintf(stderr, "cannot map %zu MB: %s\n", rss_mb, strerror(errno));
+            continue;
+        }
+        memset(ballast, 1, sz);
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            run_variant(&variants[v], iterations, rss_mb);
+        }
+        munmap(ballast, sz);
+    }
+    return 0;
+}
@@ -0,0 +1,260 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "subprocess.h"
+#include "broadcast.h"
+
+#define BCAST_MIN_READ 4096     // less room than this left in the tail starts a new chunk
+
+static void on_readable(EventLoop *loop, int fd, unsigned revents, void *data);
+
+// free the oldest chunks nobody needs any more
+static void trim(Broadcast *b) {
+    while (b->head != NULL && b->head->refs == 0) {
+        BcastChunk *c = b->head;
+        b->head = c->next;
+        if (b->tail == c) {
+            b->tail = NULL;
+        }
+        free(c);
+        b->n_chunks--;
+    }
+}
+
+static void leave_chunk(BcastSub *s) {
+    if (s->chunk != NULL) {
+        s->chunk->refs--;
+        s->chunk = NULL;
+    }
+}
+
+static void enter_chunk(BcastSub *s, BcastChunk *c) {
+    c->refs++;
+    s->chunk = c;
+}
+
+void init_Broadcast(Broadcast *b, size_t chunk_size, size_t limit) {
+    memset(b, 0, sizeof(*b));
+    b->chunk_size = chunk_size > BCAST_MIN_READ ? chunk_size : BCAST_CHUNK;
+    b->limit = limit > 0 ? limit : BCAST_LIMIT;
+    b->fd = -1;
+}
+
+void close_Broadcast(Broadcast *b) {
+    if (b->loop != NULL && !b->paused && !b->eof) {
+        del_EventLoop(b->loop, b->fd);
+    }
+    while (b->subs != NULL) {
+        unsubscribe_Broadcast(b->subs);
+    }
+    while (b->head != NULL) {
+        BcastChunk *c = b->head;
+        b->head = c->next;
+        free(c);
+    }
+    b->tail = NULL;
+    b->n_chunks = 0;
+    b->loop = NULL;
+}
+
+void subscribe_Broadcast(Broadcast *b, BcastSub *s, BcastPolicy policy, BcastReady on_ready, void *data) {
+    memset(s, 0, sizeof(*s));
+    s->b = b;
+    s->policy = policy;
+    s->on_ready = on_ready;
+    s->data = data;
+    s->pos = b->total;
+    if (b->tail != NULL) {
+        enter_chunk(s, b->tail);
+    }
+    s->next = b->subs;
+    b->subs = s;
+}
+
+// lowest position among the blocking subscribers, total if there are none
+static uint64_t slowest(const Broadcast *b) {
+    uint64_t pos = b->total;
+    for (const BcastSub *s = b->subs; s != NULL; s = s->next) {
+        if (s->policy == BCAST_BLOCK && s->pos < pos) {
+            pos = s->pos;
+        }
+    }
+    return pos;
+}
+
+// back into the loop once the slowest blocking subscriber caught up enough
+static void maybe_resume(Broadcast *b) {
+    if (b->paused && b->total - slowest(b) < b->limit) {
+        if (b->loop == NULL || add_EventLoop(b->loop, b->fd, POLLIN, on_readable, b) == 0) {
+            b->paused = false;
+        }
+    }
+}
+
+void unsubscribe_Broadcast(BcastSub *s) {
+    Broadcast *b = s->b;
+
+    for (BcastSub **p = &b->subs; *p != NULL; p = &(*p)->next) {
+        if (*p == s) {
+            *p = s->next;
+            break;
+        }
+    }
+    leave_chunk(s);
+    trim(b);
+    maybe_resume(b);
+}
+
+size_t next_BcastSub(BcastSub *s, BcastView *v) {
+    Broadcast *b = s->b;
+    BcastChunk *c = s->chunk;
+
+    memset(v, 0, sizeof(*v));
+    if (c == NULL || s->pos == c->start + c->len) {
+        if (c != NULL && c->next == NULL) {
+            return 0; // caught up
+        }
+        BcastChunk *next = c != NULL ? c->next : b->head;
+        if (next == NULL) {
+            return 0;
+        }
+        leave_chunk(s);
+        enter_chunk(s, next);
+        trim(b);
+        c = next;
+    }
+    size_t off = s->pos - c->start;
+    v->b = b;
+    v->chunk = c;
+    v->data = c->data + off;
+    v->len = c->len - off;
+    c->refs++;
+    s->pos += v->len;
+    maybe_resume(b);
+    return v->len;
+}
+
+void release_BcastView(BcastView *v) {
+    if (v->chunk != NULL) {
+        v->chunk->refs--;
+        trim(v->b);
+        v->chunk = NULL;
+    }
+}
+
+// a new tail for the next read, entered by the subscribers that had none
+static BcastChunk *grow(Broadcast *b) {
+    BcastChunk *c = malloc(sizeof(BcastChunk) + b->chunk_size);
+
+    if (c == NULL) {
+        return NULL;
+    }
+    c->next = NULL;
+    c->start = b->total;
+    c->len = 0;
+    c->cap = b->chunk_size;
+    c->refs = 0;
+    if (b->tail != NULL) {
+        b->tail->next = c;
+    } else {
+        b->head = c;
+    }
+    b->tail = c;
+    b->n_chunks++;
+    for (BcastSub *s = b->subs; s != NULL; s = s->next) {
+        if (s->chunk == NULL) {
+            enter_chunk(s, c);
+        }
+    }
+    return c;
+}
+
+// subscribers too far behind: skip dropping ones ahead, pause for blocking ones
+static void enforce_limit(Broadcast *b) {
+    for (BcastSub *s = b->subs; s != NULL; s = s->next) {
+        if (s->policy == BCAST_DROP && b->total - s->pos >= b->limit && s->chunk != b->tail) {
+            s->dropped += b->tail->start - s->pos;
+            s->pos = b->tail->start;
+            leave_chunk(s);
+            enter_chunk(s, b->tail);
+        }
+    }
+    trim(b);
+    if (!b->paused && b->total - slowest(b) >= b->limit) {
+        if (b->loop != NULL) {
+            del_EventLoop(b->loop, b->fd);
+        }
+        b->paused = true;
+        b->n_pauses++;
+    }
+}
+
+static void notify(Broadcast *b) {
+    for (BcastSub *s = b->subs, *next; s != NULL; s = next) {
+        next = s->next; // s may unsubscribe itself
+        if (s->on_ready != NULL) {
+            s->on_ready(s, s->data);
+        }
+    }
+}
+
+ssize_t fill_Broadcast(Broadcast *b, int fd) {
+    BcastChunk *c = b->tail;
+
+    if (b->paused) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    if (b->eof) {
+        return 0;
+    }
+    if ((c == NULL || c->cap - c->len < BCAST_MIN_READ) && (c = grow(b)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    ssize_t n = read(fd, c->data + c->len, c->cap - c->len);
+    if (n < 0) {
+        return -1;
+    }
+    if (n == 0) {
+        b->eof = true;
+    } else {
+        c->len += n;
+        b->total += n;
+        enforce_limit(b);
+    }
+    notify(b);
+    return n;
+}
+
+static void on_readable(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Broadcast *b = data;
+
+    ssize_t n = fill_Broadcast(b, fd);
+    if (n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR || errno == ENOBUFS))) {
+        return;
+    }
+    if (n < 0) {
+        b->err = errno;
+        b->eof = true;
+        notify(b);
+    }
+    if (!b->paused) {
+        del_EventLoop(loop, fd);
+    }
+}
+
+int watch_Broadcast(Broadcast *b, EventLoop *loop, int fd) {
+    b->loop = loop;
+    b->fd = fd;
+    if (add_EventLoop(loop, fd, POLLIN, on_readable, b)) {
+        showError(false, "Failed to watch broadcast fd %d: %s!", fd, strerror(errno));
+        b->loop = NULL;
+        return 1;
+    }
+    return 0;
+}
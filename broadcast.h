@@ -0,0 +1,97 @@
+#ifndef BROADCAST_H
+#define BROADCAST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "event_loop.h"
+
+#define BCAST_CHUNK (64 * 1024)         // default chunk size
+#define BCAST_LIMIT (1024 * 1024)       // default bytes a subscriber may lag behind
+
+typedef struct Broadcast Broadcast;
+typedef struct BcastSub BcastSub;
+
+// bytes read once, shared by every subscriber: freed when none is at or
+// before it and no view holds it
+typedef struct BcastChunk {
+    struct BcastChunk *next;
+    uint64_t start;         // stream offset of data[0]
+    size_t len;
+    size_t cap;
+    int refs;               // subscribers positioned in it plus views of it
+    char data[];
+} BcastChunk;
+
+typedef enum {
+    BCAST_BLOCK = 0,        // lagging limit bytes behind pauses the reader
+    BCAST_DROP,             // lagging limit bytes behind skips to the newest chunk
+} BcastPolicy;
+
+// new data or the end of the stream is there for s
+typedef void (*BcastReady)(BcastSub *s, void *data);
+
+struct BcastSub {
+    Broadcast *b;
+    BcastChunk *chunk;      // where pos is, NULL before the first chunk
+    uint64_t pos;           // stream offset of its next byte
+    BcastPolicy policy;
+    BcastReady on_ready;    // may be NULL to just pull
+    void *data;
+    uint64_t dropped;       // bytes skipped under BCAST_DROP
+    BcastSub *next;
+};
+
+// a zero-copy look at a chunk, valid until released
+typedef struct {
+    Broadcast *b;
+    BcastChunk *chunk;
+    const char *data;
+    size_t len;
+} BcastView;
+
+// one reader, many in-process consumers of the same stream (a child's
+// p_stdout): read() fills refcounted chunks once and each subscriber walks
+// them at its own pace through views, nothing is copied per consumer. One
+// thread only
+struct Broadcast {
+    BcastChunk *head;
+    BcastChunk *tail;       // being filled
+    size_t chunk_size;      // input
+    size_t limit;           // input
+    uint64_t total;         // bytes read
+    BcastSub *subs;
+    size_t n_chunks;
+    EventLoop *loop;        // watch_Broadcast()'s, NULL for none
+    int fd;
+    bool paused;            // a blocking subscriber is limit behind
+    bool eof;
+    int err;                // errno that ended the stream, 0 for none
+    size_t n_pauses;
+};
+
+// chunk_size and limit 0 for the defaults above
+void init_Broadcast(Broadcast *b, size_t chunk_size, size_t limit);
+// unsubscribes everyone and frees the chunks; views must be released first
+void close_Broadcast(Broadcast *b);
+// s sees everything read from now on
+void subscribe_Broadcast(Broadcast *b, BcastSub *s, BcastPolicy policy, BcastReady on_ready, void *data);
+void unsubscribe_Broadcast(BcastSub *s);
+// one read() from fd into the chunks, then every subscriber's on_ready;
+// bytes read, 0 at EOF, -1 with errno (ENOBUFS while paused)
+ssize_t fill_Broadcast(Broadcast *b, int fd);
+// fill from the loop until EOF or an error, leaving the loop while paused;
+// the fd stays the caller's
+int watch_Broadcast(Broadcast *b, EventLoop *loop, int fd);
+// the unread bytes of s's current chunk as a view, s moved past them;
+// 0 when it has caught up
+size_t next_BcastSub(BcastSub *s, BcastView *v);
+void release_BcastView(BcastView *v);
+// s has read everything and nothing more will come
+static inline bool done_BcastSub(const BcastSub *s) {
+    return s->b->eof && s->pos == s->b->total;
+}
+
+#endif // BROADCAST_H
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "builtin.h"
+
+// length of the line at buf, its '\n' included if there is one
+static size_t line_len(const char *buf, size_t len) {
+    const char *nl = memchr(buf, '\n', len);
+    return nl != NULL ? (size_t)(nl - buf) + 1 : len;
+}
+
+static size_t count_filter(void *ctx, char *buf, size_t len) {
+    BuiltinStage *b = ctx;
+
+    b->n_bytes += len;
+    if (b->what & BUILTIN_WORDS) {
+        for (size_t i = 0; i < len; i++) {
+            bool space = isspace((unsigned char)buf[i]);
+            b->n_lines += buf[i] == '\n';
+            b->n_words += !space && !b->in_word;
+            b->in_word = !space;
+        }
+    } else if (b->what & BUILTIN_LINES) {
+        for (const char *p = buf, *end = buf + len; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+            b->n_lines++;
+        }
+    }
+    return 0;
+}
+
+static void count_end(void *ctx, Relay *r) {
+    BuiltinStage *b = ctx;
+    size_t counts[3] = {b->n_lines, b->n_words, b->n_bytes};
+    char out[80];
+    int len = 0;
+    bool single = (b->what & (b->what - 1)) == 0;
+
+    for (int i = 0; i < 3; i++) {
+        if (b->what & (1u << i)) {
+            // wc prints a lone count bare and aligns several of them
+            len += single ? snprintf(out, sizeof(out), "%zu", counts[i]) :
+                snprintf(out + len, sizeof(out) - len, "%s%7zu", len > 0 ? " " : "", counts[i]);
+        }
+    }
+    out[len++] = '\n';
+    emit_Relay(r, out, len);
+}
+
+void count_Builtin(BuiltinStage *b, unsigned what) {
+    memset(b, 0, sizeof(*b));
+    b->name = "wc";
+    b->filter = count_filter;
+    b->on_end = count_end;
+    b->what = what & (BUILTIN_LINES | BUILTIN_WORDS | BUILTIN_BYTES);
+    if (b->what == 0) {
+        b->what = BUILTIN_LINES;
+    }
+}
+
+static size_t grep_filter(void *ctx, char *buf, size_t len) {
+    BuiltinStage *b = ctx;
+    size_t kept = 0;
+
+    for (size_t off = 0; off < len; ) {
+        size_t n = line_len(buf + off, len - off);
+        bool hit = memmem(buf + off, n, b->pattern, b->pattern_len) != NULL;
+        if (hit != ((b->what & BUILTIN_INVERT) != 0)) {
+            memmove(buf + kept, buf + off, n);
+            kept += n;
+            b->n_lines++;
+        }
+        off += n;
+    }
+    return kept;
+}
+
+static void grep_end(void *ctx, Relay *r) {
+    BuiltinStage *b = ctx;
+    b->status = b->n_lines > 0 ? 0 : 1;
+}
+
+void grep_Builtin(BuiltinStage *b, const char *pattern, unsigned flags) {
+    memset(b, 0, sizeof(*b));
+    b->name = "grep";
+    b->filter = grep_filter;
+    b->on_end = grep_end;
+    b->lines = true;
+    b->what = flags;
+    b->pattern = pattern;
+    b->pattern_len = strlen(pattern);
+}
+
+static size_t head_filter(void *ctx, char *buf, size_t len) {
+    BuiltinStage *b = ctx;
+    size_t off = 0;
+
+    while (off < len && b->n_lines < b->limit) {
+        off += line_len(buf + off, len - off);
+        b->n_lines++;
+    }
+    if (b->n_lines >= b->limit && b->relay != NULL) {
+        end_input_Relay(b->relay);
+    }
+    return off;
+}
+
+void head_Builtin(BuiltinStage *b, size_t n) {
+    memset(b, 0, sizeof(*b));
+    b->name = "head";
+    b->filter = head_filter;
+    b->lines = true;
+    b->limit = n;
+}
+
+static size_t tail_filter(void *ctx, char *buf, size_t len) {
+    BuiltinStage *b = ctx;
+
+    for (size_t off = 0; off < len && b->limit > 0; ) {
+        size_t n = line_len(buf + off, len - off);
+        size_t k = b->ring_next;
+        char *line = realloc(b->ring[k], n);
+        if (line == NULL) {
+            b->status = 1; // short of a line rather than stalling the stage
+        } else {
+            memcpy(line, buf + off, n);
+            b->ring[k] = line;
+            b->ring_len[k] = n;
+        }
+        b->ring_next = (k + 1) % b->limit;
+        b->n_lines++;
+        off += n;
+    }
+    return 0;
+}
+
+static void tail_end(void *ctx, Relay *r) {
+    BuiltinStage *b = ctx;
+    size_t n = b->n_lines < b->limit ? b->n_lines : b->limit;
+
+    for (size_t i = 0; i < n; i++) {
+        size_t k = (b->ring_next + b->limit - n + i) % b->limit;
+        if (b->ring[k] != NULL && emit_Relay(r, b->ring[k], b->ring_len[k])) {
+            b->status = 1;
+            return;
+        }
+    }
+}
+
+int tail_Builtin(BuiltinStage *b, size_t n) {
+    memset(b, 0, sizeof(*b));
+    b->name = "tail";
+    b->filter = tail_filter;
+    b->on_end = tail_end;
+    b->lines = true;
+    b->limit = n;
+    if (n > 0) {
+        b->ring = calloc(n, sizeof(char *));
+        b->ring_len = calloc(n, sizeof(size_t));
+        if (b->ring == NULL || b->ring_len == NULL) {
+            showError(false, "Failed to allocate tail of %zu lines!", n);
+            free_Builtin(b);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void free_Builtin(BuiltinStage *b) {
+    for (size_t i = 0; b->ring != NULL && i < b->limit; i++) {
+        free(b->ring[i]);
+    }
+    free(b->ring);
+    free(b->ring_len);
+    b->ring = NULL;
+    b->ring_len = NULL;
+}
@@ -0,0 +1,54 @@
+#ifndef BUILTIN_H
+#define BUILTIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "relay.h"
+
+// what count_Builtin() counts, in wc(1)'s column order
+#define BUILTIN_LINES   1u
+#define BUILTIN_WORDS   2u
+#define BUILTIN_BYTES   4u
+
+// grep_Builtin() flags
+#define BUILTIN_INVERT  1u  // keep the lines without the pattern, like grep -v
+
+typedef struct BuiltinStage BuiltinStage;
+
+// An in-process pipeline stage: a Relay filter (plus an end hook) that
+// does the work of a trivial command -- wc, fgrep, head, tail -- on the
+// parent's event loop instead of spawning one. Output is what the command
+// would print for stdin; status what it would exit with.
+struct BuiltinStage {
+    const char *name;       // for messages, as argv[0] would be
+    RelayFilter filter;     // ctx is the stage
+    RelayEnd on_end;
+    bool lines;             // filter whole lines, see Relay
+    int status;             // exit status the stage reports to wait_Pipeline()
+    Relay *relay;           // while it runs
+    // state of the particular builtin
+    unsigned what;          // count: BUILTIN_LINES/WORDS/BYTES; grep: flags
+    const char *pattern;    // grep: fixed string, not a regex
+    size_t pattern_len;
+    size_t limit;           // head/tail: lines
+    size_t n_lines;
+    size_t n_words;
+    size_t n_bytes;
+    bool in_word;
+    char **ring;            // tail: the last limit lines
+    size_t *ring_len;
+    size_t ring_next;
+};
+
+// wc with columns for the bits of what (0 counts lines, as wc -l)
+void count_Builtin(BuiltinStage *b, unsigned what);
+// lines containing pattern (kept by reference): grep -F, status 1 when none matched
+void grep_Builtin(BuiltinStage *b, const char *pattern, unsigned flags);
+// the first n lines, then the upstream is cut off as head(1) does
+void head_Builtin(BuiltinStage *b, size_t n);
+// the last n lines; holds at most n lines
+int tail_Builtin(BuiltinStage *b, size_t n);
+void free_Builtin(BuiltinStage *b);
+
+#endif // BUILTIN_H
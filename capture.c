@@ -0,0 +1,553 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "capture.h"
+#include "trace.h"
+#include "metrics.h"
+#include "workload.h"
+
+#define CAPTURE_MIN_READ (64 * 1024)
+#define CAPTURE_SPILL_CHUNK (1024 * 1024)  // a splice into the spill file moves this much at most
+
+int reserve_CaptureBuf(CaptureBuf *b, size_t want) {
+    if (b->cap - b->len > want) { // keep one byte for the NUL
+        return 0;
+    }
+    size_t cap = b->cap ? b->cap : CAPTURE_MIN_READ;
+    while (cap - b->len <= want) {
+        cap *= 2;
+    }
+    char *data = realloc(b->data, cap);
+    if (data == NULL) {
+        return -1;
+    }
+    b->data = data;
+    b->cap = cap;
+    return 0;
+}
+
+// ---- chunk timestamps
+
+static bool use_tsc;
+static pthread_once_t tsc_once = PTHREAD_ONCE_INIT;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the TSC only when the kernel keeps time with it: then it is invariant and
+// synchronised across CPUs
+static void check_tsc(void) {
+#if defined(__x86_64__)
+    char name[32] = "";
+    FILE *f = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "re");
+    if (f != NULL) {
+        use_tsc = fgets(name, sizeof(name), f) != NULL && strcmp(name, "tsc\n") == 0;
+        fclose(f);
+    }
+#endif
+}
+
+static inline uint64_t read_tsc(void) {
+#if defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static void add_stamp(CaptureBuf *b, size_t n) {
+    if (b->n_stamps == b->cap_stamps) {
+        size_t cap = b->cap_stamps ? b->cap_stamps * 2 : 64;
+        CaptureStamp *st = realloc(b->stamps, cap * sizeof(CaptureStamp));
+        if (st == NULL) {
+            return; // timestamps are best effort
+        }
+        b->stamps = st;
+        b->cap_stamps = cap;
+    }
+    if (b->n_stamps == 0) {
+        pthread_once(&tsc_once, check_tsc);
+    }
+    uint64_t t;
+    if (use_tsc) {
+        if (b->tsc0 == 0) { // the first point of the calibration
+            b->tsc0_ns = mono_ns();
+            b->tsc0 = read_tsc();
+        }
+        t = read_tsc();
+    } else {
+        t = mono_ns();
+    }
+    b->stamps[b->n_stamps++] = (CaptureStamp){.offset = b->total - n, .ns = t};
+}
+
+// raw TSC stamps to CLOCK_MONOTONIC, scaled by a second calibration point
+// taken now, so the rate is exact over the capture's own span
+static void convert_stamps(CaptureBuf *b) {
+    if (b->tsc0 == 0) {
+        return;
+    }
+    uint64_t ns1 = mono_ns(), tsc1 = read_tsc();
+    double ns_per_tick = tsc1 > b->tsc0 ? (double)(ns1 - b->tsc0_ns) / (tsc1 - b->tsc0) : 0;
+    for (size_t i = 0; i < b->n_stamps; i++) {
+        b->stamps[i].ns = b->tsc0_ns + (uint64_t)((b->stamps[i].ns - b->tsc0) * ns_per_tick);
+    }
+    b->tsc0 = 0;
+}
+
+// ---- spilling
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0) {
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static int open_spill(const char *dir) {
+    char tmpl[PATH_MAX];
+    int fd;
+
+    if (dir == NULL && (dir = getenv("TMPDIR")) == NULL) {
+        dir = "/tmp";
+    }
+    if ((fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) >= 0) {
+        return fd;
+    }
+    // no O_TMPFILE on this filesystem: unlink right after creating
+    if (snprintf(tmpl, sizeof(tmpl), "%s/capture.XXXXXX", dir) >= (int)sizeof(tmpl) ||
+            (fd = mkostemp(tmpl, O_CLOEXEC)) < 0) {
+        return -1;
+    }
+    unlink(tmpl);
+    return fd;
+}
+
+// what is in memory goes to a new temp file, the rest will follow it
+static int start_spill(CaptureBuf *b) {
+    if ((b->spill_fd = open_spill(b->spill_dir)) < 0) {
+        showError(false, "Failed to create capture spill file: %s!", strerror(errno));
+        return -1;
+    }
+    if (write_all(b->spill_fd, b->data, b->len)) {
+        showError(false, "Failed to write capture spill file: %s!", strerror(errno));
+        close(b->spill_fd);
+        return -1;
+    }
+    b->spilled = true;
+    if (b->len > b->spill_at) {
+        b->len = b->spill_at;
+        b->data[b->len] = '\0';
+    }
+    return 0;
+}
+
+static inline bool spill_due(const CaptureBuf *b, size_t more) {
+    return b->limit == 0 && b->spill_at > 0 && !b->spilled && b->len + more > b->spill_at;
+}
+
+static void drop_spill(CaptureBuf *b) {
+    if (b->view != NULL) {
+        munmap(b->view, b->total);
+        b->view = NULL;
+    }
+    if (b->spilled) {
+        close(b->spill_fd);
+        b->spilled = false;
+    }
+}
+
+// n more bytes of the stream at p, before a ring drops any of them
+static inline void took(CaptureBuf *b, const char *p, size_t n) {
+    b->total += n;
+    if (b->digest) {
+        update_Digest(&b->hasher, p, n);
+    }
+}
+
+int append_CaptureBuf(CaptureBuf *b, const char *p, size_t n) {
+    if (spill_due(b, n) && start_spill(b)) {
+        return -1;
+    }
+    if (b->spilled) {
+        if (write_all(b->spill_fd, p, n)) {
+            return -1;
+        }
+        took(b, p, n);
+        if (b->timestamps) {
+            add_stamp(b, n);
+        }
+        return 0;
+    }
+    took(b, p, n);
+    if (b->timestamps) {
+        add_stamp(b, n);
+    }
+    if (b->limit == 0) {
+        if (reserve_CaptureBuf(b, n)) {
+            return -1;
+        }
+        memcpy(b->data + b->len, p, n);
+        b->len += n;
+        b->data[b->len] = '\0';
+        return 0;
+    }
+    if (b->data == NULL) {
+        if ((b->data = malloc(b->limit + 1)) == NULL) {
+            return -1;
+        }
+        b->cap = b->limit + 1;
+    }
+    if (n > b->limit) { // only the last limit bytes can survive anyway
+        p += n - b->limit;
+        n = b->limit;
+    }
+    size_t first = b->limit - b->head < n ? b->limit - b->head : n;
+    memcpy(b->data + b->head, p, first);
+    memcpy(b->data, p + first, n - first);
+    b->head = (b->head + n) % b->limit;
+    b->len = b->total < b->limit ? b->total : b->limit;
+    return 0;
+}
+
+static void reverse(char *p, size_t n) {
+    for (size_t i = 0, j = n ? n - 1 : 0; i < j; i++, j--) {
+        char t = p[i];
+        p[i] = p[j];
+        p[j] = t;
+    }
+}
+
+void finish_CaptureBuf(CaptureBuf *b) {
+    convert_stamps(b);
+    if (b->digest) {
+        b->sum = final_Digest(&b->hasher);
+    }
+    if (b->limit == 0 || b->data == NULL) {
+        return;
+    }
+    if (b->total > b->limit && b->head != 0) {
+        // rotate left by head in place: the oldest kept byte sits at head
+        reverse(b->data, b->head);
+        reverse(b->data + b->head, b->limit - b->head);
+        reverse(b->data, b->limit);
+    }
+    b->head = b->len % b->limit;
+    b->data[b->len] = '\0';
+}
+
+// how much of want a read may take before stop_bytes
+static size_t stop_room(const CaptureBuf *b, size_t want) {
+    if (b->stop_bytes == 0) {
+        return want;
+    }
+    size_t left = b->stop_bytes - b->total;
+    return left < want ? left : want;
+}
+
+// stop_lines: how much of the n bytes just read at p to keep, up to and
+// including the line that meets it; bytes past it are never taken
+static size_t take_lines(CaptureBuf *b, const char *p, size_t n) {
+    if (b->stop_lines == 0) {
+        return n;
+    }
+    for (const char *q = p, *end = p + n; (q = memchr(q, '\n', end - q)) != NULL; q++) {
+        if (++b->n_lines == b->stop_lines) {
+            b->stopped = true;
+            return q + 1 - p;
+        }
+    }
+    return n;
+}
+
+static void check_stop(CaptureBuf *b) {
+    if (b->stop_bytes > 0 && b->total >= b->stop_bytes) {
+        b->stopped = true;
+    }
+}
+
+// unbounded buffers are read into directly, rings via a bounce buffer
+// so a small limit still drains the pipe in large reads
+ssize_t fill_CaptureBuf(CaptureBuf *b, int fd) {
+    char scratch[CAPTURE_MIN_READ];
+    ssize_t n;
+
+    if (b->stopped) {
+        return 0;
+    }
+    if (b->limit > 0) {
+        n = read(fd, scratch, stop_room(b, sizeof(scratch)));
+        if (n > 0) {
+            n = take_lines(b, scratch, n);
+            if (append_CaptureBuf(b, scratch, n)) {
+                errno = ENOMEM;
+                return -1;
+            }
+            check_stop(b);
+        }
+        return n;
+    }
+    if (spill_due(b, 0) && start_spill(b)) {
+        return -1;
+    }
+    if (b->spilled) {
+        // straight from the pipe into the file's page cache, unless there
+        // are lines to count or bytes to hash
+        n = -1;
+        errno = EINVAL;
+        if (b->stop_lines == 0 && !b->digest) {
+            n = splice(fd, NULL, b->spill_fd, NULL, stop_room(b, CAPTURE_SPILL_CHUNK),
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        }
+        if (n < 0 && errno == EINVAL) { // not a pipe: bounce it
+            n = read(fd, scratch, stop_room(b, sizeof(scratch)));
+            if (n > 0) {
+                n = take_lines(b, scratch, n);
+                if (write_all(b->spill_fd, scratch, n)) {
+                    return -1;
+                }
+            }
+        }
+        if (n > 0) {
+            took(b, scratch, n); // scratch is only skipped by a splice, which leaves digest off
+            if (b->timestamps) {
+                add_stamp(b, n);
+            }
+            check_stop(b);
+        }
+        return n;
+    }
+    if (reserve_CaptureBuf(b, CAPTURE_MIN_READ)) {
+        errno = ENOMEM;
+        return -1;
+    }
+    n = read(fd, b->data + b->len, stop_room(b, b->cap - b->len - 1));
+    if (n > 0) {
+        n = take_lines(b, b->data + b->len, n);
+        took(b, b->data + b->len, n);
+        b->len += n;
+        b->data[b->len] = '\0';
+        if (b->timestamps) {
+            add_stamp(b, n);
+        }
+        check_stop(b);
+    }
+    return n;
+}
+
+void short_circuit_ProcInfo(ProcInfo *ci, int fd, int signo) {
+    if (fd == ci->p_stdout) {
+        ci->p_stdout = -1;
+    } else if (fd == ci->p_stderr) {
+        ci->p_stderr = -1;
+    }
+    close(fd);
+    if (signo > 0 && ci->pid > 0 &&
+            (ci->pidfd < 0 || syscall(SYS_pidfd_send_signal, ci->pidfd, signo, NULL, 0) < 0)) {
+        kill(ci->pid, signo);
+    }
+}
+
+int run_and_capture(ProcInfo *ci, char* args[], char* env[], CaptureResult *res) {
+    struct pollfd plist[2];
+    CaptureBuf *bufs[2] = {&res->out, &res->err};
+    bool any = false; // time to first byte counts either stream
+    int rc;
+
+    reset_CaptureResult(res);
+    res->status = -1;
+    if ((rc = subprocess(ci, args, env)) != 0) {
+        return rc;
+    }
+    if (ci->stdin_type == PROC_COM_PIPE && ci->p_stdin >= 0) {
+        close(ci->p_stdin); // nothing to feed: give the child EOF
+        ci->p_stdin = -1;
+    }
+    plist[0] = (struct pollfd){.fd = ci->stdout_type == PROC_COM_CAPTURE ? ci->p_stdout : -1,
+        .events = POLLIN};
+    plist[1] = (struct pollfd){.fd = ci->stderr_type == PROC_COM_CAPTURE ? ci->p_stderr : -1,
+        .events = POLLIN};
+    // read both until EOF so a full stderr pipe can't stall a child writing stdout
+    while (plist[0].fd >= 0 || plist[1].fd >= 0) {
+        if (poll(plist, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            showError(false, "Failed to poll subprocess %s: %s!", args[0], strerror(errno));
+            break;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (plist[i].fd >= 0 && plist[i].revents) {
+                ssize_t n = fill_CaptureBuf(bufs[i], plist[i].fd);
+                TRACE3(capture__read, ci->pid, plist[i].fd, n);
+                if (n > 0) {
+                    metrics_read(ci, STDOUT_FILENO + i, n, !any);
+                    workload_read(ci, STDOUT_FILENO + i, n);
+                    any = true;
+                }
+                if (bufs[i]->stopped) {
+                    short_circuit_ProcInfo(ci, plist[i].fd, res->stop_signal);
+                    plist[i].fd = -1;
+                } else if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+                    plist[i].fd = -1;
+                }
+            }
+        }
+    }
+    finish_CaptureBuf(&res->out);
+    finish_CaptureBuf(&res->err);
+    reap_ProcInfo(ci, &res->status, 0);
+    close_ProcInfo(ci);
+    return 0;
+}
+
+uint64_t digest_CaptureBuf(const CaptureBuf *b) {
+    if (b->total == 0) {
+        return 0;
+    }
+    return b->digest ? b->sum : digest_bytes(b->data, b->len, 0);
+}
+
+const char *map_CaptureBuf(CaptureBuf *b, size_t *len) {
+    if (!b->spilled) {
+        *len = b->len;
+        return b->data != NULL ? b->data : "";
+    }
+    *len = b->total;
+    if (b->view == NULL && b->total > 0) {
+        void *p = mmap(NULL, b->total, PROT_READ, MAP_SHARED, b->spill_fd, 0);
+        if (p == MAP_FAILED) {
+            showError(false, "Failed to map capture spill file: %s!", strerror(errno));
+            *len = 0;
+            return NULL;
+        }
+        b->view = p;
+    }
+    return b->view;
+}
+
+// chunk i of b: where its bytes are in view, clipped to what was kept
+static void chunk_span(const CaptureBuf *b, size_t i, size_t kept_from, size_t *from, size_t *to) {
+    size_t a = b->stamps[i].offset, z = i + 1 < b->n_stamps ? b->stamps[i + 1].offset : b->total;
+    a = a > kept_from ? a : kept_from;
+    z = z > kept_from ? z : kept_from;
+    *from = a - kept_from;
+    *to = z - kept_from;
+}
+
+int write_interleaved_CaptureResult(CaptureResult *res, int fd) {
+    CaptureBuf *bufs[2] = {&res->out, &res->err};
+    const char *view[2];
+    size_t len[2], kept_from[2], next[2] = {0, 0};
+
+    for (int s = 0; s < 2; s++) {
+        finish_CaptureBuf(bufs[s]);
+        if ((view[s] = map_CaptureBuf(bufs[s], &len[s])) == NULL) {
+            return -1;
+        }
+        kept_from[s] = bufs[s]->total - len[s]; // a ring kept only the tail
+    }
+    while (next[0] < bufs[0]->n_stamps || next[1] < bufs[1]->n_stamps) {
+        int s = next[1] >= bufs[1]->n_stamps ? 0 : next[0] >= bufs[0]->n_stamps ? 1 :
+            bufs[1]->stamps[next[1]].ns < bufs[0]->stamps[next[0]].ns;
+        size_t from, to;
+        chunk_span(bufs[s], next[s]++, kept_from[s], &from, &to);
+        if (to > from && write_all(fd, view[s] + from, to - from)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void reset_CaptureResult(CaptureResult *res) {
+    drop_spill(&res->out);
+    drop_spill(&res->err);
+    res->out.n_stamps = res->err.n_stamps = 0;
+    res->out.n_lines = res->err.n_lines = 0;
+    res->out.stopped = res->err.stopped = false;
+    init_Digest(&res->out.hasher, 0);
+    init_Digest(&res->err.hasher, 0);
+    res->out.sum = res->err.sum = 0;
+    res->out.tsc0 = res->err.tsc0 = 0;
+    res->out.len = res->out.total = res->out.head = 0;
+    res->err.len = res->err.total = res->err.head = 0;
+    if (res->out.data != NULL) {
+        res->out.data[0] = '\0';
+    }
+    if (res->err.data != NULL) {
+        res->err.data[0] = '\0';
+    }
+}
+
+void free_CaptureResult(CaptureResult *res) {
+    CaptureBuf out = res->out, err = res->err;
+    int stop_signal = res->stop_signal;
+    drop_spill(&res->out);
+    drop_spill(&res->err);
+    free(res->out.data);
+    free(res->err.data);
+    free(res->out.stamps);
+    free(res->err.stamps);
+    memset(res, 0, sizeof(*res));
+    res->out.timestamps = out.timestamps;
+    res->err.timestamps = err.timestamps;
+    res->out.limit = out.limit;
+    res->err.limit = err.limit;
+    res->out.spill_at = out.spill_at;
+    res->err.spill_at = err.spill_at;
+    res->out.spill_dir = out.spill_dir;
+    res->err.spill_dir = err.spill_dir;
+    res->out.stop_bytes = out.stop_bytes;
+    res->err.stop_bytes = err.stop_bytes;
+    res->out.stop_lines = out.stop_lines;
+    res->err.stop_lines = err.stop_lines;
+    res->out.digest = out.digest;
+    res->err.digest = err.digest;
+    res->stop_signal = stop_signal;
+}
+
+const char *map_memfd(int fd, size_t *len) {
+    struct stat sb;
+
+    *len = 0;
+    if (fstat(fd, &sb) || sb.st_size == 0) {
+        return NULL;
+    }
+    void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        showError(false, "Failed to map memfd %d: %s!", fd, strerror(errno));
+        return NULL;
+    }
+    *len = sb.st_size;
+    return p;
+}
+
+void unmap_memfd(const char *data, size_t len) {
+    if (data != NULL) {
+        munmap((void *)data, len);
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+#include "digest.h"
+
+// when a chunk of a stream arrived
+typedef struct {
+    uint64_t offset;    // bytes of the stream before it, dropped ones included
+    uint64_t ns;        // CLOCK_MONOTONIC of its read, once finish_CaptureBuf() ran
+} CaptureStamp;
+
+// growable capture buffer, kept NUL-terminated
+// with limit set it becomes a fixed ring that keeps only the last limit
+// bytes, so a chatty child costs constant memory; total still counts all.
+// With spill_at set instead, output past that size moves to an unlinked
+// temp file: data keeps only the first spill_at bytes, the file all of it,
+// and map_CaptureBuf() shows the whole output either way
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    size_t limit;   // input: 0 keeps everything, else ring size in bytes
+    size_t total;   // bytes the child wrote, including dropped ones
+    size_t head;    // ring: next write offset
+    size_t spill_at;        // input: 0 keeps everything in memory
+    const char *spill_dir;  // input: for the temp file, NULL for $TMPDIR or /tmp
+    bool spilled;           // the temp file holds the output
+    int spill_fd;
+    char *view;             // map_CaptureBuf() of a spilled buffer
+    // input timestamps: stamp every chunk in stamps, a side array of 16
+    // bytes per read. Raw TSC reads where the kernel clocksource is the TSC,
+    // turned into CLOCK_MONOTONIC by finish_CaptureBuf(), else clock_gettime()
+    bool timestamps;
+    CaptureStamp *stamps;
+    size_t n_stamps;
+    size_t cap_stamps;
+    uint64_t tsc0;          // raw stamps: the TSC at the first one, 0 once converted
+    uint64_t tsc0_ns;
+    // input short-circuit: once the first stop_bytes bytes or stop_lines
+    // lines are in, the buffer holds exactly those, stopped is set and
+    // fill_CaptureBuf() reads no more (it returns 0, like at EOF). The
+    // library's loops then close the parent's end, so the child gets
+    // EPIPE/SIGPIPE instead of writing output nobody reads
+    size_t stop_bytes;      // 0 for no limit
+    size_t stop_lines;      // 0 for no limit
+    size_t n_lines;         // stop_lines: '\n's taken so far
+    bool stopped;
+    // input digest: hash every byte as it is read, so sum is the XXH64 of
+    // the whole output (a ring's dropped bytes included) without a second
+    // pass over it. A spilling buffer then reads instead of splicing
+    bool digest;
+    Digest hasher;
+    uint64_t sum;           // set by finish_CaptureBuf()
+} CaptureBuf;
+
+// output of run_and_capture(); reuse one across calls to keep its buffers
+typedef struct {
+    CaptureBuf out;     // stdout when stdout_type == PROC_COM_CAPTURE
+    CaptureBuf err;     // stderr when stderr_type == PROC_COM_CAPTURE
+    int status;         // wait status of the child
+    int stop_signal;    // input: sent to the child once a stream stopped, 0 to leave it to SIGPIPE
+} CaptureResult;
+
+// make room for at least want more bytes, growing geometrically
+int reserve_CaptureBuf(CaptureBuf *b, size_t want);
+// append n bytes, honoring limit
+int append_CaptureBuf(CaptureBuf *b, const char *p, size_t n);
+// one read() from fd into b; bytes read, 0 at EOF (or once stopped), -1 with errno
+ssize_t fill_CaptureBuf(CaptureBuf *b, int fd);
+// a stream of ci stopped early: close the parent's end fd (p_stdout or
+// p_stderr, out of any event loop by now) and send signo unless 0
+void short_circuit_ProcInfo(ProcInfo *ci, int fd, int signo);
+// for a ring, rotate the kept tail to the front so data[0..len) is in order;
+// converts raw timestamps
+void finish_CaptureBuf(CaptureBuf *b);
+// XXH64 of the output for journals and dedup: the streamed sum, or for a
+// buffer without digest a pass over what it kept; 0 if there was none
+uint64_t digest_CaptureBuf(const CaptureBuf *b);
+// everything captured (total bytes): data, or a read-only mapping of the
+// temp file once spilled (after the child is done); NULL on failure.
+// Valid until the buffer is reset or freed
+const char *map_CaptureBuf(CaptureBuf *b, size_t *len);
+// spawn args with ci's streams, drain every PROC_COM_CAPTURE stream
+// concurrently until EOF, then reap; a piped stdin is closed right away
+// returns subprocess()'s rc, res->status holds the wait status
+int run_and_capture(ProcInfo *ci, char* args[], char* env[], CaptureResult *res);
+// write both timestamped streams of res to fd as their chunks arrived,
+// what PROC_COM_STDOUT would have merged; bytes a ring dropped are skipped
+int write_interleaved_CaptureResult(CaptureResult *res, int fd);
+// forget captured bytes but keep the buffers (and limits) for the next run
+void reset_CaptureResult(CaptureResult *res);
+void free_CaptureResult(CaptureResult *res);
+
+// map everything a PROC_COM_MEMFD stream received (call once the child exited)
+// returns NULL with *len == 0 for empty output; release with unmap_memfd()
+const char *map_memfd(int fd, size_t *len);
+void unmap_memfd(const char *data, size_t len);
+
+#endif // CAPTURE_H
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "child.h"
+
+bool is_dst_FdMap(const FdMap *m, int fd) {
+    for (int i = 0; m != NULL && i < m->n; i++) {
+        if (m->dst[i] == fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int exec_ChildSetup(void *arg) {
+    ChildSetup *cs = arg;
+
+    for (int i = 0; i < cs->n_ns_fds; i++) {
+        if (setns(cs->ns_fds[i], 0) < 0) {
+            goto fail;
+        }
+    }
+    if (cs->set_pgroup && setpgid(0, cs->pgroup) < 0) {
+        goto fail;
+    }
+    if (cs->cpus != NULL && sched_setaffinity(0, sizeof(cpu_set_t), cs->cpus) < 0) {
+        goto fail;
+    }
+    if (cs->nice != 0) {
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0 || setpriority(PRIO_PROCESS, 0, prio + cs->nice) < 0) {
+            goto fail;
+        }
+    }
+    if (cs->set_sched) {
+        struct sched_param sp = {.sched_priority = cs->sched_priority};
+        if (sched_setscheduler(0, cs->sched_policy, &sp) < 0) {
+            goto fail;
+        }
+    }
+    for (int i = 0; i < cs->n_rlimits; i++) {
+        struct rlimit rl = {cs->rlimits[i].cur, cs->rlimits[i].max};
+        if (setrlimit(cs->rlimits[i].resource, &rl) < 0) {
+            cs->err_value = cs->rlimits[i].resource;
+            goto fail;
+        }
+    }
+    if (cs->pdeathsig != 0) {
+        if (prctl(PR_SET_PDEATHSIG, cs->pdeathsig) < 0) {
+            cs->err_value = -1;
+            goto fail;
+        }
+        pid_t ppid = getppid();
+        if (ppid != cs->ppid && ppid != 0) { // orphaned before the prctl took; 0 in a new pid namespace
+            raise(cs->pdeathsig);
+        }
+    }
+    if (cs->set_umask) {
+        umask(cs->umask);
+    }
+    // move the executable out of the way of the dups, and keep it open
+    // past close_fds; O_CLOEXEC, so exec drops it like any other fd
+    int exe_fd = cs->use_exe_fd ? cs->exe_fd : -1;
+    if (exe_fd >= 0 && (exe_fd <= STDERR_FILENO || is_dst_FdMap(cs->extra, exe_fd))) {
+        int above = cs->extra != NULL ? cs->extra->max_dst + 1 : STDERR_FILENO + 1;
+        if ((exe_fd = fcntl(exe_fd, F_DUPFD_CLOEXEC, above)) < 0) {
+            goto fail;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        switch (cs->op[i]) {
+            case SPAWN_OP_PIPE:
+            case SPAWN_OP_FD:
+            case SPAWN_OP_MEMFD:
+            case SPAWN_OP_SOCKETPAIR:
+                if (cs->fds[i] == i) {
+                    fcntl(i, F_SETFD, 0);
+                } else if (dup2(cs->fds[i], i) < 0) {
+                    goto fail;
+                }
+                break;
+            case SPAWN_OP_OPEN: {
+                int fd = open(cs->paths[i], cs->oflags[i], 0644);
+                if (fd < 0) {
+                    goto fail;
+                }
+                if (fd != i) {
+                    dup2(fd, i);
+                    close(fd);
+                }
+                break;
+            }
+            case SPAWN_OP_CLOSE:
+                close(i);
+                break;
+            case SPAWN_OP_DUP_STDOUT:
+                dup2(STDOUT_FILENO, STDERR_FILENO);
+                break;
+            case SPAWN_OP_DUP_STDIN:
+                dup2(STDIN_FILENO, STDOUT_FILENO);
+                break;
+        }
+    }
+    int lowfd = STDERR_FILENO + 1;
+    if (cs->extra != NULL) {
+        for (int i = 0; i < cs->extra->n; i++) {
+            if (dup2(cs->extra->src[i], cs->extra->dst[i]) < 0) {
+                goto fail;
+            }
+        }
+        lowfd = cs->extra->max_dst + 1;
+    }
+    if (cs->close_fds) {
+        for (int fd = STDERR_FILENO + 1; fd < lowfd; fd++) {
+            if (fd != exe_fd && !is_dst_FdMap(cs->extra, fd)) {
+                close(fd);
+            }
+        }
+        if (exe_fd >= lowfd) {
+            if (exe_fd > lowfd) {
+                syscall(SYS_close_range, lowfd, exe_fd - 1, 0);
+            }
+            syscall(SYS_close_range, exe_fd + 1, ~0U, 0);
+        } else {
+            syscall(SYS_close_range, lowfd, ~0U, 0);
+        }
+    }
+    if (cs->sigmask != NULL) {
+        // the spawner blocked everything so no handler runs on shared memory;
+        // handlers must not run in the child either
+        struct sigaction sa = {.sa_handler = SIG_DFL};
+        for (int sig = 1; sig < NSIG; sig++) {
+            struct sigaction old;
+            if (sig != SIGKILL && sig != SIGSTOP && sigaction(sig, NULL, &old) == 0 &&
+                    old.sa_handler != SIG_IGN && old.sa_handler != SIG_DFL) {
+                sigaction(sig, &sa, NULL);
+            }
+        }
+        sigprocmask(SIG_SETMASK, cs->sigmask, NULL);
+    }
+    if (exe_fd >= 0) {
+        syscall(SYS_execveat, exe_fd, "", cs->args, cs->env, AT_EMPTY_PATH);
+        if (errno != ENOSYS || cs->exe == NULL) {
+            goto fail;
+        }
+    }
+    if (cs->exe != NULL) {
+        execve(cs->exe, cs->args, cs->env);
+    } else {
+        execvpe(cs->args[0], cs->args, cs->env);
+    }
+fail:
+    cs->err = errno;
+    _exit(127);
+}
+
+#if defined(__x86_64__) && defined(SYS_clone3)
+// glibc has no clone3 wrapper, and with CLONE_VM the child must not return
+// through our frame: switch stacks in the syscall and call fn from there
+pid_t clone3_run(struct clone_args *ca, int (*fn)(void *), void *arg) {
+    register int (*r12)(void *) asm("r12") = fn;
+    register void *r13 asm("r13") = arg;
+    long ret;
+
+    asm volatile(
+        "syscall\n\t"
+        "test %%rax, %%rax\n\t"
+        "jnz 1f\n\t"
+        "mov %%r13, %%rdi\n\t"
+        "call *%%r12\n\t"
+        "mov %%eax, %%edi\n\t"
+        "mov %[nr_exit], %%eax\n\t"
+        "syscall\n\t"
+        "hlt\n"
+        "1:"
+        : "=a"(ret)
+        : "a"(SYS_clone3), "D"(ca), "S"(sizeof(*ca)), "r"(r12), "r"(r13),
+          [nr_exit] "i"(SYS_exit)
+        : "rcx", "r11", "memory");
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+    return (pid_t)ret;
+}
+#else
+pid_t clone3_run(struct clone_args *ca, int (*fn)(void *), void *arg) {
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+int join_cgroup(int cgroup_fd, pid_t pid) {
+    char buf[16];
+    int len = snprintf(buf, sizeof(buf), "%d\n", pid);
+    int fd = openat(cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 1;
+    }
+    int rc = write(fd, buf, len) == len ? 0 : 1;
+    close(fd);
+    return rc;
+}
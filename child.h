@@ -0,0 +1,76 @@
+#ifndef CHILD_H
+#define CHILD_H
+
+#include <stdbool.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <linux/sched.h>
+
+#include "subprocess.h"
+
+// Child-side setup shared by every spawn path that clones by hand (the spawn
+// server and CLONE_INTO_CGROUP spawns). The child shares the spawner's memory
+// (CLONE_VM | CLONE_VFORK), so nothing here may allocate or take locks.
+
+#define SPAWN_MAX_EXTRA_FDS 16
+
+// fds dup2()ed onto fixed numbers above stderr in the child; every src sits
+// above every dst, so the dups can run in any order
+typedef struct {
+    int n;
+    int src[SPAWN_MAX_EXTRA_FDS];
+    int dst[SPAWN_MAX_EXTRA_FDS];
+    bool owned[SPAWN_MAX_EXTRA_FDS]; // src is a spawn-time copy the parent closes afterwards
+    int max_dst;                     // highest dst, STDERR_FILENO if none
+} FdMap;
+
+typedef struct {
+    int op[3];              // SpawnOpType per stream
+    int oflags[3];          // SPAWN_OP_OPEN flags
+    const char* paths[3];   // SPAWN_OP_OPEN paths
+    int fds[3];             // SPAWN_OP_PIPE/FD/MEMFD fd to dup2 onto 0/1/2, -1 if none
+    const FdMap *extra;     // fds beyond 0-2, NULL if none
+    bool close_fds;
+    // scheduling, see ProcInfo
+    const cpu_set_t *cpus;
+    int nice;
+    bool set_sched;
+    int sched_policy;
+    int sched_priority;
+    bool set_pgroup;
+    pid_t pgroup;
+    const sigset_t *sigmask; // reset handlers and restore this mask before exec, NULL to skip
+    const int *ns_fds;      // setns() into each before anything else
+    int n_ns_fds;
+    // pre-exec steps, see ProcInfo
+    const SpawnRlimit *rlimits;
+    int n_rlimits;
+    int pdeathsig;
+    pid_t ppid;             // the spawner: pdeathsig fires at once if it is gone already
+    bool set_umask;
+    mode_t umask;
+    const char* exe;        // absolute executable, NULL to search PATH for args[0]
+    bool use_exe_fd;        // execveat exe_fd instead, exe is the fallback without execveat
+    int exe_fd;
+    char** args;
+    char** env;
+    volatile int err;       // exec errno, written by the child
+    volatile int err_value; // err from a pre-exec step: the SpawnError value, else -2
+} ChildSetup;
+
+// true if fd is the dst of an entry in m
+bool is_dst_FdMap(const FdMap *m, int fd);
+
+// clone entry point: apply cs (a ChildSetup*) and exec; never returns
+int exec_ChildSetup(void *cs);
+
+// clone3(ca) running fn(arg) in the child on ca->stack; the child must exec
+// or _exit. Returns the child pid, or -1 with errno set (ENOSYS where clone3
+// or the trampoline is unavailable)
+pid_t clone3_run(struct clone_args *ca, int (*fn)(void *), void *arg);
+
+// CLONE_INTO_CGROUP stand-in: move pid into the cgroup directory cgroup_fd
+int join_cgroup(int cgroup_fd, pid_t pid);
+
+#endif // CHILD_H
@@ -0,0 +1,183 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "subprocess.h"
+#include "chrome_trace.h"
+
+static uint64_t next_id = 1;
+static __thread TraceRing *my_ring;
+static __thread uint64_t my_trace;   // id of the trace my_ring belongs to
+
+static TraceRing *ring_of(ChromeTrace *t) {
+    if (my_trace == t->id) {
+        return my_ring;
+    }
+    TraceRing *r = calloc(1, sizeof(TraceRing));
+    if (r == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&t->lock);
+    r->next = t->rings;
+    t->rings = r;
+    pthread_mutex_unlock(&t->lock);
+    my_ring = r;
+    my_trace = t->id;
+    return r;
+}
+
+static void push(ChromeTrace *t, const TraceEvent *ev) {
+    TraceRing *r = ring_of(t);
+
+    if (r == NULL) {
+        return;
+    }
+    uint64_t head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == TRACE_RING) {
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+    r->ev[head & (TRACE_RING - 1)] = *ev;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void span_ChromeTrace(ChromeTrace *t, int track, const char *name, uint64_t start_ns, uint64_t end_ns, pid_t pid) {
+    TraceEvent ev = {.name = name, .ts_ns = start_ns, .dur_ns = end_ns > start_ns ? end_ns - start_ns : 0,
+        .track = track, .pid = pid, .ph = 'X'};
+    push(t, &ev);
+}
+
+void async_ChromeTrace(ChromeTrace *t, uint64_t id, const char *name, uint64_t start_ns, uint64_t end_ns, pid_t pid) {
+    TraceEvent ev = {.name = name, .ts_ns = start_ns, .dur_ns = end_ns > start_ns ? end_ns - start_ns : 0,
+        .id = id, .pid = pid, .ph = 'b'};
+    push(t, &ev);
+}
+
+void instant_ChromeTrace(ChromeTrace *t, int track, const char *name, uint64_t ns, pid_t pid) {
+    TraceEvent ev = {.name = name, .ts_ns = ns, .track = track, .pid = pid, .ph = 'i'};
+    push(t, &ev);
+}
+
+// one JSON object per line, each but the first led by a comma
+static void emit(ChromeTrace *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void emit(ChromeTrace *t, const char *fmt, ...) {
+    va_list args;
+
+    fputs(t->first ? "\n" : ",\n", t->out);
+    t->first = false;
+    va_start(args, fmt);
+    vfprintf(t->out, fmt, args);
+    va_end(args);
+}
+
+static void write_event(ChromeTrace *t, const TraceEvent *ev) {
+    double ts = ev->ts_ns / 1e3, dur = ev->dur_ns / 1e3;
+
+    if (ev->ph != 'b' && ev->track >= 0 && ev->track < TRACE_MAX_TRACKS &&
+            !(t->named[ev->track / 64] & (1ull << (ev->track % 64)))) {
+        t->named[ev->track / 64] |= 1ull << (ev->track % 64);
+        emit(t, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"slot %d\"}}",
+            ev->track, ev->track);
+    }
+    switch (ev->ph) {
+        case 'X':
+            emit(t, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"pid\":%d}}",
+                ev->name, ts, dur, ev->track, ev->pid);
+            break;
+        case 'b':
+            emit(t, "{\"name\":\"%s\",\"cat\":\"job\",\"ph\":\"b\",\"id\":%llu,\"ts\":%.3f,\"pid\":1,\"args\":{\"pid\":%d}}",
+                ev->name, (unsigned long long)ev->id, ts, ev->pid);
+            emit(t, "{\"name\":\"%s\",\"cat\":\"job\",\"ph\":\"e\",\"id\":%llu,\"ts\":%.3f,\"pid\":1}",
+                ev->name, (unsigned long long)ev->id, ts + dur);
+            break;
+        case 'i':
+            emit(t, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"pid\":%d}}",
+                ev->name, ts, ev->track, ev->pid);
+            break;
+    }
+    t->written++;
+}
+
+// with t->lock held
+static void drain(ChromeTrace *t) {
+    for (TraceRing *r = t->rings; r != NULL; r = r->next) {
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        for (uint64_t i = r->tail; i != head; i++) {
+            write_event(t, &r->ev[i & (TRACE_RING - 1)]);
+        }
+        __atomic_store_n(&r->tail, head, __ATOMIC_RELEASE);
+    }
+    fflush(t->out);
+}
+
+void flush_ChromeTrace(ChromeTrace *t) {
+    pthread_mutex_lock(&t->lock);
+    drain(t);
+    pthread_mutex_unlock(&t->lock);
+}
+
+static void *flusher_main(void *arg) {
+    ChromeTrace *t = arg;
+
+    pthread_mutex_lock(&t->lock);
+    while (!t->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += t->flush_ms / 1000;
+        until.tv_nsec += (long)(t->flush_ms % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&t->wake, &t->lock, &until);
+        drain(t);
+    }
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+int init_ChromeTrace(ChromeTrace *t, const char *path, int flush_ms) {
+    memset(t, 0, sizeof(*t));
+    if ((t->out = fopen(path, "we")) == NULL) {
+        showError(false, "Failed to open trace %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    t->id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    t->flush_ms = flush_ms > 0 ? flush_ms : TRACE_FLUSH_MS;
+    t->first = true;
+    fputs("[", t->out);
+    emit(t, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"job runner\"}}");
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->wake, NULL);
+    if (pthread_create(&t->flusher, NULL, flusher_main, t) != 0) {
+        showError(false, "Failed to start the trace flusher!");
+        pthread_cond_destroy(&t->wake);
+        pthread_mutex_destroy(&t->lock);
+        fclose(t->out);
+        t->out = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void close_ChromeTrace(ChromeTrace *t) {
+    pthread_mutex_lock(&t->lock);
+    t->stop = true;
+    pthread_cond_signal(&t->wake);
+    pthread_mutex_unlock(&t->lock);
+    pthread_join(t->flusher, NULL);
+    drain(t);
+    while (t->rings != NULL) {
+        TraceRing *r = t->rings;
+        t->rings = r->next;
+        t->dropped += r->dropped;
+        free(r);
+    }
+    fputs("\n]\n", t->out);
+    fclose(t->out);
+    t->out = NULL;
+    pthread_cond_destroy(&t->wake);
+    pthread_mutex_destroy(&t->lock);
+}
@@ -0,0 +1,65 @@
+#ifndef CHROME_TRACE_H
+#define CHROME_TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define TRACE_RING 4096             // events per thread buffer, power of two
+#define TRACE_FLUSH_MS 200          // default background flush period
+#define TRACE_MAX_TRACKS 4096       // tracks named "slot N" in the viewer
+
+typedef struct {
+    const char *name;       // static storage
+    uint64_t ts_ns;         // CLOCK_REALTIME
+    uint64_t dur_ns;
+    uint64_t id;            // async spans: pairs begin and end
+    int track;
+    pid_t pid;              // shown as an arg, 0 for none
+    char ph;                // 'X' span on its track, 'b' async span, 'i' instant
+} TraceEvent;
+
+// one writer thread's events: single producer, the flusher the only consumer
+typedef struct TraceRing {
+    TraceEvent ev[TRACE_RING];
+    uint64_t head;          // written by the producer
+    uint64_t tail;          // written by the flusher
+    uint64_t dropped;       // events lost to a full ring
+    struct TraceRing *next;
+} TraceRing;
+
+// Chrome trace event JSON (chrome://tracing, ui.perfetto.dev), one track per
+// runner slot: writers append to a lock-free ring of their own thread and a
+// background thread turns the rings into JSON every flush_ms, so tracing
+// costs a writer a few stores per event and never a syscall
+typedef struct {
+    FILE *out;
+    uint64_t id;            // tells a thread's cached ring from a dead trace's
+    pthread_mutex_t lock;   // the ring list and the output
+    pthread_cond_t wake;
+    pthread_t flusher;
+    TraceRing *rings;
+    int flush_ms;
+    bool stop;
+    bool first;             // no event written yet
+    uint64_t written;
+    uint64_t dropped;
+    uint64_t named[TRACE_MAX_TRACKS / 64]; // tracks that got their name
+} ChromeTrace;
+
+// write to path (truncated); flush_ms <= 0 uses TRACE_FLUSH_MS
+int init_ChromeTrace(ChromeTrace *t, const char *path, int flush_ms);
+// flush what is left, finish the JSON and free every ring; no writer
+// may still be using t
+void close_ChromeTrace(ChromeTrace *t);
+void span_ChromeTrace(ChromeTrace *t, int track, const char *name, uint64_t start_ns, uint64_t end_ns, pid_t pid);
+// a span that may overlap others, such as time in a queue, on its own row
+void async_ChromeTrace(ChromeTrace *t, uint64_t id, const char *name, uint64_t start_ns, uint64_t end_ns, pid_t pid);
+void instant_ChromeTrace(ChromeTrace *t, int track, const char *name, uint64_t ns, pid_t pid);
+// write out every ring right now
+void flush_ChromeTrace(ChromeTrace *t);
+
+#endif // CHROME_TRACE_H
@@ -0,0 +1,418 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+#include "cluster.h"
+
+// ---- per-node queues
+
+static int push_tail(ClusterNode *n, Job *job) {
+    if (n->q_len == n->q_cap) {
+        size_t cap = n->q_cap ? n->q_cap * 2 : 64;
+        Job **q = malloc(cap * sizeof(Job *));
+        if (q == NULL) {
+            return 1;
+        }
+        for (size_t i = 0; i < n->q_len; i++) { // unwrap the ring
+            q[i] = n->queue[(n->q_head + i) % n->q_cap];
+        }
+        free(n->queue);
+        n->queue = q;
+        n->q_head = 0;
+        n->q_cap = cap;
+    }
+    n->queue[(n->q_head + n->q_len++) % n->q_cap] = job;
+    job->placed = n;
+    return 0;
+}
+
+static Job *pop_head(ClusterNode *n) {
+    Job *job = n->queue[n->q_head];
+    n->q_head = (n->q_head + 1) % n->q_cap;
+    n->q_len--;
+    return job;
+}
+
+static Job *pop_tail(ClusterNode *n) {
+    return n->queue[(n->q_head + --n->q_len) % n->q_cap];
+}
+
+// ---- placement
+
+// children the node should run for us right now: its slots, less what the
+// agent's other clients run, shrunk by CPU or memory pressure; never 0, so
+// a busy node still drains its queue
+static int capacity(const ClusterNode *n) {
+    int slots = n->slots > 0 ? n->slots : n->load.ncpu;
+    int others = n->load.running - n->n_running;
+    double pressure = n->load.cpu_pressure > n->load.mem_pressure ? n->load.cpu_pressure : n->load.mem_pressure;
+
+    if (others > 0) {
+        slots -= others;
+    }
+    slots = (int)(slots * (1 - pressure / 100));
+    return slots > 0 ? slots : 1;
+}
+
+static int free_slots(const ClusterNode *n) {
+    int f = capacity(n) - n->n_running;
+    return f > 0 ? f : 0;
+}
+
+// the up node where a new job would wait least, NULL if none is up
+static ClusterNode *place(Cluster *cl) {
+    ClusterNode *best = NULL;
+    double best_wait = 0;
+
+    for (int i = 0; i < cl->n_nodes; i++) {
+        ClusterNode *n = cl->nodes[(cl->rr + i) % cl->n_nodes];
+        if (!n->up) {
+            continue;
+        }
+        double wait = (double)(n->n_running + n->q_len + 1) / capacity(n);
+        if (best == NULL || wait < best_wait) {
+            best = n;
+            best_wait = wait;
+        }
+    }
+    cl->rr++;
+    return best;
+}
+
+// ---- finishing
+
+static void job_done(Cluster *cl, Job *job) {
+    cl->n_done++;
+    if (cl->on_done != NULL) {
+        cl->on_done(cl, job, cl->data);
+    }
+    if (cl->completions != NULL) {
+        post_CompletionQueue(cl->completions, &job->node);
+    }
+}
+
+static void fail_job(Cluster *cl, Job *job, int rc) {
+    job->spawn_rc = rc;
+    job->status = -1;
+    cl->n_failed++;
+    job_done(cl, job);
+}
+
+// queue job anywhere that is up, or fail it
+static void requeue(Cluster *cl, Job *job) {
+    ClusterNode *n = place(cl);
+    if (n == NULL || push_tail(n, job)) {
+        cl->n_queued--;
+        fail_job(cl, job, report_SpawnError(&job->ci.err, SPAWN_STAGE_SERVER, -1,
+            n == NULL ? ENOTCONN : ENOMEM, 0, job->args[0]));
+    }
+}
+
+// the connection broke: its queue goes to the others; what ran there fails
+// as its eventfds fire
+static void node_down(Cluster *cl, ClusterNode *n) {
+    showError(false, "Lost cluster node %s: %s!", n->name, strerror(n->conn.err));
+    n->up = false;
+    while (n->q_len > 0) {
+        requeue(cl, pop_head(n));
+    }
+}
+
+static void finish_job(Cluster *cl, Job *job) {
+    ClusterNode *n = job->placed;
+
+    unwatch_ProcInfo(&cl->loop, &job->ci);
+    close_ProcInfo(&job->ci);
+    finish_CaptureBuf(&job->out.out);
+    finish_CaptureBuf(&job->out.err);
+    job->out.status = job->status;
+    n->n_running--;
+    cl->n_running--;
+    if (job->spawn_rc != 0 || !WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) {
+        cl->n_failed++;
+    }
+    job_done(cl, job);
+}
+
+static void on_job_event(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Job *job = data;
+    ClusterNode *n = job->placed;
+
+    if (fd == job->ci.pidfd) {
+        // the eventfd fired: the exit is already in, this doesn't block
+        int rc = reap_Remote(&n->conn, &job->ci, &job->status);
+        if (rc != 0) {
+            job->spawn_rc = report_SpawnError(&job->ci.err, SPAWN_STAGE_SERVER, -1, rc, 0, job->args[0]);
+        }
+        del_EventLoop(loop, fd);
+        job->pending--;
+    } else {
+        CaptureBuf *b = NULL;
+        char scratch[64 * 1024];
+        ssize_t r;
+        if (fd == job->ci.p_stdout && job->ci.stdout_type == PROC_COM_CAPTURE) {
+            b = &job->out.out;
+        } else if (fd == job->ci.p_stderr && job->ci.stderr_type == PROC_COM_CAPTURE) {
+            b = &job->out.err;
+        }
+        r = b != NULL ? fill_CaptureBuf(b, fd) : read(fd, scratch, sizeof(scratch));
+        if (r > 0 || (r < 0 && (errno == EINTR || errno == EAGAIN))) {
+            return;
+        }
+        del_EventLoop(loop, fd);
+        job->pending--;
+    }
+    if (job->pending == 0) {
+        finish_job(n->cluster, job);
+    }
+}
+
+// ---- dispatch
+
+// one node's spawns of a round
+typedef struct {
+    ClusterNode *n;
+    size_t k;
+    Job **jobs;
+    ProcInfo **cis;
+    char ***argvs;
+    char ***envs;
+    int *results;
+    RemoteBatch rb;
+} NodeBatch;
+
+// a node with free slots and nothing queued takes half of the backlog the
+// worst node can't start itself, from the tail of its queue
+static void steal(Cluster *cl, ClusterNode *thief) {
+    ClusterNode *victim = NULL;
+    size_t worst = 0;
+
+    for (int i = 0; i < cl->n_nodes; i++) {
+        ClusterNode *v = cl->nodes[i];
+        size_t start = free_slots(v);
+        if (v != thief && v->up && v->q_len > start && v->q_len - start > worst) {
+            victim = v;
+            worst = v->q_len - start;
+        }
+    }
+    size_t take = (worst + 1) / 2, room = free_slots(thief);
+    take = take < room ? take : room;
+    for (size_t i = 0; victim != NULL && i < take; i++) {
+        Job *job = pop_tail(victim);
+        if (push_tail(thief, job)) {
+            push_tail(victim, job);
+            break;
+        }
+        thief->n_stolen++;
+    }
+}
+
+static void start_job(Cluster *cl, ClusterNode *n, Job *job) {
+    if (job->ci.stdin_type == PROC_COM_PIPE && job->ci.p_stdin >= 0) {
+        close(job->ci.p_stdin);
+        job->ci.p_stdin = -1;
+    }
+    job->pending = 1; // the exit
+    if (proc_com_piped(job->ci.stdout_type) && job->ci.p_stdout >= 0) {
+        job->pending++;
+    }
+    if (proc_com_piped(job->ci.stderr_type) && job->ci.p_stderr >= 0) {
+        job->pending++;
+    }
+    n->n_running++;
+    n->n_started++;
+    cl->n_running++;
+    if (watch_ProcInfo(&cl->loop, &job->ci, on_job_event, job)) {
+        // can't wait for it asynchronously: wait here
+        unwatch_ProcInfo(&cl->loop, &job->ci);
+        reap_Remote(&n->conn, &job->ci, &job->status);
+        finish_job(cl, job);
+    }
+}
+
+// refresh the loads, rebalance, then send every node the jobs it has room
+// for before collecting any reply
+static void dispatch(Cluster *cl) {
+    NodeBatch *nb = calloc(cl->n_nodes ? cl->n_nodes : 1, sizeof(NodeBatch));
+    int n_batches = 0;
+
+    if (nb == NULL) {
+        return; // the next round retries
+    }
+    for (int i = 0; i < cl->n_nodes; i++) {
+        ClusterNode *n = cl->nodes[i];
+        if (n->up && load_Remote(&n->conn, &n->load, 0) != 0) {
+            node_down(cl, n);
+        }
+    }
+    for (int i = 0; i < cl->n_nodes; i++) {
+        ClusterNode *n = cl->nodes[i];
+        if (n->up && n->q_len == 0 && free_slots(n) > 0) {
+            steal(cl, n);
+        }
+    }
+    for (int i = 0; i < cl->n_nodes; i++) {
+        ClusterNode *n = cl->nodes[i];
+        size_t k = n->up ? free_slots(n) : 0;
+        k = k < n->q_len ? k : n->q_len;
+        if (k == 0) {
+            continue;
+        }
+        NodeBatch *b = &nb[n_batches];
+        void **block = malloc(k * 5 * sizeof(void *));
+        if (block == NULL) {
+            continue;
+        }
+        b->n = n;
+        b->k = k;
+        b->jobs = (Job **)block;
+        b->cis = (ProcInfo **)(block + k);
+        b->argvs = (char ***)(block + 2 * k);
+        b->envs = (char ***)(block + 3 * k);
+        b->results = malloc(k * sizeof(int));
+        if (b->results == NULL) {
+            free(block);
+            continue;
+        }
+        for (size_t j = 0; j < k; j++) {
+            Job *job = pop_head(n);
+            job->status = -1;
+            job->timed_out = false;
+            reset_CaptureResult(&job->out);
+            b->jobs[j] = job;
+            b->cis[j] = &job->ci;
+            b->argvs[j] = job->args;
+            b->envs[j] = job->env;
+        }
+        cl->n_queued -= k;
+        begin_batch_Remote(&n->conn, &b->rb, b->cis, b->argvs, b->envs, k, b->results);
+        n_batches++;
+    }
+    for (int i = 0; i < n_batches; i++) {
+        NodeBatch *b = &nb[i];
+        end_batch_Remote(&b->n->conn, &b->rb);
+        for (size_t j = 0; j < b->k; j++) {
+            Job *job = b->jobs[j];
+            job->spawn_rc = b->results[j];
+            if (job->spawn_rc == 0) {
+                start_job(cl, b->n, job);
+            } else if (job->ci.err.stage == SPAWN_STAGE_SERVER && load_Remote(&b->n->conn, &b->n->load, 0) != 0) {
+                cl->n_queued++; // it never got there
+                requeue(cl, job);
+            } else {
+                fail_job(cl, job, job->spawn_rc);
+            }
+        }
+        if (b->n->up && load_Remote(&b->n->conn, &b->n->load, 0) != 0) {
+            node_down(cl, b->n);
+        }
+        free(b->jobs);
+        free(b->results);
+    }
+    free(nb);
+}
+
+// ---- api
+
+int init_Cluster(Cluster *cl, ClusterDone on_done, void *data) {
+    memset(cl, 0, sizeof(*cl));
+    cl->on_done = on_done;
+    cl->data = data;
+    return init_EventLoop(&cl->loop, EVLOOP_EPOLL);
+}
+
+int add_fd_Cluster(Cluster *cl, int fd, const char *name, int slots) {
+    ClusterNode *n = calloc(1, sizeof(ClusterNode));
+    if (n == NULL || (n->name = strdup(name)) == NULL) {
+        showError(false, "Failed to add cluster node %s!", name);
+        free(n);
+        close(fd);
+        return 1;
+    }
+    if (cl->n_nodes == cl->cap_nodes) {
+        int cap = cl->cap_nodes ? cl->cap_nodes * 2 : 16;
+        ClusterNode **nodes = realloc(cl->nodes, cap * sizeof(ClusterNode *));
+        if (nodes == NULL) {
+            showError(false, "Failed to add cluster node %s!", name);
+            free(n->name);
+            free(n);
+            close(fd);
+            return 1;
+        }
+        cl->nodes = nodes;
+        cl->cap_nodes = cap;
+    }
+    if (init_RemoteConn(&n->conn, fd)) {
+        free(n->name);
+        free(n);
+        close(fd);
+        return 1;
+    }
+    n->cluster = cl;
+    n->slots = slots;
+    n->up = true;
+    // the agent reports on connect; placement needs its cpu count
+    if (load_Remote(&n->conn, &n->load, 5000) != 0 || n->load.ncpu <= 0) {
+        n->load.ncpu = 1;
+    }
+    cl->nodes[cl->n_nodes++] = n;
+    return 0;
+}
+
+int add_Cluster(Cluster *cl, const char *host, const char *port, int slots) {
+    char name[256];
+    int fd = connect_Remote(host, port);
+
+    snprintf(name, sizeof(name), "%s:%s", host, port);
+    return fd < 0 ? 1 : add_fd_Cluster(cl, fd, name, slots);
+}
+
+int submit_Cluster(Cluster *cl, Job *job) {
+    job->attempts = 0;
+    job->status = -1;
+    cl->n_queued++;
+    requeue(cl, job);
+    return 0;
+}
+
+size_t run_Cluster(Cluster *cl) {
+    while (cl->n_running > 0 || cl->n_queued > 0) {
+        dispatch(cl);
+        if (cl->n_running == 0) {
+            continue; // everything of the round finished or failed right away
+        }
+        if (run_EventLoop(&cl->loop, -1) < 0) {
+            showError(false, "Cluster event loop failed: %s!", strerror(errno));
+            break;
+        }
+    }
+    return cl->n_failed;
+}
+
+int kill_Cluster(Cluster *cl, int sig) {
+    int rc = 0;
+    for (int i = 0; i < cl->n_nodes; i++) {
+        if (cl->nodes[i]->up && cl->nodes[i]->n_running > 0 && kill_all_Remote(&cl->nodes[i]->conn, sig) != 0) {
+            rc = 1;
+        }
+    }
+    return rc;
+}
+
+void close_Cluster(Cluster *cl) {
+    for (int i = 0; i < cl->n_nodes; i++) {
+        ClusterNode *n = cl->nodes[i];
+        close_RemoteConn(&n->conn);
+        free(n->queue);
+        free(n->name);
+        free(n);
+    }
+    free(cl->nodes);
+    close_EventLoop(&cl->loop);
+    memset(cl, 0, sizeof(*cl));
+}
@@ -0,0 +1,70 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "runner.h"
+#include "remote.h"
+
+typedef struct Cluster Cluster;
+
+typedef void (*ClusterDone)(Cluster *cl, Job *job, void *data);
+
+// one agent of the cluster and the jobs placed on it
+typedef struct ClusterNode {
+    Cluster *cluster;
+    char *name;             // "host:port", for messages
+    RemoteConn conn;
+    bool up;                // false once the connection broke: its queue moved on
+    int slots;              // children at once; 0 follows the agent's cpu count
+    int n_running;
+    Job **queue;            // ring of placed jobs; the node pops the head, thieves take the tail
+    size_t q_head;
+    size_t q_len;
+    size_t q_cap;
+    RemoteLoad load;        // as of the last dispatch round
+    size_t n_started;
+    size_t n_stolen;        // jobs it took from other nodes' queues
+} ClusterNode;
+
+// the job runner spread over node agents from one thread: each submit is
+// placed on the node with the shortest expected wait -- its running and
+// queued jobs over the slots that the agent's own report leaves free
+// (other clients' children, CPU pressure) -- and each dispatch round sends
+// every node one spawn batch, all of them before waiting for any reply,
+// so a round costs one round trip however many nodes there are. A node
+// whose queue ran dry steals half the backlog of the worst one.
+//
+// Jobs are the runner's: ci streams, captures, spawn_rc/status, on_done
+// and completions work the same. timeout_ms is not enforced (the signal
+// would have to go over the connection); kill_Cluster() is
+struct Cluster {
+    EventLoop loop;
+    ClusterNode **nodes;
+    int n_nodes;
+    int cap_nodes;
+    size_t n_queued;        // placed, not started
+    int n_running;
+    size_t n_done;
+    size_t n_failed;        // spawn failures and non-zero exits
+    size_t rr;              // where the next placement scan starts, for ties
+    ClusterDone on_done;
+    void *data;
+    CompletionQueue *completions; // caller's, NULL for none; as in JobRunner
+};
+
+int init_Cluster(Cluster *cl, ClusterDone on_done, void *data);
+// connect to an agent; slots 0 uses the cpu count from its first report
+int add_Cluster(Cluster *cl, const char *host, const char *port, int slots);
+// as add_Cluster() over an already connected stream socket
+int add_fd_Cluster(Cluster *cl, int fd, const char *name, int slots);
+// place job on a node; it starts with the next dispatch round
+int submit_Cluster(Cluster *cl, Job *job);
+// run until nothing is queued or running; returns the number of failed jobs
+size_t run_Cluster(Cluster *cl);
+// signal every running job on every node
+int kill_Cluster(Cluster *cl, int sig);
+void close_Cluster(Cluster *cl);
+
+#endif // CLUSTER_H
@@ -0,0 +1,305 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include "cmdline.h"
+
+// unquoted, these would mean something to sh that we don't implement
+#define CMD_REJECT "$`;&()*?[]{}"
+
+typedef struct {
+    char *s;
+    size_t len;
+    size_t cap;
+} Word;
+
+typedef struct {
+    const char *line;
+    const char *p;
+    Word w;
+} Parser;
+
+static int fail(Parser *ps, const char *what) {
+    showError(false, "Command line: %s at column %d!", what, (int)(ps->p - ps->line) + 1);
+    return 1;
+}
+
+static int put(Parser *ps, char c) {
+    Word *w = &ps->w;
+    if (w->len + 1 >= w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        char *s = realloc(w->s, cap);
+        if (s == NULL) {
+            return fail(ps, "out of memory");
+        }
+        w->s = s;
+        w->cap = cap;
+    }
+    w->s[w->len++] = c;
+    w->s[w->len] = '\0';
+    return 0;
+}
+
+static inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+static inline bool ends_word(char c) {
+    return c == '\0' || is_blank(c) || c == '|' || c == '<' || c == '>';
+}
+
+// one word into ps->w with its quoting removed; *found is false if there was none
+static int read_word(Parser *ps, bool first, bool *found) {
+    *found = false;
+    ps->w.len = 0;
+    if (put(ps, '\0')) { // an empty word ('' or "") is still a string
+        return 1;
+    }
+    ps->w.len = 0;
+    if (*ps->p == '~' || *ps->p == '#') {
+        return fail(ps, *ps->p == '~' ? "'~' expansion is not supported" : "comments are not supported");
+    }
+    while (!ends_word(*ps->p)) {
+        char c = *ps->p;
+        *found = true;
+        if (c == '\'') {
+            const char *end = strchr(ps->p + 1, '\'');
+            if (end == NULL) {
+                return fail(ps, "unterminated '");
+            }
+            for (const char *q = ps->p + 1; q < end; q++) {
+                if (put(ps, *q)) {
+                    return 1;
+                }
+            }
+            ps->p = end + 1;
+            continue;
+        }
+        if (c == '"') {
+            for (ps->p++; *ps->p != '"'; ps->p++) {
+                if (*ps->p == '\0') {
+                    return fail(ps, "unterminated \"");
+                }
+                if (*ps->p == '$' || *ps->p == '`') {
+                    return fail(ps, "expansions are not supported");
+                }
+                // inside "..." a backslash only escapes these
+                if (*ps->p == '\\' && ps->p[1] != '\0' && strchr("\"\\$`", ps->p[1])) {
+                    ps->p++;
+                }
+                if (put(ps, *ps->p)) {
+                    return 1;
+                }
+            }
+            ps->p++;
+            continue;
+        }
+        if (c == '\\') {
+            if (*++ps->p == '\0') {
+                return fail(ps, "trailing \\");
+            }
+            c = *ps->p;
+        } else if (strchr(CMD_REJECT, c)) {
+            return fail(ps, "unsupported shell syntax");
+        } else if (c == '=' && first) {
+            return fail(ps, "VAR=value prefixes are not supported");
+        }
+        if (put(ps, c)) {
+            return 1;
+        }
+        ps->p++;
+    }
+    return 0;
+}
+
+static void skip_blanks(Parser *ps) {
+    while (is_blank(*ps->p)) {
+        ps->p++;
+    }
+}
+
+static CmdStage *add_stage(CmdLine *cl) {
+    if (cl->n == cl->cap) {
+        int cap = cl->cap ? cl->cap * 2 : 4;
+        CmdStage *s = realloc(cl->stages, cap * sizeof(CmdStage));
+        if (s == NULL) {
+            return NULL;
+        }
+        cl->stages = s;
+        cl->cap = cap;
+    }
+    CmdStage *st = &cl->stages[cl->n++];
+    memset(st, 0, sizeof(*st));
+    return st;
+}
+
+// fd 0, 1 or 2 redirected: take the path that follows
+static int redirect(Parser *ps, CmdStage *st, int fd, bool append) {
+    bool found;
+
+    skip_blanks(ps);
+    const char *at = ps->p;
+    if (read_word(ps, false, &found)) {
+        return 1;
+    }
+    if (!found) {
+        return fail(ps, "redirection without a path");
+    }
+    char *path = strdup(ps->w.s);
+    if (path == NULL) {
+        return fail(ps, "out of memory");
+    }
+    char **slot = fd == STDIN_FILENO ? &st->f_stdin : fd == STDOUT_FILENO ? &st->f_stdout : &st->f_stderr;
+    free(*slot); // like sh, the last one wins
+    *slot = path;
+    if (fd == STDERR_FILENO) {
+        st->err_to_out = false;
+    }
+    if (fd == STDOUT_FILENO && st->err_to_out) {
+        ps->p = at;
+        return fail(ps, "2>&1 before a stdout redirection is not supported");
+    }
+    if (fd != STDIN_FILENO) {
+        if ((st->f_stdout != NULL && st->f_stderr != NULL) && st->append != append) {
+            ps->p = at;
+            return fail(ps, "mixing > and >> in one command is not supported");
+        }
+        st->append = append;
+    }
+    return 0;
+}
+
+int parse_CmdLine(CmdLine *cl, const char *line) {
+    Parser ps = {.line = line, .p = line};
+    CmdStage *st = NULL;
+    int rc = 0;
+
+    memset(cl, 0, sizeof(*cl));
+    if (init_ArgArena(&cl->arena, strlen(line) * 2)) {
+        return 1;
+    }
+    for (;;) {
+        skip_blanks(&ps);
+        if (*ps.p == '\0' || *ps.p == '|') {
+            if (st != NULL && (st->argv = finish_ArgArena(&cl->arena)) == NULL) {
+                rc = fail(&ps, "out of memory");
+                break;
+            }
+            if (st == NULL || st->argv[0] == NULL) {
+                rc = fail(&ps, "empty command");
+                break;
+            }
+            if (*ps.p == '\0') {
+                break;
+            }
+            if (st->f_stdout != NULL) {
+                rc = fail(&ps, "only the last command may redirect stdout");
+                break;
+            }
+            ps.p++;
+            st = NULL;
+            continue;
+        }
+        if (st == NULL && (st = add_stage(cl)) == NULL) {
+            rc = fail(&ps, "out of memory");
+            break;
+        }
+        int fd = -1;
+        if (*ps.p == '<' || *ps.p == '>') {
+            fd = *ps.p == '<' ? STDIN_FILENO : STDOUT_FILENO;
+            ps.p++;
+        } else if ((ps.p[0] == '1' || ps.p[0] == '2') && ps.p[1] == '>') {
+            fd = ps.p[0] - '0';
+            ps.p += 2;
+        }
+        if (fd >= 0) {
+            bool append = fd != STDIN_FILENO && *ps.p == '>';
+            ps.p += append;
+            if (fd == STDERR_FILENO && !append && ps.p[0] == '&' && ps.p[1] == '1' && ends_word(ps.p[2])) {
+                ps.p += 2;
+                free(st->f_stderr);
+                st->f_stderr = NULL;
+                st->err_to_out = true;
+                continue;
+            }
+            if (fd == STDIN_FILENO && cl->n > 1) {
+                rc = fail(&ps, "only the first command may redirect stdin");
+                break;
+            }
+            if ((rc = redirect(&ps, st, fd, append)) != 0) {
+                break;
+            }
+            continue;
+        }
+        bool found;
+        if ((rc = read_word(&ps, cl->arena.n_pending == 0, &found)) != 0) {
+            break;
+        }
+        if (found && push_ArgArena(&cl->arena, ps.w.s)) {
+            rc = fail(&ps, "out of memory");
+            break;
+        }
+    }
+    free(ps.w.s);
+    if (rc == 0 && (cl->argvs = malloc(cl->n * sizeof(char **))) == NULL) {
+        rc = fail(&ps, "out of memory");
+    }
+    if (rc != 0) {
+        free_CmdLine(cl);
+        return 1;
+    }
+    for (int i = 0; i < cl->n; i++) {
+        cl->argvs[i] = cl->stages[i].argv;
+    }
+    return 0;
+}
+
+int apply_CmdLine(const CmdLine *cl, Pipeline *pl) {
+    if (init_Pipeline(pl, cl->n)) {
+        return 1;
+    }
+    for (int i = 0; i < cl->n; i++) {
+        const CmdStage *st = &cl->stages[i];
+        ProcInfo *ci = &pl->stages[i];
+        ci->path_append = st->append;
+        if (st->f_stdin != NULL) {
+            ci->stdin_type = PROC_COM_PATH;
+            ci->f_stdin = st->f_stdin;
+        }
+        if (st->f_stdout != NULL) {
+            ci->stdout_type = PROC_COM_PATH;
+            ci->f_stdout = st->f_stdout;
+        }
+        if (st->f_stderr != NULL) {
+            ci->stderr_type = PROC_COM_PATH;
+            ci->f_stderr = st->f_stderr;
+        } else if (st->err_to_out && (i + 1 < cl->n || st->f_stdout != NULL)) {
+            ci->stderr_type = PROC_COM_STDOUT;
+        } else if (st->err_to_out) {
+            // PROC_COM_STDOUT leaves stderr alone while stdout is inherited,
+            // but sh would send it to our stdout: hand over a copy of that
+            ci->stderr_type = PROC_COM_FD;
+            if ((ci->p_stderr = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0)) < 0) {
+                showError(false, "Failed to duplicate stdout for 2>&1: %s!", strerror(errno));
+                close_Pipeline(pl);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void free_CmdLine(CmdLine *cl) {
+    for (int i = 0; i < cl->n; i++) {
+        free(cl->stages[i].f_stdin);
+        free(cl->stages[i].f_stdout);
+        free(cl->stages[i].f_stderr);
+    }
+    free(cl->stages);
+    free(cl->argvs);
+    free_ArgArena(&cl->arena);
+    memset(cl, 0, sizeof(*cl));
+}
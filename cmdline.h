@@ -0,0 +1,41 @@
+#ifndef CMDLINE_H
+#define CMDLINE_H
+
+#include <stdbool.h>
+
+#include "arg_arena.h"
+#include "pipeline.h"
+
+// one command of a parsed line and its redirections
+typedef struct {
+    char **argv;        // NULL-terminated, in the CmdLine's arena
+    char *f_stdin;      // "< path", first command only
+    char *f_stdout;     // "> path" or ">> path", last command only
+    char *f_stderr;     // "2> path" or "2>> path"
+    bool append;        // ">>" / "2>>"; stdout and stderr of a command can't mix them
+    bool err_to_out;    // "2>&1"
+} CmdStage;
+
+// a shell-free command line: "cmd1 'a b' | cmd2 < in > out 2>&1" parsed
+// straight into pipeline stages, so a job needs no /bin/sh in between.
+// Supported are words with '...', "..." and \ quoting, |, <, >, >>, 2>,
+// 2>> and 2>&1. Anything sh would give another meaning -- expansions ($,
+// `, globs, ~, braces), lists and subshells (; & ( )), comments and
+// VAR=value prefixes -- is rejected rather than passed on literally
+typedef struct {
+    ArgArena arena;
+    CmdStage *stages;
+    char ***argvs;      // argv of every stage, for spawn_Pipeline()
+    int n;
+    int cap;
+} CmdLine;
+
+// returns 0, or 1 after showError() naming the offending column
+int parse_CmdLine(CmdLine *cl, const char *line);
+// init_Pipeline() pl with cl's commands and set up their redirections
+// as PROC_COM_PATH, PROC_COM_STDOUT (or a dup of our stdout for the last
+// command when its stdout is inherited); then spawn_Pipeline(pl, cl->argvs, env)
+int apply_CmdLine(const CmdLine *cl, Pipeline *pl);
+void free_CmdLine(CmdLine *cl);
+
+#endif // CMDLINE_H
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+
+#include "completion.h"
+
+int init_CompletionQueue(CompletionQueue *q) {
+    memset(q, 0, sizeof(*q));
+    q->head = q->tail = &q->stub;
+    if ((q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        showError(false, "Failed to create completion eventfd: %s!", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+void close_CompletionQueue(CompletionQueue *q) {
+    if (q->efd >= 0) {
+        close(q->efd);
+        q->efd = -1;
+    }
+}
+
+static void push(CompletionQueue *q, CompletionNode *node) {
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    CompletionNode *prev = __atomic_exchange_n(&q->head, node, __ATOMIC_ACQ_REL);
+    // until this store the consumer sees the queue end at prev
+    __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+}
+
+void post_CompletionQueue(CompletionQueue *q, CompletionNode *node) {
+    push(q, node);
+    if (__atomic_exchange_n(&q->signalled, 1, __ATOMIC_ACQ_REL) == 0) {
+        uint64_t one = 1;
+        while (write(q->efd, &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+}
+
+CompletionNode *pop_CompletionQueue(CompletionQueue *q) {
+    CompletionNode *tail = q->tail;
+    CompletionNode *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &q->stub) { // skip the stub
+        if (next == NULL) {
+            return NULL;
+        }
+        q->tail = tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&q->head, __ATOMIC_ACQUIRE)) {
+        return NULL; // a producer swapped head but hasn't linked it yet
+    }
+    // tail is the last node: put the stub behind it so it can be handed out
+    push(q, &q->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+size_t drain_CompletionQueue(CompletionQueue *q, CompletionCallback cb, void *data) {
+    CompletionNode *node;
+    uint64_t n;
+    size_t count = 0;
+
+    if (read(q->efd, &n, sizeof(n)) < 0 && errno != EAGAIN) {
+        return 0;
+    }
+    // posts from here on signal again, the earlier ones are popped below
+    __atomic_store_n(&q->signalled, 0, __ATOMIC_SEQ_CST);
+    while ((node = pop_CompletionQueue(q)) != NULL) {
+        cb(node, data);
+        count++;
+    }
+    return count;
+}
+
+static void on_posted(EventLoop *loop, int fd, unsigned revents, void *data) {
+    CompletionQueue *q = data;
+    drain_CompletionQueue(q, q->cb, q->data);
+}
+
+int watch_CompletionQueue(CompletionQueue *q, EventLoop *loop, CompletionCallback cb, void *data) {
+    q->cb = cb;
+    q->data = data;
+    return add_EventLoop(loop, q->efd, POLLIN, on_posted, q);
+}
@@ -0,0 +1,44 @@
+#ifndef COMPLETION_H
+#define COMPLETION_H
+
+#include <stddef.h>
+
+#include "event_loop.h"
+
+// embed one in whatever is posted; recover the record with completion_of()
+typedef struct CompletionNode {
+    struct CompletionNode *next;
+} CompletionNode;
+
+#define completion_of(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
+typedef void (*CompletionCallback)(CompletionNode *node, void *data);
+
+// intrusive multi-producer/single-consumer queue (Vyukov's): a post is one
+// atomic exchange on head plus a store, whatever the number of producers,
+// and an eventfd write only when the consumer has no wakeup pending yet.
+// Nodes come out in post order; a node must stay put until it is popped
+typedef struct {
+    CompletionNode *head;   // last posted, producers swap it
+    CompletionNode *tail;   // next to pop, consumer only
+    CompletionNode stub;
+    int efd;                // eventfd, readable while a wakeup is pending
+    int signalled;          // a producer wrote efd since the consumer last drained
+    // consumer side of watch_CompletionQueue()
+    CompletionCallback cb;
+    void *data;
+} CompletionQueue;
+
+int init_CompletionQueue(CompletionQueue *q);
+void close_CompletionQueue(CompletionQueue *q);
+// any thread
+void post_CompletionQueue(CompletionQueue *q, CompletionNode *node);
+// consumer thread; NULL when empty (or a post is half way, its wakeup follows)
+CompletionNode *pop_CompletionQueue(CompletionQueue *q);
+// consumer thread: acknowledge the wakeup and pass every queued node to cb;
+// returns how many
+size_t drain_CompletionQueue(CompletionQueue *q, CompletionCallback cb, void *data);
+// drain into cb from loop whenever something was posted
+int watch_CompletionQueue(CompletionQueue *q, EventLoop *loop, CompletionCallback cb, void *data);
+
+#endif // COMPLETION_H
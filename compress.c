@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "compress.h"
+
+int emit_CompressStream(CompressStream *cs) {
+    if (cs->frame_len == 0) {
+        return 0;
+    }
+    if (cs->sink(cs->frame, cs->frame_len, cs->sink_data) != 0) {
+        cs->failed = true;
+        return -1;
+    }
+    cs->out_total += cs->frame_len;
+    cs->frame_len = 0;
+    return 0;
+}
+
+// passthrough
+
+static int none_init(CompressStream *cs, int level) {
+    return 0;
+}
+
+static int none_write(CompressStream *cs, const char *p, size_t n, bool end) {
+    while (n > 0) {
+        size_t take = cs->frame_cap - cs->frame_len < n ? cs->frame_cap - cs->frame_len : n;
+        memcpy(cs->frame + cs->frame_len, p, take);
+        cs->frame_len += take;
+        p += take;
+        n -= take;
+        if (cs->frame_len == cs->frame_cap && emit_CompressStream(cs)) {
+            return -1;
+        }
+    }
+    return end ? emit_CompressStream(cs) : 0;
+}
+
+static void none_free(CompressStream *cs) {
+}
+
+const Codec codec_none = {"none", none_init, none_write, none_free};
+
+// gzip
+
+static int gzip_init(CompressStream *cs, int level) {
+    z_stream *z = calloc(1, sizeof(*z));
+    if (z == NULL) {
+        return -1;
+    }
+    // 15 + 16: largest window, gzip wrapper instead of zlib's
+    if (deflateInit2(z, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(z);
+        return -1;
+    }
+    cs->state = z;
+    return 0;
+}
+
+static int gzip_write(CompressStream *cs, const char *p, size_t n, bool end) {
+    z_stream *z = cs->state;
+    int rc;
+
+    while (n > (1u << 30)) { // avail_in is 32 bits
+        if (gzip_write(cs, p, 1u << 30, false)) {
+            return -1;
+        }
+        p += 1u << 30;
+        n -= 1u << 30;
+    }
+    z->next_in = (Bytef *)p;
+    z->avail_in = n;
+    do {
+        z->next_out = (Bytef *)cs->frame + cs->frame_len;
+        z->avail_out = cs->frame_cap - cs->frame_len;
+        rc = deflate(z, end ? Z_FINISH : Z_NO_FLUSH);
+        if (rc == Z_STREAM_ERROR) {
+            return -1;
+        }
+        cs->frame_len = cs->frame_cap - z->avail_out;
+        if (cs->frame_len == cs->frame_cap && emit_CompressStream(cs)) {
+            return -1;
+        }
+    } while (z->avail_in > 0 || (end && rc != Z_STREAM_END));
+    return end ? emit_CompressStream(cs) : 0;
+}
+
+static void gzip_free(CompressStream *cs) {
+    if (cs->state != NULL) {
+        deflateEnd(cs->state);
+        free(cs->state);
+    }
+}
+
+const Codec codec_gzip = {"gzip", gzip_init, gzip_write, gzip_free};
+
+int init_CompressStream(CompressStream *cs, const Codec *codec, int level, size_t frame_size,
+        FrameSink sink, void *sink_data) {
+    memset(cs, 0, sizeof(*cs));
+    cs->codec = codec;
+    cs->sink = sink;
+    cs->sink_data = sink_data;
+    cs->frame_cap = frame_size ? frame_size : COMPRESS_FRAME_SZ;
+    if ((cs->frame = malloc(cs->frame_cap)) == NULL) {
+        showError(false, "Failed to allocate %s frame!", codec->name);
+        return 1;
+    }
+    if (codec->init(cs, level)) {
+        showError(false, "Failed to set up %s compression!", codec->name);
+        free(cs->frame);
+        cs->frame = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int feed_CompressStream(CompressStream *cs, const char *p, size_t n) {
+    if (cs->failed || cs->codec->write(cs, p, n, false)) {
+        cs->failed = true;
+        return -1;
+    }
+    cs->in_total += n;
+    return 0;
+}
+
+ssize_t fill_CompressStream(CompressStream *cs, int fd) {
+    char scratch[64 * 1024];
+
+    ssize_t n = read(fd, scratch, sizeof(scratch));
+    if (n > 0 && feed_CompressStream(cs, scratch, n)) {
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
+int finish_CompressStream(CompressStream *cs) {
+    if (cs->failed || cs->codec->write(cs, NULL, 0, true)) {
+        cs->failed = true;
+        return -1;
+    }
+    return 0;
+}
+
+void close_CompressStream(CompressStream *cs) {
+    if (cs->codec != NULL) {
+        cs->codec->free(cs);
+    }
+    free(cs->frame);
+    cs->frame = NULL;
+    cs->state = NULL;
+}
+
+int write_frame_fd(const char *frame, size_t len, void *data) {
+    int fd = (int)(intptr_t)data;
+    while (len > 0) {
+        ssize_t w = write(fd, frame, len);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        frame += w;
+        len -= w;
+    }
+    return 0;
+}
+
+int run_and_compress(ProcInfo *ci, char* args[], char* env[], CompressStream *cs, int *status) {
+    ssize_t n;
+    int rc;
+
+    *status = -1;
+    ci->stdout_type = PROC_COM_PIPE;
+    if ((rc = subprocess(ci, args, env)) != 0) {
+        return rc;
+    }
+    if (ci->stdin_type == PROC_COM_PIPE && ci->p_stdin >= 0) {
+        close(ci->p_stdin); // nothing to feed: give the child EOF
+        ci->p_stdin = -1;
+    }
+    while ((n = fill_CompressStream(cs, ci->p_stdout)) > 0 || (n < 0 && errno == EINTR));
+    if (n < 0 || finish_CompressStream(cs)) {
+        showError(false, "Failed to %s output of subprocess %s!", cs->codec->name, args[0]);
+        rc = 1;
+    }
+    close(ci->p_stdout); // a child still writing after a failure gets EPIPE, not a stall
+    ci->p_stdout = -1;
+    reap_ProcInfo(ci, status, 0);
+    close_ProcInfo(ci);
+    return rc;
+}
@@ -0,0 +1,65 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+
+#define COMPRESS_FRAME_SZ (256 * 1024)  // default output frame
+
+typedef struct CompressStream CompressStream;
+
+// receives each compressed frame; nonzero stops the stream
+typedef int (*FrameSink)(const char *frame, size_t len, void *data);
+
+// a pluggable compressor; write() appends output to cs->frame and calls
+// emit_CompressStream() whenever the frame fills up
+typedef struct {
+    const char *name;
+    int (*init)(CompressStream *cs, int level);     // sets cs->state; 0 or -1
+    // consume n bytes; end flushes everything (n may be 0 then); 0 or -1
+    int (*write)(CompressStream *cs, const char *p, size_t n, bool end);
+    void (*free)(CompressStream *cs);
+} Codec;
+
+extern const Codec codec_none;  // passthrough, frames of raw bytes
+extern const Codec codec_gzip;  // zlib deflate with a gzip header, level -1..9
+
+// streaming compression of child output: memory stays at one frame plus
+// the codec state however much the child writes
+struct CompressStream {
+    const Codec *codec;
+    void *state;
+    FrameSink sink;
+    void *sink_data;
+    char *frame;
+    size_t frame_len;
+    size_t frame_cap;
+    size_t in_total;    // bytes fed in
+    size_t out_total;   // bytes handed to the sink
+    bool failed;        // the codec or the sink gave up
+};
+
+// level is passed to the codec; frame_size 0 picks COMPRESS_FRAME_SZ
+int init_CompressStream(CompressStream *cs, const Codec *codec, int level, size_t frame_size,
+    FrameSink sink, void *sink_data);
+int feed_CompressStream(CompressStream *cs, const char *p, size_t n);
+// one read() from fd, compressed right away: bytes read, 0 at EOF, -1 with
+// errno; cheap enough to call from an event loop callback
+ssize_t fill_CompressStream(CompressStream *cs, int fd);
+// flush the codec and the last frame
+int finish_CompressStream(CompressStream *cs);
+void close_CompressStream(CompressStream *cs);
+// for codecs: pass the current frame to the sink and start a new one
+int emit_CompressStream(CompressStream *cs);
+
+// FrameSink writing to the fd in data ((void *)(intptr_t)fd)
+int write_frame_fd(const char *frame, size_t len, void *data);
+
+// spawn args with stdout piped through cs, then reap; cs is finished but
+// not closed. Returns subprocess()'s rc (1 if compression failed)
+int run_and_compress(ProcInfo *ci, char* args[], char* env[], CompressStream *cs, int *status);
+
+#endif // COMPRESS_H
@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cpu_topology.h"
+#include "subprocess.h"
+
+int read_cpulist(const char *path, cpu_set_t *set) {
+    FILE *f = fopen(path, "re");
+    char buf[4096];
+    int n = 0;
+
+    CPU_ZERO(set);
+    if (f == NULL) {
+        return 0;
+    }
+    if (fgets(buf, sizeof(buf), f) != NULL) {
+        char *save;
+        for (char *tok = strtok_r(buf, ",\n", &save); tok != NULL; tok = strtok_r(NULL, ",\n", &save)) {
+            int lo, hi;
+            int m = sscanf(tok, "%d-%d", &lo, &hi);
+            if (m < 1) {
+                continue;
+            }
+            if (m == 1) {
+                hi = lo;
+            }
+            for (int c = lo; c <= hi && c < CPU_SETSIZE; c++, n++) {
+                CPU_SET(c, set);
+            }
+        }
+    }
+    fclose(f);
+    return n;
+}
+
+// the lowest CPU in the first of cpu's cpulist files that can be read, -1 if none
+static int lowest_of(const char *root, int cpu, const char *files[]) {
+    char path[256];
+    cpu_set_t set;
+
+    for (int i = 0; files[i] != NULL; i++) {
+        snprintf(path, sizeof(path), "%s/cpu%d/%s", root, cpu, files[i]);
+        if (read_cpulist(path, &set) > 0) {
+            for (int c = 0; c < CPU_SETSIZE; c++) {
+                if (CPU_ISSET(c, &set)) {
+                    return c;
+                }
+            }
+        }
+    }
+    return -1;
+}
+
+// the highest level data or unified cache, as "cache/indexK/shared_cpu_list"
+static void llc_list(const char *root, int cpu, char *buf, size_t len) {
+    char path[256], type[32];
+    int best = 0;
+
+    buf[0] = '\0';
+    for (int k = 0; k < 16; k++) {
+        int level = 0;
+        snprintf(path, sizeof(path), "%s/cpu%d/cache/index%d/level", root, cpu, k);
+        FILE *f = fopen(path, "re");
+        if (f == NULL) {
+            break;
+        }
+        bool ok = fscanf(f, "%d", &level) == 1;
+        fclose(f);
+        snprintf(path, sizeof(path), "%s/cpu%d/cache/index%d/type", root, cpu, k);
+        if ((f = fopen(path, "re")) != NULL) {
+            ok = ok && fscanf(f, "%31s", type) == 1 && strcmp(type, "Instruction") != 0;
+            fclose(f);
+        }
+        if (ok && level > best) {
+            best = level;
+            snprintf(buf, len, "cache/index%d/shared_cpu_list", k);
+        }
+    }
+}
+
+static int by_place(const void *a, const void *b) {
+    const TopoCpu *x = a, *y = b;
+    if (x->group != y->group) {
+        return x->group < y->group ? -1 : 1;
+    }
+    if (x->core != y->core) {
+        return x->core < y->core ? -1 : 1;
+    }
+    return x->cpu < y->cpu ? -1 : x->cpu > y->cpu;
+}
+
+int init_CpuTopology(CpuTopology *t, const char *root, const cpu_set_t *allowed) {
+    static const char *cores[] = {"topology/core_cpus_list", "topology/thread_siblings_list", NULL};
+    static const char *dies[] = {"topology/die_cpus_list", "topology/package_cpus_list",
+        "topology/core_siblings_list", NULL};
+    char llc[64];
+    cpu_set_t mask;
+
+    memset(t, 0, sizeof(*t));
+    if (root == NULL) {
+        root = CPU_TOPOLOGY_ROOT;
+    }
+    if (allowed == NULL) {
+        if (pthread_getaffinity_np(pthread_self(), sizeof(mask), &mask) != 0) {
+            showError(false, "Cannot get the CPU affinity mask!");
+            return 1;
+        }
+        allowed = &mask;
+    }
+    int n = CPU_COUNT(allowed);
+    t->cpus = calloc(n > 0 ? n : 1, sizeof(TopoCpu));
+    if (t->cpus == NULL) {
+        showError(false, "Failed to allocate the CPU topology!");
+        return 1;
+    }
+    for (int c = 0; c < CPU_SETSIZE && t->n_cpus < n; c++) {
+        if (!CPU_ISSET(c, allowed)) {
+            continue;
+        }
+        TopoCpu *tc = &t->cpus[t->n_cpus++];
+        tc->cpu = c;
+        if ((tc->core = lowest_of(root, c, cores)) < 0) {
+            tc->core = c;
+        }
+        llc_list(root, c, llc, sizeof(llc));
+        const char *shared[] = {llc, NULL};
+        if ((llc[0] == '\0' || (tc->group = lowest_of(root, c, shared)) < 0) &&
+                (tc->group = lowest_of(root, c, dies)) < 0) {
+            tc->group = 0;
+        }
+    }
+    if (t->n_cpus == 0) {
+        showError(false, "No CPU to place stages on!");
+        close_CpuTopology(t);
+        return 1;
+    }
+    qsort(t->cpus, t->n_cpus, sizeof(TopoCpu), by_place);
+    for (int i = 0; i < t->n_cpus; i++) {
+        t->n_groups += i == 0 || t->cpus[i].group != t->cpus[i - 1].group;
+    }
+    t->group_at = calloc(t->n_groups + 1, sizeof(int));
+    t->group_next = calloc(t->n_groups, sizeof(int));
+    if (t->group_at == NULL || t->group_next == NULL) {
+        showError(false, "Failed to allocate the CPU topology!");
+        close_CpuTopology(t);
+        return 1;
+    }
+    for (int i = 0, g = 0; i < t->n_cpus; i++) {
+        if (i > 0 && t->cpus[i].group != t->cpus[i - 1].group) {
+            t->group_at[++g] = i;
+        }
+    }
+    t->group_at[t->n_groups] = t->n_cpus;
+    return 0;
+}
+
+void place_CpuTopology(CpuTopology *t, int n, cpu_set_t sets[]) {
+    int g = t->next_group;
+    int base = t->group_at[g], size = t->group_at[g + 1] - base;
+    int p = t->group_next[g];
+
+    t->next_group = (g + 1) % t->n_groups;
+    for (int i = 0; i < n; i++) {
+        CPU_ZERO(&sets[i]);
+        CPU_SET(t->cpus[base + (p + i) % size].cpu, &sets[i]);
+    }
+    // the next pipeline here starts on a core of its own where there's one left
+    p = (p + n) % size;
+    while (p != 0 && t->cpus[base + p].core == t->cpus[base + p - 1].core) {
+        p = (p + 1) % size;
+    }
+    t->group_next[g] = p;
+}
+
+void close_CpuTopology(CpuTopology *t) {
+    free(t->cpus);
+    free(t->group_at);
+    free(t->group_next);
+    memset(t, 0, sizeof(*t));
+}
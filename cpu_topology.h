@@ -0,0 +1,41 @@
+#ifndef CPU_TOPOLOGY_H
+#define CPU_TOPOLOGY_H
+
+#include <sched.h>
+
+#define CPU_TOPOLOGY_ROOT "/sys/devices/system/cpu"
+
+typedef struct {
+    int cpu;
+    int core;           // lowest CPU of its SMT siblings
+    int group;          // lowest CPU sharing its last level cache, else its die or package
+} TopoCpu;
+
+// the CPUs we may run on, ordered so that SMT siblings sit next to each
+// other and CPUs sharing a last level cache next to those: neighbours in
+// cpus are the cheapest pairs to pass a pipe's data between
+typedef struct {
+    TopoCpu *cpus;
+    int n_cpus;
+    int *group_at;      // n_groups + 1 offsets into cpus, one run per cache group
+    int n_groups;
+    int *group_next;    // per group, where its next placement starts
+    int next_group;     // the group the next placement goes to
+} CpuTopology;
+
+// parse a sysfs cpulist like "0-3,8-11" into set; returns the number of CPUs
+int read_cpulist(const char *path, cpu_set_t *set);
+
+// root of the cpuN directories, NULL for CPU_TOPOLOGY_ROOT; allowed NULL
+// for the calling thread's affinity mask. What sysfs doesn't tell makes
+// every CPU its own core in one group
+int init_CpuTopology(CpuTopology *t, const char *root, const cpu_set_t *allowed);
+// one CPU each for n stages that pass data along: stage i and i+1 go to
+// neighbouring CPUs, SMT siblings first, then the rest of the group, and
+// each placement goes to the next cache group in turn, so independent
+// pipelines spread across dies. More stages than the group has CPUs wrap
+// around within it
+void place_CpuTopology(CpuTopology *t, int n, cpu_set_t sets[]);
+void close_CpuTopology(CpuTopology *t);
+
+#endif // CPU_TOPOLOGY_H
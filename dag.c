@@ -0,0 +1,549 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "dag.h"
+
+static void launch_chain(Dag *g, int head);
+static void dispatch(Dag *g);
+
+void init_DagHistory(DagHistory *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void free_DagHistory(DagHistory *h) {
+    free(h->table);
+    memset(h, 0, sizeof(*h));
+}
+
+uint64_t signature_args(char* args[]) {
+    uint64_t h = 14695981039346656037ull; // FNV-1a, arguments NUL-separated
+
+    for (int i = 0; args[i] != NULL; i++) {
+        for (const char *c = args[i]; ; c++) {
+            h = (h ^ (unsigned char)*c) * 1099511628211ull;
+            if (*c == '\0') {
+                break;
+            }
+        }
+    }
+    return h != 0 ? h : 1;
+}
+
+static DagHistEntry *find_entry(const DagHistory *h, uint64_t sig) {
+    if (h->cap == 0) {
+        return NULL;
+    }
+    for (size_t i = sig & (h->cap - 1); ; i = (i + 1) & (h->cap - 1)) {
+        if (h->table[i].sig == sig || h->table[i].sig == 0) {
+            return &h->table[i];
+        }
+    }
+}
+
+uint64_t estimate_DagHistory(const DagHistory *h, uint64_t sig) {
+    DagHistEntry *e = find_entry(h, sig);
+    return e != NULL && e->sig == sig ? e->est_ns : 0;
+}
+
+static int put_entry(DagHistory *h, const DagHistEntry *in) {
+    if ((h->n + 1) * 2 > h->cap) {
+        DagHistory bigger = {.cap = h->cap ? h->cap * 2 : 64};
+        if ((bigger.table = calloc(bigger.cap, sizeof(DagHistEntry))) == NULL) {
+            showError(false, "Failed to grow the runtime history!");
+            return 1;
+        }
+        for (size_t i = 0; i < h->cap; i++) {
+            if (h->table[i].sig != 0) {
+                *find_entry(&bigger, h->table[i].sig) = h->table[i];
+                bigger.n++;
+            }
+        }
+        free(h->table);
+        *h = bigger;
+    }
+    DagHistEntry *e = find_entry(h, in->sig);
+    h->n += e->sig == 0;
+    *e = *in;
+    return 0;
+}
+
+int record_DagHistory(DagHistory *h, uint64_t sig, uint64_t ns) {
+    DagHistEntry *e = find_entry(h, sig);
+
+    if (e == NULL || e->sig != sig) {
+        return put_entry(h, &(DagHistEntry){.sig = sig, .est_ns = ns, .runs = 1});
+    }
+    // a plain mean over the first runs, then an average weighted 1/4 to the latest
+    uint32_t w = e->runs < 3 ? e->runs + 1 : 4;
+    e->est_ns = (e->est_ns * (w - 1) + ns) / w;
+    e->runs++;
+    return 0;
+}
+
+int load_DagHistory(DagHistory *h, const char *path) {
+    unsigned long long sig, est;
+    unsigned runs;
+    FILE *f = fopen(path, "re");
+    int rc = 0;
+
+    if (f == NULL) {
+        showError(false, "Failed to open runtime history %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    while (rc == 0 && fscanf(f, "%llx %llu %u", &sig, &est, &runs) == 3) {
+        if (sig != 0) {
+            rc = put_entry(h, &(DagHistEntry){.sig = sig, .est_ns = est, .runs = runs});
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+int save_DagHistory(const DagHistory *h, const char *path) {
+    char tmp[4096];
+    FILE *f;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    if ((f = fopen(tmp, "we")) == NULL) {
+        showError(false, "Failed to write runtime history %s: %s!", tmp, strerror(errno));
+        return 1;
+    }
+    for (size_t i = 0; i < h->cap; i++) {
+        const DagHistEntry *e = &h->table[i];
+        if (e->sig != 0) {
+            fprintf(f, "%016llx %llu %u\n", (unsigned long long)e->sig, (unsigned long long)e->est_ns, e->runs);
+        }
+    }
+    // replaced whole, so a reader never sees half a file
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        showError(false, "Failed to save runtime history %s: %s!", path, strerror(errno));
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+int init_Dag(Dag *g, int max_running, EvLoopBackend backend) {
+    memset(g, 0, sizeof(*g));
+    return init_JobRunner(&g->runner, max_running, backend, NULL, NULL);
+}
+
+int add_Dag(Dag *g, char* args[], char* env[], const ProcInfo *ci) {
+    if (g->n_nodes == g->cap_nodes) {
+        int cap = g->cap_nodes ? g->cap_nodes * 2 : 16;
+        DagNode *nodes = realloc(g->nodes, cap * sizeof(DagNode));
+        if (nodes == NULL) {
+            showError(false, "Failed to add graph node %s!", args[0]);
+            return -1;
+        }
+        g->nodes = nodes;
+        g->cap_nodes = cap;
+    }
+    int i = g->n_nodes++;
+    DagNode *node = &g->nodes[i];
+    memset(node, 0, sizeof(*node));
+    node->job.args = args;
+    node->job.env = env;
+    if (ci != NULL) {
+        node->job.ci = *ci;
+    } else {
+        node->job.ci.p_stdin = node->job.ci.p_stdout = node->job.ci.p_stderr = -1;
+    }
+    node->group = i;
+    node->pipe_in = node->pipe_out = -1;
+    return i;
+}
+
+int edge_Dag(Dag *g, int from, int to, DagEdgeType type) {
+    if (from < 0 || from >= g->n_nodes || to < 0 || to >= g->n_nodes || from == to) {
+        showError(false, "Invalid graph edge %d -> %d!", from, to);
+        return 1;
+    }
+    if (type == DAG_EDGE_PIPE) {
+        if (g->nodes[from].pipe_out >= 0 || g->nodes[to].pipe_in >= 0) {
+            showError(false, "Graph node %s already has a pipe on that side!",
+                g->nodes[g->nodes[from].pipe_out >= 0 ? from : to].job.args[0]);
+            return 1;
+        }
+        g->nodes[from].pipe_out = to;
+        g->nodes[to].pipe_in = from;
+    }
+    if (g->n_edges == g->cap_edges) {
+        int cap = g->cap_edges ? g->cap_edges * 2 : 16;
+        DagEdge *edges = realloc(g->edges, cap * sizeof(DagEdge));
+        if (edges == NULL) {
+            showError(false, "Failed to add graph edge %d -> %d!", from, to);
+            return 1;
+        }
+        g->edges = edges;
+        g->cap_edges = cap;
+    }
+    g->edges[g->n_edges++] = (DagEdge){.from = from, .to = to, .type = type};
+    return 0;
+}
+
+int inputs_Dag(Dag *g, int node, char* paths[]) {
+    if (node < 0 || node >= g->n_nodes || paths == NULL) {
+        showError(false, "Invalid graph node %d for inputs!", node);
+        return 1;
+    }
+    g->nodes[node].inputs = paths;
+    return 0;
+}
+
+// a failed file dependency (or a cancelled scope, for a ready chain): the
+// chain never starts, nor what needs its files
+static void skip_chain(Dag *g, int head) {
+    if (g->nodes[head].state != DAG_PENDING && g->nodes[head].state != DAG_READY) {
+        return;
+    }
+    for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+        g->nodes[i].state = DAG_SKIPPED;
+        g->n_skipped++;
+    }
+    for (int e = 0; e < g->n_edges; e++) {
+        DagEdge *ed = &g->edges[e];
+        if (ed->type == DAG_EDGE_FILE && g->nodes[ed->from].group == head) {
+            skip_chain(g, g->nodes[ed->to].group);
+        }
+    }
+}
+
+// idx finished: what reads its files becomes ready, or is skipped if it failed
+static void release_dependents(Dag *g, int idx, bool ok) {
+    for (int e = 0; e < g->n_edges; e++) {
+        DagEdge *ed = &g->edges[e];
+        if (ed->type != DAG_EDGE_FILE || ed->from != idx) {
+            continue;
+        }
+        int head = g->nodes[ed->to].group;
+        if (!ok) {
+            skip_chain(g, head);
+        } else if (--g->nodes[head].waiting == 0 && g->nodes[head].state == DAG_PENDING) {
+            g->nodes[head].state = DAG_READY;
+            g->ready[g->n_ready++] = head;
+        }
+    }
+}
+
+// incremental: fingerprint the chain's nodes as they are about to start,
+// and tell whether all of it is up to date
+static bool chain_current(Dag *g, int head) {
+    bool current = true;
+
+    if (g->nodes[head].current >= 0) {
+        return g->nodes[head].current;
+    }
+    for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+        DagNode *node = &g->nodes[i];
+        char *stdin_path[2] = {node->job.ci.f_stdin, NULL};
+        uint64_t fp, stdin_fp = 0, stored;
+        node->has_fp = false;
+        if (node->inputs == NULL) {
+            current = false;
+            continue;
+        }
+        if (!fingerprint_inputs(node->inputs, g->hash_inputs, &fp) ||
+                (node->job.ci.stdin_type == PROC_COM_PATH && node->job.ci.f_stdin != NULL &&
+                !fingerprint_inputs(stdin_path, g->hash_inputs, &stdin_fp))) {
+            current = false; // a missing input: run it, and let it fail if it must
+            continue;
+        }
+        node->input_key = node->sig;
+        for (char **p = node->inputs; *p != NULL; p++) {
+            node->input_key = hash_bytes(*p, strlen(*p) + 1, node->input_key);
+        }
+        node->input_fp = fp ^ stdin_fp;
+        node->has_fp = true;
+        if (!lookup_inputs_MemoCache(g->incremental, node->input_key, &stored) || stored != node->input_fp) {
+            current = false;
+        }
+        for (int e = 0; current && e < g->n_edges; e++) {
+            DagEdge *ed = &g->edges[e];
+            if (ed->type == DAG_EDGE_FILE && ed->to == i && g->nodes[ed->from].state == DAG_DONE) {
+                current = false; // it ran this time: its files may differ
+            }
+        }
+    }
+    g->nodes[head].current = current;
+    return current;
+}
+
+static void on_node_done(JobRunner *r, Job *job, void *data) {
+    Dag *g = data;
+    DagNode *node = job->data;
+    int idx = node - g->nodes;
+
+    if (job->spawn_rc != 0) {
+        close_ProcInfo(&job->ci); // our ends of its pipes, so the neighbours see EOF/EPIPE
+    }
+    bool ok = job->spawn_rc == 0 && WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0;
+    node->state = ok ? DAG_DONE : DAG_FAILED;
+    if (!ok && job->cancelled && job->spawn_rc == ECANCELED) {
+        node->state = DAG_SKIPPED; // submitted, but the scope dropped it before it started
+        g->n_skipped++;
+    } else if (!ok) {
+        g->n_failed++;
+    } else if (g->history != NULL) {
+        int64_t ns = (job->ci.t_end.tv_sec - job->ci.t_start.tv_sec) * 1000000000ll +
+            (job->ci.t_end.tv_nsec - job->ci.t_start.tv_nsec);
+        record_DagHistory(g->history, node->sig, ns > 0 ? ns : 0);
+    }
+    if (ok && node->has_fp) {
+        store_inputs_MemoCache(g->incremental, node->input_key, node->input_fp);
+    }
+    release_dependents(g, idx, ok);
+    dispatch(g);
+}
+
+static void fail_node(Dag *g, DagNode *node) {
+    node->job.spawn_rc = 1;
+    node->job.status = -1;
+    on_node_done(&g->runner, &node->job, g);
+}
+
+// wire the chain's pipes, then submit producers before their consumers
+static void launch_chain(Dag *g, int head) {
+    for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+        g->nodes[i].state = DAG_RUNNING;
+    }
+    for (int i = head; g->nodes[i].pipe_out >= 0; i = g->nodes[i].pipe_out) {
+        ProcInfo *from = &g->nodes[i].job.ci, *to = &g->nodes[g->nodes[i].pipe_out].job.ci;
+        int p[2];
+        if (pipe2(p, O_CLOEXEC)) {
+            showError(false, "Failed to create pipe from %s to %s: %s!",
+                g->nodes[i].job.args[0], g->nodes[g->nodes[i].pipe_out].job.args[0], strerror(errno));
+            p[0] = p[1] = -1; // both ends fail to spawn with an invalid fd
+        }
+        from->stdout_type = PROC_COM_FD;
+        from->p_stdout = p[1];
+        to->stdin_type = PROC_COM_FD;
+        to->p_stdin = p[0];
+    }
+    for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+        DagNode *node = &g->nodes[i];
+        node->job.data = node;
+        if (submit_JobRunner(&g->runner, &node->job)) {
+            fail_node(g, node);
+        }
+    }
+}
+
+static int chain_length(const Dag *g, int head) {
+    int n = 0;
+    for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+        n++;
+    }
+    return n;
+}
+
+// start ready chains, longest remaining path first, while their members fit
+// the free slots; a chain that doesn't fit waits rather than being overtaken
+static void dispatch(Dag *g) {
+    JobRunner *r = &g->runner;
+
+    if (g->dispatching) { // a spawn failure reports back from inside launch_chain()
+        return;
+    }
+    g->dispatching = true;
+    while (g->scope != NULL && g->scope->cancelled && g->n_ready > 0) {
+        skip_chain(g, g->ready[--g->n_ready]);
+    }
+    while (g->n_ready > 0) {
+        int best = 0;
+        for (int k = 1; k < g->n_ready; k++) {
+            if (g->nodes[g->ready[k]].rank_ns > g->nodes[g->ready[best]].rank_ns) {
+                best = k;
+            }
+        }
+        int head = g->ready[best];
+        if (g->incremental != NULL && chain_current(g, head)) {
+            g->ready[best] = g->ready[--g->n_ready];
+            for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+                g->nodes[i].state = DAG_CURRENT;
+                g->n_current++;
+            }
+            for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+                release_dependents(g, i, true);
+            }
+            continue;
+        }
+        if (r->n_running > 0 && r->n_running + chain_length(g, head) > r->max_running) {
+            break;
+        }
+        g->ready[best] = g->ready[--g->n_ready];
+        launch_chain(g, head);
+    }
+    r->n_waiting = g->n_ready;
+    g->dispatching = false;
+}
+
+// assign every node to its chain and count the chains' file dependencies;
+// Kahn's algorithm over the chains then proves the graph acyclic
+static int plan_Dag(Dag *g) {
+    int *indeg = NULL, *queue = NULL, n_heads = 0, done = 0;
+    int rc = 1;
+
+    uint64_t fallback = 1, sum = 0;
+    if (g->history != NULL && g->history->n > 0) {
+        for (size_t i = 0; i < g->history->cap; i++) {
+            sum += g->history->table[i].est_ns;
+        }
+        fallback = sum / g->history->n > 0 ? sum / g->history->n : 1;
+    }
+    for (int i = 0; i < g->n_nodes; i++) {
+        DagNode *node = &g->nodes[i];
+        node->group = -1;
+        node->waiting = 0;
+        node->state = DAG_PENDING;
+        node->current = -1;
+        node->has_fp = false;
+        node->sig = signature_args(node->job.args);
+        node->est_ns = g->history != NULL ? estimate_DagHistory(g->history, node->sig) : 1;
+        if (node->est_ns == 0) {
+            node->est_ns = fallback;
+        }
+    }
+    for (int i = 0; i < g->n_nodes; i++) {
+        if (g->nodes[i].pipe_in < 0) {
+            n_heads++;
+            for (int j = i; j >= 0; j = g->nodes[j].pipe_out) {
+                g->nodes[j].group = i;
+            }
+        }
+    }
+    for (int i = 0; i < g->n_nodes; i++) {
+        if (g->nodes[i].group < 0) {
+            showError(false, "Graph node %s is on a pipe cycle!", g->nodes[i].job.args[0]);
+            return 1;
+        }
+    }
+    for (int e = 0; e < g->n_edges; e++) {
+        DagEdge *ed = &g->edges[e];
+        if (ed->type != DAG_EDGE_FILE) {
+            continue;
+        }
+        int from = g->nodes[ed->from].group, to = g->nodes[ed->to].group;
+        if (from == to) {
+            showError(false, "File edge %s -> %s is inside one pipe chain!",
+                g->nodes[ed->from].job.args[0], g->nodes[ed->to].job.args[0]);
+            return 1;
+        }
+        g->nodes[to].waiting++;
+    }
+    if ((indeg = malloc(g->n_nodes * sizeof(int) + 1)) == NULL ||
+            (queue = malloc(g->n_nodes * sizeof(int) + 1)) == NULL) {
+        showError(false, "Failed to plan a graph of %d nodes!", g->n_nodes);
+        goto clean_up;
+    }
+    int q_tail = 0;
+    for (int i = 0; i < g->n_nodes; i++) {
+        indeg[i] = g->nodes[i].waiting;
+        if (g->nodes[i].pipe_in < 0 && indeg[i] == 0) {
+            queue[q_tail++] = i;
+        }
+    }
+    for (int q = 0; q < q_tail; q++) {
+        done++;
+        for (int e = 0; e < g->n_edges; e++) {
+            DagEdge *ed = &g->edges[e];
+            if (ed->type == DAG_EDGE_FILE && g->nodes[ed->from].group == queue[q]) {
+                int to = g->nodes[ed->to].group;
+                if (--indeg[to] == 0) {
+                    queue[q_tail++] = to;
+                }
+            }
+        }
+    }
+    if (done != n_heads) {
+        showError(false, "Graph has a dependency cycle!");
+        goto clean_up;
+    }
+    // ranks from the sinks up: a chain takes as long as its slowest member
+    for (int q = q_tail - 1; q >= 0; q--) {
+        int head = queue[q];
+        uint64_t below = 0, own = 0;
+        for (int e = 0; e < g->n_edges; e++) {
+            DagEdge *ed = &g->edges[e];
+            if (ed->type == DAG_EDGE_FILE && g->nodes[ed->from].group == head) {
+                uint64_t r = g->nodes[g->nodes[ed->to].group].rank_ns;
+                below = r > below ? r : below;
+            }
+        }
+        for (int i = head; i >= 0; i = g->nodes[i].pipe_out) {
+            own = g->nodes[i].est_ns > own ? g->nodes[i].est_ns : own;
+        }
+        g->nodes[head].rank_ns = own + below;
+    }
+    rc = 0;
+
+clean_up:
+    free(indeg);
+    free(queue);
+    return rc;
+}
+
+long run_Dag(Dag *g) {
+    int longest = 0;
+
+    if (plan_Dag(g)) {
+        return -1;
+    }
+    g->n_failed = g->n_skipped = g->n_current = 0;
+    g->runner.on_done = on_node_done;
+    g->runner.data = g;
+    for (int i = 0; i < g->n_nodes; i++) {
+        g->nodes[i].job.scope = g->scope;
+    }
+    for (int i = 0; i < g->n_nodes; i++) {
+        if (g->nodes[i].pipe_in < 0) {
+            int n = chain_length(g, i);
+            longest = n > longest ? n : longest;
+        }
+    }
+    // a chain blocks on itself unless all of it runs
+    if (g->runner.max_running < longest) {
+        g->runner.max_running = longest;
+    }
+    if (g->runner.adapt != NULL && g->runner.adapt->o.min_limit < longest) {
+        g->runner.adapt->o.min_limit = longest;
+        if (g->runner.adapt->o.max_limit < longest) {
+            g->runner.adapt->o.max_limit = longest;
+        }
+    }
+    free(g->ready);
+    if ((g->ready = malloc((g->n_nodes + 1) * sizeof(int))) == NULL) {
+        showError(false, "Failed to allocate the ready list of a %d node graph!", g->n_nodes);
+        return -1;
+    }
+    g->n_ready = 0;
+    for (int i = 0; i < g->n_nodes; i++) {
+        if (g->nodes[i].pipe_in < 0 && g->nodes[i].waiting == 0) {
+            g->nodes[i].state = DAG_READY;
+            g->ready[g->n_ready++] = i;
+        }
+    }
+    dispatch(g);
+    run_JobRunner(&g->runner);
+    return g->n_failed + g->n_skipped;
+}
+
+void close_Dag(Dag *g) {
+    close_JobRunner(&g->runner);
+    for (int i = 0; i < g->n_nodes; i++) {
+        free_CaptureResult(&g->nodes[i].job.out);
+    }
+    free(g->nodes);
+    free(g->edges);
+    free(g->ready);
+    g->ready = NULL;
+    g->nodes = NULL;
+    g->edges = NULL;
+    g->n_nodes = g->n_edges = 0;
+}
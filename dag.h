@@ -0,0 +1,126 @@
+#ifndef DAG_H
+#define DAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "runner.h"
+#include "memo.h"
+
+typedef enum {
+    DAG_EDGE_FILE = 0,  // to starts once from exited 0 (e.g. it reads a file from wrote)
+    DAG_EDGE_PIPE       // from's stdout is to's stdin; both run at the same time
+} DagEdgeType;
+
+typedef enum {
+    DAG_PENDING = 0,
+    DAG_READY,          // dependencies done, waiting for slots
+    DAG_RUNNING,        // submitted to the runner
+    DAG_DONE,           // exited 0
+    DAG_FAILED,         // failed to spawn, or exited otherwise
+    DAG_SKIPPED,        // a file dependency failed, or its scope was cancelled: never started
+    DAG_CURRENT         // incremental: its inputs didn't change since its last success, not run
+} DagState;
+
+typedef struct {
+    Job job;            // args, env, ci stream config and the results; job.data is internal
+    void *data;         // caller's
+    DagState state;
+    // graph bookkeeping
+    int group;          // first node of its pipe chain
+    int pipe_in;        // node feeding stdin over a pipe, -1 if none
+    int pipe_out;       // node reading stdout over a pipe, -1 if none
+    int waiting;        // chain head: file dependencies of the chain not done yet
+    uint64_t sig;       // hash of args, the DagHistory key
+    uint64_t est_ns;    // expected runtime
+    uint64_t rank_ns;   // chain head: expected time from its start to the end of the graph
+    char **inputs;      // inputs_Dag(): the files it reads, NULL-terminated
+    uint64_t input_key; // incremental: its entry in the store
+    uint64_t input_fp;  // incremental: fingerprint of its inputs as it started
+    bool has_fp;
+    int current;        // chain head, incremental: 1 up to date, 0 must run, -1 not checked yet
+} DagNode;
+
+typedef struct {
+    uint64_t sig;       // 0 for a free slot
+    uint64_t est_ns;    // running mean, the last runs weigh most
+    uint32_t runs;
+} DagHistEntry;
+
+// runtime per command signature (its argv), learnt from the t_start/t_end
+// of every node that exited 0; keep one across runs, or save it between them
+typedef struct {
+    DagHistEntry *table;    // open addressing, at most half full
+    size_t cap;             // power of two
+    size_t n;
+} DagHistory;
+
+void init_DagHistory(DagHistory *h);
+void free_DagHistory(DagHistory *h);
+// hash of every argument, never 0
+uint64_t signature_args(char* args[]);
+// expected runtime of sig, 0 if it never ran
+uint64_t estimate_DagHistory(const DagHistory *h, uint64_t sig);
+int record_DagHistory(DagHistory *h, uint64_t sig, uint64_t ns);
+// one "signature estimate runs" text line per entry; load merges into h
+int load_DagHistory(DagHistory *h, const char *path);
+int save_DagHistory(const DagHistory *h, const char *path);
+
+typedef struct {
+    int from;
+    int to;
+    DagEdgeType type;
+} DagEdge;
+
+// a graph of commands run on a JobRunner: every pipe chain becomes ready as
+// a whole once the file dependencies of all its members are done, so
+// independent branches run in parallel up to max_running (raised to the
+// longest chain, whose members must run at once). Of the ready chains the
+// one on the longest remaining path starts first, measured with history's
+// runtimes when set (commands it doesn't know count as its mean), in nodes
+// otherwise. A node feeds at most one pipe and reads at most one; a failed
+// node skips what depends on its files
+//
+// With incremental set, a chain whose nodes all declared their inputs is
+// not run when every fingerprint matches the one of the node's last
+// successful run and no file dependency ran this time; its nodes end
+// DAG_CURRENT and count as done. A node that ran invalidates everything
+// reading its files
+typedef struct {
+    JobRunner runner;
+    DagNode *nodes;
+    int n_nodes;
+    int cap_nodes;
+    DagEdge *edges;
+    int n_edges;
+    int cap_edges;
+    DagHistory *history;    // caller's, NULL to rank by node count; updated as nodes finish
+    int *ready;             // heads of ready chains
+    int n_ready;
+    bool dispatching;
+    size_t n_failed;
+    size_t n_skipped;
+    MemoCache *incremental; // caller's, NULL to run every node; its dir keeps the fingerprints
+    bool hash_inputs;       // fingerprint contents rather than (dev, inode, mtime, size)
+    size_t n_current;
+    // caller's, NULL for none: every node runs in it, so the first failure
+    // (see CancelScope) SIGTERMs the running nodes and skips every node
+    // that hasn't started
+    CancelScope *scope;
+} Dag;
+
+int init_Dag(Dag *g, int max_running, EvLoopBackend backend);
+// add a node; ci (NULL for every stream inherited) is copied, pipe edges
+// override the streams they wire; returns the node index, -1 on error
+int add_Dag(Dag *g, char* args[], char* env[], const ProcInfo *ci);
+int edge_Dag(Dag *g, int from, int to, DagEdgeType type);
+// declare the files node reads (paths stays the caller's); the f_stdin of
+// a PROC_COM_PATH stdin counts without being listed. Only nodes with
+// declared inputs (an empty list for none) are ever found current
+int inputs_Dag(Dag *g, int node, char* paths[]);
+// check the graph is acyclic, then run it to the end; returns the number of
+// failed plus skipped nodes, -1 if the graph is invalid
+long run_Dag(Dag *g);
+void close_Dag(Dag *g);
+
+#endif // DAG_H
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+
+#include "deadline.h"
+
+static int set_timer(DeadlineWheel *w, bool on) {
+    struct itimerspec its = {0};
+    if (on) {
+        its.it_interval.tv_sec = w->tick_ms / 1000;
+        its.it_interval.tv_nsec = (w->tick_ms % 1000) * 1000000L;
+        its.it_value = its.it_interval;
+    }
+    return timerfd_settime(w->tfd, 0, &its, NULL);
+}
+
+static void link_deadline(DeadlineWheel *w, Deadline *d, int ms) {
+    uint64_t ticks = ms / w->tick_ms + 1; // the current tick is already partly gone
+
+    d->wheel = w;
+    d->slot = (w->now + ticks) & (DEADLINE_SLOTS - 1);
+    d->rounds = (ticks - 1) / DEADLINE_SLOTS;
+    d->prev = NULL;
+    d->next = w->slots[d->slot];
+    if (d->next != NULL) {
+        d->next->prev = d;
+    }
+    w->slots[d->slot] = d;
+    d->armed = true;
+    if (w->n_armed++ == 0) {
+        set_timer(w, true);
+    }
+}
+
+static void unlink_deadline(Deadline *d) {
+    DeadlineWheel *w = d->wheel;
+
+    if (w->cursor == d) {
+        w->cursor = d->next;
+    }
+    if (d->prev != NULL) {
+        d->prev->next = d->next;
+    } else {
+        w->slots[d->slot] = d->next;
+    }
+    if (d->next != NULL) {
+        d->next->prev = d->prev;
+    }
+    d->prev = d->next = NULL;
+    d->armed = false;
+    if (--w->n_armed == 0) {
+        set_timer(w, false);
+    }
+}
+
+static void send_signal(ProcInfo *ci, int signo) {
+    if (ci->set_pgroup && !ci->pgroup_shared) {
+        kill(-(ci->pgroup ? ci->pgroup : ci->pid), signo);
+    } else if (ci->pidfd < 0 || syscall(SYS_pidfd_send_signal, ci->pidfd, signo, NULL, 0) < 0) {
+        kill(ci->pid, signo);
+    }
+}
+
+static void expire(DeadlineWheel *w, Deadline *d) {
+    int signo = d->signo;
+
+    unlink_deadline(d);
+    send_signal(d->ci, signo);
+    if (signo == SIGTERM) {
+        d->signo = SIGKILL;
+        link_deadline(w, d, d->grace_ms);
+    }
+    if (d->on_hit != NULL) {
+        d->on_hit(d, signo, d->data);
+    }
+}
+
+static void on_tick(EventLoop *loop, int fd, unsigned revents, void *data) {
+    DeadlineWheel *w = data;
+    uint64_t n;
+
+    if (read(fd, &n, sizeof(n)) != sizeof(n)) {
+        return;
+    }
+    // a late loop catches up tick by tick so no slot is skipped
+    while (n-- > 0 && w->n_armed > 0) {
+        w->now++;
+        w->cursor = w->slots[w->now & (DEADLINE_SLOTS - 1)];
+        while (w->cursor != NULL) {
+            Deadline *d = w->cursor;
+            w->cursor = d->next;
+            if (d->rounds > 0) {
+                d->rounds--;
+            } else {
+                expire(w, d);
+            }
+        }
+    }
+}
+
+int init_DeadlineWheel(DeadlineWheel *w, EventLoop *loop, int tick_ms) {
+    memset(w, 0, sizeof(*w));
+    w->loop = loop;
+    w->tick_ms = tick_ms > 0 ? tick_ms : DEADLINE_TICK_MS;
+    w->tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (w->tfd < 0) {
+        showError(false, "Failed to create deadline timer: %s!", strerror(errno));
+        return 1;
+    }
+    if (add_EventLoop(loop, w->tfd, POLLIN, on_tick, w)) {
+        close(w->tfd);
+        w->tfd = -1;
+        return 1;
+    }
+    return 0;
+}
+
+void close_DeadlineWheel(DeadlineWheel *w) {
+    for (int i = 0; i < DEADLINE_SLOTS; i++) {
+        while (w->slots[i] != NULL) {
+            unlink_deadline(w->slots[i]);
+        }
+    }
+    if (w->tfd >= 0) {
+        del_EventLoop(w->loop, w->tfd);
+        close(w->tfd);
+        w->tfd = -1;
+    }
+}
+
+int arm_Deadline(DeadlineWheel *w, Deadline *d, ProcInfo *ci, int timeout_ms, int grace_ms) {
+    if (d->armed) {
+        unlink_deadline(d);
+    }
+    if (timeout_ms < 0 || ci->pid <= 0) {
+        showError(false, "Invalid deadline (%d ms) for pid %d!", timeout_ms, ci->pid);
+        return 1;
+    }
+    d->ci = ci;
+    d->grace_ms = grace_ms;
+    d->signo = grace_ms > 0 ? SIGTERM : SIGKILL;
+    link_deadline(w, d, timeout_ms);
+    return 0;
+}
+
+void cancel_Deadline(Deadline *d) {
+    if (d->armed) {
+        unlink_deadline(d);
+    }
+}
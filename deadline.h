@@ -0,0 +1,57 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+
+#define DEADLINE_SLOTS 512      // power of two
+#define DEADLINE_TICK_MS 10     // default wheel resolution
+
+typedef struct Deadline Deadline;
+typedef struct DeadlineWheel DeadlineWheel;
+
+// runs after each signal sent on expiry: SIGTERM first, then SIGKILL
+typedef void (*DeadlineHit)(Deadline *d, int signo, void *data);
+
+struct Deadline {
+    ProcInfo *ci;
+    int grace_ms;           // SIGTERM to SIGKILL delay; 0 sends SIGKILL right away
+    int signo;              // next signal to send
+    DeadlineHit on_hit;     // may be NULL
+    void *data;
+    // wheel bookkeeping
+    DeadlineWheel *wheel;
+    Deadline *prev;
+    Deadline *next;
+    unsigned slot;
+    uint64_t rounds;        // full turns of the wheel left
+    bool armed;
+};
+
+// hashed timer wheel on one timerfd: arm and cancel are O(1), a tick only
+// walks its own slot; the timerfd only runs while something is armed
+struct DeadlineWheel {
+    EventLoop *loop;
+    int tfd;
+    int tick_ms;
+    uint64_t now;           // ticks since init
+    Deadline *slots[DEADLINE_SLOTS];
+    Deadline *cursor;       // next entry of the slot being expired
+    size_t n_armed;
+};
+
+// tick_ms <= 0 uses DEADLINE_TICK_MS
+int init_DeadlineWheel(DeadlineWheel *w, EventLoop *loop, int tick_ms);
+void close_DeadlineWheel(DeadlineWheel *w);
+// SIGTERM ci after timeout_ms and SIGKILL it grace_ms later if still around;
+// children in their own process group (set_pgroup) are signalled as a group,
+// unless they share it with others (pgroup_shared)
+// fires at most one tick late, never early; d must stay put until it fires or is cancelled
+int arm_Deadline(DeadlineWheel *w, Deadline *d, ProcInfo *ci, int timeout_ms, int grace_ms);
+// safe on a deadline that never was armed or already fired
+void cancel_Deadline(Deadline *d);
+
+#endif // DEADLINE_H
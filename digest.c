@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "digest.h"
+
+#define P1 0x9e3779b185ebca87ull
+#define P2 0xc2b2ae3d27d4eb4full
+#define P3 0x165667b19e3779f9ull
+#define P4 0x85ebca77c2b2ae63ull
+#define P5 0x27d4eb2f165667c5ull
+
+static inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v; // XXH64 reads little endian, like every target here
+}
+
+static inline uint32_t load32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t v) {
+    acc += v * P2;
+    return rotl(acc, 31) * P1;
+}
+
+static inline uint64_t merge64(uint64_t h, uint64_t acc) {
+    h ^= round64(0, acc);
+    return h * P1 + P4;
+}
+
+// whole stripes at p: the four lanes are independent, so the loop keeps
+// four multiplies in flight
+static const unsigned char *stripes(uint64_t acc[4], const unsigned char *p, size_t n) {
+    uint64_t a = acc[0], b = acc[1], c = acc[2], d = acc[3];
+    for (; n >= DIGEST_STRIPE; p += DIGEST_STRIPE, n -= DIGEST_STRIPE) {
+        a = round64(a, load64(p));
+        b = round64(b, load64(p + 8));
+        c = round64(c, load64(p + 16));
+        d = round64(d, load64(p + 24));
+    }
+    acc[0] = a;
+    acc[1] = b;
+    acc[2] = c;
+    acc[3] = d;
+    return p;
+}
+
+void init_Digest(Digest *d, uint64_t seed) {
+    memset(d, 0, sizeof(*d));
+    d->seed = seed;
+}
+
+void update_Digest(Digest *d, const void *data, size_t n) {
+    const unsigned char *p = data;
+    size_t held = d->len % DIGEST_STRIPE;
+
+    if (n == 0) {
+        return;
+    }
+    if (d->len == 0) { // lazily, so a zeroed Digest works
+        d->acc[0] = d->seed + P1 + P2;
+        d->acc[1] = d->seed + P2;
+        d->acc[2] = d->seed;
+        d->acc[3] = d->seed - P1;
+    }
+    d->len += n;
+    if (held + n < DIGEST_STRIPE) {
+        memcpy(d->tail + held, p, n);
+        return;
+    }
+    if (held > 0) {
+        memcpy(d->tail + held, p, DIGEST_STRIPE - held);
+        stripes(d->acc, d->tail, DIGEST_STRIPE);
+        p += DIGEST_STRIPE - held;
+        n -= DIGEST_STRIPE - held;
+    }
+    p = stripes(d->acc, p, n);
+    memcpy(d->tail, p, n % DIGEST_STRIPE);
+}
+
+uint64_t final_Digest(const Digest *d) {
+    const unsigned char *p = d->tail;
+    size_t n = d->len % DIGEST_STRIPE;
+    uint64_t h;
+
+    if (d->len >= DIGEST_STRIPE) {
+        h = rotl(d->acc[0], 1) + rotl(d->acc[1], 7) + rotl(d->acc[2], 12) + rotl(d->acc[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = merge64(h, d->acc[i]);
+        }
+    } else {
+        h = d->seed + P5;
+    }
+    h += d->len;
+    for (; n >= 8; p += 8, n -= 8) {
+        h ^= round64(0, load64(p));
+        h = rotl(h, 27) * P1 + P4;
+    }
+    if (n >= 4) {
+        h ^= (uint64_t)load32(p) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+        n -= 4;
+    }
+    for (; n > 0; p++, n--) {
+        h ^= *p * P5;
+        h = rotl(h, 11) * P1;
+    }
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    return h ^ (h >> 32);
+}
+
+uint64_t digest_bytes(const void *p, size_t n, uint64_t seed) {
+    Digest d;
+    init_Digest(&d, seed);
+    update_Digest(&d, p, n);
+    return final_Digest(&d);
+}
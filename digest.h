@@ -0,0 +1,26 @@
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DIGEST_STRIPE 32    // bytes the four lanes take per round
+
+// incremental XXH64: feed bytes as they arrive and the value equals
+// XXH64 of all of them, however they were split. All-zero is a fresh
+// digest with seed 0, so it can sit in a zeroed struct
+typedef struct {
+    uint64_t acc[4];
+    uint64_t len;       // bytes fed so far
+    uint64_t seed;
+    unsigned char tail[DIGEST_STRIPE];  // the last len % DIGEST_STRIPE bytes
+} Digest;
+
+void init_Digest(Digest *d, uint64_t seed);
+void update_Digest(Digest *d, const void *p, size_t n);
+// the digest of everything fed so far; d can take more afterwards
+uint64_t final_Digest(const Digest *d);
+// one-shot, the same value as feeding p in any pieces
+uint64_t digest_bytes(const void *p, size_t n, uint64_t seed);
+
+#endif // DIGEST_H
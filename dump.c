@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "dump.h"
+
+static int open_dump(const DumpOptions *o, int flags) {
+    int fd = open(o->path, flags | (o->noatime ? O_NOATIME : 0), 0644);
+    if (fd < 0 && errno == EPERM && o->noatime) { // O_NOATIME needs ownership
+        fd = open(o->path, flags, 0644);
+    }
+    return fd;
+}
+
+int open_DumpFile(DumpFile *d, const DumpOptions *o) {
+    int flags = O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC;
+
+    memset(d, 0, sizeof(*d));
+    d->fd = -1;
+    d->drop_cache = o->drop_cache;
+    if (o->direct) {
+        d->buf_size = o->buf_size ? o->buf_size : DUMP_BUF_SZ;
+        d->buf_size = (d->buf_size + DUMP_ALIGN - 1) & ~(size_t)(DUMP_ALIGN - 1);
+        if ((d->buf = aligned_alloc(DUMP_ALIGN, d->buf_size)) == NULL) {
+            showError(false, "Failed to allocate dump buffer for %s!", o->path);
+            return 1;
+        }
+        d->fd = open_dump(o, flags | O_DIRECT);
+        d->direct = d->fd >= 0;
+        if (d->fd < 0 && errno == EINVAL) { // tmpfs and friends: buffered, then dropped
+            d->drop_cache = true;
+        }
+    }
+    if (d->fd < 0 && (d->fd = open_dump(o, flags)) < 0) {
+        showError(false, "Failed to open dump file %s: %s!", o->path, strerror(errno));
+        close_DumpFile(d);
+        return 1;
+    }
+    // KEEP_SIZE: readers never see the hint as zeros; finish_DumpFile() trims it
+    if (o->size_hint > 0 && fallocate(d->fd, FALLOC_FL_KEEP_SIZE, 0, o->size_hint) < 0 &&
+            errno != EOPNOTSUPP) {
+        showError(false, "Failed to preallocate %s: %s!", o->path, strerror(errno));
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+ssize_t fill_DumpFile(DumpFile *d, int fd) {
+    char scratch[64 * 1024];
+    ssize_t n;
+
+    if (d->buf == NULL) { // no relay buffer: plain copy
+        n = read(fd, scratch, sizeof(scratch));
+        if (n > 0) {
+            if (write_all(d->fd, scratch, n)) {
+                return -1;
+            }
+            d->written += n;
+        }
+        return n;
+    }
+    n = read(fd, d->buf + d->fill, d->buf_size - d->fill);
+    if (n <= 0) {
+        return n;
+    }
+    d->fill += n;
+    if (d->fill == d->buf_size) { // full buffers keep the offset aligned
+        if (write_all(d->fd, d->buf, d->fill)) {
+            return -1;
+        }
+        d->written += d->fill;
+        d->fill = 0;
+    }
+    return n;
+}
+
+int finish_DumpFile(DumpFile *d) {
+    if (d->fill > 0) {
+        size_t aligned = d->fill & ~(size_t)(DUMP_ALIGN - 1);
+        if (aligned > 0 && write_all(d->fd, d->buf, aligned)) {
+            return -1;
+        }
+        // the unaligned tail can't go through O_DIRECT
+        if (d->direct && aligned < d->fill) {
+            fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) & ~O_DIRECT);
+        }
+        if (write_all(d->fd, d->buf + aligned, d->fill - aligned)) {
+            return -1;
+        }
+        d->written += d->fill;
+        d->fill = 0;
+    }
+    if (ftruncate(d->fd, d->written) < 0) { // drops preallocation past the end
+        return -1;
+    }
+    if (d->drop_cache && !d->direct) {
+        fdatasync(d->fd); // dirty pages can't be dropped
+        posix_fadvise(d->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    return 0;
+}
+
+void close_DumpFile(DumpFile *d) {
+    if (d->fd >= 0) {
+        close(d->fd);
+        d->fd = -1;
+    }
+    free(d->buf);
+    d->buf = NULL;
+}
+
+int run_to_file(ProcInfo *ci, char* args[], char* env[], const DumpOptions *o, int *status) {
+    DumpFile d;
+    int rc;
+
+    *status = -1;
+    if (open_DumpFile(&d, o)) {
+        return 1;
+    }
+    if (d.buf != NULL) {
+        ci->stdout_type = PROC_COM_PIPE;
+    } else { // the child writes the file itself
+        ci->stdout_type = PROC_COM_FD;
+        ci->p_stdout = d.fd;
+    }
+    if ((rc = subprocess(ci, args, env)) != 0) {
+        close_DumpFile(&d);
+        return rc;
+    }
+    if (ci->stdin_type == PROC_COM_PIPE && ci->p_stdin >= 0) {
+        close(ci->p_stdin); // nothing to feed: give the child EOF
+        ci->p_stdin = -1;
+    }
+    if (d.buf != NULL) {
+        ssize_t n;
+        while ((n = fill_DumpFile(&d, ci->p_stdout)) > 0 || (n < 0 && errno == EINTR));
+        if (n < 0) {
+            showError(false, "Failed to write dump file %s: %s!", o->path, strerror(errno));
+            rc = 1;
+        }
+        close(ci->p_stdout); // a child still writing after a failure gets EPIPE, not a stall
+        ci->p_stdout = -1;
+    } else {
+        ci->p_stdout = -1; // ours, closed below
+    }
+    reap_ProcInfo(ci, status, 0);
+    if (d.buf == NULL) {
+        d.written = lseek(d.fd, 0, SEEK_END);
+    }
+    if (finish_DumpFile(&d) && rc == 0) {
+        showError(false, "Failed to finish dump file %s: %s!", o->path, strerror(errno));
+        rc = 1;
+    }
+    close_DumpFile(&d);
+    close_ProcInfo(ci);
+    return rc;
+}
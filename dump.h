@@ -0,0 +1,50 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+
+#define DUMP_ALIGN 4096             // O_DIRECT buffer, length and offset alignment
+#define DUMP_BUF_SZ (1024 * 1024)   // default relay buffer
+
+// how run_to_file() writes a child's (possibly multi-GB) stdout to disk
+typedef struct {
+    const char *path;
+    off_t size_hint;    // fallocate() this much up front to limit fragmentation, 0 for none
+    bool noatime;       // O_NOATIME; quietly dropped where we don't own the file
+    bool direct;        // relay the pipe through the parent into an O_DIRECT file,
+                        // so the dump never enters the page cache
+    bool drop_cache;    // without direct: fdatasync and drop the file's cached pages at the end
+    size_t buf_size;    // relay buffer, rounded up to DUMP_ALIGN; 0 for DUMP_BUF_SZ
+} DumpOptions;
+
+typedef struct {
+    int fd;
+    bool direct;        // fd is O_DIRECT (false if the filesystem refused it)
+    bool drop_cache;
+    char *buf;          // relay buffer, DUMP_ALIGN aligned
+    size_t buf_size;
+    size_t fill;
+    off_t written;      // bytes committed to the file
+} DumpFile;
+
+// create/truncate o->path and preallocate it; the relay buffer only exists
+// when direct was asked for. Returns 0, or 1 after reporting the error
+int open_DumpFile(DumpFile *d, const DumpOptions *o);
+// one read() from fd into the relay buffer, writing every full buffer out;
+// bytes read, 0 at EOF, -1 with errno
+ssize_t fill_DumpFile(DumpFile *d, int fd);
+// write what is buffered, give back preallocated space past the end and
+// apply drop_cache; 0 or -1 with errno
+int finish_DumpFile(DumpFile *d);
+void close_DumpFile(DumpFile *d);
+
+// spawn args with stdout going to o->path, directly or through the relay,
+// and reap it; the other streams are taken from ci and must not be pipes
+// returns subprocess()'s rc (or 1 if the file failed), *status the wait status
+int run_to_file(ProcInfo *ci, char* args[], char* env[], const DumpOptions *o, int *status);
+
+#endif // DUMP_H
@@ -0,0 +1,157 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "env_overlay.h"
+#include "subprocess.h"
+
+// does entry ("NAME=value" or a bare "NAME") name the variable name/len?
+static bool names(const char *entry, const char *name, size_t len) {
+    return strncmp(entry, name, len) == 0 && (entry[len] == '=' || entry[len] == '\0');
+}
+
+static size_t name_len(const char *entry) {
+    const char *eq = strchr(entry, '=');
+    return eq != NULL ? (size_t)(eq - entry) : strlen(entry);
+}
+
+// remove name from a list of owned strings
+static void drop(char **list, size_t *n, const char *name, size_t len) {
+    for (size_t i = 0; i < *n; i++) {
+        if (names(list[i], name, len)) {
+            free(list[i]);
+            list[i] = list[--*n];
+            return;
+        }
+    }
+}
+
+static int append(char ***list, size_t *n, size_t *cap, char *s) {
+    if (*n == *cap) {
+        size_t c = *cap ? *cap * 2 : 8;
+        char **l = realloc(*list, c * sizeof(char *));
+        if (l == NULL) {
+            return 1;
+        }
+        *list = l;
+        *cap = c;
+    }
+    (*list)[(*n)++] = s;
+    return 0;
+}
+
+void init_EnvOverlay(EnvOverlay *o, char* base[]) {
+    memset(o, 0, sizeof(*o));
+    o->base = base;
+    o->stale = true;
+}
+
+void free_EnvOverlay(EnvOverlay *o) {
+    clear_EnvOverlay(o);
+    free(o->sets);
+    free(o->unsets);
+    free(o->envp);
+    memset(o, 0, sizeof(*o));
+}
+
+int set_EnvOverlay(EnvOverlay *o, const char *name, const char *value) {
+    size_t len = strlen(name);
+    char *s;
+
+    if (len == 0 || strchr(name, '=') != NULL || asprintf(&s, "%s=%s", name, value) < 0) {
+        showError(false, "Failed to set environment variable %s!", name);
+        return 1;
+    }
+    drop(o->sets, &o->n_sets, name, len);
+    drop(o->unsets, &o->n_unsets, name, len);
+    if (append(&o->sets, &o->n_sets, &o->cap_sets, s)) {
+        free(s);
+        showError(false, "Failed to set environment variable %s!", name);
+        return 1;
+    }
+    o->stale = true;
+    return 0;
+}
+
+int unset_EnvOverlay(EnvOverlay *o, const char *name) {
+    size_t len = strlen(name);
+    char *s = strdup(name);
+
+    if (s == NULL) {
+        showError(false, "Failed to unset environment variable %s!", name);
+        return 1;
+    }
+    drop(o->sets, &o->n_sets, name, len);
+    drop(o->unsets, &o->n_unsets, name, len);
+    if (append(&o->unsets, &o->n_unsets, &o->cap_unsets, s)) {
+        free(s);
+        showError(false, "Failed to unset environment variable %s!", name);
+        return 1;
+    }
+    o->stale = true;
+    return 0;
+}
+
+void clear_EnvOverlay(EnvOverlay *o) {
+    for (size_t i = 0; i < o->n_sets; i++) {
+        free(o->sets[i]);
+    }
+    for (size_t i = 0; i < o->n_unsets; i++) {
+        free(o->unsets[i]);
+    }
+    o->n_sets = o->n_unsets = 0;
+    o->stale = true;
+}
+
+void rebase_EnvOverlay(EnvOverlay *o, char* base[]) {
+    o->base = base;
+    o->stale = true;
+}
+
+// is the base entry replaced or removed by a delta?
+static bool shadowed(const EnvOverlay *o, const char *entry) {
+    size_t len = name_len(entry);
+    for (size_t i = 0; i < o->n_sets; i++) {
+        if (names(o->sets[i], entry, len)) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < o->n_unsets; i++) {
+        if (names(o->unsets[i], entry, len)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+char** envp_EnvOverlay(EnvOverlay *o) {
+    size_t n_base = 0, n = 0;
+
+    if (!o->stale) {
+        return o->envp;
+    }
+    while (o->base != NULL && o->base[n_base] != NULL) {
+        n_base++;
+    }
+    if (n_base + o->n_sets + 1 > o->cap_envp) {
+        size_t cap = n_base + o->n_sets + 1;
+        char **envp = realloc(o->envp, cap * sizeof(char *));
+        if (envp == NULL) {
+            showError(false, "Failed to build environment!");
+            return NULL;
+        }
+        o->envp = envp;
+        o->cap_envp = cap;
+    }
+    for (size_t i = 0; i < n_base; i++) {
+        if (o->n_sets + o->n_unsets == 0 || !shadowed(o, o->base[i])) {
+            o->envp[n++] = o->base[i];
+        }
+    }
+    memcpy(o->envp + n, o->sets, o->n_sets * sizeof(char *));
+    n += o->n_sets;
+    o->envp[n] = NULL;
+    o->stale = false;
+    return o->envp;
+}
@@ -0,0 +1,36 @@
+#ifndef ENV_OVERLAY_H
+#define ENV_OVERLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// set/unset deltas over a base environment (usually environ); the envp for
+// subprocess() is materialized on first use and cached until a delta or the
+// base changes, so spawning with it is a pointer handoff rather than a copy
+// the envp points into base: its strings are not copied
+typedef struct {
+    char** base;
+    char** sets;            // owned "NAME=value" strings
+    size_t n_sets;
+    size_t cap_sets;
+    char** unsets;          // owned names
+    size_t n_unsets;
+    size_t cap_unsets;
+    char** envp;            // cached result, valid while !stale
+    size_t cap_envp;
+    bool stale;
+} EnvOverlay;
+
+void init_EnvOverlay(EnvOverlay *o, char* base[]);
+void free_EnvOverlay(EnvOverlay *o);
+int set_EnvOverlay(EnvOverlay *o, const char *name, const char *value);
+int unset_EnvOverlay(EnvOverlay *o, const char *name);
+// drop every delta
+void clear_EnvOverlay(EnvOverlay *o);
+// base is a different array now, or its entries changed (setenv/putenv);
+// pass the same array again to just invalidate the cache
+void rebase_EnvOverlay(EnvOverlay *o, char* base[]);
+// the NULL-terminated result, NULL on ENOMEM; valid until the next change
+char** envp_EnvOverlay(EnvOverlay *o);
+
+#endif // ENV_OVERLAY_H
@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "event_loop.h"
+#include "metrics.h"
+
+#define EVLOOP_BATCH 256
+
+static inline uint64_t ev_key(int fd, unsigned gen) {
+    return ((uint64_t)gen << 32) | (uint32_t)fd;
+}
+
+static EvHandler *get_handler(EventLoop *loop, int fd) {
+    if (fd < 0 || fd >= loop->n_handlers || loop->handlers[fd].cb == NULL) {
+        return NULL;
+    }
+    return &loop->handlers[fd];
+}
+
+static int grow_handlers(EventLoop *loop, int fd) {
+    if (fd < loop->n_handlers) {
+        return 0;
+    }
+    int n = loop->n_handlers ? loop->n_handlers : 64;
+    while (n <= fd) {
+        n *= 2;
+    }
+    EvHandler *h = realloc(loop->handlers, n * sizeof(EvHandler));
+    if (h == NULL) {
+        return -1;
+    }
+    memset(h + loop->n_handlers, 0, (n - loop->n_handlers) * sizeof(EvHandler));
+    loop->handlers = h;
+    loop->n_handlers = n;
+    return 0;
+}
+
+static int arm_uring(EventLoop *loop, int fd, EvHandler *h) {
+    struct io_uring_sqe *sqe = get_sqe_Uring(&loop->ring);
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = h->events | POLLERR | POLLHUP;
+    sqe->user_data = ev_key(fd, h->gen);
+    h->armed = true;
+    return 0;
+}
+
+static void disarm_uring(EventLoop *loop, int fd, EvHandler *h) {
+    if (!h->armed) {
+        return;
+    }
+    struct io_uring_sqe *sqe = get_sqe_Uring(&loop->ring);
+    if (sqe != NULL) {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = ev_key(fd, h->gen);
+        sqe->user_data = URING_TIMEOUT_DATA; // completion carries nothing of interest
+    }
+    h->armed = false;
+}
+
+int init_EventLoop(EventLoop *loop, EvLoopBackend backend) {
+    memset(loop, 0, sizeof(*loop));
+    loop->backend = backend;
+    loop->epfd = -1;
+    loop->ring.fd = -1;
+    switch (backend) {
+        case EVLOOP_EPOLL:
+            loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+            if (loop->epfd < 0) {
+                showError(false, "Failed to create epoll instance: %s!", strerror(errno));
+                return 1;
+            }
+            break;
+        case EVLOOP_IO_URING: {
+            int err = init_Uring(&loop->ring, EVLOOP_BATCH);
+            if (err < 0) {
+                showError(false, "Failed to set up io_uring: %s!", strerror(-err));
+                return 1;
+            }
+            break;
+        }
+        default:
+            showError(false, "Unknown event loop backend (%d)!", backend);
+            return 1;
+    }
+    return 0;
+}
+
+void close_EventLoop(EventLoop *loop) {
+    if (loop->epfd >= 0) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+    if (loop->ring.fd >= 0) {
+        close_Uring(&loop->ring);
+    }
+    free(loop->handlers);
+    loop->handlers = NULL;
+    loop->n_handlers = 0;
+    loop->n_active = 0;
+}
+
+int add_EventLoop(EventLoop *loop, int fd, unsigned events, EvCallback cb, void *data) {
+    if (fd < 0 || cb == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (grow_handlers(loop, fd)) {
+        return -1;
+    }
+    EvHandler *h = &loop->handlers[fd];
+    if (h->cb != NULL) {
+        errno = EEXIST;
+        return -1;
+    }
+    h->cb = cb;
+    h->data = data;
+    h->events = events;
+    h->gen++;
+    h->armed = false;
+    h->stream = -2;
+    h->queued = 0;
+    if (loop->backend == EVLOOP_EPOLL) {
+        struct epoll_event ev = {.events = events, .data.u64 = ev_key(fd, h->gen)};
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev)) {
+            h->cb = NULL;
+            return -1;
+        }
+    } else if (arm_uring(loop, fd, h)) {
+        h->cb = NULL;
+        errno = EBUSY;
+        return -1;
+    }
+    loop->n_active++;
+    return 0;
+}
+
+int mod_EventLoop(EventLoop *loop, int fd, unsigned events) {
+    EvHandler *h = get_handler(loop, fd);
+    if (h == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (h->events == events) {
+        return 0;
+    }
+    h->events = events;
+    if (loop->backend == EVLOOP_EPOLL) {
+        struct epoll_event ev = {.events = events, .data.u64 = ev_key(fd, h->gen)};
+        return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+    disarm_uring(loop, fd, h);
+    h->gen++;
+    return arm_uring(loop, fd, h);
+}
+
+int del_EventLoop(EventLoop *loop, int fd) {
+    EvHandler *h = get_handler(loop, fd);
+    if (h == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    if (loop->backend == EVLOOP_EPOLL) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+    } else {
+        disarm_uring(loop, fd, h);
+    }
+    h->cb = NULL;
+    h->gen++; // anything still queued for this fd is stale now
+    loop->n_active--;
+    return 0;
+}
+
+// look up the handler an event key was issued for; NULL if it went stale
+static EvHandler *match_handler(EventLoop *loop, uint64_t key) {
+    int fd = (int)(uint32_t)key;
+    EvHandler *h = get_handler(loop, fd);
+    if (h == NULL || h->gen != (unsigned)(key >> 32)) {
+        return NULL;
+    }
+    return h;
+}
+
+static int run_epoll(EventLoop *loop, int timeout_ms) {
+    struct epoll_event evs[EVLOOP_BATCH];
+    int n = epoll_wait(loop->epfd, evs, EVLOOP_BATCH, timeout_ms);
+    int dispatched = 0;
+
+    if (n < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++) {
+        EvHandler *h = match_handler(loop, evs[i].data.u64);
+        if (h != NULL) { // an earlier callback may have removed it
+            h->cb(loop, (int)(uint32_t)evs[i].data.u64, evs[i].events, h->data);
+            dispatched++;
+        }
+    }
+    return dispatched;
+}
+
+static int run_uring(EventLoop *loop, int timeout_ms) {
+    struct io_uring_cqe *cqe;
+    int dispatched = 0;
+
+    if (peek_Uring(&loop->ring) == NULL) {
+        int err = submit_Uring(&loop->ring, 1, timeout_ms);
+        if (err < 0) {
+            errno = -err;
+            return -1;
+        }
+    }
+    while ((cqe = peek_Uring(&loop->ring)) != NULL) {
+        uint64_t key = cqe->user_data;
+        int res = cqe->res;
+        seen_Uring(&loop->ring);
+        if (key == URING_TIMEOUT_DATA) {
+            continue;
+        }
+        EvHandler *h = match_handler(loop, key);
+        if (h == NULL) {
+            continue;
+        }
+        int fd = (int)(uint32_t)key;
+        unsigned gen = h->gen;
+        h->armed = false;
+        h->cb(loop, fd, res < 0 ? POLLERR : (unsigned)res, h->data);
+        dispatched++;
+        // poll requests are one-shot: re-arm unless the callback changed the registration
+        h = get_handler(loop, fd);
+        if (h != NULL && h->gen == gen && !h->armed) {
+            arm_uring(loop, fd, h);
+        }
+    }
+    // hand re-armed polls to the kernel without waiting
+    if (loop->ring.pending > 0) {
+        submit_Uring(&loop->ring, 0, 0);
+    }
+    return dispatched;
+}
+
+void sample_EventLoop(EventLoop *loop) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    loop->sampled_ns = now.tv_sec * 1000000000ull + now.tv_nsec;
+    memset(loop->queued, 0, sizeof(loop->queued));
+    memset(loop->queued_max, 0, sizeof(loop->queued_max));
+    for (int fd = 0; fd < loop->n_handlers; fd++) {
+        EvHandler *h = &loop->handlers[fd];
+        int n;
+        if (h->cb == NULL) {
+            continue;
+        }
+        if (h->stream == -2) { // once per registration, so other fds cost nothing after
+            struct stat st;
+            bool pipe = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+            bool writer = (fcntl(fd, F_GETFL) & O_ACCMODE) == O_WRONLY;
+            h->stream = !pipe ? -1 : writer ? STDIN_FILENO : STDOUT_FILENO;
+        }
+        if (h->stream < 0 || ioctl(fd, FIONREAD, &n) < 0) {
+            continue;
+        }
+        h->queued = n;
+        loop->queued[h->stream] += n;
+        if ((uint64_t)n > loop->queued_max[h->stream]) {
+            loop->queued_max[h->stream] = n;
+        }
+    }
+    metrics_piped(loop->queued, loop->queued_max);
+}
+
+static void maybe_sample(EventLoop *loop) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec * 1000000000ull + now.tv_nsec - loop->sampled_ns >= loop->sample_ms * 1000000ull) {
+        sample_EventLoop(loop);
+    }
+}
+
+int run_EventLoop(EventLoop *loop, int timeout_ms) {
+    int n = loop->backend == EVLOOP_EPOLL ? run_epoll(loop, timeout_ms) : run_uring(loop, timeout_ms);
+
+    if (loop->sample_ms > 0) {
+        maybe_sample(loop);
+    }
+    return n;
+}
+
+int watch_ProcInfo(EventLoop *loop, ProcInfo *ci, EvCallback cb, void *data) {
+    if (proc_com_piped(ci->stdin_type) && ci->p_stdin >= 0) {
+        if (add_EventLoop(loop, ci->p_stdin, POLLOUT, cb, data)) {
+            goto fail;
+        }
+        loop->handlers[ci->p_stdin].stream = STDIN_FILENO;
+    }
+    if (proc_com_piped(ci->stdout_type) && ci->p_stdout >= 0) {
+        if (add_EventLoop(loop, ci->p_stdout, POLLIN, cb, data)) {
+            goto fail;
+        }
+        loop->handlers[ci->p_stdout].stream = STDOUT_FILENO;
+    }
+    if (proc_com_piped(ci->stderr_type) && ci->p_stderr >= 0) {
+        if (add_EventLoop(loop, ci->p_stderr, POLLIN, cb, data)) {
+            goto fail;
+        }
+        loop->handlers[ci->p_stderr].stream = STDERR_FILENO;
+    }
+    if (ci->pidfd >= 0) {
+        if (add_EventLoop(loop, ci->pidfd, POLLIN, cb, data)) {
+            goto fail;
+        }
+        loop->handlers[ci->pidfd].stream = -1;
+    }
+    return 0;
+
+fail:
+    showError(false, "Failed to watch subprocess %d: %s!", ci->pid, strerror(errno));
+    unwatch_ProcInfo(loop, ci);
+    return 1;
+}
+
+void unwatch_ProcInfo(EventLoop *loop, ProcInfo *ci) {
+    if (proc_com_piped(ci->stdin_type) && get_handler(loop, ci->p_stdin)) {
+        del_EventLoop(loop, ci->p_stdin);
+    }
+    if (proc_com_piped(ci->stdout_type) && get_handler(loop, ci->p_stdout)) {
+        del_EventLoop(loop, ci->p_stdout);
+    }
+    if (proc_com_piped(ci->stderr_type) && get_handler(loop, ci->p_stderr)) {
+        del_EventLoop(loop, ci->p_stderr);
+    }
+    if (ci->pidfd >= 0 && get_handler(loop, ci->pidfd)) {
+        del_EventLoop(loop, ci->pidfd);
+    }
+    if (ci->exec_sentinel && ci->p_exec >= 0 && get_handler(loop, ci->p_exec)) {
+        del_EventLoop(loop, ci->p_exec);
+    }
+}
+
+static void on_exec_done(EventLoop *loop, int fd, unsigned revents, void *data) {
+    del_EventLoop(loop, fd);
+    exec_done_ProcInfo(data);
+}
+
+int watch_exec_ProcInfo(EventLoop *loop, ProcInfo *ci) {
+    if (!ci->exec_sentinel || ci->p_exec < 0) {
+        return 0;
+    }
+    return add_EventLoop(loop, ci->p_exec, POLLIN, on_exec_done, ci);
+}
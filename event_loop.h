@@ -0,0 +1,67 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "subprocess.h"
+#include "uring.h"
+
+typedef enum {
+    EVLOOP_EPOLL = 0,   // epoll(7), level-triggered
+    EVLOOP_IO_URING     // io_uring IORING_OP_POLL_ADD, re-armed after each event
+} EvLoopBackend;
+
+typedef struct EventLoop EventLoop;
+
+// readiness callback; revents uses the poll(2) bits (POLLIN, POLLOUT, POLLHUP, ...)
+typedef void (*EvCallback)(EventLoop *loop, int fd, unsigned revents, void *data);
+
+typedef struct {
+    EvCallback cb;      // NULL if fd is not registered
+    void *data;
+    unsigned events;    // requested events; POLLERR/POLLHUP are always reported
+    unsigned gen;       // bumped on every (re)registration to drop stale events
+    bool armed;         // io_uring: a poll request is in flight
+    signed char stream; // sampling: STDIN_FILENO.. of a pipe, -1 if none, -2 not looked at yet
+    unsigned queued;    // sampling: bytes in the pipe at the last sample
+} EvHandler;
+
+struct EventLoop {
+    EvLoopBackend backend;
+    int epfd;               // epoll fd (EVLOOP_EPOLL)
+    Uring ring;             // EVLOOP_IO_URING
+    EvHandler *handlers;    // indexed by fd
+    int n_handlers;         // capacity of handlers
+    int n_active;           // registered fds
+    // backpressure sampling: between dispatches, at most every sample_ms,
+    // FIONREAD each registered pipe and publish the bytes queued through
+    // metrics_piped(). Pipes from watch_ProcInfo() count as their stream,
+    // others as stdin for a write end and stdout for a read end
+    int sample_ms;          // input, 0 for none
+    uint64_t sampled_ns;    // CLOCK_MONOTONIC of the last sample
+    uint64_t queued[3];     // last sample, by stream: summed over the pipes
+    uint64_t queued_max[3]; // and in the fullest one
+};
+
+int init_EventLoop(EventLoop *loop, EvLoopBackend backend);
+void close_EventLoop(EventLoop *loop);
+int add_EventLoop(EventLoop *loop, int fd, unsigned events, EvCallback cb, void *data);
+int mod_EventLoop(EventLoop *loop, int fd, unsigned events);
+int del_EventLoop(EventLoop *loop, int fd);
+// wait up to timeout_ms (-1: forever) and dispatch ready callbacks
+// returns the number of callbacks run, 0 on timeout, -1 on error
+int run_EventLoop(EventLoop *loop, int timeout_ms);
+// take a backpressure sample now, whatever sample_ms says
+void sample_EventLoop(EventLoop *loop);
+
+// register the parent-side fds of ci: p_stdout, p_stderr and pidfd for POLLIN,
+// and a piped p_stdin for POLLOUT (use mod_EventLoop() to mute it when idle)
+int watch_ProcInfo(EventLoop *loop, ProcInfo *ci, EvCallback cb, void *data);
+// drop every fd of ci from the loop; call before close_ProcInfo()
+void unwatch_ProcInfo(EventLoop *loop, ProcInfo *ci);
+// exec_sentinel: let the loop stamp ci->t_exec and close p_exec once the
+// exec went through; ci must outlive the registration
+int watch_exec_ProcInfo(EventLoop *loop, ProcInfo *ci);
+
+#endif // EVENT_LOOP_H
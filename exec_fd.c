@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "exec_fd.h"
+#include "path_cache.h"
+#include "subprocess.h"
+
+typedef struct {
+    char *name;
+    char *path;
+    int fd;
+} ExecFd;
+
+static pthread_mutex_t exec_lock = PTHREAD_MUTEX_INITIALIZER;
+static ExecFd entries[EXEC_FD_MAX];
+static int n_entries;   // read without the lock to skip it while nothing is registered
+
+static void drop_entry(int i) {
+    close(entries[i].fd);
+    free(entries[i].name);
+    free(entries[i].path);
+    entries[i] = entries[n_entries - 1];
+    __atomic_store_n(&n_entries, n_entries - 1, __ATOMIC_RELEASE);
+}
+
+// O_RDONLY rather than O_PATH, to read the magic: scripts can't run this
+// way, the interpreter would be handed a /dev/fd path that exec closed
+static int open_exe(const char *name, const char *path) {
+    char magic[4];
+    struct stat sb;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        showError(false, "Failed to open executable %s: %s!", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || !(sb.st_mode & 0111) ||
+            pread(fd, magic, 4, 0) != 4 || memcmp(magic, "\177ELF", 4) != 0) {
+        showError(false, "Not registering %s: %s is not an ELF executable!", name, path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// take over fd under name, replacing an entry of the same name
+static int add_entry(const char *name, const char *path, int fd) {
+    char *n = NULL, *p = NULL;
+
+    if ((n = strdup(name)) == NULL || (p = strdup(path)) == NULL) {
+        showError(false, "Failed to allocate exec fd entry for %s!", name);
+        free(n);
+        close(fd);
+        return 1;
+    }
+    pthread_mutex_lock(&exec_lock);
+    for (int i = 0; i < n_entries; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            drop_entry(i);
+            break;
+        }
+    }
+    if (n_entries == EXEC_FD_MAX) {
+        pthread_mutex_unlock(&exec_lock);
+        showError(false, "Too many exec fds registered for %s!", name);
+        free(n);
+        free(p);
+        close(fd);
+        return 1;
+    }
+    entries[n_entries] = (ExecFd){.name = n, .path = p, .fd = fd};
+    __atomic_store_n(&n_entries, n_entries + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&exec_lock);
+    return 0;
+}
+
+int preload_exec_fd(const char *name) {
+    char path[PATH_MAX];
+
+    if (strchr(name, '/') != NULL) {
+        if (strlen(name) >= sizeof(path)) {
+            showError(false, "Executable path %s is too long!", name);
+            return 1;
+        }
+        strcpy(path, name);
+    } else if (!resolve_path(name, path, sizeof(path))) {
+        showError(false, "Failed to find %s in PATH!", name);
+        return 1;
+    }
+    int fd = open_exe(name, path);
+    if (fd < 0) {
+        return 1;
+    }
+    return add_entry(name, path, fd);
+}
+
+int register_exec_blob(const char *name, const void *data, size_t len) {
+    const char *b = data;
+    char path[32];
+    int fd = -1;
+
+    if (len < 4 || memcmp(b, "\177ELF", 4) != 0) {
+        showError(false, "Not registering %s: the blob is not an ELF executable!", name);
+        return 1;
+    }
+#ifdef MFD_EXEC
+    // vm.memfd_noexec may make memfds non-executable unless asked otherwise
+    fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING | MFD_EXEC);
+#endif
+    if (fd < 0) { // older kernels reject MFD_EXEC, their memfds are executable
+        fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    }
+    if (fd < 0) {
+        showError(false, "Failed to create memfd for %s: %s!", name, strerror(errno));
+        return 1;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t n = write(fd, b + off, len - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            showError(false, "Failed to write %s into its memfd: %s!", name, strerror(errno));
+            close(fd);
+            return 1;
+        }
+        off += n;
+    }
+    // sealed, so what runs is what was registered, even if the fd leaks
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+        showError(false, "Failed to seal the memfd of %s: %s!", name, strerror(errno));
+        close(fd);
+        return 1;
+    }
+    // for posix_spawn when clone3 is missing; the spawned child shares the fd number
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    return add_entry(name, path, fd);
+}
+
+int lookup_exec_fd(const char *name, char *buf, size_t sz) {
+    int fd = -1;
+
+    if (__atomic_load_n(&n_entries, __ATOMIC_ACQUIRE) == 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&exec_lock);
+    for (int i = 0; i < n_entries; i++) {
+        if (strcmp(entries[i].name, name) == 0) {
+            if (buf == NULL || strlen(entries[i].path) < sz) {
+                fd = entries[i].fd;
+                if (buf != NULL) {
+                    strcpy(buf, entries[i].path);
+                }
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&exec_lock);
+    return fd;
+}
+
+void drop_exec_fd(const char *name) {
+    pthread_mutex_lock(&exec_lock);
+    for (int i = n_entries - 1; i >= 0; i--) {
+        if (name == NULL || strcmp(entries[i].name, name) == 0) {
+            drop_entry(i);
+        }
+    }
+    pthread_mutex_unlock(&exec_lock);
+}
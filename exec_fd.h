@@ -0,0 +1,29 @@
+#ifndef EXEC_FD_H
+#define EXEC_FD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define EXEC_FD_MAX 32  // registered commands, meant for a handful of hot ones
+
+// registry of open executables: subprocess() spawns a registered args[0]
+// with execveat(fd, "", AT_EMPTY_PATH) from a cloned child, skipping the
+// PATH walk and the permission checks along the path, and always running
+// the inode validated here even if the path is replaced later.
+// name is matched against args[0] as given, like the path cache
+
+// resolve name (PATH walk unless it contains a slash), check it is an ELF
+// executable and keep it open; registering a name again reopens it
+int preload_exec_fd(const char *name);
+// copy len bytes of an ELF executable into a sealed memfd that spawns of
+// name run, so embedded helpers need no file on disk (nor an exec-mounted
+// /tmp); registering a name again replaces it
+int register_exec_blob(const char *name, const void *data, size_t len);
+// the fd for name, -1 if not registered; copies its path into buf when
+// buf is not NULL. Valid until the name is dropped: don't drop while
+// spawns of it may be in flight
+int lookup_exec_fd(const char *name, char *buf, size_t sz);
+// close name's fd, or every fd when NULL
+void drop_exec_fd(const char *name);
+
+#endif // EXEC_FD_H
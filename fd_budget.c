@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/resource.h>
+
+#include "fd_budget.h"
+
+FdCost fd_cost_ProcInfo(const ProcInfo *ci) {
+    FdCost c = {.held = 1}; // pidfd
+    const ProcComType types[3] = {ci->stdin_type, ci->stdout_type, ci->stderr_type};
+
+    for (int i = 0; i < 3; i++) {
+        switch (types[i]) {
+            case PROC_COM_PIPE:
+            case PROC_COM_CAPTURE:
+                c.held++;
+                c.transient++;
+                break;
+            case PROC_COM_MEMFD:
+                c.held++;
+                break;
+            case PROC_COM_DUPLEX: // one socketpair for stdin and stdout
+                if (i == STDIN_FILENO) {
+                    c.held++;
+                    c.transient++;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    for (int i = 0; i < ci->n_extra_fds; i++) {
+        if (ci->extra_fds[i].type == PROC_COM_PIPE) {
+            c.held++;
+            c.transient++;
+        } else {
+            c.transient++; // a copy when it collides with a stream fd
+        }
+    }
+    if (ci->chan_size > 0) {
+        c.held += 2; // ring memfd and bell eventfd
+    }
+    if (ci->exec_sentinel) {
+        c.held++;
+        c.transient++;
+    }
+    return c;
+}
+
+static int count_open_fds(void) {
+    DIR *d = opendir("/proc/self/fd");
+    int n = 0;
+
+    if (d == NULL) {
+        return -1;
+    }
+    while (readdir(d) != NULL) {
+        n++;
+    }
+    closedir(d);
+    return n - 3; // ".", ".." and the DIR's own fd
+}
+
+int init_FdBudget(FdBudget *b, int reserve) {
+    struct rlimit rl;
+
+    memset(b, 0, sizeof(*b));
+    if (getrlimit(RLIMIT_NOFILE, &rl) != 0) {
+        showError(false, "Failed to read RLIMIT_NOFILE: %s!", strerror(errno));
+        return 1;
+    }
+    int open_now = count_open_fds();
+    long limit = (rl.rlim_cur == RLIM_INFINITY ? 1L << 20 : (long)rl.rlim_cur) -
+        (open_now > 0 ? open_now : 0) - (reserve > 0 ? reserve : FD_BUDGET_RESERVE);
+    if (limit <= 0) {
+        showError(false, "No fds left for spawns under RLIMIT_NOFILE %ld!", (long)rl.rlim_cur);
+        return 1;
+    }
+    b->limit = limit > INT_MAX ? INT_MAX : (int)limit;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->freed, NULL);
+    return 0;
+}
+
+void close_FdBudget(FdBudget *b) {
+    pthread_cond_destroy(&b->freed);
+    pthread_mutex_destroy(&b->lock);
+}
+
+int acquire_FdBudget(FdBudget *b, int n, bool wait) {
+    int rc = 0;
+
+    if (n > b->limit) {
+        return EMFILE;
+    }
+    pthread_mutex_lock(&b->lock);
+    while (b->used + n > b->limit) {
+        if (!wait) {
+            rc = EAGAIN;
+            break;
+        }
+        pthread_cond_wait(&b->freed, &b->lock);
+    }
+    if (rc == 0) {
+        b->used += n;
+    }
+    pthread_mutex_unlock(&b->lock);
+    return rc;
+}
+
+void release_FdBudget(FdBudget *b, int n) {
+    if (n <= 0) {
+        return;
+    }
+    pthread_mutex_lock(&b->lock);
+    b->used -= n;
+    pthread_cond_broadcast(&b->freed);
+    pthread_mutex_unlock(&b->lock);
+}
+
+int spawn_FdBudget(FdBudget *b, ProcInfo *ci, char* args[], char* env[], int *held) {
+    FdCost c = fd_cost_ProcInfo(ci);
+    int rc;
+
+    *held = 0;
+    if ((rc = acquire_FdBudget(b, c.held + c.transient, true)) != 0) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, -1, rc, 0, args[0]);
+    }
+    rc = subprocess(ci, args, env);
+    release_FdBudget(b, rc == 0 ? c.transient : c.held + c.transient);
+    *held = rc == 0 ? c.held : 0;
+    return rc;
+}
@@ -0,0 +1,43 @@
+#ifndef FD_BUDGET_H
+#define FD_BUDGET_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "subprocess.h"
+
+#define FD_BUDGET_RESERVE 64    // default fds kept out of the budget for everything else
+
+// what one spawn of a ProcInfo costs the parent in descriptors
+typedef struct {
+    int held;       // kept until close_ProcInfo(): parent pipe ends, pidfd, channel, ...
+    int transient;  // only during the spawn: child pipe ends, the exec sentinel's write end
+} FdCost;
+
+FdCost fd_cost_ProcInfo(const ProcInfo *ci);
+
+// share of RLIMIT_NOFILE spawns may hold: reserve a spawn's whole cost up
+// front, give its transient part back right after and the rest once the
+// ProcInfo is closed, so spawns wait for (or skip) a full table instead of
+// failing half way with EMFILE. Thread-safe
+typedef struct {
+    int limit;
+    int used;
+    pthread_mutex_t lock;
+    pthread_cond_t freed;
+} FdBudget;
+
+// limit = RLIMIT_NOFILE minus the fds open now minus reserve (0 for
+// FD_BUDGET_RESERVE); fails if that leaves nothing. Start a pipe reservoir
+// first and count its fd_budget in reserve
+int init_FdBudget(FdBudget *b, int reserve);
+void close_FdBudget(FdBudget *b);
+// take n fds, waiting for releases if wait; EAGAIN when they aren't free,
+// EMFILE when n exceeds the whole budget
+int acquire_FdBudget(FdBudget *b, int n, bool wait);
+void release_FdBudget(FdBudget *b, int n);
+// blocking: acquire ci's cost, spawn, keep only cost.held (none on
+// failure); *held receives what to release after close_ProcInfo()
+int spawn_FdBudget(FdBudget *b, ProcInfo *ci, char* args[], char* env[], int *held);
+
+#endif // FD_BUDGET_H
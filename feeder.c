@@ -0,0 +1,293 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include "feeder.h"
+#include "metrics.h"
+
+#define FEED_IOV 16
+
+static void free_chunk(FeedChunk *c) {
+    if (c->release != NULL) {
+        c->release(c->ctx, c->data, c->len);
+    }
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    free(c);
+}
+
+static void drop_list(FeedChunk **head, FeedChunk **tail) {
+    while (*head != NULL) {
+        FeedChunk *c = *head;
+        *head = c->next;
+        free_chunk(c);
+    }
+    *tail = NULL;
+}
+
+static void drop_chunks(StdinFeeder *f) {
+    drop_list(&f->head, &f->tail);
+    drop_list(&f->in_pipe, &f->in_pipe_tail);
+    f->queued = 0;
+}
+
+// release the spliced chunks the child has read past
+static void reclaim(StdinFeeder *f) {
+    int unread;
+
+    if (f->in_pipe == NULL || f->ci->p_stdin < 0 || ioctl(f->ci->p_stdin, FIONREAD, &unread)) {
+        return;
+    }
+    size_t consumed = f->written - unread;
+    while (f->in_pipe != NULL && f->in_pipe->end <= consumed) {
+        FeedChunk *c = f->in_pipe;
+        f->in_pipe = c->next;
+        free_chunk(c);
+    }
+    if (f->in_pipe == NULL) {
+        f->in_pipe_tail = NULL;
+    }
+}
+
+// a chunk fully in the pipe: copies are done with, spliced ones wait for the reader
+static void retire(StdinFeeder *f, FeedChunk *c) {
+    if (!c->spliced) {
+        free_chunk(c);
+        return;
+    }
+    c->next = NULL;
+    c->end = f->written;
+    if (f->in_pipe_tail != NULL) {
+        f->in_pipe_tail->next = c;
+    } else {
+        f->in_pipe = c;
+    }
+    f->in_pipe_tail = c;
+}
+
+static ssize_t splice_chunk(StdinFeeder *f, FeedChunk *c) {
+    if (c->fd >= 0) {
+        return splice(c->fd, &c->fd_off, f->ci->p_stdin, NULL, c->len - c->off,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    }
+    struct iovec iov = {(char *)c->data + c->off, c->len - c->off};
+    return vmsplice(f->ci->p_stdin, &iov, 1, SPLICE_F_GIFT | SPLICE_F_NONBLOCK);
+}
+
+static void shut(StdinFeeder *f) {
+    reclaim(f);
+    if (f->ci->p_stdin >= 0) {
+        del_EventLoop(f->loop, f->ci->p_stdin);
+        close(f->ci->p_stdin);
+        f->ci->p_stdin = -1;
+    }
+}
+
+// write as much as the pipe takes; SIGPIPE is held back so a child that
+// closed its stdin shows up as EPIPE here instead of killing the parent
+static void pump(StdinFeeder *f) {
+    sigset_t pipe_set, old_set;
+    struct iovec iov[FEED_IOV];
+
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    while (f->head != NULL) {
+        ssize_t n;
+        if (f->head->spliced) {
+            n = splice_chunk(f, f->head);
+            if (n == 0) { // the file is shorter than queued: end the chunk here
+                f->queued -= f->head->len - f->head->off;
+                f->head->len = f->head->off;
+            }
+        } else {
+            int n_iov = 0;
+            for (FeedChunk *c = f->head; c != NULL && !c->spliced && n_iov < FEED_IOV; c = c->next) {
+                iov[n_iov].iov_base = (char *)c->data + c->off;
+                iov[n_iov++].iov_len = c->len - c->off;
+            }
+            n = writev(f->ci->p_stdin, iov, n_iov);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                metrics_write_stalled(STDIN_FILENO);
+            } else {
+                f->err = errno;
+                if (errno == EPIPE) { // consume the SIGPIPE we just caused
+                    struct timespec zero = {0, 0};
+                    sigtimedwait(&pipe_set, NULL, &zero);
+                }
+                drop_chunks(f);
+                shut(f);
+            }
+            break;
+        }
+        f->written += n;
+        f->queued -= n;
+        while (f->head != NULL) {
+            FeedChunk *c = f->head;
+            size_t left = c->len - c->off;
+            if ((size_t)n < left) {
+                c->off += n;
+                break;
+            }
+            n -= left;
+            f->head = c->next;
+            retire(f, c);
+        }
+        if (f->head == NULL) {
+            f->tail = NULL;
+        }
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+}
+
+static void on_writable(EventLoop *loop, int fd, unsigned revents, void *data) {
+    StdinFeeder *f = data;
+
+    reclaim(f);
+    pump(f);
+    if (f->ci->p_stdin < 0) {
+        return;
+    }
+    if (f->head == NULL) {
+        if (f->on_drain != NULL && !f->finishing) {
+            f->on_drain(f, f->data); // may queue more or finish
+        }
+        if (f->head == NULL && f->finishing) {
+            shut(f);
+        } else if (f->head == NULL && f->ci->p_stdin >= 0) {
+            mod_EventLoop(loop, fd, 0); // idle: stop asking for POLLOUT
+        }
+    }
+}
+
+int init_StdinFeeder(StdinFeeder *f, EventLoop *loop, ProcInfo *ci, FeedDrain on_drain, void *data) {
+    memset(f, 0, sizeof(*f));
+    f->loop = loop;
+    f->ci = ci;
+    f->on_drain = on_drain;
+    f->data = data;
+    if (ci->stdin_type != PROC_COM_PIPE || ci->p_stdin < 0) {
+        showError(false, "Subprocess %d has no stdin pipe to feed!", ci->pid);
+        return 1;
+    }
+    int fl = fcntl(ci->p_stdin, F_GETFL);
+    if (fl < 0 || fcntl(ci->p_stdin, F_SETFL, fl | O_NONBLOCK)) {
+        showError(false, "Failed to make stdin of subprocess %d non-blocking: %s!", ci->pid, strerror(errno));
+        return 1;
+    }
+    del_EventLoop(loop, ci->p_stdin); // watch_ProcInfo() may have registered it
+    if (add_EventLoop(loop, ci->p_stdin, 0, on_writable, f)) {
+        showError(false, "Failed to watch stdin of subprocess %d: %s!", ci->pid, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static int queue_chunk(StdinFeeder *f, const FeedChunk *chunk) {
+    if (f->ci->p_stdin < 0 || f->finishing) {
+        int err = f->err ? f->err : EPIPE;
+        if (chunk->release != NULL) {
+            chunk->release(chunk->ctx, chunk->data, chunk->len);
+        }
+        if (chunk->fd >= 0) {
+            close(chunk->fd);
+        }
+        errno = err;
+        return -1;
+    }
+    FeedChunk *c = malloc(sizeof(FeedChunk));
+    if (c == NULL) {
+        if (chunk->fd >= 0) {
+            close(chunk->fd);
+        }
+        errno = ENOMEM;
+        return -1;
+    }
+    *c = *chunk;
+    if (f->tail != NULL) {
+        f->tail->next = c;
+    } else {
+        f->head = c;
+    }
+    f->tail = c;
+    f->queued += c->len;
+    return mod_EventLoop(f->loop, f->ci->p_stdin, POLLOUT);
+}
+
+int feed_StdinFeeder(StdinFeeder *f, const char *data, size_t len, FeedRelease release, void *ctx) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    // gifts are whole pages; short buffers are cheaper to copy anyway
+    bool spliced = f->zero_copy && len >= page && (uintptr_t)data % page == 0;
+    FeedChunk c = {.data = data, .len = len, .release = release, .ctx = ctx, .fd = -1, .spliced = spliced};
+
+    return queue_chunk(f, &c);
+}
+
+static void unmap_region(void *ctx, const char *data, size_t len) {
+    munmap((char *)data - (size_t)ctx, len + (size_t)ctx);
+}
+
+int feed_file_StdinFeeder(StdinFeeder *f, int fd, off_t off, size_t len) {
+    if (f->zero_copy) {
+        FeedChunk c = {.len = len, .fd = fcntl(fd, F_DUPFD_CLOEXEC, 0), .fd_off = off, .spliced = true};
+        if (c.fd < 0) {
+            showError(false, "Failed to duplicate fd %d for feeding: %s!", fd, strerror(errno));
+            return -1;
+        }
+        return queue_chunk(f, &c);
+    }
+    size_t pad = off % sysconf(_SC_PAGESIZE); // mmap offsets must be page aligned
+    char *p = mmap(NULL, len + pad, PROT_READ, MAP_PRIVATE, fd, off - pad);
+
+    if (p == MAP_FAILED) {
+        showError(false, "Failed to map %zu bytes of fd %d for feeding: %s!", len, fd, strerror(errno));
+        return -1;
+    }
+    madvise(p, len + pad, MADV_SEQUENTIAL);
+    return feed_StdinFeeder(f, p + pad, len, unmap_region, (void *)pad);
+}
+
+int flush_StdinFeeder(StdinFeeder *f) {
+    if (f->ci->p_stdin >= 0) {
+        reclaim(f);
+        pump(f);
+    }
+    if (f->ci->p_stdin < 0) {
+        errno = f->err ? f->err : EPIPE;
+        return -1;
+    }
+    if (f->head == NULL && f->finishing) {
+        shut(f);
+    } else if (f->head == NULL) {
+        return mod_EventLoop(f->loop, f->ci->p_stdin, 0);
+    }
+    return 0;
+}
+
+void finish_StdinFeeder(StdinFeeder *f) {
+    f->finishing = true;
+    if (f->head == NULL) {
+        shut(f);
+    }
+}
+
+void close_StdinFeeder(StdinFeeder *f) {
+    drop_chunks(f);
+    shut(f);
+}
@@ -0,0 +1,76 @@
+#ifndef FEEDER_H
+#define FEEDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "event_loop.h"
+
+typedef struct StdinFeeder StdinFeeder;
+
+// called with the buffer once the child has consumed it (or it was dropped)
+typedef void (*FeedRelease)(void *ctx, const char *data, size_t len);
+// called whenever the queue runs empty, so a producer can queue more
+typedef void (*FeedDrain)(StdinFeeder *f, void *data);
+
+typedef struct FeedChunk {
+    struct FeedChunk *next;
+    const char *data;
+    size_t len;
+    size_t off;         // bytes already written
+    FeedRelease release;
+    void *ctx;
+    int fd;             // file chunk: spliced from this dup (closed when done), else -1
+    off_t fd_off;       // next file offset to splice
+    bool spliced;       // zero copy: the pipe references the memory until it is read
+    size_t end;         // spliced: the feeder's written count once its last byte went in
+} FeedChunk;
+
+// Non-blocking writer for a piped p_stdin driven by an EventLoop: buffers are
+// queued without copying and written as POLLOUT fires, next to the readers.
+// POLLOUT is only requested while data is queued, so an idle feeder costs
+// nothing. Once finished and drained it closes p_stdin to deliver EOF.
+//
+// With zero_copy set, page-aligned buffers are vmsplice()d (SPLICE_F_GIFT)
+// and file input is splice()d from the page cache instead of copied. The
+// pipe then references the memory itself, so such chunks are only released
+// once the child has read past them (written minus FIONREAD), checked at
+// every wakeup; what is still unread when p_stdin closes is released by
+// close_StdinFeeder(), to be called after the child exited. Gifted buffers
+// must not be modified before their release.
+struct StdinFeeder {
+    EventLoop *loop;
+    ProcInfo *ci;
+    FeedChunk *head;
+    FeedChunk *tail;
+    FeedChunk *in_pipe; // spliced chunks the child has not read yet, oldest first
+    FeedChunk *in_pipe_tail;
+    bool zero_copy;     // input, set after init: splice instead of copying where possible
+    size_t queued;      // bytes waiting to be written, for backpressure
+    size_t written;     // bytes the child has taken so far
+    bool finishing;     // close once the queue is empty
+    int err;            // errno that stopped feeding (EPIPE if the child closed stdin)
+    FeedDrain on_drain;
+    void *data;
+};
+
+// take over ci->p_stdin (replacing any watch_ProcInfo() registration for it)
+int init_StdinFeeder(StdinFeeder *f, EventLoop *loop, ProcInfo *ci, FeedDrain on_drain, void *data);
+// queue len bytes; data must stay valid until release (may be NULL) is called
+int feed_StdinFeeder(StdinFeeder *f, const char *data, size_t len, FeedRelease release, void *ctx);
+// queue len bytes of fd at off: a read-only mapping, or with zero_copy a
+// splice from a dup of fd (fd itself may be closed right away)
+int feed_file_StdinFeeder(StdinFeeder *f, int fd, off_t off, size_t len);
+// write what is queued now rather than at the next POLLOUT, as few
+// writev()s as the pipe allows: a header and its payload queued back to
+// back go out in one. POLLOUT stays requested only for what did not fit;
+// on_drain is not called. -1 with errno once p_stdin is closed
+int flush_StdinFeeder(StdinFeeder *f);
+// close p_stdin once everything queued so far has been written
+void finish_StdinFeeder(StdinFeeder *f);
+// drop whatever is still queued and close p_stdin now; also releases
+// spliced chunks the child never read
+void close_StdinFeeder(StdinFeeder *f);
+
+#endif // FEEDER_H
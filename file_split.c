@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "file_split.h"
+
+// the first offset at or after at that starts a record: just past a delim,
+// or the end of the file
+static off_t cut_at(int fd, off_t at, off_t size, char delim) {
+    char buf[SPLIT_SCAN];
+
+    for (off_t pos = at - 1; pos < size;) { // a delim right before at already ends a record
+        ssize_t n = pread(fd, buf, sizeof(buf), pos);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return n < 0 ? -1 : size;
+        }
+        const char *d = memchr(buf, delim, n);
+        if (d != NULL) {
+            return pos + (d - buf) + 1;
+        }
+        pos += n;
+    }
+    return size;
+}
+
+int plan_FileSplit(FileSplit *s, int fd, int n, char delim) {
+    struct stat st;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->delim = delim;
+    if (n <= 0 && (n = sysconf(_SC_NPROCESSORS_ONLN)) <= 0) {
+        n = 1;
+    }
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        showError(false, "Can't split fd %d: not a regular file!", fd);
+        return 1;
+    }
+    if ((s->parts = calloc(n, sizeof(SplitPart))) == NULL) {
+        showError(false, "Failed to allocate %d file slices!", n);
+        return 1;
+    }
+    off_t from = 0;
+    for (int i = 1; i <= n && from < st.st_size; i++) {
+        off_t to = st.st_size;
+        if (i < n) {
+            off_t at = st.st_size / n * i + st.st_size % n * i / n;
+            to = at > from ? cut_at(fd, at, st.st_size, delim) : from;
+        }
+        if (to < 0) {
+            showError(false, "Failed to read fd %d: %s!", fd, strerror(errno));
+            free_FileSplit(s);
+            return 1;
+        }
+        if (to > from) { // a record longer than a slice leaves the next slice empty
+            s->parts[s->n_parts].off = from;
+            s->parts[s->n_parts++].len = to - from;
+            from = to;
+        }
+    }
+    return 0;
+}
+
+static void finish_part(EventLoop *loop, SplitPart *p) {
+    FileSplit *s = p->split;
+
+    if (p->feeder.err != 0 && p->feed_err == 0) {
+        p->feed_err = p->feeder.err;
+    }
+    close_StdinFeeder(&p->feeder); // the child is gone: it releases what it never read
+    unwatch_ProcInfo(loop, &p->ci);
+    close_ProcInfo(&p->ci);
+    finish_CaptureBuf(&p->out.out);
+    finish_CaptureBuf(&p->out.err);
+    p->out.status = p->status;
+    if (!WIFEXITED(p->status) || WEXITSTATUS(p->status) != 0) {
+        s->n_failed++;
+    }
+    s->n_running--;
+}
+
+static void on_part_event(EventLoop *loop, int fd, unsigned revents, void *data) {
+    SplitPart *p = data;
+
+    if (fd == p->ci.pidfd) {
+        reap_ProcInfo(&p->ci, &p->status, 0);
+        del_EventLoop(loop, fd);
+        p->pending--;
+    } else {
+        CaptureBuf *b = NULL;
+        char scratch[64 * 1024];
+        ssize_t n;
+        if (fd == p->ci.p_stdout && p->ci.stdout_type == PROC_COM_CAPTURE) {
+            b = &p->out.out;
+        } else if (fd == p->ci.p_stderr && p->ci.stderr_type == PROC_COM_CAPTURE) {
+            b = &p->out.err;
+        }
+        n = b != NULL ? fill_CaptureBuf(b, fd) : read(fd, scratch, sizeof(scratch));
+        if (n > 0 || (n < 0 && (errno == EINTR || errno == EAGAIN))) {
+            return;
+        }
+        del_EventLoop(loop, fd);
+        if (--p->pending == 1 && p->ci.pidfd < 0) {
+            reap_ProcInfo(&p->ci, &p->status, 0); // no pidfd: reaped once its output is done
+            p->pending--;
+        }
+    }
+    if (p->pending == 0) {
+        finish_part(loop, p);
+    }
+}
+
+static int start_part(FileSplit *s, EventLoop *loop, SplitPart *p, char* args[], char* env[],
+        const ProcInfo *proto) {
+    p->split = s;
+    p->ci = *proto;
+    p->ci.stdin_type = PROC_COM_PIPE;
+    p->status = -1;
+    p->feed_err = 0;
+    reset_CaptureResult(&p->out);
+    if ((p->spawn_rc = subprocess(&p->ci, args, env)) != 0) {
+        return 1;
+    }
+    if (watch_ProcInfo(loop, &p->ci, on_part_event, p)) {
+        kill(p->ci.pid, SIGKILL); // can't drain it: don't leave it blocked on a full pipe
+        reap_ProcInfo(&p->ci, &p->status, 0);
+        close_ProcInfo(&p->ci);
+        return 1;
+    }
+    p->pending = 1; // the child itself
+    if (proc_com_piped(p->ci.stdout_type) && p->ci.p_stdout >= 0) {
+        p->pending++;
+    }
+    if (proc_com_piped(p->ci.stderr_type) && p->ci.p_stderr >= 0) {
+        p->pending++;
+    }
+    s->n_running++;
+    if (init_StdinFeeder(&p->feeder, loop, &p->ci, NULL, NULL) == 0) {
+        p->feeder.zero_copy = true; // spliced from the file's page cache, never copied
+        if (feed_file_StdinFeeder(&p->feeder, s->fd, p->off, p->len) == 0) {
+            finish_StdinFeeder(&p->feeder);
+            return 0;
+        }
+    }
+    p->feed_err = errno != 0 ? errno : EIO;
+    close_StdinFeeder(&p->feeder); // EOF now rather than a child waiting for input forever
+    return 0;
+}
+
+size_t run_FileSplit(FileSplit *s, char* args[], char* env[], const ProcInfo *proto,
+        EvLoopBackend backend) {
+    EventLoop loop;
+
+    s->n_running = s->n_failed = 0;
+    if (init_EventLoop(&loop, backend)) {
+        showError(false, "Failed to set up an event loop for %s!", args[0]);
+        return s->n_failed = s->n_parts;
+    }
+    for (size_t i = 0; i < s->n_parts; i++) {
+        if (start_part(s, &loop, &s->parts[i], args, env, proto)) {
+            s->n_failed++;
+        }
+    }
+    while (s->n_running > 0) {
+        if (run_EventLoop(&loop, -1) < 0 && errno != EINTR) {
+            showError(false, "File split event loop failed: %s!", strerror(errno));
+            break;
+        }
+    }
+    for (size_t i = 0; i < s->n_parts && s->n_running > 0; i++) {
+        SplitPart *p = &s->parts[i];
+        if (p->spawn_rc == 0 && p->pending > 0) { // the loop gave up: wait for it here
+            close_StdinFeeder(&p->feeder);
+            reap_ProcInfo(&p->ci, &p->status, 0);
+            finish_part(&loop, p);
+        }
+    }
+    close_EventLoop(&loop);
+    return s->n_failed;
+}
+
+void free_FileSplit(FileSplit *s) {
+    for (size_t i = 0; i < s->n_parts; i++) {
+        free_CaptureResult(&s->parts[i].out);
+    }
+    free(s->parts);
+    s->parts = NULL;
+    s->n_parts = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef FILE_SPLIT_H
+#define FILE_SPLIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+#include "capture.h"
+#include "feeder.h"
+
+#define SPLIT_SCAN (64 * 1024)  // bytes read at a time looking for a record end
+
+typedef struct FileSplit FileSplit;
+
+// one child's slice of the input and how its run went
+typedef struct {
+    FileSplit *split;
+    off_t off;          // first byte of the slice
+    size_t len;
+    ProcInfo ci;        // run_FileSplit(): proto's streams, stdin the feeder's pipe
+    StdinFeeder feeder;
+    CaptureResult out;  // PROC_COM_CAPTURE streams; set its inputs before the run
+    int spawn_rc;       // subprocess() rc, 0 if it started
+    int status;         // wait status, -1 if it never ran
+    int feed_err;       // errno that cut its input short (EPIPE: it stopped reading), 0 for none
+    int pending;        // open output streams plus the unreaped child
+} SplitPart;
+
+// a large file processed in parallel without splitting it on disk first:
+// plan_FileSplit() cuts it into n record-aligned slices, every cut moved
+// forward to just past the next delim, and run_FileSplit() gives each
+// slice to its own child as stdin, spliced from the page cache at the
+// slice's offset. A child only ever sees whole records of its own slice.
+// One thread only
+struct FileSplit {
+    int fd;             // the input, borrowed: a regular file
+    char delim;         // records end with it
+    SplitPart *parts;
+    size_t n_parts;     // at most the n asked for: slices that came out empty are dropped
+    size_t n_running;
+    size_t n_failed;    // failed to spawn, or did not exit 0
+};
+
+// n <= 0 for one slice per online CPU; 1 when fd is no regular file or
+// can't be read
+int plan_FileSplit(FileSplit *s, int fd, int n, char delim);
+// spawn args with env once per slice, all at once, with proto's stdout and
+// stderr, feed every child its slice, drain the outputs and reap them.
+// Returns the number of children that failed, as n_failed
+size_t run_FileSplit(FileSplit *s, char* args[], char* env[], const ProcInfo *proto,
+    EvLoopBackend backend);
+void free_FileSplit(FileSplit *s);
+
+#endif // FILE_SPLIT_H
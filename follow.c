@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+
+#include "follow.h"
+
+// hand on_line what the reader holds: lines, or with final the unterminated tail too
+static void deliver(FileFollower *f, int i, bool final) {
+    ChunkReader *r = &f->readers[i];
+    const char *line;
+    size_t len;
+
+    if (f->chunks) {
+        for (const ReadChunk *c = r->head; c != NULL && r->len > 0; c = c->next) {
+            if (c->len > c->off) {
+                f->on_line[i](f->ci, c->data + c->off, c->len - c->off, f->data);
+            }
+        }
+        consume_ChunkReader(r, r->len);
+        return;
+    }
+    while (next_LineSplitter(&f->splitters[i], &line, &len)) {
+        f->on_line[i](f->ci, line, len, f->data);
+    }
+    if (final && rest_LineSplitter(&f->splitters[i], &line, &len)) {
+        f->on_line[i](f->ci, line, len, f->data);
+    }
+}
+
+// read up to the current end of the file
+static void pull(FileFollower *f, int i) {
+    ssize_t n;
+
+    while ((n = pread_ChunkReader(&f->readers[i], f->fd[i], f->off[i])) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        f->off[i] += n;
+        f->n_reads++;
+        deliver(f, i, false);
+    }
+}
+
+void poll_FileFollower(FileFollower *f) {
+    for (int i = 0; i < 2; i++) {
+        if (!f->done && f->fd[i] >= 0) {
+            pull(f, i);
+        }
+    }
+}
+
+static void on_modified(EventLoop *loop, int fd, unsigned revents, void *data) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (read(fd, buf, sizeof(buf)) > 0); // which file doesn't matter: pull both
+    poll_FileFollower(data);
+}
+
+static void on_tick(EventLoop *loop, int fd, unsigned revents, void *data) {
+    uint64_t ticks;
+
+    if (read(fd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+        poll_FileFollower(data);
+    }
+}
+
+// inotify on both files, else a timer; no watch is no error, just slower
+static int watch_files(FileFollower *f) {
+    if ((f->ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+        bool ok = true;
+        for (int i = 0; i < 2 && ok; i++) {
+            const char *path = i == 0 ? f->ci->f_stdout : f->ci->f_stderr;
+            ok = f->fd[i] < 0 || inotify_add_watch(f->ino_fd, path, IN_MODIFY) >= 0;
+        }
+        if (ok) {
+            return add_EventLoop(f->loop, f->ino_fd, POLLIN, on_modified, f);
+        }
+        close(f->ino_fd);
+        f->ino_fd = -1;
+    }
+    struct itimerspec its = {
+        .it_interval = {FOLLOW_POLL_MS / 1000, FOLLOW_POLL_MS % 1000 * 1000000},
+        .it_value = {FOLLOW_POLL_MS / 1000, FOLLOW_POLL_MS % 1000 * 1000000},
+    };
+    if ((f->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+            timerfd_settime(f->timer_fd, 0, &its, NULL) < 0) {
+        showError(false, "Cannot watch followed files: %s!", strerror(errno));
+        return 1;
+    }
+    return add_EventLoop(f->loop, f->timer_fd, POLLIN, on_tick, f);
+}
+
+int follow_FileFollower(FileFollower *f, EventLoop *loop, ProcInfo *ci,
+        LineCallback on_stdout_line, LineCallback on_stderr_line, void *data) {
+    ProcComType types[2] = {ci->stdout_type, ci->stderr_type};
+    const char *paths[2] = {ci->f_stdout, ci->f_stderr};
+    struct stat sb;
+
+    memset(f, 0, sizeof(*f));
+    f->loop = loop;
+    f->ci = ci;
+    f->on_line[0] = on_stdout_line;
+    f->on_line[1] = on_stderr_line;
+    f->data = data;
+    f->fd[0] = f->fd[1] = f->ino_fd = f->timer_fd = -1;
+    for (int i = 0; i < 2; i++) {
+        init_ChunkReader(&f->readers[i]);
+        init_LineSplitter(&f->splitters[i], &f->readers[i]);
+        if (f->on_line[i] == NULL) {
+            continue;
+        }
+        if (types[i] != PROC_COM_PATH || paths[i] == NULL) {
+            showError(false, "No %s file to follow!", i == 0 ? "stdout" : "stderr");
+            close_FileFollower(f);
+            return 1;
+        }
+        if ((f->fd[i] = open(paths[i], O_RDONLY | O_CLOEXEC)) < 0) {
+            showError(false, "Cannot open %s to follow: %s!", paths[i], strerror(errno));
+            close_FileFollower(f);
+            return 1;
+        }
+        if (ci->path_append && fstat(f->fd[i], &sb) == 0) {
+            f->off[i] = sb.st_size;
+        }
+    }
+    if (watch_files(f)) {
+        close_FileFollower(f);
+        return 1;
+    }
+    return 0;
+}
+
+void end_FileFollower(FileFollower *f) {
+    if (f->done) {
+        return;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (f->fd[i] >= 0) {
+            pull(f, i);
+            deliver(f, i, true);
+        }
+    }
+    if (f->ino_fd >= 0) {
+        del_EventLoop(f->loop, f->ino_fd);
+    }
+    if (f->timer_fd >= 0) {
+        del_EventLoop(f->loop, f->timer_fd);
+    }
+    f->done = true;
+}
+
+void close_FileFollower(FileFollower *f) {
+    int *fds[4] = {&f->fd[0], &f->fd[1], &f->ino_fd, &f->timer_fd};
+
+    for (int i = 0; i < 4; i++) {
+        if (*fds[i] < 0) {
+            continue;
+        }
+        if (i >= 2 && !f->done) {
+            del_EventLoop(f->loop, *fds[i]);
+        }
+        close(*fds[i]);
+        *fds[i] = -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        free_LineSplitter(&f->splitters[i]);
+        free_ChunkReader(&f->readers[i]);
+    }
+    f->done = true;
+}
+
+static void on_child_exit(EventLoop *loop, int fd, unsigned revents, void *data) {
+    del_EventLoop(loop, fd);
+    end_FileFollower(data);
+}
+
+int run_follow(ProcInfo *ci, char* args[], char* env[],
+        LineCallback on_stdout_line, LineCallback on_stderr_line, void *data) {
+    const char *paths[2] = {ci->f_stdout, ci->f_stderr};
+    LineCallback cbs[2] = {on_stdout_line, on_stderr_line};
+    off_t from[2] = {0, 0};
+    struct stat sb;
+    EventLoop loop;
+    FileFollower f;
+    int status = -1;
+
+    // appending: where the file ends before the child adds to it
+    for (int i = 0; i < 2; i++) {
+        if (cbs[i] != NULL && ci->path_append && paths[i] != NULL && stat(paths[i], &sb) == 0) {
+            from[i] = sb.st_size;
+        }
+    }
+    if (init_EventLoop(&loop, EVLOOP_EPOLL)) {
+        return -1;
+    }
+    if (subprocess(ci, args, env)) {
+        close_EventLoop(&loop);
+        return -1;
+    }
+    if (ci->stdin_type == PROC_COM_PIPE && ci->p_stdin >= 0) {
+        close(ci->p_stdin);
+        ci->p_stdin = -1;
+    }
+    if (follow_FileFollower(&f, &loop, ci, on_stdout_line, on_stderr_line, data) == 0) {
+        f.off[0] = from[0];
+        f.off[1] = from[1];
+        poll_FileFollower(&f); // written before the watches were set
+        if (ci->pidfd >= 0 && add_EventLoop(&loop, ci->pidfd, POLLIN, on_child_exit, &f) == 0) {
+            while (!f.done && run_EventLoop(&loop, -1) >= 0);
+            if (!f.done) { // the loop failed: wait for the exit here, then take the rest
+                del_EventLoop(&loop, ci->pidfd);
+                reap_ProcInfo(ci, &status, 0);
+                end_FileFollower(&f);
+            }
+        } else { // no pidfd: look for the exit between polls
+            while (!f.done && reap_ProcInfo(ci, &status, WNOHANG) == 0) {
+                run_EventLoop(&loop, FOLLOW_POLL_MS);
+            }
+            end_FileFollower(&f);
+        }
+        close_FileFollower(&f);
+    }
+    if (ci->pid > 0 && status == -1) {
+        reap_ProcInfo(ci, &status, 0);
+    }
+    close_ProcInfo(ci);
+    close_EventLoop(&loop);
+    return status;
+}
@@ -0,0 +1,61 @@
+#ifndef FOLLOW_H
+#define FOLLOW_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "reader.h"
+#include "lines.h"
+#include "line_watch.h"
+
+#define FOLLOW_POLL_MS 50   // without inotify, how often the files are looked at
+
+// tails a child's PROC_COM_PATH stdout/stderr while it writes them: the
+// child keeps writing straight to the file, and whatever it appended since
+// the last look is pread() from the last offset through ChunkReader +
+// LineSplitter to the same callbacks a LineWatcher uses for pipes. New data
+// is noticed through IN_MODIFY on the files, or by a FOLLOW_POLL_MS timer
+// where inotify isn't to be had. A file has no EOF to go by while it is
+// being written: end_FileFollower() says the child is gone
+typedef struct {
+    EventLoop *loop;
+    ProcInfo *ci;
+    LineCallback on_line[2];    // stdout, stderr; NULL leaves the stream alone
+    void *data;
+    // input, set after follow_FileFollower(): on_line gets whatever each
+    // read brought, unframed, instead of lines
+    bool chunks;
+    int fd[2];                  // own read-only fd of f_stdout/f_stderr, -1 if not followed
+    // next byte to read: 0, or for path_append the size at follow time;
+    // may be moved back before the loop first runs
+    off_t off[2];
+    ChunkReader readers[2];
+    LineSplitter splitters[2];
+    int ino_fd;                 // IN_MODIFY on the files, -1 when polling
+    int timer_fd;               // polling, -1 with inotify
+    size_t n_reads;             // preads that brought data
+    bool done;                  // ended: everything written was delivered
+} FileFollower;
+
+// open ci's f_stdout/f_stderr for the streams that have a callback (their
+// type must be PROC_COM_PATH) and register them with loop; after subprocess()
+int follow_FileFollower(FileFollower *f, EventLoop *loop, ProcInfo *ci,
+    LineCallback on_stdout_line, LineCallback on_stderr_line, void *data);
+// read and deliver what is new in the files now, as the loop does on its
+// own; once right after follow_FileFollower() too, for what the child wrote
+// before the watches were set
+void poll_FileFollower(FileFollower *f);
+// the child exited (its pidfd is readable, or it was reaped): deliver the
+// rest of the files, the unterminated last lines and stop watching
+void end_FileFollower(FileFollower *f);
+void close_FileFollower(FileFollower *f);
+
+// spawn args with its outputs going to their files as set in ci, deliver
+// what is written to the ones with a callback while it runs and reap it;
+// returns the wait status, -1 if it never ran
+int run_follow(ProcInfo *ci, char* args[], char* env[],
+    LineCallback on_stdout_line, LineCallback on_stderr_line, void *data);
+
+#endif // FOLLOW_H
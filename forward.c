@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#include "forward.h"
+
+#define FORWARD_CHUNK (1 << 20)
+
+static __thread int bounce[2] = {-1, -1};
+
+static bool is_pipe(int fd) {
+    struct stat sb;
+    return fstat(fd, &sb) == 0 && S_ISFIFO(sb.st_mode);
+}
+
+static int get_bounce(void) {
+    if (bounce[0] < 0 && pipe2(bounce, O_CLOEXEC)) {
+        return -1;
+    }
+    return 0;
+}
+
+// splice exactly n bytes that are already sitting in pipe `from` into `to`
+static int drain(int from, int to, size_t n) {
+    while (n > 0) {
+        ssize_t m = splice(from, NULL, to, NULL, n, SPLICE_F_MOVE);
+        if (m < 0 && errno == EINTR) {
+            continue;
+        }
+        if (m <= 0) {
+            return -1;
+        }
+        n -= m;
+    }
+    return 0;
+}
+
+static ssize_t copy_some(int from, int to, size_t len) {
+    char buf[64 * 1024];
+    ssize_t n;
+
+    if (len > sizeof(buf)) {
+        len = sizeof(buf);
+    }
+    while ((n = read(from, buf, len)) < 0 && errno == EINTR);
+    for (ssize_t off = 0; off < n; ) {
+        ssize_t m = write(to, buf + off, n - off);
+        if (m < 0 && errno == EINTR) {
+            continue;
+        }
+        if (m < 0) {
+            return -1;
+        }
+        off += m;
+    }
+    return n;
+}
+
+ssize_t forward_some(int from, int to, size_t len) {
+    ssize_t n;
+
+    if (is_pipe(from) || is_pipe(to)) {
+        while ((n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE)) < 0 && errno == EINTR);
+    } else {
+        if (get_bounce()) {
+            return -1;
+        }
+        while ((n = splice(from, NULL, bounce[1], NULL, len, SPLICE_F_MOVE)) < 0 && errno == EINTR);
+        if (n > 0 && drain(bounce[0], to, n)) {
+            return -1;
+        }
+    }
+    if (n < 0 && errno == EINVAL) { // e.g. a tty or an O_APPEND file on old kernels
+        return copy_some(from, to, len);
+    }
+    return n;
+}
+
+ssize_t forward_all(int from, int to) {
+    ssize_t total = 0, n;
+
+    while ((n = forward_some(from, to, FORWARD_CHUNK)) > 0) {
+        total += n;
+    }
+    return n < 0 ? -1 : total;
+}
+
+ssize_t tee_some(int from, int to1, int to2, size_t len) {
+    int dup_to = to2;
+    ssize_t n;
+
+    if (!is_pipe(to2)) { // tee() needs a pipe on both ends
+        if (get_bounce()) {
+            return -1;
+        }
+        dup_to = bounce[1];
+    }
+    while ((n = tee(from, dup_to, len, 0)) < 0 && errno == EINTR);
+    if (n == 0) { // tee gives 0 on EOF; confirm it with a real read
+        return forward_some(from, to1, len);
+    }
+    if (n < 0) {
+        return -1;
+    }
+    // now consume the same bytes from `from` into to1
+    if (drain(from, to1, n)) {
+        return -1;
+    }
+    if (dup_to != to2 && drain(bounce[0], to2, n)) {
+        return -1;
+    }
+    return n;
+}
+
+ssize_t tee_all(int from, int to1, int to2) {
+    ssize_t total = 0, n;
+
+    while ((n = tee_some(from, to1, to2, FORWARD_CHUNK)) > 0) {
+        total += n;
+    }
+    return n < 0 ? -1 : total;
+}
+
+// write all of p to fd, waiting out a non-blocking fd
+static int write_all(int fd, const char *p, size_t len) {
+    while (len > 0) {
+        ssize_t m = write(fd, p, len);
+        if (m < 0 && errno == EAGAIN) {
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+            poll(&pfd, 1, -1);
+            continue;
+        }
+        if (m < 0 && errno == EINTR) {
+            continue;
+        }
+        if (m < 0) {
+            return -1;
+        }
+        p += m;
+        len -= m;
+    }
+    return 0;
+}
+
+// the next round of input sitting in a pipe: its length, 0 at EOF, -1 on error
+static ssize_t next_round(int from, bool from_pipe, int src) {
+    if (!from_pipe) {
+        ssize_t n;
+        while ((n = splice(from, NULL, bounce[1], NULL, FORWARD_CHUNK, SPLICE_F_MOVE)) < 0 && errno == EINTR);
+        return n;
+    }
+    for (;;) {
+        struct pollfd pfd = {.fd = src, .events = POLLIN};
+        int avail = 0;
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (ioctl(src, FIONREAD, &avail) < 0) {
+            return -1;
+        }
+        if (avail > 0) {
+            return avail;
+        }
+        if (pfd.revents & (POLLHUP | POLLERR)) {
+            return 0;
+        }
+    }
+}
+
+// a consumer went away: forget it and the SIGPIPE it raised
+static void drop_consumer(int *to, const sigset_t *pipe_set) {
+    struct timespec zero = {0, 0};
+    sigtimedwait(pipe_set, NULL, &zero);
+    *to = -1;
+}
+
+ssize_t broadcast_all(int from, int to[], int n) {
+    bool from_pipe = is_pipe(from);
+    ssize_t total = 0, len = 0;
+    sigset_t pipe_set, old_set;
+    char *buf = NULL;
+    int live = 0, null_fd = -1;
+
+    if (!from_pipe && get_bounce()) {
+        return -1;
+    }
+    int src = from_pipe ? from : bounce[0];
+    size_t *got = calloc(n > 0 ? n : 1, sizeof(*got));
+    struct pollfd *pfds = calloc(n > 0 ? n : 1, sizeof(*pfds));
+    if (got == NULL || pfds == NULL || (null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC)) < 0) {
+        free(got);
+        free(pfds);
+        return -1;
+    }
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    for (int i = 0; i < n; i++) {
+        live += to[i] >= 0;
+    }
+    while (live > 0 && (len = next_round(from, from_pipe, src)) > 0) {
+        // pace on the slowest: every consumer has room before anyone gets more
+        int np = 0;
+        for (int i = 0; i < n; i++) {
+            if (to[i] >= 0) {
+                pfds[np++] = (struct pollfd){.fd = to[i], .events = POLLOUT};
+            }
+        }
+        while (np > 0) {
+            if (poll(pfds, np, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break; // the tees below find out what's wrong
+            }
+            int k = 0; // keep waiting on the consumers without room yet
+            for (int j = 0; j < np; j++) {
+                if (!(pfds[j].revents & (POLLOUT | POLLERR | POLLHUP | POLLNVAL))) {
+                    pfds[k++] = pfds[j];
+                }
+            }
+            np = k;
+        }
+        bool short_tee = false;
+        for (int i = 0; i < n; i++) {
+            if (to[i] < 0) {
+                continue;
+            }
+            // one tee per consumer: a second one would repeat the round from its start
+            ssize_t m;
+            while ((m = tee(src, to[i], len, SPLICE_F_NONBLOCK)) < 0 && errno == EINTR);
+            if (m < 0 && errno == EPIPE) {
+                drop_consumer(&to[i], &pipe_set);
+                live--;
+                continue;
+            }
+            got[i] = m > 0 ? m : 0; // EAGAIN, or EINVAL for a consumer that is no pipe
+            short_tee |= got[i] < (size_t)len;
+        }
+        if (!short_tee) {
+            if (drain(src, null_fd, len)) {
+                len = -1;
+                break;
+            }
+        } else {
+            // rare: a consumer took less than the round, hand it the rest by
+            // copy; blocking on it is the flow control
+            if (buf == NULL && (buf = malloc(FORWARD_CHUNK)) == NULL) {
+                len = -1;
+                break;
+            }
+            for (ssize_t off = 0; off < len;) {
+                ssize_t m = read(src, buf + off, len - off);
+                if (m < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (m <= 0) {
+                    len = -1;
+                    break;
+                }
+                off += m;
+            }
+            for (int i = 0; len > 0 && i < n; i++) {
+                if (to[i] >= 0 && got[i] < (size_t)len && write_all(to[i], buf + got[i], len - got[i])) {
+                    if (errno != EPIPE) {
+                        len = -1;
+                        break;
+                    }
+                    drop_consumer(&to[i], &pipe_set);
+                    live--;
+                }
+            }
+            if (len < 0) {
+                break;
+            }
+        }
+        total += len;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    close(null_fd);
+    free(buf);
+    free(pfds);
+    free(got);
+    return len < 0 ? -1 : total;
+}
+
+ssize_t broadcast_stdin(int from, ProcInfo *cis[], int n) {
+    int *to = malloc((n > 0 ? n : 1) * sizeof(int));
+
+    if (to == NULL) {
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        to[i] = cis[i]->p_stdin;
+    }
+    ssize_t total = broadcast_all(from, to, n);
+    for (int i = 0; i < n; i++) { // EOF for everyone, including the ones that left
+        if (cis[i]->p_stdin >= 0) {
+            close(cis[i]->p_stdin);
+            cis[i]->p_stdin = -1;
+        }
+    }
+    free(to);
+    return total;
+}
@@ -0,0 +1,34 @@
+#ifndef FORWARD_H
+#define FORWARD_H
+
+#include <sys/types.h>
+
+#include "subprocess.h"
+
+// Zero-copy forwarding between a child's pipes and other fds with splice(2)
+// and tee(2). One side of a splice must be a pipe; when neither is, a
+// per-thread bounce pipe sits in between so data still stays in the kernel.
+// Targets splice() refuses (EINVAL) fall back to read()/write().
+
+// move up to len bytes; returns bytes moved, 0 at EOF, -1 with errno set
+// (EAGAIN when from is non-blocking and empty)
+ssize_t forward_some(int from, int to, size_t len);
+// forward until EOF on from; returns the total moved or -1
+ssize_t forward_all(int from, int to);
+// copy up to len bytes from the pipe `from` into both to1 and to2,
+// consuming them from `from` once; same return values as forward_some()
+ssize_t tee_some(int from, int to1, int to2, size_t len);
+// tee until EOF on from; returns the total moved or -1
+ssize_t tee_all(int from, int to1, int to2);
+// copy from to the n fds in to until EOF, reading it once: each round of
+// input is tee()d into every pipe in to, then dropped, so the data isn't
+// copied through user space. Every consumer must have room before the next
+// round, so the slowest sets the pace and at most a pipe's worth is buffered
+// per consumer; a consumer that took less than a round (or is no pipe)
+// gets the rest by write(). Entries that hit EPIPE are set to -1 and the
+// others go on, without a SIGPIPE. Returns the bytes read or -1
+ssize_t broadcast_all(int from, int to[], int n);
+// broadcast_all() into the piped p_stdin of every cis[i], then close them
+ssize_t broadcast_stdin(int from, ProcInfo *cis[], int n);
+
+#endif // FORWARD_H
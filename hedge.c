@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "hedge.h"
+#include "journal.h"
+
+static uint64_t sig_of(char* args[]) {
+    uint64_t h = argv_hash_Journal(args);
+    return h != 0 ? h : 1;
+}
+
+static HedgeHistory *find(const HedgePolicy *h, uint64_t sig) {
+    if (h->cap == 0) {
+        return NULL;
+    }
+    for (size_t i = sig & (h->cap - 1); h->table[i].sig != 0; i = (i + 1) & (h->cap - 1)) {
+        if (h->table[i].sig == sig) {
+            return &h->table[i];
+        }
+    }
+    return NULL;
+}
+
+static HedgeHistory *insert(HedgePolicy *h, uint64_t sig) {
+    if ((h->n + 1) * 2 > h->cap) {
+        size_t cap = h->cap ? h->cap * 2 : 64;
+        HedgeHistory *t = calloc(cap, sizeof(HedgeHistory));
+        if (t == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < h->cap; i++) {
+            if (h->table[i].sig != 0) {
+                size_t k = h->table[i].sig & (cap - 1);
+                while (t[k].sig != 0) {
+                    k = (k + 1) & (cap - 1);
+                }
+                t[k] = h->table[i];
+            }
+        }
+        free(h->table);
+        h->table = t;
+        h->cap = cap;
+    }
+    size_t k = sig & (h->cap - 1);
+    while (h->table[k].sig != 0) {
+        k = (k + 1) & (h->cap - 1);
+    }
+    h->table[k].sig = sig;
+    h->n++;
+    return &h->table[k];
+}
+
+void init_HedgePolicy(HedgePolicy *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void close_HedgePolicy(HedgePolicy *h) {
+    free(h->table);
+    h->table = NULL;
+    h->cap = h->n = 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t delay_HedgePolicy(const HedgePolicy *h, char* args[]) {
+    const HedgeHistory *e = find(h, sig_of(args));
+    uint32_t min_runs = h->min_runs > 0 ? h->min_runs : HEDGE_MIN_RUNS;
+    double q = h->quantile > 0 && h->quantile < 1 ? h->quantile : HEDGE_QUANTILE;
+    uint64_t sorted[HEDGE_WINDOW];
+
+    if (e == NULL || e->n < min_runs) {
+        return 0;
+    }
+    memcpy(sorted, e->ns, e->n * sizeof(uint64_t));
+    qsort(sorted, e->n, sizeof(uint64_t), cmp_u64);
+    uint64_t ns = sorted[(size_t)(q * (e->n - 1) + 0.5)];
+    uint64_t floor_ns = (uint64_t)h->min_delay_ms * 1000000;
+    return ns > floor_ns ? ns : floor_ns;
+}
+
+int record_HedgePolicy(HedgePolicy *h, char* args[], uint64_t ns) {
+    uint64_t sig = sig_of(args);
+    HedgeHistory *e = find(h, sig);
+
+    if (e == NULL && (e = insert(h, sig)) == NULL) {
+        return 1;
+    }
+    e->ns[e->next] = ns;
+    e->next = (e->next + 1) % HEDGE_WINDOW;
+    if (e->n < HEDGE_WINDOW) {
+        e->n++;
+    }
+    return 0;
+}
+
+bool may_hedge_HedgePolicy(const HedgePolicy *h) {
+    double budget = h->budget > 0 ? h->budget : HEDGE_BUDGET;
+
+    if (h->max_active > 0 && h->n_active >= h->max_active) {
+        return false;
+    }
+    return (double)(h->n_hedged + 1) <= budget * h->n_jobs;
+}
@@ -0,0 +1,48 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HEDGE_WINDOW 32         // runtimes kept per command
+#define HEDGE_MIN_RUNS 8        // default runs seen before a command is hedged
+#define HEDGE_QUANTILE 0.95     // default
+#define HEDGE_BUDGET 0.05       // default twins per hedgeable job started
+
+typedef struct {
+    uint64_t sig;       // 0 for a free slot
+    uint32_t n;         // runtimes in ns, up to HEDGE_WINDOW
+    uint32_t next;      // ring position of the next one
+    uint64_t ns[HEDGE_WINDOW];
+} HedgeHistory;
+
+// when to hedge: a run slower than quantile of its command's last
+// HEDGE_WINDOW successful runs gets a twin, within a budget of extra
+// starts. Zero inputs take the defaults above. One thread only
+typedef struct {
+    double quantile;    // input
+    int min_runs;       // input
+    int min_delay_ms;   // input: never hedge sooner than this
+    double budget;      // input: twins at most this fraction of the hedgeable jobs started
+    int max_active;     // input: twins running at once, 0 for no cap but the free slots
+    HedgeHistory *table; // open addressing, at most half full
+    size_t cap;
+    size_t n;
+    size_t n_jobs;      // hedgeable jobs started
+    size_t n_hedged;    // twins started
+    size_t n_won;       // twins that finished first
+    int n_active;       // twins running
+} HedgePolicy;
+
+void init_HedgePolicy(HedgePolicy *h);
+void close_HedgePolicy(HedgePolicy *h);
+// how long a run of args may take before it is hedged, 0 when its
+// command is not known well enough yet
+uint64_t delay_HedgePolicy(const HedgePolicy *h, char* args[]);
+// learn the runtime of a successful run
+int record_HedgePolicy(HedgePolicy *h, char* args[], uint64_t ns);
+// the budget leaves room for one more twin
+bool may_hedge_HedgePolicy(const HedgePolicy *h);
+
+#endif // HEDGE_H
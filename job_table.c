@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "subprocess.h"
+#include "job_table.h"
+
+#define WORDS(n) (((n) + 63) / 64)
+
+int init_JobTable(JobTable *t, size_t cap) {
+    size_t rows = cap ? cap : 1;
+
+    memset(t, 0, sizeof(*t));
+    t->cap = cap;
+    t->state = calloc(rows, sizeof(uint8_t));
+    t->pid = malloc(rows * sizeof(pid_t));
+    t->pidfd = malloc(rows * sizeof(int));
+    t->slot = malloc(rows * sizeof(int32_t));
+    t->deadline = calloc(rows, sizeof(uint64_t));
+    t->status = calloc(rows, sizeof(int));
+    t->cold = calloc(rows, sizeof(void *));
+    bool ok = t->state && t->pid && t->pidfd && t->slot && t->deadline && t->status && t->cold;
+    for (int s = 0; s < JOB_N_STATES; s++) {
+        ok = ok && (t->bits[s] = calloc(WORDS(rows), sizeof(uint64_t))) != NULL;
+    }
+    if (!ok) {
+        showError(false, "Failed to allocate a job table of %zu rows!", cap);
+        close_JobTable(t);
+        return 1;
+    }
+    return 0;
+}
+
+void close_JobTable(JobTable *t) {
+    free(t->state);
+    free(t->pid);
+    free(t->pidfd);
+    free(t->slot);
+    free(t->deadline);
+    free(t->status);
+    free(t->cold);
+    for (int s = 0; s < JOB_N_STATES; s++) {
+        free(t->bits[s]);
+    }
+    memset(t, 0, sizeof(*t));
+}
+
+static void move(JobTable *t, size_t i, JobState to) {
+    JobState from = t->state[i];
+    uint64_t bit = 1ull << (i % 64);
+
+    t->bits[from][i / 64] &= ~bit;
+    t->count[from]--;
+    t->bits[to][i / 64] |= bit;
+    t->count[to]++;
+    t->state[i] = to;
+}
+
+ssize_t add_JobTable(JobTable *t, void *cold) {
+    size_t i;
+
+    if (t->count[JOB_FREE] > 0 && (i = next_JobTable(t, JOB_FREE, t->free_hint)) != (size_t)-1) {
+        t->free_hint = i + 1;
+    } else if (t->n < t->cap) {
+        i = t->n++;
+        t->count[JOB_FREE]++; // a fresh row starts out free
+        t->bits[JOB_FREE][i / 64] |= 1ull << (i % 64);
+    } else {
+        return -1;
+    }
+    t->pid[i] = -1;
+    t->pidfd[i] = -1;
+    t->slot[i] = -1;
+    t->deadline[i] = 0;
+    t->status[i] = -1;
+    t->cold[i] = cold;
+    move(t, i, JOB_QUEUED);
+    return i;
+}
+
+void set_state_JobTable(JobTable *t, size_t i, JobState state) {
+    if (t->state[i] == JOB_RUNNING && state != JOB_RUNNING) {
+        t->pid[i] = -1;
+        t->pidfd[i] = -1;
+        t->slot[i] = -1;
+        t->deadline[i] = 0;
+    }
+    move(t, i, state);
+}
+
+void start_JobTable(JobTable *t, size_t i, pid_t pid, int pidfd, int slot, uint64_t deadline) {
+    t->pid[i] = pid;
+    t->pidfd[i] = pidfd;
+    t->slot[i] = slot;
+    t->deadline[i] = deadline;
+    move(t, i, JOB_RUNNING);
+}
+
+void finish_JobTable(JobTable *t, size_t i, int status, bool failed) {
+    t->status[i] = status;
+    set_state_JobTable(t, i, failed ? JOB_FAILED : JOB_DONE);
+}
+
+void remove_JobTable(JobTable *t, size_t i) {
+    set_state_JobTable(t, i, JOB_FREE);
+    t->cold[i] = NULL;
+    if (i < t->free_hint) {
+        t->free_hint = i;
+    }
+}
+
+ssize_t next_JobTable(const JobTable *t, JobState state, size_t from) {
+    const uint64_t *bits = t->bits[state];
+
+    if (from >= t->n) {
+        return -1;
+    }
+    size_t w = from / 64;
+    uint64_t word = bits[w] & (~0ull << (from % 64));
+    for (size_t end = WORDS(t->n); ; word = bits[w]) {
+        if (word != 0) {
+            size_t i = w * 64 + __builtin_ctzll(word);
+            return i < t->n ? (ssize_t)i : -1;
+        }
+        if (++w == end) {
+            return -1;
+        }
+    }
+}
+
+size_t expired_JobTable(const JobTable *t, uint64_t now, size_t *out, size_t max) {
+    const uint64_t *bits = t->bits[JOB_RUNNING];
+    size_t n = 0;
+
+    for (size_t w = 0, end = WORDS(t->n); w < end && n < max; w++) {
+        for (uint64_t word = bits[w]; word != 0 && n < max; word &= word - 1) {
+            size_t i = w * 64 + __builtin_ctzll(word);
+            if (t->deadline[i] != 0 && t->deadline[i] <= now) {
+                out[n++] = i;
+            }
+        }
+    }
+    return n;
+}
@@ -0,0 +1,58 @@
+#ifndef JOB_TABLE_H
+#define JOB_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef enum {
+    JOB_FREE = 0,       // no job in this row
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_N_STATES
+} JobState;
+
+// jobs of a big batch as parallel columns: a scan of one state reads a
+// bitset 64 rows at a time, a deadline sweep only the pids and deadlines of
+// running rows, and the cold part (argv, paths, the caller's Job) sits in its
+// own column, touched when a row is started or finished. Every column is
+// allocated once for cap rows; nothing allocates afterwards. One thread only
+typedef struct {
+    size_t cap;
+    size_t n;               // rows handed out, free ones included
+    uint8_t *state;         // JobState
+    pid_t *pid;             // -1 until running
+    int *pidfd;
+    int32_t *slot;          // caller's slot (a worker, a shard), -1 for none
+    uint64_t *deadline;     // CLOCK_MONOTONIC ns, 0 for none
+    int *status;            // wait status once done
+    void **cold;            // caller's, per row
+    uint64_t *bits[JOB_N_STATES]; // a set bit per row in that state
+    size_t count[JOB_N_STATES];
+    size_t free_hint;       // lowest row that may be free
+} JobTable;
+
+int init_JobTable(JobTable *t, size_t cap);
+void close_JobTable(JobTable *t);
+// a new queued row holding cold, or -1 with the table full
+ssize_t add_JobTable(JobTable *t, void *cold);
+// move row i to state; leaving JOB_RUNNING clears its pid, pidfd and deadline
+void set_state_JobTable(JobTable *t, size_t i, JobState state);
+void start_JobTable(JobTable *t, size_t i, pid_t pid, int pidfd, int slot, uint64_t deadline);
+void finish_JobTable(JobTable *t, size_t i, int status, bool failed);
+// release row i for add_JobTable() to hand out again
+void remove_JobTable(JobTable *t, size_t i);
+// first row from on in state, -1 if none
+ssize_t next_JobTable(const JobTable *t, JobState state, size_t from);
+// running rows whose deadline passed by now, up to max of them into out;
+// returns how many
+size_t expired_JobTable(const JobTable *t, uint64_t now, size_t *out, size_t max);
+
+static inline JobState state_JobTable(const JobTable *t, size_t i) {
+    return (JobState)t->state[i];
+}
+
+#endif // JOB_TABLE_H
@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "journal.h"
+#include "memo.h"
+#include "subprocess.h"
+
+static uint64_t record_check(const JournalRecord *rec) {
+    return hash_bytes((const char *)rec, offsetof(JournalRecord, check), JOURNAL_MAGIC);
+}
+
+static size_t slot_of(uint64_t id, size_t cap) {
+    return (id * 0x9e3779b97f4a7c15ull) >> 32 & (cap - 1);
+}
+
+static int index_put(JobJournal *j, uint64_t id, uint64_t argv_hash, int status) {
+    if ((j->n + 1) * 2 > j->cap) { // keep it at most half full
+        size_t cap = j->cap ? j->cap * 2 : 1024;
+        JournalSlot *t = calloc(cap, sizeof(JournalSlot));
+        if (t == NULL) {
+            return 1;
+        }
+        for (size_t i = 0; i < j->cap; i++) {
+            if (j->table[i].used) {
+                size_t k = slot_of(j->table[i].id, cap);
+                while (t[k].used) {
+                    k = (k + 1) & (cap - 1);
+                }
+                t[k] = j->table[i];
+            }
+        }
+        free(j->table);
+        j->table = t;
+        j->cap = cap;
+    }
+    size_t k = slot_of(id, j->cap);
+    while (j->table[k].used && j->table[k].id != id) {
+        k = (k + 1) & (j->cap - 1);
+    }
+    j->n += !j->table[k].used;
+    j->table[k] = (JournalSlot){.id = id, .argv_hash = argv_hash, .status = status, .used = true};
+    return 0;
+}
+
+// index the intact records of the file and cut off a torn tail
+static int load(JobJournal *j, const char *path) {
+    struct stat st;
+
+    if (fstat(j->fd, &st) != 0) {
+        showError(false, "Failed to stat job journal %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    if (st.st_size == 0) {
+        return 0;
+    }
+    const JournalRecord *recs = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, j->fd, 0);
+    if (recs == MAP_FAILED) {
+        showError(false, "Failed to map job journal %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    madvise((void *)recs, st.st_size, MADV_SEQUENTIAL);
+    size_t n = st.st_size / sizeof(JournalRecord), good = 0;
+    int rc = 0;
+    for (; good < n; good++) {
+        const JournalRecord *rec = &recs[good];
+        if (rec->magic != JOURNAL_MAGIC || rec->check != record_check(rec)) {
+            break;
+        }
+        if (index_put(j, rec->id, rec->argv_hash, rec->status)) {
+            showError(false, "Failed to index job journal %s!", path);
+            rc = 1;
+            break;
+        }
+    }
+    munmap((void *)recs, st.st_size);
+    j->n_loaded = good;
+    j->n_torn = st.st_size - good * sizeof(JournalRecord);
+    if (rc == 0 && j->n_torn > 0 && ftruncate(j->fd, good * sizeof(JournalRecord)) != 0) {
+        showError(false, "Failed to cut the torn tail of job journal %s: %s!", path, strerror(errno));
+        rc = 1;
+    }
+    return rc;
+}
+
+int open_JobJournal(JobJournal *j, const char *path) {
+    memset(j, 0, sizeof(*j));
+    j->batch = JOURNAL_BATCH;
+    j->sync_ms = JOURNAL_SYNC_MS;
+    if ((j->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+        showError(false, "Failed to open job journal %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    if (load(j, path)) {
+        close_JobJournal(j);
+        return 1;
+    }
+    return 0;
+}
+
+int sync_JobJournal(JobJournal *j) {
+    if (j->n_pending == 0) {
+        return 0;
+    }
+    const char *p = (const char *)j->pending;
+    size_t left = j->n_pending * sizeof(JournalRecord);
+    while (left > 0) {
+        ssize_t w = write(j->fd, p, left);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0) {
+            showError(false, "Failed to write job journal: %s!", strerror(errno));
+            j->n_pending = 0;
+            return 1;
+        }
+        p += w;
+        left -= w;
+    }
+    j->n_pending = 0;
+    if (fdatasync(j->fd) != 0) {
+        showError(false, "Failed to sync job journal: %s!", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int append_JobJournal(JobJournal *j, uint64_t id, uint64_t argv_hash, int status,
+        uint64_t out_digest, uint64_t err_digest) {
+    int batch = j->batch > 1 ? j->batch : 1;
+    struct timespec now;
+
+    if (j->pending == NULL && (j->pending = malloc(batch * sizeof(JournalRecord))) == NULL) {
+        showError(false, "Failed to allocate job journal batch!");
+        return 1;
+    }
+    JournalRecord *rec = &j->pending[j->n_pending++];
+    *rec = (JournalRecord){.magic = JOURNAL_MAGIC, .status = status, .id = id,
+        .argv_hash = argv_hash, .out_digest = out_digest, .err_digest = err_digest};
+    rec->check = record_check(rec);
+    index_put(j, id, argv_hash, status); // a miss here only means a rerun
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (j->n_pending == 1) {
+        j->first_pending = now;
+    }
+    long age_ms = (now.tv_sec - j->first_pending.tv_sec) * 1000 +
+        (now.tv_nsec - j->first_pending.tv_nsec) / 1000000;
+    if (j->n_pending >= batch || age_ms >= j->sync_ms) {
+        return sync_JobJournal(j);
+    }
+    return 0;
+}
+
+bool lookup_JobJournal(const JobJournal *j, uint64_t id, uint64_t argv_hash, int *status) {
+    if (j->cap == 0) {
+        return false;
+    }
+    for (size_t k = slot_of(id, j->cap); j->table[k].used; k = (k + 1) & (j->cap - 1)) {
+        if (j->table[k].id == id) {
+            if (j->table[k].argv_hash != argv_hash) {
+                return false;
+            }
+            *status = j->table[k].status;
+            return true;
+        }
+    }
+    return false;
+}
+
+void close_JobJournal(JobJournal *j) {
+    if (j->fd >= 0) {
+        sync_JobJournal(j);
+        close(j->fd);
+    }
+    free(j->pending);
+    free(j->table);
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+}
+
+uint64_t argv_hash_Journal(char* args[]) {
+    uint64_t h = 0;
+    for (char **a = args; *a != NULL; a++) {
+        h = hash_bytes(*a, strlen(*a) + 1, h);
+    }
+    return h;
+}
@@ -0,0 +1,64 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define JOURNAL_MAGIC 0x6c6e726a    // "jrnl"
+#define JOURNAL_BATCH 64            // default records per fdatasync
+#define JOURNAL_SYNC_MS 100         // default longest a record waits for one
+
+// one finished job, as appended; check covers the fields before it, so a
+// torn last record is recognised and cut off
+typedef struct {
+    uint32_t magic;
+    int32_t status;         // wait status
+    uint64_t id;            // Job.journal_id, or argv_hash when that is 0
+    uint64_t argv_hash;
+    uint64_t out_digest;    // digest_CaptureBuf() of the captured stdout, 0 if none
+    uint64_t err_digest;
+    uint64_t check;
+} JournalRecord;
+
+typedef struct {
+    uint64_t id;
+    uint64_t argv_hash;
+    int32_t status;
+    bool used;
+} JournalSlot;
+
+// crash-safe append-only record of finished jobs: a restarted runner skips
+// what a previous run already finished. Records are written in batches
+// with one fdatasync each, so a crash loses at most the last batch -- those
+// jobs just run again. Opening maps the file, keeps the intact prefix and
+// indexes it (the latest record of an id wins).
+typedef struct {
+    int fd;
+    int batch;              // records per fdatasync, set after open; <= 1 syncs each
+    int sync_ms;            // and a partial batch once its oldest is this old (checked on append)
+    JournalRecord *pending; // not written yet
+    int n_pending;
+    struct timespec first_pending;
+    JournalSlot *table;     // open addressing on id
+    size_t cap;
+    size_t n;
+    size_t n_loaded;        // records read on open
+    size_t n_torn;          // bytes of a broken tail cut off on open
+} JobJournal;
+
+int open_JobJournal(JobJournal *j, const char *path);
+// record a finished job; it is durable after the sync this triggers or a later one
+int append_JobJournal(JobJournal *j, uint64_t id, uint64_t argv_hash, int status,
+    uint64_t out_digest, uint64_t err_digest);
+// write and fdatasync what is pending; on failure it is dropped (and reruns)
+int sync_JobJournal(JobJournal *j);
+// the last recorded status of id, false if it never finished or its argv changed
+bool lookup_JobJournal(const JobJournal *j, uint64_t id, uint64_t argv_hash, int *status);
+void close_JobJournal(JobJournal *j);
+
+// hash of an argv, NUL separators included
+uint64_t argv_hash_Journal(char* args[]);
+
+#endif // JOURNAL_H
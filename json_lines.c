@@ -0,0 +1,682 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "json_lines.h"
+
+// per 64-byte block, one bit per byte
+typedef struct {
+    uint64_t quote;
+    uint64_t bs;        // backslashes
+    uint64_t op;        // { } [ ] : ,
+    uint64_t ws;        // space, \t, \n, \r
+    uint64_t ctrl;      // below 0x20
+    uint64_t high;      // 0x80 and up
+} BlockMasks;
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// '[' and ']' are '{' and '}' with bit 5 clear, so OR-ing in 0x20 makes two
+// compares out of four
+static void classify_sse2(const uint8_t *p, BlockMasks *m) {
+    const __m128i quote = _mm_set1_epi8('"'), bs = _mm_set1_epi8('\\');
+    const __m128i open = _mm_set1_epi8('{'), close = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':'), comma = _mm_set1_epi8(',');
+    const __m128i sp = _mm_set1_epi8(' '), tab = _mm_set1_epi8('\t');
+    const __m128i nl = _mm_set1_epi8('\n'), cr = _mm_set1_epi8('\r');
+    const __m128i bit5 = _mm_set1_epi8(0x20), below = _mm_set1_epi8(0x1f);
+
+    memset(m, 0, sizeof(*m));
+    for (int k = 0; k < 4; k++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * k));
+        __m128i f = _mm_or_si128(v, bit5);
+        __m128i op = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(f, open), _mm_cmpeq_epi8(f, close)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, cr)));
+        __m128i ctrl = _mm_cmpeq_epi8(_mm_max_epu8(v, below), below);
+        int s = 16 * k;
+        m->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << s;
+        m->bs |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, bs)) << s;
+        m->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << s;
+        m->ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << s;
+        m->ctrl |= (uint64_t)(uint16_t)_mm_movemask_epi8(ctrl) << s;
+        m->high |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << s;
+    }
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const uint8_t *p, BlockMasks *m) {
+    const __m256i quote = _mm256_set1_epi8('"'), bs = _mm256_set1_epi8('\\');
+    const __m256i open = _mm256_set1_epi8('{'), close = _mm256_set1_epi8('}');
+    const __m256i colon = _mm256_set1_epi8(':'), comma = _mm256_set1_epi8(',');
+    const __m256i sp = _mm256_set1_epi8(' '), tab = _mm256_set1_epi8('\t');
+    const __m256i nl = _mm256_set1_epi8('\n'), cr = _mm256_set1_epi8('\r');
+    const __m256i bit5 = _mm256_set1_epi8(0x20), below = _mm256_set1_epi8(0x1f);
+
+    memset(m, 0, sizeof(*m));
+    for (int k = 0; k < 2; k++) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + 32 * k));
+        __m256i f = _mm256_or_si256(v, bit5);
+        __m256i op = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(f, open), _mm256_cmpeq_epi8(f, close)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, colon), _mm256_cmpeq_epi8(v, comma)));
+        __m256i ws = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, sp), _mm256_cmpeq_epi8(v, tab)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, nl), _mm256_cmpeq_epi8(v, cr)));
+        __m256i ctrl = _mm256_cmpeq_epi8(_mm256_max_epu8(v, below), below);
+        int s = 32 * k;
+        m->quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << s;
+        m->bs |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, bs)) << s;
+        m->op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << s;
+        m->ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << s;
+        m->ctrl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ctrl) << s;
+        m->high |= (uint64_t)(uint32_t)_mm256_movemask_epi8(v) << s;
+    }
+}
+
+static void (*resolve_classify(void))(const uint8_t *, BlockMasks *) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? classify_avx2 : classify_sse2;
+}
+
+static void classify(const uint8_t *p, BlockMasks *m) {
+    static void (*impl)(const uint8_t *, BlockMasks *);
+    if (impl == NULL) {
+        impl = resolve_classify(); // idempotent, a race only repeats it
+    }
+    impl(p, m);
+}
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+// one bit per byte of a compare result, as movemask on x86 gives
+static inline uint64_t movemask_neon(uint8x16_t eq) {
+    static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t m = vandq_u8(eq, vld1q_u8(weights));
+    return vaddv_u8(vget_low_u8(m)) | (uint64_t)vaddv_u8(vget_high_u8(m)) << 8;
+}
+
+static void classify(const uint8_t *p, BlockMasks *m) {
+    memset(m, 0, sizeof(*m));
+    for (int k = 0; k < 4; k++) {
+        uint8x16_t v = vld1q_u8(p + 16 * k);
+        uint8x16_t f = vorrq_u8(v, vdupq_n_u8(0x20));
+        uint8x16_t op = vorrq_u8(vorrq_u8(vceqq_u8(f, vdupq_n_u8('{')), vceqq_u8(f, vdupq_n_u8('}'))),
+            vorrq_u8(vceqq_u8(v, vdupq_n_u8(':')), vceqq_u8(v, vdupq_n_u8(','))));
+        uint8x16_t ws = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t'))),
+            vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')), vceqq_u8(v, vdupq_n_u8('\r'))));
+        int s = 16 * k;
+        m->quote |= movemask_neon(vceqq_u8(v, vdupq_n_u8('"'))) << s;
+        m->bs |= movemask_neon(vceqq_u8(v, vdupq_n_u8('\\'))) << s;
+        m->op |= movemask_neon(op) << s;
+        m->ws |= movemask_neon(ws) << s;
+        m->ctrl |= movemask_neon(vcltq_u8(v, vdupq_n_u8(0x20))) << s;
+        m->high |= movemask_neon(vcgeq_u8(v, vdupq_n_u8(0x80))) << s;
+    }
+}
+#else
+static void classify(const uint8_t *p, BlockMasks *m) {
+    memset(m, 0, sizeof(*m));
+    for (int i = 0; i < 64; i++) {
+        uint64_t bit = 1ull << i;
+        uint8_t c = p[i];
+        m->quote |= c == '"' ? bit : 0;
+        m->bs |= c == '\\' ? bit : 0;
+        m->op |= (c | 0x20) == '{' || (c | 0x20) == '}' || c == ':' || c == ',' ? bit : 0;
+        m->ws |= c == ' ' || c == '\t' || c == '\n' || c == '\r' ? bit : 0;
+        m->ctrl |= c < 0x20 ? bit : 0;
+        m->high |= c >= 0x80 ? bit : 0;
+    }
+}
+#endif
+
+// bytes escaped by a backslash; *carry: the block before ended on one
+// that escapes the first byte of this block
+static uint64_t escaped_bits(uint64_t bs, uint64_t *carry) {
+    const uint64_t even = 0x5555555555555555ull;
+    uint64_t escaped_first = *carry;
+
+    bs &= ~escaped_first;
+    uint64_t follows = bs << 1 | escaped_first;
+    // a run starting on an odd bit escapes the byte after it iff its length is odd:
+    // adding the run's start to it carries out to the end of the run
+    uint64_t odd_starts = bs & ~even & ~follows;
+    uint64_t even_runs;
+    *carry = __builtin_add_overflow(odd_starts, bs, &even_runs);
+    return (even ^ (even_runs << 1)) & follows;
+}
+
+// bit i: odd number of set bits in x[0..i]
+static inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+static bool is_hex(char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+// offset of the first byte that is not valid UTF-8, n if none
+static size_t utf8_error(const uint8_t *s, size_t n) {
+    size_t i = 0;
+
+    while (i < n) {
+        uint8_t c = s[i];
+        size_t k;
+        uint8_t lo = 0x80, hi = 0xbf;
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        if (c >= 0xc2 && c <= 0xdf) {
+            k = 1;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            k = 2;
+            lo = c == 0xe0 ? 0xa0 : 0x80; // no overlong forms
+            hi = c == 0xed ? 0x9f : 0xbf; // no surrogates
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            k = 3;
+            lo = c == 0xf0 ? 0x90 : 0x80;
+            hi = c == 0xf4 ? 0x8f : 0xbf; // nothing past U+10FFFF
+        } else {
+            return i;
+        }
+        if (i + k >= n || s[i + 1] < lo || s[i + 1] > hi) {
+            return i;
+        }
+        for (size_t j = 2; j <= k; j++) {
+            if (s[i + j] < 0x80 || s[i + j] > 0xbf) {
+                return i;
+            }
+        }
+        i += k + 1;
+    }
+    return n;
+}
+
+void init_JsonLines(JsonLines *j, JsonRecordCallback on_record, void *data) {
+    memset(j, 0, sizeof(*j));
+    j->on_record = on_record;
+    j->data = data;
+}
+
+void free_JsonLines(JsonLines *j) {
+    free(j->index);
+    free(j->tokens);
+    j->index = NULL;
+    j->tokens = NULL;
+    j->cap_index = j->cap_tokens = 0;
+}
+
+static bool grow(void **p, size_t *cap, size_t want, size_t size) {
+    if (want <= *cap) {
+        return true;
+    }
+    size_t n = *cap ? *cap : 256;
+    while (n < want) {
+        n *= 2;
+    }
+    void *q = realloc(*p, n * size);
+    if (q == NULL) {
+        return false;
+    }
+    *p = q;
+    *cap = n;
+    return true;
+}
+
+// stage 1: the offsets of every structural character outside strings, of
+// both quotes of every string and of the first byte of every other scalar;
+// catches what the grammar pass can't see (control characters and bad
+// escapes in strings, an unterminated string, invalid UTF-8)
+static JsonStatus index_line(JsonLines *j, const char *line, size_t len, size_t *n_index, size_t *error_at) {
+    uint64_t esc_carry = 0, in_string = 0, prev_scalar = 0, high = 0;
+    uint8_t tail[64];
+    size_t n = 0;
+
+    for (size_t base = 0; base < len; base += 64) {
+        const uint8_t *p = (const uint8_t *)line + base;
+        BlockMasks m;
+        if (len - base < 64) { // pad with whitespace, which never changes a thing
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, len - base);
+            p = tail;
+        }
+        classify(p, &m);
+        uint64_t escaped = escaped_bits(m.bs, &esc_carry);
+        uint64_t quotes = m.quote & ~escaped;
+        // from an opening quote up to, not including, its closing one
+        uint64_t str = prefix_xor(quotes) ^ in_string;
+        in_string = (uint64_t)((int64_t)str >> 63);
+        uint64_t bad = (m.ctrl & str) | (escaped & ~str);
+        uint64_t esc = escaped & str;
+        while (esc != 0) {
+            size_t at = base + __builtin_ctzll(esc);
+            char c = line[at];
+            esc &= esc - 1;
+            if (c == 'u') {
+                if (at + 4 >= len || !is_hex(line[at + 1]) || !is_hex(line[at + 2]) ||
+                        !is_hex(line[at + 3]) || !is_hex(line[at + 4])) {
+                    *error_at = at;
+                    return JSON_INVALID;
+                }
+            } else if (strchr("\"\\/bfnrt", c) == NULL || c == '\0') {
+                *error_at = at;
+                return JSON_INVALID;
+            }
+        }
+        if (bad != 0) {
+            *error_at = base + __builtin_ctzll(bad);
+            return JSON_INVALID;
+        }
+        uint64_t scalar = ~str & ~quotes & ~m.ws & ~m.op;
+        uint64_t starts = scalar & ~(scalar << 1 | prev_scalar);
+        prev_scalar = scalar >> 63;
+        high |= m.high;
+        for (uint64_t s = (m.op & ~str) | quotes | starts; s != 0; s &= s - 1) {
+            j->index[n++] = base + __builtin_ctzll(s);
+        }
+    }
+    if (in_string) {
+        *error_at = len;
+        return JSON_INVALID;
+    }
+    if (high != 0) {
+        size_t at = utf8_error((const uint8_t *)line, len);
+        if (at < len) {
+            *error_at = at;
+            return JSON_INVALID;
+        }
+    }
+    *n_index = n;
+    return JSON_OK;
+}
+
+static bool is_delim(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '"' ||
+        c == ',' || c == ':' || c == '[' || c == ']' || c == '{' || c == '}';
+}
+
+static size_t digits(const char *p, size_t i, size_t end) {
+    while (i < end && p[i] >= '0' && p[i] <= '9') {
+        i++;
+    }
+    return i;
+}
+
+// the scalar starting at line[at]: its type, and its end in *end, or -1
+static int scalar_type(const char *line, size_t len, size_t at, size_t *end) {
+    size_t e = at;
+
+    while (e < len && !is_delim(line[e])) {
+        e++;
+    }
+    *end = e;
+    size_t n = e - at;
+    if (n == 4 && memcmp(line + at, "true", 4) == 0) {
+        return JSON_TRUE;
+    }
+    if (n == 5 && memcmp(line + at, "false", 5) == 0) {
+        return JSON_FALSE;
+    }
+    if (n == 4 && memcmp(line + at, "null", 4) == 0) {
+        return JSON_NULL;
+    }
+    size_t i = at + (line[at] == '-');
+    if (i < e && line[i] == '0') {
+        i++;
+    } else {
+        size_t d = digits(line, i, e);
+        if (d == i) {
+            return -1;
+        }
+        i = d;
+    }
+    if (i < e && line[i] == '.') {
+        size_t d = digits(line, i + 1, e);
+        if (d == i + 1) {
+            return -1;
+        }
+        i = d;
+    }
+    if (i < e && (line[i] | 0x20) == 'e') {
+        i++;
+        if (i < e && (line[i] == '+' || line[i] == '-')) {
+            i++;
+        }
+        size_t d = digits(line, i, e);
+        if (d == i) {
+            return -1;
+        }
+        i = d;
+    }
+    return i == e ? JSON_NUMBER : -1;
+}
+
+typedef enum {
+    EXPECT_VALUE = 0,
+    EXPECT_VALUE_OR_END,    // right after '['
+    EXPECT_KEY,
+    EXPECT_KEY_OR_END,      // right after '{'
+    EXPECT_COLON,
+    EXPECT_NEXT,            // ',' or the container's end
+} Expect;
+
+// stage 2: check the grammar over the index and lay the tokens out
+static JsonStatus parse_index(JsonLines *j, const char *line, size_t len, size_t n_index, JsonRecord *rec) {
+    uint32_t stack[JSON_MAX_DEPTH];
+    int depth = 0;
+    Expect expect = EXPECT_VALUE;
+    size_t nt = 0, i = 0;
+    bool done = false;
+    JsonToken *t = j->tokens;
+    const uint32_t *idx = j->index;
+
+    while (i < n_index) {
+        uint32_t at = idx[i];
+        char c = line[at];
+        if (done) {
+            goto invalid; // more after the root value
+        }
+        switch (expect) {
+            case EXPECT_KEY_OR_END:
+                if (c == '}') {
+                    goto close;
+                }
+                // fall through
+            case EXPECT_KEY:
+                if (c != '"') {
+                    goto invalid;
+                }
+                t[stack[depth - 1]].n++;
+                t[nt] = (JsonToken){.type = JSON_STRING, .off = at, .len = idx[i + 1] - at + 1, .next = nt + 1};
+                nt++;
+                i += 2;
+                expect = EXPECT_COLON;
+                continue;
+            case EXPECT_COLON:
+                if (c != ':') {
+                    goto invalid;
+                }
+                i++;
+                expect = EXPECT_VALUE;
+                continue;
+            case EXPECT_NEXT:
+                if (c == ',') {
+                    i++;
+                    expect = t[stack[depth - 1]].type == JSON_OBJECT ? EXPECT_KEY : EXPECT_VALUE;
+                    continue;
+                }
+                if (c == '}' || c == ']') {
+                    goto close;
+                }
+                goto invalid;
+            case EXPECT_VALUE_OR_END:
+                if (c == ']') {
+                    goto close;
+                }
+                // fall through
+            case EXPECT_VALUE:
+                if (depth > 0 && t[stack[depth - 1]].type == JSON_ARRAY) {
+                    t[stack[depth - 1]].n++;
+                }
+                if (c == '{' || c == '[') {
+                    if (depth == JSON_MAX_DEPTH) {
+                        rec->error_at = at;
+                        return JSON_TOO_DEEP;
+                    }
+                    t[nt] = (JsonToken){.type = c == '{' ? JSON_OBJECT : JSON_ARRAY, .off = at};
+                    stack[depth++] = nt++;
+                    i++;
+                    expect = c == '{' ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+                    continue;
+                }
+                if (c == '"') {
+                    t[nt] = (JsonToken){.type = JSON_STRING, .off = at, .len = idx[i + 1] - at + 1, .next = nt + 1};
+                    i += 2;
+                } else {
+                    size_t end;
+                    int type = scalar_type(line, len, at, &end);
+                    if (type < 0) {
+                        goto invalid;
+                    }
+                    t[nt] = (JsonToken){.type = type, .off = at, .len = end - at, .next = nt + 1};
+                    i++;
+                }
+                nt++;
+                expect = EXPECT_NEXT;
+                done = depth == 0;
+                continue;
+        }
+close:
+        if (depth == 0 || (c == '}') != (t[stack[depth - 1]].type == JSON_OBJECT)) {
+            goto invalid;
+        }
+        depth--;
+        t[stack[depth]].len = at + 1 - t[stack[depth]].off;
+        t[stack[depth]].next = nt;
+        i++;
+        expect = EXPECT_NEXT;
+        done = depth == 0;
+        continue;
+invalid:
+        rec->error_at = at;
+        return JSON_INVALID;
+    }
+    if (!done) {
+        rec->error_at = len; // it ends too soon
+        return JSON_INVALID;
+    }
+    rec->n_tokens = nt;
+    return JSON_OK;
+}
+
+JsonStatus parse_JsonLines(JsonLines *j, const char *line, size_t len, JsonRecord *rec) {
+    size_t n_index = 0;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->line = line;
+    rec->len = len;
+    if (len >= UINT32_MAX) {
+        return rec->status = JSON_TOO_DEEP;
+    }
+    // every byte may be indexed, and every index entry makes at most one token
+    if (!grow((void **)&j->index, &j->cap_index, len + 1, sizeof(uint32_t))) {
+        return rec->status = JSON_NOMEM;
+    }
+    if ((rec->status = index_line(j, line, len, &n_index, &rec->error_at)) != JSON_OK) {
+        return rec->status;
+    }
+    if (n_index == 0) {
+        return rec->status = JSON_BLANK;
+    }
+    if (!grow((void **)&j->tokens, &j->cap_tokens, n_index, sizeof(JsonToken))) {
+        return rec->status = JSON_NOMEM;
+    }
+    rec->tokens = j->tokens;
+    return rec->status = parse_index(j, line, len, n_index, rec);
+}
+
+void on_line_JsonLines(ProcInfo *ci, const char *line, size_t len, void *data) {
+    JsonLines *j = data;
+    JsonRecord rec;
+
+    if (parse_JsonLines(j, line, len, &rec) == JSON_BLANK) {
+        return;
+    }
+    if (rec.status == JSON_OK) {
+        j->n_records++;
+    } else {
+        j->n_invalid++;
+    }
+    if (j->on_record != NULL) {
+        j->on_record(ci, &rec, j->data);
+    }
+}
+
+ssize_t find_JsonRecord(const JsonRecord *rec, size_t obj, const char *key) {
+    const JsonToken *t = rec->tokens;
+    size_t n = strlen(key);
+
+    if (obj >= rec->n_tokens || t[obj].type != JSON_OBJECT) {
+        return -1;
+    }
+    for (size_t k = obj + 1; k < t[obj].next; k = t[k + 1].next) {
+        if (t[k].len - 2 == n && memcmp(rec->line + t[k].off + 1, key, n) == 0) {
+            return k + 1;
+        }
+    }
+    return -1;
+}
+
+ssize_t item_JsonRecord(const JsonRecord *rec, size_t arr, size_t i) {
+    const JsonToken *t = rec->tokens;
+
+    if (arr >= rec->n_tokens || t[arr].type != JSON_ARRAY || i >= t[arr].n) {
+        return -1;
+    }
+    size_t k = arr + 1;
+    while (i-- > 0) {
+        k = t[k].next;
+    }
+    return k;
+}
+
+static unsigned hex4(const char *p) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        v = v << 4 | (c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10);
+    }
+    return v;
+}
+
+static size_t put_utf8(char *buf, size_t cap, size_t at, unsigned cp) {
+    char u[4];
+    size_t n;
+
+    if (cp < 0x80) {
+        u[0] = cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        u[0] = 0xc0 | cp >> 6;
+        u[1] = 0x80 | (cp & 0x3f);
+        n = 2;
+    } else if (cp < 0x10000) {
+        u[0] = 0xe0 | cp >> 12;
+        u[1] = 0x80 | (cp >> 6 & 0x3f);
+        u[2] = 0x80 | (cp & 0x3f);
+        n = 3;
+    } else {
+        u[0] = 0xf0 | cp >> 18;
+        u[1] = 0x80 | (cp >> 12 & 0x3f);
+        u[2] = 0x80 | (cp >> 6 & 0x3f);
+        u[3] = 0x80 | (cp & 0x3f);
+        n = 4;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (at + i + 1 < cap) {
+            buf[at + i] = u[i];
+        }
+    }
+    return n;
+}
+
+ssize_t string_JsonRecord(const JsonRecord *rec, size_t tok, char *buf, size_t cap) {
+    if (tok >= rec->n_tokens || rec->tokens[tok].type != JSON_STRING) {
+        return -1;
+    }
+    const char *p = rec->line + rec->tokens[tok].off + 1;
+    const char *end = p + rec->tokens[tok].len - 2;
+    size_t n = 0;
+
+    while (p < end) {
+        const char *bs = memchr(p, '\\', end - p);
+        size_t run = (bs != NULL ? bs : end) - p;
+        if (n < cap) {
+            memcpy(buf + n, p, n + run < cap ? run : cap - n);
+        }
+        n += run;
+        p += run;
+        if (p == end) {
+            break;
+        }
+        char c = p[1];
+        unsigned cp = c;
+        p += 2;
+        switch (c) {
+            case 'b': cp = '\b'; break;
+            case 'f': cp = '\f'; break;
+            case 'n': cp = '\n'; break;
+            case 'r': cp = '\r'; break;
+            case 't': cp = '\t'; break;
+            case 'u':
+                cp = hex4(p);
+                p += 4;
+                if (cp >= 0xd800 && cp < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                    unsigned lo = hex4(p + 2);
+                    if (lo >= 0xdc00 && lo < 0xe000) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                        p += 6;
+                    }
+                }
+                if (cp >= 0xd800 && cp < 0xe000) {
+                    cp = 0xfffd; // a lone surrogate
+                }
+                break;
+        }
+        n += put_utf8(buf, cap, n, cp);
+    }
+    if (cap > 0) {
+        buf[n < cap ? n : cap - 1] = '\0';
+    }
+    return n;
+}
+
+int number_JsonRecord(const JsonRecord *rec, size_t tok, double *v) {
+    char small[64];
+
+    if (tok >= rec->n_tokens || rec->tokens[tok].type != JSON_NUMBER) {
+        return 1;
+    }
+    const JsonToken *t = &rec->tokens[tok];
+    char *s = t->len < sizeof(small) ? small : malloc(t->len + 1);
+    if (s == NULL) {
+        return 1;
+    }
+    memcpy(s, rec->line + t->off, t->len);
+    s[t->len] = '\0';
+    *v = strtod(s, NULL);
+    if (s != small) {
+        free(s);
+    }
+    return 0;
+}
+
+int int_JsonRecord(const JsonRecord *rec, size_t tok, int64_t *v) {
+    if (tok >= rec->n_tokens || rec->tokens[tok].type != JSON_NUMBER) {
+        return 1;
+    }
+    const char *p = rec->line + rec->tokens[tok].off, *end = p + rec->tokens[tok].len;
+    bool neg = *p == '-';
+    uint64_t x = 0, limit = neg ? (uint64_t)INT64_MAX + 1 : INT64_MAX;
+
+    for (p += neg; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return 1; // a fraction or an exponent
+        }
+        if (x > (limit - (*p - '0')) / 10) {
+            return 1;
+        }
+        x = x * 10 + (*p - '0');
+    }
+    *v = neg ? (int64_t)(0 - x) : (int64_t)x;
+    return 0;
+}
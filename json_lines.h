@@ -0,0 +1,90 @@
+#ifndef JSON_LINES_H
+#define JSON_LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+
+#define JSON_MAX_DEPTH 256  // nesting deeper than this is JSON_TOO_DEEP
+
+typedef enum {
+    JSON_OBJECT = 0,
+    JSON_ARRAY,
+    JSON_STRING,
+    JSON_NUMBER,
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL
+} JsonType;
+
+typedef enum {
+    JSON_OK = 0,
+    JSON_BLANK,         // nothing but whitespace, not a record
+    JSON_INVALID,       // error_at says where
+    JSON_TOO_DEEP,
+    JSON_NOMEM
+} JsonStatus;
+
+// one value of a record, in document order: a container is followed by its
+// members (an object's alternate key, value), and next skips all of them
+typedef struct {
+    JsonType type;
+    uint32_t off;       // into the line
+    uint32_t len;       // raw bytes: quotes included, a container up to its closing bracket
+    uint32_t next;      // index of the token after this value and everything in it
+    uint32_t n;         // containers: members (key/value pairs) or elements
+} JsonToken;
+
+// a parsed line; views into it are valid as long as the line is
+typedef struct {
+    const char *line;
+    size_t len;
+    JsonStatus status;
+    size_t error_at;    // JSON_INVALID: offset of the first byte found wrong
+    const JsonToken *tokens; // tokens[0] is the root value
+    size_t n_tokens;
+} JsonRecord;
+
+typedef void (*JsonRecordCallback)(ProcInfo *ci, const JsonRecord *rec, void *data);
+
+// validates and indexes JSON-lines as they come off a LineSplitter, so the
+// parse overlaps the child's I/O instead of following the capture. A SIMD
+// pass over 64-byte blocks (SSE2/AVX2 on x86_64, NEON on aarch64) finds
+// quotes, escapes and structural characters outside strings with bit
+// masks; a scalar pass then checks the grammar over that index only and
+// lays out the tokens. Non-ASCII lines are checked to be valid UTF-8
+typedef struct {
+    JsonRecordCallback on_record;   // input: every non-blank line, valid or not
+    void *data;
+    uint32_t *index;    // structural offsets of the line being parsed
+    size_t cap_index;
+    JsonToken *tokens;
+    size_t cap_tokens;
+    size_t n_records;   // valid ones
+    size_t n_invalid;
+} JsonLines;
+
+void init_JsonLines(JsonLines *j, JsonRecordCallback on_record, void *data);
+void free_JsonLines(JsonLines *j);
+// parse one line (no '\n'); rec's tokens are j's until the next call
+JsonStatus parse_JsonLines(JsonLines *j, const char *line, size_t len, JsonRecord *rec);
+// a LineCallback: with the JsonLines as its data, watch_LineWatcher() and
+// run_lines() hand the records to on_record as the lines arrive
+void on_line_JsonLines(ProcInfo *ci, const char *line, size_t len, void *data);
+
+// the value of key in the object at token obj, -1 if none; keys compare as
+// written, escapes and all
+ssize_t find_JsonRecord(const JsonRecord *rec, size_t obj, const char *key);
+// element i of the array at token arr, -1 if it is shorter
+ssize_t item_JsonRecord(const JsonRecord *rec, size_t arr, size_t i);
+// the string at token tok unescaped into buf (NUL-terminated if cap > 0);
+// returns its length snprintf-style, -1 if tok is no string
+ssize_t string_JsonRecord(const JsonRecord *rec, size_t tok, char *buf, size_t cap);
+// numbers; 1 if tok is no number (or, for the integer, has a fraction or is out of range)
+int number_JsonRecord(const JsonRecord *rec, size_t tok, double *v);
+int int_JsonRecord(const JsonRecord *rec, size_t tok, int64_t *v);
+
+#endif // JSON_LINES_H
@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "line_watch.h"
+#include "capture.h"
+
+static void on_readable(EventLoop *loop, int fd, unsigned revents, void *data) {
+    LineWatcher *w = data;
+    int i = fd == w->ci->p_stdout ? 0 : 1;
+    const char *line;
+    size_t len;
+
+    ssize_t n = read_ChunkReader(&w->readers[i], fd);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    while (!w->done[i] && next_LineSplitter(&w->splitters[i], &line, &len)) {
+        w->on_line[i](w->ci, line, len, w->data);
+        if (w->stop_lines > 0 && ++w->n_lines[i] >= w->stop_lines) {
+            stop_LineWatcher(w, STDOUT_FILENO + i);
+        }
+    }
+    if (n > 0 || w->done[i]) {
+        return;
+    }
+    // EOF or a read error: flush the unterminated tail and stop watching
+    if (rest_LineSplitter(&w->splitters[i], &line, &len)) {
+        w->on_line[i](w->ci, line, len, w->data);
+    }
+    del_EventLoop(loop, fd);
+    w->done[i] = true;
+    w->n_open--;
+}
+
+void stop_LineWatcher(LineWatcher *w, int stream) {
+    int i = stream == STDERR_FILENO;
+    int fd = i == 0 ? w->ci->p_stdout : w->ci->p_stderr;
+
+    if (w->on_line[i] == NULL || w->done[i] || fd < 0) {
+        return;
+    }
+    del_EventLoop(w->loop, fd);
+    short_circuit_ProcInfo(w->ci, fd, w->stop_signal);
+    w->done[i] = true;
+    w->n_open--;
+}
+
+int watch_LineWatcher(LineWatcher *w, EventLoop *loop, ProcInfo *ci,
+        LineCallback on_stdout_line, LineCallback on_stderr_line, void *data) {
+    int fds[2] = {ci->p_stdout, ci->p_stderr};
+
+    memset(w, 0, sizeof(*w));
+    w->loop = loop;
+    w->ci = ci;
+    w->on_line[0] = on_stdout_line;
+    w->on_line[1] = on_stderr_line;
+    w->data = data;
+    for (int i = 0; i < 2; i++) {
+        init_ChunkReader(&w->readers[i]);
+        init_LineSplitter(&w->splitters[i], &w->readers[i]);
+        if (w->on_line[i] == NULL) {
+            continue;
+        }
+        if (fds[i] < 0) {
+            showError(false, "No %s pipe to read lines from!", i == 0 ? "stdout" : "stderr");
+            close_LineWatcher(w);
+            return 1;
+        }
+        if (add_EventLoop(loop, fds[i], POLLIN, on_readable, w)) {
+            close_LineWatcher(w);
+            return 1;
+        }
+        w->n_open++;
+    }
+    return 0;
+}
+
+void close_LineWatcher(LineWatcher *w) {
+    int fds[2] = {w->ci->p_stdout, w->ci->p_stderr};
+
+    for (int i = 0; i < 2; i++) {
+        if (w->on_line[i] != NULL && fds[i] >= 0 && !w->done[i] && w->n_open > 0) {
+            del_EventLoop(w->loop, fds[i]);
+        }
+        free_LineSplitter(&w->splitters[i]);
+        free_ChunkReader(&w->readers[i]);
+    }
+    w->n_open = 0;
+}
+
+int run_lines(ProcInfo *ci, char* args[], char* env[],
+        LineCallback on_stdout_line, LineCallback on_stderr_line, void *data) {
+    return run_lines_upto(ci, args, env, on_stdout_line, on_stderr_line, data, 0, 0);
+}
+
+int run_lines_upto(ProcInfo *ci, char* args[], char* env[],
+        LineCallback on_stdout_line, LineCallback on_stderr_line, void *data,
+        size_t max_lines, int stop_signal) {
+    EventLoop loop;
+    LineWatcher w;
+    int status = -1;
+
+    if (on_stdout_line != NULL) {
+        ci->stdout_type = PROC_COM_PIPE;
+    }
+    if (on_stderr_line != NULL) {
+        ci->stderr_type = PROC_COM_PIPE;
+    }
+    if (init_EventLoop(&loop, EVLOOP_EPOLL)) {
+        return -1;
+    }
+    if (subprocess(ci, args, env)) {
+        close_EventLoop(&loop);
+        return -1;
+    }
+    if (ci->stdin_type == PROC_COM_PIPE && ci->p_stdin >= 0) {
+        close(ci->p_stdin);
+        ci->p_stdin = -1;
+    }
+    if (watch_LineWatcher(&w, &loop, ci, on_stdout_line, on_stderr_line, data) == 0) {
+        w.stop_lines = max_lines;
+        w.stop_signal = stop_signal;
+        while (!done_LineWatcher(&w) && run_EventLoop(&loop, -1) >= 0);
+        close_LineWatcher(&w);
+    }
+    reap_ProcInfo(ci, &status, 0);
+    close_ProcInfo(ci);
+    close_EventLoop(&loop);
+    return status;
+}
@@ -0,0 +1,55 @@
+#ifndef LINE_WATCH_H
+#define LINE_WATCH_H
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "reader.h"
+#include "lines.h"
+
+// one line of child output without its '\n'; line points into the read
+// buffer and is only valid during the call
+typedef void (*LineCallback)(ProcInfo *ci, const char *line, size_t len, void *data);
+
+// feeds a child's piped stdout/stderr through ChunkReader + LineSplitter as
+// the event loop reports them readable
+typedef struct {
+    EventLoop *loop;
+    ProcInfo *ci;
+    LineCallback on_line[2];    // stdout, stderr; NULL leaves the stream alone
+    void *data;
+    ChunkReader readers[2];
+    LineSplitter splitters[2];
+    int n_open;                 // watched streams not at EOF yet
+    // input, set after watch_LineWatcher(): a stream stops once this many
+    // of its lines were delivered, 0 for no limit; see stop_LineWatcher()
+    size_t stop_lines;
+    int stop_signal;            // input: sent to the child when a stream stops, 0 for none
+    size_t n_lines[2];
+    bool done[2];               // at EOF or stopped
+} LineWatcher;
+
+// register ci's p_stdout/p_stderr for the streams that have a callback
+int watch_LineWatcher(LineWatcher *w, EventLoop *loop, ProcInfo *ci,
+    LineCallback on_stdout_line, LineCallback on_stderr_line, void *data);
+// every watched stream reached EOF and its last line was delivered
+static inline bool done_LineWatcher(const LineWatcher *w) {
+    return w->n_open == 0;
+}
+// no more lines of stream (STDOUT_FILENO or STDERR_FILENO), from a
+// callback too: the parent's end is closed, so the child gets EPIPE/SIGPIPE
+// on its next write rather than producing output nobody reads
+void stop_LineWatcher(LineWatcher *w, int stream);
+void close_LineWatcher(LineWatcher *w);
+
+// spawn args with a pipe for each stream that has a callback, deliver its
+// lines until EOF and reap it; returns the wait status, -1 if it never ran
+int run_lines(ProcInfo *ci, char* args[], char* env[],
+    LineCallback on_stdout_line, LineCallback on_stderr_line, void *data);
+// run_lines() for at most max_lines lines of each stream (0 for all of
+// them): a stream is closed once it delivered its last one, and the child
+// gets stop_signal unless 0; it is still reaped before returning
+int run_lines_upto(ProcInfo *ci, char* args[], char* env[],
+    LineCallback on_stdout_line, LineCallback on_stderr_line, void *data,
+    size_t max_lines, int stop_signal);
+
+#endif // LINE_WATCH_H
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "lines.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+static const char *find_newline_sse2(const char *p, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask != 0) {
+            return p + i + __builtin_ctz(mask);
+        }
+    }
+    return memchr(p + i, '\n', n - i);
+}
+
+__attribute__((target("avx2")))
+static const char *find_newline_avx2(const char *p, size_t n) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    // two vectors per round so the loop branch is paid once per 64 bytes
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), nl);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 32)), nl);
+        uint64_t mask = (uint32_t)_mm256_movemask_epi8(a) |
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(b) << 32;
+        if (mask != 0) {
+            return p + i + __builtin_ctzll(mask);
+        }
+    }
+    return find_newline_sse2(p + i, n - i);
+}
+
+static const char *(*resolve_newline(void))(const char *, size_t) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? find_newline_avx2 : find_newline_sse2;
+}
+
+const char *find_newline(const char *p, size_t n) {
+    static const char *(*impl)(const char *, size_t);
+    if (impl == NULL) {
+        impl = resolve_newline(); // idempotent, a race only repeats it
+    }
+    return impl(p, n);
+}
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+
+const char *find_newline(const char *p, size_t n) {
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)(p + i)), nl);
+        if (vmaxvq_u8(eq) != 0) {
+            // narrow to 4 bits per byte to find the first match
+            uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+                vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            return p + i + (__builtin_ctzll(mask) >> 2);
+        }
+    }
+    return memchr(p + i, '\n', n - i);
+}
+#else
+const char *find_newline(const char *p, size_t n) {
+    return memchr(p, '\n', n);
+}
+#endif
+
+void init_LineSplitter(LineSplitter *s, ChunkReader *r) {
+    memset(s, 0, sizeof(*s));
+    s->r = r;
+}
+
+void free_LineSplitter(LineSplitter *s) {
+    free(s->carry);
+    s->carry = NULL;
+    s->carry_len = s->carry_cap = 0;
+}
+
+static bool add_carry(LineSplitter *s, const char *p, size_t n) {
+    if (s->carry_len + n > s->carry_cap) {
+        size_t cap = s->carry_cap ? s->carry_cap : 256;
+        while (cap < s->carry_len + n) {
+            cap *= 2;
+        }
+        char *c = realloc(s->carry, cap);
+        if (c == NULL) {
+            return false;
+        }
+        s->carry = c;
+        s->carry_cap = cap;
+    }
+    memcpy(s->carry + s->carry_len, p, n);
+    s->carry_len += n;
+    return true;
+}
+
+// drop the line handed out last time
+static void settle(LineSplitter *s) {
+    if (s->carry_out) {
+        s->carry_len = 0;
+        s->carry_out = false;
+    }
+    if (s->pending > 0) {
+        consume_ChunkReader(s->r, s->pending);
+        s->pending = 0;
+        s->scanned = 0;
+    }
+}
+
+bool next_LineSplitter(LineSplitter *s, const char **line, size_t *len) {
+    settle(s);
+    for (ReadChunk *c = s->r->head; c != NULL; c = s->r->head) {
+        const char *start = c->data + c->off;
+        size_t avail = c->len - c->off;
+        if (avail == 0) {
+            s->scanned = 0; // drained tail, restarted by the reader
+            return false;
+        }
+        const char *nl = find_newline(start + s->scanned, avail - s->scanned);
+        if (nl != NULL) {
+            size_t n = nl - start;
+            s->pending = n + 1;
+            if (s->carry_len > 0) { // the line began in an earlier chunk
+                if (!add_carry(s, start, n)) {
+                    return false;
+                }
+                s->carry_out = true;
+                *line = s->carry;
+                *len = s->carry_len;
+            } else {
+                *line = start;
+                *len = n;
+            }
+            return true;
+        }
+        if (c == s->r->tail) {
+            s->scanned = avail; // resume here after the next read
+            return false;
+        }
+        // the line goes on in the next chunk: keep its beginning aside
+        if (!add_carry(s, start, avail)) {
+            return false;
+        }
+        consume_ChunkReader(s->r, avail);
+        s->scanned = 0;
+    }
+    return false;
+}
+
+bool rest_LineSplitter(LineSplitter *s, const char **line, size_t *len) {
+    settle(s);
+    ReadChunk *c = s->r->head;
+    size_t avail = c != NULL ? c->len - c->off : 0;
+
+    if (s->carry_len == 0 && avail == 0) {
+        return false;
+    }
+    if (s->carry_len > 0 || c != s->r->tail) {
+        for (; c != NULL; c = c->next) {
+            if (!add_carry(s, c->data + c->off, c->len - c->off)) {
+                return false;
+            }
+        }
+        s->carry_out = true;
+        s->pending = s->r->len;
+        *line = s->carry;
+        *len = s->carry_len;
+        return true;
+    }
+    s->pending = avail;
+    *line = c->data + c->off;
+    *len = avail;
+    return true;
+}
@@ -0,0 +1,33 @@
+#ifndef LINES_H
+#define LINES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "reader.h"
+
+// first '\n' in p[0..n), NULL if none; SSE2/AVX2 on x86_64, NEON on aarch64
+const char *find_newline(const char *p, size_t n);
+
+// frames the data of a ChunkReader into lines handed out as views: a line
+// inside one chunk points straight into it, only a line straddling two chunks
+// is copied (into carry)
+typedef struct {
+    ChunkReader *r;
+    size_t scanned;         // bytes of the head chunk known to hold no '\n'
+    size_t pending;         // bytes of the last line still to consume
+    char *carry;            // start of a line from drained chunks
+    size_t carry_len;
+    size_t carry_cap;
+    bool carry_out;         // the last line was returned from carry
+} LineSplitter;
+
+void init_LineSplitter(LineSplitter *s, ChunkReader *r);
+void free_LineSplitter(LineSplitter *s);
+// next complete line without its '\n'; false when more data is needed
+// the view is valid until the next call or the next read_ChunkReader()
+bool next_LineSplitter(LineSplitter *s, const char **line, size_t *len);
+// at EOF: the unterminated last line, if any; false if nothing is left
+bool rest_LineSplitter(LineSplitter *s, const char **line, size_t *len);
+
+#endif // LINES_H
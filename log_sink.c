@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/timerfd.h>
+
+#include "log_sink.h"
+
+#define LOG_SINK_ENTRIES 8
+#define LOG_SINK_DATA 1     // user_data of the flush's sqe
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int fail(LogSink *s, int err) {
+    if (s->err == 0) {
+        s->err = err;
+        showError(false, "Cannot write the log: %s!", strerror(err));
+    }
+    return 1;
+}
+
+static void give_back(LogSink *s, LogBlock *chain) {
+    while (chain != NULL) {
+        LogBlock *b = chain;
+        chain = b->next;
+        if (b->cap != LOG_SINK_BLOCK) { // a record's own: keep only the usual size
+            free(b);
+            continue;
+        }
+        b->len = 0;
+        b->next = s->spare;
+        s->spare = b;
+    }
+}
+
+// s->iov over chain's blocks
+static int map_blocks(LogSink *s, LogBlock *chain) {
+    s->n_iov = s->iov_at = 0;
+    for (LogBlock *b = chain; b != NULL; b = b->next) {
+        if (s->n_iov == s->cap_iov) {
+            int cap = s->cap_iov ? s->cap_iov * 2 : 16;
+            struct iovec *iov = realloc(s->iov, cap * sizeof(struct iovec));
+            if (iov == NULL) {
+                return fail(s, ENOMEM);
+            }
+            s->iov = iov;
+            s->cap_iov = cap;
+        }
+        s->iov[s->n_iov].iov_base = b->data;
+        s->iov[s->n_iov++].iov_len = b->len;
+    }
+    return 0;
+}
+
+// n more bytes went out: move iov_at past the blocks they finished
+static void advance(LogSink *s, size_t n) {
+    s->n_bytes += n;
+    while (s->iov_at < s->n_iov && n >= s->iov[s->iov_at].iov_len) {
+        n -= s->iov[s->iov_at++].iov_len;
+    }
+    if (n > 0) { // short: the rest of this block goes first next time
+        s->iov[s->iov_at].iov_base = (char *)s->iov[s->iov_at].iov_base + n;
+        s->iov[s->iov_at].iov_len -= n;
+    }
+}
+
+static inline int iov_batch(const LogSink *s) {
+    return s->n_iov - s->iov_at < IOV_MAX ? s->n_iov - s->iov_at : IOV_MAX;
+}
+
+static int write_blocks(LogSink *s) {
+    struct pollfd pfd = {.fd = s->fd, .events = POLLOUT};
+
+    while (s->iov_at < s->n_iov) {
+        ssize_t n = writev(s->fd, s->iov + s->iov_at, iov_batch(s));
+        s->n_syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) { // a non-blocking fd: wait it out, the records are held
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return fail(s, errno);
+        }
+        if (n == 0) {
+            return fail(s, EIO);
+        }
+        advance(s, n);
+    }
+    return 0;
+}
+
+static int queue_writev(LogSink *s) {
+    struct io_uring_sqe *sqe = get_sqe_Uring(&s->ring);
+
+    if (sqe == NULL) {
+        return fail(s, EBUSY);
+    }
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = s->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(s->iov + s->iov_at);
+    sqe->len = iov_batch(s);
+    sqe->off = (uint64_t)-1; // at the file position, as write() would
+    sqe->user_data = LOG_SINK_DATA;
+    int rc = submit_Uring(&s->ring, 0, 0);
+    s->n_syscalls++;
+    return rc < 0 ? fail(s, -rc) : 0;
+}
+
+// wait for the flush in flight, resubmitting what it left
+static int land(LogSink *s) {
+    int rc = 0;
+
+    while (s->flying != NULL) {
+        struct io_uring_cqe *cqe = peek_Uring(&s->ring);
+        if (cqe == NULL) {
+            int err = submit_Uring(&s->ring, 1, -1);
+            s->n_syscalls++;
+            if (err < 0) {
+                rc = fail(s, -err);
+                break;
+            }
+            continue;
+        }
+        uint64_t key = cqe->user_data;
+        int res = cqe->res;
+        seen_Uring(&s->ring);
+        if (key != LOG_SINK_DATA) {
+            continue;
+        }
+        if (res == 0 || (res < 0 && res != -EINTR && res != -EAGAIN)) {
+            rc = fail(s, res == 0 ? EIO : -res);
+            break;
+        }
+        if (res > 0) {
+            advance(s, res);
+        }
+        if (s->iov_at == s->n_iov) {
+            break;
+        }
+        if (queue_writev(s)) {
+            rc = 1;
+            break;
+        }
+    }
+    give_back(s, s->flying);
+    s->flying = NULL;
+    return rc;
+}
+
+// hand the held blocks to the kernel; with io_uring without waiting
+static int start_flush(LogSink *s) {
+    LogBlock *chain = s->head;
+    int rc;
+
+    if (s->backend == LOG_SINK_URING && land(s)) {
+        return 1;
+    }
+    if (chain == NULL) {
+        return 0;
+    }
+    s->head = s->tail = NULL;
+    s->held = 0;
+    s->n_flushes++;
+    if (map_blocks(s, chain)) {
+        give_back(s, chain);
+        return 1;
+    }
+    if (s->backend == LOG_SINK_URING) {
+        s->flying = chain;
+        if ((rc = queue_writev(s)) != 0) {
+            give_back(s, chain);
+            s->flying = NULL;
+        }
+        return rc;
+    }
+    rc = write_blocks(s);
+    give_back(s, chain);
+    return rc;
+}
+
+static void on_tick(EventLoop *loop, int fd, unsigned revents, void *data) {
+    LogSink *s = data;
+    uint64_t ticks;
+
+    if (read(fd, &ticks, sizeof(ticks)) == sizeof(ticks) && s->held > 0) {
+        start_flush(s);
+    }
+}
+
+int init_LogSink(LogSink *s, int fd, LogSinkBackend backend, EventLoop *loop) {
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->backend = backend;
+    s->loop = loop;
+    s->timer_fd = -1;
+    s->ring.fd = -1;
+    if (backend == LOG_SINK_URING && init_Uring(&s->ring, LOG_SINK_ENTRIES) != 0) {
+        s->backend = LOG_SINK_WRITEV;
+        s->ring.fd = -1;
+    }
+    if (loop != NULL) {
+        if ((s->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+                add_EventLoop(loop, s->timer_fd, POLLIN, on_tick, s) != 0) {
+            showError(false, "Cannot time log flushes: %s!", strerror(errno));
+            close_LogSink(s);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// a block with room for len more bytes at the tail
+static LogBlock *room_for(LogSink *s, size_t len) {
+    LogBlock *b = s->tail;
+
+    if (b != NULL && b->cap - b->len >= len) {
+        return b;
+    }
+    if (len <= LOG_SINK_BLOCK && s->spare != NULL) {
+        b = s->spare;
+        s->spare = b->next;
+    } else {
+        size_t cap = len > LOG_SINK_BLOCK ? len : LOG_SINK_BLOCK;
+        if ((b = malloc(sizeof(LogBlock) + cap)) == NULL) {
+            return NULL;
+        }
+        b->cap = cap;
+        b->len = 0;
+    }
+    b->next = NULL;
+    if (s->tail != NULL) {
+        s->tail->next = b;
+    } else {
+        s->head = b;
+    }
+    s->tail = b;
+    return b;
+}
+
+int putv_LogSink(LogSink *s, const struct iovec *parts, int n) {
+    size_t len = 0;
+    uint64_t now = now_ns();
+
+    if (s->err != 0) {
+        return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        len += parts[i].iov_len;
+    }
+    LogBlock *b = room_for(s, len);
+    if (b == NULL) {
+        return fail(s, ENOMEM);
+    }
+    for (int i = 0; i < n; i++) {
+        memcpy(b->data + b->len, parts[i].iov_base, parts[i].iov_len);
+        b->len += parts[i].iov_len;
+    }
+    int flush_ms = s->flush_ms > 0 ? s->flush_ms : LOG_SINK_FLUSH_MS;
+    if (s->held == 0) {
+        s->first_ns = now;
+        if (s->timer_fd >= 0) {
+            struct itimerspec its = {.it_value = {flush_ms / 1000, flush_ms % 1000 * 1000000}};
+            timerfd_settime(s->timer_fd, 0, &its, NULL);
+        }
+    }
+    s->held += len;
+    s->n_records++;
+    if (s->held >= (s->flush_bytes > 0 ? s->flush_bytes : LOG_SINK_FLUSH_BYTES) ||
+            now - s->first_ns >= (uint64_t)flush_ms * 1000000) {
+        return start_flush(s);
+    }
+    return 0;
+}
+
+int put_LogSink(LogSink *s, const char *rec, size_t len) {
+    struct iovec part = {(void *)rec, len};
+    return putv_LogSink(s, &part, 1);
+}
+
+void line_LogSink(ProcInfo *ci, const char *line, size_t len, void *data) {
+    struct iovec parts[2] = {{(void *)line, len}, {"\n", 1}};
+    putv_LogSink(data, parts, 2);
+}
+
+int flush_LogSink(LogSink *s) {
+    if (start_flush(s)) {
+        return 1;
+    }
+    return s->backend == LOG_SINK_URING ? land(s) : 0;
+}
+
+void close_LogSink(LogSink *s) {
+    if (s->err == 0) {
+        flush_LogSink(s);
+    }
+    give_back(s, s->head);
+    give_back(s, s->flying);
+    s->head = s->tail = s->flying = NULL;
+    while (s->spare != NULL) {
+        LogBlock *b = s->spare;
+        s->spare = b->next;
+        free(b);
+    }
+    if (s->timer_fd >= 0) {
+        del_EventLoop(s->loop, s->timer_fd);
+        close(s->timer_fd);
+        s->timer_fd = -1;
+    }
+    if (s->ring.fd >= 0) {
+        close_Uring(&s->ring);
+        s->ring.fd = -1;
+    }
+    free(s->iov);
+    s->iov = NULL;
+    s->n_iov = s->cap_iov = 0;
+}
@@ -0,0 +1,82 @@
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "uring.h"
+
+#define LOG_SINK_BLOCK (64 * 1024)          // buffer block; a bigger record gets a block of its own
+#define LOG_SINK_FLUSH_BYTES (256 * 1024)   // default: held bytes that trigger a flush
+#define LOG_SINK_FLUSH_MS 20                // default: the oldest held record waits no longer
+
+typedef enum {
+    LOG_SINK_WRITEV = 0,    // a flush is writev(2) calls, IOV_MAX blocks at a time
+    // a flush is an IORING_OP_WRITEV the caller doesn't wait for, reaped
+    // by the next one; LOG_SINK_WRITEV where io_uring is not to be had
+    LOG_SINK_URING
+} LogSinkBackend;
+
+typedef struct LogBlock {
+    struct LogBlock *next;
+    size_t len;
+    size_t cap;
+    char data[];
+} LogBlock;
+
+// gathers small records from many children's streams for one log fd, so
+// that a thousand lines cost one writev() instead of a thousand write()s.
+// Records are copied whole into LOG_SINK_BLOCK blocks, never split across
+// two, and a flush hands the kernel whole blocks: unless the kernel writes
+// short, every write ends on a record boundary, and on an O_APPEND fd no
+// other writer's data lands inside a record. A short write is finished
+// before anything else of the sink goes out. A flush happens once
+// flush_bytes are held, once the oldest record is flush_ms old (noticed on
+// the next put, or by a timer when the sink has a loop) and on flush/close
+typedef struct {
+    int fd;                     // caller's, the log
+    LogSinkBackend backend;
+    // input, set after init_LogSink(); 0 for the LOG_SINK_ defaults
+    size_t flush_bytes;
+    int flush_ms;
+    EventLoop *loop;            // caller's, NULL for none: no flush timer
+    int timer_fd;               // with loop: armed while records are held, else -1
+    LogBlock *head;             // held, oldest first
+    LogBlock *tail;
+    LogBlock *spare;            // emptied blocks, kept for reuse
+    size_t held;                // bytes in head..tail
+    uint64_t first_ns;          // CLOCK_MONOTONIC the oldest held record came in
+    // LOG_SINK_URING: the flush in flight and its iovecs
+    Uring ring;
+    LogBlock *flying;
+    struct iovec *iov;          // over the blocks being written
+    int n_iov;
+    int iov_at;                 // the first not completely written
+    int cap_iov;
+    int err;                    // errno of the first failed write, 0 if none
+    // counters
+    size_t n_records;
+    size_t n_flushes;
+    size_t n_syscalls;          // writev()s, or io_uring_enter()s
+    uint64_t n_bytes;           // written to fd
+} LogSink;
+
+// fd stays the caller's; loop may be NULL
+int init_LogSink(LogSink *s, int fd, LogSinkBackend backend, EventLoop *loop);
+// hold one record made of n parts (say a tag, the line and its '\n'); it
+// is written out whole. 1 if it could not be held, or an earlier write failed
+int putv_LogSink(LogSink *s, const struct iovec *parts, int n);
+int put_LogSink(LogSink *s, const char *rec, size_t len);
+// a LineCallback for LineWatcher, FileFollower and run_lines(): data is the
+// LogSink, and each line goes in as a record with its '\n' put back
+void line_LogSink(ProcInfo *ci, const char *line, size_t len, void *data);
+// write out everything held and wait for it; 0, or 1 with err set
+int flush_LogSink(LogSink *s);
+// flush_LogSink() and free the buffers; fd is left open
+void close_LogSink(LogSink *s);
+
+#endif // LOG_SINK_H
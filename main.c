@@ -1,247 +1,110 @@
 #include <stdio.h>
-#include <spawn.h>
 #include <unistd.h>
-#include <errno.h>
-#include <string.h>
-#include <stdarg.h>
 #include <poll.h>
 #include <sys/wait.h>
-#include <stdbool.h>
-#include <fcntl.h>
 
-typedef enum {
-    PROC_COM_INHERIT = 0,   // from parent
-    PROC_COM_NONE,          // use /dev/null
-    PROC_COM_PIPE,          // use pipe
-    PROC_COM_FD,            // use supplied fd for stdXX
-    PROC_COM_PATH,          // use supplied path for stdXX
-    PROC_COM_STDOUT         // same as stdout; used for stderr only!
-} ProcComType;
+#include "subprocess.h"
+#include "event_loop.h"
+#include "pipeline.h"
+#include "capture.h"
+#include "line_watch.h"
 
-typedef struct {
-    // input params
-    ProcComType stdin_type;
-    ProcComType stdout_type;
-    ProcComType stderr_type;
-    char* f_stdin;  // stdin file path
-    char* f_stdout; // stdout file path
-    char* f_stderr; // stderr file path
-    // input (PROC_COM_FD) and/or output (PROC_COM_PIPE)
-    int p_stdin;  // stdin pipe fd, negative if not used
-    int p_stdout; // stdout pipe fd, negative if not used
-    int p_stderr; // stderr pipe fd, negative if not used
-    // output params
-    pid_t pid;
-} ProcInfo;
+// line callback: print each line of a child's output as it arrives
+static void print_line(ProcInfo *ci, const char *line, size_t len, void *data) {
+  printf("-> %s: %.*s\n", (const char *)data, (int)len, line);
+}
 
-void showError(bool noop, char *fmt,...) {
-    va_list args;
+typedef struct {
+  ProcInfo ci;
+  size_t bytes;
+  bool done;
+} DemoChild;
 
-    fprintf(stderr, "ERROR: ");
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
-    if (fmt[strlen(fmt)-1] != '\n') {
-        fprintf(stderr, "\n");
+// event loop callback: count stdout bytes, reap on pidfd
+static void demo_on_event(EventLoop *loop, int fd, unsigned revents, void *data) {
+  DemoChild *dc = data;
+  char buffer[4096];
+  if (fd == dc->ci.p_stdout) {
+    ssize_t br = read(fd, buffer, sizeof(buffer));
+    if (br > 0) {
+      dc->bytes += br;
+    } else {
+      del_EventLoop(loop, fd);
     }
+  } else if (fd == dc->ci.pidfd) {
+    int exit_code;
+    waitpid(dc->ci.pid, &exit_code, 0);
+    del_EventLoop(loop, fd);
+    dc->done = true;
+  }
 }
 
-void close_ProcInfo(ProcInfo *ci) {
-    if (ci->p_stdin >= 0) {
-        close(ci->p_stdin);
-        ci->p_stdin = -1;
-    }
-    if (ci->p_stdout >= 0) {
-        close(ci->p_stdout);
-        ci->p_stdout = -1;
-    }
-    if (ci->p_stderr >= 0) {
-        close(ci->p_stderr);
-        ci->p_stderr = -1;
-    }
-    ci->pid = -1;
+// run a few children at once through each event loop backend
+static void demo_event_loop(EvLoopBackend backend) {
+  EventLoop loop;
+  DemoChild kids[3];
+  char* args[] = {"ls", "/bin", NULL};
+  if (init_EventLoop(&loop, backend)) {
+    return;
+  }
+  for (int i = 0; i < 3; i++) {
+    kids[i] = (DemoChild){.ci = {.p_stdin=-1, .p_stdout=-1, .p_stderr=-1,
+      .stdout_type=PROC_COM_PIPE}};
+    subprocess(&kids[i].ci, args, NULL);
+    watch_ProcInfo(&loop, &kids[i].ci, demo_on_event, &kids[i]);
+  }
+  while (loop.n_active > 0 && run_EventLoop(&loop, 1000) >= 0);
+  for (int i = 0; i < 3; i++) {
+    printf("event loop %d: child %d read %zu bytes\n", backend, i, kids[i].bytes);
+    unwatch_ProcInfo(&loop, &kids[i].ci);
+    close_ProcInfo(&kids[i].ci);
+  }
+  close_EventLoop(&loop);
 }
 
-// create a subprocess and execute it
-// args and env are char*[] with last element being NULL
-int subprocess(ProcInfo *ci, char* args[], char* env[]) {
-    int stdin_pipe[2], stdout_pipe[2], stderr_pipe[2];
-    int rc = 0;
-    posix_spawn_file_actions_t action;
-
-    posix_spawn_file_actions_init(&action);
-    switch (ci->stdin_type) {
-        case PROC_COM_PIPE:
-            if (pipe(stdin_pipe)) {
-                showError(false, "Failed to create stdin pipe for subprocess %s: %s!", args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            // on the child side
-            posix_spawn_file_actions_addclose(&action, stdin_pipe[1]); // the write end
-            posix_spawn_file_actions_adddup2(&action, stdin_pipe[0], STDIN_FILENO); // the read end
-            posix_spawn_file_actions_addclose(&action, stdin_pipe[0]);
-            break;
-        case PROC_COM_FD:
-            if (ci->p_stdin < 0) {
-                showError(false, "Invalid stdin fd (%d) for subprocess %s: %s!",
-                    ci->p_stdin, args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            posix_spawn_file_actions_adddup2(&action, ci->p_stdin, STDIN_FILENO);
-            if (ci->p_stdin != STDIN_FILENO) {
-              posix_spawn_file_actions_addclose(&action, ci->p_stdin);
-            }
-            break;
-        case PROC_COM_STDOUT:
-            showError(false, "Invalid pipe type (PROC_COM_STDOUT) for stdin!");
-            rc = 1;
-            goto clean_up;
-        case PROC_COM_PATH:
-            if (ci->f_stdin == NULL) {
-                showError(false, "Empty stdin path for subprocess %s: %s!", args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            posix_spawn_file_actions_addopen(&action, STDIN_FILENO, ci->f_stdin, O_RDONLY, 0644);
-            break;
-        case PROC_COM_NONE:
-            posix_spawn_file_actions_addclose(&action, STDIN_FILENO);
-            break;
-        case PROC_COM_INHERIT: // no-op
-            break;
-        default:
-            showError(false, "Unknown PipeType (%d) for stdin!", ci->stdin_type);
-            rc = 1;
-            goto clean_up;
-    }
-    switch (ci->stdout_type) {
-        case PROC_COM_PIPE:
-            if (pipe(stdout_pipe)) {
-                showError(false, "Failed to create stdout pipe for subprocess %s: %s!", args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            // on the child side
-            posix_spawn_file_actions_addclose(&action, stdout_pipe[0]); // the read end
-            posix_spawn_file_actions_adddup2(&action, stdout_pipe[1], STDOUT_FILENO); // the write end
-            posix_spawn_file_actions_addclose(&action, stdout_pipe[1]);
-            break;
-        case PROC_COM_STDOUT:
-            showError(false, "Invalid pipe type (PROC_COM_STDOUT) for stdout!");
-            rc = 1;
-            goto clean_up;
-        case PROC_COM_FD:
-            if (ci->p_stdout < 0) {
-                showError(false, "Invalid stdout fd (%d) for subprocess %s: %s!",
-                    ci->p_stdout, args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            posix_spawn_file_actions_adddup2(&action, ci->p_stdout, STDOUT_FILENO);
-            if (ci->p_stdout != STDOUT_FILENO) {
-              posix_spawn_file_actions_addclose(&action, ci->p_stdout);
-            }
-            break;
-        case PROC_COM_PATH:
-            if (ci->f_stdout == NULL) {
-                showError(false, "Empty stdout path for subprocess %s: %s!", args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            posix_spawn_file_actions_addopen(&action, STDOUT_FILENO, ci->f_stdout, O_CREAT|O_WRONLY|O_TRUNC, 0644);
-            break;
-        case PROC_COM_NONE:
-            posix_spawn_file_actions_addclose(&action, STDOUT_FILENO);
-            break;
-        case PROC_COM_INHERIT: // no-op
-            break;
-        default:
-            showError(false, "Unknown PipeType (%d) for stdout!", ci->stdout_type);
-            rc = 1;
-            goto clean_up;
-    }
-    switch (ci->stderr_type) {
-        case PROC_COM_PIPE:
-            if (pipe(stderr_pipe)) {
-                showError(false, "Failed to create stderr pipe for subprocess %s: %s!", args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            // on the child side
-            posix_spawn_file_actions_addclose(&action, stderr_pipe[0]); // the read end
-            posix_spawn_file_actions_adddup2(&action, stderr_pipe[1], STDERR_FILENO); // the write end
-            posix_spawn_file_actions_addclose(&action, stderr_pipe[1]);
-            break;
-        case PROC_COM_FD:
-            if (ci->p_stderr < 0) {
-                showError(false, "Invalid stderr fd (%d) for subprocess %s: %s!",
-                    ci->p_stderr, args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            posix_spawn_file_actions_adddup2(&action, ci->p_stderr, STDERR_FILENO);
-            if (ci->p_stderr != STDERR_FILENO) {
-              posix_spawn_file_actions_addclose(&action, ci->p_stderr);
-            }
-            break;
-        case PROC_COM_PATH:
-            if (ci->f_stderr == NULL) {
-                showError(false, "Empty stderr path for subprocess %s: %s!", args[0], strerror(errno));
-                rc = 1;
-                goto clean_up;
-            }
-            posix_spawn_file_actions_addopen(&action, STDERR_FILENO, ci->f_stderr, O_CREAT|O_WRONLY|O_TRUNC, 0644);
-            break;
-        case PROC_COM_STDOUT:
-            if (ci->stdout_type == PROC_COM_INHERIT) { // no-op
-                break;
-            } else if (ci->stdout_type != PROC_COM_NONE) {
-                posix_spawn_file_actions_adddup2(&action, STDOUT_FILENO, STDERR_FILENO);
-                break;
-            }
-            // fall thorugh for ci->stdout_type == PROC_COM_NONE
-        case PROC_COM_NONE:
-            posix_spawn_file_actions_addclose(&action, STDERR_FILENO);
-            break;
-        case PROC_COM_INHERIT: // no-op
-            break;
-        default:
-            showError(false, "Unknown PipeType (%d) for stderr!", ci->stderr_type);
-            rc = 1;
-            goto clean_up;
-    }
-
-    rc = posix_spawnp(&(ci->pid), args[0], &action, NULL, args, env);
-    if(rc != 0) {
-        showError(false, "Failed to spawn subprocess %s: %s!", args[0], strerror(errno));
-        goto clean_up;
-    }
-    // close child-side of pipes, and assign returned pipes
-    if (ci->stdin_type == PROC_COM_PIPE) {
-        close(stdin_pipe[0]); // the read end
-        ci->p_stdin = stdin_pipe[1]; // the write end
-    } else if (ci->stdin_type != PROC_COM_FD) {
-        ci->p_stdin = -1;
-    }
-    if (ci->stdout_type == PROC_COM_PIPE) {
-        close(stdout_pipe[1]); // the write end
-        ci->p_stdout = stdout_pipe[0]; // the read end
-    } else if (ci->stdin_type != PROC_COM_FD) {
-        ci->p_stdout = -1;
-    }
-    if (ci->stderr_type == PROC_COM_PIPE) {
-        close(stderr_pipe[1]); // the write end
-        ci->p_stderr = stderr_pipe[0]; // the read end
-    } else if (ci->stdin_type != PROC_COM_FD) {
-        // When PROC_COM_STDOUT is used, the caller should use just ci->p_stdout
-        ci->p_stderr = -1;
-    }
+// ls /bin | grep a | wc -l without any manual fd juggling
+static void demo_pipeline(void) {
+  Pipeline pl;
+  char* ls_args[] = {"ls", "/bin", NULL};
+  char* grep_args[] = {"grep", "a", NULL};
+  char* wc_args[] = {"wc", "-l", NULL};
+  char** argvs[] = {ls_args, grep_args, wc_args};
+  char buffer[128];
+  if (init_Pipeline(&pl, 3)) {
+    return;
+  }
+  pl.stages[2].stdout_type = PROC_COM_PIPE;
+  if (spawn_Pipeline(&pl, argvs, NULL) == 0) {
+    ssize_t br = read(pl.stages[2].p_stdout, buffer, sizeof(buffer)-1);
+    buffer[br > 0 ? br : 0] = '\0';
+    printf("pipeline output: %s", buffer);
+  }
+  printf("pipeline done %d\n", wait_Pipeline(&pl, NULL));
+  close_Pipeline(&pl);
+}
 
-clean_up:
-    posix_spawn_file_actions_destroy(&action);
-    return rc;
+// the same with grep and wc run in-process: only ls is spawned
+static void demo_builtin_pipeline(void) {
+  Pipeline pl;
+  BuiltinStage grep, wc;
+  char* ls_args[] = {"ls", "/bin", NULL};
+  char** argvs[] = {ls_args, NULL, NULL};
+  char buffer[128];
+  if (init_Pipeline(&pl, 3)) {
+    return;
+  }
+  grep_Builtin(&grep, "a", 0);
+  count_Builtin(&wc, BUILTIN_LINES);
+  pl.stages[2].stdout_type = PROC_COM_PIPE;
+  if (set_builtin_Pipeline(&pl, 1, &grep) == 0 && set_builtin_Pipeline(&pl, 2, &wc) == 0 &&
+      spawn_Pipeline(&pl, argvs, NULL) == 0) {
+    // the builtins run inside wait_Pipeline(); wc's one line fits the pipe
+    printf("builtin pipeline done %d\n", wait_Pipeline(&pl, NULL));
+    ssize_t br = read(pl.stages[2].p_stdout, buffer, sizeof(buffer)-1);
+    buffer[br > 0 ? br : 0] = '\0';
+    printf("builtin pipeline output: %s", buffer);
+  }
+  close_Pipeline(&pl);
 }
 
 int main(void) {
@@ -260,35 +123,44 @@ int main(void) {
   //printf("stdout fd: %d\n", ci.p_stdout);
   subprocess(&ci, args, NULL);
   char buffer[128];
-  struct pollfd plist[] = { {ci.p_stderr, POLLIN} };
+  // the pidfd becomes readable when ls exits, so completion shares the poll set
+  struct pollfd plist[] = { {ci.p_stderr, POLLIN}, {ci.pidfd, POLLIN} };
   int p_sz = sizeof(plist) / sizeof(struct pollfd);
   int br;
-  for (int rval; (rval=poll(plist, p_sz, -1)) > 0; ) {
+  for (int rval; (plist[0].fd >= 0 || plist[1].fd >= 0) &&
+      (rval=poll(plist, p_sz, -1)) > 0; ) {
     if (plist[0].revents & POLLIN) {
       br = read(ci.p_stderr, buffer, sizeof(buffer)-1);
       printf("-> read %d bytes from %s stderr:\n", br, args[0]);
       buffer[br] = '\0';
       printf("%s\n", buffer);
-    } else {
-      break; // nothing left to read
+    } else if (plist[0].revents) {
+      plist[0].fd = -1; // nothing left to read
+    }
+    if (plist[1].revents) {
+      plist[1].fd = -1; // ls has exited
     }
   }
-  waitpid(ci.pid, &exit_code, 0);
+  reap_ProcInfo(&ci, &exit_code, 0);
   printf("Done %d\n", exit_code);
+  printf("ls: %ld us user, %ld us sys, %ld KB max rss, %ld us wall\n",
+    ci.usage.ru_utime.tv_sec * 1000000L + ci.usage.ru_utime.tv_usec,
+    ci.usage.ru_stime.tv_sec * 1000000L + ci.usage.ru_stime.tv_usec,
+    ci.usage.ru_maxrss,
+    (ci.t_end.tv_sec - ci.t_start.tv_sec) * 1000000L + (ci.t_end.tv_nsec - ci.t_start.tv_nsec) / 1000);
   // close the stiin pipe to allow wc to end!
   close(ci2.p_stdin);
   ci2.p_stdin = -1;
-  struct pollfd plist2[] = { {ci2.p_stdout, POLLIN} };
-  int p2_sz = sizeof(plist2) / sizeof(struct pollfd);
-  for (int rval; (rval=poll(plist2, p2_sz, -1)) > 0; ) {
-    if (plist2[0].revents & POLLIN) {
-      int br = read(ci2.p_stdout, buffer, sizeof(buffer)-1);
-      printf("-> read %d bytes from %s stdout:\n", br, args2[0]);
-      buffer[br] = '\0';
-      printf("%s\n", buffer);
-    } else {
-      break; // nothing left to read
+  ci.p_stdout = -1; // the same fd, lent to ls: close_ProcInfo(&ci) must not close it again
+  // whole lines of wc's output, however the reads split them
+  EventLoop lines_loop;
+  LineWatcher lw;
+  if (init_EventLoop(&lines_loop, EVLOOP_EPOLL) == 0) {
+    if (watch_LineWatcher(&lw, &lines_loop, &ci2, print_line, NULL, args2[0]) == 0) {
+      while (!done_LineWatcher(&lw) && run_EventLoop(&lines_loop, -1) >= 0);
+      close_LineWatcher(&lw);
     }
+    close_EventLoop(&lines_loop);
   }
   waitpid(ci2.pid, &exit_code, 0);
   printf("Done2 %d\n", exit_code);
@@ -302,6 +174,21 @@ int main(void) {
   printf("Done3 %d\n", exit_code);
   close_ProcInfo(&ci3);
 
+  demo_pipeline();
+  demo_builtin_pipeline();
+  {
+    // collect all of ls's output in memory
+    ProcInfo cc = {.p_stdin=-1, .p_stdout=-1, .p_stderr=-1,
+      .stdout_type=PROC_COM_CAPTURE, .stderr_type=PROC_COM_CAPTURE};
+    CaptureResult res = {0};
+    run_and_capture(&cc, args, NULL, &res);
+    printf("captured %zu bytes of stdout, %zu of stderr, status %d\n",
+      res.out.len, res.err.len, res.status);
+    free_CaptureResult(&res);
+  }
+  demo_event_loop(EVLOOP_EPOLL);
+  demo_event_loop(EVLOOP_IO_URING);
+
   printf("snprintf: %d\n", snprintf(NULL, 0, "This is a test %d!", exit_code));
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,139 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "mem_budget.h"
+#include "memo.h"
+#include "subprocess.h"
+
+static uint64_t sig_of(char* args[], bool program_only) {
+    uint64_t h = program_only ? 1 : 2; // an argv never collides with its program
+    for (char **a = args; *a != NULL; a++) {
+        h = hash_bytes(*a, strlen(*a) + 1, h);
+        if (program_only) {
+            break;
+        }
+    }
+    return h != 0 ? h : 1;
+}
+
+static MemEstimate *find(const MemBudget *b, uint64_t sig) {
+    if (b->cap == 0) {
+        return NULL;
+    }
+    for (size_t i = sig & (b->cap - 1); b->table[i].sig != 0; i = (i + 1) & (b->cap - 1)) {
+        if (b->table[i].sig == sig) {
+            return &b->table[i];
+        }
+    }
+    return NULL;
+}
+
+static MemEstimate *insert(MemBudget *b, uint64_t sig) {
+    if ((b->n + 1) * 2 > b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : 256;
+        MemEstimate *t = calloc(cap, sizeof(MemEstimate));
+        if (t == NULL) {
+            return NULL;
+        }
+        for (size_t i = 0; i < b->cap; i++) {
+            if (b->table[i].sig != 0) {
+                size_t k = b->table[i].sig & (cap - 1);
+                while (t[k].sig != 0) {
+                    k = (k + 1) & (cap - 1);
+                }
+                t[k] = b->table[i];
+            }
+        }
+        free(b->table);
+        b->table = t;
+        b->cap = cap;
+    }
+    size_t k = sig & (b->cap - 1);
+    while (b->table[k].sig != 0) {
+        k = (k + 1) & (b->cap - 1);
+    }
+    b->table[k].sig = sig;
+    b->n++;
+    return &b->table[k];
+}
+
+static long mem_available_kb(void) {
+    char line[128];
+    long kb = -1;
+    FILE *f = fopen("/proc/meminfo", "re");
+
+    if (f == NULL) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "MemAvailable: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+int init_MemBudget(MemBudget *b, long limit_kb) {
+    memset(b, 0, sizeof(*b));
+    b->limit_kb = limit_kb > 0 ? limit_kb : mem_available_kb();
+    if (b->limit_kb <= 0) {
+        showError(false, "Failed to size the memory budget: no MemAvailable!");
+        return 1;
+    }
+    return 0;
+}
+
+void close_MemBudget(MemBudget *b) {
+    free(b->table);
+    memset(b, 0, sizeof(*b));
+}
+
+long estimate_MemBudget(const MemBudget *b, char* args[]) {
+    const MemEstimate *e = find(b, sig_of(args, false));
+    if (e == NULL) {
+        e = find(b, sig_of(args, true));
+    }
+    if (e != NULL) {
+        return e->peak_kb;
+    }
+    return b->default_kb > 0 ? b->default_kb : MEM_BUDGET_DEFAULT_KB;
+}
+
+static void learn(MemEstimate *e, long kb) {
+    if (e->runs++ == 0 || kb >= e->peak_kb) {
+        e->peak_kb = kb;
+    } else {
+        e->peak_kb -= (e->peak_kb - kb) / 4;
+    }
+}
+
+int record_MemBudget(MemBudget *b, char* args[], long maxrss_kb) {
+    for (int program = 0; program < 2; program++) {
+        uint64_t sig = sig_of(args, program);
+        MemEstimate *e = find(b, sig);
+        if (e == NULL && (e = insert(b, sig)) == NULL) {
+            return 1;
+        }
+        learn(e, maxrss_kb);
+    }
+    return 0;
+}
+
+bool acquire_MemBudget(MemBudget *b, long kb, bool force) {
+    if (!force && b->used_kb + kb > b->limit_kb) {
+        return false;
+    }
+    b->used_kb += kb;
+    return true;
+}
+
+void release_MemBudget(MemBudget *b, long kb) {
+    b->used_kb -= kb;
+}
+
+bool fits_MemBudget(const MemBudget *b, long kb) {
+    return b->used_kb + kb <= b->limit_kb;
+}
@@ -0,0 +1,44 @@
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEM_BUDGET_DEFAULT_KB (64 * 1024)   // estimate for a command never seen
+#define MEM_BUDGET_LOOKAHEAD 32             // queued jobs a runner looks past for one that fits
+
+typedef struct {
+    uint64_t sig;       // 0 for a free slot
+    long peak_kb;       // rolling estimate of the command's peak RSS
+    uint32_t runs;
+} MemEstimate;
+
+// admission by memory: every running child holds its command's estimated
+// peak RSS against limit_kb. Estimates are learnt from ru_maxrss at reap,
+// per argv and per program (argv[0]) for argvs not seen yet; a new peak is
+// taken as is, smaller ones pull the estimate down by a quarter of the gap
+// per run, so it errs high. One thread only
+typedef struct {
+    long limit_kb;
+    long used_kb;
+    long default_kb;    // for unknown programs; 0 means MEM_BUDGET_DEFAULT_KB
+    MemEstimate *table; // open addressing, at most half full
+    size_t cap;
+    size_t n;
+} MemBudget;
+
+// limit_kb <= 0 takes MemAvailable of /proc/meminfo
+int init_MemBudget(MemBudget *b, long limit_kb);
+void close_MemBudget(MemBudget *b);
+long estimate_MemBudget(const MemBudget *b, char* args[]);
+// learn a reaped run's ru_maxrss (kB)
+int record_MemBudget(MemBudget *b, char* args[], long maxrss_kb);
+// take kb if it fits, or unconditionally with force (a job bigger than the
+// whole budget runs alone); false without
+bool acquire_MemBudget(MemBudget *b, long kb, bool force);
+void release_MemBudget(MemBudget *b, long kb);
+// kb would be taken by acquire_MemBudget() without force
+bool fits_MemBudget(const MemBudget *b, long kb);
+
+#endif // MEM_BUDGET_H
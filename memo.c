@@ -0,0 +1,347 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include "memo.h"
+#include "path_cache.h"
+
+// what precedes the blob, stdout and stderr in a store file
+typedef struct {
+    uint32_t magic;
+    int32_t status;
+    uint64_t hash;
+    uint64_t input_hash;
+    uint64_t input_len;
+    uint64_t blob_len;
+    uint64_t out_len;
+    uint64_t err_len;
+} MemoHeader;
+
+// 8 bytes per step with a murmur3 finalizer; not cryptographic, the
+// blob is compared byte for byte on every hit anyway
+uint64_t hash_bytes(const char *p, size_t n, uint64_t seed) {
+    uint64_t h = seed ^ (n * 0x9e3779b97f4a7c15ull);
+    uint64_t v;
+
+    for (; n >= 8; p += 8, n -= 8) {
+        memcpy(&v, p, 8);
+        h ^= v * 0xc2b2ae3d27d4eb4full;
+        h = ((h << 31) | (h >> 33)) * 0x9e3779b97f4a7c15ull;
+    }
+    v = 0;
+    memcpy(&v, p, n);
+    h ^= v * 0xc2b2ae3d27d4eb4full;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    return h ^ (h >> 33);
+}
+
+static const char *env_value(char* env[], const char *key) {
+    size_t n = strlen(key);
+    for (char **e = env; e != NULL && *e != NULL; e++) {
+        if (strncmp(*e, key, n) == 0 && (*e)[n] == '=') {
+            return *e;
+        }
+    }
+    return NULL;
+}
+
+bool make_MemoKey(const MemoCache *m, MemoKey *k, char* args[], char* env[],
+        const char *input, size_t input_len) {
+    CaptureBuf b = {0};
+    char exe[PATH_MAX];
+    struct stat sb;
+    int fail = 0;
+
+    memset(k, 0, sizeof(*k));
+    if (strchr(args[0], '/') == NULL ? !resolve_path(args[0], exe, sizeof(exe)) :
+            snprintf(exe, sizeof(exe), "%s", args[0]) >= (int)sizeof(exe)) {
+        return false;
+    }
+    if (stat(exe, &sb) < 0) {
+        return false;
+    }
+    // a rebuilt or replaced executable gets a new key
+    uint64_t id[5] = {sb.st_dev, sb.st_ino, sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec, sb.st_size};
+    fail |= append_CaptureBuf(&b, (const char *)id, sizeof(id));
+    fail |= append_CaptureBuf(&b, exe, strlen(exe) + 1);
+    for (char **a = args; *a != NULL; a++) {
+        fail |= append_CaptureBuf(&b, *a, strlen(*a) + 1);
+    }
+    fail |= append_CaptureBuf(&b, "", 1); // end of argv
+    for (const char **key = m->env_keys; key != NULL && *key != NULL; key++) {
+        const char *v = env_value(env, *key);
+        fail |= append_CaptureBuf(&b, v ? "=" : "-", 1); // unset differs from empty
+        fail |= append_CaptureBuf(&b, v ? v : *key, strlen(v ? v : *key) + 1);
+    }
+    fail |= append_CaptureBuf(&b, input ? "<" : "-", 1); // no stdin differs from empty stdin
+    if (fail) {
+        free(b.data);
+        return false;
+    }
+    k->blob = b.data;
+    k->blob_len = b.len;
+    k->hash = hash_bytes(b.data, b.len, 0);
+    k->input_hash = hash_bytes(input ? input : "", input_len, k->hash);
+    k->input_len = input_len;
+    snprintf(k->name, sizeof(k->name), "%016llx%016llx",
+        (unsigned long long)k->hash, (unsigned long long)k->input_hash);
+    return true;
+}
+
+void free_MemoKey(MemoKey *k) {
+    free(k->blob);
+    k->blob = NULL;
+}
+
+static int open_entry(const MemoCache *m, const char *name, int flags) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", m->dir, name) >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return open(path, flags | O_CLOEXEC, 0644);
+}
+
+bool lookup_MemoCache(const MemoCache *m, const MemoKey *k, MemoEntry *e) {
+    struct stat sb;
+    MemoHeader h;
+
+    memset(e, 0, sizeof(*e));
+    int fd = open_entry(m, k->name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(h)) {
+        close(fd);
+        return false;
+    }
+    void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file
+    if (p == MAP_FAILED) {
+        return false;
+    }
+    e->map = p;
+    e->map_len = sb.st_size;
+    memcpy(&h, p, sizeof(h));
+    if (h.magic != MEMO_MAGIC || h.hash != k->hash || h.input_hash != k->input_hash ||
+            h.input_len != k->input_len || h.blob_len != k->blob_len ||
+            sizeof(h) + h.blob_len + h.out_len + h.err_len != (uint64_t)sb.st_size ||
+            memcmp((char *)p + sizeof(h), k->blob, k->blob_len) != 0) {
+        release_MemoEntry(e);
+        return false;
+    }
+    e->out = (char *)p + sizeof(h) + h.blob_len;
+    e->out_len = h.out_len;
+    e->err = e->out + h.out_len;
+    e->err_len = h.err_len;
+    e->status = h.status;
+    return true;
+}
+
+void release_MemoEntry(MemoEntry *e) {
+    if (e->map != NULL) {
+        munmap(e->map, e->map_len);
+    }
+    memset(e, 0, sizeof(*e));
+}
+
+int store_MemoCache(const MemoCache *m, const MemoKey *k, const CaptureResult *res) {
+    MemoHeader h = {.magic = MEMO_MAGIC, .status = res->status, .hash = k->hash,
+        .input_hash = k->input_hash, .input_len = k->input_len, .blob_len = k->blob_len,
+        .out_len = res->out.len, .err_len = res->err.len};
+    struct iovec iov[4] = {
+        {&h, sizeof(h)},
+        {k->blob, k->blob_len},
+        {res->out.data, res->out.len},
+        {res->err.data, res->err.len},
+    };
+    char tmp[PATH_MAX], path[PATH_MAX];
+    size_t total = sizeof(h) + k->blob_len + res->out.len + res->err.len;
+
+    if (snprintf(tmp, sizeof(tmp), "%s/.%s.XXXXXX", m->dir, k->name) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%s", m->dir, k->name);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        showError(false, "Failed to create memo entry in %s: %s!", m->dir, strerror(errno));
+        return -1;
+    }
+    // a written file is renamed into place, so readers never map a partial entry
+    ssize_t w = pwritev(fd, iov, 4, 0);
+    close(fd);
+    if (w != (ssize_t)total || rename(tmp, path) < 0) {
+        showError(false, "Failed to write memo entry %s!", path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// what an inputs file of the store holds
+typedef struct {
+    uint32_t magic;
+    uint32_t pad;
+    uint64_t key;
+    uint64_t fp;
+} InputsRecord;
+
+bool fingerprint_inputs(char* paths[], bool contents, uint64_t *fp) {
+    uint64_t h = 0;
+    struct stat sb;
+
+    for (char **p = paths; p != NULL && *p != NULL; p++) {
+        h = hash_bytes(*p, strlen(*p) + 1, h); // a renamed input is a change too
+        if (!contents) {
+            if (stat(*p, &sb) < 0) {
+                return false;
+            }
+            uint64_t id[5] = {sb.st_dev, sb.st_ino, sb.st_mtim.tv_sec, sb.st_mtim.tv_nsec, sb.st_size};
+            h = hash_bytes((const char *)id, sizeof(id), h);
+            continue;
+        }
+        int fd = open(*p, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fstat(fd, &sb) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return false;
+        }
+        void *m = sb.st_size > 0 ? mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+        close(fd);
+        if (m == MAP_FAILED) {
+            return false;
+        }
+        h = hash_bytes(m != NULL ? m : "", sb.st_size, h);
+        if (m != NULL) {
+            munmap(m, sb.st_size);
+        }
+    }
+    *fp = h;
+    return true;
+}
+
+bool lookup_inputs_MemoCache(const MemoCache *m, uint64_t key, uint64_t *fp) {
+    char name[24];
+    InputsRecord rec;
+
+    snprintf(name, sizeof(name), "%016llx.in", (unsigned long long)key);
+    int fd = open_entry(m, name, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    ssize_t n = pread(fd, &rec, sizeof(rec), 0);
+    close(fd);
+    if (n != sizeof(rec) || rec.magic != MEMO_INPUTS_MAGIC || rec.key != key) {
+        return false;
+    }
+    *fp = rec.fp;
+    return true;
+}
+
+int store_inputs_MemoCache(const MemoCache *m, uint64_t key, uint64_t fp) {
+    InputsRecord rec = {.magic = MEMO_INPUTS_MAGIC, .key = key, .fp = fp};
+    char tmp[PATH_MAX], path[PATH_MAX];
+
+    if (snprintf(tmp, sizeof(tmp), "%s/.%016llx.in.XXXXXX", m->dir, (unsigned long long)key) >= (int)sizeof(tmp)) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/%016llx.in", m->dir, (unsigned long long)key);
+    int fd = mkostemp(tmp, O_CLOEXEC);
+    if (fd < 0) {
+        showError(false, "Failed to create inputs entry in %s: %s!", m->dir, strerror(errno));
+        return -1;
+    }
+    ssize_t w = pwrite(fd, &rec, sizeof(rec), 0);
+    close(fd);
+    if (w != sizeof(rec) || rename(tmp, path) < 0) {
+        showError(false, "Failed to write inputs entry %s!", path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void replay(const MemoEntry *e, CaptureResult *res) {
+    reset_CaptureResult(res);
+    append_CaptureBuf(&res->out, e->out, e->out_len);
+    append_CaptureBuf(&res->err, e->err, e->err_len);
+    finish_CaptureBuf(&res->out);
+    finish_CaptureBuf(&res->err);
+    res->status = e->status;
+}
+
+static int input_memfd(const char *input, size_t len) {
+    int fd = memfd_create("memo-stdin", MFD_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t w = write(fd, input + off, len - off);
+        if (w < 0 && errno != EINTR) {
+            close(fd);
+            return -1;
+        }
+        off += w > 0 ? w : 0;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+int run_memoized(const MemoCache *m, ProcInfo *ci, char* args[], char* env[],
+        const char *input, size_t input_len, CaptureResult *res, bool *hit) {
+    MemoKey k;
+    MemoEntry e;
+    int in = -1, rc;
+
+    *hit = false;
+    bool keyed = make_MemoKey(m, &k, args, env, input, input_len);
+    if (keyed && lookup_MemoCache(m, &k, &e)) {
+        replay(&e, res);
+        release_MemoEntry(&e);
+        free_MemoKey(&k);
+        *hit = true;
+        return 0;
+    }
+    ci->stdout_type = PROC_COM_CAPTURE;
+    ci->stderr_type = PROC_COM_CAPTURE;
+    if (input != NULL) {
+        // a memfd can't fill up like a pipe, so nothing has to feed it
+        if ((in = input_memfd(input, input_len)) < 0) {
+            showError(false, "Failed to buffer stdin for %s: %s!", args[0], strerror(errno));
+            if (keyed) {
+                free_MemoKey(&k);
+            }
+            return 1;
+        }
+        ci->stdin_type = PROC_COM_FD;
+        ci->p_stdin = in;
+    } else {
+        ci->stdin_type = PROC_COM_NONE;
+    }
+    rc = run_and_capture(ci, args, env, res);
+    if (in >= 0 && ci->p_stdin == in) { // a failed spawn leaves it to us
+        close(in);
+        ci->p_stdin = -1;
+    }
+    if (keyed && rc == 0 && WIFEXITED(res->status) &&
+            res->out.total == res->out.len && res->err.total == res->err.len) {
+        store_MemoCache(m, &k, res);
+    }
+    if (keyed) {
+        free_MemoKey(&k);
+    }
+    return rc;
+}
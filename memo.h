@@ -0,0 +1,74 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess.h"
+#include "capture.h"
+
+#define MEMO_MAGIC 0x6f6d656d   // "memo"
+#define MEMO_INPUTS_MAGIC 0x74706e69 // "inpt"
+
+// opt-in memoization of deterministic commands: a run is keyed by its argv,
+// the env vars named in env_keys, the executable's identity (dev, inode,
+// mtime, size) and its stdin, and a repeat replays the stored stdout, stderr
+// and wait status instead of spawning. Anything else the command reads
+// (files named in argv, the cwd) is not part of the key.
+typedef struct {
+    const char *dir;            // content-addressed store: one file per key
+    const char **env_keys;      // NULL-terminated names hashed with their values, may be NULL
+} MemoCache;
+
+// a stored result, mapped read-only; out and err point into the mapping
+typedef struct {
+    void *map;
+    size_t map_len;
+    const char *out;
+    size_t out_len;
+    const char *err;
+    size_t err_len;
+    int status;                 // wait status of the run that was stored
+} MemoEntry;
+
+// the key of one command; its name in the store is hex of both hashes
+typedef struct {
+    char *blob;                 // argv, env and executable identity, stored for verification
+    size_t blob_len;
+    uint64_t hash;              // of blob
+    uint64_t input_hash;        // of stdin
+    size_t input_len;
+    char name[33];
+} MemoKey;
+
+// fast 64-bit hash of n bytes, not cryptographic
+uint64_t hash_bytes(const char *p, size_t n, uint64_t seed);
+
+// build the key; false if the executable can't be identified (not cacheable)
+bool make_MemoKey(const MemoCache *m, MemoKey *k, char* args[], char* env[],
+    const char *input, size_t input_len);
+void free_MemoKey(MemoKey *k);
+// map the entry for k; false on a miss or an entry that doesn't match k
+bool lookup_MemoCache(const MemoCache *m, const MemoKey *k, MemoEntry *e);
+void release_MemoEntry(MemoEntry *e);
+// store a finished run under k, atomically replacing an older entry; 0 or -1
+int store_MemoCache(const MemoCache *m, const MemoKey *k, const CaptureResult *res);
+
+// declared inputs, for incremental re-execution: the fingerprint of a set
+// of files is their (dev, inode, mtime, size), or with contents their
+// bytes; false if one of them can't be read
+bool fingerprint_inputs(char* paths[], bool contents, uint64_t *fp);
+// the fingerprint the last successful run under key saw, false if none
+bool lookup_inputs_MemoCache(const MemoCache *m, uint64_t key, uint64_t *fp);
+// record it after a success, atomically like store_MemoCache(); 0 or -1
+int store_inputs_MemoCache(const MemoCache *m, uint64_t key, uint64_t fp);
+
+// run_and_capture() through the cache: stdout and stderr are captured, stdin
+// is input (through a memfd) or /dev/null when input is NULL. Runs that
+// didn't exit normally or lost bytes to a capture limit are not stored.
+// *hit tells whether res was replayed; returns like run_and_capture()
+int run_memoized(const MemoCache *m, ProcInfo *ci, char* args[], char* env[],
+    const char *input, size_t input_len, CaptureResult *res, bool *hit);
+
+#endif // MEMO_H
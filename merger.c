@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "merger.h"
+
+static int open_spill(const Merger *m) {
+    const char *dir = m->opt.spill_dir;
+    char path[4096];
+
+    if (dir == NULL && (dir = getenv("TMPDIR")) == NULL) {
+        dir = "/tmp";
+    }
+    int fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0 && (errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL)) {
+        snprintf(path, sizeof(path), "%s/merge-XXXXXX", dir);
+        if ((fd = mkostemp(path, O_CLOEXEC)) >= 0) {
+            unlink(path);
+        }
+    }
+    if (fd < 0) {
+        showError(false, "Failed to create a merge spill file in %s: %s!", dir, strerror(errno));
+    }
+    return fd;
+}
+
+static int write_spill(MergeInput *in, const char *p, size_t len) {
+    if (in->spill < 0 && (in->spill = open_spill(in->m)) < 0) {
+        return 1;
+    }
+    for (size_t off = 0; off < len;) {
+        ssize_t n = write(in->spill, p + off, len - off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // what did go out stays there: keep the rest in memory, in order
+            showError(false, "Failed to spill merged output: %s!", strerror(errno));
+            return 1;
+        }
+        off += n;
+        in->m->spilled += n;
+    }
+    return 0;
+}
+
+// spill everything in held; false if it stays in memory
+static bool spill_held(MergeInput *in) {
+    Merger *m = in->m;
+
+    if (in->held.len == 0 || write_spill(in, in->held.data, in->held.len)) {
+        return false;
+    }
+    m->held -= in->held.len;
+    in->held.len = 0;
+    return true;
+}
+
+static void hold(MergeInput *in, const char *line, size_t len) {
+    Merger *m = in->m;
+    size_t limit = m->opt.mem_limit ? m->opt.mem_limit : MERGE_MEM_LIMIT;
+
+    if (m->held + len + 1 > limit) {
+        // with held empty, the line can go straight behind the spilled ones
+        spill_held(in);
+        if (in->held.len == 0 && write_spill(in, line, len) == 0 && write_spill(in, "\n", 1) == 0) {
+            return;
+        }
+    }
+    if (append_CaptureBuf(&in->held, line, len) || append_CaptureBuf(&in->held, "\n", 1)) {
+        showError(false, "Failed to hold merged output of input %d!", in->idx);
+        return;
+    }
+    m->held += len + 1;
+}
+
+// hand out the '\n'-terminated lines of p[0..len)
+static void emit_block(MergeInput *in, const char *p, size_t len) {
+    Merger *m = in->m;
+
+    while (len > 0) {
+        const char *nl = find_newline(p, len);
+        size_t n = nl != NULL ? (size_t)(nl - p) : len;
+        m->sink(m, in->idx, p, n, m->data);
+        n += nl != NULL;
+        p += n;
+        len -= n;
+    }
+}
+
+// in became the head: what it spilled first, then what it holds
+static void replay(MergeInput *in) {
+    Merger *m = in->m;
+
+    if (in->spill >= 0) {
+        size_t len;
+        const char *p = map_memfd(in->spill, &len);
+        emit_block(in, p, len);
+        unmap_memfd(p, len);
+        close(in->spill);
+        in->spill = -1;
+    }
+    emit_block(in, in->held.data, in->held.len);
+    m->held -= in->held.len;
+    free(in->held.data);
+    memset(&in->held, 0, sizeof(in->held));
+}
+
+static void advance(Merger *m) {
+    while (m->head < m->n && m->in[m->head].done) {
+        m->n_done++;
+        if (++m->head < m->n) {
+            replay(&m->in[m->head]);
+        }
+    }
+}
+
+static void take_line(MergeInput *in, const char *line, size_t len) {
+    Merger *m = in->m;
+
+    if (!m->opt.ordered || in->idx == m->head) {
+        m->sink(m, in->idx, line, len, m->data);
+    } else {
+        hold(in, line, len);
+    }
+}
+
+static void on_readable(EventLoop *loop, int fd, unsigned revents, void *data) {
+    MergeInput *in = data;
+    Merger *m = in->m;
+    const char *line;
+    size_t len;
+
+    ssize_t n = read_ChunkReader(&in->reader, fd);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    while (next_LineSplitter(&in->split, &line, &len)) {
+        take_line(in, line, len);
+    }
+    if (n > 0) {
+        return;
+    }
+    // EOF or a read error: the unterminated tail is a line too
+    if (rest_LineSplitter(&in->split, &line, &len)) {
+        take_line(in, line, len);
+    }
+    del_EventLoop(loop, fd);
+    in->fd = -1;
+    in->done = true;
+    if (m->opt.ordered) {
+        advance(m);
+    } else {
+        m->n_done++;
+    }
+}
+
+int init_Merger(Merger *m, int n, const MergeOptions *opt, MergeSink sink, void *data) {
+    memset(m, 0, sizeof(*m));
+    if (opt != NULL) {
+        m->opt = *opt;
+    }
+    m->sink = sink;
+    m->data = data;
+    m->n = n;
+    if ((m->in = calloc(n > 0 ? n : 1, sizeof(MergeInput))) == NULL) {
+        showError(false, "Failed to allocate %d merge inputs!", n);
+        return 1;
+    }
+    for (int i = 0; i < n; i++) {
+        MergeInput *in = &m->in[i];
+        in->m = m;
+        in->idx = i;
+        in->fd = in->spill = -1;
+        init_ChunkReader(&in->reader);
+        init_LineSplitter(&in->split, &in->reader);
+    }
+    return 0;
+}
+
+int add_Merger(Merger *m, EventLoop *loop, int i, int fd) {
+    if (i < 0 || i >= m->n || m->in[i].fd >= 0 || m->in[i].done) {
+        showError(false, "Merge input %d is out of range or already added!", i);
+        return 1;
+    }
+    if (add_EventLoop(loop, fd, POLLIN, on_readable, &m->in[i])) {
+        return 1;
+    }
+    m->loop = loop;
+    m->in[i].fd = fd;
+    return 0;
+}
+
+void close_Merger(Merger *m) {
+    for (int i = 0; i < m->n; i++) {
+        MergeInput *in = &m->in[i];
+        if (in->fd >= 0) {
+            del_EventLoop(m->loop, in->fd);
+        }
+        if (in->spill >= 0) {
+            close(in->spill);
+        }
+        free(in->held.data);
+        free_LineSplitter(&in->split);
+        free_ChunkReader(&in->reader);
+    }
+    free(m->in);
+    m->in = NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef MERGER_H
+#define MERGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "event_loop.h"
+#include "reader.h"
+#include "lines.h"
+#include "capture.h"
+
+#define MERGE_MEM_LIMIT (4 * 1024 * 1024)  // default bound on held lines
+
+typedef struct Merger Merger;
+
+// one whole line of input `input` without its '\n' (an unterminated last
+// line arrives like any other); only valid during the call
+typedef void (*MergeSink)(Merger *m, int input, const char *line, size_t len, void *data);
+
+typedef struct {
+    bool ordered;           // every line of input i before any of input i+1
+    size_t mem_limit;       // held bytes before spilling, 0 for MERGE_MEM_LIMIT
+    const char *spill_dir;  // NULL for $TMPDIR or /tmp
+} MergeOptions;
+
+typedef struct {
+    Merger *m;
+    int idx;
+    int fd;                 // -1 until added, and again at EOF
+    ChunkReader reader;
+    LineSplitter split;
+    CaptureBuf held;        // ordered: '\n'-terminated lines waiting their turn
+    int spill;              // older held lines, unlinked temp file; -1 if none
+    bool done;              // EOF seen, every line delivered or held
+} MergeInput;
+
+// fans the stdout of n children into one line stream for sink: lines never
+// interleave, and unordered lines go out as they complete. Ordered, the
+// lines of inputs behind the current one are held, and once all inputs hold
+// more than mem_limit the growing one is written out to its spill file, so
+// a slow early child costs disk rather than memory
+struct Merger {
+    MergeOptions opt;
+    MergeSink sink;
+    void *data;
+    EventLoop *loop;
+    MergeInput *in;
+    int n;
+    int head;               // ordered: the input being passed through
+    int n_done;             // inputs fully delivered
+    size_t held;            // bytes held across inputs
+    size_t spilled;         // bytes ever written to spill files
+};
+
+// opt may be NULL for unordered with the defaults
+int init_Merger(Merger *m, int n, const MergeOptions *opt, MergeSink sink, void *data);
+// read input i from fd (a child's p_stdout, kept open by the caller) until EOF
+int add_Merger(Merger *m, EventLoop *loop, int i, int fd);
+// every input reached EOF and every line went to the sink
+static inline bool done_Merger(const Merger *m) {
+    return m->n_done == m->n;
+}
+void close_Merger(Merger *m);
+
+#endif // MERGER_H
@@ -0,0 +1,337 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "metrics.h"
+
+typedef struct Shard {
+    MetricsSnapshot m;
+    struct Shard *prev;
+    struct Shard *next;
+} Shard;
+
+static bool metrics_on = false;
+static pthread_mutex_t shard_lock = PTHREAD_MUTEX_INITIALIZER;
+static Shard *shards;           // live threads
+static MetricsSnapshot retired; // folded in from exited threads
+static pthread_key_t shard_key;
+static pthread_once_t shard_once = PTHREAD_ONCE_INIT;
+static __thread Shard *mine;
+
+static const char *stage_names[METRICS_STAGES] = {
+    "none", "stream_type", "stream_path", "stream_fd", "pipe", "close_fds", "alloc",
+    "affinity", "exec", "cgroup", "sched", "server", "channel", "extra_fd", "admission", "pre_exec",
+    "preflight",
+};
+static const char *hist_names[METRIC_N_HISTS] = {
+    "spawn_latency", "first_byte", "runtime",
+};
+
+static void merge(MetricsSnapshot *to, const MetricsSnapshot *from) {
+    to->spawns += __atomic_load_n(&from->spawns, __ATOMIC_RELAXED);
+    to->reaped += __atomic_load_n(&from->reaped, __ATOMIC_RELAXED);
+    to->monitored += __atomic_load_n(&from->monitored, __ATOMIC_RELAXED);
+    to->monitored_rss_kb += __atomic_load_n(&from->monitored_rss_kb, __ATOMIC_RELAXED);
+    to->monitored_cpu_ns += __atomic_load_n(&from->monitored_cpu_ns, __ATOMIC_RELAXED);
+    for (int i = 0; i < METRICS_STAGES; i++) {
+        to->failures[i] += __atomic_load_n(&from->failures[i], __ATOMIC_RELAXED);
+    }
+    for (int i = 0; i < 3; i++) {
+        to->bytes_read[i] += __atomic_load_n(&from->bytes_read[i], __ATOMIC_RELAXED);
+        to->write_stalls[i] += __atomic_load_n(&from->write_stalls[i], __ATOMIC_RELAXED);
+        to->pipe_queued[i] += __atomic_load_n(&from->pipe_queued[i], __ATOMIC_RELAXED);
+        uint64_t max = __atomic_load_n(&from->pipe_queued_max[i], __ATOMIC_RELAXED);
+        to->pipe_queued_max[i] = max > to->pipe_queued_max[i] ? max : to->pipe_queued_max[i];
+    }
+    for (int i = 0; i < METRIC_N_HISTS; i++) {
+        const Histogram *f = &from->hist[i];
+        Histogram *t = &to->hist[i];
+        uint64_t max = __atomic_load_n(&f->max, __ATOMIC_RELAXED);
+        t->count += __atomic_load_n(&f->count, __ATOMIC_RELAXED);
+        t->sum += __atomic_load_n(&f->sum, __ATOMIC_RELAXED);
+        t->max = max > t->max ? max : t->max;
+        for (int b = 0; b < HIST_BUCKETS; b++) {
+            t->buckets[b] += __atomic_load_n(&f->buckets[b], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static void retire_shard(void *p) {
+    Shard *s = p;
+
+    pthread_mutex_lock(&shard_lock);
+    merge(&retired, &s->m);
+    if (s->prev != NULL) {
+        s->prev->next = s->next;
+    } else {
+        shards = s->next;
+    }
+    if (s->next != NULL) {
+        s->next->prev = s->prev;
+    }
+    pthread_mutex_unlock(&shard_lock);
+    free(s);
+    mine = NULL;
+}
+
+static void make_key(void) {
+    pthread_key_create(&shard_key, retire_shard);
+}
+
+static Shard *get_shard(void) {
+    if (mine != NULL) {
+        return mine;
+    }
+    pthread_once(&shard_once, make_key);
+    if ((mine = calloc(1, sizeof(*mine))) == NULL) {
+        return NULL; // this thread goes uncounted
+    }
+    pthread_mutex_lock(&shard_lock);
+    mine->next = shards;
+    if (shards != NULL) {
+        shards->prev = mine;
+    }
+    shards = mine;
+    pthread_mutex_unlock(&shard_lock);
+    pthread_setspecific(shard_key, mine);
+    return mine;
+}
+
+void enable_metrics(bool on) {
+    metrics_on = on;
+}
+
+bool metrics_enabled(void) {
+    return metrics_on;
+}
+
+// only the owning thread writes a shard: relaxed stores are enough for
+// snapshot_metrics() to read whole values
+static inline void bump(uint64_t *c, uint64_t n) {
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+static unsigned bucket_of(uint64_t v) {
+    if (v < (1u << HIST_SUB_BITS)) {
+        return v;
+    }
+    unsigned e = 63 - __builtin_clzll(v);
+    return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+        ((v >> (e - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1));
+}
+
+// smallest value of the next bucket
+static uint64_t bucket_end(unsigned b) {
+    b++;
+    if (b < (1u << HIST_SUB_BITS)) {
+        return b;
+    }
+    if (b >= HIST_BUCKETS) {
+        return UINT64_MAX;
+    }
+    unsigned e = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    uint64_t sub = b & ((1u << HIST_SUB_BITS) - 1);
+    return ((1ull << HIST_SUB_BITS) + sub) << (e - HIST_SUB_BITS);
+}
+
+static void record(MetricHist which, const struct timespec *from, const struct timespec *to) {
+    Shard *s = get_shard();
+    int64_t ns = (to->tv_sec - from->tv_sec) * 1000000000ll + (to->tv_nsec - from->tv_nsec);
+
+    if (s == NULL) {
+        return;
+    }
+    Histogram *h = &s->m.hist[which];
+    uint64_t v = ns > 0 ? ns : 0;
+    bump(&h->count, 1);
+    bump(&h->sum, v);
+    bump(&h->buckets[bucket_of(v)], 1);
+    if (v > h->max) {
+        __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+    }
+}
+
+void metrics_spawned(const ProcInfo *ci) {
+    struct timespec now;
+    Shard *s;
+
+    if (!metrics_on || (s = get_shard()) == NULL) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    bump(&s->m.spawns, 1);
+    record(METRIC_SPAWN_LATENCY, &ci->t_start, &now);
+}
+
+void metrics_failed(SpawnStage stage) {
+    Shard *s;
+
+    if (!metrics_on || (unsigned)stage >= METRICS_STAGES || (s = get_shard()) == NULL) {
+        return;
+    }
+    bump(&s->m.failures[stage], 1);
+}
+
+void metrics_read(const ProcInfo *ci, int stream, size_t n, bool first) {
+    Shard *s;
+
+    if (!metrics_on || stream < 0 || stream > 2 || (s = get_shard()) == NULL) {
+        return;
+    }
+    bump(&s->m.bytes_read[stream], n);
+    if (first) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        record(METRIC_FIRST_BYTE, &ci->t_start, &now);
+    }
+}
+
+void metrics_reaped(const ProcInfo *ci) {
+    Shard *s;
+
+    if (!metrics_on || (s = get_shard()) == NULL) {
+        return;
+    }
+    bump(&s->m.reaped, 1);
+    record(METRIC_RUNTIME, &ci->t_start, &ci->t_end);
+}
+
+void metrics_sampled(uint64_t children, uint64_t rss_kb, uint64_t cpu_ns) {
+    Shard *s;
+
+    if (!metrics_on || (s = mine != NULL ? mine : children > 0 ? get_shard() : NULL) == NULL) {
+        return;
+    }
+    __atomic_store_n(&s->m.monitored, children, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->m.monitored_rss_kb, rss_kb, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->m.monitored_cpu_ns, cpu_ns, __ATOMIC_RELAXED);
+}
+
+void metrics_write_stalled(int stream) {
+    Shard *s;
+
+    if (!metrics_on || stream < 0 || stream > 2 || (s = get_shard()) == NULL) {
+        return;
+    }
+    bump(&s->m.write_stalls[stream], 1);
+}
+
+void metrics_piped(const uint64_t queued[3], const uint64_t queued_max[3]) {
+    Shard *s;
+
+    if (!metrics_on || (s = get_shard()) == NULL) {
+        return;
+    }
+    for (int i = 0; i < 3; i++) {
+        __atomic_store_n(&s->m.pipe_queued[i], queued[i], __ATOMIC_RELAXED);
+        __atomic_store_n(&s->m.pipe_queued_max[i], queued_max[i], __ATOMIC_RELAXED);
+    }
+}
+
+void snapshot_metrics(MetricsSnapshot *s) {
+    memset(s, 0, sizeof(*s));
+    pthread_mutex_lock(&shard_lock);
+    merge(s, &retired);
+    for (Shard *sh = shards; sh != NULL; sh = sh->next) {
+        merge(s, &sh->m);
+    }
+    pthread_mutex_unlock(&shard_lock);
+}
+
+uint64_t percentile_Histogram(const Histogram *h, double q) {
+    uint64_t want = q * h->count, seen = 0;
+
+    if (h->count == 0) {
+        return 0;
+    }
+    for (unsigned b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > want || seen == h->count) {
+            uint64_t end = bucket_end(b) - 1;
+            return end < h->max ? end : h->max;
+        }
+    }
+    return h->max;
+}
+
+static void put(char *buf, size_t len, size_t *off, const char *fmt, ...) {
+    va_list args;
+    size_t at = *off < len ? *off : len;
+
+    va_start(args, fmt);
+    int n = vsnprintf(buf + at, len - at, fmt, args);
+    va_end(args);
+    *off += n > 0 ? n : 0;
+}
+
+size_t format_metrics_prometheus(const MetricsSnapshot *s, const char *prefix, char *buf, size_t len) {
+    static const char *streams[3] = {"stdin", "stdout", "stderr"};
+    const char *p = prefix != NULL ? prefix : "subprocess";
+    size_t off = 0;
+
+    if (len > 0) {
+        buf[0] = '\0';
+    }
+    put(buf, len, &off, "# TYPE %s_spawns_total counter\n%s_spawns_total %llu\n",
+        p, p, (unsigned long long)s->spawns);
+    put(buf, len, &off, "# TYPE %s_spawn_failures_total counter\n", p);
+    for (int i = 1; i < METRICS_STAGES; i++) {
+        put(buf, len, &off, "%s_spawn_failures_total{stage=\"%s\"} %llu\n",
+            p, stage_names[i], (unsigned long long)s->failures[i]);
+    }
+    put(buf, len, &off, "# TYPE %s_bytes_read_total counter\n", p);
+    for (int i = 1; i < 3; i++) {
+        put(buf, len, &off, "%s_bytes_read_total{stream=\"%s\"} %llu\n",
+            p, streams[i], (unsigned long long)s->bytes_read[i]);
+    }
+    put(buf, len, &off, "# TYPE %s_write_stalls_total counter\n", p);
+    for (int i = 0; i < 3; i++) {
+        put(buf, len, &off, "%s_write_stalls_total{stream=\"%s\"} %llu\n",
+            p, streams[i], (unsigned long long)s->write_stalls[i]);
+    }
+    put(buf, len, &off, "# TYPE %s_pipe_queued_bytes gauge\n", p);
+    for (int i = 0; i < 3; i++) {
+        put(buf, len, &off, "%s_pipe_queued_bytes{stream=\"%s\"} %llu\n",
+            p, streams[i], (unsigned long long)s->pipe_queued[i]);
+    }
+    put(buf, len, &off, "# TYPE %s_pipe_queued_max_bytes gauge\n", p);
+    for (int i = 0; i < 3; i++) {
+        put(buf, len, &off, "%s_pipe_queued_max_bytes{stream=\"%s\"} %llu\n",
+            p, streams[i], (unsigned long long)s->pipe_queued_max[i]);
+    }
+    put(buf, len, &off, "# TYPE %s_reaped_total counter\n%s_reaped_total %llu\n",
+        p, p, (unsigned long long)s->reaped);
+    put(buf, len, &off, "# TYPE %s_monitored gauge\n%s_monitored %llu\n",
+        p, p, (unsigned long long)s->monitored);
+    put(buf, len, &off, "# TYPE %s_monitored_rss_bytes gauge\n%s_monitored_rss_bytes %llu\n",
+        p, p, (unsigned long long)s->monitored_rss_kb * 1024);
+    put(buf, len, &off, "# TYPE %s_monitored_cpu_seconds gauge\n%s_monitored_cpu_seconds %.3f\n",
+        p, p, s->monitored_cpu_ns / 1e9);
+    // fixed powers of four from ~1us to ~69s, on bucket edges: each count is
+    // of the samples below le, so one of exactly le ns (which Prometheus puts
+    // in le) is counted in the next bound up; off at the edges only
+    for (int i = 0; i < METRIC_N_HISTS; i++) {
+        const Histogram *h = &s->hist[i];
+        const char *n = hist_names[i];
+        unsigned b = 0;
+        uint64_t cum = 0;
+
+        put(buf, len, &off, "# TYPE %s_%s_seconds histogram\n", p, n);
+        for (int k = 10; k <= 36; k += 2) {
+            uint64_t le = 1ull << k;
+            for (; b < HIST_BUCKETS && bucket_end(b) <= le; b++) {
+                cum += h->buckets[b];
+            }
+            put(buf, len, &off, "%s_%s_seconds_bucket{le=\"%.9g\"} %llu\n",
+                p, n, le / 1e9, (unsigned long long)cum);
+        }
+        put(buf, len, &off, "%s_%s_seconds_bucket{le=\"+Inf\"} %llu\n",
+            p, n, (unsigned long long)h->count);
+        put(buf, len, &off, "%s_%s_seconds_sum %.9f\n%s_%s_seconds_count %llu\n",
+            p, n, h->sum / 1e9, p, n, (unsigned long long)h->count);
+    }
+    return off;
+}
@@ -0,0 +1,75 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "subprocess.h"
+
+#define HIST_SUB_BITS 3                             // 8 buckets per power of two: <= 12.5% error
+#define HIST_BUCKETS ((64 - 2) << HIST_SUB_BITS)    // covers every uint64_t
+#define METRICS_STAGES (SPAWN_STAGE_PREFLIGHT + 1)
+
+// log-linear (HDR style) histogram of nanoseconds
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} Histogram;
+
+typedef enum {
+    METRIC_SPAWN_LATENCY = 0,   // t_start until posix_spawn has returned and fds are set up
+    METRIC_FIRST_BYTE,          // t_start until the first captured byte
+    METRIC_RUNTIME,             // t_start until reap_ProcInfo()
+    METRIC_N_HISTS
+} MetricHist;
+
+// totals over every thread, from snapshot_metrics()
+typedef struct {
+    uint64_t spawns;                    // children started
+    uint64_t failures[METRICS_STAGES];  // reported SpawnErrors by stage
+    uint64_t bytes_read[3];             // by STDIN_FILENO.., captured by the library's loops
+    uint64_t reaped;
+    Histogram hist[METRIC_N_HISTS];
+    // gauges of the last ProcMonitor round, summed over the monitors
+    uint64_t monitored;                 // live children sampled
+    uint64_t monitored_rss_kb;
+    uint64_t monitored_cpu_ns;
+    // backpressure, by STDIN_FILENO..: writes that found a pipe full, and
+    // the bytes queued in the pipes at each event loop's last sample
+    uint64_t write_stalls[3];
+    uint64_t pipe_queued[3];            // summed over the pipes
+    uint64_t pipe_queued_max[3];        // in the fullest one
+} MetricsSnapshot;
+
+// off by default; every hook is one branch while disabled. Each thread
+// records into its own shard, so spawner threads never share a cache line;
+// a thread's shard is folded into the totals when it exits
+void enable_metrics(bool on);
+bool metrics_enabled(void);
+
+// hooks, called by subprocess.c and capture.c; for loops of your own
+void metrics_spawned(const ProcInfo *ci);
+void metrics_failed(SpawnStage stage);
+void metrics_read(const ProcInfo *ci, int stream, size_t n, bool first);
+void metrics_reaped(const ProcInfo *ci);
+// set this thread's monitor gauges (see monitor.h), not added to them
+void metrics_sampled(uint64_t children, uint64_t rss_kb, uint64_t cpu_ns);
+// a write into a stream of a child hit EAGAIN
+void metrics_write_stalled(int stream);
+// set this thread's pipe gauges (see EventLoop.sample_ms), not added to them
+void metrics_piped(const uint64_t queued[3], const uint64_t queued_max[3]);
+
+// sum every shard; concurrent writers may be mid-update, so counts can be
+// off by the few events in flight, never torn
+void snapshot_metrics(MetricsSnapshot *s);
+// value (ns, a bucket's upper edge) below which q (0..1) of the samples fall
+uint64_t percentile_Histogram(const Histogram *h, double q);
+// Prometheus text exposition of s, with names prefixed by prefix ("subprocess"
+// when NULL); returns the length snprintf-style, so a short buf can be retried
+size_t format_metrics_prometheus(const MetricsSnapshot *s, const char *prefix, char *buf, size_t len);
+
+#endif // METRICS_H
@@ -0,0 +1,224 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#include "monitor.h"
+#include "metrics.h"
+
+static void close_entry(MonitorEntry *e) {
+    close(e->stat_fd);
+    close(e->statm_fd);
+}
+
+// fill s from the two files; false once the child is gone (reaped)
+static bool sample(ProcMonitor *m, MonitorEntry *e, ProcSample *s) {
+    char buf[1024];
+    unsigned long utime, stime, vm_pages, rss_pages;
+    int threads;
+    char state;
+
+    ssize_t n = pread(e->stat_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    // comm may hold spaces and parens: the fields start after the last ')'
+    char *p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %d",
+            &state, &utime, &stime, &threads) != 4) {
+        return false;
+    }
+    n = pread(e->statm_fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    if (sscanf(buf, "%lu %lu", &vm_pages, &rss_pages) != 2) {
+        return false;
+    }
+    s->pid = e->pid;
+    s->state = state;
+    s->threads = threads;
+    s->cpu_ns = (uint64_t)(utime + stime) * 1000000000 / m->ticks;
+    s->vm_kb = vm_pages * m->page_kb;
+    s->rss_kb = rss_pages * m->page_kb;
+    clock_gettime(CLOCK_MONOTONIC, &s->at);
+    s->cpu_permille = 0;
+    if (e->sampled) {
+        int64_t dt = (s->at.tv_sec - e->last.at.tv_sec) * 1000000000ll + (s->at.tv_nsec - e->last.at.tv_nsec);
+        if (dt > 0 && s->cpu_ns >= e->last.cpu_ns) {
+            s->cpu_permille = (s->cpu_ns - e->last.cpu_ns) * 1000 / dt;
+        }
+    }
+    return true;
+}
+
+static void sample_all(ProcMonitor *m) {
+    uint64_t rss_kb = 0, cpu_ns = 0;
+    size_t live = 0;
+
+    pthread_mutex_lock(&m->lock);
+    for (size_t i = 0; i < m->n; ) {
+        MonitorEntry *e = &m->entries[i];
+        ProcSample s;
+        if (!sample(m, e, &s)) { // reaped without being removed
+            close_entry(e);
+            m->entries[i] = m->entries[--m->n];
+            continue;
+        }
+        e->last = s;
+        e->sampled = true;
+        rss_kb += s.rss_kb;
+        cpu_ns += s.cpu_ns;
+        live++;
+        if (m->on_sample != NULL) {
+            m->on_sample(&s, m->data);
+        }
+        i++;
+    }
+    m->rounds++;
+    pthread_mutex_unlock(&m->lock);
+    metrics_sampled(live, rss_kb, cpu_ns);
+}
+
+static void *monitor_main(void *arg) {
+    ProcMonitor *m = arg;
+
+    pthread_mutex_lock(&m->lock);
+    while (!m->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += m->interval_ms / 1000;
+        until.tv_nsec += (long)(m->interval_ms % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&m->wake, &m->lock, &until) == ETIMEDOUT && !m->stop) {
+            pthread_mutex_unlock(&m->lock);
+            sample_all(m);
+            pthread_mutex_lock(&m->lock);
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    metrics_sampled(0, 0, 0); // this thread's gauges outlive it otherwise
+    return NULL;
+}
+
+int init_ProcMonitor(ProcMonitor *m, int interval_ms, ProcSampled on_sample, void *data) {
+    memset(m, 0, sizeof(*m));
+    m->interval_ms = interval_ms > 0 ? interval_ms : MONITOR_INTERVAL_MS;
+    m->on_sample = on_sample;
+    m->data = data;
+    m->ticks = sysconf(_SC_CLK_TCK);
+    m->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+    if (m->ticks <= 0) {
+        m->ticks = 100;
+    }
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->wake, NULL);
+    if (pthread_create(&m->tid, NULL, monitor_main, m) != 0) {
+        showError(false, "Failed to start the monitor thread!");
+        pthread_cond_destroy(&m->wake);
+        pthread_mutex_destroy(&m->lock);
+        return 1;
+    }
+    return 0;
+}
+
+void close_ProcMonitor(ProcMonitor *m) {
+    pthread_mutex_lock(&m->lock);
+    m->stop = true;
+    pthread_cond_signal(&m->wake);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->tid, NULL);
+    for (size_t i = 0; i < m->n; i++) {
+        close_entry(&m->entries[i]);
+    }
+    free(m->entries);
+    m->entries = NULL;
+    m->n = m->cap = 0;
+    pthread_cond_destroy(&m->wake);
+    pthread_mutex_destroy(&m->lock);
+}
+
+int add_ProcMonitor(ProcMonitor *m, const ProcInfo *ci) {
+    char path[32];
+    MonitorEntry e = {.pid = ci->pid};
+
+    if (ci->pidfd < 0) {
+        showError(false, "Monitoring subprocess %d needs its pidfd!", ci->pid);
+        return 1;
+    }
+    snprintf(path, sizeof(path), "/proc/%d", ci->pid);
+    int dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0) {
+        return 1;
+    }
+    // the directory is bound to whoever had the pid when it was opened: if
+    // our child can still take a signal, that was our child
+    if (syscall(SYS_pidfd_send_signal, ci->pidfd, 0, NULL, 0) < 0) {
+        close(dir);
+        return 1;
+    }
+    e.stat_fd = openat(dir, "stat", O_RDONLY | O_CLOEXEC);
+    e.statm_fd = openat(dir, "statm", O_RDONLY | O_CLOEXEC);
+    close(dir);
+    if (e.stat_fd < 0 || e.statm_fd < 0) {
+        showError(false, "Failed to open /proc files of subprocess %d: %s!", ci->pid, strerror(errno));
+        if (e.stat_fd >= 0) {
+            close(e.stat_fd);
+        }
+        if (e.statm_fd >= 0) {
+            close(e.statm_fd);
+        }
+        return 1;
+    }
+    pthread_mutex_lock(&m->lock);
+    if (m->n == m->cap) {
+        size_t cap = m->cap ? m->cap * 2 : 64;
+        MonitorEntry *t = realloc(m->entries, cap * sizeof(MonitorEntry));
+        if (t == NULL) {
+            pthread_mutex_unlock(&m->lock);
+            close_entry(&e);
+            return 1;
+        }
+        m->entries = t;
+        m->cap = cap;
+    }
+    m->entries[m->n++] = e;
+    pthread_mutex_unlock(&m->lock);
+    return 0;
+}
+
+void remove_ProcMonitor(ProcMonitor *m, pid_t pid) {
+    pthread_mutex_lock(&m->lock);
+    for (size_t i = 0; i < m->n; i++) {
+        if (m->entries[i].pid == pid) {
+            close_entry(&m->entries[i]);
+            m->entries[i] = m->entries[--m->n];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+bool last_ProcMonitor(ProcMonitor *m, pid_t pid, ProcSample *out) {
+    bool found = false;
+
+    pthread_mutex_lock(&m->lock);
+    for (size_t i = 0; i < m->n; i++) {
+        if (m->entries[i].pid == pid && m->entries[i].sampled) {
+            *out = m->entries[i].last;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+    return found;
+}
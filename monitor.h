@@ -0,0 +1,68 @@
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "subprocess.h"
+
+#define MONITOR_INTERVAL_MS 1000    // default sampling period
+
+// one look at a live child
+typedef struct {
+    pid_t pid;
+    char state;             // R, S, D, Z, ... from /proc/<pid>/stat
+    int threads;
+    uint64_t cpu_ns;        // user plus system time so far
+    uint32_t cpu_permille;  // since the previous sample, 1000 per busy core
+    uint64_t rss_kb;        // resident, from statm
+    uint64_t vm_kb;         // virtual size, from statm
+    struct timespec at;     // CLOCK_MONOTONIC
+} ProcSample;
+
+// runs on the monitor thread after each sample, must not call back into it
+typedef void (*ProcSampled)(const ProcSample *s, void *data);
+
+typedef struct {
+    pid_t pid;
+    int stat_fd;            // /proc/<pid>/stat, opened once
+    int statm_fd;
+    ProcSample last;
+    bool sampled;
+} MonitorEntry;
+
+// samples the CPU and memory of every added child from its own thread:
+// /proc/<pid>/stat and statm are opened once per child (checked against its
+// pidfd, so a reused pid is never picked up) and pread() every interval_ms,
+// so 10k children cost no path lookups, just two fds each. The totals of the
+// last round go to the metrics gauges. Thread-safe
+typedef struct {
+    int interval_ms;        // input
+    ProcSampled on_sample;  // input, NULL for none
+    void *data;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t tid;
+    MonitorEntry *entries;
+    size_t n;
+    size_t cap;
+    size_t rounds;
+    bool stop;
+    long ticks;             // sysconf(_SC_CLK_TCK)
+    long page_kb;
+} ProcMonitor;
+
+// interval_ms <= 0 uses MONITOR_INTERVAL_MS; starts the thread
+int init_ProcMonitor(ProcMonitor *m, int interval_ms, ProcSampled on_sample, void *data);
+void close_ProcMonitor(ProcMonitor *m);
+// start sampling ci's child, which needs a pidfd; 1 if it is gone already
+int add_ProcMonitor(ProcMonitor *m, const ProcInfo *ci);
+// stop sampling pid, at the latest before reaping it
+void remove_ProcMonitor(ProcMonitor *m, pid_t pid);
+// the latest sample of pid; false if there is none yet
+bool last_ProcMonitor(ProcMonitor *m, pid_t pid, ProcSample *out);
+
+#endif // MONITOR_H
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "ns_pool.h"
+
+#define NS_HELPER_STACK (16 * 1024)
+
+static const struct {
+    int flag;
+    const char *name;
+} kinds[NS_MAX_KINDS] = {
+    {CLONE_NEWUSER, "user"}, {CLONE_NEWNS, "mnt"}, {CLONE_NEWNET, "net"},
+    {CLONE_NEWIPC, "ipc"}, {CLONE_NEWUTS, "uts"}, {CLONE_NEWCGROUP, "cgroup"},
+};
+
+static void close_set(NsSet *s) {
+    for (int i = 0; i < s->n; i++) {
+        close(s->fds[i]);
+    }
+    s->n = 0;
+}
+
+// the helper only waits for the parent to let it go
+static int helper_main(void *arg) {
+    int *fd = arg;
+    char c;
+
+    while (read(*fd, &c, 1) < 0 && errno == EINTR);
+    _exit(0);
+}
+
+static int make_set(NsPool *p, NsSet *s) {
+    static __thread char *stack;
+    char path[64];
+    int gate[2], rc = 0;
+
+    memset(s, 0, sizeof(*s));
+    if (stack == NULL && (stack = aligned_alloc(16, NS_HELPER_STACK)) == NULL) {
+        return 1;
+    }
+    if (pipe2(gate, O_CLOEXEC)) {
+        showError(false, "Failed to create namespace helper pipe: %s!", strerror(errno));
+        return 1;
+    }
+    // CLONE_VM: nothing is copied, the helper runs on its own stack
+    pid_t pid = clone(helper_main, stack + NS_HELPER_STACK, CLONE_VM | SIGCHLD | p->flags, &gate[0]);
+    if (pid < 0) {
+        showError(false, "Failed to create namespaces: %s!", strerror(errno));
+        close(gate[0]);
+        close(gate[1]);
+        return 1;
+    }
+    for (int i = 0; i < NS_MAX_KINDS && rc == 0; i++) {
+        if (!(p->flags & kinds[i].flag)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/proc/%d/ns/%s", pid, kinds[i].name);
+        if ((s->fds[s->n] = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+            showError(false, "Failed to open %s: %s!", path, strerror(errno));
+            rc = 1;
+        } else {
+            s->n++;
+        }
+    }
+    if (rc == 0 && p->prepare != NULL && p->prepare(pid, p->data) != 0) {
+        rc = 1;
+    }
+    // the helper holds its own copy of both ends, so EOF never comes
+    while (write(gate[1], "", 1) < 0 && errno == EINTR);
+    close(gate[1]);
+    close(gate[0]);
+    waitpid(pid, NULL, 0); // the fds keep the namespaces alive without it
+    if (rc != 0) {
+        close_set(s);
+    }
+    return rc;
+}
+
+int init_NsPool(NsPool *p, int flags, int target, int max_uses, NsPrepare prepare, void *data) {
+    int known = 0;
+
+    memset(p, 0, sizeof(*p));
+    for (int i = 0; i < NS_MAX_KINDS; i++) {
+        known |= kinds[i].flag;
+    }
+    if (flags == 0 || (flags & ~known)) {
+        showError(false, "Namespace pool flags %#x are empty or not supported!", flags);
+        return 1;
+    }
+    p->flags = flags;
+    p->target = target > 0 ? target : 1;
+    p->max_uses = max_uses;
+    p->prepare = prepare;
+    p->data = data;
+    if ((p->free = calloc(p->target, sizeof(NsSet))) == NULL) {
+        showError(false, "Failed to allocate a pool of %d namespace sets!", p->target);
+        return 1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    return fill_NsPool(p) > 0 ? 0 : 1;
+}
+
+int fill_NsPool(NsPool *p) {
+    int made = 0;
+
+    for (;;) {
+        NsSet s;
+        pthread_mutex_lock(&p->lock);
+        bool full = p->n_free >= p->target;
+        pthread_mutex_unlock(&p->lock);
+        if (full || make_set(p, &s)) {
+            return made;
+        }
+        pthread_mutex_lock(&p->lock);
+        p->made++;
+        if (p->n_free < p->target) {
+            p->free[p->n_free++] = s;
+            s.n = 0;
+        }
+        pthread_mutex_unlock(&p->lock);
+        close_set(&s); // a release filled the slot meanwhile
+        made++;
+    }
+}
+
+int acquire_NsPool(NsPool *p, NsSet *s) {
+    pthread_mutex_lock(&p->lock);
+    if (p->n_free > 0) {
+        *s = p->free[--p->n_free];
+        pthread_mutex_unlock(&p->lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&p->lock);
+    if (make_set(p, s)) {
+        return 1;
+    }
+    pthread_mutex_lock(&p->lock);
+    p->made++;
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+void release_NsPool(NsPool *p, NsSet *s, bool dirty) {
+    s->uses++;
+    if (!dirty && (p->max_uses == 0 || s->uses < p->max_uses)) {
+        pthread_mutex_lock(&p->lock);
+        if (p->n_free < p->target) {
+            p->free[p->n_free++] = *s;
+            s->n = 0;
+        }
+        pthread_mutex_unlock(&p->lock);
+    }
+    close_set(s);
+}
+
+void close_NsPool(NsPool *p) {
+    for (int i = 0; i < p->n_free; i++) {
+        close_set(&p->free[i]);
+    }
+    free(p->free);
+    p->free = NULL;
+    p->n_free = 0;
+    pthread_mutex_destroy(&p->lock);
+}
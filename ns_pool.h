@@ -0,0 +1,57 @@
+#ifndef NS_POOL_H
+#define NS_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "subprocess.h"
+
+#define NS_MAX_KINDS 6  // user, mnt, net, ipc, uts, cgroup
+
+// one prepared set of namespaces, held open by fds; the user namespace
+// comes first so the others can be joined from inside it
+typedef struct {
+    int fds[NS_MAX_KINDS];
+    int n;
+    int uses;               // children started in it so far
+} NsSet;
+
+// runs while the helper that created a set is alive, e.g. to write its
+// uid_map or bring up interfaces from /proc/pid; non-zero drops the set
+typedef int (*NsPrepare)(pid_t helper, void *data);
+
+// recycled namespaces for sandboxed children: making a set costs a clone
+// of a helper process, joining one a setns() per kind in the child, so
+// sets are made ahead (fill_NsPool) and handed out again after release.
+// PID namespaces are not supported: setns() only moves later children
+typedef struct {
+    int flags;              // CLONE_NEW* kinds of every set
+    int target;             // sets fill_NsPool() keeps ready
+    int max_uses;           // destroy a set after this many releases, 0 never
+    NsPrepare prepare;
+    void *data;
+    NsSet *free;            // LIFO of ready sets
+    int n_free;
+    pthread_mutex_t lock;
+    size_t made;
+} NsPool;
+
+// prepare may be NULL; makes target sets right away
+int init_NsPool(NsPool *p, int flags, int target, int max_uses, NsPrepare prepare, void *data);
+// top the ready sets back up to target; returns the number made
+int fill_NsPool(NsPool *p);
+// take a ready set into *s, making one if none is ready
+int acquire_NsPool(NsPool *p, NsSet *s);
+// give s back once its children are done with it; dirty (or max_uses
+// reached) closes it instead
+void release_NsPool(NsPool *p, NsSet *s, bool dirty);
+void close_NsPool(NsPool *p);
+
+// spawn ci's child into s; s must stay valid until subprocess() returns
+static inline void apply_NsSet(const NsSet *s, ProcInfo *ci) {
+    ci->ns_fds = s->fds;
+    ci->n_ns_fds = s->n;
+}
+
+#endif // NS_POOL_H
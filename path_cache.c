@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "path_cache.h"
+
+#define PATH_CACHE_BUCKETS 256
+
+typedef struct PathEntry {
+    struct PathEntry *next;
+    char *name;
+    char *path;
+} PathEntry;
+
+static bool cache_on = false;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static PathEntry *buckets[PATH_CACHE_BUCKETS];
+static char *cached_env_path; // PATH the entries were resolved against
+
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u; // FNV-1a
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static void clear_locked(void) {
+    for (int i = 0; i < PATH_CACHE_BUCKETS; i++) {
+        PathEntry *e = buckets[i];
+        while (e != NULL) {
+            PathEntry *next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            e = next;
+        }
+        buckets[i] = NULL;
+    }
+}
+
+void enable_path_cache(bool on) {
+    pthread_mutex_lock(&cache_lock);
+    cache_on = on;
+    if (!on) {
+        clear_locked();
+        free(cached_env_path);
+        cached_env_path = NULL;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+bool path_cache_enabled(void) {
+    return cache_on;
+}
+
+// walk PATH the way posix_spawnp would; relative entries make the answer
+// depend on the cwd, so they end the walk uncached
+static bool resolve(const char *name, const char *env_path, char *out, size_t sz) {
+    const char *p = env_path;
+    size_t nlen = strlen(name);
+
+    while (*p) {
+        const char *end = strchrnul(p, ':');
+        size_t dlen = end - p;
+        if (dlen == 0 || p[0] != '/') {
+            return false;
+        }
+        if (dlen + 1 + nlen + 1 <= sz) {
+            struct stat sb;
+            memcpy(out, p, dlen);
+            out[dlen] = '/';
+            memcpy(out + dlen + 1, name, nlen + 1);
+            if (stat(out, &sb) == 0 && S_ISREG(sb.st_mode) && access(out, X_OK) == 0) {
+                return true;
+            }
+        }
+        p = *end ? end + 1 : end;
+    }
+    return false;
+}
+
+bool lookup_path_cache(const char *name, char *buf, size_t sz) {
+    const char *env_path = getenv("PATH");
+    bool found = false;
+
+    if (!cache_on || strchr(name, '/') != NULL) {
+        return false;
+    }
+    if (env_path == NULL) {
+        env_path = "/bin:/usr/bin"; // glibc's default search path
+    }
+    pthread_mutex_lock(&cache_lock);
+    if (cached_env_path == NULL || strcmp(cached_env_path, env_path) != 0) {
+        clear_locked(); // PATH changed: every answer may be different now
+        free(cached_env_path);
+        cached_env_path = strdup(env_path);
+    }
+    uint32_t b = hash_name(name) % PATH_CACHE_BUCKETS;
+    for (PathEntry *e = buckets[b]; e != NULL; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            if (strlen(e->path) < sz) {
+                strcpy(buf, e->path);
+                found = true;
+            }
+            goto done;
+        }
+    }
+    char path[PATH_MAX];
+    if (resolve(name, env_path, path, sizeof(path)) && strlen(path) < sz) {
+        PathEntry *e = malloc(sizeof(PathEntry));
+        if (e != NULL && (e->name = strdup(name)) != NULL && (e->path = strdup(path)) != NULL) {
+            e->next = buckets[b];
+            buckets[b] = e;
+        } else if (e != NULL) {
+            free(e->name);
+            free(e);
+        }
+        strcpy(buf, path);
+        found = true;
+    }
+
+done:
+    pthread_mutex_unlock(&cache_lock);
+    return found;
+}
+
+bool resolve_path(const char *name, char *buf, size_t sz) {
+    const char *env_path = getenv("PATH");
+    if (strchr(name, '/') != NULL) {
+        return false;
+    }
+    return resolve(name, env_path != NULL ? env_path : "/bin:/usr/bin", buf, sz);
+}
+
+void invalidate_path_cache(const char *name) {
+    pthread_mutex_lock(&cache_lock);
+    if (name == NULL) {
+        clear_locked();
+    } else {
+        PathEntry **pe = &buckets[hash_name(name) % PATH_CACHE_BUCKETS];
+        while (*pe != NULL) {
+            PathEntry *e = *pe;
+            if (strcmp(e->name, name) == 0) {
+                *pe = e->next;
+                free(e->name);
+                free(e->path);
+                free(e);
+                break;
+            }
+            pe = &e->next;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
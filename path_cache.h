@@ -0,0 +1,19 @@
+#ifndef PATH_CACHE_H
+#define PATH_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// opt-in cache of PATH lookups for subprocess(): a hit lets it call
+// posix_spawn with the absolute path instead of posix_spawnp walking PATH
+void enable_path_cache(bool on);
+bool path_cache_enabled(void);
+// copy the resolved path of name into buf; false if it can't be cached
+// (contains a slash, not found, or PATH has relative entries before it)
+bool lookup_path_cache(const char *name, char *buf, size_t sz);
+// uncached PATH walk with the same rules, for callers that keep their own answer
+bool resolve_path(const char *name, char *buf, size_t sz);
+// drop name (every entry when NULL), e.g. after an ENOENT from the cached path
+void invalidate_path_cache(const char *name);
+
+#endif // PATH_CACHE_H
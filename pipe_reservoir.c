@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "pipe_reservoir.h"
+#include "subprocess.h"
+
+typedef struct {
+    int fd[2];
+    int granted;    // F_GETPIPE_SZ of the pair
+} PipePair;
+
+static pthread_mutex_t res_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t res_wake = PTHREAD_COND_INITIALIZER; // refill: taken below the low mark, or stopping
+static bool res_on = false;
+static bool stopping;
+static bool starved;        // out of descriptors: wait for a take before trying again
+static pthread_t refill;
+static PipePair *pairs;     // LIFO
+static int n_pairs;
+static int cap;             // pairs, already limited by the fd budget
+static int res_size;
+static size_t hits, misses;
+
+static bool make_pair(PipePair *pp) {
+    if (pipe2(pp->fd, O_CLOEXEC)) {
+        return false;
+    }
+    pp->granted = res_size > 0 ? set_pipe_size(pp->fd[0], res_size) : fcntl(pp->fd[0], F_GETPIPE_SZ);
+    return true;
+}
+
+static void *refill_main(void *arg) {
+    sigset_t all;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, NULL);
+    pthread_mutex_lock(&res_lock);
+    while (!stopping) {
+        if (n_pairs >= cap || starved) {
+            pthread_cond_wait(&res_wake, &res_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&res_lock);
+        PipePair pp;
+        bool ok = make_pair(&pp);
+        int err = errno;
+        pthread_mutex_lock(&res_lock);
+        if (!ok) {
+            if (err != EMFILE && err != ENFILE) {
+                showError(false, "Failed to refill the pipe reservoir: %s!", strerror(err));
+                break; // spawns make their own pipes
+            }
+            starved = true;
+            continue;
+        }
+        pairs[n_pairs++] = pp;
+    }
+    pthread_mutex_unlock(&res_lock);
+    return NULL;
+}
+
+int start_pipe_reservoir(int target, int size, int fd_budget) {
+    struct rlimit rl;
+
+    if (res_on) {
+        showError(false, "The pipe reservoir is already running!");
+        return 1;
+    }
+    if (fd_budget <= 0) {
+        fd_budget = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY ? rl.rlim_cur / 4 : 256;
+    }
+    cap = target < fd_budget / 2 ? target : fd_budget / 2;
+    if (cap < 1) {
+        showError(false, "Pipe reservoir of %d pairs does not fit a budget of %d fds!", target, fd_budget);
+        return 1;
+    }
+    if ((pairs = calloc(cap, sizeof(*pairs))) == NULL) {
+        showError(false, "Failed to allocate the pipe reservoir!");
+        return 1;
+    }
+    n_pairs = 0;
+    res_size = size > 0 ? size : 0;
+    stopping = starved = false;
+    hits = misses = 0;
+    if (pthread_create(&refill, NULL, refill_main, NULL) != 0) {
+        showError(false, "Failed to start the pipe reservoir thread!");
+        free(pairs);
+        pairs = NULL;
+        return 1;
+    }
+    __atomic_store_n(&res_on, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void stop_pipe_reservoir(void) {
+    if (!res_on) {
+        return;
+    }
+    pthread_mutex_lock(&res_lock);
+    __atomic_store_n(&res_on, false, __ATOMIC_RELEASE);
+    stopping = true;
+    pthread_cond_signal(&res_wake);
+    pthread_mutex_unlock(&res_lock);
+    pthread_join(refill, NULL);
+    for (int i = 0; i < n_pairs; i++) {
+        close(pairs[i].fd[0]);
+        close(pairs[i].fd[1]);
+    }
+    n_pairs = 0;
+    free(pairs);
+    pairs = NULL;
+}
+
+int take_pipe_reservoir(int p[2], int size) {
+    int granted = -1;
+
+    if (!__atomic_load_n(&res_on, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    pthread_mutex_lock(&res_lock);
+    if (res_on && (size > 0 ? size : 0) == res_size) {
+        if (n_pairs > 0) {
+            PipePair *pp = &pairs[--n_pairs];
+            p[0] = pp->fd[0];
+            p[1] = pp->fd[1];
+            granted = pp->granted;
+            hits++;
+        } else {
+            misses++;
+        }
+        // refill in batches from half empty, not after every take
+        if (n_pairs <= cap / 2) {
+            starved = false;
+            pthread_cond_signal(&res_wake);
+        }
+    }
+    pthread_mutex_unlock(&res_lock);
+    return granted;
+}
+
+void pipe_reservoir_stats(size_t *h, size_t *m) {
+    pthread_mutex_lock(&res_lock);
+    *h = hits;
+    *m = misses;
+    pthread_mutex_unlock(&res_lock);
+}
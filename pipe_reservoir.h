@@ -0,0 +1,22 @@
+#ifndef PIPE_RESERVOIR_H
+#define PIPE_RESERVOIR_H
+
+#include <stddef.h>
+
+// opt-in stock of O_CLOEXEC pipe pairs for subprocess()'s PROC_COM_PIPE
+// streams: a background thread keeps up to target pairs made and sized, so
+// a spawn takes them instead of paying pipe2() and F_SETPIPE_SZ inline.
+// The reservoir never holds more than fd_budget descriptors (0 for a
+// quarter of RLIMIT_NOFILE) and stops refilling on EMFILE/ENFILE until a
+// pair is taken again
+int start_pipe_reservoir(int target, int size, int fd_budget);
+// join the thread and close every pair still held
+void stop_pipe_reservoir(void);
+// move a pair sized for size (0: the kernel default) into p; returns its
+// F_GETPIPE_SZ size, or -1 when empty, stopped or stocked for another size.
+// Never blocks on the refill
+int take_pipe_reservoir(int p[2], int size);
+// pairs handed out and requests that found none
+void pipe_reservoir_stats(size_t *hits, size_t *misses);
+
+#endif // PIPE_RESERVOIR_H
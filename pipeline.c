@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "pipeline.h"
+
+int init_Pipeline(Pipeline *pl, int n) {
+    pl->n = 0;
+    pl->n_spawned = 0;
+    pl->builtins = NULL;
+    pl->relays = NULL;
+    pl->cpus = NULL;
+    pl->loop = NULL;
+    pl->has_own_loop = false;
+    pl->stages = calloc(n > 0 ? n : 1, sizeof(ProcInfo));
+    if (pl->stages == NULL) {
+        showError(false, "Failed to allocate a %d stage pipeline!", n);
+        return 1;
+    }
+    pl->n = n;
+    for (int i = 0; i < n; i++) {
+        pl->stages[i].p_stdin = -1;
+        pl->stages[i].p_stdout = -1;
+        pl->stages[i].p_stderr = -1;
+        pl->stages[i].pidfd = -1;
+        pl->stages[i].pid = -1;
+    }
+    return 0;
+}
+
+int set_builtin_Pipeline(Pipeline *pl, int i, BuiltinStage *b) {
+    if (i <= 0 || i >= pl->n) {
+        showError(false, "Builtin %s can't be stage %d of %d!", b->name, i, pl->n);
+        return 1;
+    }
+    if (pl->builtins == NULL) {
+        pl->builtins = calloc(pl->n, sizeof(BuiltinStage *));
+        pl->relays = calloc(pl->n, sizeof(Relay));
+        if (pl->builtins == NULL || pl->relays == NULL) {
+            showError(false, "Failed to allocate builtin stages!");
+            free(pl->builtins);
+            free(pl->relays);
+            pl->builtins = NULL;
+            pl->relays = NULL;
+            return 1;
+        }
+    }
+    pl->builtins[i] = b;
+    return 0;
+}
+
+static BuiltinStage *builtin_at(const Pipeline *pl, int i) {
+    return pl->builtins != NULL ? pl->builtins[i] : NULL;
+}
+
+int place_Pipeline(Pipeline *pl, CpuTopology *t) {
+    int n = 0;
+
+    if (pl->cpus == NULL && (pl->cpus = calloc(pl->n > 0 ? pl->n : 1, sizeof(cpu_set_t))) == NULL) {
+        showError(false, "Failed to allocate CPU sets for a %d stage pipeline!", pl->n);
+        return 1;
+    }
+    for (int i = 0; i < pl->n; i++) {
+        n += builtin_at(pl, i) == NULL;
+    }
+    place_CpuTopology(t, n, pl->cpus); // packed: stage i's set is moved to its slot below
+    for (int i = pl->n - 1, k = n - 1; i >= 0; i--) {
+        if (builtin_at(pl, i) != NULL) {
+            pl->stages[i].cpus = NULL;
+            continue;
+        }
+        pl->cpus[i] = pl->cpus[k--];
+        pl->stages[i].cpus = &pl->cpus[i];
+    }
+    return 0;
+}
+
+static const char *stage_name(const Pipeline *pl, char **argvs[], int i) {
+    BuiltinStage *b = builtin_at(pl, i);
+    return b != NULL ? b->name : argvs[i][0];
+}
+
+// an fd of our own on the same file as fd: the relay makes it non-blocking,
+// which must not leak into the description the rest of the process writes
+// to, so pipes and ttys are reopened; a regular file's offset has to be shared
+static int own_output(int fd) {
+    struct stat st;
+    char path[32];
+
+    if (fstat(fd, &st) == 0 && !S_ISREG(st.st_mode)) {
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        int own = open(path, O_WRONLY | O_CLOEXEC);
+        if (own >= 0) {
+            return own;
+        }
+    }
+    return fcntl(fd, F_DUPFD_CLOEXEC, 0);
+}
+
+// where the last stage (a builtin) writes, after its stdout_type
+static int builtin_output(ProcInfo *ci) {
+    int p[2];
+
+    switch (ci->stdout_type) {
+    case PROC_COM_INHERIT:
+        return own_output(STDOUT_FILENO);
+    case PROC_COM_NONE:
+        return open("/dev/null", O_WRONLY | O_CLOEXEC);
+    case PROC_COM_PATH:
+        if (ci->f_stdout == NULL) {
+            errno = EINVAL;
+            return -1;
+        }
+        return open(ci->f_stdout, proc_path_oflags(ci) | O_CLOEXEC, 0666);
+    case PROC_COM_FD:
+        return ci->p_stdout >= 0 ? own_output(ci->p_stdout) : (errno = EBADF, -1);
+    case PROC_COM_PIPE:
+        if (pipe2(p, O_CLOEXEC)) {
+            return -1;
+        }
+        ci->p_stdout = p[0];
+        return p[1];
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+// start builtin stage i as a relay from its stdin pipe to the next stage
+static int start_builtin(Pipeline *pl, int i) {
+    BuiltinStage *b = pl->builtins[i];
+    ProcInfo *ci = &pl->stages[i];
+    EventLoop *loop = pl->loop != NULL ? pl->loop : &pl->own_loop;
+    bool last = i + 1 == pl->n;
+
+    int out = last ? builtin_output(ci) : ci->p_stdout;
+    if (out < 0) {
+        showError(false, "Failed to open the output of builtin %s: %s!", b->name, strerror(errno));
+        return 1;
+    }
+    b->relay = &pl->relays[i];
+    int rc = init_Relay(b->relay, loop, ci->p_stdin, out, 0, b->filter, b, NULL, NULL);
+    ci->p_stdin = -1; // the relay's now, closed by it on failure too
+    if (!last) {
+        ci->p_stdout = -1;
+    }
+    if (rc != 0) {
+        b->relay = NULL;
+        return rc;
+    }
+    b->relay->lines = b->lines;
+    b->relay->on_end = b->on_end;
+    return 0;
+}
+
+int spawn_Pipeline(Pipeline *pl, char **argvs[], char* env[]) {
+    int rc = 0;
+    int i;
+
+    if (pl->builtins != NULL && pl->loop == NULL && !pl->has_own_loop) {
+        if (init_EventLoop(&pl->own_loop, EVLOOP_EPOLL)) {
+            return 1;
+        }
+        pl->has_own_loop = true;
+    }
+
+    // all pipes are created up front; O_CLOEXEC keeps every stage from
+    // inheriting the ends that belong to the other stages
+    for (i = 0; i + 1 < pl->n; i++) {
+        int p[2];
+        if (pipe2(p, O_CLOEXEC)) {
+            showError(false, "Failed to create pipe between stage %d (%s) and %d (%s): %s!",
+                i, stage_name(pl, argvs, i), i + 1, stage_name(pl, argvs, i + 1), strerror(errno));
+            rc = 1;
+            goto clean_up;
+        }
+        pl->stages[i].stdout_type = PROC_COM_FD;
+        pl->stages[i].p_stdout = p[1];
+        pl->stages[i + 1].stdin_type = PROC_COM_FD;
+        pl->stages[i + 1].p_stdin = p[0];
+    }
+    for (i = 0; i < pl->n; i++) {
+        ProcInfo *ci = &pl->stages[i];
+        if (builtin_at(pl, i) != NULL) {
+            if ((rc = start_builtin(pl, i)) != 0) {
+                goto clean_up;
+            }
+            pl->n_spawned++;
+            continue;
+        }
+        rc = subprocess(ci, argvs[i], env);
+        if (rc != 0) {
+            goto clean_up;
+        }
+        pl->n_spawned++;
+        // the stage now holds its own copies of the inter-stage ends
+        if (i > 0) {
+            close(ci->p_stdin);
+            ci->p_stdin = -1;
+        }
+        if (i + 1 < pl->n) {
+            close(ci->p_stdout);
+            ci->p_stdout = -1;
+        }
+    }
+    return 0;
+
+clean_up:
+    // release inter-stage ends of stages that never started;
+    // already running stages then see EOF or EPIPE and wind down
+    for (int j = pl->n_spawned; j < pl->n; j++) {
+        ProcInfo *ci = &pl->stages[j];
+        if (j > 0 && ci->p_stdin >= 0) {
+            close(ci->p_stdin);
+            ci->p_stdin = -1;
+        }
+        if (j + 1 < pl->n && ci->p_stdout >= 0) {
+            close(ci->p_stdout);
+            ci->p_stdout = -1;
+        }
+    }
+    return rc;
+}
+
+bool done_Pipeline(const Pipeline *pl) {
+    for (int i = 0; i < pl->n_spawned; i++) {
+        if (builtin_at(pl, i) != NULL && !done_Relay(&pl->relays[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int wait_Pipeline(Pipeline *pl, int *statuses) {
+    EventLoop *loop = pl->loop != NULL ? pl->loop : &pl->own_loop;
+    int last = -1;
+
+    while (!done_Pipeline(pl)) {
+        if (run_EventLoop(loop, -1) < 0) {
+            showError(false, "Failed to run the builtin stages: %s!", strerror(errno));
+            break;
+        }
+    }
+    for (int i = 0; i < pl->n; i++) {
+        BuiltinStage *b = builtin_at(pl, i);
+        int status = -1;
+        if (i < pl->n_spawned && b != NULL) {
+            status = W_EXITCODE(b->status, 0);
+        } else if (i < pl->n_spawned) {
+            reap_ProcInfo(&pl->stages[i], &status, 0);
+        }
+        if (statuses != NULL) {
+            statuses[i] = status;
+        }
+        if (i == pl->n - 1) {
+            last = status;
+        }
+    }
+    return last;
+}
+
+void close_Pipeline(Pipeline *pl) {
+    for (int i = 0; i < pl->n; i++) {
+        if (i < pl->n_spawned && builtin_at(pl, i) != NULL) {
+            close_Relay(&pl->relays[i]);
+            pl->builtins[i]->relay = NULL;
+        }
+        close_ProcInfo(&pl->stages[i]);
+    }
+    if (pl->has_own_loop) {
+        close_EventLoop(&pl->own_loop);
+        pl->has_own_loop = false;
+    }
+    free(pl->builtins);
+    free(pl->relays);
+    pl->builtins = NULL;
+    pl->relays = NULL;
+    free(pl->cpus);
+    pl->cpus = NULL;
+    free(pl->stages);
+    pl->stages = NULL;
+    pl->n = 0;
+    pl->n_spawned = 0;
+}
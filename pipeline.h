@@ -0,0 +1,49 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "relay.h"
+#include "builtin.h"
+#include "cpu_topology.h"
+
+// a chain of subprocesses: stdout of stage i feeds stdin of stage i+1.
+// Any stage but the first may be a BuiltinStage instead, run by the parent
+// as a Relay between the pipes around it; the last one writes where the
+// stage's stdout_type says (INHERIT, NONE, PATH, FD, or a PIPE the caller
+// reads from p_stdout -- on pl->loop if the output may outgrow the pipe)
+typedef struct {
+    int n;              // number of stages
+    int n_spawned;      // stages actually started
+    ProcInfo *stages;   // one per stage, fds initialized to -1
+    BuiltinStage **builtins; // NULL, or per stage the builtin that replaces its argv
+    Relay *relays;      // per stage, the running builtins
+    cpu_set_t *cpus;    // per stage, what place_Pipeline() pinned it to; NULL if unplaced
+    EventLoop *loop;    // caller's, NULL for a private one that wait_Pipeline() runs
+    EventLoop own_loop;
+    bool has_own_loop;
+} Pipeline;
+
+// allocate n stages with every stream set to PROC_COM_INHERIT; before spawning
+// the caller may set stages[0] stdin, stages[n-1] stdout and any stage's stderr
+int init_Pipeline(Pipeline *pl, int n);
+// run b in place of stage i (i > 0); b must outlive the pipeline
+int set_builtin_Pipeline(Pipeline *pl, int i, BuiltinStage *b);
+// pin the stages to neighbouring CPUs of one cache group of t, the next
+// group for the next pipeline placed from t (see place_CpuTopology());
+// builtin stages run in the parent and are left out. Before spawn_Pipeline()
+int place_Pipeline(Pipeline *pl, CpuTopology *t);
+// create the inter-stage pipes and spawn every stage; argvs has n entries
+// (NULL for builtin stages); parent-side copies of the inter-stage pipes are
+// closed once the stages own them, the builtins' relays keep theirs
+int spawn_Pipeline(Pipeline *pl, char **argvs[], char* env[]);
+// every builtin stage has finished its output
+bool done_Pipeline(const Pipeline *pl);
+// run the loop until the builtins are done, then wait for all spawned
+// stages; statuses (optional) receives n wait statuses, a builtin's as
+// W_EXITCODE(b->status, 0). Returns the status of the last stage, or -1
+// if it was never spawned
+int wait_Pipeline(Pipeline *pl, int *statuses);
+void close_Pipeline(Pipeline *pl);
+
+#endif // PIPELINE_H
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "preflight.h"
+#include "path_cache.h"
+
+#define PREFLIGHT_BUCKETS 256
+#define PREFLIGHT_PATH_DIRS 64
+#define PATH_WD (-2)    // a PATH lookup: every directory of PATH covers it
+// what can make a missing name appear in the directory watched for it
+#define WATCH_MASK (IN_CREATE | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+typedef struct Missing {
+    struct Missing *next;
+    char *name;
+    bool exe;           // args[0], else an input path
+    int code;           // errno to report
+    int wd;             // the watch whose events drop it, PATH_WD for a PATH lookup
+} Missing;
+
+static bool preflight_on = false;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static Missing *buckets[PREFLIGHT_BUCKETS];
+static size_t n_missing;
+static int ino_fd = -1;
+static char *watched_path;      // PATH whose directories path_wds cover, NULL for none
+static int path_wds[PREFLIGHT_PATH_DIRS];
+static int n_path_wds;
+
+static uint32_t hash_name(const char *s, bool exe) {
+    uint32_t h = exe ? 2166136261u : 2166136261u ^ 1; // FNV-1a
+    while (*s) {
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    }
+    return h;
+}
+
+// drop the entries wd covers; every one for wd == -1
+static void drop_locked(int wd) {
+    for (int i = 0; i < PREFLIGHT_BUCKETS; i++) {
+        Missing **pe = &buckets[i];
+        while (*pe != NULL) {
+            Missing *e = *pe;
+            if (wd != -1 && e->wd != wd) {
+                pe = &e->next;
+                continue;
+            }
+            *pe = e->next;
+            free(e->name);
+            free(e);
+            n_missing--;
+        }
+    }
+}
+
+static bool is_path_wd(int wd) {
+    for (int i = 0; i < n_path_wds; i++) {
+        if (path_wds[i] == wd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// forget the PATH watches; the next PATH lookup sets them up again
+static void unwatch_path_locked(void) {
+    drop_locked(PATH_WD);
+    for (int i = 0; i < n_path_wds; i++) {
+        inotify_rm_watch(ino_fd, path_wds[i]);
+        drop_locked(path_wds[i]); // an input under a PATH directory shared the watch
+    }
+    n_path_wds = 0;
+    free(watched_path);
+    watched_path = NULL;
+}
+
+// apply what changed in the watched directories since the last call
+static void drain_locked(void) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+
+    while (ino_fd >= 0 && (n = read(ino_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                unwatch_path_locked();
+                drop_locked(-1);
+            } else if (is_path_wd(ev->wd)) {
+                unwatch_path_locked(); // also picks up a PATH directory created since
+            } else {
+                drop_locked(ev->wd);
+            }
+        }
+    }
+}
+
+static int add_watch_locked(const char *dir) {
+    if (ino_fd < 0 && (ino_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        return -1;
+    }
+    return inotify_add_watch(ino_fd, dir, WATCH_MASK);
+}
+
+// the directory a missing entry would appear in, or for a missing
+// directory its parent; -1 if neither can be watched
+static int watch_dir_locked(const char *dir, size_t len) {
+    char d[PATH_MAX];
+
+    if (len == 0 || len >= sizeof(d)) {
+        return -1;
+    }
+    memcpy(d, dir, len);
+    d[len] = '\0';
+    int wd = add_watch_locked(d);
+    if (wd < 0 && errno == ENOENT) {
+        char *slash = strrchr(d, '/');
+        if (slash != NULL) {
+            slash[slash == d] = '\0'; // keep "/" itself
+            wd = add_watch_locked(d);
+        }
+    }
+    return wd;
+}
+
+// watch every directory of env_path; false if one can't be
+static bool watch_path_locked(const char *env_path) {
+    if (watched_path != NULL && strcmp(watched_path, env_path) == 0) {
+        return true;
+    }
+    unwatch_path_locked();
+    for (const char *p = env_path;; p++) {
+        const char *end = strchrnul(p, ':');
+        int wd = n_path_wds < PREFLIGHT_PATH_DIRS ? watch_dir_locked(p, end - p) : -1;
+        if (wd < 0) {
+            unwatch_path_locked();
+            return false;
+        }
+        path_wds[n_path_wds++] = wd;
+        if (*(p = end) == '\0') {
+            break;
+        }
+    }
+    return (watched_path = strdup(env_path)) != NULL;
+}
+
+static Missing *find_locked(const char *name, bool exe) {
+    for (Missing *e = buckets[hash_name(name, exe) % PREFLIGHT_BUCKETS]; e != NULL; e = e->next) {
+        if (e->exe == exe && strcmp(e->name, name) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void remember_locked(const char *name, bool exe, int code, int wd) {
+    if (n_missing >= PREFLIGHT_MAX_MISSING) { // start over, watches and all
+        unwatch_path_locked();
+        drop_locked(-1);
+        if (ino_fd >= 0) {
+            close(ino_fd);
+            ino_fd = -1;
+        }
+        return;
+    }
+    Missing *e = malloc(sizeof(Missing));
+    if (e == NULL || (e->name = strdup(name)) == NULL) {
+        free(e);
+        return;
+    }
+    uint32_t b = hash_name(name, exe) % PREFLIGHT_BUCKETS;
+    e->exe = exe;
+    e->code = code;
+    e->wd = wd;
+    e->next = buckets[b];
+    buckets[b] = e;
+    n_missing++;
+}
+
+// what opening path for the child would run into: exec for exe, else read
+static int check_file(const char *path, bool exe) {
+    struct stat sb;
+
+    if (!exe) {
+        return access(path, R_OK) == 0 ? 0 : errno;
+    }
+    if (stat(path, &sb) != 0) {
+        return errno;
+    }
+    return S_ISREG(sb.st_mode) && access(path, X_OK) == 0 ? 0 : EACCES;
+}
+
+// a name with a slash, checked as is; only an absolute one's failure is cached
+static int check_path_locked(const char *path, bool exe) {
+    Missing *e = find_locked(path, exe);
+    int code;
+
+    if (e != NULL) {
+        return e->code;
+    }
+    if ((code = check_file(path, exe)) != 0 && path[0] == '/') {
+        const char *slash = strrchr(path, '/');
+        int wd = watch_dir_locked(path, slash == path ? 1 : slash - path);
+        if (wd >= 0) {
+            remember_locked(path, exe, code, wd);
+        }
+    }
+    return code;
+}
+
+// walk PATH like posix_spawnp: EACCES if only non-executables were found;
+// with relative entries in it the answer depends on the cwd and isn't cached
+static int check_exe_locked(const char *name) {
+    const char *env_path = getenv("PATH");
+    char path[PATH_MAX];
+    bool relative = false;
+    int code = ENOENT;
+    Missing *e;
+
+    if (env_path == NULL) {
+        env_path = "/bin:/usr/bin"; // glibc's default search path
+    }
+    if (watched_path != NULL && strcmp(watched_path, env_path) != 0) {
+        unwatch_path_locked(); // PATH changed: its answers are void
+    }
+    if ((e = find_locked(name, true)) != NULL) {
+        return e->code;
+    }
+    size_t nlen = strlen(name);
+    for (const char *p = env_path;; p++) {
+        const char *end = strchrnul(p, ':');
+        const char *dir = end > p ? p : "."; // an empty entry is the cwd
+        size_t dlen = end > p ? (size_t)(end - p) : 1;
+        relative |= dir[0] != '/';
+        if (dlen + 1 + nlen + 1 <= sizeof(path)) {
+            memcpy(path, dir, dlen);
+            path[dlen] = '/';
+            memcpy(path + dlen + 1, name, nlen + 1);
+            int rc = check_file(path, true);
+            if (rc == 0) {
+                return 0;
+            }
+            if (rc == EACCES) {
+                code = EACCES;
+            }
+        }
+        if (*(p = end) == '\0') {
+            break;
+        }
+    }
+    if (!relative && watch_path_locked(env_path)) {
+        remember_locked(name, true, code, PATH_WD);
+    }
+    return code;
+}
+
+void enable_preflight(bool on) {
+    pthread_mutex_lock(&cache_lock);
+    preflight_on = on;
+    if (!on) {
+        unwatch_path_locked();
+        drop_locked(-1);
+        if (ino_fd >= 0) {
+            close(ino_fd);
+            ino_fd = -1;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+bool preflight_enabled(void) {
+    return preflight_on;
+}
+
+int preflight_spawn(const SpawnTemplate *st, ProcInfo *ci, char* args[]) {
+    const char *exe = st->exe != NULL ? st->exe : args[0];
+    char resolved[PATH_MAX];
+    int code = 0, stream = -1;
+
+    if (!preflight_on) {
+        return 0;
+    }
+    pthread_mutex_lock(&cache_lock);
+    drain_locked();
+    // short of a cached miss, a path cache hit says it all for args[0]
+    bool known = st->exe == NULL && path_cache_enabled() && find_locked(exe, true) == NULL &&
+        lookup_path_cache(exe, resolved, sizeof(resolved));
+    if (!known) {
+        code = strchr(exe, '/') != NULL ? check_path_locked(exe, true) : check_exe_locked(exe);
+    }
+    if (code == 0 && st->op[STDIN_FILENO] == SPAWN_OP_OPEN && st->path[STDIN_FILENO] != NULL) {
+        stream = STDIN_FILENO;
+        code = check_path_locked(st->path[STDIN_FILENO], false);
+    }
+    pthread_mutex_unlock(&cache_lock);
+    if (code == 0) {
+        return 0;
+    }
+    return report_SpawnError(&ci->err, SPAWN_STAGE_PREFLIGHT, stream, code, 0, args[0]);
+}
+
+void invalidate_preflight(const char *name) {
+    pthread_mutex_lock(&cache_lock);
+    if (name == NULL) {
+        drop_locked(-1);
+    } else {
+        for (int exe = 0; exe < 2; exe++) {
+            Missing **pe = &buckets[hash_name(name, exe) % PREFLIGHT_BUCKETS];
+            while (*pe != NULL) {
+                Missing *e = *pe;
+                if (e->exe == exe && strcmp(e->name, name) == 0) {
+                    *pe = e->next;
+                    free(e->name);
+                    free(e);
+                    n_missing--;
+                    break;
+                }
+                pe = &e->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
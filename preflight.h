@@ -0,0 +1,26 @@
+#ifndef PREFLIGHT_H
+#define PREFLIGHT_H
+
+#include <stdbool.h>
+
+#include "subprocess.h"
+
+#define PREFLIGHT_MAX_MISSING 4096  // cached failures before the cache starts over
+
+// opt-in checks subprocess() runs before it creates any pipe, fd or file
+// action: args[0] (or the template's exe) resolves to an executable and a
+// PROC_COM_PATH stdin can be opened for reading. A spawn that would fail
+// there fails with SPAWN_STAGE_PREFLIGHT instead, for the price of a hash
+// lookup once the answer is cached. Only failures are cached (successes
+// through the path cache, when it is on), each with an inotify watch on
+// the directory that would have to change to fix it: PATH's directories,
+// or the input's parent. A name whose directory can't be watched is
+// checked afresh every time. Thread-safe
+void enable_preflight(bool on);
+bool preflight_enabled(void);
+// 0 if the spawn may go ahead, else the errno it reported into ci->err
+int preflight_spawn(const SpawnTemplate *st, ProcInfo *ci, char* args[]);
+// forget the cached failure of name (an args[0] or input path), every one when NULL
+void invalidate_preflight(const char *name);
+
+#endif // PREFLIGHT_H
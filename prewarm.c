@@ -0,0 +1,469 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prewarm.h"
+#include "path_cache.h"
+#include "subprocess.h"
+
+#define PREWARM_LD_CACHE "/etc/ld.so.cache"
+#define PREWARM_LIB_DIRS "/lib64:/usr/lib64:/lib:/usr/lib"  // ld.so's own defaults, after the cache
+#define PREWARM_STRTAB_MAX (1 << 20)
+#define PREWARM_PHNUM_MAX 256
+#if __ELF_NATIVE_CLASS == 64
+#define PREWARM_ELF_CLASS ELFCLASS64
+#else
+#define PREWARM_ELF_CLASS ELFCLASS32
+#endif
+
+// glibc's ld.so.cache format since 2.32, new-format part alone
+#define LD_CACHE_MAGIC "glibc-ld.so.cache1.1"
+#define LD_CACHE_HEADER 48
+#define LD_CACHE_ENTRY 24
+
+typedef struct {
+    void *addr;
+    size_t len;
+} LockedRange;
+
+typedef struct {
+    char *name;
+    int flags;
+    LockedRange *locked;
+    int n_locked;
+    PrewarmStats st;
+} Prewarm;
+
+static pthread_mutex_t prewarm_lock = PTHREAD_MUTEX_INITIALIZER;
+static Prewarm entries[PREWARM_MAX];
+static int n_entries;
+
+// one command being warmed
+typedef struct {
+    int flags;
+    char *files[PREWARM_FILES_MAX]; // still to warm or warmed, the executable first
+    int n_files;
+    struct stat seen[PREWARM_FILES_MAX]; // of those warmed: one file under two paths is read once
+    int n_seen;
+    LockedRange *locked;
+    int n_locked;
+    int cap_locked;
+    bool lock_failed;               // reported once per command
+    bool script;                    // files[0] became the interpreter of the script named
+    ElfW(Half) machine;             // the executable's: libraries of another are skipped
+    const char *cache;              // PREWARM_LD_CACHE mapped, NULL if none
+    size_t cache_len;
+    PrewarmStats st;
+} Warmer;
+
+static void unlock_ranges(LockedRange *r, int n) {
+    for (int i = 0; i < n; i++) {
+        munmap(r[i].addr, r[i].len);
+    }
+    free(r);
+}
+
+static void add_file(Warmer *w, const char *path) {
+    for (int i = 0; i < w->n_files; i++) {
+        if (strcmp(w->files[i], path) == 0) {
+            return;
+        }
+    }
+    if (w->n_files == PREWARM_FILES_MAX) {
+        w->st.n_missing++; // beyond the limit: left to fault in
+        return;
+    }
+    if ((w->files[w->n_files] = strdup(path)) != NULL) {
+        w->n_files++;
+    }
+}
+
+static bool read_ehdr(int fd, ElfW(Ehdr) *eh) {
+    return pread(fd, eh, sizeof(*eh), 0) == sizeof(*eh) && memcmp(eh->e_ident, ELFMAG, SELFMAG) == 0 &&
+        eh->e_ident[EI_CLASS] == PREWARM_ELF_CLASS && eh->e_phentsize == sizeof(ElfW(Phdr)) &&
+        eh->e_phnum > 0 && eh->e_phnum <= PREWARM_PHNUM_MAX;
+}
+
+// a library ld.so would take for the executable
+static bool loadable(const Warmer *w, const char *path) {
+    ElfW(Ehdr) eh;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = read_ehdr(fd, &eh) && eh.e_type == ET_DYN && eh.e_machine == w->machine;
+    close(fd);
+    return ok;
+}
+
+// look for soname in the ':'-separated dirs, $ORIGIN in them being origin
+static bool find_in(const Warmer *w, const char *dirs, const char *origin, const char *soname,
+        char *out, size_t sz) {
+    char dir[PATH_MAX];
+
+    while (dirs != NULL && *dirs != '\0') {
+        const char *end = strchrnul(dirs, ':');
+        int len = end - dirs;
+        const char *o = memmem(dirs, len, "$ORIGIN", 7), *b = memmem(dirs, len, "${ORIGIN}", 9);
+        if (b != NULL) {
+            snprintf(dir, sizeof(dir), "%.*s%s%.*s", (int)(b - dirs), dirs, origin, (int)(end - b - 9), b + 9);
+        } else if (o != NULL) {
+            snprintf(dir, sizeof(dir), "%.*s%s%.*s", (int)(o - dirs), dirs, origin, (int)(end - o - 7), o + 7);
+        } else {
+            snprintf(dir, sizeof(dir), "%.*s", len, dirs);
+        }
+        dirs = *end == ':' ? end + 1 : end;
+        if (dir[0] == '\0') {
+            continue;
+        }
+        if ((size_t)snprintf(out, sz, "%s/%s", dir, soname) < sz && loadable(w, out)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool find_in_cache(const Warmer *w, const char *soname, char *out, size_t sz) {
+    const char *c = w->cache;
+    uint32_t n;
+
+    if (c == NULL || w->cache_len < LD_CACHE_HEADER ||
+            memcmp(c, LD_CACHE_MAGIC, sizeof(LD_CACHE_MAGIC) - 1) != 0) {
+        return false;
+    }
+    memcpy(&n, c + sizeof(LD_CACHE_MAGIC) - 1, sizeof(n));
+    for (uint32_t i = 0; i < n && LD_CACHE_HEADER + (size_t)(i + 1) * LD_CACHE_ENTRY <= w->cache_len; i++) {
+        uint32_t kv[2];
+        memcpy(kv, c + LD_CACHE_HEADER + (size_t)i * LD_CACHE_ENTRY + 4, sizeof(kv));
+        if (kv[0] >= w->cache_len || kv[1] >= w->cache_len ||
+                memchr(c + kv[0], '\0', w->cache_len - kv[0]) == NULL ||
+                memchr(c + kv[1], '\0', w->cache_len - kv[1]) == NULL || strcmp(c + kv[0], soname) != 0) {
+            continue;
+        }
+        if (strlen(c + kv[1]) < sz && loadable(w, c + kv[1])) { // entries of other ABIs share the name
+            strcpy(out, c + kv[1]);
+            return true;
+        }
+    }
+    return false;
+}
+
+// ld.so's order: DT_RPATH unless there is a DT_RUNPATH, LD_LIBRARY_PATH,
+// DT_RUNPATH, the cache, the default directories
+static void add_needed(Warmer *w, const char *soname, const char *rpath, const char *runpath,
+        const char *origin) {
+    char path[PATH_MAX];
+
+    if (strchr(soname, '/') != NULL) {
+        add_file(w, soname);
+        return;
+    }
+    if ((runpath == NULL && find_in(w, rpath, origin, soname, path, sizeof(path))) ||
+            find_in(w, getenv("LD_LIBRARY_PATH"), origin, soname, path, sizeof(path)) ||
+            find_in(w, runpath, origin, soname, path, sizeof(path)) ||
+            find_in_cache(w, soname, path, sizeof(path)) ||
+            find_in(w, PREWARM_LIB_DIRS, origin, soname, path, sizeof(path))) {
+        add_file(w, path);
+    } else {
+        w->st.n_missing++;
+    }
+}
+
+static void lock_segment(Warmer *w, int fd, const char *path, off_t off, size_t len) {
+    long pg = sysconf(_SC_PAGESIZE);
+    off_t start = off & ~(off_t)(pg - 1);
+    size_t span = len + (off - start);
+
+    if (w->n_locked == w->cap_locked) {
+        int cap = w->cap_locked ? w->cap_locked * 2 : 8;
+        LockedRange *r = realloc(w->locked, cap * sizeof(LockedRange));
+        if (r == NULL) {
+            return;
+        }
+        w->locked = r;
+        w->cap_locked = cap;
+    }
+    void *addr = mmap(NULL, span, PROT_READ, MAP_SHARED, fd, start);
+    if (addr != MAP_FAILED && mlock(addr, span) == 0) {
+        w->locked[w->n_locked++] = (LockedRange){addr, span};
+        w->st.n_locked += len;
+        return;
+    }
+    if (!w->lock_failed) {
+        showError(false, "Cannot lock the text of %s into memory: %s!", path, strerror(errno));
+        w->lock_failed = true;
+    }
+    if (addr != MAP_FAILED) {
+        munmap(addr, span);
+    }
+}
+
+// the dynamic section of a file: its libraries go onto w's list
+static void follow_dynamic(Warmer *w, int fd, const char *path, const ElfW(Phdr) *ph, int n,
+        const ElfW(Phdr) *dyn) {
+    char origin[PATH_MAX];
+    size_t n_dyn = dyn->p_filesz / sizeof(ElfW(Dyn));
+    ElfW(Addr) strtab = 0;
+    size_t strsz = 0;
+
+    if (n_dyn == 0 || n_dyn > PREWARM_STRTAB_MAX / sizeof(ElfW(Dyn))) {
+        return;
+    }
+    ElfW(Dyn) *d = malloc(n_dyn * sizeof(ElfW(Dyn)));
+    if (d == NULL || pread(fd, d, n_dyn * sizeof(ElfW(Dyn)), dyn->p_offset) != (ssize_t)(n_dyn * sizeof(ElfW(Dyn)))) {
+        free(d);
+        return;
+    }
+    for (size_t i = 0; i < n_dyn && d[i].d_tag != DT_NULL; i++) {
+        if (d[i].d_tag == DT_STRTAB) {
+            strtab = d[i].d_un.d_ptr;
+        } else if (d[i].d_tag == DT_STRSZ) {
+            strsz = d[i].d_un.d_val;
+        }
+    }
+    // DT_STRTAB is an address: find the file offset of the segment holding it
+    off_t str_off = -1;
+    for (int i = 0; i < n; i++) {
+        if (ph[i].p_type == PT_LOAD && strtab >= ph[i].p_vaddr && strtab < ph[i].p_vaddr + ph[i].p_filesz) {
+            str_off = ph[i].p_offset + (strtab - ph[i].p_vaddr);
+        }
+    }
+    char *str = str_off >= 0 && strsz > 0 && strsz <= PREWARM_STRTAB_MAX ? malloc(strsz + 1) : NULL;
+    if (str == NULL || pread(fd, str, strsz, str_off) != (ssize_t)strsz) {
+        free(str);
+        free(d);
+        return;
+    }
+    str[strsz] = '\0';
+    const char *rpath = NULL, *runpath = NULL;
+    for (size_t i = 0; i < n_dyn && d[i].d_tag != DT_NULL; i++) {
+        if (d[i].d_tag == DT_RPATH && d[i].d_un.d_val < strsz) {
+            rpath = str + d[i].d_un.d_val;
+        } else if (d[i].d_tag == DT_RUNPATH && d[i].d_un.d_val < strsz) {
+            runpath = str + d[i].d_un.d_val;
+        }
+    }
+    snprintf(origin, sizeof(origin), "%s", path);
+    char *slash = strrchr(origin, '/');
+    if (slash != NULL) {
+        *(slash == origin ? slash + 1 : slash) = '\0';
+    }
+    for (size_t i = 0; i < n_dyn && d[i].d_tag != DT_NULL; i++) {
+        if (d[i].d_tag == DT_NEEDED && d[i].d_un.d_val < strsz) {
+            add_needed(w, str + d[i].d_un.d_val, rpath, runpath, origin);
+        }
+    }
+    free(str);
+    free(d);
+}
+
+// read files[i] in, and queue its interpreter and libraries
+static int warm_file(Warmer *w, int i) {
+    const char *path = w->files[i];
+    char magic[PATH_MAX];
+    ElfW(Ehdr) eh;
+    ElfW(Phdr) ph[PREWARM_PHNUM_MAX];
+    const ElfW(Phdr) *dyn = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        if (i == 0) {
+            showError(false, "Cannot open %s to prewarm: %s!", path, strerror(errno));
+            return 1;
+        }
+        w->st.n_missing++; // found a moment ago, gone now
+        return 0;
+    }
+    struct stat *sb = &w->seen[w->n_seen];
+    if (w->n_seen < PREWARM_FILES_MAX && fstat(fd, sb) == 0) {
+        for (int k = 0; k < w->n_seen; k++) {
+            if (w->seen[k].st_dev == sb->st_dev && w->seen[k].st_ino == sb->st_ino) {
+                close(fd);
+                return 0;
+            }
+        }
+        w->n_seen++;
+    }
+    if (!read_ehdr(fd, &eh)) {
+        ssize_t n = i == 0 ? pread(fd, magic, sizeof(magic) - 1, 0) : -1;
+        close(fd);
+        if (n > 2 && magic[0] == '#' && magic[1] == '!') { // a script: warm its interpreter
+            magic[n] = '\0';
+            char *interp = magic + 2 + strspn(magic + 2, " \t");
+            interp[strcspn(interp, " \t\n")] = '\0';
+            if (*interp == '/' && !w->script) {
+                w->script = true;
+                free(w->files[0]);
+                w->files[0] = strdup(interp);
+                return w->files[0] != NULL ? warm_file(w, 0) : 1;
+            }
+        }
+        if (i == 0) {
+            showError(false, "Not prewarming %s: no ELF executable of this ABI!", path);
+            return 1;
+        }
+        return 0;
+    }
+    if (i == 0) {
+        w->machine = eh.e_machine;
+    }
+    if (pread(fd, ph, eh.e_phnum * sizeof(ElfW(Phdr)), eh.e_phoff) != (ssize_t)(eh.e_phnum * sizeof(ElfW(Phdr)))) {
+        close(fd);
+        return i == 0;
+    }
+    for (int k = 0; k < eh.e_phnum; k++) {
+        if (ph[k].p_type == PT_LOAD && ph[k].p_filesz > 0) {
+            // best effort: both only start the reads, and may drop some under memory
+            // pressure; fadvise where readahead is refused
+            if (readahead(fd, ph[k].p_offset, ph[k].p_filesz) != 0) {
+                posix_fadvise(fd, ph[k].p_offset, ph[k].p_filesz, POSIX_FADV_WILLNEED);
+            }
+            w->st.n_bytes += ph[k].p_filesz;
+            if ((w->flags & PREWARM_LOCK) && (ph[k].p_flags & PF_X)) {
+                lock_segment(w, fd, path, ph[k].p_offset, ph[k].p_filesz);
+            }
+        } else if (ph[k].p_type == PT_INTERP && ph[k].p_filesz > 1 && ph[k].p_filesz < sizeof(magic) &&
+                pread(fd, magic, ph[k].p_filesz, ph[k].p_offset) == (ssize_t)ph[k].p_filesz) {
+            magic[ph[k].p_filesz - 1] = '\0';
+            add_file(w, magic);
+        } else if (ph[k].p_type == PT_DYNAMIC) {
+            dyn = &ph[k];
+        }
+    }
+    if (dyn != NULL) {
+        follow_dynamic(w, fd, path, ph, eh.e_phnum, dyn);
+    }
+    close(fd);
+    w->st.n_files++;
+    return 0;
+}
+
+// keep w's result under name, replacing an earlier one
+static int add_entry(const char *name, Warmer *w) {
+    char *n = strdup(name);
+
+    if (n == NULL) {
+        showError(false, "Failed to allocate prewarm entry for %s!", name);
+        unlock_ranges(w->locked, w->n_locked);
+        return 1;
+    }
+    pthread_mutex_lock(&prewarm_lock);
+    int i = 0;
+    while (i < n_entries && strcmp(entries[i].name, name) != 0) {
+        i++;
+    }
+    if (i == PREWARM_MAX) {
+        pthread_mutex_unlock(&prewarm_lock);
+        showError(false, "Too many commands registered for prewarming at %s!", name);
+        free(n);
+        unlock_ranges(w->locked, w->n_locked);
+        return 1;
+    }
+    if (i < n_entries) {
+        free(entries[i].name);
+        unlock_ranges(entries[i].locked, entries[i].n_locked);
+    } else {
+        n_entries++;
+    }
+    entries[i] = (Prewarm){.name = n, .flags = w->flags, .locked = w->locked, .n_locked = w->n_locked,
+        .st = w->st};
+    pthread_mutex_unlock(&prewarm_lock);
+    return 0;
+}
+
+int prewarm_command(const char *name, int flags) {
+    char path[PATH_MAX];
+    Warmer w = {.flags = flags};
+    struct stat sb;
+    int rc = 0;
+
+    if (strchr(name, '/') != NULL) {
+        if (strlen(name) >= sizeof(path)) {
+            showError(false, "Executable path %s is too long!", name);
+            return 1;
+        }
+        strcpy(path, name);
+    } else if (!(path_cache_enabled() && lookup_path_cache(name, path, sizeof(path))) &&
+            !resolve_path(name, path, sizeof(path))) {
+        showError(false, "Failed to find %s in PATH!", name);
+        return 1;
+    }
+    int cfd = open(PREWARM_LD_CACHE, O_RDONLY | O_CLOEXEC);
+    if (cfd >= 0 && fstat(cfd, &sb) == 0 && sb.st_size > 0) {
+        void *c = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, cfd, 0);
+        if (c != MAP_FAILED) {
+            w.cache = c;
+            w.cache_len = sb.st_size;
+        }
+    }
+    if (cfd >= 0) {
+        close(cfd);
+    }
+    add_file(&w, path);
+    for (int i = 0; i < w.n_files && rc == 0; i++) {
+        rc = warm_file(&w, i);
+    }
+    if (w.cache != NULL) {
+        munmap((void *)w.cache, w.cache_len);
+    }
+    for (int i = 0; i < w.n_files; i++) {
+        free(w.files[i]);
+    }
+    if (w.n_files == 0 || rc != 0) {
+        unlock_ranges(w.locked, w.n_locked);
+        return 1;
+    }
+    return add_entry(name, &w);
+}
+
+int prewarm_all(void) {
+    char *names[PREWARM_MAX];
+    int flags[PREWARM_MAX], n = 0, failed = 0;
+
+    pthread_mutex_lock(&prewarm_lock);
+    for (int i = 0; i < n_entries; i++) {
+        if ((names[n] = strdup(entries[i].name)) != NULL) {
+            flags[n++] = entries[i].flags;
+        }
+    }
+    pthread_mutex_unlock(&prewarm_lock);
+    for (int i = 0; i < n; i++) { // outside the lock: reading them in takes a while
+        failed += prewarm_command(names[i], flags[i]) != 0;
+        free(names[i]);
+    }
+    return failed;
+}
+
+void drop_prewarm(const char *name) {
+    pthread_mutex_lock(&prewarm_lock);
+    for (int i = n_entries - 1; i >= 0; i--) {
+        if (name == NULL || strcmp(entries[i].name, name) == 0) {
+            free(entries[i].name);
+            unlock_ranges(entries[i].locked, entries[i].n_locked);
+            entries[i] = entries[--n_entries];
+        }
+    }
+    pthread_mutex_unlock(&prewarm_lock);
+}
+
+void prewarm_stats(PrewarmStats *st) {
+    memset(st, 0, sizeof(*st));
+    pthread_mutex_lock(&prewarm_lock);
+    for (int i = 0; i < n_entries; i++) {
+        st->n_files += entries[i].st.n_files;
+        st->n_missing += entries[i].st.n_missing;
+        st->n_bytes += entries[i].st.n_bytes;
+        st->n_locked += entries[i].st.n_locked;
+    }
+    pthread_mutex_unlock(&prewarm_lock);
+}
@@ -0,0 +1,39 @@
+#ifndef PREWARM_H
+#define PREWARM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PREWARM_MAX 32          // registered commands, meant for a handful of big ones
+#define PREWARM_FILES_MAX 64    // the executable, its interpreter and libraries, per command
+
+#define PREWARM_LOCK 1          // also mlock() the executable segments, until dropped
+
+typedef struct {
+    size_t n_files;     // executables, interpreters and libraries read in
+    size_t n_missing;   // DT_NEEDED libraries not found
+    uint64_t n_bytes;   // of PT_LOAD segments readahead was asked for, not known to be resident
+    uint64_t n_locked;  // of those, mlock()ed
+} PrewarmStats;
+
+// the first spawns after a deployment or a page cache eviction fault the
+// executable and every DT_NEEDED library in page by page. A registered
+// command is resolved like a spawn would (the path cache when it's on,
+// else a PATH walk), its ELF program headers and dynamic section followed
+// to its interpreter and libraries, transitively: DT_RPATH,
+// LD_LIBRARY_PATH, DT_RUNPATH (with $ORIGIN), /etc/ld.so.cache and the
+// default directories, as ld.so searches them. Each file's PT_LOAD
+// segments are then readahead(), so exec is likely to find them in the
+// page cache; the reads are only started, and may still be in flight when
+// this returns; only the segments PREWARM_LOCK mlock()s are in for sure
+// Registering a name again resolves and warms it afresh
+int prewarm_command(const char *name, int flags);
+// warm every registered command again, say after a deployment; returns
+// how many failed
+int prewarm_all(void);
+// forget name, or every command when NULL, unlocking what it locked
+void drop_prewarm(const char *name);
+// summed over the registered commands' latest warming
+void prewarm_stats(PrewarmStats *st);
+
+#endif // PREWARM_H
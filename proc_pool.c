@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "proc_pool.h"
+
+void init_ProcPool(ProcPool *p, size_t max_keep) {
+    memset(p, 0, sizeof(*p));
+    p->owner = pthread_self();
+    p->max_keep = max_keep;
+}
+
+void close_ProcPool(ProcPool *p) {
+    for (ProcSlab *s = p->slabs, *next; s != NULL; s = next) {
+        next = s->next;
+        for (int i = 0; i < PROC_SLAB_SLOTS; i++) {
+            free_CaptureResult(&s->slots[i].out);
+        }
+        free(s);
+    }
+    memset(p, 0, sizeof(*p));
+}
+
+static int grow(ProcPool *p) {
+    ProcSlab *s = calloc(1, sizeof(ProcSlab));
+    if (s == NULL) {
+        showError(false, "Failed to allocate %d process slots!", PROC_SLAB_SLOTS);
+        return 1;
+    }
+    s->next = p->slabs;
+    p->slabs = s;
+    for (int i = PROC_SLAB_SLOTS - 1; i >= 0; i--) {
+        s->slots[i].pool = p;
+        s->slots[i].next = p->free;
+        p->free = &s->slots[i];
+    }
+    p->n_slots += PROC_SLAB_SLOTS;
+    return 0;
+}
+
+ProcSlot *acquire_ProcPool(ProcPool *p) {
+    if (p->free == NULL) {
+        // only the owner takes from remote, so a plain swap is ABA-free
+        p->free = __atomic_exchange_n(&p->remote, NULL, __ATOMIC_ACQUIRE);
+    }
+    if (p->free == NULL && grow(p)) {
+        return NULL;
+    }
+    ProcSlot *s = p->free;
+    p->free = s->next;
+    s->next = NULL;
+    memset(&s->ci, 0, sizeof(s->ci));
+    s->ci.p_stdin = s->ci.p_stdout = s->ci.p_stderr = -1;
+    s->ci.pidfd = -1;
+    reset_CaptureResult(&s->out);
+    s->out.status = -1;
+    for (int i = 0; i < 4; i++) {
+        s->pfds[i] = (struct pollfd){.fd = -1};
+    }
+    return s;
+}
+
+static void trim(CaptureBuf *b, size_t max_keep) {
+    if (max_keep > 0 && b->cap > max_keep) {
+        free(b->data);
+        b->data = NULL;
+        b->cap = b->len = b->head = b->total = 0;
+    }
+}
+
+void release_ProcSlot(ProcSlot *s) {
+    ProcPool *p = s->pool;
+
+    close_ProcInfo(&s->ci);
+    trim(&s->out.out, p->max_keep);
+    trim(&s->out.err, p->max_keep);
+    if (pthread_equal(pthread_self(), p->owner)) {
+        s->next = p->free;
+        p->free = s;
+        return;
+    }
+    s->next = __atomic_load_n(&p->remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&p->remote, &s->next, s, true,
+            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
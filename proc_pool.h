@@ -0,0 +1,50 @@
+#ifndef PROC_POOL_H
+#define PROC_POOL_H
+
+#include <stddef.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "subprocess.h"
+#include "capture.h"
+
+#define PROC_SLAB_SLOTS 64
+
+typedef struct ProcPool ProcPool;
+
+// a pooled ProcInfo with the buffers that usually travel with it
+typedef struct ProcSlot {
+    ProcInfo ci;
+    CaptureResult out;          // buffers survive release, only their bytes are dropped
+    struct pollfd pfds[4];      // stdin, stdout, stderr, pidfd
+    ProcPool *pool;
+    struct ProcSlot *next;      // free list
+} ProcSlot;
+
+typedef struct ProcSlab {
+    struct ProcSlab *next;
+    ProcSlot slots[PROC_SLAB_SLOTS];
+} ProcSlab;
+
+// slab allocator for ProcSlots, owned by one spawner thread: acquire and
+// release from the owner never lock; other threads releasing a slot push it
+// onto a lock-free list the owner collects in one swap when it runs dry
+struct ProcPool {
+    pthread_t owner;
+    ProcSlot *free;
+    ProcSlot *remote;           // released by other threads
+    ProcSlab *slabs;
+    size_t n_slots;
+    size_t max_keep;            // capture buffers above this are freed on release, 0 keeps all
+};
+
+// call from the owning thread
+void init_ProcPool(ProcPool *p, size_t max_keep);
+// every slot must be released first
+void close_ProcPool(ProcPool *p);
+// a slot with fds set to -1 and empty capture buffers; NULL on ENOMEM
+ProcSlot *acquire_ProcPool(ProcPool *p);
+// close_ProcInfo() and hand the slot back; safe from any thread
+void release_ProcSlot(ProcSlot *s);
+
+#endif // PROC_POOL_H
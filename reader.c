@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "reader.h"
+
+static ReadChunk *new_chunk(ChunkReader *r) {
+    ReadChunk *c = r->spare;
+
+    if (c != NULL && c->cap >= r->chunk) {
+        r->spare = NULL;
+    } else {
+        free(r->spare);
+        r->spare = NULL;
+        if ((c = malloc(sizeof(ReadChunk) + r->chunk)) == NULL) {
+            return NULL;
+        }
+        c->cap = r->chunk;
+    }
+    c->next = NULL;
+    c->off = c->len = 0;
+    return c;
+}
+
+static void recycle(ChunkReader *r, ReadChunk *c) {
+    if (r->spare == NULL || r->spare->cap < c->cap) {
+        free(r->spare);
+        r->spare = c;
+    } else {
+        free(c);
+    }
+}
+
+void init_ChunkReader(ChunkReader *r) {
+    memset(r, 0, sizeof(*r));
+    r->chunk = READER_MIN_CHUNK;
+}
+
+void free_ChunkReader(ChunkReader *r) {
+    for (ReadChunk *c = r->head, *next; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(r->spare);
+    init_ChunkReader(r);
+}
+
+// readv() for off < 0, else preadv() at off
+static ssize_t fill(ChunkReader *r, int fd, off_t off) {
+    struct iovec iov[2];
+    int n_iov = 0;
+    ReadChunk *fresh;
+
+    if (r->max_chunk == 0) {
+        int sz = fcntl(fd, F_GETPIPE_SZ);
+        r->max_chunk = sz > READER_MIN_CHUNK ? (size_t)sz : READER_MIN_CHUNK;
+    }
+    // top up the tail first, spill into a fresh chunk
+    if (r->tail != NULL && r->tail->len < r->tail->cap) {
+        iov[n_iov++] = (struct iovec){r->tail->data + r->tail->len, r->tail->cap - r->tail->len};
+    }
+    if ((fresh = new_chunk(r)) == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    iov[n_iov++] = (struct iovec){fresh->data, fresh->cap};
+
+    ssize_t n = off < 0 ? readv(fd, iov, n_iov) : preadv(fd, iov, n_iov, off);
+    if (n <= 0) {
+        recycle(r, fresh);
+        return n;
+    }
+    size_t offered = iov[0].iov_len + (n_iov > 1 ? iov[1].iov_len : 0);
+    size_t left = n;
+    if (n_iov > 1) {
+        size_t k = left < iov[0].iov_len ? left : iov[0].iov_len;
+        r->tail->len += k;
+        left -= k;
+    }
+    if (left > 0) {
+        fresh->len = left;
+        if (r->tail != NULL) {
+            r->tail->next = fresh;
+        } else {
+            r->head = fresh;
+        }
+        r->tail = fresh;
+    } else {
+        recycle(r, fresh);
+    }
+    r->len += n;
+    r->total += n;
+    // the pipe had at least as much as we offered: read bigger next time
+    if ((size_t)n == offered && r->chunk < r->max_chunk) {
+        r->chunk = r->chunk * 2 < r->max_chunk ? r->chunk * 2 : r->max_chunk;
+    }
+    return n;
+}
+
+ssize_t read_ChunkReader(ChunkReader *r, int fd) {
+    return fill(r, fd, -1);
+}
+
+ssize_t pread_ChunkReader(ChunkReader *r, int fd, off_t off) {
+    return fill(r, fd, off);
+}
+
+void consume_ChunkReader(ChunkReader *r, size_t n) {
+    if (n > r->len) {
+        n = r->len;
+    }
+    r->len -= n;
+    while (n > 0 && r->head != NULL) {
+        ReadChunk *c = r->head;
+        size_t avail = c->len - c->off;
+        if (n < avail) {
+            c->off += n;
+            return;
+        }
+        n -= avail;
+        c->off = c->len;
+        if (c == r->tail) {
+            c->off = c->len = 0; // keep filling it from the start
+            return;
+        }
+        r->head = c->next;
+        recycle(r, c);
+    }
+}
+
+char *flatten_ChunkReader(const ChunkReader *r, size_t *len) {
+    char *buf = malloc(r->len + 1), *p = buf;
+
+    if (buf == NULL) {
+        return NULL;
+    }
+    for (const ReadChunk *c = r->head; c != NULL; c = c->next) {
+        memcpy(p, c->data + c->off, c->len - c->off);
+        p += c->len - c->off;
+    }
+    *p = '\0';
+    if (len != NULL) {
+        *len = p - buf;
+    }
+    return buf;
+}
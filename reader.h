@@ -0,0 +1,46 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define READER_MIN_CHUNK (64 * 1024)
+
+typedef struct ReadChunk {
+    struct ReadChunk *next;
+    size_t cap;
+    size_t off;             // consumed bytes at the front
+    size_t len;             // bytes filled, off included
+    char data[];
+} ReadChunk;
+
+// pulls child output with readv() into a chain of chunks: bytes are never
+// moved once read, a contiguous copy is only made by flatten_ChunkReader()
+// chunks start at READER_MIN_CHUNK and double, up to the pipe's capacity,
+// each time a read fills everything that was offered
+typedef struct {
+    ReadChunk *head;        // oldest unconsumed data
+    ReadChunk *tail;        // being filled
+    ReadChunk *spare;       // one drained chunk kept for reuse
+    size_t chunk;           // size of the next chunk
+    size_t max_chunk;       // F_GETPIPE_SZ of the fd, once known
+    size_t len;             // unconsumed bytes held
+    size_t total;           // bytes read over the reader's life
+} ChunkReader;
+
+void init_ChunkReader(ChunkReader *r);
+void free_ChunkReader(ChunkReader *r);
+// one readv() from fd; bytes read, 0 at EOF, -1 with errno (EAGAIN on an empty
+// non-blocking fd)
+ssize_t read_ChunkReader(ChunkReader *r, int fd);
+// read_ChunkReader() from offset off of a file, leaving its file offset alone;
+// 0 at its current end
+ssize_t pread_ChunkReader(ChunkReader *r, int fd, off_t off);
+// drop n bytes from the front, recycling drained chunks
+void consume_ChunkReader(ChunkReader *r, size_t n);
+// everything unconsumed as one NUL-terminated malloc()ed block; the reader
+// keeps its data, NULL on ENOMEM
+char *flatten_ChunkReader(const ChunkReader *r, size_t *len);
+
+#endif // READER_H
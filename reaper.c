@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+
+#include "reaper.h"
+
+static size_t hash_pid(pid_t pid, size_t cap) {
+    return ((uint32_t)pid * 2654435761u) & (cap - 1);
+}
+
+static ReapEntry *find(ChildReaper *r, pid_t pid) {
+    for (size_t i = hash_pid(pid, r->cap); r->table[i].pid != 0; i = (i + 1) & (r->cap - 1)) {
+        if (r->table[i].pid == pid) {
+            return &r->table[i];
+        }
+    }
+    return NULL;
+}
+
+static ReapEntry *insert(ChildReaper *r, pid_t pid) {
+    if ((r->n + 1) * 2 > r->cap) {
+        size_t cap = r->cap * 2;
+        ReapEntry *old = r->table, *table = calloc(cap, sizeof(ReapEntry));
+        if (table == NULL) {
+            return NULL;
+        }
+        size_t old_cap = r->cap;
+        r->table = table;
+        r->cap = cap;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i].pid != 0) {
+                size_t j = hash_pid(old[i].pid, cap);
+                while (table[j].pid != 0) {
+                    j = (j + 1) & (cap - 1);
+                }
+                table[j] = old[i];
+            }
+        }
+        free(old);
+    }
+    size_t i = hash_pid(pid, r->cap);
+    while (r->table[i].pid != 0) {
+        i = (i + 1) & (r->cap - 1);
+    }
+    r->n++;
+    r->table[i] = (ReapEntry){.pid = pid};
+    return &r->table[i];
+}
+
+// backward-shift deletion: no tombstones, lookups stay short
+static void erase(ChildReaper *r, ReapEntry *e) {
+    size_t i = e - r->table, mask = r->cap - 1;
+
+    for (size_t j = (i + 1) & mask; r->table[j].pid != 0; j = (j + 1) & mask) {
+        size_t home = hash_pid(r->table[j].pid, r->cap);
+        // move j into the hole at i unless its home lies cyclically in (i, j]
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            r->table[i] = r->table[j];
+            i = j;
+        }
+    }
+    r->table[i].pid = 0;
+    r->n--;
+}
+
+static void deliver(ChildReaper *r, ReapEntry *e) {
+    ReapEntry done = *e;
+    erase(r, e);
+    done.ci->usage = done.usage;
+    clock_gettime(CLOCK_REALTIME, &done.ci->t_end);
+    done.cb(r, done.ci, done.status, done.data);
+}
+
+int drain_ChildReaper(ChildReaper *r) {
+    int n = 0, status;
+    struct rusage usage;
+    pid_t pid;
+
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        ReapEntry *e = find(r, pid);
+        if (e == NULL && (e = insert(r, pid)) == NULL) {
+            continue; // nobody can claim it without memory anyway
+        }
+        e->status = status;
+        e->usage = usage;
+        if (e->ci == NULL) {
+            continue; // parked until watch_ChildReaper() claims it
+        }
+        deliver(r, e);
+        n++;
+    }
+    return n;
+}
+
+static void on_sigchld(EventLoop *loop, int fd, unsigned revents, void *data) {
+    ChildReaper *r = data;
+    struct signalfd_siginfo si[16];
+
+    // one wait4() sweep covers every queued signal, empty the fd first
+    while (read(fd, si, sizeof(si)) == sizeof(si));
+    drain_ChildReaper(r);
+}
+
+int init_ChildReaper(ChildReaper *r, EventLoop *loop) {
+    sigset_t mask;
+
+    memset(r, 0, sizeof(*r));
+    r->loop = loop;
+    r->cap = 64;
+    if ((r->table = calloc(r->cap, sizeof(ReapEntry))) == NULL) {
+        showError(false, "Failed to allocate child reaper!");
+        return 1;
+    }
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &r->old_mask);
+    r->sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (r->sfd < 0 || add_EventLoop(loop, r->sfd, POLLIN, on_sigchld, r)) {
+        showError(false, "Failed to set up SIGCHLD signalfd: %s!", strerror(errno));
+        close_ChildReaper(r);
+        return 1;
+    }
+    set_spawn_sigmask(&r->old_mask);
+    // children that exited before the signal was blocked raised it already
+    drain_ChildReaper(r);
+    return 0;
+}
+
+void close_ChildReaper(ChildReaper *r) {
+    if (r->sfd >= 0) {
+        del_EventLoop(r->loop, r->sfd);
+        close(r->sfd);
+        r->sfd = -1;
+    }
+    if (r->table != NULL) {
+        set_spawn_sigmask(NULL);
+        pthread_sigmask(SIG_SETMASK, &r->old_mask, NULL);
+        free(r->table);
+        r->table = NULL;
+    }
+    r->cap = r->n = 0;
+}
+
+int watch_ChildReaper(ChildReaper *r, ProcInfo *ci, ReapCallback cb, void *data) {
+    ReapEntry *e = find(r, ci->pid);
+
+    if (e != NULL && e->ci == NULL) { // beat us to it
+        e->ci = ci;
+        e->cb = cb;
+        e->data = data;
+        deliver(r, e);
+        return 0;
+    }
+    if (e == NULL && (e = insert(r, ci->pid)) == NULL) {
+        showError(false, "Failed to watch pid %d!", ci->pid);
+        return 1;
+    }
+    e->ci = ci;
+    e->cb = cb;
+    e->data = data;
+    return 0;
+}
+
+void unwatch_ChildReaper(ChildReaper *r, ProcInfo *ci) {
+    ReapEntry *e = find(r, ci->pid);
+    if (e != NULL && e->ci == ci) {
+        erase(r, e);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef REAPER_H
+#define REAPER_H
+
+#include <stddef.h>
+#include <signal.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+
+typedef struct ChildReaper ChildReaper;
+
+// runs once ci's exit was collected; status is the wait status
+typedef void (*ReapCallback)(ChildReaper *r, ProcInfo *ci, int status, void *data);
+
+typedef struct {
+    pid_t pid;          // 0 for a free slot
+    ProcInfo *ci;       // NULL: exited before it was watched, status is kept
+    int status;
+    struct rusage usage;
+    ReapCallback cb;
+    void *data;
+} ReapEntry;
+
+// SIGCHLD through a signalfd for kernels without pidfd_open: every signal
+// drains all exited children at once, since pending SIGCHLDs coalesce.
+// While it is open the reaper collects every child of the process, watched
+// or not. SIGCHLD is blocked in the calling thread: init it before starting
+// threads so they inherit the mask, children still start with the old one
+struct ChildReaper {
+    EventLoop *loop;
+    int sfd;
+    sigset_t old_mask;
+    ReapEntry *table;   // open addressing on pid, at most half full
+    size_t cap;         // power of two
+    size_t n;
+};
+
+int init_ChildReaper(ChildReaper *r, EventLoop *loop);
+void close_ChildReaper(ChildReaper *r);
+// call cb from the loop once ci exits, right away if it already has
+int watch_ChildReaper(ChildReaper *r, ProcInfo *ci, ReapCallback cb, void *data);
+void unwatch_ChildReaper(ChildReaper *r, ProcInfo *ci);
+// collect every exited child now; returns how many callbacks ran
+int drain_ChildReaper(ChildReaper *r);
+
+#endif // REAPER_H
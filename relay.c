@@ -0,0 +1,297 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "relay.h"
+#include "metrics.h"
+
+static void on_readable(EventLoop *loop, int fd, unsigned revents, void *data);
+static void on_writable(EventLoop *loop, int fd, unsigned revents, void *data);
+
+static void close_in(Relay *r) {
+    if (r->in_fd >= 0) {
+        if (!r->in_paused) {
+            del_EventLoop(r->loop, r->in_fd);
+        }
+        close(r->in_fd);
+        r->in_fd = -1;
+    }
+}
+
+static void close_out(Relay *r) {
+    if (r->out_fd >= 0) {
+        if (!r->out_sync) {
+            del_EventLoop(r->loop, r->out_fd);
+        }
+        close(r->out_fd);
+        r->out_fd = -1;
+    }
+}
+
+static void finish(Relay *r) {
+    close_in(r);
+    close_out(r);
+    if (r->on_done != NULL) {
+        r->on_done(r, r->data);
+    }
+}
+
+// move the unwritten bytes to the front of the buffer
+static void compact(Relay *r) {
+    memmove(r->buf, r->buf + r->start, r->end - r->start);
+    r->ready -= r->start;
+    r->end -= r->start;
+    r->start = 0;
+}
+
+// run the filter over what came in since the last call; with lines set
+// only up to the last '\n' unless final (EOF) or a line fills the buffer
+static void filter_new(Relay *r, bool final) {
+    size_t cut = r->end;
+
+    if (r->lines && !final) {
+        const char *nl = memrchr(r->buf + r->ready, '\n', r->end - r->ready);
+        if (nl != NULL) {
+            cut = nl - r->buf + 1;
+        } else if (r->start < r->ready || r->end - r->start < r->cap) {
+            return; // wait for the line end; a line as long as the buffer goes in pieces
+        }
+    }
+    size_t len = cut - r->ready;
+    if (len == 0) {
+        return;
+    }
+    size_t keep = r->filter != NULL ? r->filter(r->ctx, r->buf + r->ready, len) : len;
+    if (keep > len) {
+        keep = len;
+    }
+    memmove(r->buf + r->ready + keep, r->buf + cut, r->end - cut);
+    r->ready += keep;
+    r->end -= len - keep;
+}
+
+int emit_Relay(Relay *r, const char *data, size_t len) {
+    if (r->end + len > r->cap && r->start > 0) {
+        compact(r);
+    }
+    if (r->end + len > r->cap) {
+        char *buf = realloc(r->buf, r->end + len);
+        if (buf == NULL) {
+            showError(false, "Failed to grow relay buffer!");
+            return 1;
+        }
+        r->buf = buf;
+        r->cap = r->end + len;
+    }
+    // behind the kept bytes, ahead of a partial line still waiting
+    memmove(r->buf + r->ready + len, r->buf + r->ready, r->end - r->ready);
+    memcpy(r->buf + r->ready, data, len);
+    r->ready += len;
+    r->end += len;
+    return 0;
+}
+
+static void set_out(Relay *r) {
+    bool want = r->start < r->ready;
+    if (r->out_sync) {
+        if (want && r->out_fd >= 0) {
+            on_writable(r->loop, r->out_fd, POLLOUT, r);
+        }
+        return;
+    }
+    if (r->out_fd >= 0 && want != r->out_armed) {
+        mod_EventLoop(r->loop, r->out_fd, want ? POLLOUT : 0);
+        r->out_armed = want;
+    }
+}
+
+static void set_in(Relay *r) {
+    if (r->in_fd < 0) {
+        return;
+    }
+    bool full = r->end - r->start == r->cap;
+    if (full && !r->in_paused) {
+        // out of the loop rather than events 0: a hung up pipe reports POLLHUP anyway
+        del_EventLoop(r->loop, r->in_fd);
+        r->in_paused = true;
+        r->n_pauses++;
+    } else if (!full && r->in_paused) {
+        if (add_EventLoop(r->loop, r->in_fd, POLLIN, on_readable, r) == 0) {
+            r->in_paused = false;
+        }
+    }
+}
+
+// all of the input went out: pass the EOF on
+static void check_done(Relay *r) {
+    if (r->eof && r->start == r->end && r->out_fd >= 0) {
+        finish(r);
+    }
+}
+
+static void on_readable(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Relay *r = data;
+
+    if (r->start > 0 && r->end == r->cap) {
+        compact(r);
+    }
+    ssize_t n = read(fd, r->buf + r->end, r->cap - r->end);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (n > 0) {
+        r->end += n;
+        r->n_in += n;
+        filter_new(r, false);
+    } else if (n < 0) {
+        r->err = errno;
+    }
+    if (n <= 0 || r->stop_in) {
+        filter_new(r, true);
+        r->eof = true;
+        close_in(r);
+        if (r->on_end != NULL) {
+            r->on_end(r->ctx, r);
+        }
+    }
+    set_out(r);
+    set_in(r);
+    check_done(r);
+}
+
+// write what is ready; SIGPIPE is held back as in the stdin feeder, so a
+// downstream that exited shows up as EPIPE; false once the relay finished
+static bool pump(Relay *r, int fd) {
+    sigset_t pipe_set, old_set;
+    bool open = true;
+
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    while (r->start < r->ready) {
+        ssize_t w = write(fd, r->buf + r->start, r->ready - r->start);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0 && errno == EAGAIN) {
+            metrics_write_stalled(STDIN_FILENO); // the next stage's input is full
+            break;
+        }
+        if (w < 0) {
+            r->err = errno;
+            if (errno == EPIPE) { // consume the SIGPIPE we just caused
+                struct timespec zero = {0, 0};
+                sigtimedwait(&pipe_set, NULL, &zero);
+            }
+            open = false;
+            break;
+        }
+        r->start += w;
+        r->n_out += w;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return open;
+}
+
+static void on_writable(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Relay *r = data;
+
+    if ((revents & (POLLERR | POLLHUP)) && r->start == r->ready) {
+        r->err = EPIPE; // the reader left while there was nothing to write
+        r->eof = true;
+        r->start = r->ready = r->end = 0;
+        finish(r);
+        return;
+    }
+    if (!pump(r, fd)) { // the downstream is gone: closing the upstream lets the producer know
+        r->eof = true;
+        r->start = r->ready = r->end = 0;
+        finish(r);
+        return;
+    }
+    if (r->start == r->end) {
+        r->start = r->ready = r->end = 0;
+    } else if (r->start == r->ready) {
+        compact(r); // only a partial line is left: make room for the rest of it
+    }
+    set_out(r);
+    set_in(r);
+    check_done(r);
+}
+
+static int make_nonblocking(int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    return fl < 0 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) ? -1 : 0;
+}
+
+int init_Relay(Relay *r, EventLoop *loop, int in_fd, int out_fd, size_t cap,
+        RelayFilter filter, void *ctx, RelayDone on_done, void *data) {
+    memset(r, 0, sizeof(*r));
+    r->loop = loop;
+    r->in_fd = in_fd;
+    r->out_fd = out_fd;
+    r->cap = cap > 0 ? cap : RELAY_DEFAULT_CAP;
+    r->filter = filter;
+    r->ctx = ctx;
+    r->on_done = on_done;
+    r->data = data;
+    if (in_fd < 0 || out_fd < 0) {
+        showError(false, "Relay needs both an upstream and a downstream fd!");
+        close_Relay(r);
+        return 1;
+    }
+    if ((r->buf = malloc(r->cap)) == NULL) {
+        showError(false, "Failed to allocate relay buffer!");
+        close_Relay(r);
+        return 1;
+    }
+    if (make_nonblocking(in_fd) || make_nonblocking(out_fd)) {
+        showError(false, "Failed to make relay fds non-blocking: %s!", strerror(errno));
+        close_Relay(r);
+        return 1;
+    }
+    r->in_paused = true; // not registered yet
+    if (add_EventLoop(loop, out_fd, 0, on_writable, r)) {
+        r->out_sync = errno == EPERM; // a regular file never blocks anyway
+        if (!r->out_sync) {
+            showError(false, "Failed to watch relay fds: %s!", strerror(errno));
+            close_Relay(r);
+            return 1;
+        }
+    }
+    if (add_EventLoop(loop, in_fd, POLLIN, on_readable, r)) {
+        showError(false, "Failed to watch relay fds: %s!", strerror(errno));
+        close_Relay(r);
+        return 1;
+    }
+    r->in_paused = false;
+    return 0;
+}
+
+int init_stages_Relay(Relay *r, EventLoop *loop, ProcInfo *from, ProcInfo *to, size_t cap,
+        RelayFilter filter, void *ctx, RelayDone on_done, void *data) {
+    if (from->p_stdout < 0 || to->p_stdin < 0) {
+        showError(false, "Relay needs a piped stdout of %d and stdin of %d!", from->pid, to->pid);
+        return 1;
+    }
+    del_EventLoop(loop, from->p_stdout); // watch_ProcInfo() may have registered them
+    del_EventLoop(loop, to->p_stdin);
+    int rc = init_Relay(r, loop, from->p_stdout, to->p_stdin, cap, filter, ctx, on_done, data);
+    from->p_stdout = -1; // closed by the relay, also when init failed
+    to->p_stdin = -1;
+    return rc;
+}
+
+void close_Relay(Relay *r) {
+    close_in(r);
+    close_out(r);
+    free(r->buf);
+    r->buf = NULL;
+}
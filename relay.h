@@ -0,0 +1,78 @@
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "event_loop.h"
+
+#define RELAY_DEFAULT_CAP (64 * 1024)
+
+typedef struct Relay Relay;
+
+// rewrite len bytes in place and return how many of them to pass on (at most
+// len, so the buffer bound holds); with lines set buf holds whole lines only
+typedef size_t (*RelayFilter)(void *ctx, char *buf, size_t len);
+// upstream ended: a last chance to emit_Relay() what the filter held back
+typedef void (*RelayEnd)(void *ctx, Relay *r);
+// the relay finished: upstream ended and everything was written, or err says why not
+typedef void (*RelayDone)(Relay *r, void *data);
+
+// One edge between two stages that the parent sits in, e.g. to filter the
+// output of one child before it goes to the stdin of the next. The edge
+// owns a buffer of cap bytes: when it is full the upstream fd is taken out
+// of the loop (its writer then blocks on the full pipe), and POLLOUT on the
+// downstream fd is only asked for while there is something to write, so
+// the relay holds at most cap bytes however fast or slow either side is.
+// Upstream EOF is passed on by closing the downstream fd once drained; a
+// downstream that went away (EPIPE) closes the upstream fd too, so the
+// producer gets its SIGPIPE instead of filling a pipe nobody drains.
+struct Relay {
+    EventLoop *loop;
+    int in_fd;          // read end, -1 once closed
+    int out_fd;         // write end, -1 once closed
+    char *buf;
+    size_t cap;
+    size_t start;       // [start, ready): filtered, waiting for the downstream
+    size_t ready;       // [ready, end): read, waiting for a line end (lines only)
+    size_t end;
+    RelayFilter filter; // NULL passes bytes through
+    void *ctx;
+    bool lines;         // input, set after init: filter whole lines only
+    RelayEnd on_end;    // input, set after init: NULL for none; gets ctx
+    bool stop_in;       // end_input_Relay() was called
+    bool in_paused;     // the buffer is full, upstream is out of the loop
+    bool out_armed;     // POLLOUT is requested
+    bool out_sync;      // out_fd can't be polled (a regular file under epoll): written right away
+    bool eof;
+    int err;            // errno that ended the relay early, 0 if none
+    size_t n_in;        // bytes read from upstream
+    size_t n_out;       // bytes written downstream
+    size_t n_pauses;    // times the buffer filled up
+    RelayDone on_done;
+    void *data;
+};
+
+// take over in_fd and out_fd (both made non-blocking); cap 0 uses RELAY_DEFAULT_CAP
+int init_Relay(Relay *r, EventLoop *loop, int in_fd, int out_fd, size_t cap,
+    RelayFilter filter, void *ctx, RelayDone on_done, void *data);
+// relay from->p_stdout to to->p_stdin; both ProcInfo fields are set to -1
+// as the relay owns them from then on
+int init_stages_Relay(Relay *r, EventLoop *loop, ProcInfo *from, ProcInfo *to, size_t cap,
+    RelayFilter filter, void *ctx, RelayDone on_done, void *data);
+// append len bytes to the output; for on_end only (not the filter), and
+// the buffer may grow past cap for it
+int emit_Relay(Relay *r, const char *data, size_t len);
+// take no more input (from a filter, e.g. once a head has its lines): the
+// upstream fd closes, its writer gets EPIPE, and the rest drains as at EOF
+static inline void end_input_Relay(Relay *r) {
+    r->stop_in = true;
+}
+// both fds are closed (or were never taken)
+static inline bool done_Relay(const Relay *r) {
+    return r->in_fd < 0 && r->out_fd < 0;
+}
+// drop the buffer and close whatever fds are still open
+void close_Relay(Relay *r);
+
+#endif // RELAY_H
@@ -0,0 +1,1214 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "remote.h"
+#include "event_loop.h"
+#include "feeder.h"
+#include "admission.h"
+
+#define REMOTE_HDR 12           // len, id, type, stream, 2 bytes padding
+#define REMOTE_CHUNK (64 * 1024)
+#define SPAWN_APPEND 1          // REMOTE_SPAWN flags
+#define SPAWN_ENV 2
+#define REMOTE_LOAD_MS 100      // agent: least time between unasked REMOTE_LOAD frames
+
+extern char **environ;
+
+// ---- framing, shared by both sides
+
+typedef struct {
+    char *p;
+    size_t len;
+    size_t cap;
+} Buf;
+
+static int put_buf(Buf *b, const void *d, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + n) {
+            cap *= 2;
+        }
+        char *p = realloc(b->p, cap);
+        if (p == NULL) {
+            return 1;
+        }
+        b->p = p;
+        b->cap = cap;
+    }
+    memcpy(b->p + b->len, d, n);
+    b->len += n;
+    return 0;
+}
+
+static int put_u32(Buf *b, uint32_t v) {
+    v = htonl(v);
+    return put_buf(b, &v, sizeof(v));
+}
+
+static int put_str(Buf *b, const char *s) {
+    return put_buf(b, s != NULL ? s : "", s != NULL ? strlen(s) + 1 : 1);
+}
+
+static void put_hdr(char *h, uint32_t len, uint32_t id, uint8_t type, uint8_t stream) {
+    len = htonl(len);
+    id = htonl(id);
+    memcpy(h, &len, 4);
+    memcpy(h + 4, &id, 4);
+    h[8] = type;
+    h[9] = stream;
+    h[10] = h[11] = 0;
+}
+
+// start a frame in b; end_frame() fills in its length
+static size_t begin_frame(Buf *b, uint32_t id, uint8_t type, uint8_t stream, int *err) {
+    char h[REMOTE_HDR];
+    size_t at = b->len;
+    put_hdr(h, 0, id, type, stream);
+    *err |= put_buf(b, h, sizeof(h));
+    return at;
+}
+
+static void end_frame(Buf *b, size_t at) {
+    uint32_t len = htonl(b->len - at - REMOTE_HDR);
+    memcpy(b->p + at, &len, 4);
+}
+
+static int send_all(int fd, struct iovec *iov, int n_iov) {
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n_iov};
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov->iov_base = (char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+static int send_frame(int fd, pthread_mutex_t *lock, uint8_t type, uint32_t id, uint8_t stream,
+        const void *p, size_t n) {
+    char h[REMOTE_HDR];
+    struct iovec iov[2] = {{h, sizeof(h)}, {(void *)p, n}};
+    put_hdr(h, n, id, type, stream);
+    if (lock != NULL) {
+        pthread_mutex_lock(lock);
+    }
+    int rc = send_all(fd, iov, n > 0 ? 2 : 1);
+    if (lock != NULL) {
+        pthread_mutex_unlock(lock);
+    }
+    return rc;
+}
+
+static int send_u32s(int fd, pthread_mutex_t *lock, uint8_t type, uint32_t id, const uint32_t *v, int n) {
+    uint32_t net[8];
+    for (int i = 0; i < n; i++) {
+        net[i] = htonl(v[i]);
+    }
+    return send_frame(fd, lock, type, id, 0, net, n * sizeof(uint32_t));
+}
+
+static int read_full(int fd, void *buf, size_t n) {
+    char *p = buf;
+    while (n > 0) {
+        ssize_t r = read(fd, p, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            errno = r == 0 ? ECONNRESET : errno;
+            return -1;
+        }
+        p += r;
+        n -= r;
+    }
+    return 0;
+}
+
+typedef struct {
+    uint32_t len;
+    uint32_t id;
+    uint8_t type;
+    uint8_t stream;
+} FrameHdr;
+
+// next frame; its payload lands in *buf (grown as needed, NUL-terminated)
+static int read_frame(int fd, FrameHdr *h, Buf *buf) {
+    char raw[REMOTE_HDR];
+    if (read_full(fd, raw, sizeof(raw))) {
+        return -1;
+    }
+    memcpy(&h->len, raw, 4);
+    memcpy(&h->id, raw + 4, 4);
+    h->len = ntohl(h->len);
+    h->id = ntohl(h->id);
+    h->type = raw[8];
+    h->stream = raw[9];
+    if (h->len > REMOTE_MAX_FRAME || h->stream > STDERR_FILENO) {
+        errno = EPROTO;
+        return -1;
+    }
+    buf->len = 0;
+    if (buf->cap < h->len + 1) {
+        char *p = realloc(buf->p, h->len + 1);
+        if (p == NULL) {
+            return -1;
+        }
+        buf->p = p;
+        buf->cap = h->len + 1;
+    }
+    if (read_full(fd, buf->p, h->len)) {
+        return -1;
+    }
+    buf->len = h->len;
+    buf->p[h->len] = '\0';
+    return 0;
+}
+
+static bool take_u32(const char **p, const char *end, uint32_t *v) {
+    if (end - *p < 4) {
+        return false;
+    }
+    memcpy(v, *p, 4);
+    *v = ntohl(*v);
+    *p += 4;
+    return true;
+}
+
+static const char *take_str(const char **p, const char *end) {
+    const char *s = *p;
+    const char *nul = memchr(s, '\0', end - s);
+    if (nul == NULL) {
+        return NULL;
+    }
+    *p = nul + 1;
+    return s;
+}
+
+static inline bool forwarded(ProcComType t) {
+    return t == PROC_COM_PIPE || t == PROC_COM_CAPTURE;
+}
+
+// ---- agent
+
+typedef struct AgentConn AgentConn;
+
+typedef struct {
+    AgentConn *conn;
+    uint32_t id;
+    ProcInfo ci;
+    StdinFeeder feed;
+    bool feeding;
+    int n_open;         // outputs not at EOF yet
+    bool exited;
+    bool reap_at_eof;
+    int status;
+} AgentProc;
+
+struct AgentConn {
+    int fd;
+    EventLoop loop;
+    AgentProc **procs;
+    int n;
+    int cap;
+    Buf in;
+    bool done;
+    int cpu_fd;         // /proc/pressure/cpu and memory, -1 without PSI
+    int mem_fd;
+    struct timespec load_sent;
+};
+
+// children of every connection of this agent, for REMOTE_LOAD
+static int agent_running;
+
+static void send_load(AgentConn *ac) {
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t v[4] = {
+        __atomic_load_n(&agent_running, __ATOMIC_RELAXED),
+        ncpu > 0 ? ncpu : 1,
+        ac->cpu_fd >= 0 ? (uint32_t)(read_pressure(ac->cpu_fd) * 100) : 0,
+        ac->mem_fd >= 0 ? (uint32_t)(read_pressure(ac->mem_fd) * 100) : 0,
+    };
+    clock_gettime(CLOCK_MONOTONIC, &ac->load_sent);
+    if (send_u32s(ac->fd, NULL, REMOTE_LOAD, 0, v, 4)) {
+        ac->done = true;
+    }
+}
+
+// after an exit: the client learns of freed slots, at most every REMOTE_LOAD_MS
+static void maybe_send_load(AgentConn *ac) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - ac->load_sent.tv_sec) * 1000 + (now.tv_nsec - ac->load_sent.tv_nsec) / 1000000 >= REMOTE_LOAD_MS) {
+        send_load(ac);
+    }
+}
+
+static AgentProc *agent_find(AgentConn *ac, uint32_t id) {
+    for (int i = 0; i < ac->n; i++) {
+        if (ac->procs[i]->id == id) {
+            return ac->procs[i];
+        }
+    }
+    return NULL;
+}
+
+static void agent_drop(AgentConn *ac, AgentProc *p) {
+    for (int i = 0; i < ac->n; i++) {
+        if (ac->procs[i] == p) {
+            ac->procs[i] = ac->procs[--ac->n];
+            break;
+        }
+    }
+    if (p->feeding) {
+        close_StdinFeeder(&p->feed);
+    }
+    unwatch_ProcInfo(&ac->loop, &p->ci);
+    close_ProcInfo(&p->ci);
+    free(p);
+    __atomic_sub_fetch(&agent_running, 1, __ATOMIC_RELAXED);
+}
+
+// EXIT goes out once the child is reaped and both outputs hit EOF, so it
+// always follows the child's last DATA frame
+static void agent_maybe_done(AgentProc *p) {
+    if (p->n_open == 0 && p->reap_at_eof && !p->exited) {
+        reap_ProcInfo(&p->ci, &p->status, 0);
+        p->exited = true;
+    }
+    if (!p->exited || p->n_open > 0) {
+        return;
+    }
+    uint32_t status = p->status;
+    AgentConn *ac = p->conn;
+    if (send_u32s(ac->fd, NULL, REMOTE_EXIT, p->id, &status, 1)) {
+        ac->done = true;
+    }
+    agent_drop(ac, p);
+    maybe_send_load(ac);
+}
+
+static void on_agent_output(EventLoop *loop, int fd, unsigned revents, void *data) {
+    AgentProc *p = data;
+    char buf[REMOTE_CHUNK];
+    int stream = fd == p->ci.p_stdout ? STDOUT_FILENO : STDERR_FILENO;
+
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+        return;
+    }
+    if (n > 0) {
+        if (send_frame(p->conn->fd, NULL, REMOTE_DATA, p->id, stream, buf, n)) {
+            p->conn->done = true;
+        }
+        return;
+    }
+    del_EventLoop(loop, fd);
+    close(fd);
+    *(stream == STDOUT_FILENO ? &p->ci.p_stdout : &p->ci.p_stderr) = -1;
+    if (send_frame(p->conn->fd, NULL, REMOTE_EOF, p->id, stream, NULL, 0)) {
+        p->conn->done = true;
+    }
+    p->n_open--;
+    agent_maybe_done(p);
+}
+
+static void on_agent_exit(EventLoop *loop, int fd, unsigned revents, void *data) {
+    AgentProc *p = data;
+
+    del_EventLoop(loop, fd);
+    reap_ProcInfo(&p->ci, &p->status, 0);
+    p->exited = true;
+    agent_maybe_done(p);
+}
+
+static void release_copy(void *ctx, const char *data, size_t len) {
+    free((void *)data);
+}
+
+static void agent_spawn(AgentConn *ac, uint32_t id) {
+    const char *p = ac->in.p, *end = ac->in.p + ac->in.len;
+    uint32_t argc = 0, envc = 0;
+    char **argv = NULL, **env = NULL;
+    const char *paths[3];
+    ProcInfo ci = {.p_stdin=-1, .p_stdout=-1, .p_stderr=-1};
+    int rc = 0;
+    uint32_t reply[6] = {0};
+
+    reply[1] = (uint32_t)-1;
+    if (end - p < 4) {
+        rc = EPROTO;
+        p = end;
+    }
+    uint8_t types[3] = {0}, flags = 0;
+    if (rc == 0) {
+        memcpy(types, p, 3);
+        flags = p[3];
+        p += 4;
+    }
+    if (rc == 0 && (!take_u32(&p, end, &argc) || !take_u32(&p, end, &envc) ||
+            argc == 0 || argc > ac->in.len || envc > ac->in.len)) {
+        rc = EPROTO;
+    }
+    if (rc == 0 && ((argv = calloc(argc + 1, sizeof(char *))) == NULL ||
+            (env = calloc(envc + 1, sizeof(char *))) == NULL)) {
+        rc = ENOMEM;
+    }
+    for (uint32_t i = 0; rc == 0 && i < argc + envc + 3; i++) {
+        const char *s = take_str(&p, end);
+        if (s == NULL) {
+            rc = EPROTO;
+        } else if (i < argc) {
+            argv[i] = (char *)s;
+        } else if (i < argc + envc) {
+            env[i - argc] = (char *)s;
+        } else {
+            paths[i - argc - envc] = *s != '\0' ? s : NULL;
+        }
+    }
+    for (int i = 0; rc == 0 && i < 3; i++) {
+        ProcComType t = types[i];
+        if (t != PROC_COM_INHERIT && t != PROC_COM_NONE && t != PROC_COM_PIPE &&
+                t != PROC_COM_PATH && t != PROC_COM_STDOUT) {
+            rc = EPROTO;
+        }
+    }
+    // its slot before the child: once SPAWNED is out, the client waits for its EXIT
+    AgentProc *ap = NULL;
+    if (rc == 0 && (ap = calloc(1, sizeof(AgentProc))) == NULL) {
+        rc = ENOMEM;
+    }
+    if (rc == 0 && ac->n == ac->cap) {
+        AgentProc **procs = realloc(ac->procs, (ac->cap * 2 + 4) * sizeof(AgentProc *));
+        if (procs == NULL) {
+            rc = ENOMEM;
+        } else {
+            ac->procs = procs;
+            ac->cap = ac->cap * 2 + 4;
+        }
+    }
+    if (rc != 0) {
+        reply[0] = rc;
+        reply[2] = SPAWN_STAGE_SERVER;
+        reply[4] = rc;
+    } else {
+        ci.stdin_type = types[0];
+        ci.stdout_type = types[1];
+        ci.stderr_type = types[2];
+        ci.f_stdin = (char *)paths[0];
+        ci.f_stdout = (char *)paths[1];
+        ci.f_stderr = (char *)paths[2];
+        ci.path_append = flags & SPAWN_APPEND;
+        rc = subprocess(&ci, argv, flags & SPAWN_ENV ? env : environ);
+        reply[0] = rc;
+        reply[1] = rc == 0 ? (uint32_t)ci.pid : (uint32_t)-1;
+        reply[2] = ci.err.stage;
+        reply[3] = ci.err.stream;
+        reply[4] = ci.err.code;
+        reply[5] = ci.err.value;
+    }
+    free(argv);
+    free(env);
+    if (send_u32s(ac->fd, NULL, REMOTE_SPAWNED, id, reply, 6)) {
+        ac->done = true;
+    }
+    if (rc != 0) {
+        free(ap);
+        return;
+    }
+    ac->procs[ac->n++] = ap;
+    __atomic_add_fetch(&agent_running, 1, __ATOMIC_RELAXED);
+    ap->conn = ac;
+    ap->id = id;
+    ap->ci = ci;
+    ap->ci.f_stdin = ap->ci.f_stdout = ap->ci.f_stderr = NULL; // pointed into the frame
+    if (ap->ci.p_stdout >= 0 && add_EventLoop(&ac->loop, ap->ci.p_stdout, POLLIN, on_agent_output, ap) == 0) {
+        ap->n_open++;
+    }
+    if (ap->ci.p_stderr >= 0 && add_EventLoop(&ac->loop, ap->ci.p_stderr, POLLIN, on_agent_output, ap) == 0) {
+        ap->n_open++;
+    }
+    if (ap->ci.stdin_type == PROC_COM_PIPE) {
+        ap->feeding = init_StdinFeeder(&ap->feed, &ac->loop, &ap->ci, NULL, NULL) == 0;
+    }
+    if (ap->ci.pidfd < 0 || add_EventLoop(&ac->loop, ap->ci.pidfd, POLLIN, on_agent_exit, ap)) {
+        ap->reap_at_eof = true; // no pidfd to watch: reap once the outputs ended
+        agent_maybe_done(ap);
+    }
+}
+
+static void on_agent_conn(EventLoop *loop, int fd, unsigned revents, void *data) {
+    AgentConn *ac = data;
+    FrameHdr h;
+
+    if (read_frame(fd, &h, &ac->in)) {
+        ac->done = true;
+        return;
+    }
+    if (h.type == REMOTE_SPAWN) {
+        agent_spawn(ac, h.id);
+        return;
+    }
+    if (h.type == REMOTE_LOAD) {
+        send_load(ac);
+        return;
+    }
+    AgentProc *p = agent_find(ac, h.id);
+    if (p == NULL) { // raced with its exit
+        return;
+    }
+    if (h.type == REMOTE_DATA && p->feeding && h.len > 0) {
+        char *copy = malloc(h.len);
+        if (copy != NULL) {
+            memcpy(copy, ac->in.p, h.len);
+            feed_StdinFeeder(&p->feed, copy, h.len, release_copy, NULL);
+        }
+    } else if (h.type == REMOTE_EOF && p->feeding) {
+        finish_StdinFeeder(&p->feed);
+    } else if (h.type == REMOTE_KILL && h.len >= 4) {
+        uint32_t sig;
+        const char *q = ac->in.p;
+        take_u32(&q, q + h.len, &sig);
+        if (p->exited) {
+            return; // reaped, only its output is still draining: the pid may be someone else's
+        }
+        if (p->ci.pidfd >= 0) {
+            syscall(SYS_pidfd_send_signal, p->ci.pidfd, sig, NULL, 0);
+        } else {
+            kill(p->ci.pid, sig);
+        }
+    }
+}
+
+int serve_RemoteAgent(int fd) {
+    AgentConn ac = {.fd = fd};
+
+    if (init_EventLoop(&ac.loop, EVLOOP_EPOLL)) {
+        close(fd);
+        return 1;
+    }
+    ac.cpu_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+    ac.mem_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+    send_load(&ac); // the client's first placement needs one
+    if (add_EventLoop(&ac.loop, fd, POLLIN, on_agent_conn, &ac)) {
+        showError(false, "Failed to watch remote connection: %s!", strerror(errno));
+        ac.done = true;
+    }
+    while (!ac.done && run_EventLoop(&ac.loop, -1) >= 0);
+    // the client is gone: nobody is left to read what still runs
+    while (ac.n > 0) {
+        AgentProc *p = ac.procs[0];
+        if (!p->exited) {
+            kill(p->ci.pid, SIGKILL);
+            reap_ProcInfo(&p->ci, NULL, 0);
+        }
+        agent_drop(&ac, p);
+    }
+    free(ac.procs);
+    free(ac.in.p);
+    if (ac.cpu_fd >= 0) {
+        close(ac.cpu_fd);
+    }
+    if (ac.mem_fd >= 0) {
+        close(ac.mem_fd);
+    }
+    close_EventLoop(&ac.loop);
+    close(fd);
+    return 0;
+}
+
+static void *agent_thread(void *arg) {
+    serve_RemoteAgent((int)(intptr_t)arg);
+    return NULL;
+}
+
+int run_RemoteAgent(int listen_fd) {
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            showError(false, "Remote agent failed to accept: %s!", strerror(errno));
+            pthread_attr_destroy(&attr);
+            return 1;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly off TCP
+        pthread_t t;
+        if (pthread_create(&t, &attr, agent_thread, (void *)(intptr_t)fd)) {
+            close(fd);
+        }
+    }
+}
+
+// ---- client
+
+struct RemoteProc {
+    uint32_t id;
+    ProcInfo *ci;       // NULL once reaped
+    int local[3];       // our side of the forwarded streams' socketpairs, else -1
+    int exit_fd;        // eventfd; ci->pidfd is a dup of it
+    bool replied;
+    bool exited;
+    bool reaped;        // the forwarder frees it
+    bool in_use;        // the reader is writing to local[] unlocked
+    int status;
+    uint32_t reply[6];  // REMOTE_SPAWNED: rc, pid, stage, stream, code, value
+};
+
+static RemoteProc *client_find(RemoteConn *c, uint32_t id) {
+    for (int i = 0; i < c->n_procs; i++) {
+        if (c->procs[i]->id == id) {
+            return c->procs[i];
+        }
+    }
+    return NULL;
+}
+
+static void wake_forwarder(RemoteConn *c) {
+    while (write(c->wake[1], "", 1) < 0 && errno == EINTR);
+}
+
+static void close_local(RemoteProc *p, int stream) {
+    if (p->local[stream] >= 0) {
+        close(p->local[stream]);
+        p->local[stream] = -1;
+    }
+}
+
+static void free_proc(RemoteProc *p) {
+    for (int i = 0; i < 3; i++) {
+        close_local(p, i);
+    }
+    if (p->exit_fd >= 0) {
+        close(p->exit_fd);
+    }
+    free(p);
+}
+
+static void mark_exited(RemoteProc *p, int status) {
+    uint64_t one = 1;
+    p->exited = true;
+    p->status = status;
+    if (write(p->exit_fd, &one, sizeof(one)) < 0) {
+        // an eventfd only fails on overflow; it is readable either way
+    }
+}
+
+// one frame from the agent, by the reader thread
+static int read_agent_frame(RemoteConn *c, Buf *in) {
+    FrameHdr h;
+
+    if (read_frame(c->fd, &h, in)) {
+        return -1;
+    }
+    pthread_mutex_lock(&c->lock);
+    if (h.type == REMOTE_LOAD) {
+        uint32_t v[4] = {0};
+        const char *q = in->p, *end = in->p + in->len;
+        for (int i = 0; i < 4; i++) {
+            take_u32(&q, end, &v[i]);
+        }
+        c->load = (RemoteLoad){.running = v[0], .ncpu = v[1],
+            .cpu_pressure = v[2] / 100.0, .mem_pressure = v[3] / 100.0};
+        c->load_seq++;
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    RemoteProc *p = client_find(c, h.id);
+    if (p == NULL) {
+        pthread_mutex_unlock(&c->lock);
+        return 0;
+    }
+    const char *q = in->p, *end = in->p + in->len;
+    if (h.type == REMOTE_DATA && h.stream != STDIN_FILENO && p->local[h.stream] >= 0) {
+        // the write may block on a slow reader: not under the lock
+        p->in_use = true;
+        pthread_mutex_unlock(&c->lock);
+        struct iovec iov = {in->p, in->len};
+        bool broken = send_all(p->local[h.stream], &iov, 1) != 0; // the caller closed its end
+        pthread_mutex_lock(&c->lock);
+        if (broken) {
+            close_local(p, h.stream);
+        }
+        p->in_use = false;
+        if (p->reaped) {
+            wake_forwarder(c);
+        }
+    } else if (h.type == REMOTE_EOF && h.stream != STDIN_FILENO) {
+        close_local(p, h.stream);
+    } else if (h.type == REMOTE_SPAWNED) {
+        for (int i = 0; i < 6; i++) {
+            take_u32(&q, end, &p->reply[i]);
+        }
+        p->replied = true;
+        pthread_cond_broadcast(&c->cond);
+    } else if (h.type == REMOTE_EXIT) {
+        uint32_t status = (uint32_t)-1;
+        take_u32(&q, end, &status);
+        mark_exited(p, (int)status);
+        pthread_cond_broadcast(&c->cond);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+// the connection broke: fail pending spawns, end the outputs, report exits
+static void connection_lost(RemoteConn *c, int err) {
+    pthread_mutex_lock(&c->lock);
+    c->dead = true;
+    c->err = err ? err : ECONNRESET;
+    for (int i = 0; i < c->n_procs; i++) {
+        RemoteProc *p = c->procs[i];
+        if (!p->replied) {
+            p->replied = true;
+            p->reply[0] = c->err;
+            p->reply[2] = SPAWN_STAGE_SERVER;
+            p->reply[4] = c->err;
+        }
+        if (!p->exited) {
+            mark_exited(p, -1);
+        }
+        close_local(p, STDOUT_FILENO);
+        close_local(p, STDERR_FILENO);
+    }
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    wake_forwarder(c); // it ends the stdin sides
+}
+
+// reader: the agent's frames into the local socketpairs; it never sends,
+// so the agent can always get its output out while stdin is being pushed
+static void *reader_main(void *arg) {
+    RemoteConn *c = arg;
+    Buf in = {0};
+
+    while (read_agent_frame(c, &in) == 0);
+    connection_lost(c, errno);
+    free(in.p);
+    return NULL;
+}
+
+// forwarder: what callers write to p_stdin out as DATA frames; also frees
+// reaped procs, since it is the only thread polling their stdin sides
+static void *forwarder_main(void *arg) {
+    RemoteConn *c = arg;
+    struct pollfd *pfd = NULL;
+    RemoteProc **owner = NULL;
+    int cap = 0;
+    char buf[REMOTE_CHUNK];
+
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        if (c->closing) {
+            pthread_mutex_unlock(&c->lock);
+            break;
+        }
+        for (int i = 0; i < c->n_procs; i++) {
+            RemoteProc *p = c->procs[i];
+            if (c->dead) {
+                close_local(p, STDIN_FILENO);
+            }
+            if (p->reaped && !p->in_use) {
+                free_proc(p);
+                c->procs[i--] = c->procs[--c->n_procs];
+            }
+        }
+        if (c->n_procs + 1 > cap) {
+            // without memory for more, the procs past cap wait for a later round
+            int want = c->n_procs + 16;
+            struct pollfd *more_pfd = realloc(pfd, want * sizeof(*pfd));
+            if (more_pfd != NULL) {
+                pfd = more_pfd;
+                RemoteProc **more_owner = realloc(owner, want * sizeof(*owner));
+                if (more_owner != NULL) {
+                    owner = more_owner;
+                    cap = want;
+                }
+            }
+        }
+        if (cap == 0) { // not even the wakeup pipe fits: retry shortly
+            pthread_mutex_unlock(&c->lock);
+            poll(NULL, 0, 10);
+            continue;
+        }
+        int n = 1;
+        pfd[0] = (struct pollfd){.fd = c->wake[0], .events = POLLIN};
+        for (int i = 0; i < c->n_procs && n < cap; i++) {
+            if (c->procs[i]->replied && c->procs[i]->local[STDIN_FILENO] >= 0) {
+                owner[n] = c->procs[i];
+                pfd[n++] = (struct pollfd){.fd = c->procs[i]->local[STDIN_FILENO], .events = POLLIN};
+            }
+        }
+        pthread_mutex_unlock(&c->lock);
+
+        if (poll(pfd, n, -1) < 0 && errno != EINTR) {
+            break;
+        }
+        if (pfd[0].revents) {
+            while (read(c->wake[0], buf, sizeof(buf)) > 0);
+        }
+        for (int i = 1; i < n; i++) {
+            if (pfd[i].revents == 0) {
+                continue;
+            }
+            RemoteProc *p = owner[i];
+            ssize_t r = read(p->local[STDIN_FILENO], buf, sizeof(buf));
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r > 0) {
+                send_frame(c->fd, &c->send_lock, REMOTE_DATA, p->id, STDIN_FILENO, buf, r);
+                continue;
+            }
+            // a failed send shows up at the reader as a broken connection
+            send_frame(c->fd, &c->send_lock, REMOTE_EOF, p->id, STDIN_FILENO, NULL, 0);
+            pthread_mutex_lock(&c->lock);
+            close_local(p, STDIN_FILENO);
+            pthread_mutex_unlock(&c->lock);
+        }
+    }
+    free(pfd);
+    free(owner);
+    return NULL;
+}
+
+int init_RemoteConn(RemoteConn *c, int fd) {
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->next_id = 1;
+    if (pipe2(c->wake, O_CLOEXEC | O_NONBLOCK)) {
+        showError(false, "Failed to create remote wakeup pipe: %s!", strerror(errno));
+        return 1;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_mutex_init(&c->send_lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    if (pthread_create(&c->reader, NULL, reader_main, c)) {
+        showError(false, "Failed to start remote connection thread!");
+        goto fail;
+    }
+    if (pthread_create(&c->forwarder, NULL, forwarder_main, c)) {
+        showError(false, "Failed to start remote connection thread!");
+        shutdown(fd, SHUT_RDWR);
+        pthread_join(c->reader, NULL);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    close(c->wake[0]);
+    close(c->wake[1]);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->send_lock);
+    pthread_mutex_destroy(&c->lock);
+    return 1;
+}
+
+int connect_Remote(const char *host, const char *port) {
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM}, *res, *ai;
+    int fd = -1, rc = getaddrinfo(host, port, &hints, &res);
+
+    if (rc != 0) {
+        showError(false, "Failed to resolve remote agent %s:%s: %s!", host, port, gai_strerror(rc));
+        return -1;
+    }
+    for (ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        showError(false, "Failed to connect to remote agent %s:%s: %s!", host, port, strerror(errno));
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+int open_RemoteConn(RemoteConn *c, const char *host, const char *port) {
+    int fd = connect_Remote(host, port);
+
+    if (fd < 0) {
+        return 1;
+    }
+    if (init_RemoteConn(c, fd)) {
+        close(fd);
+        return 1;
+    }
+    return 0;
+}
+
+void close_RemoteConn(RemoteConn *c) {
+    shutdown(c->fd, SHUT_RDWR); // the reader sees EOF and fails everything
+    pthread_join(c->reader, NULL);
+    pthread_mutex_lock(&c->lock);
+    c->closing = true;
+    pthread_mutex_unlock(&c->lock);
+    wake_forwarder(c);
+    pthread_join(c->forwarder, NULL);
+    for (int i = 0; i < c->n_procs; i++) {
+        free_proc(c->procs[i]);
+    }
+    free(c->procs);
+    c->procs = NULL;
+    c->n_procs = 0;
+    close(c->fd);
+    close(c->wake[0]);
+    close(c->wake[1]);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->send_lock);
+    pthread_mutex_destroy(&c->lock);
+}
+
+static void close_caller_ends(ProcInfo *ci) {
+    int *fds[] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr, &ci->pidfd};
+    for (int i = 0; i < 4; i++) {
+        if (*fds[i] >= 0) {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+}
+
+// validate ci, create its socketpairs and eventfd, register it and append
+// its REMOTE_SPAWN frame to b
+static int prepare_spawn(RemoteConn *c, ProcInfo *ci, char* args[], char* env[], Buf *b, RemoteProc **out) {
+    ProcComType types[3] = {ci->stdin_type, ci->stdout_type, ci->stderr_type};
+    int *ends[3] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr};
+    const char *paths[3] = {ci->f_stdin, ci->f_stdout, ci->f_stderr};
+    RemoteProc *p;
+
+    *out = NULL;
+    ci->err.stage = SPAWN_STAGE_NONE;
+    ci->pidfd = -1;
+    for (int i = 0; i < 3; i++) {
+        ProcComType t = types[i];
+        if (t != PROC_COM_INHERIT && t != PROC_COM_NONE && t != PROC_COM_PATH && !forwarded(t) &&
+                !(t == PROC_COM_STDOUT && i == STDERR_FILENO)) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_STREAM_TYPE, i, EINVAL, t, args[0]);
+        }
+        if (t == PROC_COM_CAPTURE && i == STDIN_FILENO) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_STREAM_TYPE, i, EINVAL, t, args[0]);
+        }
+    }
+    if ((p = calloc(1, sizeof(RemoteProc))) == NULL) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_ALLOC, -1, ENOMEM, 0, args[0]);
+    }
+    p->ci = ci;
+    p->local[0] = p->local[1] = p->local[2] = p->exit_fd = -1;
+    for (int i = 0; i < 3; i++) {
+        int sv[2];
+        *ends[i] = -1;
+        if (!forwarded(types[i])) {
+            continue;
+        }
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+            int err = errno;
+            close_caller_ends(ci);
+            free_proc(p);
+            return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, i, err, 0, args[0]);
+        }
+        *ends[i] = sv[0];
+        p->local[i] = sv[1];
+        if (i == STDIN_FILENO) { // the caller only writes, the forwarder only reads
+            shutdown(sv[0], SHUT_RD);
+        } else {
+            shutdown(sv[0], SHUT_WR);
+        }
+    }
+    if ((p->exit_fd = eventfd(0, EFD_CLOEXEC)) < 0 ||
+            (ci->pidfd = fcntl(p->exit_fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+        int err = errno;
+        close_caller_ends(ci);
+        free_proc(p);
+        return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, -1, err, 0, args[0]);
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->dead && c->n_procs == c->cap_procs) {
+        RemoteProc **procs = realloc(c->procs, (c->cap_procs * 2 + 8) * sizeof(RemoteProc *));
+        if (procs != NULL) {
+            c->procs = procs;
+            c->cap_procs = c->cap_procs * 2 + 8;
+        }
+    }
+    if (c->dead || c->n_procs == c->cap_procs) {
+        int err = c->dead ? c->err : ENOMEM;
+        pthread_mutex_unlock(&c->lock);
+        close_caller_ends(ci);
+        free_proc(p);
+        return report_SpawnError(&ci->err, SPAWN_STAGE_SERVER, -1, err, 0, args[0]);
+    }
+    p->id = c->next_id++;
+    c->procs[c->n_procs++] = p;
+    pthread_mutex_unlock(&c->lock);
+
+    int argc = 0, envc = 0, err = 0;
+    while (args[argc] != NULL) {
+        argc++;
+    }
+    while (env != NULL && env[envc] != NULL) {
+        envc++;
+    }
+    size_t at = begin_frame(b, p->id, REMOTE_SPAWN, 0, &err);
+    uint8_t head[4] = {0, 0, 0, (ci->path_append ? SPAWN_APPEND : 0) | (env != NULL ? SPAWN_ENV : 0)};
+    for (int i = 0; i < 3; i++) { // the agent pipes what we forward, capturing is ours
+        head[i] = forwarded(types[i]) ? PROC_COM_PIPE : types[i];
+    }
+    err |= put_buf(b, head, sizeof(head)) | put_u32(b, argc) | put_u32(b, envc);
+    for (int i = 0; i < argc; i++) {
+        err |= put_str(b, args[i]);
+    }
+    for (int i = 0; i < envc; i++) {
+        err |= put_str(b, env[i]);
+    }
+    for (int i = 0; i < 3; i++) {
+        err |= put_str(b, types[i] == PROC_COM_PATH ? paths[i] : NULL);
+    }
+    end_frame(b, at);
+    *out = p;
+    if (err || b->len - at - REMOTE_HDR > REMOTE_MAX_FRAME) {
+        b->len = at;
+        pthread_mutex_lock(&c->lock);
+        p->replied = p->reaped = true; // never sent: the forwarder frees it
+        p->ci = NULL;
+        pthread_mutex_unlock(&c->lock);
+        *out = NULL;
+        close_caller_ends(ci);
+        return report_SpawnError(&ci->err, err ? SPAWN_STAGE_ALLOC : SPAWN_STAGE_SERVER, -1,
+            err ? ENOMEM : E2BIG, 0, args[0]);
+    }
+    return 0;
+}
+
+int begin_batch_Remote(RemoteConn *c, RemoteBatch *rb, ProcInfo **cis, char** argvs[], char** envs[], size_t n, int *results) {
+    Buf b = {0};
+
+    *rb = (RemoteBatch){.n = n, .cis = cis, .argvs = argvs, .results = results};
+    if ((rb->procs = calloc(n ? n : 1, sizeof(RemoteProc *))) == NULL) {
+        for (size_t i = 0; i < n; i++) {
+            results[i] = report_SpawnError(&cis[i]->err, SPAWN_STAGE_ALLOC, -1, ENOMEM, 0, argvs[i][0]);
+        }
+        return 1;
+    }
+    for (size_t i = 0; i < n; i++) {
+        results[i] = prepare_spawn(c, cis[i], argvs[i], envs != NULL ? envs[i] : NULL, &b, &rb->procs[i]);
+    }
+    if (b.len > 0) {
+        struct iovec iov = {b.p, b.len};
+        pthread_mutex_lock(&c->send_lock);
+        send_all(c->fd, &iov, 1); // on failure the reader fails the replies
+        pthread_mutex_unlock(&c->send_lock);
+    }
+    free(b.p);
+    return 0;
+}
+
+size_t end_batch_Remote(RemoteConn *c, RemoteBatch *rb) {
+    size_t failed = 0;
+
+    pthread_mutex_lock(&c->lock);
+    for (size_t i = 0; rb->procs != NULL && i < rb->n; i++) {
+        RemoteProc *p = rb->procs[i];
+        if (p == NULL) {
+            continue;
+        }
+        while (!p->replied) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        }
+        ProcInfo *ci = rb->cis[i];
+        rb->results[i] = (int)p->reply[0];
+        if (rb->results[i] == 0) {
+            ci->pid = (pid_t)p->reply[1];
+            clock_gettime(CLOCK_REALTIME, &ci->t_start);
+            continue;
+        }
+        p->reaped = true;
+        p->ci = NULL;
+        close_caller_ends(ci);
+        pthread_mutex_unlock(&c->lock);
+        report_SpawnError(&ci->err, (SpawnStage)p->reply[2], (int)p->reply[3], (int)p->reply[4],
+            (int)p->reply[5], rb->argvs[i][0]);
+        pthread_mutex_lock(&c->lock);
+    }
+    pthread_mutex_unlock(&c->lock);
+    wake_forwarder(c); // new stdin ends to watch, failed spawns to free
+    for (size_t i = 0; i < rb->n; i++) {
+        failed += rb->results[i] != 0;
+    }
+    free(rb->procs);
+    rb->procs = NULL;
+    return failed;
+}
+
+size_t spawn_batch_Remote(RemoteConn *c, ProcInfo *cis, char** argvs[], size_t n, char* env[], int *results) {
+    ProcInfo **ptrs = malloc((n ? n : 1) * sizeof(ProcInfo *));
+    char ***envs = env != NULL ? malloc((n ? n : 1) * sizeof(char **)) : NULL;
+    RemoteBatch rb;
+    size_t failed = n;
+
+    if (ptrs == NULL || (env != NULL && envs == NULL)) {
+        for (size_t i = 0; i < n; i++) {
+            results[i] = report_SpawnError(&cis[i].err, SPAWN_STAGE_ALLOC, -1, ENOMEM, 0, argvs[i][0]);
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            ptrs[i] = &cis[i];
+            if (envs != NULL) {
+                envs[i] = env;
+            }
+        }
+        begin_batch_Remote(c, &rb, ptrs, argvs, envs, n, results);
+        failed = end_batch_Remote(c, &rb);
+    }
+    free(ptrs);
+    free(envs);
+    return failed;
+}
+
+int spawn_Remote(RemoteConn *c, ProcInfo *ci, char* args[], char* env[]) {
+    int rc;
+    spawn_batch_Remote(c, ci, (char **[]){args}, 1, env, &rc);
+    return rc;
+}
+
+static RemoteProc *find_ci(RemoteConn *c, const ProcInfo *ci) {
+    for (int i = 0; i < c->n_procs; i++) {
+        if (c->procs[i]->ci == ci) {
+            return c->procs[i];
+        }
+    }
+    return NULL;
+}
+
+int reap_Remote(RemoteConn *c, ProcInfo *ci, int *status) {
+    pthread_mutex_lock(&c->lock);
+    RemoteProc *p = find_ci(c, ci);
+    if (p == NULL) {
+        pthread_mutex_unlock(&c->lock);
+        return ESRCH;
+    }
+    while (!p->exited) {
+        pthread_cond_wait(&c->cond, &c->lock);
+    }
+    if (status != NULL) {
+        *status = p->status;
+    }
+    int rc = p->status == -1 && c->dead ? c->err : 0;
+    p->reaped = true;
+    p->ci = NULL;
+    pthread_mutex_unlock(&c->lock);
+    clock_gettime(CLOCK_REALTIME, &ci->t_end);
+    wake_forwarder(c);
+    return rc;
+}
+
+int kill_Remote(RemoteConn *c, ProcInfo *ci, int sig) {
+    pthread_mutex_lock(&c->lock);
+    RemoteProc *p = find_ci(c, ci);
+    uint32_t id = p != NULL && !p->exited ? p->id : 0;
+    pthread_mutex_unlock(&c->lock);
+    if (id == 0) {
+        return ESRCH;
+    }
+    uint32_t s = sig;
+    return send_u32s(c->fd, &c->send_lock, REMOTE_KILL, id, &s, 1) ? errno : 0;
+}
+
+int kill_all_Remote(RemoteConn *c, int sig) {
+    Buf b = {0};
+    int err = 0;
+    uint32_t s = htonl(sig);
+
+    pthread_mutex_lock(&c->lock);
+    for (int i = 0; i < c->n_procs; i++) {
+        RemoteProc *p = c->procs[i];
+        if (p->ci != NULL && p->replied && p->reply[0] == 0 && !p->exited) {
+            size_t at = begin_frame(&b, p->id, REMOTE_KILL, 0, &err);
+            err |= put_buf(&b, &s, sizeof(s));
+            end_frame(&b, at);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    int rc = err ? ENOMEM : 0;
+    if (rc == 0 && b.len > 0) {
+        struct iovec iov = {b.p, b.len};
+        pthread_mutex_lock(&c->send_lock);
+        rc = send_all(c->fd, &iov, 1) ? errno : 0;
+        pthread_mutex_unlock(&c->send_lock);
+    }
+    free(b.p);
+    return rc;
+}
+
+int load_Remote(RemoteConn *c, RemoteLoad *load, int wait_ms) {
+    struct timespec until;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += wait_ms / 1000;
+    until.tv_nsec += (long)(wait_ms % 1000) * 1000000;
+    if (until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&c->lock);
+    uint64_t seq = c->load_seq; // before asking: the answer may beat us back
+    pthread_mutex_unlock(&c->lock);
+    if (wait_ms != 0 && send_frame(c->fd, &c->send_lock, REMOTE_LOAD, 0, 0, NULL, 0)) {
+        rc = errno;
+    }
+    pthread_mutex_lock(&c->lock);
+    while (rc == 0 && wait_ms != 0 && c->load_seq == seq) {
+        if (c->dead) {
+            rc = c->err;
+        } else if (wait_ms < 0) {
+            pthread_cond_wait(&c->cond, &c->lock);
+        } else if (pthread_cond_timedwait(&c->cond, &c->lock, &until) == ETIMEDOUT) {
+            rc = ETIMEDOUT;
+        }
+    }
+    if (rc == 0 && c->dead) {
+        rc = c->err;
+    }
+    *load = c->load;
+    pthread_mutex_unlock(&c->lock);
+    return rc;
+}
@@ -0,0 +1,119 @@
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "subprocess.h"
+
+// Remote spawning: an agent on each node runs children for clients that
+// reach it over one persistent stream socket (TCP, or a Unix socket/ssh
+// tunnel), and every child of a client shares that connection. Frames are
+// [len, id, type, stream] headers in network order plus payload; stdout
+// and stderr travel as DATA frames and show up at the caller as the local
+// end of a socketpair in p_stdout/p_stderr, stdin the same way back, so
+// the usual read loops and event loops work unchanged.
+//
+// Streams: PROC_COM_PIPE and PROC_COM_CAPTURE are forwarded; NONE, PATH
+// and STDOUT (and INHERIT: the agent's own streams) are set up on the node;
+// FD, SOCKET, MEMFD and DUPLEX fds can't cross the connection (EINVAL).
+// Failures talking to the agent are reported as SPAWN_STAGE_SERVER.
+//
+// There is no authentication: listen on a trusted network or tunnel.
+
+#define REMOTE_MAX_FRAME (1 << 20)      // payload bytes of one frame
+
+typedef enum {
+    REMOTE_SPAWN = 1,   // client: stream types, flags, argv, env and paths
+    REMOTE_SPAWNED,     // agent: rc, pid and the SpawnError of a spawn
+    REMOTE_DATA,        // either way: bytes of stream (stdin from the client)
+    REMOTE_EOF,         // either way: the stream ended
+    REMOTE_EXIT,        // agent: wait status, after both outputs' EOF
+    REMOTE_KILL,        // client: send a signal
+    REMOTE_LOAD,        // agent: its children, cpus and PSI; the client sends it to ask
+} RemoteFrameType;
+
+// the node as its agent last reported it: on connect, on a REMOTE_LOAD
+// request and after exits (at most every 100ms)
+typedef struct {
+    int running;            // children of all of the agent's clients
+    int ncpu;
+    double cpu_pressure;    // /proc/pressure "some avg10" (%), 0 without PSI
+    double mem_pressure;
+} RemoteLoad;
+
+typedef struct RemoteProc RemoteProc;
+
+// a client connection, safe to share between threads. A reader thread
+// demuxes the agent's frames into the local socketpairs, a forwarder
+// thread sends what callers write to p_stdin. Writes to the socketpairs
+// block, so an output nobody reads stalls the others on the connection
+typedef struct {
+    int fd;
+    pthread_t reader;
+    pthread_t forwarder;
+    pthread_mutex_t lock;       // procs and their state
+    pthread_cond_t cond;
+    pthread_mutex_t send_lock;  // one frame at a time on fd
+    RemoteProc **procs;
+    int n_procs;
+    int cap_procs;
+    uint32_t next_id;
+    int wake[2];                // tells the forwarder the set of stdin ends changed
+    bool dead;                  // the connection is gone, err says why
+    int err;
+    bool closing;
+    RemoteLoad load;
+    uint64_t load_seq;          // count of reports so far
+} RemoteConn;
+
+// a spawn batch in flight, see begin_batch_Remote()
+typedef struct {
+    size_t n;
+    ProcInfo **cis;
+    char ***argvs;
+    int *results;
+    RemoteProc **procs;
+} RemoteBatch;
+
+// take over a connected stream socket fd
+int init_RemoteConn(RemoteConn *c, int fd);
+// connect to an agent at host:port over TCP
+int open_RemoteConn(RemoteConn *c, const char *host, const char *port);
+// just the connect: a TCP_NODELAY socket for init_RemoteConn(), or -1
+int connect_Remote(const char *host, const char *port);
+// end the connection: the agent kills what still runs
+void close_RemoteConn(RemoteConn *c);
+
+// spawn n children on the agent with a single write; results[i] gets each
+// subprocess()-style rc (ci->err says why). env NULL uses the agent's.
+// ci->pid is the pid on the node and ci->pidfd an eventfd that turns
+// readable when the child exited, so watch_ProcInfo() works; use
+// reap_Remote(), not reap_ProcInfo(). Every ci must outlive its reap
+size_t spawn_batch_Remote(RemoteConn *c, ProcInfo *cis, char** argvs[], size_t n, char* env[], int *results);
+int spawn_Remote(RemoteConn *c, ProcInfo *ci, char* args[], char* env[]);
+// spawn_batch_Remote() in two halves: send the batch, then wait for the
+// replies, so batches to several agents share one round trip. envs NULL
+// (or an envs[i] NULL) uses the agent's environment; the arrays must stay
+// put until end_batch_Remote(), which returns the number of failures
+int begin_batch_Remote(RemoteConn *c, RemoteBatch *rb, ProcInfo **cis, char** argvs[], char** envs[], size_t n, int *results);
+size_t end_batch_Remote(RemoteConn *c, RemoteBatch *rb);
+// wait for ci's exit and forget it; then close_ProcInfo(ci) as usual
+int reap_Remote(RemoteConn *c, ProcInfo *ci, int *status);
+int kill_Remote(RemoteConn *c, ProcInfo *ci, int sig);
+// signal every child of the connection that still runs, in one write
+int kill_all_Remote(RemoteConn *c, int sig);
+// the agent's latest load report; with wait_ms != 0 ask for a fresh one and
+// wait up to that long (< 0 forever). 0, ETIMEDOUT (*load is the old one)
+// or the connection's error, which may come with wait_ms 0 too
+int load_Remote(RemoteConn *c, RemoteLoad *load, int wait_ms);
+
+// agent: serve one connection until the client goes away, then kill the
+// children it left running; fd is closed on return
+int serve_RemoteAgent(int fd);
+// agent: accept on a listening socket forever, a thread per connection
+int run_RemoteAgent(int listen_fd);
+
+#endif // REMOTE_H
@@ -0,0 +1,1520 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <time.h>
+
+#include "runner.h"
+
+static void start_next(JobRunner *r);
+static void leave_scope(JobRunner *r, Job *job);
+static void leave_lane(JobRunner *r, Job *job);
+static void resume_job(JobRunner *r, Job *job);
+static void release_tenant(JobRunner *r, Job *job);
+static int push_queue(JobRunner *r, Job *job);
+static Job *drop_from_tenants(JobRunner *r, const CancelScope *s);
+
+#define LANE_STRIDE (1u << 20)  // LANES_WEIGHTED: a weight 1 lane's pass per start
+#define TENANT_STRIDE (1u << 20) // a weight 1 tenant's vtime per start
+
+_Static_assert(VIEW_LANES == RUNNER_LANES, "the view has a queue depth per lane");
+
+// the counters as they stand, for the view's readers
+static void publish_view(JobRunner *r) {
+    RunnerStats s = {
+        .max_running = r->max_running,
+        .n_running = r->n_running,
+        .n_paused = r->n_paused,
+        .loop_fds = r->loop.n_active,
+        .n_queued = r->q_tail - r->q_head + r->n_tenant_queued,
+        .n_tenant_queued = r->n_tenant_queued,
+        .n_waiting = r->n_waiting,
+        .n_done = r->n_done,
+        .n_failed = r->n_failed,
+    };
+    for (int l = 0; l < RUNNER_LANES; l++) {
+        s.lane_queued[l] = r->lanes[l].n_queued;
+    }
+    for (int i = 0; i < 3; i++) {
+        s.pipe_queued[i] = r->loop.queued[i];
+    }
+    publish_RunnerView(r->view, &s);
+}
+
+// the last the runner does with job
+static void job_done(JobRunner *r, Job *job) {
+    leave_scope(r, job);
+    if (job->tenant != NULL) {
+        release_tenant(r, job);
+        job->tenant->n_done++;
+        if (job->spawn_rc != 0 || !WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) {
+            job->tenant->n_failed++;
+        }
+    }
+    if (r->view != NULL) {
+        publish_view(r);
+    }
+    if (r->table != NULL && job->row >= 0) {
+        finish_JobTable(r->table, job->row, job->status, job->spawn_rc != 0 ||
+            !WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0);
+    }
+    if (r->on_done != NULL) {
+        r->on_done(r, job, r->data);
+    }
+    if (r->completions != NULL) {
+        post_CompletionQueue(r->completions, &job->node);
+    }
+}
+
+static uint64_t journal_key(Job *job, uint64_t argv_hash) {
+    return job->journal_id != 0 ? job->journal_id : argv_hash;
+}
+
+static void journal_job(JobRunner *r, Job *job) {
+    uint64_t h = argv_hash_Journal(job->args);
+    append_JobJournal(r->journal, journal_key(job, h), h, job->status,
+        digest_CaptureBuf(&job->out.out), digest_CaptureBuf(&job->out.err));
+}
+
+static uint64_t real_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t ts_ns(const struct timespec *ts) {
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+// the lowest free slot, -1 without memory for one
+static int take_slot(JobRunner *r) {
+    for (int i = 0; i < r->cap_slots; i++) {
+        if (!r->slot_busy[i]) {
+            r->slot_busy[i] = true;
+            return i;
+        }
+    }
+    int cap = r->cap_slots ? r->cap_slots * 2 : 16;
+    bool *busy = realloc(r->slot_busy, cap * sizeof(bool));
+    if (busy == NULL) {
+        return -1;
+    }
+    memset(busy + r->cap_slots, 0, (cap - r->cap_slots) * sizeof(bool));
+    int i = r->cap_slots;
+    busy[i] = true;
+    r->slot_busy = busy;
+    r->cap_slots = cap;
+    return i;
+}
+
+// the phases of a job that left its slot, and the slot free again
+static void trace_job(JobRunner *r, Job *job, bool spawned) {
+    ChromeTrace *t = r->trace;
+    const ProcInfo *ci = &job->ci;
+    pid_t pid = spawned ? ci->pid : 0;
+    uint64_t start = ts_ns(&ci->t_start);
+
+    if (job->t_queued != 0) {
+        async_ChromeTrace(t, ++r->n_traced, "queued", job->t_queued, start, pid);
+    }
+    if (job->slot < 0) {
+        return;
+    }
+    if (!spawned) {
+        span_ChromeTrace(t, job->slot, "spawn failed", start, job->t_spawned, 0);
+    } else {
+        uint64_t exec = ts_ns(&ci->t_exec); // only stamped when the caller waited for exec_sentinel
+        exec = exec > job->t_spawned ? exec : job->t_spawned;
+        uint64_t end = ts_ns(&ci->t_end);
+        span_ChromeTrace(t, job->slot, "spawn", start, job->t_spawned, pid);
+        if (exec > job->t_spawned) {
+            span_ChromeTrace(t, job->slot, "exec", job->t_spawned, exec, pid);
+        }
+        span_ChromeTrace(t, job->slot, "running", exec, end, pid);
+        if (job->t_first != 0) {
+            instant_ChromeTrace(t, job->slot, "first byte", job->t_first, pid);
+        }
+        span_ChromeTrace(t, job->slot, "reap", end, real_ns(), pid);
+    }
+    r->slot_busy[job->slot] = false;
+    job->slot = -1;
+}
+
+static bool settle_hedge(JobRunner *r, Job **jobp);
+static void unwatch_hedge(JobRunner *r, Job *job);
+
+static bool succeeded(const Job *job) {
+    return job->spawn_rc == 0 && job->status != -1 && WIFEXITED(job->status) && WEXITSTATUS(job->status) == 0;
+}
+
+static void finish_job(JobRunner *r, Job *job) {
+    if (r->trace != NULL) {
+        trace_job(r, job, true);
+    }
+    if (r->view != NULL) {
+        remove_RunnerView(r->view, job->view_entry);
+        job->view_entry = -1;
+    }
+    cancel_Deadline(&job->deadline);
+    unwatch_ProcInfo(&r->loop, &job->ci);
+    close_ProcInfo(&job->ci);
+    if (r->fd_budget != NULL) {
+        release_FdBudget(r->fd_budget, job->fds_held);
+        job->fds_held = 0;
+    }
+    if (r->mem_budget != NULL) {
+        release_MemBudget(r->mem_budget, job->mem_held_kb);
+        job->mem_held_kb = 0;
+        if (job->spawn_rc == 0 && job->status != -1) {
+            record_MemBudget(r->mem_budget, job->args, job->ci.usage.ru_maxrss);
+        }
+    }
+    finish_CaptureBuf(&job->out.out);
+    finish_CaptureBuf(&job->out.err);
+    job->out.status = job->status;
+    leave_lane(r, job);
+    r->n_running--;
+    if (r->hedge != NULL) {
+        unwatch_hedge(r, job);
+        if (succeeded(job)) {
+            const struct timespec *a = &job->ci.t_start, *b = &job->ci.t_end;
+            record_HedgePolicy(r->hedge, job->args,
+                (uint64_t)(b->tv_sec - a->tv_sec) * 1000000000 + b->tv_nsec - a->tv_nsec);
+        }
+        if (job->hedge_pair != NULL && !settle_hedge(r, &job)) {
+            start_next(r); // its twin (or the job it twins) still runs
+            return;
+        }
+    }
+    if (r->journal != NULL && job->spawn_rc == 0 && job->status != -1) {
+        journal_job(r, job);
+    }
+    r->n_done++;
+    if (r->adapt != NULL) {
+        r->max_running = complete_AdaptLimit(r->adapt,
+            r->q_head < r->q_tail || r->n_tenant_queued > 0 || r->n_waiting > 0);
+    }
+    if (job->spawn_rc != 0 || !WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) {
+        r->n_failed++;
+    }
+    leave_scope(r, job); // a failure cancels its scope's queued jobs before they get the slot
+    if (job->tenant != NULL) {
+        release_tenant(r, job); // so the refill sees its tenant's share without it
+    }
+    start_next(r); // refill the slot before anything else runs
+    job_done(r, job);
+}
+
+static void reap(Job *job) {
+    JobRunner *r = job->runner;
+
+    if (reap_ProcInfo(&job->ci, &job->status, 0) > 0 && r->own_pgroup && --r->n_grouped == 0) {
+        r->pgroup = 0; // nobody left to join: the next child leads a new group
+    }
+}
+
+static void on_job_event(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Job *job = data;
+    JobRunner *r = job->runner;
+
+    if (fd == job->ci.pidfd) {
+        reap(job);
+        del_EventLoop(loop, fd);
+        job->pending--;
+    } else {
+        CaptureBuf *b = NULL;
+        char scratch[64 * 1024];
+        ssize_t n;
+        if (fd == job->ci.p_stdout && job->ci.stdout_type == PROC_COM_CAPTURE) {
+            b = &job->out.out;
+        } else if (fd == job->ci.p_stderr && job->ci.stderr_type == PROC_COM_CAPTURE) {
+            b = &job->out.err;
+        }
+        n = b != NULL ? fill_CaptureBuf(b, fd) : read(fd, scratch, sizeof(scratch));
+        if (n > 0 && r->trace != NULL && job->t_first == 0) {
+            job->t_first = real_ns();
+        }
+        if (n > 0 && job->view_entry >= 0) {
+            count_RunnerView(r->view, job->view_entry, fd == job->ci.p_stderr ? STDERR_FILENO : STDOUT_FILENO, n);
+        }
+        bool stopped = b != NULL && b->stopped;
+        if (!stopped && (n > 0 || (n < 0 && (errno == EINTR || errno == EAGAIN)))) {
+            return;
+        }
+        del_EventLoop(loop, fd);
+        if (stopped) {
+            short_circuit_ProcInfo(&job->ci, fd, job->out.stop_signal);
+        }
+        if (--job->pending == 1 && job->ci.pidfd < 0) {
+            reap(job); // no pidfd: the child is reaped once its output is done
+            job->pending--;
+        }
+    }
+    if (job->pending == 0) {
+        finish_job(r, job);
+    }
+}
+
+static void on_deadline(Deadline *d, int signo, void *data) {
+    Job *job = data;
+    job->timed_out = true;
+}
+
+// a hedged job and its twin, while either still runs
+typedef struct JobHedge {
+    Job *primary;
+    Job twin;
+    Job *winner;        // the first to exit 0, NULL so far
+    int live;           // members not finished yet
+} JobHedge;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool hedgeable(const Job *job) {
+    const ProcInfo *ci = &job->ci;
+    ProcComType outs[2] = {ci->stdout_type, ci->stderr_type};
+
+    if (!job->idempotent || ci->n_extra_fds > 0 || ci->chan_size > 0) {
+        return false;
+    }
+    if (ci->stdin_type != PROC_COM_NONE && ci->stdin_type != PROC_COM_PATH && ci->stdin_type != PROC_COM_PIPE) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (outs[i] != PROC_COM_NONE && outs[i] != PROC_COM_PIPE && outs[i] != PROC_COM_CAPTURE) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int start_job(JobRunner *r, Job *job);
+
+static void set_hedge_timer(JobRunner *r) {
+    struct itimerspec its = {{0, 0}, {0, 0}};
+
+    if (r->n_watch > 0) {
+        uint64_t due = r->hedge_watch[0]->hedge_due;
+        its.it_value = (struct timespec){.tv_sec = due / 1000000000, .tv_nsec = due % 1000000000};
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) {
+            its.it_value.tv_nsec = 1; // zero would disarm it
+        }
+    }
+    timerfd_settime(r->hedge_tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void unwatch_hedge(JobRunner *r, Job *job) {
+    for (size_t i = 0; i < r->n_watch; i++) {
+        if (r->hedge_watch[i] == job) {
+            memmove(&r->hedge_watch[i], &r->hedge_watch[i + 1], (r->n_watch - i - 1) * sizeof(Job *));
+            r->n_watch--;
+            if (i == 0) {
+                set_hedge_timer(r);
+            }
+            return;
+        }
+    }
+}
+
+// signal a running job with whatever it started: the group it leads, if
+// that group is its own; with own_pgroup the group is everyone's, so just it
+static void signal_member(Job *job, int sig) {
+    if (job->ci.pid <= 0 || job->pending == 0) {
+        return;
+    }
+    if (job->paused && sig != SIGSTOP) {
+        resume_job(job->runner, job); // stopped, it would not act on sig before a SIGCONT
+    }
+    if (job->ci.set_pgroup && job->ci.pgroup == 0 && !job->ci.pgroup_shared) {
+        killpg(job->ci.pid, sig);
+    } else if (job->ci.pidfd < 0 || syscall(SYS_pidfd_send_signal, job->ci.pidfd, sig, NULL, 0) < 0) {
+        kill(job->ci.pid, sig);
+    }
+}
+
+static int lane_of(const Job *job) {
+    return job->lane >= 0 && job->lane < RUNNER_LANES ? job->lane : RUNNER_LANES - 1;
+}
+
+// slots the lanes other than l are still owed from their reservations
+static int lane_owed(const JobRunner *r, int l) {
+    int owed = 0;
+    for (int i = 0; i < RUNNER_LANES; i++) {
+        const JobLane *ln = &r->lanes[i];
+        int active = ln->n_running - ln->n_paused;
+        if (i != l && ln->reserved > active) {
+            owed += ln->reserved - active;
+        }
+    }
+    return owed;
+}
+
+// a job of lane l may take a slot now
+static bool lane_fits(const JobRunner *r, int l) {
+    return r->n_running - r->n_paused + lane_owed(r, l) < r->max_running;
+}
+
+static void enter_lane(JobRunner *r, Job *job) {
+    JobLane *ln = &r->lanes[lane_of(job)];
+    job->paused = false;
+    job->lane_prev = NULL;
+    job->lane_next = ln->running;
+    if (job->lane_next != NULL) {
+        job->lane_next->lane_prev = job;
+    }
+    ln->running = job;
+    ln->n_running++;
+}
+
+// job finished: off its lane's running list; a twin, never on it, is left alone
+static void leave_lane(JobRunner *r, Job *job) {
+    JobLane *ln = &r->lanes[lane_of(job)];
+
+    if (job->lane_prev == NULL && ln->running != job) {
+        return;
+    }
+    if (job->lane_prev != NULL) {
+        job->lane_prev->lane_next = job->lane_next;
+    } else {
+        ln->running = job->lane_next;
+    }
+    if (job->lane_next != NULL) {
+        job->lane_next->lane_prev = job->lane_prev;
+    }
+    job->lane_prev = job->lane_next = NULL;
+    ln->n_running--;
+    if (job->paused) {
+        job->paused = false;
+        ln->n_paused--;
+        r->n_paused--;
+    }
+}
+
+static void pause_job(JobRunner *r, Job *job) {
+    JobLane *ln = &r->lanes[lane_of(job)];
+    signal_member(job, SIGSTOP);
+    job->paused = true;
+    ln->n_paused++;
+    ln->n_paused_total++;
+    r->n_paused++;
+    if (job->view_entry >= 0) {
+        pause_RunnerView(r->view, job->view_entry, true);
+    }
+}
+
+static void resume_job(JobRunner *r, Job *job) {
+    JobLane *ln = &r->lanes[lane_of(job)];
+    job->paused = false;
+    ln->n_paused--;
+    r->n_paused--;
+    signal_member(job, SIGCONT);
+    if (job->view_entry >= 0) {
+        pause_RunnerView(r->view, job->view_entry, false);
+    }
+}
+
+// a member of a hedged pair finished; true once both did, with *jobp then
+// the primary holding the winner's results, to be delivered
+static bool settle_hedge(JobRunner *r, Job **jobp) {
+    Job *job = *jobp;
+    JobHedge *h = job->hedge_pair;
+    Job *other = job == h->primary ? &h->twin : h->primary;
+
+    h->live--;
+    if (job == &h->twin) {
+        r->hedge->n_active--;
+    }
+    if (h->winner == NULL && succeeded(job)) {
+        h->winner = job;
+        if (h->live > 0) {
+            signal_member(other, SIGKILL); // the one that lost
+        }
+    }
+    if (h->live > 0) {
+        return false;
+    }
+    Job *p = h->primary;
+    if (h->winner == &h->twin) {
+        CaptureResult out = p->out;
+        p->out = h->twin.out;
+        h->twin.out = out;
+        p->status = h->twin.status;
+        p->timed_out = h->twin.timed_out;
+        p->ci.usage = h->twin.ci.usage;
+        p->ci.t_end = h->twin.ci.t_end;
+        r->hedge->n_won++;
+    }
+    free_CaptureResult(&h->twin.out);
+    p->hedged = true;
+    p->hedge_pair = NULL;
+    free(h);
+    *jobp = p;
+    return true;
+}
+
+// run a copy of job next to it, within the policy's budget and a free slot
+static void start_twin(JobRunner *r, Job *job) {
+    HedgePolicy *hp = r->hedge;
+    FdCost cost = {0};
+    long kb = 0;
+
+    if (job->pending == 0 || job->hedge_pair != NULL || job->paused ||
+            r->n_running - r->n_paused >= r->max_running || !may_hedge_HedgePolicy(hp)) {
+        return;
+    }
+    if (r->mem_budget != NULL) {
+        kb = estimate_MemBudget(r->mem_budget, job->args);
+        if (!acquire_MemBudget(r->mem_budget, kb, false)) {
+            return;
+        }
+    }
+    if (r->fd_budget != NULL) {
+        cost = fd_cost_ProcInfo(&job->ci);
+        if (acquire_FdBudget(r->fd_budget, cost.held + cost.transient, false) != 0) {
+            cost.held = cost.transient = 0;
+            goto fail;
+        }
+    }
+    JobHedge *h = calloc(1, sizeof(JobHedge));
+    if (h == NULL) {
+        goto fail;
+    }
+    Job *t = &h->twin;
+    *t = *job;
+    ProcInfo *ci = &t->ci;
+    ci->p_stdin = ci->p_stdout = ci->p_stderr = -1;
+    ci->pidfd = ci->p_chan = ci->p_bell = ci->p_exec = -1;
+    ci->pid = -1;
+    memset(&ci->err, 0, sizeof(ci->err));
+    memset(&ci->usage, 0, sizeof(ci->usage));
+    memset(&t->deadline, 0, sizeof(t->deadline));
+    t->lane_prev = t->lane_next = NULL; // not on its lane: it borrows its job's place there
+    t->tenant_kb = -1; // its job holds the tenant share for both
+    memset(&t->out, 0, sizeof(t->out));
+    t->out.out.limit = job->out.out.limit;
+    t->out.err.limit = job->out.err.limit;
+    t->out.out.spill_at = job->out.out.spill_at;
+    t->out.err.spill_at = job->out.err.spill_at;
+    t->out.out.spill_dir = job->out.out.spill_dir;
+    t->out.err.spill_dir = job->out.err.spill_dir;
+    t->out.out.timestamps = job->out.out.timestamps;
+    t->out.err.timestamps = job->out.err.timestamps;
+    t->out.out.stop_bytes = job->out.out.stop_bytes;
+    t->out.err.stop_bytes = job->out.err.stop_bytes;
+    t->out.out.stop_lines = job->out.out.stop_lines;
+    t->out.err.stop_lines = job->out.err.stop_lines;
+    t->out.out.digest = job->out.out.digest;
+    t->out.err.digest = job->out.err.digest;
+    t->out.stop_signal = job->out.stop_signal;
+    t->fds_held = cost.held;
+    t->mem_held_kb = kb;
+    t->hedge_pair = h;
+    t->t_queued = 0; // never queued
+    h->primary = job;
+    h->live = 2;
+    job->hedge_pair = h;
+    hp->n_hedged++;
+    hp->n_active++;
+    int failed = start_job(r, t);
+    if (r->fd_budget != NULL) {
+        release_FdBudget(r->fd_budget, failed ? cost.held + cost.transient : cost.transient);
+    }
+    if (!failed) {
+        return;
+    }
+    hp->n_hedged--; // the job goes on alone
+    hp->n_active--;
+    job->hedge_pair = NULL;
+    free_CaptureResult(&t->out);
+    free(h);
+    cost.held = cost.transient = 0;
+fail:
+    if (r->fd_budget != NULL) {
+        release_FdBudget(r->fd_budget, cost.held + cost.transient);
+    }
+    if (r->mem_budget != NULL) {
+        release_MemBudget(r->mem_budget, kb);
+    }
+}
+
+static void on_hedge_timer(EventLoop *loop, int fd, unsigned revents, void *data) {
+    JobRunner *r = data;
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN) {
+        return;
+    }
+    uint64_t now = now_ns();
+    while (r->n_watch > 0 && r->hedge_watch[0]->hedge_due <= now) {
+        Job *job = r->hedge_watch[0];
+        memmove(&r->hedge_watch[0], &r->hedge_watch[1], (r->n_watch - 1) * sizeof(Job *));
+        r->n_watch--;
+        start_twin(r, job);
+    }
+    set_hedge_timer(r);
+}
+
+// give job a twin once it outlived its command's hedge delay
+static void watch_hedge(JobRunner *r, Job *job) {
+    r->hedge->n_jobs++;
+    uint64_t delay = delay_HedgePolicy(r->hedge, job->args);
+    if (delay == 0) {
+        return;
+    }
+    if (r->hedge_tfd < 0) {
+        if ((r->hedge_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+            showError(false, "Failed to create hedge timer: %s!", strerror(errno));
+            return;
+        }
+        if (add_EventLoop(&r->loop, r->hedge_tfd, POLLIN, on_hedge_timer, r)) {
+            close(r->hedge_tfd);
+            r->hedge_tfd = -1;
+            return;
+        }
+    }
+    if (r->n_watch == r->cap_watch) {
+        size_t cap = r->cap_watch ? r->cap_watch * 2 : 64;
+        Job **w = realloc(r->hedge_watch, cap * sizeof(Job *));
+        if (w == NULL) {
+            return;
+        }
+        r->hedge_watch = w;
+        r->cap_watch = cap;
+    }
+    job->hedge_due = now_ns() + delay;
+    size_t i = r->n_watch;
+    while (i > 0 && r->hedge_watch[i - 1]->hedge_due > job->hedge_due) {
+        r->hedge_watch[i] = r->hedge_watch[i - 1];
+        i--;
+    }
+    r->hedge_watch[i] = job;
+    r->n_watch++;
+    if (i == 0) {
+        set_hedge_timer(r);
+    }
+}
+
+// an entry for job, just spawned
+static void view_job(JobRunner *r, Job *job) {
+    JobView j = {
+        .pid = job->ci.pid,
+        .lane = lane_of(job),
+        .twin = job->hedge_pair != NULL && job == &job->hedge_pair->twin,
+        .started_ns = now_ns(),
+    };
+    const char *name = strrchr(job->args[0], '/');
+    snprintf(j.name, sizeof(j.name), "%s", name != NULL ? name + 1 : job->args[0]);
+    if (job->timeout_ms > 0) {
+        j.deadline_ns = j.started_ns + (uint64_t)job->timeout_ms * 1000000;
+    }
+    job->view_entry = add_RunnerView(r->view, &j);
+}
+
+static int start_job(JobRunner *r, Job *job) {
+    job->runner = r;
+    job->view_entry = -1;
+    job->status = -1;
+    job->timed_out = false;
+    reset_CaptureResult(&job->out);
+    if (r->journal != NULL) { // its digests are taken as the output is read
+        job->out.out.digest = job->out.err.digest = true;
+    }
+    if (r->own_pgroup) {
+        job->ci.set_pgroup = true;
+        job->ci.pgroup = r->pgroup;
+        job->ci.pgroup_shared = true; // its timeout is its own, not the whole group's
+    }
+    if (r->use_cgroup) {
+        job->ci.set_cgroup = true;
+        job->ci.cgroup_fd = r->cgroup_fd;
+    }
+    bool hedge = r->hedge != NULL && hedgeable(job);
+    bool group = hedge || job->scope != NULL || r->lanes[lane_of(job)].preemptible;
+    if (group && !r->own_pgroup) {
+        // its own group, so a losing twin or a cancelled job dies with its
+        // children, and a paused one stops with them
+        job->ci.set_pgroup = true;
+        job->ci.pgroup = 0;
+        job->ci.pgroup_shared = false;
+    }
+    if (r->trace != NULL) {
+        job->slot = take_slot(r);
+        job->t_first = 0;
+    }
+    job->spawn_rc = subprocess(&job->ci, job->args, job->env);
+    if (r->trace != NULL) {
+        job->t_spawned = real_ns();
+        if (job->spawn_rc != 0) {
+            trace_job(r, job, false);
+        }
+    }
+    if (job->spawn_rc != 0) {
+        return 1;
+    }
+    if (r->own_pgroup) {
+        if (r->pgroup == 0) {
+            r->pgroup = job->ci.pid;
+        }
+        r->n_grouped++;
+    }
+    if (job->ci.stdin_type == PROC_COM_PIPE && job->ci.p_stdin >= 0) {
+        close(job->ci.p_stdin);
+        job->ci.p_stdin = -1;
+    } else if (job->ci.stdin_type == PROC_COM_DUPLEX) {
+        shutdown_duplex(&job->ci);
+    }
+    job->pending = 1; // the child itself
+    if (proc_com_piped(job->ci.stdout_type) && job->ci.p_stdout >= 0) {
+        job->pending++;
+    }
+    if (proc_com_piped(job->ci.stderr_type) && job->ci.p_stderr >= 0) {
+        job->pending++;
+    }
+    if (watch_ProcInfo(&r->loop, &job->ci, on_job_event, job)) {
+        // can't wait for it asynchronously: run it to completion here
+        reap(job);
+        job->pending = 0;
+    }
+    r->n_running++;
+    if (r->view != NULL) {
+        view_job(r, job);
+    }
+    if (r->table != NULL && job->row >= 0 && job->hedge_pair == NULL) { // a twin keeps its job's row
+        start_JobTable(r->table, job->row, job->ci.pid, job->ci.pidfd, -1,
+            job->timeout_ms > 0 ? now_ns() + (uint64_t)job->timeout_ms * 1000000 : 0);
+    }
+    if (hedge && job->hedge_pair == NULL && job->pending > 0) {
+        watch_hedge(r, job);
+    }
+    if (job->scope != NULL && job->hedge_pair == NULL) { // a twin is signalled through its job
+        job->scope_prev = NULL;
+        job->scope_next = job->scope->running;
+        if (job->scope_next != NULL) {
+            job->scope_next->scope_prev = job;
+        }
+        job->scope->running = job;
+    }
+    if (job->hedge_pair == NULL) {
+        enter_lane(r, job);
+    }
+    if (job->pending > 0 && job->timeout_ms > 0) {
+        job->deadline.on_hit = on_deadline;
+        job->deadline.data = job;
+        arm_Deadline(&r->deadlines, &job->deadline, &job->ci, job->timeout_ms, job->grace_ms);
+    }
+    if (job->pending == 1 && job->ci.pidfd < 0) { // nothing to wait on
+        reap(job);
+        job->pending = 0;
+    }
+    if (job->pending == 0) {
+        finish_job(r, job);
+    }
+    return 0;
+}
+
+static void on_admit_timer(EventLoop *loop, int fd, unsigned revents, void *data) {
+    JobRunner *r = data;
+    uint64_t expirations;
+
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN) {
+        return;
+    }
+    r->admit_armed = false;
+    start_next(r);
+}
+
+// start_next() again in ms; 1 if there is no timer to do it
+static int arm_admit(JobRunner *r, int ms) {
+    struct itimerspec its = {.it_value = {.tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000 + 1}};
+
+    if (r->admit_tfd < 0) {
+        if ((r->admit_tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+            showError(false, "Failed to create admission timer: %s!", strerror(errno));
+            return 1;
+        }
+        if (add_EventLoop(&r->loop, r->admit_tfd, POLLIN, on_admit_timer, r)) {
+            close(r->admit_tfd);
+            r->admit_tfd = -1;
+            return 1;
+        }
+    }
+    if (timerfd_settime(r->admit_tfd, 0, &its, NULL) != 0) {
+        return 1;
+    }
+    r->admit_armed = true;
+    return 0;
+}
+
+static void fail_queued(JobRunner *r, Job *job, int rc) {
+    job->runner = r;
+    job->spawn_rc = rc;
+    job->status = -1;
+    r->n_done++;
+    r->n_failed++;
+    job_done(r, job);
+}
+
+static bool trips_scope(const CancelScope *s, const Job *job) {
+    if (job->cancelled) {
+        return false; // its own cancellation is no new failure
+    }
+    if (s->on_status >= 0) {
+        return job->spawn_rc == 0 && job->status != -1 && WIFEXITED(job->status) &&
+            WEXITSTATUS(job->status) == s->on_status;
+    }
+    return !succeeded(job);
+}
+
+// job is done with its scope: off the running list, and cancelling it if
+// job is the first member to fail; called again for the same job it does nothing
+static void leave_scope(JobRunner *r, Job *job) {
+    CancelScope *s = job->scope;
+
+    if (s == NULL) {
+        return;
+    }
+    if (job->scope_prev != NULL) {
+        job->scope_prev->scope_next = job->scope_next;
+    } else if (s->running == job) {
+        s->running = job->scope_next;
+    }
+    if (job->scope_next != NULL) {
+        job->scope_next->scope_prev = job->scope_prev;
+    }
+    job->scope_prev = job->scope_next = NULL;
+    if (!s->cancelled && trips_scope(s, job)) {
+        s->cause = job;
+        cancel_CancelScope(r, s);
+    }
+}
+
+void init_CancelScope(CancelScope *s, int on_status) {
+    memset(s, 0, sizeof(*s));
+    s->on_status = on_status;
+}
+
+void cancel_CancelScope(JobRunner *r, CancelScope *s) {
+    int sig = s->signo > 0 ? s->signo : SIGTERM;
+    Job *dropped = NULL, **tail = &dropped;
+    size_t keep = r->q_head;
+
+    if (s->cancelled) {
+        return;
+    }
+    s->cancelled = true;
+    for (Job *job = s->running; job != NULL; job = job->scope_next) {
+        job->cancelled = true;
+        s->n_cancelled++;
+        signal_member(job, sig);
+        if (job->hedge_pair != NULL) {
+            signal_member(&job->hedge_pair->twin, sig);
+        }
+    }
+    // unlink the queued members first: their on_done may submit more jobs
+    for (size_t i = r->q_head; i < r->q_tail; i++) {
+        Job *job = r->queue[i];
+        if (job->scope != s) {
+            r->queue[keep++] = job;
+            continue;
+        }
+        if (r->mem_blocked == job) {
+            r->mem_blocked = NULL;
+        }
+        r->lanes[lane_of(job)].n_queued--;
+        job->scope_next = NULL;
+        *tail = job;
+        tail = &job->scope_next;
+    }
+    r->q_tail = keep;
+    *tail = drop_from_tenants(r, s);
+    for (; *tail != NULL; tail = &(*tail)->scope_next) {
+        (*tail)->scope_next = (*tail)->tenant_next;
+        (*tail)->tenant_next = NULL;
+    }
+    while (dropped != NULL) {
+        Job *job = dropped;
+        dropped = job->scope_next;
+        job->scope_next = NULL;
+        job->cancelled = true;
+        s->n_cancelled++;
+        fail_queued(r, job, ECANCELED);
+    }
+}
+
+// bring a job that fits the memory budget to the head of the queue and
+// take its estimate; 1 if none may start now
+static int pick_by_memory(JobRunner *r) {
+    MemBudget *b = r->mem_budget;
+    Job *head = r->queue[r->q_head];
+    long kb = estimate_MemBudget(b, head->args);
+
+    if (acquire_MemBudget(b, kb, r->n_running == 0)) {
+        head->mem_held_kb = kb;
+        return 0;
+    }
+    if (r->mem_blocked != head) {
+        r->mem_blocked = head;
+        r->mem_passed = 0;
+    }
+    if (r->mem_passed >= MEM_BUDGET_LOOKAHEAD) {
+        return 1; // it has waited long enough: hold the rest back for it
+    }
+    size_t end = r->q_head + 1 + MEM_BUDGET_LOOKAHEAD;
+    for (size_t i = r->q_head + 1; i < r->q_tail && i < end; i++) {
+        Job *job = r->queue[i];
+        if (lane_of(job) != lane_of(head)) {
+            continue; // overtaking stays within the lane pick_lane() chose
+        }
+        kb = estimate_MemBudget(b, job->args);
+        if (acquire_MemBudget(b, kb, false)) {
+            memmove(&r->queue[r->q_head + 1], &r->queue[r->q_head], (i - r->q_head) * sizeof(Job *));
+            r->queue[r->q_head] = job;
+            job->mem_held_kb = kb;
+            r->mem_passed++;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void give_back_memory(JobRunner *r, Job *job) {
+    if (r->mem_budget != NULL) {
+        release_MemBudget(r->mem_budget, job->mem_held_kb);
+        job->mem_held_kb = 0;
+    }
+}
+
+// bring the first queued job of the lane whose turn it is to the head of
+// the queue; 1 if every lane with queued work is held back by the others'
+// reservations or the lack of a slot
+static int pick_lane(JobRunner *r) {
+    int best = -1;
+
+    for (int l = 0; l < RUNNER_LANES; l++) {
+        const JobLane *ln = &r->lanes[l];
+        if (ln->n_queued == 0 || !lane_fits(r, l)) {
+            continue;
+        }
+        if (r->lane_policy == LANES_STRICT) {
+            best = l;
+            break;
+        }
+        if (best < 0 || ln->pass < r->lanes[best].pass) {
+            best = l;
+        }
+    }
+    if (best < 0) {
+        return 1;
+    }
+    size_t i = r->q_head;
+    while (i < r->q_tail && lane_of(r->queue[i]) != best) {
+        i++;
+    }
+    if (i > r->q_head && i < r->q_tail) {
+        Job *job = r->queue[i];
+        memmove(&r->queue[r->q_head + 1], &r->queue[r->q_head], (i - r->q_head) * sizeof(Job *));
+        r->queue[r->q_head] = job;
+    }
+    return 0;
+}
+
+// the job at the head of the queue leaves it; started says it got a slot
+static void dequeue(JobRunner *r, const Job *job, bool started) {
+    JobLane *ln = &r->lanes[lane_of(job)];
+
+    ln->n_queued--;
+    if (started && r->lane_policy == LANES_WEIGHTED) {
+        r->lane_pass = ln->pass;
+        ln->pass += LANE_STRIDE / (ln->weight > 0 ? ln->weight : 1);
+    }
+}
+
+// the most urgent lane with queued work can't start it: pause the newest
+// running job of a less urgent, preemptible lane when that alone makes
+// room, and a lane is only preempted down to its reservation
+static bool preempt(JobRunner *r) {
+    int want = 0;
+
+    while (want < RUNNER_LANES && r->lanes[want].n_queued == 0) {
+        want++;
+    }
+    if (want == RUNNER_LANES ||
+            r->n_running - r->n_paused - 1 + lane_owed(r, want) >= r->max_running) {
+        return false;
+    }
+    for (int l = RUNNER_LANES - 1; l > want; l--) {
+        JobLane *ln = &r->lanes[l];
+        if (!ln->preemptible || ln->n_running - ln->n_paused <= ln->reserved) {
+            continue;
+        }
+        for (Job *job = ln->running; job != NULL; job = job->lane_next) {
+            if (!job->paused && job->hedge_pair == NULL && job->pending > 0) {
+                pause_job(r, job);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// paused jobs get their slots back, oldest first, before anything of their
+// lane or a less urgent one starts
+static void resume_paused(JobRunner *r) {
+    for (int l = 0; l < RUNNER_LANES && r->n_paused > 0; l++) {
+        JobLane *ln = &r->lanes[l];
+        while (ln->n_paused > 0 && lane_fits(r, l)) {
+            Job *oldest = NULL;
+            for (Job *job = ln->running; job != NULL; job = job->lane_next) {
+                if (job->paused) {
+                    oldest = job;
+                }
+            }
+            resume_job(r, oldest);
+        }
+        if (ln->n_queued > 0 && lane_fits(r, l)) {
+            return;
+        }
+    }
+}
+
+static int tenant_weight(const JobTenant *t) {
+    return t->weight > 0 ? t->weight : 1;
+}
+
+// the larger of its fractions of the slots and of the memory, over its weight
+static double tenant_share(const JobRunner *r, const JobTenant *t) {
+    double share = (double)t->n_running / (r->max_running > 0 ? r->max_running : 1);
+    if (r->mem_budget != NULL && r->mem_budget->limit_kb > 0) {
+        double mem = (double)t->mem_kb / r->mem_budget->limit_kb;
+        share = mem > share ? mem : share;
+    }
+    return share / tenant_weight(t);
+}
+
+static bool tenant_before(const JobRunner *r, const JobTenant *a, const JobTenant *b) {
+    double sa = tenant_share(r, a), sb = tenant_share(r, b);
+    return sa != sb ? sa < sb : a->vtime < b->vtime;
+}
+
+static void put_tenant(JobRunner *r, size_t i, JobTenant *t) {
+    r->tenant_heap[i] = t;
+    t->heap_pos = i + 1;
+}
+
+static void sift_up_tenant(JobRunner *r, size_t i) {
+    JobTenant *t = r->tenant_heap[i];
+    while (i > 0 && tenant_before(r, t, r->tenant_heap[(i - 1) / 2])) {
+        put_tenant(r, i, r->tenant_heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    put_tenant(r, i, t);
+}
+
+static void sift_down_tenant(JobRunner *r, size_t i) {
+    JobTenant *t = r->tenant_heap[i];
+    for (;;) {
+        size_t c = 2 * i + 1;
+        if (c >= r->n_tenant_heap) {
+            break;
+        }
+        if (c + 1 < r->n_tenant_heap && tenant_before(r, r->tenant_heap[c + 1], r->tenant_heap[c])) {
+            c++;
+        }
+        if (!tenant_before(r, r->tenant_heap[c], t)) {
+            break;
+        }
+        put_tenant(r, i, r->tenant_heap[c]);
+        i = c;
+    }
+    put_tenant(r, i, t);
+}
+
+// t's share moved: restore the heap around it
+static void reorder_tenant(JobRunner *r, JobTenant *t) {
+    if (t->heap_pos > 0) {
+        sift_up_tenant(r, t->heap_pos - 1);
+        sift_down_tenant(r, t->heap_pos - 1);
+    }
+}
+
+static void heapify_tenants(JobRunner *r) {
+    for (size_t i = r->n_tenant_heap / 2; i-- > 0;) {
+        sift_down_tenant(r, i);
+    }
+}
+
+// t has queued work again
+static int push_tenant(JobRunner *r, JobTenant *t) {
+    if (r->n_tenant_heap == r->cap_tenant_heap) {
+        size_t cap = r->cap_tenant_heap ? r->cap_tenant_heap * 2 : 16;
+        JobTenant **h = realloc(r->tenant_heap, cap * sizeof(JobTenant *));
+        if (h == NULL) {
+            return 1;
+        }
+        r->tenant_heap = h;
+        r->cap_tenant_heap = cap;
+    }
+    if (t->vtime < r->tenant_vtime) {
+        t->vtime = r->tenant_vtime; // an idle tenant banks no turns
+    }
+    t->mem_passed = 0;
+    put_tenant(r, r->n_tenant_heap++, t);
+    sift_up_tenant(r, r->n_tenant_heap - 1);
+    return 0;
+}
+
+static void remove_tenant(JobRunner *r, JobTenant *t) {
+    size_t i = t->heap_pos - 1;
+    JobTenant *last = r->tenant_heap[--r->n_tenant_heap];
+
+    t->heap_pos = 0;
+    if (last != t) {
+        put_tenant(r, i, last);
+        reorder_tenant(r, last);
+    }
+}
+
+// job no longer holds a share of its tenant's; called again it does nothing
+static void release_tenant(JobRunner *r, Job *job) {
+    JobTenant *t = job->tenant;
+
+    if (job->tenant_kb < 0) {
+        return; // never left its tenant's queue
+    }
+    t->n_running--;
+    t->mem_kb -= job->tenant_kb;
+    job->tenant_kb = -1;
+    if (job->spawn_rc == 0 && job->status != -1) {
+        t->busy_ns += ts_ns(&job->ci.t_end) - ts_ns(&job->ci.t_start);
+    }
+    reorder_tenant(r, t);
+}
+
+// unlink the queued jobs of scope s (every one for NULL) from the tenants'
+// queues; returns them chained by tenant_next
+static Job *drop_from_tenants(JobRunner *r, const CancelScope *s) {
+    Job *dropped = NULL, **tail = &dropped;
+    size_t keep = 0;
+
+    for (size_t i = 0; i < r->n_tenant_heap; i++) {
+        JobTenant *t = r->tenant_heap[i];
+        Job **pp = &t->q_head;
+        t->q_tail = NULL;
+        while (*pp != NULL) {
+            Job *job = *pp;
+            if (s != NULL && job->scope != s) {
+                t->q_tail = job;
+                pp = &job->tenant_next;
+                continue;
+            }
+            *pp = job->tenant_next;
+            job->tenant_next = NULL;
+            *tail = job;
+            tail = &job->tenant_next;
+            t->n_queued--;
+            r->n_tenant_queued--;
+        }
+        t->heap_pos = 0;
+        if (t->n_queued > 0) {
+            put_tenant(r, keep++, t);
+        }
+    }
+    r->n_tenant_heap = keep;
+    heapify_tenants(r);
+    return dropped;
+}
+
+// slot refill: the next job of the tenant furthest below its share joins
+// the runner's FIFO, charged to its tenant. With a mem_budget a tenant
+// whose job doesn't fit is passed over for the next in share order, up to
+// MEM_BUDGET_LOOKAHEAD of them, and as often as MEM_BUDGET_LOOKAHEAD times;
+// 1 if no job is to start now
+static int refill_from_tenants(JobRunner *r) {
+    MemBudget *b = r->mem_budget;
+    JobTenant *t = NULL;
+    long kb = 0;
+
+    if (r->n_tenant_heap == 0 || r->n_running - r->n_paused >= r->max_running) {
+        return 1;
+    }
+    if (r->tenant_max != r->max_running) { // every slot share moved
+        r->tenant_max = r->max_running;
+        heapify_tenants(r);
+    }
+    JobTenant *root = r->tenant_heap[0];
+    // tenants in share order: the best of a frontier that starts at the root
+    // and takes in the children of each one passed over
+    size_t frontier[MEM_BUDGET_LOOKAHEAD + 2];
+    size_t n_front = 1;
+    frontier[0] = 0;
+    for (int looked = 0; n_front > 0 && looked <= MEM_BUDGET_LOOKAHEAD; looked++) {
+        size_t best = 0;
+        for (size_t k = 1; k < n_front; k++) {
+            if (tenant_before(r, r->tenant_heap[frontier[k]], r->tenant_heap[frontier[best]])) {
+                best = k;
+            }
+        }
+        size_t i = frontier[best];
+        frontier[best] = frontier[--n_front];
+        JobTenant *c = r->tenant_heap[i];
+        kb = b != NULL ? estimate_MemBudget(b, c->q_head->args) : 0;
+        if (b == NULL || r->n_running == 0 || fits_MemBudget(b, kb)) {
+            t = c;
+            break;
+        }
+        if (i == 0 && root->mem_passed >= MEM_BUDGET_LOOKAHEAD) {
+            return 1; // it has waited long enough: hold the rest back for it
+        }
+        for (size_t k = 2 * i + 1; k <= 2 * i + 2 && k < r->n_tenant_heap && looked < MEM_BUDGET_LOOKAHEAD; k++) {
+            frontier[n_front++] = k;
+        }
+    }
+    if (t == NULL) {
+        return 1;
+    }
+    Job *job = t->q_head;
+    if (push_queue(r, job)) {
+        return 1;
+    }
+    root->mem_passed = t == root ? 0 : root->mem_passed + 1;
+    if ((t->q_head = job->tenant_next) == NULL) {
+        t->q_tail = NULL;
+    }
+    job->tenant_next = NULL;
+    t->n_queued--;
+    r->n_tenant_queued--;
+    t->n_running++;
+    t->n_started++;
+    t->mem_kb += kb;
+    job->tenant_kb = kb;
+    uint64_t waited = now_ns() - job->t_submitted;
+    t->wait_ns += waited;
+    if (waited > t->max_wait_ns) {
+        t->max_wait_ns = waited;
+    }
+    r->tenant_vtime = t->vtime;
+    t->vtime += TENANT_STRIDE / tenant_weight(t);
+    if (t->n_queued == 0) {
+        remove_tenant(r, t);
+    } else {
+        reorder_tenant(r, t);
+    }
+    return 0;
+}
+
+static void start_next(JobRunner *r) {
+    int rc, wait_ms;
+
+    for (;;) {
+        if (r->n_paused > 0) {
+            resume_paused(r);
+        }
+        if (r->admit_armed || (r->q_head == r->q_tail && refill_from_tenants(r))) {
+            break;
+        }
+        if (pick_lane(r)) {
+            if (preempt(r)) {
+                continue;
+            }
+            break; // a finishing job frees a slot and calls us again
+        }
+        if (r->admission != NULL && (rc = poll_Admission(r->admission, &wait_ms)) != 0) {
+            if (rc == EAGAIN && arm_admit(r, wait_ms) == 0) {
+                break;
+            }
+            Job *job = r->queue[r->q_head++];
+            dequeue(r, job, false);
+            fail_queued(r, job, report_SpawnError(&job->ci.err, SPAWN_STAGE_ADMISSION, -1,
+                rc == EAGAIN ? EBUSY : rc, 0, job->args[0]));
+            continue;
+        }
+        if (r->mem_budget != NULL && pick_by_memory(r)) {
+            break; // a finishing job gives its memory back and calls us again
+        }
+        Job *job = r->queue[r->q_head];
+        FdCost cost = {0};
+        if (r->fd_budget != NULL) {
+            cost = fd_cost_ProcInfo(&job->ci);
+            rc = acquire_FdBudget(r->fd_budget, cost.held + cost.transient, false);
+            if (rc == EAGAIN && r->n_running > 0) {
+                give_back_memory(r, job);
+                break; // a finishing job gives its fds back and calls us again
+            }
+            if (rc != 0) {
+                give_back_memory(r, job);
+                r->q_head++;
+                dequeue(r, job, false);
+                fail_queued(r, job, report_SpawnError(&job->ci.err, SPAWN_STAGE_PIPE, -1,
+                    EMFILE, 0, job->args[0]));
+                continue;
+            }
+            job->fds_held = cost.held;
+        }
+        r->q_head++;
+        dequeue(r, job, true);
+        int failed = start_job(r, job);
+        if (r->fd_budget != NULL) { // the child ends are closed by now, and all of it on failure
+            release_FdBudget(r->fd_budget, failed ? cost.held + cost.transient : cost.transient);
+            if (failed) {
+                job->fds_held = 0;
+            }
+        }
+        if (failed) {
+            int d;
+            give_back_memory(r, job);
+            if (r->admission != NULL && retryable_spawn(&job->ci, job->spawn_rc) &&
+                    (d = backoff_Admission(r->admission, job->attempts++)) >= 0 && arm_admit(r, d) == 0) {
+                r->q_head--; // its slot still holds it: retry it first
+                r->lanes[lane_of(job)].n_queued++;
+                break;
+            }
+            r->n_done++;
+            r->n_failed++;
+            job_done(r, job);
+        }
+    }
+    if (r->n_paused > 0 && r->n_paused == r->n_running) {
+        // only paused jobs are left to free fds or memory a queued job
+        // waits for: let them run rather than wait on each other forever
+        for (int l = 0; l < RUNNER_LANES; l++) {
+            while (r->lanes[l].n_paused > 0) {
+                Job *job = r->lanes[l].running;
+                while (!job->paused) {
+                    job = job->lane_next;
+                }
+                resume_job(r, job);
+            }
+        }
+    }
+    if (r->q_head == r->q_tail) {
+        r->q_head = r->q_tail = 0;
+    }
+    if (r->view != NULL) {
+        publish_view(r);
+    }
+}
+
+int init_JobRunner(JobRunner *r, int max_running, EvLoopBackend backend, JobDone on_done, void *data) {
+    memset(r, 0, sizeof(*r));
+    r->max_running = max_running > 0 ? max_running : 1;
+    r->on_done = on_done;
+    r->data = data;
+    r->admit_tfd = -1;
+    r->hedge_tfd = -1;
+    if (init_EventLoop(&r->loop, backend)) {
+        return 1;
+    }
+    if (init_DeadlineWheel(&r->deadlines, &r->loop, 0)) {
+        close_EventLoop(&r->loop);
+        return 1;
+    }
+    return 0;
+}
+
+// onto the tail of the FIFO, in its lane
+static int push_queue(JobRunner *r, Job *job) {
+    if (r->q_tail == r->q_cap) {
+        if (r->q_head > 0) { // slide the live part down before growing
+            memmove(r->queue, r->queue + r->q_head, (r->q_tail - r->q_head) * sizeof(Job *));
+            r->q_tail -= r->q_head;
+            r->q_head = 0;
+        }
+        if (r->q_tail == r->q_cap) {
+            size_t cap = r->q_cap ? r->q_cap * 2 : 64;
+            Job **q = realloc(r->queue, cap * sizeof(Job *));
+            if (q == NULL) {
+                showError(false, "Failed to queue job %s!", job->args[0]);
+                return 1;
+            }
+            r->queue = q;
+            r->q_cap = cap;
+        }
+    }
+    JobLane *ln = &r->lanes[lane_of(job)];
+    if (ln->n_queued++ == 0 && ln->pass < r->lane_pass) {
+        ln->pass = r->lane_pass; // an idle lane banks no turns
+    }
+    r->queue[r->q_tail++] = job;
+    return 0;
+}
+
+int submit_JobRunner(JobRunner *r, Job *job) {
+    job->replayed = false;
+    job->hedged = false;
+    job->cancelled = false;
+    job->hedge_pair = NULL;
+    job->scope_prev = job->scope_next = NULL;
+    job->row = -1;
+    job->slot = -1;
+    job->t_queued = r->trace != NULL ? real_ns() : 0;
+    if (r->table != NULL && (job->row = add_JobTable(r->table, job)) < 0) {
+        showError(false, "Job table full, can't queue job %s!", job->args[0]);
+        return 1;
+    }
+    if (job->scope != NULL && job->scope->cancelled) {
+        job->cancelled = true;
+        job->scope->n_cancelled++;
+        fail_queued(r, job, ECANCELED);
+        return 0;
+    }
+    if (r->journal != NULL) {
+        uint64_t h = argv_hash_Journal(job->args);
+        int status;
+        if (lookup_JobJournal(r->journal, journal_key(job, h), h, &status) &&
+                WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            job->runner = r;
+            job->replayed = true;
+            job->spawn_rc = 0;
+            job->status = status;
+            job->timed_out = false;
+            reset_CaptureResult(&job->out);
+            job->out.status = status;
+            r->n_done++;
+            job_done(r, job);
+            return 0;
+        }
+    }
+    job->attempts = 0;
+    job->tenant_kb = -1;
+    if (job->tenant != NULL) {
+        JobTenant *t = job->tenant;
+        if (t->n_queued == 0 && push_tenant(r, t)) {
+            showError(false, "Failed to queue job %s!", job->args[0]);
+            if (job->row >= 0) {
+                remove_JobTable(r->table, job->row);
+            }
+            return 1;
+        }
+        job->t_submitted = now_ns();
+        job->tenant_next = NULL;
+        if (t->q_tail != NULL) {
+            t->q_tail->tenant_next = job;
+        } else {
+            t->q_head = job;
+        }
+        t->q_tail = job;
+        t->n_queued++;
+        r->n_tenant_queued++;
+    } else if (push_queue(r, job)) {
+        if (job->row >= 0) {
+            remove_JobTable(r->table, job->row);
+        }
+        return 1;
+    }
+    start_next(r);
+    return 0;
+}
+
+size_t run_JobRunner(JobRunner *r) {
+    start_next(r);
+    while (r->n_running > 0 || r->q_head < r->q_tail || r->n_tenant_queued > 0) {
+        if (run_EventLoop(&r->loop, -1) < 0) {
+            showError(false, "Job runner event loop failed: %s!", strerror(errno));
+            break;
+        }
+    }
+    if (r->journal != NULL) {
+        sync_JobJournal(r->journal);
+    }
+    return r->n_failed;
+}
+
+static int kill_cgroup(JobRunner *r, int sig) {
+    char buf[4096];
+    int fd, rc = 0;
+
+    if (sig == SIGKILL && (fd = openat(r->cgroup_fd, "cgroup.kill", O_WRONLY | O_CLOEXEC)) >= 0) {
+        rc = write(fd, "1", 1) == 1 ? 0 : 1;
+        close(fd);
+        if (rc == 0) {
+            return 0;
+        }
+    }
+    if ((fd = openat(r->cgroup_fd, "cgroup.procs", O_RDONLY | O_CLOEXEC)) < 0) {
+        showError(false, "Failed to open cgroup.procs: %s!", strerror(errno));
+        return 1;
+    }
+    FILE *f = fdopen(fd, "r");
+    if (f == NULL) {
+        close(fd);
+        return 1;
+    }
+    setvbuf(f, buf, _IOFBF, sizeof(buf));
+    long pid;
+    while (fscanf(f, "%ld", &pid) == 1) {
+        if (kill(pid, sig) != 0 && errno != ESRCH) {
+            rc = 1;
+        }
+    }
+    fclose(f);
+    return rc;
+}
+
+int kill_JobRunner(JobRunner *r, int sig) {
+    if (r->own_pgroup) {
+        if (r->pgroup > 0 && killpg(r->pgroup, sig) != 0 && errno != ESRCH) {
+            showError(false, "Failed to signal process group %d: %s!", r->pgroup, strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    if (r->use_cgroup) {
+        return kill_cgroup(r, sig);
+    }
+    showError(false, "Job runner has no process group or cgroup to signal!");
+    return 1;
+}
+
+int cancel_JobRunner(JobRunner *r) {
+    while (r->q_head < r->q_tail) {
+        Job *job = r->queue[r->q_head++];
+        dequeue(r, job, false);
+        fail_queued(r, job, ECANCELED);
+    }
+    r->q_head = r->q_tail = 0;
+    for (Job *job = drop_from_tenants(r, NULL), *next; job != NULL; job = next) {
+        next = job->tenant_next;
+        job->tenant_next = NULL;
+        fail_queued(r, job, ECANCELED);
+    }
+    return r->n_running > 0 ? kill_JobRunner(r, SIGKILL) : 0;
+}
+
+void close_JobRunner(JobRunner *r) {
+    if (r->admit_tfd >= 0) {
+        del_EventLoop(&r->loop, r->admit_tfd);
+        close(r->admit_tfd);
+        r->admit_tfd = -1;
+    }
+    if (r->hedge_tfd >= 0) {
+        del_EventLoop(&r->loop, r->hedge_tfd);
+        close(r->hedge_tfd);
+        r->hedge_tfd = -1;
+    }
+    free(r->hedge_watch);
+    r->hedge_watch = NULL;
+    free(r->slot_busy);
+    r->slot_busy = NULL;
+    r->cap_slots = 0;
+    r->n_watch = r->cap_watch = 0;
+    close_DeadlineWheel(&r->deadlines);
+    close_EventLoop(&r->loop);
+    free(r->queue);
+    r->queue = NULL;
+    free(r->tenant_heap);
+    r->tenant_heap = NULL;
+    r->n_tenant_heap = r->cap_tenant_heap = r->n_tenant_queued = 0;
+    r->q_head = r->q_tail = r->q_cap = 0;
+}
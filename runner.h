@@ -0,0 +1,261 @@
+#ifndef RUNNER_H
+#define RUNNER_H
+
+#include <stddef.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "capture.h"
+#include "deadline.h"
+#include "admission.h"
+#include "adapt.h"
+#include "fd_budget.h"
+#include "completion.h"
+#include "journal.h"
+#include "mem_budget.h"
+#include "hedge.h"
+#include "job_table.h"
+#include "chrome_trace.h"
+#include "runner_view.h"
+
+#define RUNNER_LANES 4      // priority lanes, 0 the most urgent
+
+typedef struct JobRunner JobRunner;
+struct JobTenant;
+struct ClusterNode;
+struct JobHedge;
+struct CancelScope;
+
+// one command for the runner; ci carries the stream configuration
+// PROC_COM_CAPTURE streams are collected into out, PROC_COM_PIPE outputs are
+// drained and dropped, and a piped (or PROC_COM_DUPLEX) stdin is closed right after the spawn
+typedef struct Job {
+    char** args;        // NULL-terminated argv
+    char** env;         // passed to subprocess() as is
+    ProcInfo ci;
+    void *data;         // caller's
+    uint64_t journal_id; // journal: the job's key, stable across runs; 0 keys it by argv
+    int timeout_ms;     // SIGTERM the child after this long, 0 for no limit
+    int grace_ms;       // then SIGKILL it this much later, 0 to SIGKILL at the deadline
+    bool idempotent;    // hedge: running it twice at once is harmless
+    struct CancelScope *scope; // caller's, NULL for none: the jobs it fails fast with
+    int lane;           // 0 to RUNNER_LANES - 1, 0 the most urgent; out of range is the least urgent
+    struct JobTenant *tenant; // caller's, NULL for none: queued with its tenant until it is its turn
+    // results
+    int spawn_rc;       // subprocess() rc, 0 if it started
+    int status;         // wait status, -1 if it never ran
+    CaptureResult out;
+    bool timed_out;     // the deadline hit before the job finished
+    bool replayed;      // journal: finished by an earlier run, not started; status is that run's
+    bool hedged;        // hedge: a twin ran next to it; status and out are the winner's
+    bool cancelled;     // scope: signalled, or never started, because another member failed
+    bool paused;        // lanes: SIGSTOPped for a more urgent lane's job, its slot lent out
+    // runner bookkeeping
+    Deadline deadline;
+    JobRunner *runner;
+    int pending;        // open streams plus the unreaped child
+    int attempts;       // EAGAIN retries so far
+    int fds_held;       // fd_budget: held until the job finishes
+    long mem_held_kb;   // mem_budget: its estimate, held until the job finishes
+    CompletionNode node; // completions: posted by, see completion_of()
+    struct ClusterNode *placed; // cluster: the node it is queued or running on
+    uint64_t hedge_due; // hedge: CLOCK_MONOTONIC ns at which it gets a twin
+    struct JobHedge *hedge_pair; // hedge: the pair it is part of while both run
+    ssize_t row;        // table: its row, -1 for none
+    uint64_t t_queued;  // trace: CLOCK_REALTIME ns it was submitted at, 0 for a twin
+    uint64_t t_spawned; // trace: subprocess() returned
+    uint64_t t_first;   // trace: its first byte of output arrived, 0 if none yet
+    int slot;           // trace: the track it runs on
+    ssize_t view_entry; // view: its entry while it runs, -1 for none
+    struct Job *scope_prev; // scope: the members running
+    struct Job *scope_next;
+    struct Job *lane_prev;  // lanes: the lane's running jobs, newest first
+    struct Job *lane_next;
+    struct Job *tenant_next; // tenants: the next of its tenant's queue
+    uint64_t t_submitted; // tenants: CLOCK_MONOTONIC ns, for its tenant's wait
+    long tenant_kb;     // tenants: the memory estimate charged to its tenant, -1 while not charged
+} Job;
+
+// fail-fast for a set of jobs, on one runner: the first member to fail
+// (spawn failure, signal or non-zero exit; with on_status >= 0, to exit
+// with that status instead) cancels the scope. Its queued members then
+// finish with spawn_rc ECANCELED, the running ones get signo, at their
+// process group (just the child with own_pgroup, whose group is shared),
+// and members submitted later finish the same way on the spot. A Dag with
+// a scope stops starting nodes once it is cancelled
+typedef struct CancelScope {
+    int on_status;      // input: -1 for any failure
+    int signo;          // input: 0 for SIGTERM
+    bool cancelled;
+    struct Job *cause;  // the member that cancelled it, NULL if cancelled by hand or not yet
+    struct Job *running;
+    size_t n_cancelled; // members signalled or never started because of it
+} CancelScope;
+
+typedef enum {
+    LANES_STRICT = 0,   // the most urgent lane with queued work goes first
+    LANES_WEIGHTED,     // lanes with queued work share the starts by weight
+} LanePolicy;
+
+// one priority class of a runner's jobs. Lanes keep no queue of their own:
+// the job to start next is brought to the head of the runner's FIFO, which
+// stays in submit order within each lane
+typedef struct {
+    int reserved;       // input: slots its jobs are guaranteed, left idle for it even when other lanes queue
+    int weight;         // input: LANES_WEIGHTED share of the starts, 0 for 1
+    // input: a more urgent lane's job that finds no slot SIGSTOPs its
+    // newest running job (process group and all) and takes the slot; the
+    // job gets SIGCONT before anything of its lane or less urgent starts.
+    // Its timeout keeps running while stopped, and kill_JobRunner()'s
+    // signals other than SIGKILL wait for the SIGCONT
+    bool preemptible;
+    size_t n_queued;
+    int n_running;      // started from it and not finished, paused ones included
+    int n_paused;
+    size_t n_paused_total; // times one of its jobs was paused
+    uint64_t pass;      // LANES_WEIGHTED: its position in the stride schedule
+    Job *running;
+} JobLane;
+
+// one team sharing a runner. A tenant's jobs wait in its own FIFO, and
+// whenever a slot frees up the runner takes the next job of the backlogged
+// tenant furthest below its weighted share of the slots and, with a
+// mem_budget, of the memory: the one whose larger of the two fractions it
+// holds, over its weight, is smallest (dominant resource fairness), ties
+// going to the one with the fewest starts by weight. Picking is a heap
+// operation, O(log tenants), however deep the queues are. Jobs without a
+// tenant keep the runner's own FIFO and go ahead of every tenant's. The
+// counters are per-tenant metrics; a tenant belongs to one runner
+typedef struct JobTenant {
+    int weight;         // input: share relative to the others, 0 for 1
+    const char *name;   // input: caller's, for reporting
+    Job *q_head;        // queued jobs, oldest first
+    Job *q_tail;
+    size_t n_queued;
+    int n_running;      // taken from its queue and not finished yet
+    long mem_kb;        // mem_budget: the estimates of those
+    uint64_t vtime;     // starts over weight, caught up to the runner's on becoming backlogged
+    size_t heap_pos;    // position in the runner's heap plus one, 0 while not backlogged
+    int mem_passed;     // mem_budget: refills that went past it because its job didn't fit
+    size_t n_started;
+    size_t n_done;
+    size_t n_failed;    // spawn failures and non-zero exits
+    uint64_t wait_ns;   // summed time its started jobs spent queued
+    uint64_t max_wait_ns;
+    uint64_t busy_ns;   // summed runtime of its finished jobs
+} JobTenant;
+
+typedef void (*JobDone)(JobRunner *r, Job *job, void *data);
+
+// keeps at most max_running children alive, starting the next queued job
+// from the completion callback of the one that just finished
+struct JobRunner {
+    EventLoop loop;
+    DeadlineWheel deadlines; // one timerfd for every job's timeout
+    int max_running;
+    int n_running;
+    Job **queue;        // FIFO of jobs not started yet
+    size_t q_head;
+    size_t q_tail;
+    size_t q_cap;
+    size_t n_done;
+    size_t n_failed;    // spawn failures and non-zero exits
+    // every job is in lane job->lane; with every lane at its defaults they
+    // all share one FIFO, as without lanes. Paused jobs count in
+    // n_running but not against max_running
+    LanePolicy lane_policy; // input
+    JobLane lanes[RUNNER_LANES];
+    int n_paused;
+    uint64_t lane_pass; // LANES_WEIGHTED: the pass of the lane that started a job last
+    // backlogged tenants, min-heap by share; see JobTenant
+    JobTenant **tenant_heap;
+    size_t n_tenant_heap;
+    size_t cap_tenant_heap;
+    size_t n_tenant_queued;
+    uint64_t tenant_vtime; // vtime of the tenant that started a job last
+    int tenant_max;     // max_running the heap was ordered for
+    JobDone on_done;
+    void *data;
+    // group lifecycle, set before the first submit; see kill_JobRunner()
+    bool own_pgroup;    // every child joins one process group (it won't get the tty's signals)
+    bool use_cgroup;    // every child starts in the cgroup cgroup_fd
+    int cgroup_fd;      // O_DIRECTORY fd of a cgroup v2 directory, left open
+    pid_t pgroup;       // own_pgroup: the group, 0 until a child leads one
+    size_t n_grouped;   // own_pgroup: unreaped children in it
+    // caller's, NULL to start jobs unconditionally: while it holds spawns back
+    // (or an EAGAIN spawn backs off) the queue waits on a timer in the loop;
+    // shed jobs finish with spawn_rc EBUSY
+    Admission *admission;
+    int admit_tfd;      // that timer, -1 until first needed
+    bool admit_armed;
+    // caller's, NULL to keep max_running: every completion feeds it and
+    // max_running follows the limit it settles on
+    AdaptLimit *adapt;
+    size_t n_waiting;   // work its owner holds back for a slot (a Dag's ready chains), seen as queued
+    // caller's, NULL for none: a job starts only once its fd_cost_ProcInfo()
+    // fits, else waits for running jobs to give theirs back; one that can't
+    // fit even then finishes with spawn_rc EMFILE
+    FdBudget *fd_budget;
+    // caller's, NULL for none: every finished job is posted here after
+    // on_done, for a consumer on another thread; the runner is done with
+    // the job by then
+    CompletionQueue *completions;
+    // caller's, NULL for none: every started job that ran to its exit is
+    // recorded, and submit_JobRunner() finishes a job the journal already
+    // has with exit status 0 on the spot (replayed) instead of running it
+    JobJournal *journal;
+    // caller's, NULL for none: a job starts only once its command's
+    // estimated peak RSS fits next to the running ones'; a queued job up
+    // to MEM_BUDGET_LOOKAHEAD behind may overtake one that doesn't fit, as
+    // often as that many times. With nothing running anything starts
+    MemBudget *mem_budget;
+    Job *mem_blocked;   // the job being overtaken
+    int mem_passed;     // how often so far
+    // caller's, NULL for none: an idempotent job still running once its
+    // command's hedge delay passed gets a twin, when the policy's budget and
+    // a free slot allow. The first of the two to exit 0 wins, the other's
+    // process group is SIGKILLed (just the child with own_pgroup); the job
+    // finishes once both are reaped, with the winner's status and output.
+    // Only jobs whose streams can be run twice are hedged: stdin NONE, PATH
+    // or PIPE, outputs NONE, PIPE or CAPTURE, no extra fds or channel
+    HedgePolicy *hedge;
+    Job **hedge_watch;  // running hedge candidates by hedge_due
+    size_t n_watch;
+    size_t cap_watch;
+    int hedge_tfd;      // fires at the first hedge_due, -1 until first needed
+    // caller's, NULL for none: every submitted job gets a row (job->row,
+    // cold = the Job) that follows it through queued, running and done or
+    // failed; rows stay until the caller removes them
+    JobTable *table;
+    // caller's, NULL for none: each running job holds the lowest free slot,
+    // and each slot is a track showing spawn, exec, first byte, running and
+    // reap of its jobs (gaps are idle slots); the time jobs spent queued is
+    // shown as async spans
+    ChromeTrace *trace;
+    bool *slot_busy;
+    int cap_slots;
+    uint64_t n_traced;
+    // caller's, set before the first submit, NULL for none: every running
+    // child gets an entry and the counters are published whenever a job
+    // starts or finishes, for other threads to read without a lock
+    RunnerView *view;
+};
+
+int init_JobRunner(JobRunner *r, int max_running, EvLoopBackend backend, JobDone on_done, void *data);
+// queue job; it starts right away if a slot is free
+int submit_JobRunner(JobRunner *r, Job *job);
+// run until nothing is queued or running; returns the number of failed jobs
+size_t run_JobRunner(JobRunner *r);
+// signal every running child at once: killpg() with own_pgroup, else
+// cgroup.kill (or each pid of cgroup.procs for other signals and older
+// kernels) with use_cgroup; 1 if neither is set or the signal failed
+int kill_JobRunner(JobRunner *r, int sig);
+// drop the queue (those jobs finish with spawn_rc ECANCELED) and SIGKILL
+// the running children; run_JobRunner() returns once they are reaped
+int cancel_JobRunner(JobRunner *r);
+void init_CancelScope(CancelScope *s, int on_status);
+// cancel s now, as if a member of it had failed on r
+void cancel_CancelScope(JobRunner *r, CancelScope *s);
+void close_JobRunner(JobRunner *r);
+
+#endif // RUNNER_H
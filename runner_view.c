@@ -0,0 +1,228 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+
+#include "runner_view.h"
+#include "subprocess.h"
+
+#define VIEW_SPINS 64       // retries of a torn copy before the reader yields to the writer
+
+_Static_assert(sizeof(JobView) % sizeof(uint64_t) == 0, "JobView is copied a word at a time");
+_Static_assert(sizeof(RunnerStats) % sizeof(uint64_t) == 0, "RunnerStats is copied a word at a time");
+
+// readers copy while the writer stores, so every word is moved atomically:
+// a torn copy is thrown away, but each of its loads is a whole word
+static void store_words(uint64_t *dst, const void *src, size_t size) {
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+        uint64_t w;
+        memcpy(&w, (const char *)src + i * sizeof(uint64_t), sizeof(w));
+        __atomic_store_n(&dst[i], w, __ATOMIC_RELAXED);
+    }
+}
+
+static void load_words(void *dst, const uint64_t *src, size_t size) {
+    for (size_t i = 0; i < size / sizeof(uint64_t); i++) {
+        uint64_t w = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        memcpy((char *)dst + i * sizeof(uint64_t), &w, sizeof(w));
+    }
+}
+
+static void write_begin(uint64_t *seq) {
+    __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // odd before any of the data
+}
+
+static void write_end(uint64_t *seq) {
+    __atomic_store_n(seq, __atomic_load_n(seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+}
+
+// size bytes of src, as of one moment the writer wasn't in the middle of them
+static void read_stable(const uint64_t *seq, void *dst, const uint64_t *src, size_t size) {
+    for (int spins = 0;; spins++) {
+        if (spins >= VIEW_SPINS) {
+            sched_yield(); // the writer may have been preempted mid-update
+        }
+        uint64_t s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (s & 1) {
+            continue;
+        }
+        load_words(dst, src, size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE); // the data before the second look
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == s) {
+            return;
+        }
+    }
+}
+
+int init_RunnerView(RunnerView *v, size_t cap) {
+    memset(v, 0, sizeof(*v));
+    v->entries = calloc(cap > 0 ? cap : 1, sizeof(ViewEntry));
+    if (v->entries == NULL) {
+        showError(false, "Failed to allocate the runner view!");
+        return 1;
+    }
+    v->cap = cap;
+    return 0;
+}
+
+void close_RunnerView(RunnerView *v) {
+    free(v->entries);
+    memset(v, 0, sizeof(*v));
+}
+
+ssize_t add_RunnerView(RunnerView *v, const JobView *j) {
+    size_t i = v->free_hint;
+
+    while (i < v->cap && v->entries[i].v.pid != 0) {
+        i++;
+    }
+    if (i == v->cap) {
+        v->free_hint = v->cap;
+        v->n_unlisted++;
+        return -1;
+    }
+    ViewEntry *e = &v->entries[i];
+    write_begin(&e->seq);
+    store_words(e->w, j, sizeof(JobView));
+    write_end(&e->seq);
+    v->free_hint = i + 1;
+    if (i >= v->n_used) {
+        __atomic_store_n(&v->n_used, i + 1, __ATOMIC_RELEASE);
+    }
+    return i;
+}
+
+void remove_RunnerView(RunnerView *v, ssize_t i) {
+    static const JobView none;
+
+    if (i < 0) {
+        v->n_unlisted--;
+        return;
+    }
+    ViewEntry *e = &v->entries[i];
+    write_begin(&e->seq);
+    store_words(e->w, &none, sizeof(JobView));
+    write_end(&e->seq);
+    if ((size_t)i < v->free_hint) {
+        v->free_hint = i;
+    }
+}
+
+void count_RunnerView(RunnerView *v, ssize_t i, int stream, size_t n) {
+    if (i < 0) {
+        return;
+    }
+    ViewEntry *e = &v->entries[i];
+    uint64_t *bytes = stream == STDERR_FILENO ? &e->v.bytes_err : &e->v.bytes_out;
+    write_begin(&e->seq);
+    __atomic_store_n(bytes, __atomic_load_n(bytes, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+    write_end(&e->seq);
+}
+
+void pause_RunnerView(RunnerView *v, ssize_t i, bool paused) {
+    if (i < 0) {
+        return;
+    }
+    ViewEntry *e = &v->entries[i];
+    JobView j = e->v; // the writer's own, nothing races it here
+    j.paused = paused;
+    write_begin(&e->seq);
+    store_words(e->w, &j, sizeof(JobView));
+    write_end(&e->seq);
+}
+
+void publish_RunnerView(RunnerView *v, const RunnerStats *s) {
+    struct timespec ts;
+    RunnerStats st = *s;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    st.published_ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    st.n_unlisted = v->n_unlisted;
+    write_begin(&v->seq);
+    store_words(v->stats_w, &st, sizeof(RunnerStats));
+    write_end(&v->seq);
+}
+
+void stats_RunnerView(const RunnerView *v, RunnerStats *s) {
+    read_stable(&v->seq, s, v->stats_w, sizeof(RunnerStats));
+}
+
+size_t snapshot_RunnerView(const RunnerView *v, RunnerStats *s, JobView *jobs, size_t max) {
+    size_t n_used = __atomic_load_n(&v->n_used, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+
+    stats_RunnerView(v, s);
+    for (size_t i = 0; i < n_used && n < max; i++) {
+        const ViewEntry *e = &v->entries[i];
+        read_stable(&e->seq, &jobs[n], e->w, sizeof(JobView));
+        n += jobs[n].pid != 0;
+    }
+    return n;
+}
+
+static void put(char *buf, size_t len, size_t *off, const char *fmt, ...) {
+    va_list args;
+    size_t at = *off < len ? *off : len;
+
+    va_start(args, fmt);
+    int n = vsnprintf(buf + at, len - at, fmt, args);
+    va_end(args);
+    *off += n > 0 ? n : 0;
+}
+
+// name as a JSON string
+static void put_name(char *buf, size_t len, size_t *off, const char *name) {
+    put(buf, len, off, "\"");
+    for (size_t i = 0; i < VIEW_NAME_LEN && name[i] != '\0'; i++) {
+        unsigned char c = name[i];
+        if (c == '"' || c == '\\') {
+            put(buf, len, off, "\\%c", c);
+        } else if (c < 0x20) {
+            put(buf, len, off, "\\u%04x", c);
+        } else {
+            put(buf, len, off, "%c", c);
+        }
+    }
+    put(buf, len, off, "\"");
+}
+
+size_t format_view_json(const RunnerStats *s, const JobView *jobs, size_t n, uint64_t now_ns,
+        char *buf, size_t len) {
+    size_t off = 0;
+
+    if (len > 0) {
+        buf[0] = '\0';
+    }
+    put(buf, len, &off, "{\"max_running\":%d,\"running\":%d,\"paused\":%d,\"queued\":%llu,\"lanes\":[",
+        s->max_running, s->n_running, s->n_paused, (unsigned long long)s->n_queued);
+    for (int l = 0; l < VIEW_LANES; l++) {
+        put(buf, len, &off, "%s%llu", l > 0 ? "," : "", (unsigned long long)s->lane_queued[l]);
+    }
+    put(buf, len, &off, "],\"tenant_queued\":%llu,\"waiting\":%llu,\"done\":%llu,\"failed\":%llu,"
+        "\"loop_fds\":%d,\"pipe_queued\":[%llu,%llu,%llu],\"unlisted\":%llu,\"age_ms\":%llu,\"jobs\":[",
+        (unsigned long long)s->n_tenant_queued, (unsigned long long)s->n_waiting,
+        (unsigned long long)s->n_done, (unsigned long long)s->n_failed, s->loop_fds,
+        (unsigned long long)s->pipe_queued[0], (unsigned long long)s->pipe_queued[1],
+        (unsigned long long)s->pipe_queued[2], (unsigned long long)s->n_unlisted,
+        (unsigned long long)(now_ns > s->published_ns ? (now_ns - s->published_ns) / 1000000 : 0));
+    for (size_t i = 0; i < n; i++) {
+        const JobView *j = &jobs[i];
+        put(buf, len, &off, "%s{\"pid\":%d,\"name\":", i > 0 ? "," : "", (int)j->pid);
+        put_name(buf, len, &off, j->name);
+        put(buf, len, &off, ",\"lane\":%d,\"paused\":%s,\"twin\":%s,\"running_ms\":%llu,\"out\":%llu,\"err\":%llu",
+            j->lane, j->paused ? "true" : "false", j->twin ? "true" : "false",
+            (unsigned long long)(now_ns > j->started_ns ? (now_ns - j->started_ns) / 1000000 : 0),
+            (unsigned long long)j->bytes_out, (unsigned long long)j->bytes_err);
+        if (j->deadline_ns != 0) { // negative once it passed
+            put(buf, len, &off, ",\"deadline_ms\":%lld", (long long)(int64_t)(j->deadline_ns - now_ns) / 1000000);
+        }
+        put(buf, len, &off, "}");
+    }
+    put(buf, len, &off, "]}\n");
+    return off;
+}
@@ -0,0 +1,96 @@
+#ifndef RUNNER_VIEW_H
+#define RUNNER_VIEW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define VIEW_NAME_LEN 32    // of a job's argv[0], truncated
+#define VIEW_LANES 4        // RUNNER_LANES
+
+// a running child, as readers see it
+typedef struct {
+    pid_t pid;
+    int lane;
+    bool paused;
+    bool twin;              // a hedged job's twin
+    uint64_t started_ns;    // CLOCK_MONOTONIC, once subprocess() returned
+    uint64_t deadline_ns;   // CLOCK_MONOTONIC, 0 for none
+    uint64_t bytes_out;     // read from its stdout so far, captured or not
+    uint64_t bytes_err;
+    char name[VIEW_NAME_LEN];
+} JobView;
+
+// the runner's counters and its event loop, as of its last update
+typedef struct {
+    uint64_t published_ns;  // CLOCK_MONOTONIC of that update
+    int max_running;
+    int n_running;          // paused ones included
+    int n_paused;
+    int loop_fds;           // registered on its event loop
+    uint64_t n_queued;      // in the FIFO and the tenants' queues
+    uint64_t lane_queued[VIEW_LANES];
+    uint64_t n_tenant_queued;
+    uint64_t n_waiting;     // held back by its owner (a Dag's ready chains)
+    uint64_t n_done;
+    uint64_t n_failed;
+    uint64_t pipe_queued[3]; // the loop's last backpressure sample, by stream
+    uint64_t n_unlisted;    // running without an entry, all cap of them taken
+} RunnerStats;
+
+typedef struct {
+    uint64_t seq;           // odd while the writer updates v
+    union {
+        JobView v;
+        uint64_t w[sizeof(JobView) / sizeof(uint64_t)]; // as copied
+    };
+} ViewEntry;
+
+// a live view of a JobRunner for other threads: a status query must not
+// take a lock the runner's thread would then wait on. The runner is the one
+// writer; the stats and each entry sit behind a sequence counter of their
+// own, which it makes odd, updates and makes even again, never waiting on
+// anyone. A reader copies and retries while the counter was odd or moved
+// under it, so what it gets is whole, though the stats and the entries may
+// be a few events apart. Every entry is allocated once for cap children;
+// one job per running child (a twin has its own), those past cap are only
+// counted
+typedef struct RunnerView {
+    uint64_t seq;
+    union {
+        RunnerStats stats;
+        uint64_t stats_w[sizeof(RunnerStats) / sizeof(uint64_t)];
+    };
+    ViewEntry *entries;
+    size_t cap;
+    size_t n_used;          // entries below this may be live
+    // the writer's
+    size_t free_hint;       // lowest entry that may be free
+    uint64_t n_unlisted;
+} RunnerView;
+
+int init_RunnerView(RunnerView *v, size_t cap);
+void close_RunnerView(RunnerView *v);
+
+// writer side, the runner's thread only
+// an entry for j (its pid > 0), or -1 with all of them taken
+ssize_t add_RunnerView(RunnerView *v, const JobView *j);
+// free entry i, -1 for a child that got none
+void remove_RunnerView(RunnerView *v, ssize_t i);
+// entry i's child wrote n more bytes to stream (STDOUT_FILENO, STDERR_FILENO)
+void count_RunnerView(RunnerView *v, ssize_t i, int stream, size_t n);
+void pause_RunnerView(RunnerView *v, ssize_t i, bool paused);
+// replace the stats; n_unlisted is the view's own
+void publish_RunnerView(RunnerView *v, const RunnerStats *s);
+
+// reader side, any thread, any number of them
+void stats_RunnerView(const RunnerView *v, RunnerStats *s);
+// the stats and up to max live entries into jobs; returns how many
+size_t snapshot_RunnerView(const RunnerView *v, RunnerStats *s, JobView *jobs, size_t max);
+// one line of JSON of a snapshot, ages taken against now_ns (CLOCK_MONOTONIC);
+// returns the length snprintf-style, so a short buf can be retried
+size_t format_view_json(const RunnerStats *s, const JobView *jobs, size_t n, uint64_t now_ns,
+    char *buf, size_t len);
+
+#endif // RUNNER_VIEW_H
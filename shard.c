@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+
+#include "shard.h"
+
+static void run_msg(CompletionNode *node, void *data) {
+    ReactorShard *sh = data;
+    ShardMsg *msg = completion_of(node, ShardMsg, node);
+
+    sh->n_msgs++;
+    msg->fn(sh, msg->arg);
+}
+
+static void *shard_main(void *arg) {
+    ReactorShard *sh = arg;
+
+    while (!sh->stopping) {
+        int n = run_EventLoop(&sh->loop, -1);
+        if (n < 0 && errno != EINTR) {
+            showError(false, "Shard %d stopped: %s!", sh->id, strerror(errno));
+            break;
+        }
+        sh->n_events += n > 0 ? n : 0;
+    }
+    return NULL;
+}
+
+static void stop_shard(ReactorShard *sh, void *arg) {
+    sh->stopping = true;
+}
+
+static void close_shard(ReactorShard *sh) {
+    close_DeadlineWheel(&sh->wheel);
+    close_CompletionQueue(&sh->inbox);
+    close_EventLoop(&sh->loop);
+}
+
+static int start_shard(ShardSet *s, int i, bool pin, EvLoopBackend backend) {
+    ReactorShard *sh = &s->shards[i];
+
+    sh->set = s;
+    sh->id = i;
+    sh->cpu = -1;
+    if (init_EventLoop(&sh->loop, backend)) {
+        return 1;
+    }
+    if (init_CompletionQueue(&sh->inbox)) {
+        close_EventLoop(&sh->loop);
+        return 1;
+    }
+    if (init_DeadlineWheel(&sh->wheel, &sh->loop, 0) ||
+            watch_CompletionQueue(&sh->inbox, &sh->loop, run_msg, sh)) {
+        close_shard(sh);
+        return 1;
+    }
+    if (pthread_create(&sh->tid, NULL, shard_main, sh)) {
+        showError(false, "Failed to start shard %d!", i);
+        close_shard(sh);
+        return 1;
+    }
+    sh->started = true;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if (pin && ncpu > 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(i % ncpu, &set);
+        if (pthread_setaffinity_np(sh->tid, sizeof(set), &set) == 0) {
+            sh->cpu = i % ncpu;
+        }
+    }
+    return 0;
+}
+
+int init_ShardSet(ShardSet *s, int n, bool pin, EvLoopBackend backend, ShardPolicy policy) {
+    memset(s, 0, sizeof(*s));
+    if (n <= 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n <= 0) {
+        n = 1;
+    }
+    s->policy = policy;
+    if ((s->shards = calloc(n, sizeof(ReactorShard))) == NULL) {
+        showError(false, "Failed to allocate %d reactor shards!", n);
+        return 1;
+    }
+    for (; s->n < n; s->n++) {
+        if (start_shard(s, s->n, pin, backend)) {
+            break;
+        }
+    }
+    if (s->n == 0) {
+        free(s->shards);
+        s->shards = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+void close_ShardSet(ShardSet *s) {
+    for (int i = 0; i < s->n; i++) {
+        post_ShardSet(s, i, &s->shards[i].stop_msg, stop_shard, NULL);
+    }
+    for (int i = 0; i < s->n; i++) {
+        ReactorShard *sh = &s->shards[i];
+        if (sh->started) {
+            pthread_join(sh->tid, NULL);
+            close_shard(sh);
+        }
+    }
+    free(s->shards);
+    s->shards = NULL;
+    s->n = 0;
+}
+
+void post_ShardSet(ShardSet *s, int i, ShardMsg *msg, ShardFn fn, void *arg) {
+    msg->fn = fn;
+    msg->arg = arg;
+    post_CompletionQueue(&s->shards[i].inbox, &msg->node);
+}
+
+int pick_ShardSet(ShardSet *s, uint64_t key) {
+    if (s->policy == SHARD_HASH) {
+        return (key * 0x9e3779b97f4a7c15ull >> 32) % s->n;
+    }
+    int best = 0;
+    size_t best_load = SIZE_MAX;
+    for (int i = 0; i < s->n; i++) {
+        size_t load = __atomic_load_n(&s->shards[i].load, __ATOMIC_RELAXED);
+        if (load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+static void attach_proc(ReactorShard *sh, void *arg) {
+    ShardProc *sp = arg;
+
+    sp->shard = sh;
+    sp->rc = watch_ProcInfo(&sh->loop, sp->ci, sp->cb, sp->data);
+    if (sp->rc != 0) {
+        showError(false, "Failed to watch subprocess %d on shard %d!", sp->ci->pid, sh->id);
+    }
+}
+
+int attach_ShardSet(ShardSet *s, ShardProc *sp, ProcInfo *ci, uint64_t key, EvCallback cb, void *data) {
+    int i = pick_ShardSet(s, key);
+
+    sp->ci = ci;
+    sp->cb = cb;
+    sp->data = data;
+    sp->shard = NULL;
+    sp->rc = 0;
+    // counted right away, so a burst of picks spreads before the shards catch up
+    __atomic_fetch_add(&s->shards[i].load, 1, __ATOMIC_RELAXED);
+    post_ShardSet(s, i, &sp->msg, attach_proc, sp);
+    return i;
+}
+
+void detach_Shard(ReactorShard *sh) {
+    __atomic_fetch_sub(&sh->load, 1, __ATOMIC_RELAXED);
+}
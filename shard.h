@@ -0,0 +1,85 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "completion.h"
+#include "deadline.h"
+
+typedef struct ReactorShard ReactorShard;
+typedef struct ShardSet ShardSet;
+
+// runs on the shard's thread
+typedef void (*ShardFn)(ReactorShard *sh, void *arg);
+
+// a unit of cross-shard work, posted to the target's inbox
+typedef struct {
+    CompletionNode node;
+    ShardFn fn;
+    void *arg;
+} ShardMsg;
+
+// one event loop thread with its own timers and inbox; the pidfds watched
+// in its loop are its reaper. Everything in it belongs to its thread: other
+// threads only reach it through post_ShardSet()
+struct ReactorShard {
+    ShardSet *set;
+    int id;
+    int cpu;                // pinned to, -1 if not pinned
+    pthread_t tid;
+    EventLoop loop;
+    DeadlineWheel wheel;
+    CompletionQueue inbox;  // eventfd-signalled, drained by the loop
+    size_t load;            // attached children, atomic: read by pickers elsewhere
+    size_t n_msgs;          // inbox messages run
+    size_t n_events;        // loop callbacks dispatched
+    bool stopping;
+    ShardMsg stop_msg;
+    bool started;
+};
+
+typedef enum {
+    SHARD_LEAST_LOADED = 0, // fewest attached children
+    SHARD_HASH,             // the key's shard, so related children share a loop
+} ShardPolicy;
+
+// N reactors instead of one: each child is attached to one shard, whose
+// thread then does all of its I/O, timers and reaping, so the shards share
+// no state and scale with the cores they are pinned to
+struct ShardSet {
+    ReactorShard *shards;
+    int n;
+    ShardPolicy policy;
+};
+
+// a child handed to a shard by attach_ShardSet()
+typedef struct {
+    ShardMsg msg;
+    ProcInfo *ci;
+    EvCallback cb;
+    void *data;
+    ReactorShard *shard;    // set once attached
+    int rc;                 // watch_ProcInfo() rc on the shard
+} ShardProc;
+
+// n <= 0 uses one shard per online CPU; pin puts shard i on CPU i mod cpus
+int init_ShardSet(ShardSet *s, int n, bool pin, EvLoopBackend backend, ShardPolicy policy);
+// stop every shard after what it was posted so far, join and free them
+void close_ShardSet(ShardSet *s);
+// run fn(shard i, arg) on that shard's thread; msg must stay put until then
+void post_ShardSet(ShardSet *s, int i, ShardMsg *msg, ShardFn fn, void *arg);
+// the shard new work should go to; key only matters for SHARD_HASH
+int pick_ShardSet(ShardSet *s, uint64_t key);
+// pick a shard for ci and watch_ProcInfo() it there with cb/data, from the
+// shard's thread; cb then runs on it (sp->shard says which, for its wheel).
+// Returns the shard index; sp and ci must stay put until detached
+int attach_ShardSet(ShardSet *s, ShardProc *sp, ProcInfo *ci, uint64_t key, EvCallback cb, void *data);
+// on the shard thread, once the child is unwatched: its load is gone
+void detach_Shard(ReactorShard *sh);
+
+#endif // SHARD_H
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "shm_channel.h"
+
+// record length that sends the reader back to the start of the ring
+#define SHM_WRAP UINT32_MAX
+#define REC_HDR sizeof(uint32_t)
+
+static inline uint32_t rec_size(size_t len) {
+    return (REC_HDR + len + 7) & ~(uint32_t)7;
+}
+
+int create_ShmChannel(size_t size, int *memfd, int *bell) {
+    ShmRingHeader hdr = {.magic = SHM_CHANNEL_MAGIC};
+    size_t sz = SHM_CHANNEL_MIN;
+    int err;
+
+    while (sz < size && sz <= UINT32_MAX / 2) {
+        sz *= 2;
+    }
+    hdr.size = sz;
+    *memfd = memfd_create("shm-channel", MFD_CLOEXEC);
+    if (*memfd < 0) {
+        return errno;
+    }
+    if (ftruncate(*memfd, sizeof(hdr) + sz) < 0 || pwrite(*memfd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        goto fail;
+    }
+    *bell = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (*bell < 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    err = errno;
+    close(*memfd);
+    *memfd = *bell = -1;
+    return err;
+}
+
+int open_ShmChannel(ShmChannel *c, int memfd, int bell) {
+    ShmRingHeader hdr;
+
+    memset(c, 0, sizeof(*c));
+    c->bell = bell;
+    if (pread(memfd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+        return errno ? errno : EINVAL;
+    }
+    if (hdr.magic != SHM_CHANNEL_MAGIC || hdr.size < SHM_CHANNEL_MIN || (hdr.size & (hdr.size - 1))) {
+        return EINVAL;
+    }
+    c->map_len = sizeof(hdr) + hdr.size;
+    void *p = mmap(NULL, c->map_len, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (p == MAP_FAILED) {
+        c->map_len = 0;
+        return errno;
+    }
+    c->hdr = p;
+    c->size = hdr.size;
+    c->data = (char *)p + sizeof(ShmRingHeader);
+    return 0;
+}
+
+void close_ShmChannel(ShmChannel *c) {
+    if (c->hdr != NULL) {
+        munmap(c->hdr, c->map_len);
+    }
+    c->hdr = NULL;
+    c->data = NULL;
+}
+
+static long futex(uint32_t *word, int op, uint32_t val) {
+    return syscall(SYS_futex, word, op, val, NULL, NULL, 0);
+}
+
+int send_ShmChannel(ShmChannel *c, const void *rec, size_t len, bool wait) {
+    ShmRingHeader *h = c->hdr;
+    uint32_t need = rec_size(len);
+
+    if (len > c->size / 2 || need > c->size / 2) {
+        return EMSGSIZE;
+    }
+    uint64_t head = h->head; // only the writer moves head
+    uint32_t pos = head & (c->size - 1);
+    uint32_t to_end = c->size - pos;
+    uint64_t total = need <= to_end ? need : to_end + need; // a wrap skips to_end bytes
+    for (;;) {
+        uint64_t tail = __atomic_load_n(&h->tail, __ATOMIC_SEQ_CST);
+        if (c->size - (head - tail) >= total) {
+            break;
+        }
+        if (!wait) {
+            return EAGAIN;
+        }
+        uint32_t gen = __atomic_load_n(&h->space, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&h->writer_waiting, 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&h->tail, __ATOMIC_SEQ_CST);
+        if (c->size - (head - tail) < total) {
+            futex(&h->space, FUTEX_WAIT, gen);
+        }
+        __atomic_store_n(&h->writer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+    if (need > to_end) {
+        *(uint32_t *)(c->data + pos) = SHM_WRAP;
+        pos = 0;
+    }
+    *(uint32_t *)(c->data + pos) = len;
+    memcpy(c->data + pos + REC_HDR, rec, len);
+    __atomic_store_n(&h->head, head + total, __ATOMIC_SEQ_CST);
+    // ring only when the reader may have found the ring empty and gone to sleep
+    if (__atomic_load_n(&h->tail, __ATOMIC_SEQ_CST) == head) {
+        uint64_t one = 1;
+        while (write(c->bell, &one, sizeof(one)) < 0 && errno == EINTR);
+    }
+    return 0;
+}
+
+void ack_ShmChannel(ShmChannel *c) {
+    uint64_t n;
+    while (read(c->bell, &n, sizeof(n)) < 0 && errno == EINTR);
+}
+
+const void *peek_ShmChannel(ShmChannel *c, size_t *len) {
+    ShmRingHeader *h = c->hdr;
+    uint64_t tail = h->tail; // only the reader moves tail
+    uint64_t head = __atomic_load_n(&h->head, __ATOMIC_SEQ_CST);
+
+    c->peeked = 0;
+    if (head == tail) {
+        return NULL;
+    }
+    uint32_t pos = tail & (c->size - 1);
+    uint32_t n = *(uint32_t *)(c->data + pos);
+    if (n == SHM_WRAP) {
+        c->peeked = c->size - pos;
+        pos = 0;
+        n = *(uint32_t *)c->data;
+    }
+    if (n > c->size / 2 || pos + rec_size(n) > c->size) {
+        c->peeked = 0;
+        return NULL; // not a record the writer could have made
+    }
+    c->peeked += rec_size(n);
+    *len = n;
+    return c->data + pos + REC_HDR;
+}
+
+void consume_ShmChannel(ShmChannel *c) {
+    ShmRingHeader *h = c->hdr;
+
+    if (c->peeked == 0) {
+        return;
+    }
+    __atomic_store_n(&h->tail, h->tail + c->peeked, __ATOMIC_SEQ_CST);
+    c->peeked = 0;
+    if (__atomic_load_n(&h->writer_waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_add_fetch(&h->space, 1, __ATOMIC_SEQ_CST);
+        futex(&h->space, FUTEX_WAKE, INT_MAX);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SHM_CHANNEL_H
+#define SHM_CHANNEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A record ring in a memfd shared by a parent and one cooperating child.
+// ProcInfo.chan_size > 0 makes subprocess() create one and hand it to the
+// child as SHM_CHANNEL_FD, with an eventfd doorbell as SHM_BELL_FD. The child
+// (the only writer) rings the bell when the ring goes non-empty, so the
+// parent can watch p_bell in its event loop; a writer facing a full ring
+// sleeps on a futex in the shared header until the parent consumes.
+
+#define SHM_CHANNEL_FD 3        // ring memfd in the child
+#define SHM_BELL_FD 4           // eventfd doorbell in the child
+#define SHM_CHANNEL_MAGIC 0x314d4853u // "SHM1"
+#define SHM_CHANNEL_MIN 4096    // smallest ring, in data bytes
+
+// start of the memfd; head and tail count bytes ever written/consumed
+typedef struct {
+    uint32_t magic;
+    uint32_t size;              // data bytes after the header, a power of two
+    char pad0[56];
+    uint64_t head;              // child: end of the last published record
+    char pad1[56];
+    uint64_t tail;              // parent: end of the last consumed record
+    uint32_t space;             // futex word, bumped when the parent frees space
+    uint32_t writer_waiting;    // the child sleeps on space
+    char pad2[48];
+} ShmRingHeader;
+
+typedef struct {
+    ShmRingHeader *hdr;
+    char *data;
+    size_t map_len;
+    uint32_t size;              // hdr->size at open, never re-read from the shared page
+    int bell;                   // eventfd, not owned
+    uint32_t peeked;            // bytes the last peek_ShmChannel() record occupies
+} ShmChannel;
+
+// memfd with an initialized header for a ring of at least size bytes, and
+// its doorbell eventfd; both O_CLOEXEC. Returns 0 or an errno value
+int create_ShmChannel(size_t size, int *memfd, int *bell);
+// map a ring made by create_ShmChannel(); the fds stay the caller's
+// (in the child: open_ShmChannel(&c, SHM_CHANNEL_FD, SHM_BELL_FD))
+int open_ShmChannel(ShmChannel *c, int memfd, int bell);
+void close_ShmChannel(ShmChannel *c);
+
+// writer: append one record; a full ring blocks when wait, else fails with
+// EAGAIN. Records over half the ring fail with EMSGSIZE. Returns 0 or errno
+int send_ShmChannel(ShmChannel *c, const void *rec, size_t len, bool wait);
+
+// reader: clear the doorbell, then peek/consume until peek returns NULL
+void ack_ShmChannel(ShmChannel *c);
+// oldest unconsumed record, valid until consume_ShmChannel(); NULL if empty
+const void *peek_ShmChannel(ShmChannel *c, size_t *len);
+void consume_ShmChannel(ShmChannel *c);
+
+#endif // SHM_CHANNEL_H
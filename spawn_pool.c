@@ -0,0 +1,285 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "spawn_pool.h"
+#include "cpu_topology.h"
+
+typedef struct {
+    SpawnPool *pool;
+    int id;
+} WorkerArg;
+
+static int push(SpawnWorker *w, SpawnTask *t) {
+    pthread_mutex_lock(&w->lock);
+    if (w->tail - w->head == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 256;
+        SpawnTask **tasks = malloc(cap * sizeof(SpawnTask *));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&w->lock);
+            return -1;
+        }
+        for (size_t i = w->head; i < w->tail; i++) {
+            tasks[i - w->head] = w->tasks[i & (w->cap - 1)];
+        }
+        free(w->tasks);
+        w->tail -= w->head;
+        w->head = 0;
+        w->tasks = tasks;
+        w->cap = cap;
+    }
+    w->tasks[w->tail++ & (w->cap - 1)] = t;
+    w->stats.depth = w->tail - w->head;
+    pthread_mutex_unlock(&w->lock);
+    return 0;
+}
+
+// owner end: newest first, its fds and argv are most likely still in cache
+static SpawnTask *pop(SpawnWorker *w) {
+    SpawnTask *t = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->tail > w->head) {
+        t = w->tasks[--w->tail & (w->cap - 1)];
+        w->stats.depth = w->tail - w->head;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+// thief end: oldest first
+static SpawnTask *steal(SpawnWorker *w) {
+    SpawnTask *t = NULL;
+    if (pthread_mutex_trylock(&w->lock)) {
+        return NULL; // busy: try the next victim instead of waiting
+    }
+    if (w->tail > w->head) {
+        t = w->tasks[w->head++ & (w->cap - 1)];
+        w->stats.depth = w->tail - w->head;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+static void run_task(SpawnPool *p, int id, SpawnTask *t) {
+    SpawnWorker *w = &p->workers[id];
+    t->worker = id;
+    t->rc = subprocess(t->ci, t->args, t->env);
+    __atomic_fetch_add(t->rc ? &w->stats.failed : &w->stats.spawned, 1, __ATOMIC_RELAXED);
+    if (t->done != NULL) {
+        t->done(t, t->data);
+    }
+}
+
+static void *worker_main(void *arg) {
+    WorkerArg *wa = arg;
+    SpawnPool *p = wa->pool;
+    int id = wa->id;
+    SpawnWorker *w = &p->workers[id];
+    free(wa);
+
+    for (;;) {
+        SpawnTask *t = pop(w);
+        if (t == NULL) {
+            // own deque is dry: walk the others starting next door
+            for (int k = 1; k < p->n_workers && t == NULL; k++) {
+                t = steal(&p->workers[(id + k) % p->n_workers]);
+            }
+            if (t != NULL) {
+                __atomic_fetch_add(&w->stats.steals, 1, __ATOMIC_RELAXED);
+                if (p->stats_hook != NULL) {
+                    p->stats_hook(id, &w->stats, p->stats_data);
+                }
+            }
+        }
+        if (t != NULL) {
+            __atomic_fetch_sub(&p->pending, 1, __ATOMIC_RELEASE);
+            run_task(p, id, t);
+            continue;
+        }
+        if (p->stats_hook != NULL) {
+            p->stats_hook(id, &w->stats, p->stats_data);
+        }
+        pthread_mutex_lock(&p->idle_lock);
+        while (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0 && !p->stopping) {
+            pthread_cond_wait(&p->idle_cond, &p->idle_lock);
+        }
+        bool stop = p->stopping && __atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) == 0;
+        pthread_mutex_unlock(&p->idle_lock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void pin_to_node(SpawnWorker *w, int index) {
+    char path[128];
+    cpu_set_t set;
+    int n_nodes = 0;
+
+    while (n_nodes < 1024) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n_nodes);
+        if (access(path, R_OK)) {
+            break;
+        }
+        n_nodes++;
+    }
+    if (n_nodes == 0) {
+        return;
+    }
+    int node = index % n_nodes;
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (read_cpulist(path, &set) > 0 && pthread_setaffinity_np(w->tid, sizeof(set), &set) == 0) {
+        w->node = node;
+    }
+}
+
+int init_SpawnPool(SpawnPool *p, int n_threads, bool numa_pin, SpawnStatsHook hook, void *data) {
+    memset(p, 0, sizeof(*p));
+    if (n_threads <= 0) {
+        n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n_threads <= 0) {
+        n_threads = 1;
+    }
+    p->workers = calloc(n_threads, sizeof(SpawnWorker));
+    if (p->workers == NULL) {
+        showError(false, "Failed to allocate %d spawn workers!", n_threads);
+        return 1;
+    }
+    p->stats_hook = hook;
+    p->stats_data = data;
+    pthread_mutex_init(&p->idle_lock, NULL);
+    pthread_cond_init(&p->idle_cond, NULL);
+    for (int i = 0; i < n_threads; i++) {
+        pthread_mutex_init(&p->workers[i].lock, NULL);
+        p->workers[i].node = -1;
+    }
+    for (int i = 0; i < n_threads; i++) {
+        WorkerArg *wa = malloc(sizeof(WorkerArg));
+        if (wa == NULL) {
+            break;
+        }
+        *wa = (WorkerArg){.pool = p, .id = i};
+        if (pthread_create(&p->workers[i].tid, NULL, worker_main, wa)) {
+            free(wa);
+            break;
+        }
+        p->n_workers++;
+        if (numa_pin) {
+            pin_to_node(&p->workers[i], i);
+        }
+    }
+    if (p->n_workers == 0) {
+        showError(false, "Failed to start any spawn worker!");
+        free(p->workers);
+        p->workers = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int submit_SpawnPool(SpawnPool *p, SpawnTask *task, int worker) {
+    if (worker < 0 || worker >= p->n_workers) {
+        worker = __atomic_fetch_add(&p->next, 1, __ATOMIC_RELAXED) % p->n_workers;
+    }
+    __atomic_fetch_add(&p->pending, 1, __ATOMIC_RELEASE);
+    if (push(&p->workers[worker], task)) {
+        __atomic_fetch_sub(&p->pending, 1, __ATOMIC_RELEASE);
+        showError(false, "Failed to queue spawn of %s!", task->args[0]);
+        return 1;
+    }
+    pthread_mutex_lock(&p->idle_lock);
+    pthread_cond_signal(&p->idle_cond);
+    pthread_mutex_unlock(&p->idle_lock);
+    return 0;
+}
+
+void stats_SpawnPool(SpawnPool *p, int worker, SpawnWorkerStats *out) {
+    SpawnWorker *w = &p->workers[worker];
+    pthread_mutex_lock(&w->lock);
+    *out = w->stats;
+    pthread_mutex_unlock(&w->lock);
+}
+
+void close_SpawnPool(SpawnPool *p) {
+    pthread_mutex_lock(&p->idle_lock);
+    p->stopping = true;
+    pthread_cond_broadcast(&p->idle_cond);
+    pthread_mutex_unlock(&p->idle_lock);
+    for (int i = 0; i < p->n_workers; i++) {
+        pthread_join(p->workers[i].tid, NULL);
+    }
+    for (int i = 0; i < p->n_workers; i++) {
+        pthread_mutex_destroy(&p->workers[i].lock);
+        free(p->workers[i].tasks);
+    }
+    pthread_mutex_destroy(&p->idle_lock);
+    pthread_cond_destroy(&p->idle_cond);
+    free(p->workers);
+    p->workers = NULL;
+    p->n_workers = 0;
+}
+
+static SpawnPool shared_pool;
+static int shared_rc;
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+
+static void start_shared_pool(void) {
+    shared_rc = init_SpawnPool(&shared_pool, 1, false, NULL, NULL);
+}
+
+static long futex(uint32_t *word, int op, uint32_t val) {
+    return syscall(SYS_futex, word, op, val, NULL, NULL, 0);
+}
+
+// on the pool thread
+static void async_done(SpawnTask *task, void *data) {
+    AsyncSpawn *as = data;
+
+    if (as->q != NULL) {
+        post_CompletionQueue(as->q, &as->node); // the caller's from here on
+        return;
+    }
+    __atomic_store_n(&as->done, 1, __ATOMIC_RELEASE);
+    futex(&as->done, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+int subprocess_async(SpawnPool *p, AsyncSpawn *as, ProcInfo *ci, char* args[], char* env[],
+        CompletionQueue *q) {
+    if (p == NULL) {
+        pthread_once(&shared_once, start_shared_pool);
+        if (shared_rc != 0) {
+            return 1;
+        }
+        p = &shared_pool;
+    }
+    memset(as, 0, sizeof(*as));
+    as->task = (SpawnTask){.ci = ci, .args = args, .env = env, .rc = -1, .worker = -1,
+        .done = async_done, .data = as};
+    as->q = q;
+    return submit_SpawnPool(p, &as->task, -1);
+}
+
+bool poll_AsyncSpawn(AsyncSpawn *as, int *rc) {
+    if (__atomic_load_n(&as->done, __ATOMIC_ACQUIRE) == 0) {
+        return false;
+    }
+    if (rc != NULL) {
+        *rc = as->task.rc;
+    }
+    return true;
+}
+
+int wait_AsyncSpawn(AsyncSpawn *as) {
+    while (__atomic_load_n(&as->done, __ATOMIC_ACQUIRE) == 0) {
+        futex(&as->done, FUTEX_WAIT_PRIVATE, 0);
+    }
+    return as->task.rc;
+}
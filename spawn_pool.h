@@ -0,0 +1,97 @@
+#ifndef SPAWN_POOL_H
+#define SPAWN_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "subprocess.h"
+#include "completion.h"
+
+typedef struct SpawnTask SpawnTask;
+
+// runs on the worker thread right after subprocess() returned
+typedef void (*SpawnTaskDone)(SpawnTask *task, void *data);
+
+struct SpawnTask {
+    ProcInfo *ci;
+    char** args;
+    char** env;
+    int rc;                 // subprocess() rc
+    int worker;             // worker that spawned it
+    SpawnTaskDone done;
+    void *data;
+};
+
+typedef struct {
+    size_t spawned;
+    size_t failed;
+    size_t steals;          // tasks taken from other workers
+    size_t depth;           // tasks queued on this worker right now
+} SpawnWorkerStats;
+
+typedef void (*SpawnStatsHook)(int worker, const SpawnWorkerStats *stats, void *data);
+
+typedef struct {
+    pthread_mutex_t lock;   // taken by the owner and by thieves
+    SpawnTask **tasks;      // ring; the owner pops the newest, thieves the oldest
+    size_t head;            // oldest
+    size_t tail;            // one past the newest
+    size_t cap;             // power of two
+    SpawnWorkerStats stats;
+    pthread_t tid;
+    int node;               // NUMA node the thread is pinned to, -1 if not pinned
+} SpawnWorker;
+
+// threads spawning with subprocess() in parallel (safe thanks to O_CLOEXEC pipes)
+// each keeps its own deque, idle threads steal from the others
+typedef struct {
+    SpawnWorker *workers;
+    int n_workers;
+    size_t next;            // round-robin submit cursor
+    size_t pending;         // queued on some deque, not yet taken
+    bool stopping;
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    SpawnStatsHook stats_hook;  // called after each steal and when a worker runs dry
+    void *stats_data;
+} SpawnPool;
+
+// n_threads <= 0 uses one per online CPU; numa_pin spreads threads over the
+// NUMA nodes in /sys and pins each to its node's CPUs
+int init_SpawnPool(SpawnPool *p, int n_threads, bool numa_pin, SpawnStatsHook hook, void *data);
+// queue task on worker (-1: round robin); the caller keeps task alive until done
+int submit_SpawnPool(SpawnPool *p, SpawnTask *task, int worker);
+// snapshot of one worker's counters
+void stats_SpawnPool(SpawnPool *p, int worker, SpawnWorkerStats *out);
+// finish every queued task, then stop the threads
+void close_SpawnPool(SpawnPool *p);
+
+// A spawn whose fork and exec happen on a pool thread (through the spawn
+// server when it runs), so an event loop thread never sits out the vfork
+// suspension of posix_spawn. Once subprocess() returned, ci is filled in
+// and the spawn completes either by posting node to q -- after which the
+// pool does not touch it again -- or, with q NULL, as a future for
+// wait_AsyncSpawn(). ci, args and env must stay put until then
+typedef struct {
+    SpawnTask task;         // task.rc: the subprocess() rc, ci->err says why
+    CompletionNode node;
+    CompletionQueue *q;
+    uint32_t done;          // future: futex word, 1 once done
+} AsyncSpawn;
+
+static inline AsyncSpawn *async_spawn_of(CompletionNode *node) {
+    return completion_of(node, AsyncSpawn, node);
+}
+
+// queue the spawn on p, or with p NULL on a single thread pool that is
+// started on first use and lives as long as the process
+int subprocess_async(SpawnPool *p, AsyncSpawn *as, ProcInfo *ci, char* args[], char* env[],
+    CompletionQueue *q);
+// future: true once the spawn went through, its rc in *rc (may be NULL)
+bool poll_AsyncSpawn(AsyncSpawn *as, int *rc);
+// future: block until the spawn went through; returns its rc
+int wait_AsyncSpawn(AsyncSpawn *as);
+
+#endif // SPAWN_POOL_H
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "spawn_server.h"
+#include "child.h"
+
+#define SERVER_STACK (64 * 1024)
+#define SERVER_FD 3 // the helper keeps its socket here and closes everything above
+#define SPAWN_MAX_FDS 4 // rides along a request: the three streams and the cgroup fd
+
+typedef struct {
+    uint32_t op[3];         // SpawnOpType per stream
+    uint32_t oflags[3];
+    int32_t pipe_sz[3];     // requested SPAWN_OP_PIPE capacity, 0 for default
+    uint32_t path_mask;     // streams with a path in the payload
+    uint32_t fd_mask;       // SPAWN_OP_FD streams whose fd rides along in SCM_RIGHTS
+    uint32_t close_fds;
+    uint32_t has_exe;       // payload starts with an absolute executable path
+    uint32_t argc;
+    int32_t envc;           // -1 for a NULL env
+    uint32_t len;           // payload bytes: exe, paths, args, env, each NUL-terminated
+    uint32_t has_cgroup;    // the last fd in SCM_RIGHTS is a cgroup directory
+    uint32_t set_cpus;      // scheduling fields of ProcInfo, applied in the child
+    uint32_t set_sched;
+    uint32_t set_pgroup;
+    int32_t nice;
+    int32_t sched_policy;
+    int32_t sched_priority;
+    int32_t pgroup;
+    cpu_set_t cpus;
+} SpawnRequest;
+
+typedef struct {
+    int32_t rc;             // 0 on success
+    int32_t err;            // errno of the failure
+    int32_t stage;          // SpawnStage of the failure
+    int32_t pid;            // child pid, also set if only the exec failed
+    uint32_t fd_mask;       // SPAWN_OP_PIPE/MEMFD streams whose parent end rides along
+    int32_t pipe_sz[3];     // granted capacity of requested pipe sizes
+} SpawnReply;
+
+static int server_fd = -1;
+static pid_t server_pid = -1;
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int send_fds(int sock, const void *buf, size_t len, const int *fds, int n_fds) {
+    struct iovec iov = {.iov_base = (void *)buf, .iov_len = len};
+    union {
+        char buf[CMSG_SPACE(SPAWN_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (n_fds > 0) {
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+        memcpy(CMSG_DATA(c), fds, n_fds * sizeof(int));
+    }
+    ssize_t n;
+    while ((n = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+    return n == (ssize_t)len ? 0 : -1;
+}
+
+// read exactly len bytes; fds (if any) from the first segment land in fds
+static int recv_fds(int sock, void *buf, size_t len, int *fds, int max_fds, int *n_fds) {
+    union {
+        char buf[CMSG_SPACE(SPAWN_MAX_FDS * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    size_t got = 0;
+
+    if (n_fds != NULL) {
+        *n_fds = 0;
+    }
+    while (got < len) {
+        struct iovec iov = {.iov_base = (char *)buf + got, .iov_len = len - got};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = ctl.buf, .msg_controllen = sizeof(ctl.buf)};
+        ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS && n_fds != NULL) {
+                int cnt = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                int keep = cnt < max_fds - *n_fds ? cnt : max_fds - *n_fds;
+                memcpy(fds + *n_fds, CMSG_DATA(c), keep * sizeof(int));
+                *n_fds += keep;
+            }
+        }
+        if (msg.msg_flags & MSG_CTRUNC) { // an fd was dropped: the message is no use without it
+            for (int i = 0; n_fds != NULL && i < *n_fds; i++) {
+                close(fds[i]);
+            }
+            if (n_fds != NULL) {
+                *n_fds = 0;
+            }
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void serve_one(int sock, const SpawnRequest *req, char *payload, int *in_fds, int n_in) {
+    static char *stack;
+    char **args = calloc(req->argc + 1, sizeof(char *));
+    char **env = req->envc >= 0 ? calloc(req->envc + 1, sizeof(char *)) : NULL;
+    int pipes[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+    int out_fds[3], n_out = 0, n_used = 0;
+    SpawnReply rep = {.pid = -1, .stage = SPAWN_STAGE_EXEC};
+    ChildSetup job = {.args = args, .env = env, .fds = {-1, -1, -1},
+        .close_fds = req->close_fds, .cpus = req->set_cpus ? &req->cpus : NULL,
+        .nice = req->nice, .set_sched = req->set_sched, .sched_policy = req->sched_policy,
+        .sched_priority = req->sched_priority, .set_pgroup = req->set_pgroup,
+        .pgroup = req->pgroup};
+    int cgroup_fd = req->has_cgroup && n_in > 0 ? in_fds[n_in - 1] : -1;
+    char *p = payload;
+
+    if (stack == NULL) {
+        stack = aligned_alloc(16, SERVER_STACK);
+    }
+    if (args == NULL || (req->envc >= 0 && env == NULL) || stack == NULL) {
+        rep.rc = 1;
+        rep.err = ENOMEM;
+        goto reply;
+    }
+    if (req->has_exe) {
+        job.exe = p;
+        p += strlen(p) + 1;
+    }
+    for (int i = 0; i < 3; i++) {
+        job.op[i] = req->op[i];
+        job.oflags[i] = req->oflags[i];
+        if (req->path_mask & (1u << i)) {
+            job.paths[i] = p;
+            p += strlen(p) + 1;
+        }
+    }
+    for (uint32_t i = 0; i < req->argc; i++, p += strlen(p) + 1) {
+        args[i] = p;
+    }
+    for (int32_t i = 0; i < req->envc; i++, p += strlen(p) + 1) {
+        env[i] = p;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (req->op[i] == SPAWN_OP_FD && (req->fd_mask & (1u << i)) && n_used < n_in) {
+            job.fds[i] = in_fds[n_used++];
+        } else if (req->op[i] == SPAWN_OP_PIPE) {
+            if (pipe2(pipes[i], O_CLOEXEC)) {
+                rep.rc = 1;
+                rep.err = errno;
+                goto reply;
+            }
+            if (req->pipe_sz[i] > 0) {
+                rep.pipe_sz[i] = set_pipe_size(pipes[i][0], req->pipe_sz[i]);
+            }
+            job.fds[i] = pipes[i][i == STDIN_FILENO ? 0 : 1];
+        } else if (req->op[i] == SPAWN_OP_MEMFD) {
+            if ((pipes[i][0] = memfd_create(i == STDOUT_FILENO ? "stdout" : "stderr", MFD_CLOEXEC)) < 0) {
+                rep.rc = 1;
+                rep.err = errno;
+                goto reply;
+            }
+            job.fds[i] = pipes[i][0];
+        }
+    }
+    if (cgroup_fd >= 0) {
+        struct clone_args ca = {
+            .flags = CLONE_VM | CLONE_VFORK | CLONE_PARENT | CLONE_INTO_CGROUP,
+            .exit_signal = 0, // clone3 rejects one with CLONE_PARENT, the helper's SIGCHLD is used
+            .stack = (unsigned long)stack,
+            .stack_size = SERVER_STACK,
+            .cgroup = cgroup_fd,
+        };
+        rep.pid = clone3_run(&ca, exec_ChildSetup, &job);
+        if (rep.pid < 0 && errno != ENOSYS) {
+            rep.rc = 1;
+            rep.err = errno;
+            rep.stage = SPAWN_STAGE_CGROUP;
+            goto reply;
+        }
+    }
+    if (rep.pid < 0) {
+        rep.pid = clone(exec_ChildSetup, stack + SERVER_STACK,
+            CLONE_VM | CLONE_VFORK | CLONE_PARENT | SIGCHLD, &job);
+        // without clone3 the child can only join its cgroup after exec
+        if (rep.pid > 0 && cgroup_fd >= 0 && job.err == 0 && join_cgroup(cgroup_fd, rep.pid)) {
+            job.err = errno;
+            rep.stage = SPAWN_STAGE_CGROUP;
+            kill(rep.pid, SIGKILL);
+        }
+    }
+    if (rep.pid < 0) {
+        rep.rc = 1;
+        rep.err = errno;
+    } else if (job.err != 0) { // cloned, but exec failed: the caller reaps it
+        rep.rc = 1;
+        rep.err = job.err;
+    } else {
+        for (int i = 0; i < 3; i++) {
+            if (req->op[i] == SPAWN_OP_PIPE) {
+                out_fds[n_out++] = pipes[i][i == STDIN_FILENO ? 1 : 0];
+                rep.fd_mask |= 1u << i;
+            } else if (req->op[i] == SPAWN_OP_MEMFD) {
+                out_fds[n_out++] = pipes[i][0];
+                rep.fd_mask |= 1u << i;
+            }
+        }
+    }
+
+reply:
+    send_fds(sock, &rep, sizeof(rep), out_fds, n_out);
+    for (int i = 0; i < 3; i++) {
+        if (pipes[i][0] >= 0) {
+            close(pipes[i][0]);
+        }
+        if (pipes[i][1] >= 0) {
+            close(pipes[i][1]);
+        }
+    }
+    for (int i = 0; i < n_in; i++) {
+        close(in_fds[i]);
+    }
+    free(args);
+    free(env);
+}
+
+static void server_main(int sock) {
+    SpawnRequest req;
+    int fds[SPAWN_MAX_FDS], n_fds;
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    // keep only stdio and the socket
+    if (sock != SERVER_FD) {
+        dup3(sock, SERVER_FD, O_CLOEXEC); // dup2 would hand it to every child
+        close(sock);
+        sock = SERVER_FD;
+    }
+    syscall(SYS_close_range, SERVER_FD + 1, ~0U, 0);
+    while (recv_fds(sock, &req, sizeof(req), fds, SPAWN_MAX_FDS, &n_fds) == 0) {
+        char *payload = malloc(req.len + 1);
+        if (payload == NULL || recv_fds(sock, payload, req.len, NULL, 0, NULL)) {
+            break;
+        }
+        payload[req.len] = '\0';
+        serve_one(sock, &req, payload, fds, n_fds);
+        free(payload);
+    }
+    _exit(0);
+}
+
+int start_SpawnServer(void) {
+    int sv[2];
+
+    if (server_fd >= 0) {
+        return 0;
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv)) {
+        showError(false, "Failed to create spawn server socket: %s!", strerror(errno));
+        return 1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        showError(false, "Failed to fork spawn server: %s!", strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        close(sv[0]);
+        server_main(sv[1]);
+    }
+    close(sv[1]);
+    server_fd = sv[0];
+    server_pid = pid;
+    return 0;
+}
+
+void stop_SpawnServer(void) {
+    pthread_mutex_lock(&server_lock);
+    if (server_fd >= 0) {
+        close(server_fd); // the helper exits on EOF
+        server_fd = -1;
+        waitpid(server_pid, NULL, 0);
+        server_pid = -1;
+    }
+    pthread_mutex_unlock(&server_lock);
+}
+
+bool spawn_server_enabled(void) {
+    return server_fd >= 0;
+}
+
+static size_t pack(char *dst, const char *s) {
+    size_t n = strlen(s) + 1;
+    if (dst != NULL) {
+        memcpy(dst, s, n);
+    }
+    return n;
+}
+
+int spawn_via_server(const SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]) {
+    SpawnRequest req = {.close_fds = st->close_fds, .envc = -1,
+        .set_sched = ci->set_sched, .set_pgroup = ci->set_pgroup, .nice = ci->nice,
+        .sched_policy = ci->sched_policy, .sched_priority = ci->sched_priority,
+        .pgroup = ci->pgroup};
+    SpawnReply rep;
+    int *fds[3] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr};
+    int *sizes[3] = {&ci->sz_stdin, &ci->sz_stdout, &ci->sz_stderr};
+    int in_fds[SPAWN_MAX_FDS], n_in = 0, out_fds[3], n_out = 0, rc;
+    size_t len = 0;
+    char *payload, *p;
+
+    if (ci->cpus != NULL) {
+        req.set_cpus = 1;
+        req.cpus = *ci->cpus;
+    }
+    for (int i = 0; i < 3; i++) {
+        req.op[i] = st->op[i];
+        req.oflags[i] = st->oflags[i];
+        req.pipe_sz[i] = st->op[i] == SPAWN_OP_PIPE ? *sizes[i] : 0;
+        if (st->op[i] == SPAWN_OP_OPEN) {
+            req.path_mask |= 1u << i;
+            len += pack(NULL, st->path[i]);
+        } else if (st->op[i] == SPAWN_OP_FD) {
+            if ((rc = check_stream_fd(st, ci, i, args[0])) != 0) {
+                return rc;
+            }
+            req.fd_mask |= 1u << i;
+            in_fds[n_in++] = *fds[i];
+        }
+    }
+    if (ci->set_cgroup) {
+        req.has_cgroup = 1;
+        in_fds[n_in++] = ci->cgroup_fd;
+    }
+    if (st->exe != NULL) {
+        req.has_exe = 1;
+        len += pack(NULL, st->exe);
+    }
+    for (; args[req.argc] != NULL; req.argc++) {
+        len += pack(NULL, args[req.argc]);
+    }
+    if (env != NULL) {
+        for (req.envc = 0; env[req.envc] != NULL; req.envc++) {
+            len += pack(NULL, env[req.envc]);
+        }
+    }
+    req.len = len;
+    if ((payload = malloc(len ? len : 1)) == NULL) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_ALLOC, -1, ENOMEM, 0, args[0]);
+    }
+    p = payload;
+    if (st->exe != NULL) {
+        p += pack(p, st->exe);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (req.path_mask & (1u << i)) {
+            p += pack(p, st->path[i]);
+        }
+    }
+    for (uint32_t i = 0; i < req.argc; i++) {
+        p += pack(p, args[i]);
+    }
+    for (int32_t i = 0; i < req.envc; i++) {
+        p += pack(p, env[i]);
+    }
+
+    pthread_mutex_lock(&server_lock);
+    int io = server_fd < 0 ||
+        send_fds(server_fd, &req, sizeof(req), in_fds, n_in) ||
+        write_all(server_fd, payload, len) ||
+        recv_fds(server_fd, &rep, sizeof(rep), out_fds, 3, &n_out);
+    pthread_mutex_unlock(&server_lock);
+    free(payload);
+    if (io) {
+        report_SpawnError(&ci->err, SPAWN_STAGE_SERVER, -1, EPIPE, 0, args[0]);
+        return 1;
+    }
+    if (rep.rc != 0) {
+        if (rep.pid > 0) { // exec failed after the clone; the child is ours to reap
+            waitpid(rep.pid, NULL, 0);
+        }
+        return report_SpawnError(&ci->err, rep.stage, -1, rep.err, 0, args[0]);
+    }
+    ci->pid = rep.pid;
+    for (int i = 0, j = 0; i < 3; i++) {
+        if (rep.fd_mask & (1u << i)) {
+            *fds[i] = j < n_out ? out_fds[j++] : -1;
+            if (*sizes[i] > 0) {
+                *sizes[i] = rep.pipe_sz[i];
+            }
+        } else if (st->op[i] != SPAWN_OP_FD) {
+            *fds[i] = -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#ifndef SPAWN_SERVER_H
+#define SPAWN_SERVER_H
+
+#include <stdbool.h>
+
+#include "subprocess.h"
+
+// Spawn-server mode: a small helper forked early (while the parent is still
+// small) that creates children on behalf of subprocess(). Requests travel over
+// a Unix socket, pipe fds come back via SCM_RIGHTS. The helper clones with
+// CLONE_PARENT, so children still belong to the caller: waitpid() and
+// pidfds work exactly as with a local spawn.
+
+// fork the helper; call before the parent grows large or starts threads
+int start_SpawnServer(void);
+// stop routing through the helper and let it exit
+void stop_SpawnServer(void);
+bool spawn_server_enabled(void);
+// spawn the planned streams of st through the helper; fills ci->pid and fds
+int spawn_via_server(const SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]);
+
+#endif // SPAWN_SERVER_H
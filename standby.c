@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "standby.h"
+#include "child.h"
+#include "path_cache.h"
+#include "stdbuf.h"
+
+#define STANDBY_STACK (64 * 1024)
+
+struct StandbyArea {
+    ChildSetup cs;
+    int keep[8];        // fds the child keeps open while it waits
+    int n_keep;
+    int ctl;            // the child's end of the control pipe
+    char *ptrs[STANDBY_MAX_PTRS];
+    char stack[STANDBY_STACK] __attribute__((aligned(16)));
+    char strings[];
+};
+
+#define AREA_STRINGS (STANDBY_AREA_SZ - sizeof(StandbyArea))
+
+// close every fd from 3 up except the (at most 8) in keep
+static void close_except(int *keep, int n) {
+    int lo = STDERR_FILENO + 1;
+
+    for (int i = 1; i < n; i++) { // insertion sort: no libc state in the child
+        for (int j = i; j > 0 && keep[j - 1] > keep[j]; j--) {
+            int t = keep[j];
+            keep[j] = keep[j - 1];
+            keep[j - 1] = t;
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (keep[i] >= lo) {
+            if (keep[i] > lo) {
+                syscall(SYS_close_range, lo, keep[i] - 1, 0);
+            }
+            lo = keep[i] + 1;
+        }
+    }
+    syscall(SYS_close_range, lo, ~0U, 0);
+}
+
+// the child: shares our memory, but not our fds or signal handlers, and
+// touches nothing but its own stack and area until it execs
+static int standby_main(void *arg) {
+    StandbyArea *a = arg;
+    char c;
+    ssize_t n;
+
+    close_except(a->keep, a->n_keep);
+    while ((n = read(a->ctl, &c, 1)) < 0 && errno == EINTR);
+    if (n != 1) {
+        _exit(0); // pool closed, or the parent is gone
+    }
+    return exec_ChildSetup(&a->cs);
+}
+
+static void close_standby(Standby *s) {
+    if (s->ctl >= 0) {
+        close(s->ctl);
+    }
+    if (s->status >= 0) {
+        close(s->status);
+    }
+    for (int i = 0; i < 3; i++) {
+        if (s->fds[i] >= 0) {
+            close(s->fds[i]);
+        }
+    }
+    if (s->area != NULL) {
+        munmap(s->area, STANDBY_AREA_SZ);
+    }
+}
+
+// start one child that sets nothing up but its pipes and waits on ctl
+static int make_standby(StandbyPool *p, Standby *s) {
+    const int shape_fds[3] = {p->shape.p_stdin, p->shape.p_stdout, p->shape.p_stderr};
+    const int sizes[3] = {p->shape.sz_stdin, p->shape.sz_stdout, p->shape.sz_stderr};
+    int ctl[2] = {-1, -1}, status[2] = {-1, -1}, child[3] = {-1, -1, -1};
+    int n_keep = 0;
+
+    *s = (Standby){.ctl = -1, .status = -1, .fds = {-1, -1, -1}};
+    s->area = mmap(NULL, STANDBY_AREA_SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (s->area == MAP_FAILED) {
+        s->area = NULL;
+        return -1;
+    }
+    if (pipe2(ctl, O_CLOEXEC) || pipe2(status, O_CLOEXEC)) {
+        goto fail;
+    }
+    for (int i = 0; i < 3; i++) {
+        int pp[2];
+        switch (p->st.op[i]) {
+            case SPAWN_OP_PIPE:
+                if (pipe2(pp, O_CLOEXEC)) {
+                    goto fail;
+                }
+                if (sizes[i] > 0) {
+                    set_pipe_size(pp[0], sizes[i]);
+                }
+                child[i] = pp[i == STDIN_FILENO ? 0 : 1];
+                s->fds[i] = pp[i == STDIN_FILENO ? 1 : 0];
+                break;
+            case SPAWN_OP_SOCKETPAIR:
+                if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pp)) {
+                    goto fail;
+                }
+                child[i] = pp[0];
+                s->fds[i] = pp[1];
+                break;
+            case SPAWN_OP_MEMFD:
+                if ((s->fds[i] = memfd_create("standby", MFD_CLOEXEC)) < 0) {
+                    goto fail;
+                }
+                child[i] = s->fds[i];
+                break;
+            case SPAWN_OP_FD:
+                child[i] = shape_fds[i];
+                break;
+            default: // opened, closed or dup'd by exec_ChildSetup()
+                break;
+        }
+        if (child[i] >= 0) {
+            s->area->keep[n_keep++] = child[i];
+        }
+    }
+    s->area->keep[n_keep++] = ctl[0];
+    s->area->keep[n_keep++] = status[1];
+    s->area->n_keep = n_keep;
+    s->area->ctl = ctl[0];
+
+    ChildSetup *cs = &s->area->cs;
+    *cs = (ChildSetup){.fds = {child[0], child[1], child[2]}, .cpus = p->shape.cpus,
+        .nice = p->shape.nice, .set_sched = p->shape.set_sched,
+        .sched_policy = p->shape.sched_policy, .sched_priority = p->shape.sched_priority,
+        .set_pgroup = p->shape.set_pgroup, .pgroup = p->shape.pgroup, .sigmask = &p->mask,
+        .ns_fds = p->shape.ns_fds, .n_ns_fds = p->shape.n_ns_fds};
+    for (int i = 0; i < 3; i++) {
+        cs->op[i] = p->st.op[i];
+        cs->oflags[i] = p->st.oflags[i];
+        cs->paths[i] = p->st.path[i];
+    }
+
+    // CLONE_VM without CLONE_VFORK: nothing is copied now, and the exec
+    // later only drops the child's reference to our address space, so a
+    // claim costs no more than the exec itself. The refill thread blocks
+    // every signal, the child waits with all of them blocked (SIGKILL
+    // aside) and exec_ChildSetup() restores mask
+    pid_t pid = clone(standby_main, s->area->stack + STANDBY_STACK,
+        CLONE_VM | SIGCHLD | p->shape.clone_ns, s->area);
+    if (pid < 0) {
+        goto fail;
+    }
+    s->pid = pid;
+    s->ctl = ctl[1];
+    s->status = status[0];
+    close(ctl[0]);
+    close(status[1]);
+    for (int i = 0; i < 3; i++) {
+        if (child[i] >= 0 && child[i] != s->fds[i] && p->st.op[i] != SPAWN_OP_FD) {
+            close(child[i]);
+        }
+    }
+    return 0;
+
+fail:
+    for (int i = 0; i < 2; i++) {
+        if (ctl[i] >= 0) {
+            close(ctl[i]);
+        }
+        if (status[i] >= 0) {
+            close(status[i]);
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        if (child[i] >= 0 && child[i] != s->fds[i] && p->st.op[i] != SPAWN_OP_FD) {
+            close(child[i]);
+        }
+    }
+    close_standby(s);
+    return -1;
+}
+
+static void *refill_main(void *arg) {
+    StandbyPool *p = arg;
+    sigset_t all;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, NULL);
+    pthread_mutex_lock(&p->lock);
+    while (!p->stopping) {
+        if (p->n_ready >= p->target) {
+            pthread_cond_wait(&p->wake, &p->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&p->lock);
+        Standby s;
+        int rc = make_standby(p, &s);
+        pthread_mutex_lock(&p->lock);
+        if (rc != 0) {
+            showError(false, "Failed to create standby process: %s!", strerror(errno));
+            break; // claims fall back to subprocess()
+        }
+        if (p->stopping) {
+            close(s.ctl);
+            s.ctl = -1;
+            waitpid(s.pid, NULL, 0);
+            close_standby(&s);
+            break;
+        }
+        p->ready[p->n_ready++] = s;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int init_StandbyPool(StandbyPool *p, const ProcInfo *shape, int target) {
+    memset(p, 0, sizeof(*p));
+    p->shape = *shape;
+    p->target = target > 0 ? target : 1;
+    if (shape->set_cgroup || shape->chan_size > 0 || shape->n_extra_fds > 0) {
+        showError(false, "Standby processes support no cgroups, channels or extra fds!");
+        return 1;
+    }
+    if (init_SpawnTemplate(&p->st, shape)) {
+        return 1;
+    }
+    pthread_sigmask(SIG_SETMASK, NULL, &p->mask);
+    if ((p->ready = calloc(p->target, sizeof(Standby))) == NULL) {
+        close_SpawnTemplate(&p->st);
+        return 1;
+    }
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->wake, NULL);
+    if (pthread_create(&p->refill, NULL, refill_main, p) != 0) {
+        showError(false, "Failed to start the standby refill thread!");
+        pthread_cond_destroy(&p->wake);
+        pthread_mutex_destroy(&p->lock);
+        free(p->ready);
+        close_SpawnTemplate(&p->st);
+        return 1;
+    }
+    return 0;
+}
+
+// copy args and env into the area and point argv/envp at the copies
+static bool fill_area(StandbyArea *a, char* args[], char* env[]) {
+    size_t n_ptrs = 0, off = 0;
+    char resolved[PATH_MAX];
+    char **lists[2] = {args, env};
+
+    a->cs.exe = NULL;
+    if (strchr(args[0], '/') != NULL ||
+            (path_cache_enabled() ? lookup_path_cache(args[0], resolved, sizeof(resolved)) :
+            resolve_path(args[0], resolved, sizeof(resolved)))) {
+        const char *exe = strchr(args[0], '/') != NULL ? args[0] : resolved;
+        size_t len = strlen(exe) + 1;
+        if (len > AREA_STRINGS) {
+            return false;
+        }
+        memcpy(a->strings, exe, len);
+        a->cs.exe = a->strings;
+        off = len;
+    }
+    for (int l = 0; l < 2; l++) {
+        if (l == 1) {
+            a->cs.env = env != NULL ? &a->ptrs[n_ptrs] : NULL;
+        } else {
+            a->cs.args = &a->ptrs[n_ptrs];
+        }
+        for (char **s = lists[l]; s != NULL && *s != NULL; s++) {
+            size_t len = strlen(*s) + 1;
+            if (n_ptrs + 2 > STANDBY_MAX_PTRS || off + len > AREA_STRINGS) {
+                return false;
+            }
+            memcpy(a->strings + off, *s, len);
+            a->ptrs[n_ptrs++] = a->strings + off;
+            off += len;
+        }
+        a->ptrs[n_ptrs++] = NULL;
+    }
+    return true;
+}
+
+// args and env into s's area, with what the shape's stdout_buf/stderr_buf add
+static bool fill_standby(StandbyPool *p, Standby *s, char* args[], char* env[]) {
+    EnvOverlay o;
+
+    if (p->shape.stdout_buf == PROC_BUF_DEFAULT && p->shape.stderr_buf == PROC_BUF_DEFAULT) {
+        return fill_area(s->area, args, env);
+    }
+    char **envp = stdbuf_env(&o, &p->shape, env);
+    if (envp == NULL) {
+        return false;
+    }
+    bool ok = fill_area(s->area, args, envp);
+    free_EnvOverlay(&o);
+    return ok;
+}
+
+// exec on s, or spawn as usual without one
+static int claim_standby(StandbyPool *p, Standby *s, ProcInfo *ci, char* args[], char* env[]) {
+    int *fds[3] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr};
+    char c;
+
+    if (s == NULL || !fill_standby(p, s, args, env)) {
+        if (s != NULL) { // too big for the area: let it go and spawn as usual
+            close(s->ctl);
+            s->ctl = -1;
+            waitpid(s->pid, NULL, 0);
+            close_standby(s);
+        }
+        *ci = p->shape;
+        return spawn_SpawnTemplate(&p->st, ci, args, env);
+    }
+
+    *ci = p->shape;
+    ci->pidfd = -1;
+    ci->err.stage = SPAWN_STAGE_NONE;
+    clock_gettime(CLOCK_REALTIME, &ci->t_start);
+    if (write(s->ctl, "x", 1) != 1) {
+        int err = errno;
+        kill(s->pid, SIGKILL);
+        waitpid(s->pid, NULL, 0);
+        close_standby(s);
+        return report_SpawnError(&ci->err, SPAWN_STAGE_EXEC, -1, err, 0, args[0]);
+    }
+    while (read(s->status, &c, 1) < 0 && errno == EINTR); // EOF: exec'd or failed
+    int err = __atomic_load_n(&s->area->cs.err, __ATOMIC_SEQ_CST);
+    if (err != 0) {
+        waitpid(s->pid, NULL, 0);
+        close_standby(s);
+        return report_SpawnError(&ci->err, SPAWN_STAGE_EXEC, -1, err, 0, args[0]);
+    }
+    ci->pid = s->pid;
+    ci->pidfd = syscall(SYS_pidfd_open, s->pid, 0);
+    for (int i = 0; i < 3; i++) {
+        if (p->st.op[i] == SPAWN_OP_PIPE || p->st.op[i] == SPAWN_OP_MEMFD) {
+            *fds[i] = s->fds[i];
+        } else if (p->st.op[i] == SPAWN_OP_SOCKETPAIR) { // one duplex fd, as p_stdout
+            ci->p_stdin = -1;
+            ci->p_stdout = s->fds[i];
+        } else if (p->st.op[i] != SPAWN_OP_FD && p->st.op[i] != SPAWN_OP_DUP_STDIN) {
+            *fds[i] = -1;
+        }
+        s->fds[i] = -1;
+    }
+    close(s->ctl);
+    close(s->status);
+    munmap(s->area, STANDBY_AREA_SZ);
+    return 0;
+}
+
+int claim_StandbyPool(StandbyPool *p, ProcInfo *ci, char* args[], char* env[]) {
+    Standby s;
+
+    pthread_mutex_lock(&p->lock);
+    bool warm = p->n_ready > 0;
+    if (warm) {
+        s = p->ready[--p->n_ready];
+        p->hits++;
+    } else {
+        p->misses++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    int rc = claim_standby(p, warm ? &s : NULL, ci, args, env);
+    // refill only now, so the next clone doesn't compete with this exec
+    pthread_mutex_lock(&p->lock);
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    return rc;
+}
+
+void close_StandbyPool(StandbyPool *p) {
+    pthread_mutex_lock(&p->lock);
+    p->stopping = true;
+    pthread_cond_signal(&p->wake);
+    pthread_mutex_unlock(&p->lock);
+    pthread_join(p->refill, NULL);
+    for (int i = 0; i < p->n_ready; i++) {
+        close(p->ready[i].ctl); // EOF: the child exits without exec
+        p->ready[i].ctl = -1;
+    }
+    for (int i = 0; i < p->n_ready; i++) {
+        waitpid(p->ready[i].pid, NULL, 0);
+        close_standby(&p->ready[i]);
+    }
+    p->n_ready = 0;
+    free(p->ready);
+    p->ready = NULL;
+    pthread_cond_destroy(&p->wake);
+    pthread_mutex_destroy(&p->lock);
+    close_SpawnTemplate(&p->st);
+}
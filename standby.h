@@ -0,0 +1,58 @@
+#ifndef STANDBY_H
+#define STANDBY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "subprocess.h"
+
+#define STANDBY_AREA_SZ (256 * 1024)    // argv, env and strings of one claim
+#define STANDBY_MAX_PTRS 4096           // argv plus env entries
+
+typedef struct StandbyArea StandbyArea;
+
+// a cloned child with its streams already set up, blocked on ctl until it
+// is told what to exec
+typedef struct {
+    pid_t pid;
+    int ctl;            // write one byte to exec, close to let it exit
+    int status;         // O_CLOEXEC in the child: EOF once it exec'd or died
+    int fds[3];         // parent ends of its streams, like ProcInfo p_stdXX
+    StandbyArea *area;  // shared with the child
+} Standby;
+
+// Warm processes that exec on demand: a background thread clones children
+// (CLONE_VM, like vfork without the wait) shaped like shape (streams,
+// scheduling, pgroup) up to target, each waiting on its control pipe;
+// claiming one writes argv/env into its area and wakes it, so the clone and
+// the pipe setup are off the critical path.
+// Standbys start with only fds 0-2 and their own, as if close_fds were set;
+// PROC_COM_FD streams use shape's fds, which must stay open, and so do its
+// ns_fds; clone_ns namespaces are made with the standby. Cgroups and extra
+// fds are not supported.
+typedef struct {
+    ProcInfo shape;
+    SpawnTemplate st;
+    sigset_t mask;          // the children's signal mask after exec
+    int target;
+    Standby *ready;         // LIFO of warm children
+    int n_ready;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;    // refill thread: a standby was taken or stopping
+    pthread_t refill;
+    bool stopping;
+    size_t hits;            // claims served warm
+    size_t misses;          // claims that found the pool empty and spawned
+} StandbyPool;
+
+// start the refill thread; shape is copied, its cpus (if any) must stay valid
+int init_StandbyPool(StandbyPool *p, const ProcInfo *shape, int target);
+// spawn args like subprocess(ci, args, env) with the pool's shape, on a warm
+// child when one is ready; returns subprocess()'s rc
+int claim_StandbyPool(StandbyPool *p, ProcInfo *ci, char* args[], char* env[]);
+// stop refilling and let every waiting child exit
+void close_StandbyPool(StandbyPool *p);
+
+#endif // STANDBY_H
@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "stdbuf.h"
+
+static pthread_mutex_t lib_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *lib_path;
+static bool lib_looked;
+
+const char *stdbuf_library(void) {
+    static const char *candidates[] = {STDBUF_LIBRARIES};
+
+    pthread_mutex_lock(&lib_lock);
+    if (!lib_looked) {
+        for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]) && lib_path == NULL; i++) {
+            if (access(candidates[i], R_OK) == 0) {
+                lib_path = strdup(candidates[i]);
+            }
+        }
+        lib_looked = true;
+    }
+    const char *path = lib_path;
+    pthread_mutex_unlock(&lib_lock);
+    return path;
+}
+
+void set_stdbuf_library(const char *path) {
+    pthread_mutex_lock(&lib_lock);
+    free(lib_path);
+    lib_path = path != NULL ? strdup(path) : NULL;
+    lib_looked = path != NULL;
+    pthread_mutex_unlock(&lib_lock);
+}
+
+static const char *mode_of(ProcBuffering b) {
+    return b == PROC_BUF_NONE ? "0" : "L";
+}
+
+static const char *get_env(char* env[], const char *name) {
+    size_t len = strlen(name);
+
+    for (size_t i = 0; env != NULL && env[i] != NULL; i++) {
+        if (strncmp(env[i], name, len) == 0 && env[i][len] == '=') {
+            return env[i] + len + 1;
+        }
+    }
+    return NULL;
+}
+
+char** stdbuf_env(EnvOverlay *o, const ProcInfo *ci, char* env[]) {
+    const char *lib = stdbuf_library();
+    int fail = 0;
+
+    init_EnvOverlay(o, env);
+    if (ci->stdout_buf != PROC_BUF_DEFAULT) {
+        fail |= set_EnvOverlay(o, "_STDBUF_O", mode_of(ci->stdout_buf));
+    }
+    if (ci->stderr_buf != PROC_BUF_DEFAULT) {
+        fail |= set_EnvOverlay(o, "_STDBUF_E", mode_of(ci->stderr_buf));
+    }
+    fail |= set_EnvOverlay(o, "PYTHONUNBUFFERED", "1");
+    if (lib != NULL) {
+        const char *preload = get_env(env, "LD_PRELOAD");
+        if (preload == NULL || *preload == '\0') {
+            fail |= set_EnvOverlay(o, "LD_PRELOAD", lib);
+        } else if (strstr(preload, lib) == NULL) {
+            char *both;
+            if (asprintf(&both, "%s:%s", preload, lib) < 0) {
+                fail = 1;
+            } else {
+                fail |= set_EnvOverlay(o, "LD_PRELOAD", both);
+                free(both);
+            }
+        }
+    }
+    char **envp = fail ? NULL : envp_EnvOverlay(o);
+    if (envp == NULL) {
+        free_EnvOverlay(o);
+    }
+    return envp;
+}
@@ -0,0 +1,36 @@
+#ifndef STDBUF_H
+#define STDBUF_H
+
+#include "subprocess.h"
+#include "env_overlay.h"
+
+// A child's libc picks full buffering for a stdout that isn't a terminal,
+// so what it prints reaches a PROC_COM_PIPE reader in 4 KiB bursts. With
+// ProcInfo.stdout_buf/stderr_buf set, subprocess() passes the child the
+// environment stdbuf(1) would: coreutils' libstdbuf.so in LD_PRELOAD,
+// appended to any the env has already, and _STDBUF_O/_STDBUF_E, which it
+// turns into a setvbuf() before main(); PYTHONUNBUFFERED=1 covers Python,
+// which does its own buffering.
+//
+// It is the environment and nothing else, so every backend behaves alike:
+// posix_spawn, clone3/vfork and the spawn server all exec with that envp.
+// What it can't reach on any of them: static binaries, setuid/setcap
+// executables (the loader ignores LD_PRELOAD for them), programs that call
+// setvbuf() on their own and runtimes not built on C stdio. Those need a
+// pseudo-terminal, or a flag of their own (grep --line-buffered, ...).
+// Without libstdbuf.so the _STDBUF_ variables are still set, to no effect
+
+#define STDBUF_LIBRARIES "/usr/libexec/coreutils/libstdbuf.so", "/usr/lib/coreutils/libstdbuf.so", \
+    "/usr/lib64/coreutils/libstdbuf.so", "/usr/local/libexec/coreutils/libstdbuf.so"
+
+// the libstdbuf.so in use: the one set, else the first of STDBUF_LIBRARIES
+// there is, looked up once; NULL if none
+const char *stdbuf_library(void);
+// use path instead, NULL to look again
+void set_stdbuf_library(const char *path);
+// env (may be NULL) with what ci's stdout_buf/stderr_buf ask for, built in
+// o, which the caller frees once the child is spawned; NULL on ENOMEM,
+// with o freed already
+char** stdbuf_env(EnvOverlay *o, const ProcInfo *ci, char* env[]);
+
+#endif // STDBUF_H
@@ -0,0 +1,1122 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "subprocess.h"
+#include "spawn_server.h"
+#include "path_cache.h"
+#include "preflight.h"
+#include "pipe_reservoir.h"
+#include "exec_fd.h"
+#include "child.h"
+#include "shm_channel.h"
+#include "trace.h"
+#include "metrics.h"
+#include "workload.h"
+#include "stdbuf.h"
+
+// one write(2) per message: no stdio lock, lines from threads don't interleave
+void showError(bool noop, char *fmt,...) {
+    char buf[1024];
+    va_list args;
+    int len = 7;
+
+    memcpy(buf, "ERROR: ", len);
+    va_start(args, fmt);
+    len += vsnprintf(buf + len, sizeof(buf) - len - 1, fmt, args);
+    va_end(args);
+    if (len > (int)sizeof(buf) - 2) {
+        len = sizeof(buf) - 2;
+    }
+    if (buf[len - 1] != '\n') {
+        buf[len++] = '\n';
+    }
+    while (write(STDERR_FILENO, buf, len) < 0 && errno == EINTR);
+}
+
+static const char *stream_names[] = {"stdin", "stdout", "stderr"};
+static const char *com_names[] = {"PROC_COM_INHERIT", "PROC_COM_NONE", "PROC_COM_PIPE",
+    "PROC_COM_FD", "PROC_COM_PATH", "PROC_COM_STDOUT", "PROC_COM_CAPTURE", "PROC_COM_MEMFD",
+    "PROC_COM_SOCKET", "PROC_COM_DUPLEX"};
+
+int format_SpawnError(const SpawnError *err, char *buf, size_t len) {
+    const char *name = err->name != NULL ? err->name : "(template)";
+    const char *stream = err->stream >= 0 && err->stream < 3 ? stream_names[err->stream] : "?";
+    const char *why = strerror(err->code);
+
+    switch (err->stage) {
+        case SPAWN_STAGE_NONE:
+            return snprintf(buf, len, "No error");
+        case SPAWN_STAGE_STREAM_TYPE:
+            if (err->value >= 0 && err->value < (int)(sizeof(com_names) / sizeof(*com_names))) {
+                return snprintf(buf, len, "Invalid pipe type (%s) for %s of subprocess %s",
+                    com_names[err->value], stream, name);
+            }
+            return snprintf(buf, len, "Unknown PipeType (%d) for %s of subprocess %s",
+                err->value, stream, name);
+        case SPAWN_STAGE_STREAM_PATH:
+            return snprintf(buf, len, "Empty %s path for subprocess %s", stream, name);
+        case SPAWN_STAGE_STREAM_FD:
+            return snprintf(buf, len, "Invalid %s fd (%d) for subprocess %s: %s", stream, err->value, name, why);
+        case SPAWN_STAGE_PIPE:
+            return snprintf(buf, len, "Failed to create %s %s for subprocess %s: %s",
+                stream, err->value ? "memfd" : "pipe", name, why);
+        case SPAWN_STAGE_CLOSE_FDS:
+            return snprintf(buf, len, "Failed to set up fd closing for subprocess %s: %s", name, why);
+        case SPAWN_STAGE_ALLOC:
+            return snprintf(buf, len, "Failed to allocate memory for subprocess %s: %s", name, why);
+        case SPAWN_STAGE_AFFINITY:
+            return snprintf(buf, len, "Failed to set CPU affinity for subprocess %s: %s", name, why);
+        case SPAWN_STAGE_EXEC:
+            return snprintf(buf, len, "Failed to spawn subprocess %s: %s", name, why);
+        case SPAWN_STAGE_CGROUP:
+            return snprintf(buf, len, "Failed to move subprocess %s into cgroup: %s", name, why);
+        case SPAWN_STAGE_SCHED:
+            return snprintf(buf, len, "Failed to %s subprocess %s: %s",
+                err->value ? "set scheduling policy of" : "renice", name, why);
+        case SPAWN_STAGE_SERVER:
+            return snprintf(buf, len, "Lost spawn server while spawning subprocess %s: %s", name, why);
+        case SPAWN_STAGE_CHANNEL:
+            return snprintf(buf, len, "Failed to create result channel for subprocess %s: %s", name, why);
+        case SPAWN_STAGE_EXTRA_FD:
+            return snprintf(buf, len, "Failed to pass fd %d to subprocess %s: %s", err->value, name, why);
+        case SPAWN_STAGE_ADMISSION:
+            return snprintf(buf, len, "Shed subprocess %s under load: %s", name, why);
+        case SPAWN_STAGE_PRE_EXEC:
+            if (err->value >= 0) {
+                return snprintf(buf, len, "Failed to set rlimit %d of subprocess %s: %s", err->value, name, why);
+            }
+            return snprintf(buf, len, "Failed to set parent death signal of subprocess %s: %s", name, why);
+        case SPAWN_STAGE_PREFLIGHT:
+            if (err->stream >= 0) {
+                return snprintf(buf, len, "Failed to open %s file of subprocess %s: %s", stream, name, why);
+            }
+            return snprintf(buf, len, "Failed to find executable %s: %s", name, why);
+    }
+    return snprintf(buf, len, "Spawn error %d for subprocess %s: %s", err->stage, name, why);
+}
+
+// the default logger formats only once something actually failed
+static void log_SpawnError(const SpawnError *err, void *data) {
+    char buf[512];
+    format_SpawnError(err, buf, sizeof(buf));
+    showError(false, "%s!", buf);
+}
+
+static SpawnLogger spawn_logger = log_SpawnError;
+static void *spawn_logger_data;
+
+void set_spawn_logger(SpawnLogger fn, void *data) {
+    spawn_logger = fn;
+    spawn_logger_data = data;
+}
+
+int report_SpawnError(SpawnError *out, SpawnStage stage, int stream, int code, int value, const char *name) {
+    SpawnError err = {.stage = stage, .stream = stream, .code = code, .value = value, .name = name};
+
+    TRACE3(spawn__error, stage, code, name);
+    metrics_failed(stage);
+
+    if (out != NULL) {
+        *out = err;
+    }
+    if (spawn_logger != NULL) {
+        spawn_logger(&err, spawn_logger_data);
+    }
+    return code != 0 ? code : 1;
+}
+
+static void close_channel(ProcInfo *ci) {
+    if (ci->p_chan >= 0) {
+        close(ci->p_chan);
+    }
+    if (ci->p_bell >= 0) {
+        close(ci->p_bell);
+    }
+    ci->p_chan = ci->p_bell = -1;
+}
+
+static void close_extra_pipes(ProcInfo *ci) {
+    for (int i = 0; i < ci->n_extra_fds; i++) {
+        ExtraFd *e = &ci->extra_fds[i];
+        if (e->type == PROC_COM_PIPE && e->fd >= 0) {
+            close(e->fd);
+            e->fd = -1;
+        }
+    }
+}
+
+void close_ProcInfo(ProcInfo *ci) {
+    if (ci->p_stdin >= 0) {
+        close(ci->p_stdin);
+        ci->p_stdin = -1;
+    }
+    if (ci->p_stdout >= 0) {
+        close(ci->p_stdout);
+        ci->p_stdout = -1;
+    }
+    if (ci->p_stderr >= 0) {
+        close(ci->p_stderr);
+        ci->p_stderr = -1;
+    }
+    if (ci->pid > 0 && ci->pidfd >= 0) { // pidfd is only valid once spawned
+        close(ci->pidfd);
+    }
+    if (ci->chan_size > 0) {
+        close_channel(ci);
+    }
+    if (ci->exec_sentinel && ci->p_exec >= 0) {
+        close(ci->p_exec);
+        ci->p_exec = -1;
+    }
+    close_extra_pipes(ci);
+    ci->pidfd = -1;
+    ci->pid = -1;
+}
+
+void exec_done_ProcInfo(ProcInfo *ci) {
+    char c;
+
+    if (!ci->exec_sentinel || ci->p_exec < 0) {
+        return;
+    }
+    while (read(ci->p_exec, &c, 1) < 0 && errno == EINTR);
+    clock_gettime(CLOCK_REALTIME, &ci->t_exec);
+    close(ci->p_exec);
+    ci->p_exec = -1;
+}
+
+pid_t reap_ProcInfo(ProcInfo *ci, int *status, int options) {
+    pid_t rc;
+
+    while ((rc = wait4(ci->pid, status, options, &ci->usage)) < 0 && errno == EINTR &&
+            !(options & WNOHANG));
+    if (rc > 0) {
+        clock_gettime(CLOCK_REALTIME, &ci->t_end);
+        TRACE2(reap, rc, status != NULL ? *status : -1);
+        metrics_reaped(ci);
+        workload_reaped(ci, status != NULL ? *status : -1);
+    }
+    return rc;
+}
+
+static sigset_t child_mask;
+static bool child_mask_set;
+
+void set_spawn_sigmask(const sigset_t *mask) {
+    if (mask != NULL) {
+        child_mask = *mask;
+    }
+    child_mask_set = mask != NULL;
+}
+
+// glibc posix_spawn forked before 2.24; musl's always used CLONE_VM
+#if (defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 24))) || \
+    (!defined(__GLIBC__) && defined(__linux__) && !defined(__UCLIBC__))
+#define AUTO_BACKEND SPAWN_BACKEND_POSIX_SPAWN
+#else
+#define AUTO_BACKEND SPAWN_BACKEND_VFORK
+#endif
+
+static SpawnBackend backend = AUTO_BACKEND;
+
+void set_spawn_backend(SpawnBackend b) {
+    backend = b == SPAWN_BACKEND_AUTO ? AUTO_BACKEND : b;
+}
+
+SpawnBackend spawn_backend(void) {
+    return backend;
+}
+
+const char *spawn_backend_name(SpawnBackend b) {
+    switch (b) {
+        case SPAWN_BACKEND_AUTO:
+            return spawn_backend_name(AUTO_BACKEND);
+        case SPAWN_BACKEND_POSIX_SPAWN:
+            return "posix_spawn";
+        case SPAWN_BACKEND_VFORK:
+            return "vfork";
+    }
+    return "?";
+}
+
+int open_shared_output(const char *path, bool truncate) {
+    int fd = open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+    if (fd < 0) {
+        showError(false, "Failed to open shared output %s: %s!", path, strerror(errno));
+    }
+    return fd;
+}
+
+int prepare_stream_socket(int fd, bool nodelay, int sndbuf, int rcvbuf) {
+    int flags = fcntl(fd, F_GETFL), domain, proto, on = 1;
+    socklen_t len = sizeof(int);
+
+    if (flags < 0 || ((flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags & ~O_NONBLOCK) != 0)) {
+        showError(false, "Failed to make socket %d blocking: %s!", fd, strerror(errno));
+        return 1;
+    }
+    if (nodelay && getsockopt(fd, SOL_SOCKET, SO_DOMAIN, &domain, &len) == 0 &&
+            (domain == AF_INET || domain == AF_INET6) &&
+            getsockopt(fd, SOL_SOCKET, SO_PROTOCOL, &proto, &len) == 0 && proto == IPPROTO_TCP &&
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0) {
+        showError(false, "Failed to set TCP_NODELAY on socket %d: %s!", fd, strerror(errno));
+        return 1;
+    }
+    if (sndbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) != 0) {
+        showError(false, "Failed to set send buffer of socket %d: %s!", fd, strerror(errno));
+        return 1;
+    }
+    if (rcvbuf > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) != 0) {
+        showError(false, "Failed to set receive buffer of socket %d: %s!", fd, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int shutdown_duplex(ProcInfo *ci) {
+    if (ci->stdout_type != PROC_COM_DUPLEX || ci->p_stdout < 0 || shutdown(ci->p_stdout, SHUT_WR) != 0) {
+        showError(false, "Failed to shut down duplex stdin of %d: %s!", ci->pid,
+            ci->p_stdout < 0 ? "no socket" : strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+int set_pipe_size(int fd, int size) {
+    int granted = fcntl(fd, F_SETPIPE_SZ, size);
+    if (granted < 0) { // over pipe-max-size without CAP_SYS_RESOURCE: keep what we have
+        granted = fcntl(fd, F_GETPIPE_SZ);
+    }
+    return granted;
+}
+
+// open a pidfd for pid; returns -1 if the kernel does not support it
+static int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        return fd;
+    }
+#endif
+    return -1;
+}
+
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 34)
+#define HAVE_ADDCLOSEFROM 1
+#endif
+
+// make the child close every fd from lowfd up, after the stdXX dups are done
+static int add_closefrom(posix_spawn_file_actions_t *action, int lowfd) {
+#ifdef HAVE_ADDCLOSEFROM
+    return posix_spawn_file_actions_addclosefrom_np(action, lowfd);
+#else
+    // no closefrom action: close what is open right now, one action per fd
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *de;
+    if (dir == NULL) {
+        return errno;
+    }
+    while ((de = readdir(dir)) != NULL) {
+        int fd = atoi(de->d_name);
+        if (fd >= lowfd && fd != dirfd(dir)) {
+            posix_spawn_file_actions_addclose(action, fd);
+        }
+    }
+    closedir(dir);
+    return 0;
+#endif
+}
+
+// validate one ProcComType combination and resolve it into per-stream ops
+// name is only used for error messages, failures are recorded in *err
+static int plan_streams(SpawnTemplate *st, const ProcInfo *ci, const char *name, SpawnError *err) {
+    memset(st, 0, sizeof(*st));
+    st->close_fds = ci->close_fds;
+    switch (ci->stdin_type) {
+        case PROC_COM_PIPE:
+            st->op[STDIN_FILENO] = SPAWN_OP_PIPE;
+            break;
+        case PROC_COM_FD:
+        case PROC_COM_SOCKET:
+            st->op[STDIN_FILENO] = SPAWN_OP_FD;
+            break;
+        case PROC_COM_DUPLEX:
+            if (ci->stdout_type != PROC_COM_DUPLEX) {
+                report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDOUT_FILENO, EINVAL, ci->stdout_type, name);
+                return 1;
+            }
+            st->op[STDIN_FILENO] = SPAWN_OP_SOCKETPAIR;
+            break;
+        case PROC_COM_STDOUT:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDIN_FILENO, EINVAL, PROC_COM_STDOUT, name);
+            return 1;
+        case PROC_COM_CAPTURE:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDIN_FILENO, EINVAL, PROC_COM_CAPTURE, name);
+            return 1;
+        case PROC_COM_MEMFD:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDIN_FILENO, EINVAL, PROC_COM_MEMFD, name);
+            return 1;
+        case PROC_COM_PATH:
+            if (ci->f_stdin == NULL) {
+                report_SpawnError(err, SPAWN_STAGE_STREAM_PATH, STDIN_FILENO, EINVAL, 0, name);
+                return 1;
+            }
+            st->op[STDIN_FILENO] = SPAWN_OP_OPEN;
+            st->path[STDIN_FILENO] = ci->f_stdin;
+            st->oflags[STDIN_FILENO] = O_RDONLY;
+            break;
+        case PROC_COM_NONE:
+            st->op[STDIN_FILENO] = SPAWN_OP_CLOSE;
+            break;
+        case PROC_COM_INHERIT: // no-op
+            break;
+        default:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDIN_FILENO, EINVAL, ci->stdin_type, name);
+            return 1;
+    }
+    switch (ci->stdout_type) {
+        case PROC_COM_PIPE:
+        case PROC_COM_CAPTURE:
+            st->op[STDOUT_FILENO] = SPAWN_OP_PIPE;
+            break;
+        case PROC_COM_MEMFD:
+            st->op[STDOUT_FILENO] = SPAWN_OP_MEMFD;
+            break;
+        case PROC_COM_STDOUT:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDOUT_FILENO, EINVAL, PROC_COM_STDOUT, name);
+            return 1;
+        case PROC_COM_FD:
+        case PROC_COM_SOCKET:
+            st->op[STDOUT_FILENO] = SPAWN_OP_FD;
+            break;
+        case PROC_COM_DUPLEX:
+            if (ci->stdin_type != PROC_COM_DUPLEX) {
+                report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDIN_FILENO, EINVAL, ci->stdin_type, name);
+                return 1;
+            }
+            st->op[STDOUT_FILENO] = SPAWN_OP_DUP_STDIN;
+            break;
+        case PROC_COM_PATH:
+            if (ci->f_stdout == NULL) {
+                report_SpawnError(err, SPAWN_STAGE_STREAM_PATH, STDOUT_FILENO, EINVAL, 0, name);
+                return 1;
+            }
+            st->op[STDOUT_FILENO] = SPAWN_OP_OPEN;
+            st->path[STDOUT_FILENO] = ci->f_stdout;
+            st->oflags[STDOUT_FILENO] = proc_path_oflags(ci);
+            break;
+        case PROC_COM_NONE:
+            st->op[STDOUT_FILENO] = SPAWN_OP_CLOSE;
+            break;
+        case PROC_COM_INHERIT: // no-op
+            break;
+        default:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDOUT_FILENO, EINVAL, ci->stdout_type, name);
+            return 1;
+    }
+    switch (ci->stderr_type) {
+        case PROC_COM_PIPE:
+        case PROC_COM_CAPTURE:
+            st->op[STDERR_FILENO] = SPAWN_OP_PIPE;
+            break;
+        case PROC_COM_MEMFD:
+            st->op[STDERR_FILENO] = SPAWN_OP_MEMFD;
+            break;
+        case PROC_COM_FD:
+        case PROC_COM_SOCKET:
+            st->op[STDERR_FILENO] = SPAWN_OP_FD;
+            break;
+        case PROC_COM_PATH:
+            if (ci->f_stderr == NULL) {
+                report_SpawnError(err, SPAWN_STAGE_STREAM_PATH, STDERR_FILENO, EINVAL, 0, name);
+                return 1;
+            }
+            st->op[STDERR_FILENO] = SPAWN_OP_OPEN;
+            st->path[STDERR_FILENO] = ci->f_stderr;
+            st->oflags[STDERR_FILENO] = proc_path_oflags(ci);
+            break;
+        case PROC_COM_STDOUT:
+            if (ci->stdout_type == PROC_COM_INHERIT) { // no-op
+                break;
+            } else if (ci->stdout_type != PROC_COM_NONE) {
+                st->op[STDERR_FILENO] = SPAWN_OP_DUP_STDOUT;
+                break;
+            }
+            // fall thorugh for ci->stdout_type == PROC_COM_NONE
+        case PROC_COM_NONE:
+            st->op[STDERR_FILENO] = SPAWN_OP_CLOSE;
+            break;
+        case PROC_COM_INHERIT: // no-op
+            break;
+        default:
+            report_SpawnError(err, SPAWN_STAGE_STREAM_TYPE, STDERR_FILENO, EINVAL, ci->stderr_type, name);
+            return 1;
+    }
+    st->stdin_type = ci->stdin_type;
+    st->stdout_type = ci->stdout_type;
+    st->stderr_type = ci->stderr_type;
+    st->reusable = true;
+    for (int i = 0; i < 3; i++) {
+        if (st->op[i] == SPAWN_OP_PIPE || st->op[i] == SPAWN_OP_FD || st->op[i] == SPAWN_OP_MEMFD ||
+                st->op[i] == SPAWN_OP_SOCKETPAIR) {
+            st->reusable = false; // needs fresh fds on every spawn
+        }
+    }
+#ifndef HAVE_ADDCLOSEFROM
+    if (st->close_fds) {
+        st->reusable = false; // the fallback snapshots the fds open at spawn time
+    }
+#endif
+    return 0;
+}
+
+// give *fd a number above max: a copy, and the original closed if we own it
+// (a caller's fd is only copied)
+static bool move_above(int *fd, int max, bool owned) {
+    if (*fd > max) {
+        return true;
+    }
+    int moved = fcntl(*fd, F_DUPFD_CLOEXEC, max + 1);
+    if (moved < 0) {
+        return false;
+    }
+    if (owned) {
+        close(*fd);
+    }
+    *fd = moved;
+    return true;
+}
+
+// src (moved above every dst first) goes onto dst; owned srcs are ours to close
+static int add_extra(FdMap *m, int src, int dst, bool owned) {
+    int orig = src;
+    if (!move_above(&src, m->max_dst, owned)) {
+        return errno;
+    }
+    m->src[m->n] = src;
+    m->dst[m->n] = dst;
+    m->owned[m->n] = owned || src != orig;
+    m->n++;
+    return 0;
+}
+
+// spawn-time copies and, after a failure, the parent ends of extra pipes
+static void release_extra(ProcInfo *ci, FdMap *m, bool failed) {
+    for (int i = 0; i < m->n; i++) {
+        if (m->owned[i]) {
+            close(m->src[i]);
+        }
+    }
+    m->n = 0;
+    if (failed) {
+        close_channel(ci);
+        close_extra_pipes(ci);
+    }
+}
+
+// the channel and extra_fds of ci, as dups for the child
+static int plan_extra(ProcInfo *ci, const char *name, FdMap *m) {
+    int max = ci->n_extra_fds + (ci->chan_size > 0 ? 2 : 0);
+    int rc;
+
+    m->n = 0;
+    m->max_dst = STDERR_FILENO;
+    if (max > SPAWN_MAX_EXTRA_FDS) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_EXTRA_FD, -1, E2BIG, max, name);
+    }
+    for (int i = 0; i < ci->n_extra_fds; i++) {
+        ExtraFd *e = &ci->extra_fds[i];
+        if (e->type == PROC_COM_PIPE) {
+            e->fd = -1; // nothing to close yet if we fail early
+        }
+        if (e->child_fd <= STDERR_FILENO ||
+                (ci->chan_size > 0 && (e->child_fd == SHM_CHANNEL_FD || e->child_fd == SHM_BELL_FD))) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_EXTRA_FD, -1, EINVAL, e->child_fd, name);
+        }
+        for (int j = 0; j < i; j++) {
+            if (ci->extra_fds[j].child_fd == e->child_fd) {
+                return report_SpawnError(&ci->err, SPAWN_STAGE_EXTRA_FD, -1, EINVAL, e->child_fd, name);
+            }
+        }
+        if (e->type != PROC_COM_FD && e->type != PROC_COM_PIPE) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_STREAM_TYPE, -1, EINVAL, e->type, name);
+        }
+        if (e->type == PROC_COM_FD && e->fd < 0) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_EXTRA_FD, -1, EBADF, e->child_fd, name);
+        }
+        if (e->child_fd > m->max_dst) {
+            m->max_dst = e->child_fd;
+        }
+    }
+    if (ci->chan_size > 0 && m->max_dst < SHM_BELL_FD) {
+        m->max_dst = SHM_BELL_FD;
+    }
+    if (ci->chan_size > 0) {
+        if ((rc = create_ShmChannel(ci->chan_size, &ci->p_chan, &ci->p_bell)) != 0 ||
+                (rc = add_extra(m, ci->p_chan, SHM_CHANNEL_FD, false)) != 0 ||
+                (rc = add_extra(m, ci->p_bell, SHM_BELL_FD, false)) != 0) {
+            release_extra(ci, m, true);
+            return report_SpawnError(&ci->err, SPAWN_STAGE_CHANNEL, -1, rc, 0, name);
+        }
+    }
+    for (int i = 0; i < ci->n_extra_fds; i++) {
+        ExtraFd *e = &ci->extra_fds[i];
+        int p[2];
+        if (e->type == PROC_COM_FD) {
+            int src = e->fd;
+            // a stream fd is closed by its own actions before ours run: pass a copy
+            if ((src == ci->p_stdin && proc_com_borrowed(ci->stdin_type)) ||
+                    (src == ci->p_stdout && proc_com_borrowed(ci->stdout_type)) ||
+                    (src == ci->p_stderr && proc_com_borrowed(ci->stderr_type))) {
+                src = fcntl(src, F_DUPFD_CLOEXEC, m->max_dst + 1);
+            }
+            rc = src < 0 ? errno : add_extra(m, src, e->child_fd, src != e->fd);
+        } else if (pipe2(p, O_CLOEXEC) != 0) {
+            rc = errno;
+        } else {
+            e->fd = p[e->input ? 1 : 0];
+            rc = add_extra(m, p[e->input ? 0 : 1], e->child_fd, true);
+            if (rc != 0) {
+                close(p[e->input ? 0 : 1]);
+            }
+        }
+        if (rc != 0) {
+            release_extra(ci, m, true);
+            return report_SpawnError(&ci->err, SPAWN_STAGE_EXTRA_FD, -1, rc, e->child_fd, name);
+        }
+    }
+    return 0;
+}
+
+int check_stream_fd(const SpawnTemplate *st, ProcInfo *ci, int stream, const char *name) {
+    const int fds[3] = {ci->p_stdin, ci->p_stdout, ci->p_stderr};
+    const ProcComType types[3] = {st->stdin_type, st->stdout_type, st->stderr_type};
+    struct stat sb;
+
+    if (fds[stream] < 0) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_STREAM_FD, stream, EBADF, fds[stream], name);
+    }
+    if (types[stream] == PROC_COM_SOCKET && (fstat(fds[stream], &sb) != 0 || !S_ISSOCK(sb.st_mode))) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_STREAM_FD, stream, ENOTSOCK, fds[stream], name);
+    }
+    return 0;
+}
+
+// a later stream dups the same fd (one socket for stdin and stdout)
+static bool fd_needed_later(const SpawnTemplate *st, const int *fds[3], int i) {
+    for (int j = i + 1; j < 3; j++) {
+        if (st->op[j] == SPAWN_OP_FD && *fds[j] == *fds[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// append the file actions for st; pipes[i] receives any pipe created for stream i
+// and extra the channel and extra_fds dups, see release_extra()
+static int add_actions(const SpawnTemplate *st, ProcInfo *ci, const char *name,
+        posix_spawn_file_actions_t *action, int pipes[3][2], FdMap *extra) {
+    const int *fds[3] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr};
+    int *sizes[3] = {&ci->sz_stdin, &ci->sz_stdout, &ci->sz_stderr};
+    int rc;
+
+    for (int i = 0; i < 3; i++) {
+        switch (st->op[i]) {
+            case SPAWN_OP_PIPE: {
+                int granted = take_pipe_reservoir(pipes[i], *sizes[i]);
+                if (granted >= 0) {
+                    if (*sizes[i] > 0) {
+                        *sizes[i] = granted;
+                    }
+                } else if (pipe2(pipes[i], O_CLOEXEC)) {
+                    return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, i, errno, 0, name);
+                } else if (*sizes[i] > 0) {
+                    *sizes[i] = set_pipe_size(pipes[i][0], *sizes[i]);
+                }
+                // on the child side; stdin reads from [0], stdout/stderr write to [1]
+                int child = pipes[i][i == STDIN_FILENO ? 0 : 1];
+                int parent = pipes[i][i == STDIN_FILENO ? 1 : 0];
+                posix_spawn_file_actions_addclose(action, parent);
+                posix_spawn_file_actions_adddup2(action, child, i);
+                posix_spawn_file_actions_addclose(action, child);
+                break;
+            }
+            case SPAWN_OP_SOCKETPAIR:
+                // [0] becomes the child's stdin and stdout, [1] the parent's p_stdout
+                if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pipes[i])) {
+                    return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, i, errno, 0, name);
+                }
+                posix_spawn_file_actions_addclose(action, pipes[i][1]);
+                posix_spawn_file_actions_adddup2(action, pipes[i][0], i);
+                posix_spawn_file_actions_addclose(action, pipes[i][0]);
+                break;
+            case SPAWN_OP_DUP_STDIN:
+                posix_spawn_file_actions_adddup2(action, STDIN_FILENO, STDOUT_FILENO);
+                break;
+            case SPAWN_OP_MEMFD:
+                // the child writes through its dup, the parent keeps the memfd itself
+                pipes[i][0] = memfd_create(stream_names[i], MFD_CLOEXEC);
+                if (pipes[i][0] < 0) {
+                    return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, i, errno, 1, name);
+                }
+                posix_spawn_file_actions_adddup2(action, pipes[i][0], i);
+                break;
+            case SPAWN_OP_FD:
+                if ((rc = check_stream_fd(st, ci, i, name)) != 0) {
+                    return rc;
+                }
+                posix_spawn_file_actions_adddup2(action, *fds[i], i);
+                if (*fds[i] != i && !fd_needed_later(st, fds, i)) {
+                    posix_spawn_file_actions_addclose(action, *fds[i]);
+                }
+                break;
+            case SPAWN_OP_OPEN:
+                posix_spawn_file_actions_addopen(action, i, st->path[i], st->oflags[i], 0644);
+                break;
+            case SPAWN_OP_CLOSE:
+                posix_spawn_file_actions_addclose(action, i);
+                break;
+            case SPAWN_OP_DUP_STDOUT:
+                posix_spawn_file_actions_adddup2(action, STDOUT_FILENO, STDERR_FILENO);
+                break;
+            case SPAWN_OP_INHERIT: // no-op
+                break;
+        }
+    }
+    if ((rc = plan_extra(ci, name, extra)) != 0) {
+        return rc;
+    }
+    // after the stream dups: stream pipes may sit on low fds until those are done
+    for (int i = 0; i < extra->n; i++) {
+        posix_spawn_file_actions_adddup2(action, extra->src[i], extra->dst[i]);
+    }
+    if (st->close_fds) {
+        for (int fd = STDERR_FILENO + 1; fd < extra->max_dst; fd++) {
+            if (!is_dst_FdMap(extra, fd)) {
+                posix_spawn_file_actions_addclose(action, fd);
+            }
+        }
+    }
+    int lowfd = extra->max_dst + 1;
+    if (st->close_fds && (rc = add_closefrom(action, lowfd)) != 0) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_CLOSE_FDS, -1, rc, 0, name);
+    }
+    return 0;
+}
+
+// after a successful spawn: close child-side of pipes, and assign returned pipes
+static void adopt_fds(const SpawnTemplate *st, ProcInfo *ci, int pipes[3][2]) {
+    int *fds[3] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr};
+
+    for (int i = 0; i < 3; i++) {
+        if (st->op[i] == SPAWN_OP_PIPE) {
+            int child = i == STDIN_FILENO ? 0 : 1;
+            close(pipes[i][child]);
+            *fds[i] = pipes[i][1 - child];
+        } else if (st->op[i] == SPAWN_OP_MEMFD) {
+            *fds[i] = pipes[i][0];
+        } else if (st->op[i] == SPAWN_OP_SOCKETPAIR) {
+            close(pipes[i][0]);
+            ci->p_stdin = -1;
+            ci->p_stdout = pipes[i][1];
+        } else if (st->op[i] != SPAWN_OP_FD && st->op[i] != SPAWN_OP_DUP_STDIN) {
+            // When PROC_COM_STDOUT is used, the caller should use just ci->p_stdout
+            *fds[i] = -1;
+        }
+    }
+}
+
+static void close_pipes(int pipes[3][2]) {
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (pipes[i][j] >= 0) {
+                close(pipes[i][j]);
+                pipes[i][j] = -1;
+            }
+        }
+    }
+}
+
+#define CLONE_STACK (64 * 1024)
+
+// clone3 (clone without it) and exec_ChildSetup() in place of posix_spawn,
+// for SPAWN_BACKEND_VFORK and what posix_spawn can't do: with CLONE_INTO_CGROUP
+// when ci->set_cgroup, so the child never runs outside its limits, with
+// execveat when exe_fd >= 0 (a preload_exec_fd() fd, exe its path), and
+// with ci's namespaces and pre-exec steps
+// returns ENOSYS, with nothing created, when set_cgroup needs clone3 and it is unavailable
+static int spawn_cloned(SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[],
+        int exe_fd, const char *exe) {
+    static __thread char *stack; // one per thread: pools spawn concurrently
+    int pipes[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+    const int *fds[3] = {&ci->p_stdin, &ci->p_stdout, &ci->p_stderr};
+    posix_spawn_file_actions_t unused;
+    char resolved[PATH_MAX];
+    sigset_t all, old;
+    FdMap extra = {0};
+    int rc;
+
+    if (stack == NULL && (stack = aligned_alloc(16, CLONE_STACK)) == NULL) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_ALLOC, -1, ENOMEM, 0, args[0]);
+    }
+    ChildSetup cs = {.fds = {-1, -1, -1}, .extra = &extra, .close_fds = st->close_fds, .cpus = ci->cpus,
+        .nice = ci->nice, .set_sched = ci->set_sched, .sched_policy = ci->sched_policy,
+        .sched_priority = ci->sched_priority, .set_pgroup = ci->set_pgroup,
+        .pgroup = ci->pgroup, .sigmask = child_mask_set ? &child_mask : &old,
+        .ns_fds = ci->ns_fds, .n_ns_fds = ci->n_ns_fds,
+        .rlimits = ci->rlimits, .n_rlimits = ci->n_rlimits, .pdeathsig = ci->pdeathsig,
+        .ppid = getpid(), .set_umask = ci->set_umask, .umask = ci->umask, .err_value = -2,
+        .exe = exe != NULL ? exe : st->exe, .use_exe_fd = exe_fd >= 0, .exe_fd = exe_fd,
+        .args = args, .env = env};
+    if (cs.exe == NULL && path_cache_enabled() && lookup_path_cache(args[0], resolved, sizeof(resolved))) {
+        cs.exe = resolved;
+    }
+    // same pipes and fd checks as a posix_spawn, the actions themselves are dropped
+    posix_spawn_file_actions_init(&unused);
+    rc = add_actions(st, ci, args[0], &unused, pipes, &extra);
+    posix_spawn_file_actions_destroy(&unused);
+    if (rc) {
+        close_pipes(pipes);
+        release_extra(ci, &extra, true);
+        return rc;
+    }
+    for (int i = 0; i < 3; i++) {
+        cs.op[i] = st->op[i];
+        cs.oflags[i] = st->oflags[i];
+        cs.paths[i] = st->path[i];
+        if (st->op[i] == SPAWN_OP_PIPE) {
+            cs.fds[i] = pipes[i][i == STDIN_FILENO ? 0 : 1];
+        } else if (st->op[i] == SPAWN_OP_MEMFD || st->op[i] == SPAWN_OP_SOCKETPAIR) {
+            cs.fds[i] = pipes[i][0];
+        } else if (st->op[i] == SPAWN_OP_FD) {
+            cs.fds[i] = *fds[i];
+        }
+    }
+
+    struct clone_args ca = {
+        .flags = CLONE_VM | CLONE_VFORK | (ci->set_cgroup ? CLONE_INTO_CGROUP : 0) | ci->clone_ns,
+        .exit_signal = SIGCHLD,
+        .stack = (unsigned long)stack,
+        .stack_size = CLONE_STACK,
+        .cgroup = ci->set_cgroup ? ci->cgroup_fd : 0,
+    };
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pid_t pid = clone3_run(&ca, exec_ChildSetup, &cs);
+    if (pid < 0 && errno == ENOSYS && !ci->set_cgroup) { // only clone3 places it into a cgroup
+        pid = clone(exec_ChildSetup, stack + CLONE_STACK, (int)ca.flags | SIGCHLD, &cs);
+    }
+    rc = pid < 0 ? errno : 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (pid < 0) {
+        close_pipes(pipes);
+        release_extra(ci, &extra, true);
+        if (rc != ENOSYS) {
+            report_SpawnError(&ci->err, ci->set_cgroup ? SPAWN_STAGE_CGROUP : SPAWN_STAGE_EXEC,
+                -1, rc, 0, args[0]);
+        }
+        return rc;
+    }
+    if (cs.err != 0) { // cloned, but exec failed
+        waitpid(pid, NULL, 0);
+        close_pipes(pipes);
+        release_extra(ci, &extra, true);
+        if (cs.err_value != -2) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_PRE_EXEC, -1, cs.err, cs.err_value, args[0]);
+        }
+        return report_SpawnError(&ci->err, SPAWN_STAGE_EXEC, -1, cs.err, 0, args[0]);
+    }
+    ci->pid = pid;
+    ci->pidfd = open_pidfd(pid);
+    adopt_fds(st, ci, pipes);
+    release_extra(ci, &extra, false);
+    return 0;
+}
+
+// posix_spawnattr for ci's scheduler and process group and the spawn sigmask;
+// false if none is set
+// glibc only takes SCHED_OTHER/FIFO/RR here, *late_sched asks the caller to
+// apply other policies (SCHED_BATCH, SCHED_IDLE) to the child itself
+static bool init_attr(const ProcInfo *ci, posix_spawnattr_t *attr, bool *late_sched) {
+    short flags = 0;
+
+    *late_sched = false;
+    if (!ci->set_sched && !ci->set_pgroup && !child_mask_set) {
+        return false;
+    }
+    posix_spawnattr_init(attr);
+    if (ci->set_sched) {
+        struct sched_param sp = {.sched_priority = ci->sched_priority};
+        if (posix_spawnattr_setschedpolicy(attr, ci->sched_policy) == 0) {
+            posix_spawnattr_setschedparam(attr, &sp);
+            flags |= POSIX_SPAWN_SETSCHEDULER;
+        } else {
+            *late_sched = true;
+        }
+    }
+    if (ci->set_pgroup) {
+        posix_spawnattr_setpgroup(attr, ci->pgroup);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    if (child_mask_set) {
+        posix_spawnattr_setsigmask(attr, &child_mask);
+        flags |= POSIX_SPAWN_SETSIGMASK;
+    }
+    posix_spawnattr_setflags(attr, flags);
+    return true;
+}
+
+// the child inherits the write end, O_CLOEXEC drops it at execve; called
+// once the spawn returned, keeps the read end on success
+static void finish_sentinel(ProcInfo *ci, int sentinel[2], int rc) {
+    if (sentinel[1] < 0) {
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &ci->t_spawned);
+    close(sentinel[1]);
+    if (rc == 0) {
+        ci->p_exec = sentinel[0];
+    } else {
+        close(sentinel[0]);
+    }
+    sentinel[0] = sentinel[1] = -1;
+}
+
+// spawn with a planned template; st->action is used as is when reusable
+static int spawn_with_env(SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]) {
+    int pipes[3][2] = {{-1, -1}, {-1, -1}, {-1, -1}};
+    int rc = 0;
+    posix_spawn_file_actions_t action, *pa = &st->action;
+    posix_spawnattr_t attr, *pattr = NULL;
+    cpu_set_t saved_cpus;
+    bool pinned = false, late_sched;
+    bool has_extra = ci->chan_size > 0 || ci->n_extra_fds > 0;
+    bool has_ns = ci->n_ns_fds > 0 || ci->clone_ns != 0;
+    bool has_pre_exec = ci->n_rlimits > 0 || ci->pdeathsig != 0 || ci->set_umask;
+    int sentinel[2] = {-1, -1};
+    FdMap extra = {0};
+
+    ci->pidfd = -1;
+    ci->p_chan = ci->p_bell = -1;
+    ci->err.stage = SPAWN_STAGE_NONE;
+    if (preflight_enabled() && (rc = preflight_spawn(st, ci, args)) != 0) {
+        return rc; // before a single pipe or fd exists
+    }
+    clock_gettime(CLOCK_REALTIME, &ci->t_start);
+    // the server protocol has no room for fds beyond 0-2 nor socketpairs: spawn those here
+    if (spawn_server_enabled() && !has_extra && !has_ns && !has_pre_exec && !ci->exec_sentinel &&
+            st->op[STDIN_FILENO] != SPAWN_OP_SOCKETPAIR) {
+        rc = spawn_via_server(st, ci, args, env);
+        TRACE3(spawn__exec, ci->pid, args[0], rc);
+        if (rc == 0) {
+            ci->pidfd = open_pidfd(ci->pid);
+            metrics_spawned(ci);
+            workload_spawned(ci, args[0]);
+        }
+        return rc;
+    }
+    if (ci->exec_sentinel) {
+        ci->p_exec = -1;
+        if (pipe2(sentinel, O_CLOEXEC) < 0) {
+            return report_SpawnError(&ci->err, SPAWN_STAGE_PIPE, -1, errno, 0, args[0]);
+        }
+    }
+    char exe[PATH_MAX];
+    int exe_fd = st->exe == NULL ? lookup_exec_fd(args[0], exe, sizeof(exe)) : -1;
+    if (ci->set_cgroup || exe_fd >= 0 || has_ns || has_pre_exec || backend == SPAWN_BACKEND_VFORK) {
+        rc = spawn_cloned(st, ci, args, env, exe_fd, exe_fd >= 0 ? exe : NULL);
+        if (rc != ENOSYS || has_ns || has_pre_exec) { // posix_spawn has no namespaces or pre-exec steps
+            if (rc == ENOSYS) {
+                report_SpawnError(&ci->err, SPAWN_STAGE_EXEC, -1, rc, 0, args[0]);
+            }
+            finish_sentinel(ci, sentinel, rc);
+            TRACE3(spawn__exec, ci->pid, args[0], rc);
+            if (rc == 0) {
+                metrics_spawned(ci);
+                workload_spawned(ci, args[0]);
+            }
+            return rc;
+        }
+        rc = 0; // no clone3: spawn as usual (and move the child afterwards)
+    }
+    if (!st->reusable || has_extra) { // the prebuilt actions only cover 0-2
+        pa = &action;
+        posix_spawn_file_actions_init(&action);
+        if ((rc = add_actions(st, ci, args[0], &action, pipes, &extra)) != 0) {
+            goto clean_up;
+        }
+    }
+    if (init_attr(ci, &attr, &late_sched)) {
+        pattr = &attr;
+    }
+    // posix_spawnattr has no affinity: the child inherits the mask of the
+    // spawning thread, so borrow it for the duration of the spawn
+    if (ci->cpus != NULL) {
+        if ((rc = pthread_getaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus)) != 0 ||
+                (rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), ci->cpus)) != 0) {
+            report_SpawnError(&ci->err, SPAWN_STAGE_AFFINITY, -1, rc, 0, args[0]);
+            goto clean_up;
+        }
+        pinned = true;
+    }
+    TRACE1(spawn__actions, args[0]);
+
+    char resolved[PATH_MAX];
+    if (st->exe != NULL || exe_fd >= 0) {
+        rc = posix_spawn(&(ci->pid), st->exe != NULL ? st->exe : exe, pa, pattr, args, env);
+    } else if (path_cache_enabled() && lookup_path_cache(args[0], resolved, sizeof(resolved))) {
+        rc = posix_spawn(&(ci->pid), resolved, pa, pattr, args, env);
+        if (rc == ENOENT) { // moved or removed since it was cached: search again
+            invalidate_path_cache(args[0]);
+            rc = posix_spawnp(&(ci->pid), args[0], pa, pattr, args, env);
+        }
+    } else {
+        rc = posix_spawnp(&(ci->pid), args[0], pa, pattr, args, env);
+    }
+    if (pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved_cpus), &saved_cpus);
+    }
+    finish_sentinel(ci, sentinel, rc);
+    TRACE3(spawn__exec, ci->pid, args[0], rc);
+    if(rc != 0) {
+        // posix_spawn returns the error, errno is not meaningful here
+        report_SpawnError(&ci->err, SPAWN_STAGE_EXEC, -1, rc, 0, args[0]);
+        goto clean_up;
+    }
+    if (ci->set_cgroup && join_cgroup(ci->cgroup_fd, ci->pid)) {
+        rc = errno;
+        report_SpawnError(&ci->err, SPAWN_STAGE_CGROUP, -1, rc, 0, args[0]);
+        kill(ci->pid, SIGKILL);
+        waitpid(ci->pid, NULL, 0);
+        if (ci->pidfd >= 0) {
+            close(ci->pidfd);
+        }
+        ci->pidfd = -1;
+        ci->pid = -1; // reaped: the pid may be someone else's by now
+        goto clean_up;
+    }
+    // nor a nice value, and a thread can't take back a nice increment without
+    // privilege, so renice the child; it keeps running if that fails
+    if (ci->nice != 0) {
+        errno = 0;
+        int prio = getpriority(PRIO_PROCESS, 0);
+        if (errno != 0 || setpriority(PRIO_PROCESS, ci->pid, prio + ci->nice) != 0) {
+            report_SpawnError(&ci->err, SPAWN_STAGE_SCHED, -1, errno, 0, args[0]);
+        }
+    }
+    if (late_sched) {
+        struct sched_param sp = {.sched_priority = ci->sched_priority};
+        if (sched_setscheduler(ci->pid, ci->sched_policy, &sp) != 0) {
+            report_SpawnError(&ci->err, SPAWN_STAGE_SCHED, -1, errno, 1, args[0]);
+        }
+    }
+    ci->pidfd = open_pidfd(ci->pid);
+    adopt_fds(st, ci, pipes);
+    TRACE2(spawn__done, ci->pid, args[0]);
+    metrics_spawned(ci);
+    workload_spawned(ci, args[0]);
+
+clean_up:
+    if (rc != 0) {
+        close_pipes(pipes);
+        finish_sentinel(ci, sentinel, rc);
+        if (ci->exec_sentinel && ci->p_exec >= 0) { // spawned, then given up on
+            close(ci->p_exec);
+            ci->p_exec = -1;
+        }
+    }
+    release_extra(ci, &extra, rc != 0);
+    if (pattr != NULL) {
+        posix_spawnattr_destroy(pattr);
+    }
+    if (pa == &action) {
+        posix_spawn_file_actions_destroy(&action);
+    }
+    return rc;
+}
+
+static int spawn_planned(SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]) {
+    EnvOverlay o;
+
+    if (ci->stdout_buf == PROC_BUF_DEFAULT && ci->stderr_buf == PROC_BUF_DEFAULT) {
+        return spawn_with_env(st, ci, args, env);
+    }
+    char **envp = stdbuf_env(&o, ci, env);
+    if (envp == NULL) {
+        return report_SpawnError(&ci->err, SPAWN_STAGE_ALLOC, -1, ENOMEM, 0, args[0]);
+    }
+    int rc = spawn_with_env(st, ci, args, envp);
+    free_EnvOverlay(&o);
+    return rc;
+}
+
+// create a subprocess and execute it
+// args and env are char*[] with last element being NULL
+// pipes are created O_CLOEXEC so concurrent spawns from other threads never
+// inherit them; adddup2 clears the flag on the child's stdXX copies
+int subprocess(ProcInfo *ci, char* args[], char* env[]) {
+    SpawnTemplate st;
+
+    TRACE1(spawn__start, args[0]);
+    ci->pidfd = -1;
+    if (plan_streams(&st, ci, args[0], &ci->err)) {
+        return 1;
+    }
+    st.reusable = false; // one-off: build the actions inline
+    return spawn_planned(&st, ci, args, env);
+}
+
+int init_SpawnTemplate(SpawnTemplate *st, const ProcInfo *shape) {
+    int unused[3][2];
+    ProcInfo ci = *shape;
+    FdMap extra = {0};
+
+    ci.chan_size = 0; // per spawn, never part of the shared actions
+    ci.n_extra_fds = 0;
+    if (plan_streams(st, shape, "(template)", NULL)) {
+        return 1;
+    }
+    if (st->reusable) {
+        posix_spawn_file_actions_init(&st->action);
+        if (add_actions(st, &ci, "(template)", &st->action, unused, &extra)) {
+            posix_spawn_file_actions_destroy(&st->action);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int spawn_SpawnTemplate(SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]) {
+    TRACE1(spawn__start, args[0]);
+    ci->stdin_type = st->stdin_type;
+    ci->stdout_type = st->stdout_type;
+    ci->stderr_type = st->stderr_type;
+    return spawn_planned(st, ci, args, env);
+}
+
+void close_SpawnTemplate(SpawnTemplate *st) {
+    if (st->reusable) {
+        posix_spawn_file_actions_destroy(&st->action);
+        st->reusable = false;
+    }
+}
@@ -0,0 +1,250 @@
+#ifndef SUBPROCESS_H
+#define SUBPROCESS_H
+
+#include <stdbool.h>
+#include <spawn.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef enum {
+    PROC_COM_INHERIT = 0,   // from parent
+    PROC_COM_NONE,          // use /dev/null
+    PROC_COM_PIPE,          // use pipe
+    PROC_COM_FD,            // use supplied fd for stdXX
+    PROC_COM_PATH,          // use supplied path for stdXX
+    PROC_COM_STDOUT,        // same as stdout; used for stderr only!
+    PROC_COM_CAPTURE,       // pipe drained into memory by run_and_capture(); stdout/stderr only
+    PROC_COM_MEMFD,         // anonymous memfd, mmap it after exit with map_memfd(); stdout/stderr only
+    PROC_COM_SOCKET,        // supplied connected socket for stdXX, see prepare_stream_socket()
+    PROC_COM_DUPLEX         // stdin and stdout both (set it on both): one socketpair whose
+                            // parent end is p_stdout alone, see shutdown_duplex()
+} ProcComType;
+
+// stdio buffering for a child's output stream, see stdbuf.h
+typedef enum {
+    PROC_BUF_DEFAULT = 0,   // the child's libc decides: full buffering on a pipe
+    PROC_BUF_LINE,          // flushed at every '\n'
+    PROC_BUF_NONE           // flushed at every write
+} ProcBuffering;
+
+// stream types that leave the parent holding a pipe end
+static inline bool proc_com_piped(ProcComType t) {
+    return t == PROC_COM_PIPE || t == PROC_COM_CAPTURE || t == PROC_COM_DUPLEX;
+}
+
+// stream types whose p_stdXX the caller supplies for the child to dup
+static inline bool proc_com_borrowed(ProcComType t) {
+    return t == PROC_COM_FD || t == PROC_COM_SOCKET;
+}
+
+// where a spawn failed
+typedef enum {
+    SPAWN_STAGE_NONE = 0,       // no error
+    SPAWN_STAGE_STREAM_TYPE,    // ProcComType not allowed for the stream (value: the type)
+    SPAWN_STAGE_STREAM_PATH,    // PROC_COM_PATH without a path
+    SPAWN_STAGE_STREAM_FD,      // PROC_COM_FD with a negative fd, PROC_COM_SOCKET without a socket (value: the fd)
+    SPAWN_STAGE_PIPE,           // pipe2() or memfd_create() for the stream
+    SPAWN_STAGE_CLOSE_FDS,      // setting up close_fds
+    SPAWN_STAGE_ALLOC,          // out of memory
+    SPAWN_STAGE_AFFINITY,       // borrowing the CPU mask for the child
+    SPAWN_STAGE_EXEC,           // creating or executing the child
+    SPAWN_STAGE_CGROUP,         // placing the child into its cgroup
+    SPAWN_STAGE_SCHED,          // renice/scheduler after the spawn; the child still runs
+    SPAWN_STAGE_SERVER,         // talking to the spawn server
+    SPAWN_STAGE_CHANNEL,        // creating the shared-memory result channel
+    SPAWN_STAGE_EXTRA_FD,       // an extra_fds entry (value: its child_fd)
+    SPAWN_STAGE_ADMISSION,      // shed by admission control under load, see admission.h
+    SPAWN_STAGE_PRE_EXEC,       // a pre-exec step in the child (value: the rlimit resource, -1 for others)
+    SPAWN_STAGE_PREFLIGHT       // the executable, or the stdin path (stream set), fails the preflight checks
+} SpawnStage;
+
+typedef struct {
+    SpawnStage stage;
+    int stream;                 // STDIN_FILENO.. for stream stages, -1 otherwise
+    int code;                   // errno value
+    int value;                  // stage specific, see SpawnStage
+    const char* name;           // args[0] of the failed spawn, not copied
+} SpawnError;
+
+// one fd beyond stdin/stdout/stderr for the child
+typedef struct {
+    int child_fd;       // fd number in the child, above STDERR_FILENO
+    ProcComType type;   // PROC_COM_FD: pass fd; PROC_COM_PIPE: a fresh pipe
+    bool input;         // PROC_COM_PIPE: the child reads from it instead of writing
+    int fd;             // PROC_COM_FD: the parent fd, borrowed;
+                        // PROC_COM_PIPE: receives the parent end, closed by close_ProcInfo()
+} ExtraFd;
+
+// one setrlimit() the child applies to itself before exec
+typedef struct {
+    int resource;       // RLIMIT_AS, RLIMIT_NOFILE, ...
+    rlim_t cur;
+    rlim_t max;
+} SpawnRlimit;
+
+// gets every spawn failure; must not keep err past the call
+typedef void (*SpawnLogger)(const SpawnError *err, void *data);
+
+typedef struct {
+    // input params
+    ProcComType stdin_type;
+    ProcComType stdout_type;
+    ProcComType stderr_type;
+    char* f_stdin;  // stdin file path
+    char* f_stdout; // stdout file path
+    char* f_stderr; // stderr file path
+    // input (PROC_COM_FD) and/or output (PROC_COM_PIPE, PROC_COM_MEMFD)
+    int p_stdin;  // stdin pipe fd, negative if not used
+    int p_stdout; // stdout pipe fd, negative if not used
+    int p_stderr; // stderr pipe fd, negative if not used
+    bool close_fds; // close every fd above stderr in the child
+    bool path_append; // PROC_COM_PATH outputs append instead of truncating
+    // how the child's stdio buffers stdout/stderr, through its environment
+    ProcBuffering stdout_buf;
+    ProcBuffering stderr_buf;
+    // PROC_COM_PIPE capacity in bytes, 0 for the kernel default; on return
+    // a requested size is replaced by the size the kernel actually granted
+    int sz_stdin;
+    int sz_stdout;
+    int sz_stderr;
+    // scheduling of the child, each left as inherited when zero
+    const cpu_set_t *cpus;  // CPU affinity, NULL to inherit
+    int nice;               // increment to the parent's nice value, like nice(1)
+    bool set_sched;         // apply sched_policy and sched_priority (SCHED_BATCH, SCHED_FIFO, ...)
+    int sched_policy;
+    int sched_priority;
+    bool set_pgroup;        // move the child into process group pgroup
+    pid_t pgroup;           // 0 makes the child the leader of a new group
+    bool pgroup_shared;     // set_pgroup: others share the group, so signals for this child go to it alone
+    bool set_cgroup;        // start the child inside cgroup_fd (CLONE_INTO_CGROUP)
+    int cgroup_fd;          // O_DIRECTORY fd of a cgroup v2 directory
+    const int *ns_fds;      // namespace fds the child setns()es into first, in order, see ns_pool.h
+    int n_ns_fds;
+    int clone_ns;           // CLONE_NEW* flags: fresh namespaces for this child alone
+    size_t chan_size;       // > 0: shared-memory record ring for the child, see shm_channel.h
+    ExtraFd *extra_fds;     // more fds for the child, n_extra_fds of them
+    int n_extra_fds;        // at most SPAWN_MAX_EXTRA_FDS (with a channel: two fewer)
+    bool exec_sentinel;     // report when the child's execve went through, see p_exec
+    // pre-exec steps the child applies to itself, in place of a prlimit or
+    // shell wrapper; any of them takes the clone3 path (not the spawn server)
+    const SpawnRlimit *rlimits; // n_rlimits of them
+    int n_rlimits;
+    int pdeathsig;          // PR_SET_PDEATHSIG: sent when the spawning thread exits, 0 for none
+    bool set_umask;
+    mode_t umask;
+    // output params
+    pid_t pid;
+    int pidfd; // pidfd of the child (readable on exit), negative if not available
+    int p_chan; // chan_size: memfd of the ring (SHM_CHANNEL_FD in the child), else -1
+    int p_bell; // chan_size: eventfd the child rings (SHM_BELL_FD in the child), else -1
+    // exec_sentinel: O_CLOEXEC pipe the child held until execve; EOF on it
+    // means the exec is done (or the child died), see watch_exec_ProcInfo()
+    int p_exec;
+    struct timespec t_start; // CLOCK_REALTIME right before the spawn
+    struct timespec t_spawned; // exec_sentinel: when posix_spawn returned
+    struct timespec t_exec;    // exec_sentinel: when EOF on p_exec was seen
+    struct timespec t_end;   // CLOCK_REALTIME when reap_ProcInfo() collected the exit
+    struct rusage usage;     // the child's CPU time, max RSS, faults and switches, by reap_ProcInfo()
+    SpawnError err;          // why the last spawn failed; stage is SPAWN_STAGE_NONE on success
+} ProcInfo;
+
+// open(2) flags the child uses for a PROC_COM_PATH stdout/stderr
+static inline int proc_path_oflags(const ProcInfo *ci) {
+    return O_CREAT | O_WRONLY | (ci->path_append ? O_APPEND : O_TRUNC);
+}
+
+// open path once for any number of children, to hand out as PROC_COM_FD:
+// O_APPEND puts every write() of every child whole at the current end, and
+// nothing truncates or walks the path per spawn; truncate empties it now
+// returns the fd (O_CLOEXEC, close it after the last spawn) or -1
+int open_shared_output(const char *path, bool truncate);
+
+// what subprocess() does to one child stream, resolved from its ProcComType
+typedef enum {
+    SPAWN_OP_INHERIT = 0,   // nothing
+    SPAWN_OP_PIPE,          // fresh pipe on every spawn
+    SPAWN_OP_FD,            // caller supplied fd on every spawn
+    SPAWN_OP_OPEN,          // open path
+    SPAWN_OP_CLOSE,         // close
+    SPAWN_OP_DUP_STDOUT,    // dup stdout onto stderr
+    SPAWN_OP_MEMFD,         // fresh memfd on every spawn
+    SPAWN_OP_SOCKETPAIR,    // stdin only: fresh socketpair, the parent end goes to p_stdout
+    SPAWN_OP_DUP_STDIN      // stdout only: dup stdin (the socketpair) onto stdout
+} SpawnOpType;
+
+// how subprocess() creates a child outside the spawn server; every backend
+// takes the same ProcInfo
+typedef enum {
+    SPAWN_BACKEND_AUTO = 0,     // posix_spawn where the libc vforks for it, else SPAWN_BACKEND_VFORK
+    SPAWN_BACKEND_POSIX_SPAWN,  // posix_spawn(): CLONE_VM | CLONE_VFORK on glibc >= 2.24 and musl
+    SPAWN_BACKEND_VFORK         // clone3, or clone on older kernels, CLONE_VM | CLONE_VFORK and
+                                // exec_ChildSetup(); for libcs whose posix_spawn forks
+} SpawnBackend;
+
+// a validated ProcComType combination that can be spawned many times
+// when no stream needs per-spawn fds, the file actions are built only once
+typedef struct {
+    ProcComType stdin_type;
+    ProcComType stdout_type;
+    ProcComType stderr_type;
+    SpawnOpType op[3];      // indexed by STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO
+    const char* path[3];    // SPAWN_OP_OPEN paths
+    int oflags[3];          // SPAWN_OP_OPEN flags
+    bool close_fds;
+    const char* exe;        // absolute executable to spawn, NULL to search PATH for args[0]
+    bool reusable;          // action is prebuilt and shared by every spawn
+    posix_spawn_file_actions_t action;
+} SpawnTemplate;
+
+void showError(bool noop, char *fmt,...);
+// route spawn failures to fn instead of the default stderr line, NULL drops them
+void set_spawn_logger(SpawnLogger fn, void *data);
+// "Failed to ..." message for err without the ERROR prefix; returns snprintf()'s length
+int format_SpawnError(const SpawnError *err, char *buf, size_t len);
+// fill *out (if not NULL) and pass it to the logger; returns code, or 1 if code is 0
+int report_SpawnError(SpawnError *out, SpawnStage stage, int stream, int code, int value, const char *name);
+void close_ProcInfo(ProcInfo *ci);
+// get a connected socket ready to be a child's PROC_COM_SOCKET stream:
+// blocking (the child shares its file status flags), TCP_NODELAY on TCP
+// sockets if nodelay, and SO_SNDBUF/SO_RCVBUF when > 0. The child then
+// reads and writes the socket itself; once it exited, shutdown() or close
+// the parent's fd so the peer sees EOF
+int prepare_stream_socket(int fd, bool nodelay, int sndbuf, int rcvbuf);
+// PROC_COM_DUPLEX: signal EOF on the child's stdin, its stdout stays readable
+int shutdown_duplex(ProcInfo *ci);
+// resize a pipe with F_SETPIPE_SZ; returns the granted capacity, or -1
+// if the pipe size can't be queried (an over-limit request keeps the old size)
+int set_pipe_size(int fd, int size);
+// wait4() for the child, filling t_end and usage; returns wait4()'s result
+// (0 with WNOHANG while it is still running), EINTR is retried when blocking
+pid_t reap_ProcInfo(ProcInfo *ci, int *status, int options);
+// exec_sentinel: block until EOF on p_exec, stamp t_exec and close it;
+// returns at once when p_exec is readable (an event loop saw POLLIN/POLLHUP)
+void exec_done_ProcInfo(ProcInfo *ci);
+// signal mask children start with instead of the spawning thread's, NULL to
+// go back to inheriting it; set it before spawning from several threads
+void set_spawn_sigmask(const sigset_t *mask);
+// pick the backend for later spawns; AUTO resolves it for this libc
+void set_spawn_backend(SpawnBackend b);
+// the backend in use, never AUTO
+SpawnBackend spawn_backend(void);
+const char *spawn_backend_name(SpawnBackend b);
+// create a subprocess and execute it
+// args and env are char*[] with last element being NULL
+int subprocess(ProcInfo *ci, char* args[], char* env[]);
+
+// validate the stream types, paths and close_fds of shape once
+int init_SpawnTemplate(SpawnTemplate *st, const ProcInfo *shape);
+// the SPAWN_OP_FD stdXX of ci must be open, and a socket for PROC_COM_SOCKET;
+// returns the reported error code
+int check_stream_fd(const SpawnTemplate *st, ProcInfo *ci, int stream, const char *name);
+// spawn like subprocess() with st's streams; only PROC_COM_FD fds, pipe sizes,
+// the scheduling fields and the pre-exec steps are read from ci
+int spawn_SpawnTemplate(SpawnTemplate *st, ProcInfo *ci, char* args[], char* env[]);
+void close_SpawnTemplate(SpawnTemplate *st);
+
+#endif // SUBPROCESS_H
@@ -0,0 +1,444 @@
+// C++17 RAII wrappers for subprocess(): descriptors and children are owned by
+// move-only objects, so they can live in containers and are released on every
+// path, exceptions included. Header-only; link the C sources as usual.
+#ifndef SUBPROCESS_HPP
+#define SUBPROCESS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+extern "C" {
+#include "subprocess.h"
+}
+
+namespace subproc {
+
+// a file descriptor closed on destruction; move-only so it is never closed twice
+class Fd {
+public:
+    Fd() noexcept = default;
+    explicit Fd(int fd) noexcept : fd_(fd) {}
+    Fd(const Fd &) = delete;
+    Fd &operator=(const Fd &) = delete;
+    Fd(Fd &&o) noexcept : fd_(o.release()) {}
+    Fd &operator=(Fd &&o) noexcept {
+        if (this != &o) {
+            reset(o.release());
+        }
+        return *this;
+    }
+    ~Fd() { reset(); }
+
+    int get() const noexcept { return fd_; }
+    explicit operator bool() const noexcept { return fd_ >= 0; }
+    // give up ownership without closing
+    int release() noexcept { return std::exchange(fd_, -1); }
+    void reset(int fd = -1) noexcept {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = fd;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+// both ends of a pipe2(O_CLOEXEC)
+struct Pipe {
+    Fd read_end;
+    Fd write_end;
+
+    static Pipe create(int flags = 0) {
+        int fds[2];
+        if (::pipe2(fds, O_CLOEXEC | flags) < 0) {
+            throw std::system_error(errno, std::generic_category(), "pipe2");
+        }
+        return Pipe{Fd(fds[0]), Fd(fds[1])};
+    }
+};
+
+// thrown when subprocess() fails; code() carries the errno value
+class SpawnFailure : public std::system_error {
+public:
+    explicit SpawnFailure(const SpawnError &err)
+        : std::system_error(err.code, std::generic_category(), message(err)), err_(err) {}
+    const SpawnError &error() const noexcept { return err_; }
+
+private:
+    // system_error appends strerror(code) itself
+    static std::string message(const SpawnError &err) {
+        char buf[512];
+        format_SpawnError(&err, buf, sizeof(buf));
+        std::string msg = buf, why = std::string(": ") + strerror(err.code);
+        if (msg.size() > why.size() && msg.compare(msg.size() - why.size(), why.size(), why) == 0) {
+            msg.resize(msg.size() - why.size());
+        }
+        return msg;
+    }
+    SpawnError err_;
+};
+
+namespace detail {
+
+// plan_streams() of subprocess.c, evaluated by the compiler
+constexpr SpawnOpType BAD_OP = static_cast<SpawnOpType>(-1);
+
+constexpr SpawnOpType stdin_op(ProcComType t) {
+    switch (t) {
+        case PROC_COM_INHERIT: return SPAWN_OP_INHERIT;
+        case PROC_COM_NONE: return SPAWN_OP_CLOSE;
+        case PROC_COM_PIPE: return SPAWN_OP_PIPE;
+        case PROC_COM_FD:
+        case PROC_COM_SOCKET: return SPAWN_OP_FD;
+        case PROC_COM_PATH: return SPAWN_OP_OPEN;
+        case PROC_COM_DUPLEX: return SPAWN_OP_SOCKETPAIR;
+        default: return BAD_OP;
+    }
+}
+
+constexpr SpawnOpType output_op(ProcComType t) {
+    switch (t) {
+        case PROC_COM_INHERIT: return SPAWN_OP_INHERIT;
+        case PROC_COM_NONE: return SPAWN_OP_CLOSE;
+        case PROC_COM_PIPE:
+        case PROC_COM_CAPTURE: return SPAWN_OP_PIPE;
+        case PROC_COM_FD:
+        case PROC_COM_SOCKET: return SPAWN_OP_FD;
+        case PROC_COM_PATH: return SPAWN_OP_OPEN;
+        case PROC_COM_MEMFD: return SPAWN_OP_MEMFD;
+        case PROC_COM_DUPLEX: return SPAWN_OP_DUP_STDIN;
+        default: return BAD_OP;
+    }
+}
+
+constexpr SpawnOpType stderr_op(ProcComType t, ProcComType out) {
+    if (t == PROC_COM_DUPLEX) {
+        return BAD_OP;
+    }
+    if (t != PROC_COM_STDOUT) {
+        return output_op(t);
+    }
+    if (out == PROC_COM_INHERIT) {
+        return SPAWN_OP_INHERIT;
+    }
+    return out == PROC_COM_NONE ? SPAWN_OP_CLOSE : SPAWN_OP_DUP_STDOUT;
+}
+
+} // namespace detail
+
+// stream setup for Process::spawn(); the ProcInfo fields it does not cover
+// (scheduling, cgroup, pipe sizes) can be set through info()
+class Options {
+public:
+    Options() noexcept {
+        ci_.p_stdin = ci_.p_stdout = ci_.p_stderr = -1;
+        ci_.pidfd = -1;
+    }
+    Options &stdin_pipe() noexcept { ci_.stdin_type = PROC_COM_PIPE; return *this; }
+    Options &stdout_pipe() noexcept { ci_.stdout_type = PROC_COM_PIPE; return *this; }
+    Options &stderr_pipe() noexcept { ci_.stderr_type = PROC_COM_PIPE; return *this; }
+    Options &stderr_to_stdout() noexcept { ci_.stderr_type = PROC_COM_STDOUT; return *this; }
+    // one socketpair for stdin and stdout, read and written through stdout()
+    Options &duplex() noexcept { ci_.stdin_type = ci_.stdout_type = PROC_COM_DUPLEX; return *this; }
+    // fd is only borrowed: it must stay open until spawn() returns
+    Options &stdin_fd(const Fd &fd) noexcept { return use_fd(ci_.stdin_type, ci_.p_stdin, fd); }
+    Options &stdout_fd(const Fd &fd) noexcept { return use_fd(ci_.stdout_type, ci_.p_stdout, fd); }
+    Options &stderr_fd(const Fd &fd) noexcept { return use_fd(ci_.stderr_type, ci_.p_stderr, fd); }
+    // a connected socket, borrowed the same way; see prepare_stream_socket()
+    Options &stdin_socket(const Fd &fd) noexcept { return use_fd(ci_.stdin_type, ci_.p_stdin, fd, PROC_COM_SOCKET); }
+    Options &stdout_socket(const Fd &fd) noexcept { return use_fd(ci_.stdout_type, ci_.p_stdout, fd, PROC_COM_SOCKET); }
+    Options &close_fds(bool on = true) noexcept { ci_.close_fds = on; return *this; }
+    ProcInfo &info() noexcept { return ci_; }
+    const ProcInfo &info() const noexcept { return ci_; }
+
+private:
+    Options &use_fd(ProcComType &type, int &slot, const Fd &fd, ProcComType as = PROC_COM_FD) noexcept {
+        type = as;
+        slot = fd.get();
+        return *this;
+    }
+    ProcInfo ci_{};
+};
+
+// a running (or finished, not yet destroyed) child and the parent ends of its pipes
+class Process {
+public:
+    Process() noexcept = default;
+    Process(const Process &) = delete;
+    Process &operator=(const Process &) = delete;
+    Process(Process &&o) noexcept { steal(o); }
+    Process &operator=(Process &&o) noexcept {
+        if (this != &o) {
+            kill_and_reap();
+            steal(o);
+        }
+        return *this;
+    }
+    // a child nobody waited for is killed and reaped so it can't linger as a zombie
+    ~Process() { kill_and_reap(); }
+
+    // args[0] is searched in PATH; env == nullptr passes an empty environment
+    static Process spawn(const std::vector<std::string> &args, const Options &opt = Options(),
+            char **env = environ) {
+        std::vector<char *> argv = make_argv(args);
+        return spawn(argv.data(), opt, env);
+    }
+    // a ready NULL-terminated argv, such as Command::argv()'s: nothing is allocated
+    static Process spawn(char **argv, const Options &opt = Options(), char **env = environ) {
+        ProcInfo ci = opt.info();
+        if (::subprocess(&ci, argv, env) != 0) {
+            throw SpawnFailure(ci.err);
+        }
+        return adopt(ci);
+    }
+
+    // spawn with the stream types fixed at compile time: a combination
+    // subprocess() would reject does not compile, and the streams skip its
+    // runtime planning; the types in opt are ignored, its fds and paths used
+    template <ProcComType In, ProcComType Out, ProcComType Err>
+    static Process spawn(const std::vector<std::string> &args, const Options &opt = Options(),
+            char **env = environ) {
+        std::vector<char *> argv = make_argv(args);
+        return spawn<In, Out, Err>(argv.data(), opt, env);
+    }
+    template <ProcComType In, ProcComType Out, ProcComType Err>
+    static Process spawn(char **argv, const Options &opt = Options(), char **env = environ) {
+        static_assert(detail::stdin_op(In) != detail::BAD_OP, "stdin can't be PROC_COM_STDOUT, CAPTURE or MEMFD");
+        static_assert(detail::output_op(Out) != detail::BAD_OP, "stdout can't be PROC_COM_STDOUT");
+        static_assert(detail::stderr_op(Err, Out) != detail::BAD_OP, "invalid stderr ProcComType");
+        static_assert((In == PROC_COM_DUPLEX) == (Out == PROC_COM_DUPLEX), "PROC_COM_DUPLEX is for stdin and stdout both");
+        ProcInfo ci = opt.info();
+        SpawnTemplate st{};
+        st.stdin_type = In;
+        st.stdout_type = Out;
+        st.stderr_type = Err;
+        st.op[STDIN_FILENO] = detail::stdin_op(In);
+        st.op[STDOUT_FILENO] = detail::output_op(Out);
+        st.op[STDERR_FILENO] = detail::stderr_op(Err, Out);
+        st.close_fds = ci.close_fds;
+        // only a path's presence is left to check at run time
+        if constexpr (In == PROC_COM_PATH) {
+            set_path(st, STDIN_FILENO, ci.f_stdin, O_RDONLY, ci, argv[0]);
+        }
+        if constexpr (Out == PROC_COM_PATH) {
+            set_path(st, STDOUT_FILENO, ci.f_stdout, proc_path_oflags(&ci), ci, argv[0]);
+        }
+        if constexpr (Err == PROC_COM_PATH) {
+            set_path(st, STDERR_FILENO, ci.f_stderr, proc_path_oflags(&ci), ci, argv[0]);
+        }
+        if (spawn_SpawnTemplate(&st, &ci, argv, env) != 0) {
+            throw SpawnFailure(ci.err);
+        }
+        return adopt(ci);
+    }
+
+    pid_t pid() const noexcept { return pid_; }
+    bool valid() const noexcept { return pid_ > 0; }
+    // readable once the child exits, -1 if the kernel has no pidfds
+    const Fd &pidfd() const noexcept { return pidfd_; }
+    Fd &stdin_fd() noexcept { return stdin_; }
+    Fd &stdout_fd() noexcept { return stdout_; }
+    Fd &stderr_fd() noexcept { return stderr_; }
+
+    // send sig through the pidfd when there is one, so a recycled pid is never hit
+    bool kill(int sig = SIGTERM) noexcept {
+        if (pid_ <= 0) {
+            return false;
+        }
+        if (pidfd_ && ::syscall(SYS_pidfd_send_signal, pidfd_.get(), sig, nullptr, 0) == 0) {
+            return true;
+        }
+        return ::kill(pid_, sig) == 0;
+    }
+
+    // block until the child exits; returns its wait status, and the same
+    // status again on later calls
+    int wait() {
+        if (pid_ > 0) {
+            ProcInfo ci{};
+            ci.pid = pid_;
+            if (reap_ProcInfo(&ci, &status_, 0) < 0) {
+                throw std::system_error(errno, std::generic_category(), "wait4");
+            }
+            usage_ = ci.usage;
+            pid_ = -1;
+            pidfd_.reset();
+        }
+        return status_;
+    }
+    // resource usage of the child once wait() returned
+    const struct rusage &usage() const noexcept { return usage_; }
+
+private:
+    static std::vector<char *> make_argv(const std::vector<std::string> &args) {
+        std::vector<char *> argv;
+        argv.reserve(args.size() + 1);
+        for (const std::string &a : args) {
+            argv.push_back(const_cast<char *>(a.c_str()));
+        }
+        argv.push_back(nullptr);
+        return argv;
+    }
+    static void set_path(SpawnTemplate &st, int stream, const char *path, int oflags,
+            ProcInfo &ci, const char *name) {
+        if (path == nullptr) {
+            report_SpawnError(&ci.err, SPAWN_STAGE_STREAM_PATH, stream, EINVAL, 0, name);
+            throw SpawnFailure(ci.err);
+        }
+        st.path[stream] = path;
+        st.oflags[stream] = oflags;
+    }
+    // take ownership of what subprocess() left in ci
+    static Process adopt(const ProcInfo &ci) noexcept {
+        Process p;
+        p.pid_ = ci.pid;
+        p.pidfd_.reset(ci.pidfd);
+        // PROC_COM_FD and PROC_COM_SOCKET fds stay the caller's
+        if (!proc_com_borrowed(ci.stdin_type)) {
+            p.stdin_.reset(ci.p_stdin);
+        }
+        if (!proc_com_borrowed(ci.stdout_type)) {
+            p.stdout_.reset(ci.p_stdout);
+        }
+        if (!proc_com_borrowed(ci.stderr_type)) {
+            p.stderr_.reset(ci.p_stderr);
+        }
+        return p;
+    }
+    void steal(Process &o) noexcept {
+        pid_ = std::exchange(o.pid_, -1);
+        status_ = o.status_;
+        usage_ = o.usage_;
+        pidfd_ = std::move(o.pidfd_);
+        stdin_ = std::move(o.stdin_);
+        stdout_ = std::move(o.stdout_);
+        stderr_ = std::move(o.stderr_);
+    }
+    void kill_and_reap() noexcept {
+        stdin_.reset();
+        stdout_.reset();
+        stderr_.reset();
+        if (pid_ > 0) {
+            kill(SIGKILL);
+            while (::waitpid(pid_, &status_, 0) < 0 && errno == EINTR);
+            pid_ = -1;
+        }
+        pidfd_.reset();
+    }
+
+    pid_t pid_ = -1;
+    int status_ = -1;
+    struct rusage usage_{};
+    Fd pidfd_;
+    Fd stdin_;
+    Fd stdout_;
+    Fd stderr_;
+};
+
+// the I-th runtime argument of a Command
+template <std::size_t I>
+struct Slot {
+    static constexpr std::size_t index = I;
+};
+template <std::size_t I>
+inline constexpr Slot<I> slot{};
+
+namespace detail {
+
+template <typename T>
+struct is_slot : std::false_type {};
+template <std::size_t I>
+struct is_slot<Slot<I>> : std::true_type {};
+
+template <typename T>
+constexpr std::size_t slot_count() {
+    if constexpr (is_slot<T>::value) {
+        return T::index + 1;
+    } else {
+        return 0;
+    }
+}
+
+inline char *arg_ptr(const char *s) noexcept { return const_cast<char *>(s); }
+inline char *arg_ptr(const std::string &s) noexcept { return const_cast<char *>(s.c_str()); }
+
+} // namespace detail
+
+// a fixed command line with N words, Slots of them filled in per call: the
+// constant words and the NULL terminator are laid out at compile time, and
+// argv() only copies that array and patches the slot pointers, so building
+// the argv allocates nothing. Make one with command():
+//   static constexpr auto wc = subproc::command("wc", "-l", subproc::slot<0>);
+//   auto p = wc.spawn(opt, path);
+template <std::size_t N, std::size_t Slots>
+class Command {
+public:
+    using Argv = std::array<char *, N + 1>;
+
+    template <typename... Parts>
+    constexpr explicit Command(const Parts &...parts) noexcept {
+        std::size_t pos = 0, k = 0;
+        (place(parts, pos++, k), ...);
+    }
+
+    // the argv with every slot set to its value; the values' strings must
+    // outlive the spawn
+    template <typename... Args>
+    Argv argv(const Args &...values) const noexcept {
+        static_assert(sizeof...(Args) == Slots, "one value per slot");
+        char *vals[Slots > 0 ? Slots : 1] = {detail::arg_ptr(values)...};
+        Argv v = base_;
+        for (std::size_t k = 0; k < n_slots_; k++) {
+            v[slot_pos_[k]] = vals[slot_index_[k]];
+        }
+        return v;
+    }
+
+    template <typename... Args>
+    Process spawn(const Options &opt, const Args &...values) const {
+        Argv v = argv(values...);
+        return Process::spawn(v.data(), opt);
+    }
+
+private:
+    template <typename T>
+    constexpr void place(const T &part, std::size_t pos, std::size_t &k) noexcept {
+        if constexpr (detail::is_slot<T>::value) {
+            slot_pos_[k] = pos;
+            slot_index_[k++] = T::index;
+            n_slots_ = k;
+        } else {
+            base_[pos] = const_cast<char *>(static_cast<const char *>(part));
+        }
+    }
+
+    Argv base_{};       // constant words, nullptr at the slots and the end
+    std::size_t slot_pos_[N > 0 ? N : 1]{};
+    std::size_t slot_index_[N > 0 ? N : 1]{};
+    std::size_t n_slots_ = 0;
+};
+
+// a Command from string literals and slot<I> placeholders
+template <typename... Parts>
+constexpr auto command(const Parts &...parts) noexcept {
+    constexpr std::size_t slots = std::max({std::size_t(0), detail::slot_count<Parts>()...});
+    return Command<sizeof...(Parts), slots>(parts...);
+}
+
+} // namespace subproc
+
+#endif // SUBPROCESS_HPP
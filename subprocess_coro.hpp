@@ -0,0 +1,324 @@
+// C++20 coroutines over subprocess.hpp: co_await child output, input and exit
+// on an EventLoop instead of blocking a thread in poll()/waitpid(). Every
+// coroutine of one Loop runs on the thread calling Loop::run(), so thousands
+// of children cost one thread and a few fds each. Header-only.
+#ifndef SUBPROCESS_CORO_HPP
+#define SUBPROCESS_CORO_HPP
+
+#include <coroutine>
+#include <exception>
+#include <list>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <poll.h>
+
+#include "subprocess.hpp"
+
+extern "C" {
+#include "event_loop.h"
+}
+
+namespace subproc {
+
+template <typename T = void> class Task;
+
+namespace detail {
+
+// hand control straight back to whoever awaited the finished coroutine
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        std::coroutine_handle<> next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+    void rethrow() const {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+template <typename T> struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object() noexcept;
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T result() {
+        rethrow();
+        return std::move(*value);
+    }
+};
+
+template <> struct Promise<void> : PromiseBase {
+    Task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+    void result() { rethrow(); }
+};
+
+} // namespace detail
+
+// a lazy coroutine: it starts when awaited (or passed to Loop) and resumes
+// its awaiter when done; exceptions surface at the co_await
+template <typename T> class Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() noexcept = default;
+    explicit Task(handle_type h) noexcept : h_(h) {}
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+    Task(Task &&o) noexcept : h_(std::exchange(o.h_, nullptr)) {}
+    Task &operator=(Task &&o) noexcept {
+        if (this != &o) {
+            reset();
+            h_ = std::exchange(o.h_, nullptr);
+        }
+        return *this;
+    }
+    ~Task() { reset(); }
+
+    bool done() const noexcept { return !h_ || h_.done(); }
+    handle_type handle() const noexcept { return h_; }
+    T result() { return h_.promise().result(); }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            handle_type h;
+            bool await_ready() noexcept { return !h || h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                h.promise().continuation = awaiting;
+                return h;
+            }
+            T await_resume() { return h.promise().result(); }
+        };
+        return Awaiter{h_};
+    }
+
+private:
+    // a frame destroyed while suspended also drops its pending fd waits
+    void reset() noexcept {
+        if (h_) {
+            h_.destroy();
+            h_ = nullptr;
+        }
+    }
+    handle_type h_;
+};
+
+namespace detail {
+template <typename T> Task<T> Promise<T>::get_return_object() noexcept {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+inline Task<void> Promise<void>::get_return_object() noexcept {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+} // namespace detail
+
+// owns an EventLoop and runs coroutines on it
+class Loop {
+public:
+    explicit Loop(EvLoopBackend backend = EVLOOP_EPOLL) {
+        if (init_EventLoop(&loop_, backend)) {
+            throw std::system_error(errno, std::generic_category(), "init_EventLoop");
+        }
+    }
+    Loop(const Loop &) = delete;
+    Loop &operator=(const Loop &) = delete;
+    ~Loop() {
+        tasks_.clear(); // frames first: their waits still point into the loop
+        close_EventLoop(&loop_);
+    }
+
+    EventLoop *get() noexcept { return &loop_; }
+
+    // start task now and keep it alive until it finishes inside run()
+    void start(Task<void> task) {
+        tasks_.push_back(std::move(task));
+        tasks_.back().handle().resume();
+    }
+
+    // run until task and everything start()ed has finished; returns task's
+    // result, and rethrows the first exception of a start()ed task
+    template <typename T> T run(Task<T> task) {
+        task.handle().resume();
+        while (!task.done() || !tasks_.empty()) {
+            reap_started();
+            if (task.done() && tasks_.empty()) {
+                break;
+            }
+            if (run_EventLoop(&loop_, -1) < 0 && errno != EINTR) {
+                throw std::system_error(errno, std::generic_category(), "run_EventLoop");
+            }
+        }
+        return task.result();
+    }
+    void run() {
+        run([]() -> Task<void> { co_return; }());
+    }
+
+private:
+    void reap_started() {
+        for (auto it = tasks_.begin(); it != tasks_.end();) {
+            if (!it->done()) {
+                ++it;
+                continue;
+            }
+            Task<void> t = std::move(*it);
+            it = tasks_.erase(it);
+            t.result();
+        }
+    }
+
+    EventLoop loop_;
+    std::list<Task<void>> tasks_;
+};
+
+// suspend until fd reports one of events; returns the poll(2) revents
+// only one coroutine may wait on a given fd at a time
+class FdReady {
+public:
+    FdReady(Loop &loop, int fd, unsigned events) noexcept : loop_(loop.get()), fd_(fd), events_(events) {}
+    FdReady(const FdReady &) = delete;
+    FdReady &operator=(const FdReady &) = delete;
+    ~FdReady() {
+        if (armed_) {
+            del_EventLoop(loop_, fd_);
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> h) {
+        h_ = h;
+        if (add_EventLoop(loop_, fd_, events_, on_ready, this)) {
+            err_ = errno;
+            return false; // resume right away and throw from await_resume()
+        }
+        armed_ = true;
+        return true;
+    }
+    unsigned await_resume() const {
+        if (err_ != 0) {
+            throw std::system_error(err_, std::generic_category(), "add_EventLoop");
+        }
+        return revents_;
+    }
+
+private:
+    static void on_ready(EventLoop *loop, int fd, unsigned revents, void *data) {
+        FdReady *self = static_cast<FdReady *>(data);
+        del_EventLoop(loop, fd); // one-shot: the next co_await registers again
+        self->armed_ = false;
+        self->revents_ = revents;
+        self->h_.resume();
+    }
+
+    EventLoop *loop_;
+    int fd_;
+    unsigned events_;
+    std::coroutine_handle<> h_;
+    unsigned revents_ = 0;
+    int err_ = 0;
+    bool armed_ = false;
+};
+
+inline FdReady readable(Loop &loop, int fd) noexcept { return FdReady(loop, fd, POLLIN); }
+inline FdReady writable(Loop &loop, int fd) noexcept { return FdReady(loop, fd, POLLOUT); }
+
+inline void set_nonblocking(const Fd &fd) {
+    int fl;
+    if (fd && ((fl = ::fcntl(fd.get(), F_GETFL)) < 0 || ::fcntl(fd.get(), F_SETFL, fl | O_NONBLOCK) < 0)) {
+        throw std::system_error(errno, std::generic_category(), "fcntl");
+    }
+}
+
+// read what is available from a non-blocking fd, waiting for data first if
+// there is none; 0 means EOF
+inline Task<size_t> read_some(Loop &loop, int fd, std::span<char> buf) {
+    for (;;) {
+        ssize_t n = ::read(fd, buf.data(), buf.size());
+        if (n >= 0) {
+            co_return static_cast<size_t>(n);
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        co_await readable(loop, fd);
+    }
+}
+
+// write all of data to a non-blocking fd, waiting whenever the pipe is full
+inline Task<void> write_all(Loop &loop, int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t n = ::write(fd, data.data(), data.size());
+        if (n >= 0) {
+            data.remove_prefix(static_cast<size_t>(n));
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN) {
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        co_await writable(loop, fd);
+    }
+}
+
+// a Process whose pipes are driven by a Loop; the pipe ends are switched to
+// O_NONBLOCK, and a write to a child that closed stdin fails with EPIPE
+// only once SIGPIPE is ignored
+class AsyncProcess {
+public:
+    AsyncProcess(Loop &loop, Process proc) : loop_(&loop), proc_(std::move(proc)) {
+        set_nonblocking(proc_.stdin_fd());
+        set_nonblocking(proc_.stdout_fd());
+        set_nonblocking(proc_.stderr_fd());
+    }
+    static AsyncProcess spawn(Loop &loop, const std::vector<std::string> &args,
+            const Options &opt = Options(), char **env = environ) {
+        return AsyncProcess(loop, Process::spawn(args, opt, env));
+    }
+
+    Process &process() noexcept { return proc_; }
+
+    // from the stdout pipe; 0 at EOF
+    Task<size_t> read_some(std::span<char> buf) { return subproc::read_some(*loop_, proc_.stdout_fd().get(), buf); }
+    Task<size_t> read_some_stderr(std::span<char> buf) { return subproc::read_some(*loop_, proc_.stderr_fd().get(), buf); }
+    // to the stdin pipe; data must stay valid until the task finishes
+    Task<void> write_all(std::string_view data) { return subproc::write_all(*loop_, proc_.stdin_fd().get(), data); }
+    // give the child EOF on stdin
+    void close_stdin() noexcept { proc_.stdin_fd().reset(); }
+
+    // wait for the child to exit and reap it; returns the wait status
+    // without a pidfd (kernels before 5.3) this blocks the loop in wait()
+    Task<int> exit() {
+        if (proc_.valid() && proc_.pidfd()) {
+            co_await readable(*loop_, proc_.pidfd().get());
+        }
+        co_return proc_.wait();
+    }
+
+private:
+    Loop *loop_;
+    Process proc_;
+};
+
+} // namespace subproc
+
+#endif // SUBPROCESS_CORO_HPP
@@ -0,0 +1,47 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// USDT probes (provider "subprocess") along the spawn lifecycle, for
+// bpftrace/perf on a live binary, e.g.
+//   bpftrace -e 'usdt:./main:subprocess:spawn__exec { printf("%d %s\n", arg0, str(arg1)); }'
+// A probe is a single nop plus an ELF note, so they stay compiled in; without
+// <sys/sdt.h> (systemtap-sdt-dev) or with -DSUBPROCESS_NO_SDT they vanish.
+//
+//   spawn__start   (argv0)             subprocess()/spawn_SpawnTemplate() entered
+//   spawn__actions (argv0)             file actions and attributes are ready
+//   spawn__exec    (pid, argv0, rc)    posix_spawn (or the spawn server) returned
+//   spawn__done    (pid, argv0)        cgroup, scheduling and pidfd handled
+//   spawn__error   (stage, code, argv0) any SpawnError being reported
+//   capture__read  (pid, fd, bytes)    each read of run_and_capture()
+//   reap           (pid, status)       reap_ProcInfo() collected the child
+//
+// The child's own execve() happens after posix_spawn returns to us; trace it
+// with the sched:sched_process_exec tracepoint.
+//
+// Built with -DSUBPROCESS_TRACE_HOOK every probe instead calls
+// subprocess_trace_hook() with its name, which the program must define:
+// for in-process timing of the phases, see bench/setup_bench.c.
+
+#if !defined(SUBPROCESS_TRACE_HOOK) && !defined(SUBPROCESS_NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SUBPROCESS_SDT 1
+#endif
+#endif
+
+#if defined(SUBPROCESS_TRACE_HOOK)
+void subprocess_trace_hook(const char *probe);
+#define TRACE1(name, a) subprocess_trace_hook(#name)
+#define TRACE2(name, a, b) subprocess_trace_hook(#name)
+#define TRACE3(name, a, b, c) subprocess_trace_hook(#name)
+#elif defined(SUBPROCESS_SDT)
+#define TRACE1(name, a) DTRACE_PROBE1(subprocess, name, a)
+#define TRACE2(name, a, b) DTRACE_PROBE2(subprocess, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(subprocess, name, a, b, c)
+#else
+#define TRACE1(name, a) ((void)0)
+#define TRACE2(name, a, b) ((void)0)
+#define TRACE3(name, a, b, c) ((void)0)
+#endif
+
+#endif // TRACE_H
@@ -0,0 +1,160 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+int init_Uring(Uring *r, unsigned entries) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return -errno;
+    }
+    r->features = p.features;
+    r->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) { // one mapping covers both rings
+        if (r->cq_sz > r->sq_sz) {
+            r->sq_sz = r->cq_sz;
+        }
+        r->cq_sz = r->sq_sz;
+    }
+    r->sq_ptr = mmap(NULL, r->sq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED) {
+        goto fail;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_ptr = r->sq_ptr;
+    } else {
+        r->cq_ptr = mmap(NULL, r->cq_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+            r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED) {
+            r->cq_ptr = NULL;
+            goto fail;
+        }
+    }
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+        r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        r->sqes = NULL;
+        goto fail;
+    }
+    r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+    r->sq_entries = p.sq_entries;
+    r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+    return 0;
+
+fail:
+    {
+        int err = -errno;
+        if (r->sq_ptr == MAP_FAILED) {
+            r->sq_ptr = NULL;
+        }
+        close_Uring(r);
+        return err;
+    }
+}
+
+void close_Uring(Uring *r) {
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_sz);
+    }
+    if (r->cq_ptr != NULL && r->cq_ptr != r->sq_ptr) {
+        munmap(r->cq_ptr, r->cq_sz);
+    }
+    if (r->sq_ptr != NULL) {
+        munmap(r->sq_ptr, r->sq_sz);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+static int enter_Uring(Uring *r, unsigned to_submit, unsigned wait_nr) {
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int rc = syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr, flags, NULL, 0);
+    return rc < 0 ? -errno : rc;
+}
+
+struct io_uring_sqe *get_sqe_Uring(Uring *r) {
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *r->sq_tail;
+
+    if (tail - head >= r->sq_entries) { // full: hand the queued ones to the kernel
+        if (enter_Uring(r, r->pending, 0) < 0) {
+            return NULL;
+        }
+        r->pending = 0;
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (tail - head >= r->sq_entries) {
+            return NULL;
+        }
+    }
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->pending++;
+    return sqe;
+}
+
+int submit_Uring(Uring *r, unsigned wait_nr, int timeout_ms) {
+    struct __kernel_timespec ts;
+
+    if (wait_nr > 0 && timeout_ms >= 0) {
+        struct io_uring_sqe *sqe = get_sqe_Uring(r);
+        if (sqe == NULL) {
+            return -EBUSY;
+        }
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (unsigned long)&ts;
+        sqe->len = 1;
+        sqe->off = wait_nr; // also completes once wait_nr other cqes arrived
+        sqe->user_data = URING_TIMEOUT_DATA;
+    }
+    int rc = enter_Uring(r, r->pending, wait_nr);
+    if (rc >= 0) {
+        r->pending = 0;
+        rc = 0;
+    }
+    return rc == -EINTR || rc == -ETIME ? 0 : rc;
+}
+
+struct io_uring_cqe *peek_Uring(Uring *r) {
+    unsigned head = *r->cq_head;
+
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &r->cqes[head & *r->cq_mask];
+}
+
+void seen_Uring(Uring *r) {
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int register_Uring(Uring *r, unsigned opcode, void *arg, unsigned nr_args) {
+    int rc = syscall(__NR_io_uring_register, r->fd, opcode, arg, nr_args);
+    return rc < 0 ? -errno : 0;
+}
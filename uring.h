@@ -0,0 +1,49 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+// minimal raw-syscall io_uring wrapper (no liburing dependency)
+typedef struct {
+    int fd;
+    // submission ring
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    // completion ring
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // mappings, for munmap
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_sz;
+    size_t cq_sz;
+    size_t sqes_sz;
+    unsigned features;
+    unsigned pending; // sqes queued but not yet submitted
+} Uring;
+
+// user_data reserved for internal timeout sqes
+#define URING_TIMEOUT_DATA UINT64_MAX
+
+int init_Uring(Uring *r, unsigned entries);
+void close_Uring(Uring *r);
+// get a zeroed sqe, submitting queued ones first when the ring is full; NULL on error
+struct io_uring_sqe *get_sqe_Uring(Uring *r);
+// submit queued sqes and wait for at least wait_nr completions
+// timeout_ms < 0 waits forever; returns 0 or -errno
+int submit_Uring(Uring *r, unsigned wait_nr, int timeout_ms);
+// next completion or NULL; call seen_Uring() once done with it
+struct io_uring_cqe *peek_Uring(Uring *r);
+void seen_Uring(Uring *r);
+// io_uring_register(2); returns 0 or -errno
+int register_Uring(Uring *r, unsigned opcode, void *arg, unsigned nr_args);
+
+#endif // URING_H
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "uring_capture.h"
+#include "metrics.h"
+
+// IORING_OP_READ_MULTISHOT (Linux 6.7) is newer than the installed headers
+#define URING_OP_READ_MULTISHOT 49
+#define URING_BUF_GROUP 0
+
+// user_data is the job pointer with the operation in its low bits
+enum { OP_WRITE_STDIN = 0, OP_READ_STDOUT, OP_READ_STDERR, OP_POLL_EXIT, OP_MASK = 3 };
+
+static inline uint64_t op_key(UringJob *job, unsigned op) {
+    return (uint64_t)(uintptr_t)job | op;
+}
+
+// hand buffer bid back to the kernel
+static void recycle_buf(UringCapture *u, unsigned bid) {
+    unsigned short tail = u->br->tail;
+    struct io_uring_buf *b = &u->br->bufs[tail & (u->n_bufs - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * u->buf_sz);
+    b->len = u->buf_sz;
+    b->bid = bid;
+    __atomic_store_n(&u->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+static struct io_uring_sqe *job_sqe(UringCapture *u, UringJob *job) {
+    struct io_uring_sqe *sqe = get_sqe_Uring(&u->ring);
+    if (sqe == NULL) {
+        showError(false, "Failed to queue io_uring request for subprocess %s!", job->args[0]);
+    }
+    return sqe;
+}
+
+static int queue_read(UringCapture *u, UringJob *job, int stream) {
+    struct io_uring_sqe *sqe = job_sqe(u, job);
+    if (sqe == NULL) {
+        return 1;
+    }
+    sqe->fd = stream == STDOUT_FILENO ? job->ci.p_stdout : job->ci.p_stderr;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    if (u->multishot) { // one sqe keeps completing until EOF or the buffers run dry
+        sqe->opcode = URING_OP_READ_MULTISHOT;
+    } else {
+        sqe->opcode = IORING_OP_READ;
+        sqe->len = u->buf_sz;
+        sqe->off = (uint64_t)-1;
+    }
+    sqe->user_data = op_key(job, stream == STDOUT_FILENO ? OP_READ_STDOUT : OP_READ_STDERR);
+    return 0;
+}
+
+static int queue_write(UringCapture *u, UringJob *job) {
+    struct io_uring_sqe *sqe = job_sqe(u, job);
+    if (sqe == NULL) {
+        return 1;
+    }
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = job->ci.p_stdin;
+    sqe->addr = (uint64_t)(uintptr_t)(job->input + job->written);
+    sqe->len = job->input_len - job->written;
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = op_key(job, OP_WRITE_STDIN);
+    return 0;
+}
+
+static int queue_poll_exit(UringCapture *u, UringJob *job) {
+    struct io_uring_sqe *sqe = job_sqe(u, job);
+    if (sqe == NULL) {
+        return 1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = job->ci.pidfd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = op_key(job, OP_POLL_EXIT);
+    return 0;
+}
+
+static void finish_job(UringCapture *u, UringJob *job) {
+    close_ProcInfo(&job->ci);
+    finish_CaptureBuf(&job->out.out);
+    finish_CaptureBuf(&job->out.err);
+    job->out.status = job->status;
+    u->n_running--;
+    u->n_done++;
+    if (!WIFEXITED(job->status) || WEXITSTATUS(job->status) != 0) {
+        u->n_failed++;
+    }
+    if (u->on_done != NULL) {
+        u->on_done(u, job, u->data);
+    }
+}
+
+// one stream (or the exit) of job is done
+static void settle(UringCapture *u, UringJob *job) {
+    if (--job->pending == 1 && job->ci.pidfd < 0) {
+        reap_ProcInfo(&job->ci, &job->status, 0); // no pidfd: reap once the output is done
+        job->pending--;
+    }
+    if (job->pending == 0) {
+        finish_job(u, job);
+    }
+}
+
+static void close_stdin(UringCapture *u, UringJob *job) {
+    close(job->ci.p_stdin);
+    job->ci.p_stdin = -1;
+    settle(u, job);
+}
+
+static void on_read(UringCapture *u, UringJob *job, int stream, int res, unsigned flags) {
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        ProcComType type = stream == STDOUT_FILENO ? job->ci.stdout_type : job->ci.stderr_type;
+        if (res > 0 && type == PROC_COM_CAPTURE) {
+            CaptureBuf *b = stream == STDOUT_FILENO ? &job->out.out : &job->out.err;
+            if (append_CaptureBuf(b, u->bufs + (size_t)bid * u->buf_sz, res)) {
+                showError(false, "Failed to capture output of subprocess %s!", job->args[0]);
+            }
+        }
+        recycle_buf(u, bid);
+    }
+    if (res > 0) {
+        if (!(flags & IORING_CQE_F_MORE) && queue_read(u, job, stream)) {
+            settle(u, job);
+        }
+        return;
+    }
+    if (res == -EINVAL && u->multishot) {
+        u->multishot = false; // kernel without multishot reads: one sqe per chunk
+        res = -EAGAIN;
+    }
+    if (res == -ENOBUFS || res == -EAGAIN || res == -EINTR) {
+        if (queue_read(u, job, stream)) {
+            settle(u, job);
+        }
+        return;
+    }
+    if (res < 0) {
+        showError(false, "Failed to read from subprocess %s: %s!", job->args[0], strerror(-res));
+    }
+    settle(u, job); // EOF
+}
+
+static void on_write(UringCapture *u, UringJob *job, int res) {
+    if (res > 0) {
+        job->written += res;
+        if (job->written == job->input_len || queue_write(u, job)) {
+            close_stdin(u, job);
+        }
+        return;
+    }
+    if (res == -EAGAIN) {
+        metrics_write_stalled(STDIN_FILENO);
+    }
+    if ((res == -EAGAIN || res == -EINTR) && queue_write(u, job) == 0) {
+        return;
+    }
+    if (res < 0 && res != -EPIPE) { // EPIPE: the child stopped reading, not an error here
+        showError(false, "Failed to write to subprocess %s: %s!", job->args[0], strerror(-res));
+    }
+    close_stdin(u, job);
+}
+
+int init_UringCapture(UringCapture *u, unsigned entries, unsigned n_bufs, unsigned buf_sz,
+        UringJobDone on_done, void *data) {
+    int err;
+
+    memset(u, 0, sizeof(*u));
+    u->ring.fd = -1;
+    u->on_done = on_done;
+    u->data = data;
+    u->multishot = true;
+    u->buf_sz = buf_sz ? buf_sz : URING_CAPTURE_BUF_SZ;
+    n_bufs = n_bufs ? n_bufs : URING_CAPTURE_BUFS;
+    for (u->n_bufs = 1; u->n_bufs < n_bufs && u->n_bufs < 32768; u->n_bufs *= 2);
+    if ((err = init_Uring(&u->ring, entries ? entries : URING_CAPTURE_ENTRIES)) < 0) {
+        showError(false, "Failed to set up io_uring: %s!", strerror(-err));
+        return 1;
+    }
+    u->br_sz = u->n_bufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_sz, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    u->bufs = mmap(NULL, (size_t)u->n_bufs * u->buf_sz, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED || u->bufs == MAP_FAILED) {
+        err = -errno;
+        goto fail;
+    }
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t)(uintptr_t)u->br,
+        .ring_entries = u->n_bufs,
+        .bgid = URING_BUF_GROUP,
+    };
+    if ((err = register_Uring(&u->ring, IORING_REGISTER_PBUF_RING, &reg, 1)) < 0) {
+        goto fail;
+    }
+    for (unsigned i = 0; i < u->n_bufs; i++) {
+        recycle_buf(u, i);
+    }
+    return 0;
+
+fail:
+    showError(false, "Failed to set up io_uring capture buffers: %s!", strerror(-err));
+    close_UringCapture(u);
+    return 1;
+}
+
+int submit_UringCapture(UringCapture *u, UringJob *job) {
+    job->owner = u;
+    job->status = -1;
+    job->written = 0;
+    reset_CaptureResult(&job->out);
+    job->spawn_rc = subprocess(&job->ci, job->args, job->env);
+    if (job->spawn_rc != 0) {
+        u->n_done++;
+        u->n_failed++;
+        if (u->on_done != NULL) {
+            u->on_done(u, job, u->data);
+        }
+        return job->spawn_rc;
+    }
+    u->n_running++;
+    job->pending = 1; // the child itself
+    if (proc_com_piped(job->ci.stdin_type) && job->ci.p_stdin >= 0) {
+        if (job->input_len > 0 && queue_write(u, job) == 0) {
+            job->pending++;
+        } else {
+            close(job->ci.p_stdin); // nothing to feed: give the child EOF
+            job->ci.p_stdin = -1;
+        }
+    }
+    if (proc_com_piped(job->ci.stdout_type) && job->ci.p_stdout >= 0 &&
+            queue_read(u, job, STDOUT_FILENO) == 0) {
+        job->pending++;
+    }
+    if (proc_com_piped(job->ci.stderr_type) && job->ci.p_stderr >= 0 &&
+            queue_read(u, job, STDERR_FILENO) == 0) {
+        job->pending++;
+    }
+    if (job->ci.pidfd >= 0 && queue_poll_exit(u, job)) {
+        close(job->ci.pidfd); // reap after the output instead
+        job->ci.pidfd = -1;
+    }
+    if (job->pending == 1 && job->ci.pidfd < 0) { // nothing to wait on
+        reap_ProcInfo(&job->ci, &job->status, 0);
+        job->pending = 0;
+        finish_job(u, job);
+    }
+    return 0;
+}
+
+size_t run_UringCapture(UringCapture *u) {
+    struct io_uring_cqe *cqe;
+
+    while (u->n_running > 0) {
+        if (peek_Uring(&u->ring) == NULL) {
+            int err = submit_Uring(&u->ring, 1, -1);
+            if (err < 0) {
+                showError(false, "io_uring capture failed: %s!", strerror(-err));
+                break;
+            }
+        }
+        while ((cqe = peek_Uring(&u->ring)) != NULL) {
+            uint64_t key = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            seen_Uring(&u->ring);
+            if (key == URING_TIMEOUT_DATA) {
+                continue;
+            }
+            UringJob *job = (UringJob *)(uintptr_t)(key & ~(uint64_t)OP_MASK);
+            switch (key & OP_MASK) {
+                case OP_WRITE_STDIN:
+                    on_write(u, job, res);
+                    break;
+                case OP_READ_STDOUT:
+                    on_read(u, job, STDOUT_FILENO, res, flags);
+                    break;
+                case OP_READ_STDERR:
+                    on_read(u, job, STDERR_FILENO, res, flags);
+                    break;
+                case OP_POLL_EXIT:
+                    reap_ProcInfo(&job->ci, &job->status, 0);
+                    settle(u, job);
+                    break;
+            }
+        }
+    }
+    return u->n_failed;
+}
+
+void close_UringCapture(UringCapture *u) {
+    if (u->ring.fd >= 0) {
+        close_Uring(&u->ring); // drops the buffer ring registration too
+    }
+    if (u->br != NULL && u->br != MAP_FAILED) {
+        munmap(u->br, u->br_sz);
+    }
+    if (u->bufs != NULL && u->bufs != MAP_FAILED) {
+        munmap(u->bufs, (size_t)u->n_bufs * u->buf_sz);
+    }
+    u->br = NULL;
+    u->bufs = NULL;
+}
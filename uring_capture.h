@@ -0,0 +1,70 @@
+#ifndef URING_CAPTURE_H
+#define URING_CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "subprocess.h"
+#include "capture.h"
+#include "uring.h"
+
+#define URING_CAPTURE_ENTRIES 256   // default submission queue size
+#define URING_CAPTURE_BUFS 256      // default provided buffers, power of two
+#define URING_CAPTURE_BUF_SZ 65536  // default size of one provided buffer
+
+typedef struct UringCapture UringCapture;
+
+// one child for the capture ring; like a runner Job, PROC_COM_CAPTURE streams
+// are collected into out and PROC_COM_PIPE outputs are read and dropped
+typedef struct UringJob {
+    char** args;        // NULL-terminated argv
+    char** env;         // passed to subprocess() as is
+    ProcInfo ci;
+    void *data;         // caller's
+    const char *input;  // written to a piped stdin, which is closed afterwards;
+                        // ignore SIGPIPE if the child may exit without reading it
+    size_t input_len;
+    // results
+    int spawn_rc;       // subprocess() rc, 0 if it started
+    int status;         // wait status, -1 if it never ran
+    CaptureResult out;
+    // ring bookkeeping
+    UringCapture *owner;
+    size_t written;     // bytes of input the child took
+    int pending;        // streams in flight plus the unreaped child
+} UringJob;
+
+typedef void (*UringJobDone)(UringCapture *u, UringJob *job, void *data);
+
+// spawn -> capture -> reap driven entirely by io_uring completions: pipe
+// reads select buffers from one provided buffer ring (multishot where the
+// kernel has IORING_OP_READ_MULTISHOT), stdin is fed by write sqes and exits
+// arrive as pidfd polls, so a whole batch of children costs one
+// io_uring_enter() per round instead of a read() per chunk
+struct UringCapture {
+    Uring ring;
+    struct io_uring_buf_ring *br;   // registered as buffer group 0
+    char *bufs;                     // n_bufs * buf_sz of buffer memory
+    size_t br_sz;
+    unsigned n_bufs;
+    unsigned buf_sz;
+    bool multishot;                 // cleared once the kernel rejects multishot reads
+    size_t n_running;
+    size_t n_done;
+    size_t n_failed;                // spawn failures and non-zero exits
+    UringJobDone on_done;
+    void *data;
+};
+
+// entries, n_bufs and buf_sz of 0 pick the URING_CAPTURE_ defaults
+// needs provided buffer rings (Linux 5.19)
+int init_UringCapture(UringCapture *u, unsigned entries, unsigned n_bufs, unsigned buf_sz,
+    UringJobDone on_done, void *data);
+// spawn job and queue its sqes; they reach the kernel with the next run round
+// returns subprocess()'s rc, on_done has already run for a failed spawn
+int submit_UringCapture(UringCapture *u, UringJob *job);
+// run until every submitted job finished; returns the number of failed jobs
+size_t run_UringCapture(UringCapture *u);
+void close_UringCapture(UringCapture *u);
+
+#endif // URING_CAPTURE_H
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+#include "worker.h"
+
+#define SPIN_LOOP_EVERY 64  // busy_poll_us: spins between non-blocking event loop passes
+
+static void dispatch(WorkerPool *p);
+static void fail_queued(WorkerPool *p, int err);
+
+static void put_le32(unsigned char *b, uint32_t v) {
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+}
+
+static uint32_t get_le32(const char *s) {
+    const unsigned char *b = (const unsigned char *)s;
+    return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ volatile("yield");
+#endif
+}
+
+static void complete(WorkerPool *p, WorkerRequest *req, int err, const char *resp, size_t len) {
+    p->n_pending--;
+    p->n_done++;
+    req->done(req, err, resp, len, req->ctx);
+}
+
+// hand out complete frames; false once the worker broke the protocol
+static bool parse_responses(Worker *w) {
+    WorkerPool *p = w->pool;
+    size_t max = p->opt.max_frame ? p->opt.max_frame : WORKER_MAX_FRAME;
+    size_t off = 0;
+
+    while (w->in.len - off >= 4) {
+        uint32_t len = get_le32(w->in.data + off);
+        if (len > max || w->busy == NULL) {
+            showError(false, "Worker %d of %s sent %s frame!", w->ci.pid, p->args[0],
+                w->busy == NULL ? "an unasked" : "an oversized");
+            return false;
+        }
+        if (w->in.len - off - 4 < len) {
+            break;
+        }
+        WorkerRequest *req = w->busy;
+        w->busy = NULL;
+        w->served++;
+        complete(p, req, 0, w->in.data + off + 4, len);
+        off += 4 + len;
+        if (p->opt.max_requests > 0 && w->served >= p->opt.max_requests && !w->retiring) {
+            w->retiring = true; // EOF on stdin asks it to exit; it's replaced then
+            finish_StdinFeeder(&w->feed);
+        }
+    }
+    memmove(w->in.data, w->in.data + off, w->in.len - off);
+    w->in.len -= off;
+    return true;
+}
+
+static void start_worker(Worker *w);
+
+// the child is gone or unusable: answer its request, reap, maybe restart
+static void worker_down(Worker *w, bool protocol_error) {
+    WorkerPool *p = w->pool;
+    int status = -1;
+
+    if (w->ci.p_stdout >= 0) {
+        del_EventLoop(&p->loop, w->ci.p_stdout);
+    }
+    if (w->ci.pidfd >= 0) {
+        del_EventLoop(&p->loop, w->ci.pidfd);
+    }
+    close_StdinFeeder(&w->feed);
+    if (protocol_error || !w->retiring) {
+        kill(w->ci.pid, SIGKILL); // a zombie doesn't mind, a wedged child can't block us
+    }
+    reap_ProcInfo(&w->ci, &status, 0);
+    close_ProcInfo(&w->ci);
+    w->alive = false;
+    p->n_alive--;
+    bool crashed = protocol_error || !w->retiring || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    if (w->busy != NULL) {
+        WorkerRequest *req = w->busy;
+        w->busy = NULL;
+        complete(p, req, EPIPE, NULL, 0);
+    }
+    if (crashed && !p->closing) {
+        w->crashes++;
+        p->n_crashes++;
+    }
+    if (!p->closing && (!crashed || p->opt.max_crashes == 0 || w->crashes < p->opt.max_crashes)) {
+        p->n_restarts++;
+        start_worker(w);
+    }
+    if (p->n_alive == 0 && !p->closing) {
+        fail_queued(p, ECANCELED);
+    }
+}
+
+static void on_output(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Worker *w = data;
+    ssize_t n;
+
+    while ((n = fill_CaptureBuf(&w->in, fd)) > 0);
+    if (!parse_responses(w)) {
+        worker_down(w, true);
+    } else if (n == 0 || (errno != EAGAIN && errno != EINTR)) {
+        worker_down(w, false);
+    }
+    dispatch(w->pool);
+}
+
+static void on_worker_exit(EventLoop *loop, int fd, unsigned revents, void *data) {
+    Worker *w = data;
+
+    // a recycled worker may have exited right after its last response
+    while (fill_CaptureBuf(&w->in, w->ci.p_stdout) > 0);
+    worker_down(w, !parse_responses(w));
+    dispatch(w->pool);
+}
+
+static void start_worker(Worker *w) {
+    WorkerPool *p = w->pool;
+    ProcInfo *ci = &w->ci;
+
+    memset(ci, 0, sizeof(*ci));
+    ci->stdin_type = PROC_COM_PIPE;
+    ci->stdout_type = PROC_COM_PIPE;
+    ci->stderr_type = p->opt.stderr_type;
+    ci->p_stdin = ci->p_stdout = ci->p_stderr = -1;
+    w->in.len = 0;
+    w->served = 0;
+    w->retiring = false;
+    if (subprocess(ci, p->args, p->env) != 0) {
+        return;
+    }
+    int fl = fcntl(ci->p_stdout, F_GETFL);
+    if (fcntl(ci->p_stdout, F_SETFL, fl | O_NONBLOCK) ||
+            init_StdinFeeder(&w->feed, &p->loop, ci, NULL, NULL) ||
+            add_EventLoop(&p->loop, ci->p_stdout, POLLIN, on_output, w) ||
+            (ci->pidfd >= 0 && add_EventLoop(&p->loop, ci->pidfd, POLLIN, on_worker_exit, w))) {
+        showError(false, "Failed to watch worker %d of %s!", ci->pid, p->args[0]);
+        if (ci->p_stdin >= 0) {
+            del_EventLoop(&p->loop, ci->p_stdin);
+        }
+        if (ci->p_stdout >= 0) {
+            del_EventLoop(&p->loop, ci->p_stdout);
+        }
+        kill(ci->pid, SIGKILL);
+        reap_ProcInfo(ci, NULL, 0);
+        close_ProcInfo(ci);
+        return;
+    }
+    w->alive = true;
+    p->n_alive++;
+}
+
+static void dispatch(WorkerPool *p) {
+    for (int i = 0; i < p->n_workers && p->head != NULL; i++) {
+        Worker *w = &p->workers[i];
+        if (!w->alive || w->retiring || w->busy != NULL) {
+            continue;
+        }
+        WorkerRequest *req = p->head;
+        if ((p->head = req->next) == NULL) {
+            p->tail = NULL;
+        }
+        w->busy = req;
+        put_le32(req->hdr, req->len);
+        if (feed_StdinFeeder(&w->feed, (const char *)req->hdr, 4, NULL, NULL) ||
+                (req->len > 0 && feed_StdinFeeder(&w->feed, req->data, req->len, NULL, NULL)) ||
+                (p->opt.busy_poll_us > 0 && flush_StdinFeeder(&w->feed))) {
+            worker_down(w, false); // fails req; the restarted worker takes the next one
+        }
+    }
+}
+
+static void fail_queued(WorkerPool *p, int err) {
+    while (p->head != NULL) {
+        WorkerRequest *req = p->head;
+        if ((p->head = req->next) == NULL) {
+            p->tail = NULL;
+        }
+        complete(p, req, err, NULL, 0);
+    }
+}
+
+int init_WorkerPool(WorkerPool *p, char* args[], char* env[], int n_workers, const WorkerOptions *opt) {
+    memset(p, 0, sizeof(*p));
+    p->args = args;
+    p->env = env;
+    if (opt != NULL) {
+        p->opt = *opt;
+    }
+    p->n_workers = n_workers > 0 ? n_workers : 1;
+    p->n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((p->workers = calloc(p->n_workers, sizeof(Worker))) == NULL) {
+        showError(false, "Failed to allocate workers for %s!", args[0]);
+        return 1;
+    }
+    if (init_EventLoop(&p->loop, p->opt.backend)) {
+        free(p->workers);
+        p->workers = NULL;
+        return 1;
+    }
+    for (int i = 0; i < p->n_workers; i++) {
+        p->workers[i].pool = p;
+        start_worker(&p->workers[i]);
+    }
+    if (p->n_alive == 0) {
+        close_WorkerPool(p);
+        return 1;
+    }
+    return 0;
+}
+
+int submit_WorkerPool(WorkerPool *p, WorkerRequest *req) {
+    if (req->len > UINT32_MAX || p->closing) {
+        errno = p->closing ? ECANCELED : EMSGSIZE;
+        return 1;
+    }
+    req->next = NULL;
+    if (p->tail != NULL) {
+        p->tail->next = req;
+    } else {
+        p->head = req;
+    }
+    p->tail = req;
+    p->n_pending++;
+    return 0;
+}
+
+// busy_poll_us: read the stdout of every worker with a request in flight
+// until nothing was answered for that long, polling the loop itself now
+// and then without waiting for exits and writes that didn't fit; false
+// once it went idle with requests still pending
+static bool spin(WorkerPool *p) {
+    uint64_t idle_ns = (uint64_t)p->opt.busy_poll_us * 1000;
+    uint64_t last = now_ns();
+
+    for (unsigned i = 1; p->n_pending > 0; i++) {
+        size_t done = p->n_done;
+        for (int k = 0; k < p->n_workers; k++) {
+            Worker *w = &p->workers[k];
+            if (w->alive && w->busy != NULL) {
+                on_output(&p->loop, w->ci.p_stdout, POLLIN, w);
+            }
+        }
+        if (i % SPIN_LOOP_EVERY == 0 && run_EventLoop(&p->loop, 0) < 0 && errno != EINTR) {
+            return false;
+        }
+        if (p->n_done != done) {
+            p->n_spun += p->n_done - done;
+            last = now_ns();
+        } else if (now_ns() - last >= idle_ns) {
+            p->n_slept++;
+            return false;
+        } else if (p->n_cpus > 1) {
+            cpu_relax();
+        } else {
+            sched_yield(); // the one CPU is the worker's: spinning would only delay its answer
+        }
+    }
+    return true;
+}
+
+void run_WorkerPool(WorkerPool *p) {
+    if (p->n_alive == 0) {
+        fail_queued(p, ECANCELED);
+    }
+    dispatch(p);
+    while (p->n_pending > 0) {
+        if (p->opt.busy_poll_us > 0 && spin(p)) {
+            break;
+        }
+        if (run_EventLoop(&p->loop, -1) < 0 && errno != EINTR) {
+            showError(false, "Worker pool event loop failed: %s!", strerror(errno));
+            break;
+        }
+    }
+}
+
+void close_WorkerPool(WorkerPool *p) {
+    p->closing = true;
+    fail_queued(p, ECANCELED);
+    for (int i = 0; i < p->n_workers; i++) {
+        Worker *w = &p->workers[i];
+        if (w->alive) {
+            w->retiring = true;
+            finish_StdinFeeder(&w->feed);
+        }
+    }
+    // idle workers see EOF and exit; the loop answers what was in flight
+    while (p->n_alive > 0 && run_EventLoop(&p->loop, -1) >= 0);
+    for (int i = 0; i < p->n_workers; i++) {
+        free(p->workers[i].in.data);
+    }
+    free(p->workers);
+    p->workers = NULL;
+    close_EventLoop(&p->loop);
+}
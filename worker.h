@@ -0,0 +1,96 @@
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "subprocess.h"
+#include "event_loop.h"
+#include "feeder.h"
+#include "capture.h"
+
+#define WORKER_MAX_FRAME (64 * 1024 * 1024)   // default limit on a response frame
+
+typedef struct WorkerPool WorkerPool;
+typedef struct WorkerRequest WorkerRequest;
+
+// err is 0 with the response frame's payload (valid during the call only),
+// EPIPE if the worker died before answering, ECANCELED if the pool closed
+// or has no workers left
+typedef void (*WorkerDone)(WorkerRequest *req, int err, const char *resp, size_t len, void *data);
+
+// one request frame; the caller keeps it and data alive until done runs
+struct WorkerRequest {
+    const char *data;
+    size_t len;
+    WorkerDone done;
+    void *ctx;
+    // pool bookkeeping
+    WorkerRequest *next;
+    unsigned char hdr[4];
+};
+
+typedef struct {
+    WorkerPool *pool;
+    ProcInfo ci;
+    StdinFeeder feed;
+    CaptureBuf in;          // response bytes not parsed yet
+    WorkerRequest *busy;    // the request the worker is answering
+    size_t served;          // responses since this child started
+    int crashes;            // exits this slot didn't ask for
+    bool alive;
+    bool retiring;          // stdin closed after max_requests, waiting for the exit
+} Worker;
+
+typedef struct {
+    ProcComType stderr_type;    // worker stderr, PROC_COM_INHERIT by default
+    size_t max_requests;        // recycle a worker after this many responses, 0 never
+    int max_crashes;            // stop restarting a slot after this many crashes, 0 never
+    size_t max_frame;           // larger responses kill the worker, 0 for WORKER_MAX_FRAME
+    EvLoopBackend backend;
+    // low latency: run_WorkerPool() reads the answering workers' stdout in
+    // a loop instead of sleeping in the event loop, and goes back to
+    // sleeping once nothing came for this long; requests are written at
+    // submit or dispatch time, header and payload in one writev(). It burns
+    // the calling thread's CPU while requests are in flight, so give a hot
+    // pool a thread (and a few workers) of its own. 0 for none
+    int busy_poll_us;
+} WorkerOptions;
+
+// n long-lived children of args speaking length-prefixed frames: every
+// request and response is a 4-byte little-endian length then the payload.
+// Each worker has one request in flight, so responses route back in order;
+// requests queue until a worker is idle. A worker that exits is restarted
+// (at once: a tool that crashes on startup burns through max_crashes)
+struct WorkerPool {
+    EventLoop loop;
+    char** args;
+    char** env;
+    WorkerOptions opt;
+    Worker *workers;
+    int n_workers;
+    int n_alive;
+    WorkerRequest *head;    // queued, not sent yet
+    WorkerRequest *tail;
+    size_t n_pending;       // queued plus in flight
+    size_t n_restarts;
+    size_t n_crashes;
+    size_t n_done;          // requests answered or failed
+    size_t n_spun;          // of those, in the busy_poll_us loop
+    size_t n_slept;         // times it went idle and fell back to the event loop
+    long n_cpus;            // online, at init: with one, the busy_poll_us loop yields instead of spinning
+    bool closing;
+};
+
+// start n_workers children; opt may be NULL for the defaults; args and env
+// must stay valid, restarts use them again
+int init_WorkerPool(WorkerPool *p, char* args[], char* env[], int n_workers, const WorkerOptions *opt);
+// queue req; no callback runs before run_WorkerPool()
+int submit_WorkerPool(WorkerPool *p, WorkerRequest *req);
+// dispatch until every submitted request got its callback
+void run_WorkerPool(WorkerPool *p);
+// close every worker's stdin, wait for them to exit, fail what is still queued
+void close_WorkerPool(WorkerPool *p);
+
+#endif // WORKER_H
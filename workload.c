@@ -0,0 +1,261 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "workload.h"
+
+#define WORKLOAD_BUCKETS 256
+#define WORKLOAD_BUFSIZ (256 * 1024)
+
+// a child between workload_spawned() and workload_reaped()
+typedef struct Pending {
+    struct Pending *next;
+    WorkloadRecord rec;
+    pid_t pid;
+} Pending;
+
+static bool recording = false;
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *rec_out;
+static uint64_t rec_t0;         // CLOCK_REALTIME ns the recording started
+static uint64_t rec_prev;       // start_ns of the last record written
+static Pending *pending[WORKLOAD_BUCKETS];
+
+static inline uint64_t ns_of(const struct timespec *ts) {
+    return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static void put_varint(FILE *f, uint64_t v) {
+    unsigned char b[10];
+    int n = 0;
+
+    do {
+        b[n++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+        v >>= 7;
+    } while (v != 0);
+    fwrite(b, 1, n, f);
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static void drop_pending_locked(void) {
+    for (int i = 0; i < WORKLOAD_BUCKETS; i++) {
+        while (pending[i] != NULL) {
+            Pending *p = pending[i];
+            pending[i] = p->next;
+            free(p);
+        }
+    }
+}
+
+int start_workload_recording(const char *path) {
+    struct timespec now;
+    FILE *f = fopen(path, "we");
+
+    if (f == NULL) {
+        showError(false, "Cannot record the workload to %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    setvbuf(f, NULL, _IOFBF, WORKLOAD_BUFSIZ);
+    fwrite(WORKLOAD_MAGIC, 1, 4, f);
+    fputc(WORKLOAD_VERSION, f);
+    clock_gettime(CLOCK_REALTIME, &now);
+    pthread_mutex_lock(&rec_lock);
+    if (rec_out != NULL) {
+        fclose(rec_out);
+    }
+    drop_pending_locked();
+    rec_out = f;
+    rec_t0 = ns_of(&now);
+    rec_prev = 0;
+    recording = true;
+    pthread_mutex_unlock(&rec_lock);
+    return 0;
+}
+
+void stop_workload_recording(void) {
+    pthread_mutex_lock(&rec_lock);
+    recording = false;
+    if (rec_out != NULL) {
+        fclose(rec_out);
+        rec_out = NULL;
+    }
+    drop_pending_locked();
+    pthread_mutex_unlock(&rec_lock);
+}
+
+bool workload_recording(void) {
+    return recording;
+}
+
+static Pending **find_locked(pid_t pid) {
+    Pending **pp = &pending[(unsigned)pid % WORKLOAD_BUCKETS];
+
+    while (*pp != NULL && (*pp)->pid != pid) {
+        pp = &(*pp)->next;
+    }
+    return pp;
+}
+
+void workload_spawned(const ProcInfo *ci, const char *name) {
+    Pending *p;
+
+    if (!recording || (p = calloc(1, sizeof(Pending))) == NULL) {
+        return;
+    }
+    uint64_t start = ns_of(&ci->t_start);
+    p->pid = ci->pid;
+    p->rec.types[STDIN_FILENO] = ci->stdin_type;
+    p->rec.types[STDOUT_FILENO] = ci->stdout_type;
+    p->rec.types[STDERR_FILENO] = ci->stderr_type;
+    snprintf(p->rec.name, sizeof(p->rec.name), "%s", name);
+    pthread_mutex_lock(&rec_lock);
+    if (!recording) {
+        pthread_mutex_unlock(&rec_lock);
+        free(p);
+        return;
+    }
+    p->rec.start_ns = start > rec_t0 ? start - rec_t0 : 0;
+    Pending **pp = &pending[(unsigned)p->pid % WORKLOAD_BUCKETS];
+    p->next = *pp;
+    *pp = p;
+    pthread_mutex_unlock(&rec_lock);
+}
+
+void workload_read(const ProcInfo *ci, int stream, size_t n) {
+    if (!recording || stream < STDOUT_FILENO || stream > STDERR_FILENO) {
+        return;
+    }
+    pthread_mutex_lock(&rec_lock);
+    Pending *p = *find_locked(ci->pid);
+    if (p != NULL) {
+        p->rec.out_bytes[stream - STDOUT_FILENO] += n;
+    }
+    pthread_mutex_unlock(&rec_lock);
+}
+
+// the size of an output the child wrote somewhere other than our pipes
+static uint64_t file_size(const ProcInfo *ci, int i) {
+    ProcComType t = i == 0 ? ci->stdout_type : ci->stderr_type;
+    const char *path = i == 0 ? ci->f_stdout : ci->f_stderr;
+    int fd = i == 0 ? ci->p_stdout : ci->p_stderr;
+    struct stat sb;
+
+    if (t == PROC_COM_PATH && path != NULL && stat(path, &sb) == 0) {
+        return sb.st_size;
+    }
+    if (t == PROC_COM_MEMFD && fd >= 0 && fstat(fd, &sb) == 0) {
+        return sb.st_size;
+    }
+    return 0;
+}
+
+void workload_reaped(const ProcInfo *ci, int status) {
+    if (!recording) {
+        return;
+    }
+    uint64_t sizes[2] = {file_size(ci, 0), file_size(ci, 1)};
+    uint64_t start = ns_of(&ci->t_start), end = ns_of(&ci->t_end);
+    pthread_mutex_lock(&rec_lock);
+    Pending **pp = find_locked(ci->pid), *p = *pp;
+    if (p == NULL || rec_out == NULL) {
+        pthread_mutex_unlock(&rec_lock);
+        return;
+    }
+    *pp = p->next;
+    WorkloadRecord *r = &p->rec;
+    r->runtime_ns = end > start ? end - start : 0;
+    r->status = status;
+    size_t len = strlen(r->name);
+    put_varint(rec_out, zigzag((int64_t)(r->start_ns - rec_prev)));
+    put_varint(rec_out, r->runtime_ns);
+    for (int i = 0; i < 2; i++) {
+        put_varint(rec_out, r->out_bytes[i] + sizes[i]);
+    }
+    put_varint(rec_out, zigzag(status));
+    put_varint(rec_out, r->types[0] | r->types[1] << 4 | r->types[2] << 8);
+    put_varint(rec_out, len);
+    fwrite(r->name, 1, len, rec_out);
+    rec_prev = r->start_ns;
+    pthread_mutex_unlock(&rec_lock);
+    free(p);
+}
+
+int open_WorkloadTrace(WorkloadTrace *t, const char *path) {
+    char magic[5];
+
+    memset(t, 0, sizeof(*t));
+    if ((t->in = fopen(path, "re")) == NULL) {
+        showError(false, "Cannot open workload trace %s: %s!", path, strerror(errno));
+        return 1;
+    }
+    if (fread(magic, 1, 5, t->in) != 5 || memcmp(magic, WORKLOAD_MAGIC, 4) != 0 ||
+            magic[4] != WORKLOAD_VERSION) {
+        showError(false, "%s is no workload trace of version %d!", path, WORKLOAD_VERSION);
+        close_WorkloadTrace(t);
+        return 1;
+    }
+    return 0;
+}
+
+// 1 with a value, 0 at a clean end of file, -1 cut short
+static int get_varint(FILE *f, uint64_t *v, bool first) {
+    int c, shift = 0;
+
+    *v = 0;
+    while ((c = getc(f)) != EOF) {
+        if (shift > 63) {
+            return -1;
+        }
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+        shift += 7;
+        first = false;
+    }
+    return first ? 0 : -1;
+}
+
+int next_WorkloadTrace(WorkloadTrace *t, WorkloadRecord *rec) {
+    uint64_t v[7];
+    int rc;
+
+    if ((rc = get_varint(t->in, &v[0], true)) <= 0) {
+        return rc;
+    }
+    for (int i = 1; i < 7; i++) {
+        if (get_varint(t->in, &v[i], false) <= 0) {
+            return -1;
+        }
+    }
+    memset(rec, 0, sizeof(*rec));
+    rec->start_ns = t->prev_start + (int64_t)((v[0] >> 1) ^ -(v[0] & 1));
+    rec->runtime_ns = v[1];
+    rec->out_bytes[0] = v[2];
+    rec->out_bytes[1] = v[3];
+    rec->status = (int)(int64_t)((v[4] >> 1) ^ -(v[4] & 1));
+    for (int i = 0; i < 3; i++) {
+        rec->types[i] = (v[5] >> (4 * i)) & 0xf;
+    }
+    if (v[6] >= sizeof(rec->name) || fread(rec->name, 1, v[6], t->in) != v[6]) {
+        return -1;
+    }
+    t->prev_start = rec->start_ns;
+    return 1;
+}
+
+void close_WorkloadTrace(WorkloadTrace *t) {
+    if (t->in != NULL) {
+        fclose(t->in);
+        t->in = NULL;
+    }
+}
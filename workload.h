@@ -0,0 +1,55 @@
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "subprocess.h"
+
+#define WORKLOAD_NAME_MAX 64    // argv[0] bytes kept, NUL included
+#define WORKLOAD_MAGIC "SPWL"
+#define WORKLOAD_VERSION 1
+
+// one child of a recorded workload
+typedef struct {
+    uint64_t start_ns;          // t_start, since the recording started
+    uint64_t runtime_ns;        // t_start until reap_ProcInfo()
+    // stdout, stderr: what the library's loops read of a pipe, the size
+    // of a PROC_COM_PATH file or a memfd at exit
+    uint64_t out_bytes[2];
+    int status;                 // wait status, -1 if reaped without one
+    ProcComType types[3];
+    char name[WORKLOAD_NAME_MAX];
+} WorkloadRecord;
+
+// the shape of production traffic, for replay offline: while recording,
+// every child subprocess() starts is remembered by pid and written out
+// once reap_ProcInfo() collected it (so in exit order, not start order)
+// as a few LEB128 varints, about 20 bytes plus its name. The hooks are one
+// branch while off; on, they take a lock, so keep it to capture runs.
+// The file starts with WORKLOAD_MAGIC and a version byte
+int start_workload_recording(const char *path);
+// write out what is buffered and close the file; children not reaped by
+// then are left out
+void stop_workload_recording(void);
+bool workload_recording(void);
+
+// hooks, called by subprocess.c and capture.c; for loops of your own
+void workload_spawned(const ProcInfo *ci, const char *name);
+void workload_read(const ProcInfo *ci, int stream, size_t n);
+void workload_reaped(const ProcInfo *ci, int status);
+
+// reads a recording back
+typedef struct {
+    FILE *in;
+    uint64_t prev_start;        // start_ns of the record before
+} WorkloadTrace;
+
+int open_WorkloadTrace(WorkloadTrace *t, const char *path);
+// 1 with the next record in rec, 0 at the end, -1 if the trace is cut short
+int next_WorkloadTrace(WorkloadTrace *t, WorkloadRecord *rec);
+void close_WorkloadTrace(WorkloadTrace *t);
+
+#endif // WORKLOAD_H
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "xargs.h"
+
+#ifndef MAX_ARG_STRLEN
+#define MAX_ARG_STRLEN (32 * 4096) // the kernel's cap on a single string
+#endif
+
+// execve() charges each string with its NUL and a pointer to it
+static size_t arg_cost(const char *s) {
+    return strlen(s) + 1 + sizeof(char *);
+}
+
+size_t arg_room_XArgs(char* env[]) {
+    long max = sysconf(_SC_ARG_MAX);
+    size_t used = sizeof(char *) * 2 + XARGS_HEADROOM; // both NULL terminators
+
+    if (max <= 0) {
+        max = _POSIX_ARG_MAX;
+    }
+    for (size_t i = 0; env != NULL && env[i] != NULL; i++) {
+        used += arg_cost(env[i]);
+    }
+    return (size_t)max > used ? (size_t)max - used : 0;
+}
+
+// how many items from i on fit in one batch after the prefix
+static size_t fit(const XArgs *x, char* items[], size_t i, size_t n, size_t prefix_cost, size_t max_args) {
+    size_t bytes = prefix_cost, k = 0;
+
+    for (; i + k < n && k < max_args; k++) {
+        size_t c = arg_cost(items[i + k]);
+        if (bytes + c > x->room || c - sizeof(char *) > MAX_ARG_STRLEN) {
+            break;
+        }
+        bytes += c;
+    }
+    return k;
+}
+
+int plan_XArgs(XArgs *x, char* prefix[], char* items[], size_t n, char* env[],
+        size_t max_args, size_t spread) {
+    size_t n_prefix = 0, prefix_cost = 0;
+
+    memset(x, 0, sizeof(*x));
+    x->room = arg_room_XArgs(env);
+    while (prefix[n_prefix] != NULL) {
+        prefix_cost += arg_cost(prefix[n_prefix++]);
+    }
+    if (spread > 1 && (max_args == 0 || max_args > (n + spread - 1) / spread)) {
+        max_args = (n + spread - 1) / spread;
+    }
+    if (max_args == 0) {
+        max_args = SIZE_MAX;
+    }
+    // first pass: how many batches, so both arrays are sized once
+    size_t n_jobs = 0;
+    for (size_t i = 0, k; i < n; i += k, n_jobs++) {
+        if ((k = fit(x, items, i, n, prefix_cost, max_args)) == 0) {
+            showError(false, "Argument %zu is too long for one command line!", i);
+            errno = E2BIG;
+            return 1;
+        }
+    }
+    x->jobs = calloc(n_jobs ? n_jobs : 1, sizeof(Job));
+    x->vecs = malloc((n + n_jobs * (n_prefix + 1) + 1) * sizeof(char *));
+    if (x->jobs == NULL || x->vecs == NULL) {
+        showError(false, "Failed to allocate %zu batches!", n_jobs);
+        free_XArgs(x);
+        errno = ENOMEM;
+        return 1;
+    }
+    char **v = x->vecs;
+    for (size_t i = 0, k; i < n; i += k, x->n_jobs++) {
+        k = fit(x, items, i, n, prefix_cost, max_args);
+        x->jobs[x->n_jobs].args = v;
+        memcpy(v, prefix, n_prefix * sizeof(char *));
+        memcpy(v + n_prefix, items + i, k * sizeof(char *));
+        v += n_prefix + k;
+        *v++ = NULL;
+    }
+    return 0;
+}
+
+size_t submit_XArgs(XArgs *x, JobRunner *r, const ProcInfo *proto, char* env[]) {
+    size_t failed = 0;
+
+    for (size_t i = 0; i < x->n_jobs; i++) {
+        Job *job = &x->jobs[i];
+        job->env = env;
+        job->ci = *proto;
+        if (submit_JobRunner(r, job)) {
+            failed++;
+        }
+    }
+    return failed;
+}
+
+void free_XArgs(XArgs *x) {
+    for (size_t i = 0; x->jobs != NULL && i < x->n_jobs; i++) {
+        free_CaptureResult(&x->jobs[i].out);
+    }
+    free(x->jobs);
+    free(x->vecs);
+    x->jobs = NULL;
+    x->vecs = NULL;
+    x->n_jobs = 0;
+}
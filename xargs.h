@@ -0,0 +1,33 @@
+#ifndef XARGS_H
+#define XARGS_H
+
+#include <stddef.h>
+
+#include "subprocess.h"
+#include "runner.h"
+
+#define XARGS_HEADROOM 2048     // bytes of ARG_MAX left unused, as POSIX xargs does
+
+// one command over many items, xargs style: prefix followed by as many
+// items as fit under ARG_MAX, so a million names take a few hundred spawns
+typedef struct {
+    Job *jobs;          // one per batch: args set, the rest for the caller
+    size_t n_jobs;
+    char **vecs;        // every batch's argv, back to back
+    size_t room;        // bytes of argv strings and pointers a batch may take
+} XArgs;
+
+// bytes left in ARG_MAX for argv once env and its pointers are counted
+size_t arg_room_XArgs(char* env[]);
+// split items (not copied, they must outlive x) into batches of at most
+// max_args (0 for no cap but ARG_MAX); with spread > 1 no batch takes more
+// than its share of n / spread, so every one of that many slots gets work.
+// 1 with E2BIG when prefix and an item alone don't fit
+int plan_XArgs(XArgs *x, char* prefix[], char* items[], size_t n, char* env[],
+    size_t max_args, size_t spread);
+// submit every batch with proto's streams and env, plan with spread set to
+// r->max_running to keep all of its slots busy; returns the number of batches that failed to submit
+size_t submit_XArgs(XArgs *x, JobRunner *r, const ProcInfo *proto, char* env[]);
+void free_XArgs(XArgs *x);
+
+#endif // XARGS_H